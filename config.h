@@ -232,6 +232,24 @@
 /* Define if we have a poll() that aborts when pollfds is null */
 /* #undef HAVE_POLL_THAT_ABORTS_WHEN_POLLFDS_IS_NULL */
 
+/* Define if we have close_range(2) (Linux-5.9+) */
+#define HAVE_CLOSE_RANGE 1
+
+/* Define if we have /proc/self/fd and getdents64(2) (Linux) */
+#define HAVE_PROC_SELF_FD 1
+
+/* Define if we have posix_spawn(3) */
+#define HAVE_POSIX_SPAWN 1
+
+/* Define if we have posix_spawn_file_actions_addclosefrom_np(3) (glibc-2.34+) */
+#define HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP 1
+
+/* Define if we have pidfd_open(2) (Linux-5.3+) */
+#define HAVE_PIDFD_OPEN 1
+
+/* Define if we have pthread_rwlockattr_setkind_np(3) (glibc) */
+#define HAVE_PTHREAD_RWLOCKATTR_SETKIND_NP 1
+
 #endif
 
 /* vi:set ts=4 sw=4: */
@@ -30,15 +30,30 @@ I<libslack(coproc)> - coprocess module
     #include <slack/std.h>
     #include <slack/coproc.h>
 
+    #define COPROC_POOL_LINE 0
+    #define COPROC_POOL_FRAMED 1
+    #define COPROC_POOL_MAX_RESPONSE (16 * 1024 * 1024)
+
+    typedef struct CoprocPool CoprocPool;
+    typedef void coproc_output_t(pid_t pid, int fd, const char *buf, size_t size, void *arg);
+    typedef void coproc_exit_t(pid_t pid, int status, void *arg);
+
     pid_t coproc_open(int *to, int *from, int *err, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data);
     int coproc_close(pid_t pid, int *to, int *from, int *err);
     pid_t coproc_pty_open(int *pty_user_fd, char *pty_device_name, size_t pty_device_name_size, const struct termios *pty_device_termios, const struct winsize *pty_device_winsize, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data);
     int coproc_pty_close(pid_t pid, int *pty_user_fd, const char *pty_device_name);
+    CoprocPool *coproc_pool_create(size_t size, int framing, const char *cmd, char * const *argv, char * const *envv);
+    void coproc_pool_release(CoprocPool *pool);
+    void *coproc_pool_destroy(CoprocPool **pool);
+    ssize_t coproc_pool_request(CoprocPool *pool, const char *req, size_t reqlen, char **rsp, long msec);
+    pid_t coproc_async_open(Agent *agent, int *to, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data, coproc_output_t *output, coproc_exit_t *exited, void *arg);
 
 =head1 DESCRIPTION
 
 This module contains functions for creating coprocesses that use either
-pipes or pseudo terminals for communication.
+pipes or pseudo terminals for communication, for maintaining pools of
+long-lived coprocesses that service requests over pipes, and for supervising
+coprocesses asynchronously with an I<agent(3)>.
 
 =over 4
 
@@ -54,15 +69,43 @@ pipes or pseudo terminals for communication.
 #define _DEFAULT_SOURCE /* New name for _BSD_SOURCE */
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* For posix_spawn_file_actions_addclosefrom_np() on Linux */
+#endif
+
 #include "config.h"
 #include "std.h"
 
 #include <sys/wait.h>
+#include <sys/time.h>
+#ifdef HAVE_POLL
+#if HAVE_POLL_H
+#include <poll.h>
+#elif HAVE_SYS_POLL_H
+#include <sys/poll.h>
+#endif
+#elif HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+
+#if defined(HAVE_POSIX_SPAWN) && defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP)
+#define COPROC_SPAWN 1
+#include <spawn.h>
+#endif
+
+#if defined(HAVE_PIDFD_OPEN)
+#include <sys/syscall.h>
+#if defined(SYS_pidfd_open)
+#define COPROC_PIDFD 1
+#endif
+#endif
 
 #include "coproc.h"
 #include "daemon.h"
 #include "pseudo.h"
 #include "err.h"
+#include "fio.h"
+#include "mem.h"
 
 #ifndef HAVE_SNPRINTF
 #include "snprintf.h"
@@ -84,9 +127,336 @@ extern char **environ;
 #define DEFAULT_USER_PATH ":/bin:/usr/bin"
 #endif
 
+#ifndef COPROC_PATH_CACHE_SIZE
+#define COPROC_PATH_CACHE_SIZE 16
+#endif
+
 #define RD 0
 #define WR 1
 
+typedef struct CoprocAsync CoprocAsync;
+
+struct CoprocAsync
+{
+	pid_t pid;               /* process id of the coprocess */
+	int from;                /* pipe for reading from the coprocess (-1 after eof) */
+	int err;                 /* pipe for reading errors from the coprocess (-1 after eof) */
+	int pidfd;               /* pidfd for the coprocess (-1 if unavailable or reaped) */
+	int reaped;              /* has the coprocess been reaped? */
+	int status;              /* exit status of the coprocess */
+	long backoff;            /* microseconds until next check (when polling) */
+	coproc_output_t *output; /* called when output arrives */
+	coproc_exit_t *exited;   /* called when the coprocess has terminated */
+	void *arg;               /* argument for the callbacks */
+};
+
+typedef struct CoprocWorker CoprocWorker;
+
+struct CoprocWorker
+{
+	pid_t pid;       /* process id of the coprocess (-1 if not running) */
+	int to;          /* pipe for writing to the coprocess */
+	int from;        /* pipe for reading from the coprocess */
+	int err;         /* pipe for reading errors from the coprocess */
+	int busy;        /* is a request in progress? */
+	char *pending;   /* bytes read after the end of the last response */
+	size_t pending_length; /* number of pending bytes */
+};
+
+struct CoprocPool
+{
+	pthread_mutex_t lock;  /* mutex lock for the busy flags */
+	pthread_cond_t idle;   /* signalled when a worker becomes idle */
+	int framing;           /* COPROC_POOL_LINE or COPROC_POOL_FRAMED */
+	size_t size;           /* number of workers */
+	size_t next;           /* index of the next worker to try */
+	CoprocWorker *workers; /* the workers */
+	char *cmd;             /* the command for (re)starting workers */
+	char **argv;           /* the argument vector for (re)starting workers */
+	char **envv;           /* the environment for (re)starting workers */
+};
+
+#ifdef COPROC_SPAWN
+
+typedef struct CoprocPath CoprocPath;
+
+struct CoprocPath
+{
+	char *cmd;      /* The command name as passed to coproc_open() */
+	char *path;     /* The value of $PATH when cmd was resolved */
+	char *resolved; /* The path that cmd resolved to */
+};
+
+static struct
+{
+	pthread_mutex_t lock;                     /* Mutex lock for structure */
+	CoprocPath cache[COPROC_PATH_CACHE_SIZE]; /* Recently resolved commands */
+	int next;                                 /* Next cache entry to replace */
+}
+g =
+{
+	PTHREAD_MUTEX_INITIALIZER
+};
+
+#endif
+
+static char * const *new_shargv(const char *cmd, char * const *argv)
+{
+	char **shargv;
+	int nargs = 0;
+
+	while (argv[nargs])
+		++nargs;
+
+	if (!(shargv = malloc((nargs + 2) * sizeof(char **))))
+		return NULL;
+
+	shargv[0] = "/bin/sh";
+	shargv[1] = (char *)cmd;
+
+	for (nargs = 1; argv[nargs]; ++nargs)
+		shargv[nargs + 1] = argv[nargs];
+
+	shargv[nargs + 1] = NULL;
+
+	return (char * const *)shargv;
+}
+
+#ifdef COPROC_SPAWN
+
+/*
+
+C<int path_cache_get(const char *cmd, const char *path, char *buf, size_t size)>
+
+Looks for C<cmd> in the cache of commands that were recently found by
+searching C<path>. If found, the resolved path is copied into C<buf> (of
+C<size> bytes) and C<1> is returned. Otherwise, returns C<0>.
+
+*/
+
+static int path_cache_get(const char *cmd, const char *path, char *buf, size_t size)
+{
+	int found = 0;
+	int i;
+
+	if (pthread_mutex_lock(&g.lock))
+		return 0;
+
+	for (i = 0; i < COPROC_PATH_CACHE_SIZE; ++i)
+	{
+		CoprocPath *entry = &g.cache[i];
+
+		if (entry->cmd && !strcmp(entry->cmd, cmd) && !strcmp(entry->path, path) && strlen(entry->resolved) < size)
+		{
+			strcpy(buf, entry->resolved);
+			found = 1;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&g.lock);
+
+	return found;
+}
+
+/*
+
+C<void path_cache_release(CoprocPath *entry)>
+
+Releases the memory held by a cache entry and marks it as unused.
+
+*/
+
+static void path_cache_release(CoprocPath *entry)
+{
+	free(entry->cmd);
+	free(entry->path);
+	free(entry->resolved);
+	entry->cmd = entry->path = entry->resolved = NULL;
+}
+
+/*
+
+C<void path_cache_set(const char *cmd, const char *path, const char *resolved)>
+
+Records that searching C<path> for C<cmd> found C<resolved>. If C<resolved>
+is C<null>, forgets any existing record instead. The oldest record is
+replaced when the cache is full.
+
+*/
+
+static void path_cache_set(const char *cmd, const char *path, const char *resolved)
+{
+	CoprocPath *entry;
+	int i;
+
+	if (pthread_mutex_lock(&g.lock))
+		return;
+
+	for (i = 0; i < COPROC_PATH_CACHE_SIZE; ++i)
+		if (g.cache[i].cmd && !strcmp(g.cache[i].cmd, cmd) && !strcmp(g.cache[i].path, path))
+			path_cache_release(&g.cache[i]);
+
+	if (resolved)
+	{
+		entry = &g.cache[g.next];
+		g.next = (g.next + 1) % COPROC_PATH_CACHE_SIZE;
+		path_cache_release(entry);
+
+		if (!(entry->cmd = malloc(strlen(cmd) + 1)) || !(entry->path = malloc(strlen(path) + 1)) || !(entry->resolved = malloc(strlen(resolved) + 1)))
+			path_cache_release(entry);
+		else
+		{
+			strcpy(entry->cmd, cmd);
+			strcpy(entry->path, path);
+			strcpy(entry->resolved, resolved);
+		}
+	}
+
+	pthread_mutex_unlock(&g.lock);
+}
+
+/*
+
+C<int spawn_file(pid_t *pid, const char *file, char * const *argv, char * const *envv, const posix_spawn_file_actions_t *actions)>
+
+Spawns C<file> with I<posix_spawn(3)>. If the header of C<file> isn't
+recognised (C<ENOEXEC>), then C</bin/sh> is spawned with C<file> as its
+first argument instead (like I<do_exec()>). Returns the same as
+I<posix_spawn(3)>.
+
+*/
+
+static int spawn_file(pid_t *pid, const char *file, char * const *argv, char * const *envv, const posix_spawn_file_actions_t *actions)
+{
+	char * const *shargv;
+	int rc;
+
+	if ((rc = posix_spawn(pid, file, actions, NULL, argv, envv)) != ENOEXEC)
+		return rc;
+
+	if (!(shargv = new_shargv(file, argv)))
+		return ENOMEM;
+
+	rc = posix_spawn(pid, "/bin/sh", actions, NULL, shargv, envv);
+	free((void *)shargv);
+
+	return rc;
+}
+
+/*
+
+C<int do_spawn(pid_t *pid, int has_meta, const char *cmd, char * const *argv, char * const *envv, const posix_spawn_file_actions_t *actions)>
+
+The I<posix_spawn(3)> equivalent of I<do_exec()>. The difference is that
+the C<PATH> search is performed in the parent process, and its result is
+cached so that subsequent coprocesses running the same command don't need
+to search again (until C<PATH> changes, or the cached path fails). On
+success, returns C<0>. On error, returns an error code (as for
+I<posix_spawn(3)>).
+
+*/
+
+static int do_spawn(pid_t *pid, int has_meta, const char *cmd, char * const *argv, char * const *envv, const posix_spawn_file_actions_t *actions)
+{
+	char *path, *s, *f;
+	char cmdbuf[512];
+	int rc = ENOENT;
+
+	if (!envv)
+		envv = environ;
+
+	if (has_meta)
+	{
+		char const *shargv[4];
+
+		shargv[0] = "sh";
+		shargv[1] = "-c";
+		shargv[2] = cmd;
+		shargv[3] = NULL;
+
+		return posix_spawn(pid, "/bin/sh", actions, NULL, (char * const *)shargv, envv);
+	}
+
+	if (strchr(cmd, PATH_SEP))
+		return spawn_file(pid, cmd, argv, envv, actions);
+
+	if (!(path = getenv("PATH")))
+		path = geteuid() ? DEFAULT_USER_PATH : DEFAULT_ROOT_PATH;
+
+	if (path_cache_get(cmd, path, cmdbuf, 512))
+	{
+		if ((rc = spawn_file(pid, cmdbuf, argv, envv, actions)) == 0)
+			return 0;
+
+		path_cache_set(cmd, path, NULL);
+	}
+
+	for (s = path; s; s = (*f) ? f + 1 : NULL)
+	{
+		if (!(f = strchr(s, PATH_LIST_SEP)))
+			f = s + strlen(s);
+
+		if (snprintf(cmdbuf, 512, "%.*s%s%s", (int)(f - s), s, (f - s) ? PATH_SEP_STR : "", cmd) >= 512)
+			continue;
+
+		if ((rc = posix_spawn(pid, cmdbuf, actions, NULL, argv, envv)) == 0)
+		{
+			/* Don't cache relative paths, they depend on the current directory */
+
+			if (*cmdbuf == PATH_SEP)
+				path_cache_set(cmd, path, cmdbuf);
+
+			return 0;
+		}
+
+		if (rc == ENOEXEC)
+			return spawn_file(pid, cmdbuf, argv, envv, actions);
+	}
+
+	return rc;
+}
+
+/*
+
+C<pid_t coproc_spawn(int has_meta, const char *cmd, char * const *argv, char * const *envv, int *to_pipe, int *from_pipe, int *err_pipe)>
+
+Starts a coprocess with I<posix_spawn(3)> rather than I<fork(2)> and
+I<execve(2)>. The pipes are attached to C<stdin>, C<stdout> and C<stderr>
+(and all other descriptors are closed) with spawn file actions. With
+I<glibc>, I<posix_spawn(3)> uses C<clone(CLONE_VM | CLONE_VFORK)> so the
+parent's page tables are not copied, which makes this much faster than
+I<fork(2)> when the parent process is large. On success, returns the process
+id of the coprocess. On error, returns C<-1> with C<errno> set
+appropriately.
+
+*/
+
+static pid_t coproc_spawn(int has_meta, const char *cmd, char * const *argv, char * const *envv, int *to_pipe, int *from_pipe, int *err_pipe)
+{
+	posix_spawn_file_actions_t actions[1];
+	pid_t pid;
+	int rc;
+
+	if ((rc = posix_spawn_file_actions_init(actions)))
+		return set_errno(rc);
+
+	if (!(rc = posix_spawn_file_actions_adddup2(actions, to_pipe[RD], STDIN_FILENO)) &&
+		!(rc = posix_spawn_file_actions_adddup2(actions, from_pipe[WR], STDOUT_FILENO)) &&
+		!(rc = posix_spawn_file_actions_adddup2(actions, err_pipe[WR], STDERR_FILENO)) &&
+		!(rc = posix_spawn_file_actions_addclosefrom_np(actions, STDERR_FILENO + 1)))
+		rc = do_spawn(&pid, has_meta, cmd, argv, envv, actions);
+
+	posix_spawn_file_actions_destroy(actions);
+
+	if (rc)
+		return set_errno(rc);
+
+	return pid;
+}
+
+#endif
+
 /*
 
 =item C<pid_t coproc_open(int *to, int *from, int *err, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data)>
@@ -118,8 +488,19 @@ is invoked before the pipes are duplicated onto C<stdin>, C<stdout> and
 C<stderr>. I<data> is passed as the argument to I<action>. This is useful
 when you need to prevent the coprocess from inheriting certain process
 attributes. It can be used to ignore signals, set default signal handlers,
-modify the signal mask and close files. On success, returns the process id
-of the coprocess. On error, returns C<-1> with C<errno> set appropriately.
+modify the signal mask and close files. If C<action> is C<null> (and the
+system has I<posix_spawn(3)>), the coprocess is started with
+I<posix_spawn(3)> rather than I<fork(2)> which avoids copying the page
+tables of a large parent process. In that case, the C<PATH> search is
+performed in the parent process, and the result is cached (like a shell's
+hash table) until C<PATH> changes or the cached path stops working. If
+I<posix_spawn(3)> fails, I<fork(2)> is used instead. Before C<action> is
+invoked, all file descriptors other than C<stdin>, C<stdout> and C<stderr>
+that the child process inherited are marked close-on-exec with
+I<cloexec_from(3)>, so the coprocess doesn't inherit them. If the coprocess
+should inherit a particular file descriptor, C<action> can clear its
+C<FD_CLOEXEC> flag. On success, returns the process id of the coprocess. On
+error, returns C<-1> with C<errno> set appropriately.
 
 Note: That this can only be used with coprocesses that do not buffer I/O or
 that explicitly set line buffering (or no buffering) with I<setbuf(3)> or
@@ -136,28 +517,6 @@ execute.>
 
 */
 
-static char * const *new_shargv(const char *cmd, char * const *argv)
-{
-	char **shargv;
-	int nargs = 0;
-
-	while (argv[nargs])
-		++nargs;
-
-	if (!(shargv = malloc((nargs + 2) * sizeof(char **))))
-		return NULL;
-
-	shargv[0] = "/bin/sh";
-	shargv[1] = (char *)cmd;
-
-	for (nargs = 1; argv[nargs]; ++nargs)
-		shargv[nargs + 1] = argv[nargs];
-
-	shargv[nargs + 1] = NULL;
-
-	return (char * const *)shargv;
-}
-
 static void do_exec(int has_meta, const char *cmd, char * const *argv, char * const *envv)
 {
 	if (has_meta)
@@ -254,9 +613,20 @@ pid_t coproc_open(int *to, int *from, int *err, const char *cmd, char * const *a
 		return -1;
 	}
 
-	/* Create child process */
+	/*
+	** Create child process. If there's no action to perform in the child,
+	** try posix_spawn() first to avoid copying our page tables. If that
+	** fails (e.g. the command isn't found), fall back to fork() so that
+	** failures are reported in the same way (i.e. by the child's exit
+	** status).
+	*/
+
+#ifdef COPROC_SPAWN
+	if (action || (pid = coproc_spawn(has_meta, cmd, argv, envv, to_pipe, from_pipe, err_pipe)) == -1)
+#endif
+		pid = fork();
 
-	switch (pid = fork())
+	switch (pid)
 	{
 		case -1:
 		{
@@ -271,6 +641,10 @@ pid_t coproc_open(int *to, int *from, int *err, const char *cmd, char * const *a
 
 		case 0:
 		{
+			/* Don't leak the parent's file descriptors into the coprocess */
+
+			cloexec_from(STDERR_FILENO + 1);
+
 			/* Adjust process attributes */
 
 			if (action)
@@ -366,123 +740,1087 @@ int coproc_close(pid_t pid, int *to, int *from, int *err)
 		*from = -1;
 	}
 
-	if (err && *err != -1)
+	if (err && *err != -1)
+	{
+		close(*err);
+		*err = -1;
+	}
+
+	if (waitpid(pid, &status, 0) == -1)
+		return -1;
+
+	return status;
+}
+
+/*
+
+=item C<pid_t coproc_pty_open(int *pty_user_fd, char *pty_device_name, size_t pty_device_name_size, const struct termios *pty_device_termios, const struct winsize *pty_device_winsize, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data)>
+
+Equivalent to I<coproc_open(3)> except that communication with the coprocess
+occurs over a pseudo terminal. This is useful when the coprocess uses
+standard I/O, and you don't have the source code. Standard I/O is fully
+buffered unless connected to a terminal. C<*pty_user_fd> is set to the user
+(or controlling process) side of a pseudo terminal. Data written to
+C<*pty_user_fd> can be read from the standard input of the coprocess. Data
+written to the standard output or standard error of the coprocess can be
+read from C<*pty_user_fd>. The device name of the coprocess side of the
+pseudo terminal is stored in the buffer pointed to by C<pty_device_name>
+which must be able to store at least 64 bytes. C<pty_device_name_size> is
+the size of the buffer pointed to by C<pty_device_name>. No more than
+C<pty_device_name_size> bytes will be written into the buffer pointed to by
+C<pty_device_name> including the terminating C<nul> byte. If
+C<pty_device_termios> is not null, it is passed to I<tcsetattr(3)> with the
+command C<TCSANOW> to set the terminal attributes of the device on the
+coprocess side of the pseudo terminal. If C<pty_device_winsize> is not null,
+it is passed to I<ioctl(2)> with the command C<TIOCSWINSZ> to set the window
+size of the device on the coprocess side of the pseudo terminal. As with
+I<coproc_open(3)>, inherited file descriptors other than C<stdin>,
+C<stdout> and C<stderr> are marked close-on-exec (by I<pty_fork(3)>) before
+C<action> is invoked. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+pid_t coproc_pty_open(int *pty_user_fd, char *pty_device_name, size_t pty_device_name_size, const struct termios *pty_device_termios, const struct winsize *pty_device_winsize, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data)
+{
+	pid_t pid;        /* process id of the coprocess */
+	int has_meta;     /* does cmd contain shell meta characters? */
+
+	/* Check arguments */
+
+	if (!pty_user_fd || !pty_device_name || pty_device_name_size < 64 || !cmd)
+		return set_errno(EINVAL);
+
+	has_meta = (cmd[strcspn(cmd, SHELL_META_CHARACTERS)] != '\0');
+
+	if ((has_meta && argv) || (!has_meta && !argv))
+		return set_errno(EINVAL);
+
+	/* Create pty and child process */
+
+	switch (pid = pty_fork(pty_user_fd, pty_device_name, pty_device_name_size, pty_device_termios, pty_device_winsize))
+	{
+		case -1:
+			return -1;
+
+		case 0:
+		{
+			/* Adjust process attributes */
+
+			if (action)
+				action(data);
+
+			/* Execute co-process */
+
+			do_exec(has_meta, cmd, argv, envv);
+			_exit(EXIT_FAILURE);
+		}
+
+		default:
+			return pid;
+	}
+}
+
+/*
+
+=item C<int coproc_pty_close(pid_t pid, int *pty_user_fd, const char *pty_device_name)>
+
+Closes the coprocess referred to by C<pid> which must have been obtained
+from I<coproc_pty_open(3)>. The coprocess side of the pseudo terminal is
+released with I<pty_release(3)> and C<*pty_user_fd> is closed and set to
+C<-1> if it is not already C<-1>. The current process will then wait for the
+coprocess to terminate by calling I<waitpid(2)>. On success, returns the
+status of the child process as determined by I<waitpid(2)>. On error,
+returns C<-1> with C<errno> set appropriately. B<Note:> If I<waitpid(2)> is
+interrupted by a signal, I<coproc_close(3)> will return C<-1> with C<errno>
+set to C<EINTR>. The caller has to call I<coproc_close(3)> (or just
+I<waitpid(2)>) again until it succeeds (or until a real error occurs).
+
+=cut
+
+*/
+
+int coproc_pty_close(pid_t pid, int *pty_user_fd, const char *pty_device_name)
+{
+	int status = 0;
+
+	if (pid <= 0)
+		return set_errno(EINVAL);
+
+	if (pty_user_fd && *pty_user_fd != -1)
+	{
+		pty_release(pty_device_name);
+		close(*pty_user_fd);
+		*pty_user_fd = -1;
+	}
+
+	if (waitpid(pid, &status, 0) == -1)
+		return -1;
+
+	return status;
+}
+
+/*
+
+C<int pool_copy_vector(char ***dst, char * const *src)>
+
+Makes a deep copy of the null-terminated string vector C<src> in C<*dst> so
+that workers can be restarted after the caller's vector has gone. If C<src>
+is C<null>, C<*dst> is set to C<null>. On success, returns C<0>. On error,
+returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int pool_copy_vector(char ***dst, char * const *src)
+{
+	size_t n, i;
+
+	*dst = NULL;
+
+	if (!src)
+		return 0;
+
+	for (n = 0; src[n]; ++n)
+	{}
+
+	if (!(*dst = mem_create(n + 1, char *)))
+		return -1;
+
+	for (i = 0; i < n; ++i)
+	{
+		if (!((*dst)[i] = mem_strdup(src[i])))
+		{
+			while (i--)
+				mem_release((*dst)[i]);
+
+			mem_destroy(dst);
+			return -1;
+		}
+	}
+
+	(*dst)[n] = NULL;
+
+	return 0;
+}
+
+/*
+
+C<void pool_release_vector(char **vec)>
+
+Releases a string vector created by I<pool_copy_vector()>.
+
+*/
+
+static void pool_release_vector(char **vec)
+{
+	size_t i;
+
+	if (!vec)
+		return;
+
+	for (i = 0; vec[i]; ++i)
+		mem_release(vec[i]);
+
+	mem_release(vec);
+}
+
+/*
+
+C<int pool_worker_start(CoprocPool *pool, CoprocWorker *worker)>
+
+Starts the coprocess for C<worker> and makes its pipes non-blocking. Any
+bytes left over from a previous coprocess are discarded. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+*/
+
+static int pool_worker_start(CoprocPool *pool, CoprocWorker *worker)
+{
+	mem_release(worker->pending);
+	worker->pending = NULL;
+	worker->pending_length = 0;
+
+	if ((worker->pid = coproc_open(&worker->to, &worker->from, &worker->err, pool->cmd, pool->argv, pool->envv, NULL, NULL)) == -1)
+		return -1;
+
+	if (nonblock_on(worker->to) == -1 || nonblock_on(worker->from) == -1 || nonblock_on(worker->err) == -1)
+	{
+		int errno_save = errno;
+		kill(worker->pid, SIGKILL);
+		coproc_close(worker->pid, &worker->to, &worker->from, &worker->err);
+		worker->pid = -1;
+		return set_errno(errno_save);
+	}
+
+	return 0;
+}
+
+/*
+
+C<void pool_worker_stop(CoprocWorker *worker, int signo)>
+
+Closes the pipes of C<worker>, sends it the signal C<signo>, and waits for
+it to terminate. Any pending bytes are discarded.
+
+*/
+
+static void pool_worker_stop(CoprocWorker *worker, int signo)
+{
+	mem_release(worker->pending);
+	worker->pending = NULL;
+	worker->pending_length = 0;
+
+	if (worker->pid == -1)
+		return;
+
+	kill(worker->pid, signo);
+
+	while (coproc_close(worker->pid, &worker->to, &worker->from, &worker->err) == -1 && errno == EINTR)
+	{}
+
+	worker->pid = -1;
+}
+
+/*
+
+C<long pool_remaining(const struct timeval *deadline)>
+
+Returns the number of milliseconds until C<deadline>, or C<-1> if
+C<deadline> is C<null> (i.e. there is no deadline). Returns C<0> when the
+deadline has passed.
+
+*/
+
+static long pool_remaining(const struct timeval *deadline)
+{
+	struct timeval now[1];
+	long msec;
+
+	if (!deadline)
+		return -1;
+
+	if (gettimeofday(now, NULL) == -1)
+		return 0;
+
+	msec = (deadline->tv_sec - now->tv_sec) * 1000 + (deadline->tv_usec - now->tv_usec) / 1000;
+
+	return (msec > 0) ? msec : 0;
+}
+
+/*
+
+C<int pool_wait(CoprocWorker *worker, int fd, int for_write, const struct timeval *deadline)>
+
+Waits until C<fd> (one of C<worker>'s pipes) is readable or writable (if
+C<for_write> is non-zero), or until C<deadline>. Anything that the worker
+writes to its standard error in the meantime is discarded so that it can't
+block. On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately (C<ETIMEDOUT> when the deadline passes).
+
+*/
+
+static int pool_wait(CoprocWorker *worker, int fd, int for_write, const struct timeval *deadline)
+{
+	char junk[BUFSIZ];
+
+	for (;;)
+	{
+		long msec = pool_remaining(deadline);
+
+		if (msec == 0 && deadline)
+			return set_errno(ETIMEDOUT);
+
+#ifdef HAVE_POLL
+		{
+			struct pollfd pfds[2];
+
+			pfds[0].fd = fd;
+			pfds[0].events = (for_write) ? POLLOUT : POLLIN;
+			pfds[0].revents = 0;
+			pfds[1].fd = worker->err;
+			pfds[1].events = POLLIN;
+			pfds[1].revents = 0;
+
+			if ((poll(pfds, (worker->err != -1) ? 2 : 1, (int)msec)) == -1)
+			{
+				if (errno == EINTR)
+					continue;
+
+				return -1;
+			}
+
+			if ((pfds[1].revents & (POLLIN | POLLHUP)) && read(worker->err, junk, BUFSIZ) <= 0)
+			{
+				close(worker->err);
+				worker->err = -1;
+			}
+
+			if (pfds[0].revents)
+				return 0;
+		}
+#else
+		{
+			struct timeval tv[1];
+			fd_set rfds[1], wfds[1];
+			int maxfd = (fd > worker->err) ? fd : worker->err;
+
+			FD_ZERO(rfds);
+			FD_ZERO(wfds);
+			FD_SET(fd, (for_write) ? wfds : rfds);
+
+			if (worker->err != -1)
+				FD_SET(worker->err, rfds);
+
+			if (msec != -1)
+			{
+				tv->tv_sec = msec / 1000;
+				tv->tv_usec = (msec % 1000) * 1000;
+			}
+
+			if ((select(maxfd + 1, rfds, wfds, NULL, (msec == -1) ? NULL : tv)) == -1)
+			{
+				if (errno == EINTR)
+					continue;
+
+				return -1;
+			}
+
+			if (worker->err != -1 && FD_ISSET(worker->err, rfds) && read(worker->err, junk, BUFSIZ) == 0)
+			{
+				close(worker->err);
+				worker->err = -1;
+			}
+
+			if (FD_ISSET(fd, (for_write) ? wfds : rfds))
+				return 0;
+		}
+#endif
+	}
+}
+
+/*
+
+C<int pool_write(CoprocWorker *worker, const char *buf, size_t size, const struct timeval *deadline)>
+
+Writes C<size> bytes from C<buf> to C<worker> before C<deadline>. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+*/
+
+static int pool_write(CoprocWorker *worker, const char *buf, size_t size, const struct timeval *deadline)
+{
+	ssize_t bytes;
+
+	while (size)
+	{
+		if (pool_wait(worker, worker->to, 1, deadline) == -1)
+			return -1;
+
+		if ((bytes = write(worker->to, buf, size)) == -1)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+
+			return -1;
+		}
+
+		buf += bytes;
+		size -= bytes;
+	}
+
+	return 0;
+}
+
+/*
+
+C<ssize_t pool_read(CoprocWorker *worker, char *buf, size_t size, const struct timeval *deadline)>
+
+Reads up to C<size> bytes from C<worker> into C<buf> before C<deadline>.
+On success, returns the number of bytes read (at least C<1>). On error,
+returns C<-1> with C<errno> set appropriately (C<EPIPE> if the worker closed
+its standard output).
+
+*/
+
+static ssize_t pool_read(CoprocWorker *worker, char *buf, size_t size, const struct timeval *deadline)
+{
+	ssize_t bytes;
+
+	for (;;)
+	{
+		if (pool_wait(worker, worker->from, 0, deadline) == -1)
+			return -1;
+
+		if ((bytes = read(worker->from, buf, size)) == -1)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+
+			return -1;
+		}
+
+		if (bytes == 0)
+			return set_errno(EPIPE);
+
+		return bytes;
+	}
+}
+
+/*
+
+C<ssize_t pool_transact(CoprocPool *pool, CoprocWorker *worker, const char *req, size_t reqlen, char **rsp, const struct timeval *deadline)>
+
+Sends a request to C<worker> and receives its response using the pool's
+framing. With C<COPROC_POOL_LINE>, anything read after the newline is kept
+in the worker's pending bytes, and is the start of its next response. On
+success, returns the length of the response which is stored in C<*rsp>. On
+error, returns C<-1> with C<errno> set appropriately (C<EMSGSIZE> if the
+response is longer than C<COPROC_POOL_MAX_RESPONSE>). After an error, the
+state of the worker's pipes is unknown.
+
+*/
+
+static ssize_t pool_transact(CoprocPool *pool, CoprocWorker *worker, const char *req, size_t reqlen, char **rsp, const struct timeval *deadline)
+{
+	size_t length = 0, size = 0, scanned, rest, want;
+	unsigned char hdr[4];
+	char *buf = NULL, *nl;
+	ssize_t bytes;
+
+	if (pool->framing == COPROC_POOL_FRAMED)
+	{
+		if (reqlen > 0xffffffffUL)
+			return set_errno(EMSGSIZE);
+
+		hdr[0] = (reqlen >> 24) & 0xff;
+		hdr[1] = (reqlen >> 16) & 0xff;
+		hdr[2] = (reqlen >> 8) & 0xff;
+		hdr[3] = reqlen & 0xff;
+
+		if (pool_write(worker, (char *)hdr, 4, deadline) == -1 || pool_write(worker, req, reqlen, deadline) == -1)
+			return -1;
+
+		for (length = 0; length < 4; length += bytes)
+			if ((bytes = pool_read(worker, (char *)hdr + length, 4 - length, deadline)) == -1)
+				return -1;
+
+		want = ((size_t)hdr[0] << 24) | ((size_t)hdr[1] << 16) | ((size_t)hdr[2] << 8) | (size_t)hdr[3];
+
+		if (want > COPROC_POOL_MAX_RESPONSE)
+			return set_errno(EMSGSIZE);
+
+		if (!(buf = mem_create(want + 1, char)))
+			return -1;
+
+		for (length = 0; length < want; length += bytes)
+		{
+			if ((bytes = pool_read(worker, buf + length, want - length, deadline)) == -1)
+			{
+				mem_release(buf);
+				return -1;
+			}
+		}
+	}
+	else
+	{
+		if (pool_write(worker, req, reqlen, deadline) == -1)
+			return -1;
+
+		if ((!reqlen || req[reqlen - 1] != '\n') && pool_write(worker, "\n", 1, deadline) == -1)
+			return -1;
+
+		/* Start with anything read after the end of the previous response */
+
+		buf = worker->pending;
+		size = length = worker->pending_length;
+		worker->pending = NULL;
+		worker->pending_length = 0;
+
+		for (scanned = 0; !(nl = (length > scanned) ? memchr(buf + scanned, '\n', length - scanned) : NULL); )
+		{
+			scanned = length;
+
+			if (length >= COPROC_POOL_MAX_RESPONSE)
+			{
+				mem_release(buf);
+				return set_errno(EMSGSIZE);
+			}
+
+			if (size - length < 128)
+			{
+				while (size - length < 128)
+					size = (size) ? size * 2 : 256;
+
+				if (!mem_resize(&buf, size))
+				{
+					mem_release(buf);
+					return -1;
+				}
+			}
+
+			if ((bytes = pool_read(worker, buf + length, size - length - 1, deadline)) == -1)
+			{
+				mem_release(buf);
+				return -1;
+			}
+
+			length += bytes;
+		}
+
+		/* Keep anything after the newline for the next response */
+
+		if ((rest = length - (nl - buf) - 1))
+		{
+			if (!(worker->pending = mem_create(rest, char)))
+			{
+				mem_release(buf);
+				return -1;
+			}
+
+			memcpy(worker->pending, nl + 1, rest);
+			worker->pending_length = rest;
+		}
+
+		length = nl - buf;
+	}
+
+	buf[length] = '\0';
+	*rsp = buf;
+
+	return length;
+}
+
+/*
+
+=item C<CoprocPool *coproc_pool_create(size_t size, int framing, const char *cmd, char * const *argv, char * const *envv)>
+
+Creates a pool of C<size> long-lived coprocesses that all run the same
+command. C<cmd>, C<argv> and C<envv> are as for I<coproc_open(3)> (they are
+copied so that workers can be restarted later). Requests are sent to the
+coprocesses with I<coproc_pool_request(3)>, which avoids the cost of
+creating a new process for every request. C<framing> determines how
+requests and responses are delimited on the pipes. If it is
+C<COPROC_POOL_LINE>, each request is a line of text (a newline is appended
+if necessary), and each response is a single line of text. If a coprocess
+writes more than one line, the extra lines are the responses to its
+following requests (nothing it writes is discarded). If it is
+C<COPROC_POOL_FRAMED>, each request and response is preceded by its length
+as a 4-byte unsigned integer in network byte order. Responses longer than
+C<COPROC_POOL_MAX_RESPONSE> bytes (16MiB) are rejected. The coprocesses must
+not buffer their output (see I<coproc_open(3)>). Anything they write to
+their standard error is discarded. On success, returns the new pool. On
+error, returns C<null> with C<errno> set appropriately. It is the caller's
+responsibility to deallocate the new pool with I<coproc_pool_release(3)> or
+I<coproc_pool_destroy(3)>. It is strongly recommended to use
+I<coproc_pool_destroy(3)>, because it also sets the pointer variable to
+C<null>.
+
+Note: Writing to a coprocess that has terminated raises C<SIGPIPE>. Callers
+should ignore C<SIGPIPE> so that this is reported as an error instead, and
+the coprocess is restarted.
+
+=cut
+
+*/
+
+CoprocPool *coproc_pool_create(size_t size, int framing, const char *cmd, char * const *argv, char * const *envv)
+{
+	CoprocPool *pool;
+	int has_meta;
+	size_t i;
+
+	if (!size || (framing != COPROC_POOL_LINE && framing != COPROC_POOL_FRAMED) || !cmd)
+		return set_errnull(EINVAL);
+
+	has_meta = (cmd[strcspn(cmd, SHELL_META_CHARACTERS)] != '\0');
+
+	if ((has_meta && argv) || (!has_meta && !argv))
+		return set_errnull(EINVAL);
+
+	if (!(pool = mem_new(CoprocPool)))
+		return NULL;
+
+	memset(pool, 0, sizeof(CoprocPool));
+	pool->size = size;
+	pool->framing = framing;
+
+	if (pthread_mutex_init(&pool->lock, NULL))
+	{
+		mem_release(pool);
+		return NULL;
+	}
+
+	if (pthread_cond_init(&pool->idle, NULL))
+	{
+		pthread_mutex_destroy(&pool->lock);
+		mem_release(pool);
+		return NULL;
+	}
+
+	if (!(pool->workers = mem_create(size, CoprocWorker)) ||
+		!(pool->cmd = mem_strdup(cmd)) ||
+		pool_copy_vector(&pool->argv, argv) == -1 ||
+		pool_copy_vector(&pool->envv, envv) == -1)
+	{
+		coproc_pool_release(pool);
+		return NULL;
+	}
+
+	for (i = 0; i < size; ++i)
+	{
+		pool->workers[i].pid = -1;
+		pool->workers[i].busy = 0;
+		pool->workers[i].pending = NULL;
+		pool->workers[i].pending_length = 0;
+	}
+
+	for (i = 0; i < size; ++i)
+	{
+		if (pool_worker_start(pool, &pool->workers[i]) == -1)
+		{
+			coproc_pool_release(pool);
+			return NULL;
+		}
+	}
+
+	return pool;
+}
+
+/*
+
+=item C<void coproc_pool_release(CoprocPool *pool)>
+
+Releases (deallocates) C<pool>. The pipes to each coprocess are closed, each
+coprocess is sent a C<SIGTERM> signal, and then waited for. This must not be
+called while other threads are making requests of C<pool>.
+
+=cut
+
+*/
+
+void coproc_pool_release(CoprocPool *pool)
+{
+	size_t i;
+
+	if (!pool)
+		return;
+
+	if (pool->workers)
+		for (i = 0; i < pool->size; ++i)
+			pool_worker_stop(&pool->workers[i], SIGTERM);
+
+	mem_release(pool->workers);
+	mem_release(pool->cmd);
+	pool_release_vector(pool->argv);
+	pool_release_vector(pool->envv);
+	pthread_cond_destroy(&pool->idle);
+	pthread_mutex_destroy(&pool->lock);
+	mem_release(pool);
+}
+
+/*
+
+=item C<void *coproc_pool_destroy(CoprocPool **pool)>
+
+Destroys (deallocates and sets to C<null>) C<*pool>. Returns C<null>.
+
+=cut
+
+*/
+
+void *coproc_pool_destroy(CoprocPool **pool)
+{
+	if (pool && *pool)
+	{
+		coproc_pool_release(*pool);
+		*pool = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<ssize_t coproc_pool_request(CoprocPool *pool, const char *req, size_t reqlen, char **rsp, long msec)>
+
+Sends the request in the buffer pointed to by C<req> (of length C<reqlen>)
+to an idle coprocess in C<pool> and receives its response. If all of the
+coprocesses are busy, waits for one to become idle. Idle coprocesses are
+selected in rotation to spread the load. If the selected coprocess has
+terminated, it is restarted first. If C<msec> is not negative, it is the
+deadline, in milliseconds, for the entire request (including waiting for an
+idle coprocess). If the deadline passes, or the coprocess fails to respond
+properly (e.g. its response is longer than C<COPROC_POOL_MAX_RESPONSE>), the
+coprocess is killed and restarted, and the request fails. For
+C<COPROC_POOL_LINE> pools, C<req> must not contain a newline except at the
+end. On success, the response is stored in C<*rsp> and its length is
+returned. The response is followed by a C<nul> byte (not included in the
+length). For C<COPROC_POOL_LINE> pools, the newline at the end of the
+response is not included. It is the caller's responsibility to deallocate
+the response with I<free(3)> or I<mem_release(3)>. On error, returns C<-1>
+with C<errno> set appropriately (C<ETIMEDOUT> if the deadline passes,
+C<EMSGSIZE> if the response is too long, C<EINVAL> if a line request
+contains a newline). This function is I<MT-Safe>. Several threads may make
+requests of the same pool at the same time.
+
+=cut
+
+*/
+
+ssize_t coproc_pool_request(CoprocPool *pool, const char *req, size_t reqlen, char **rsp, long msec)
+{
+	struct timeval deadline[1];
+	CoprocWorker *worker = NULL;
+	ssize_t length;
+	size_t i;
+	int errno_save;
+
+	if (!pool || (!req && reqlen) || !rsp)
+		return set_errno(EINVAL);
+
+	/* A newline in a line request would make the worker respond twice */
+
+	if (pool->framing == COPROC_POOL_LINE && reqlen > 1 && memchr(req, '\n', reqlen - 1))
+		return set_errno(EINVAL);
+
+	if (msec >= 0)
+	{
+		if (gettimeofday(deadline, NULL) == -1)
+			return -1;
+
+		deadline->tv_sec += msec / 1000;
+		deadline->tv_usec += (msec % 1000) * 1000;
+
+		if (deadline->tv_usec >= 1000000)
+			deadline->tv_sec += 1, deadline->tv_usec -= 1000000;
+	}
+
+	/* Select an idle worker (waiting until one becomes idle or the deadline) */
+
+	if ((errno_save = pthread_mutex_lock(&pool->lock)))
+		return set_errno(errno_save);
+
+	for (;;)
+	{
+		for (i = 0; i < pool->size; ++i)
+		{
+			CoprocWorker *candidate = &pool->workers[(pool->next + i) % pool->size];
+
+			if (!candidate->busy)
+			{
+				worker = candidate;
+				worker->busy = 1;
+				pool->next = (pool->next + i + 1) % pool->size;
+				break;
+			}
+		}
+
+		if (worker)
+			break;
+
+		if (msec >= 0)
+		{
+			struct timespec abstime[1];
+
+			abstime->tv_sec = deadline->tv_sec;
+			abstime->tv_nsec = deadline->tv_usec * 1000;
+
+			if ((errno_save = pthread_cond_timedwait(&pool->idle, &pool->lock, abstime)) == ETIMEDOUT)
+				break;
+		}
+		else
+			errno_save = pthread_cond_wait(&pool->idle, &pool->lock);
+
+		if (errno_save && errno_save != EINTR)
+			break;
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!worker)
+		return set_errno(errno_save ? errno_save : ETIMEDOUT);
+
+	/* Restart the worker if it has terminated */
+
+	if (worker->pid != -1 && waitpid(worker->pid, NULL, WNOHANG) == worker->pid)
+	{
+		coproc_close(worker->pid, &worker->to, &worker->from, &worker->err);
+		worker->pid = -1;
+	}
+
+	if (worker->pid == -1 && pool_worker_start(pool, worker) == -1)
+		length = -1;
+	else if ((length = pool_transact(pool, worker, req, reqlen, rsp, (msec >= 0) ? deadline : NULL)) == -1)
+	{
+		errno_save = errno;
+		pool_worker_stop(worker, SIGKILL);
+		pool_worker_start(pool, worker);
+		errno = errno_save;
+	}
+
+	/* Return the worker to the pool */
+
+	errno_save = errno;
+	pthread_mutex_lock(&pool->lock);
+	worker->busy = 0;
+	pthread_cond_signal(&pool->idle);
+	pthread_mutex_unlock(&pool->lock);
+	errno = errno_save;
+
+	return length;
+}
+
+static int async_poll(Agent *agent, void *arg);
+
+/*
+
+C<int async_check(Agent *agent, CoprocAsync *async)>
+
+Called whenever the state of C<async> changes. When both of its output
+pipes have been closed, and it has been reaped, the exit callback is called
+and C<async> is deallocated. When its output pipes have been closed but it
+hasn't been reaped and there is no pidfd to wait for, starts polling for its
+termination. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+*/
+
+static int async_check(Agent *agent, CoprocAsync *async)
+{
+	if (async->from != -1 || async->err != -1)
+		return 0;
+
+	if (async->reaped)
+	{
+		if (async->exited)
+			async->exited(async->pid, async->status, async->arg);
+
+		mem_release(async);
+
+		return 0;
+	}
+
+	if (async->pidfd == -1)
+	{
+		async->backoff = 10000;
+
+		if (!agent_schedule(agent, 0, async->backoff, async_poll, async))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+
+C<int async_output(Agent *agent, int fd, int revents, void *arg)>
+
+Reaction to the coprocess's standard output or standard error becoming
+readable. Reads what's available and passes it to the output callback. On
+end of file (or error), passes an empty buffer to the output callback,
+disconnects and closes C<fd>, and, if that was the last thing waited for,
+finishes the coprocess.
+
+*/
+
+static int async_output(Agent *agent, int fd, int revents, void *arg)
+{
+	CoprocAsync *async = (CoprocAsync *)arg;
+	int which = (fd == async->from) ? STDOUT_FILENO : STDERR_FILENO;
+	char buf[BUFSIZ];
+	ssize_t bytes;
+
+	while ((bytes = read(fd, buf, BUFSIZ)) == -1 && errno == EINTR)
+	{}
+
+	if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+
+	if (bytes > 0)
 	{
-		close(*err);
-		*err = -1;
+		if (async->output)
+			async->output(async->pid, which, buf, (size_t)bytes, async->arg);
+
+		return 0;
 	}
 
-	if (waitpid(pid, &status, 0) == -1)
-		return -1;
+	if (async->output)
+		async->output(async->pid, which, buf, 0, async->arg);
 
-	return status;
+	agent_disconnect(agent, fd);
+	close(fd);
+
+	if (which == STDOUT_FILENO)
+		async->from = -1;
+	else
+		async->err = -1;
+
+	return async_check(agent, async);
 }
 
 /*
 
-=item C<pid_t coproc_pty_open(int *pty_user_fd, char *pty_device_name, size_t pty_device_name_size, const struct termios *pty_device_termios, const struct winsize *pty_device_winsize, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data)>
-
-Equivalent to I<coproc_open(3)> except that communication with the coprocess
-occurs over a pseudo terminal. This is useful when the coprocess uses
-standard I/O, and you don't have the source code. Standard I/O is fully
-buffered unless connected to a terminal. C<*pty_user_fd> is set to the user
-(or controlling process) side of a pseudo terminal. Data written to
-C<*pty_user_fd> can be read from the standard input of the coprocess. Data
-written to the standard output or standard error of the coprocess can be
-read from C<*pty_user_fd>. The device name of the coprocess side of the
-pseudo terminal is stored in the buffer pointed to by C<pty_device_name>
-which must be able to store at least 64 bytes. C<pty_device_name_size> is
-the size of the buffer pointed to by C<pty_device_name>. No more than
-C<pty_device_name_size> bytes will be written into the buffer pointed to by
-C<pty_device_name> including the terminating C<nul> byte. If
-C<pty_device_termios> is not null, it is passed to I<tcsetattr(3)> with the
-command C<TCSANOW> to set the terminal attributes of the device on the
-coprocess side of the pseudo terminal. If C<pty_device_winsize> is not null,
-it is passed to I<ioctl(2)> with the command C<TIOCSWINSZ> to set the window
-size of the device on the coprocess side of the pseudo terminal. On success,
-returns C<0>. On error, returns C<-1> with C<errno> set appropriately.
+C<int async_reap(Agent *agent, int fd, int revents, void *arg)>
 
-=cut
+Reaction to the coprocess's pidfd becoming readable (i.e. the coprocess has
+terminated). Collects its exit status, disconnects and closes the pidfd,
+and, if its output has been completely read, finishes the coprocess.
 
 */
 
-pid_t coproc_pty_open(int *pty_user_fd, char *pty_device_name, size_t pty_device_name_size, const struct termios *pty_device_termios, const struct winsize *pty_device_winsize, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data)
+static int async_reap(Agent *agent, int fd, int revents, void *arg)
 {
-	pid_t pid;        /* process id of the coprocess */
-	int has_meta;     /* does cmd contain shell meta characters? */
+	CoprocAsync *async = (CoprocAsync *)arg;
 
-	/* Check arguments */
+	while (waitpid(async->pid, &async->status, WNOHANG) == -1 && errno == EINTR)
+	{}
 
-	if (!pty_user_fd || !pty_device_name || pty_device_name_size < 64 || !cmd)
-		return set_errno(EINVAL);
+	async->reaped = 1;
+	agent_disconnect(agent, fd);
+	close(fd);
+	async->pidfd = -1;
 
-	has_meta = (cmd[strcspn(cmd, SHELL_META_CHARACTERS)] != '\0');
+	return async_check(agent, async);
+}
 
-	if ((has_meta && argv) || (!has_meta && !argv))
-		return set_errno(EINVAL);
+/*
 
-	/* Create pty and child process */
+C<int async_poll(Agent *agent, void *arg)>
 
-	switch (pid = pty_fork(pty_user_fd, pty_device_name, pty_device_name_size, pty_device_termios, pty_device_winsize))
-	{
-		case -1:
-			return -1;
+Scheduled action (used when pidfds aren't available) that checks whether the
+coprocess has terminated. If so, finishes it. Otherwise, checks again later,
+backing off from 10ms up to 1s.
 
-		case 0:
-		{
-			/* Adjust process attributes */
+*/
 
-			if (action)
-				action(data);
+static int async_poll(Agent *agent, void *arg)
+{
+	CoprocAsync *async = (CoprocAsync *)arg;
+	pid_t pid;
 
-			/* Execute co-process */
+	while ((pid = waitpid(async->pid, &async->status, WNOHANG)) == -1 && errno == EINTR)
+	{}
 
-			do_exec(has_meta, cmd, argv, envv);
-			_exit(EXIT_FAILURE);
-		}
+	if (pid != 0)
+	{
+		async->reaped = 1;
 
-		default:
-			return pid;
+		return async_check(agent, async);
 	}
+
+	if (async->backoff < 1000000)
+		async->backoff <<= 1;
+
+	return (agent_schedule(agent, 0, async->backoff, async_poll, async)) ? 0 : -1;
 }
 
 /*
 
-=item C<int coproc_pty_close(pid_t pid, int *pty_user_fd, const char *pty_device_name)>
-
-Closes the coprocess referred to by C<pid> which must have been obtained
-from I<coproc_pty_open(3)>. The coprocess side of the pseudo terminal is
-released with I<pty_release(3)> and C<*pty_user_fd> is closed and set to
-C<-1> if it is not already C<-1>. The current process will then wait for the
-coprocess to terminate by calling I<waitpid(2)>. On success, returns the
-status of the child process as determined by I<waitpid(2)>. On error,
-returns C<-1> with C<errno> set appropriately. B<Note:> If I<waitpid(2)> is
-interrupted by a signal, I<coproc_close(3)> will return C<-1> with C<errno>
-set to C<EINTR>. The caller has to call I<coproc_close(3)> (or just
-I<waitpid(2)>) again until it succeeds (or until a real error occurs).
+=item C<pid_t coproc_async_open(Agent *agent, int *to, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data, coproc_output_t *output, coproc_exit_t *exited, void *arg)>
+
+Equivalent to I<coproc_open(3)> except that the coprocess is supervised by
+C<agent> rather than by the caller. This allows a single thread to manage
+many coprocesses at once, without blocking in I<waitpid(2)> and without a
+C<SIGCHLD> handler. If C<to> is not C<null>, C<*to> is set to the pipe for
+writing to the coprocess's standard input, and it is the caller's
+responsibility to close it when finished. Otherwise, the coprocess's
+standard input is closed immediately. The coprocess's standard output and
+standard error are connected to C<agent>. Whenever either has data
+available, C<output> (if not C<null>) is called with five arguments: the
+process id, C<STDOUT_FILENO> or C<STDERR_FILENO>, a buffer containing the
+data, its length, and C<arg>. When either reaches end of file, C<output> is
+called with a length of zero. When the coprocess has terminated, and all of
+its output has been delivered, C<exited> (if not C<null>) is called with
+three arguments: the process id, its exit status (as returned by
+I<waitpid(2)>), and C<arg>. Note that if the coprocess passes its standard
+output or standard error to its own children, C<exited> won't be called
+until they have closed them as well. The coprocess's termination is
+detected with a I<pidfd> (see I<pidfd_open(2)>) that is also connected to
+C<agent> where possible. Otherwise, after its output pipes have been closed,
+it is checked for periodically with I<waitpid(2)>. The callbacks are called
+from within I<agent_start(3)>. They must not block. All of the coprocess's
+resources have been released by the time C<exited> is called. On success,
+returns the process id of the coprocess. On error, returns C<-1> with
+C<errno> set appropriately.
 
 =cut
 
 */
 
-int coproc_pty_close(pid_t pid, int *pty_user_fd, const char *pty_device_name)
+pid_t coproc_async_open(Agent *agent, int *to, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data, coproc_output_t *output, coproc_exit_t *exited, void *arg)
 {
-	int status = 0;
+	CoprocAsync *async;
+	int to_fd, errno_save;
 
-	if (pid <= 0)
+	if (!agent)
 		return set_errno(EINVAL);
 
-	if (pty_user_fd && *pty_user_fd != -1)
+	if (!(async = mem_new(CoprocAsync)))
+		return -1;
+
+	memset(async, 0, sizeof(CoprocAsync));
+	async->pidfd = -1;
+	async->output = output;
+	async->exited = exited;
+	async->arg = arg;
+
+	if ((async->pid = coproc_open(&to_fd, &async->from, &async->err, cmd, argv, envv, action, data)) == -1)
 	{
-		pty_release(pty_device_name);
-		close(*pty_user_fd);
-		*pty_user_fd = -1;
+		mem_release(async);
+		return -1;
 	}
 
-	if (waitpid(pid, &status, 0) == -1)
-		return -1;
+	if (to)
+		*to = to_fd;
+	else
+		close(to_fd);
 
-	return status;
+#ifdef COPROC_PIDFD
+	/* Fails with ENOSYS before Linux-5.3 (then fall back to polling). It's close-on-exec. */
+
+	async->pidfd = (int)syscall(SYS_pidfd_open, async->pid, 0);
+#endif
+
+	if (nonblock_on(async->from) == -1 || nonblock_on(async->err) == -1)
+		goto failed;
+
+	if (agent_connect(agent, async->from, R_OK, async_output, async) == -1)
+		goto failed;
+
+	if (agent_connect(agent, async->err, R_OK, async_output, async) == -1)
+	{
+		agent_disconnect(agent, async->from);
+		goto failed;
+	}
+
+	if (async->pidfd != -1 && agent_connect(agent, async->pidfd, R_OK, async_reap, async) == -1)
+	{
+		agent_disconnect(agent, async->from);
+		agent_disconnect(agent, async->err);
+		goto failed;
+	}
+
+	return async->pid;
+
+failed:
+	errno_save = errno;
+
+	if (to)
+		close(*to), *to = -1;
+
+	kill(async->pid, SIGKILL);
+	coproc_close(async->pid, NULL, &async->from, &async->err);
+
+	if (async->pidfd != -1)
+		close(async->pidfd);
+
+	mem_release(async);
+
+	return set_errno(errno_save);
 }
 
 /*
@@ -499,7 +1837,23 @@ calls. See their manual pages.
 =item C<EINVAL>
 
 Invalid arguments were passed to I<coproc_open(3)>, I<coproc_close(3)>,
-I<coproc_pty_open(3)> or I<coproc_pty_close(3)>.
+I<coproc_pty_open(3)>, I<coproc_pty_close(3)>, I<coproc_pool_create(3)>,
+I<coproc_pool_request(3)> or I<coproc_async_open(3)>.
+
+=item C<ETIMEDOUT>
+
+I<coproc_pool_request(3)> sets this when the deadline passes.
+
+=item C<EPIPE>
+
+I<coproc_pool_request(3)> sets this when a coprocess closes its standard
+output (e.g. terminates) before responding.
+
+=item C<EMSGSIZE>
+
+I<coproc_pool_request(3)> sets this when a request is too large for the
+C<COPROC_POOL_FRAMED> length prefix, or a response is longer than
+C<COPROC_POOL_MAX_RESPONSE> bytes.
 
 =back
 
@@ -808,6 +2162,7 @@ This version uses a pseudo terminal and C<sh -c>.
 =head1 SEE ALSO
 
 I<libslack(3)>,
+I<agent(3)>,
 I<execve(2)>,
 I<system(3)>,
 I<popen(3)>,
@@ -865,6 +2220,79 @@ static void print_error_details(char *buf, int bytes, char *expected)
 	}
 }
 
+static void set_action_env(void *data)
+{
+	putenv((char *)data);
+}
+
+typedef struct PoolTest PoolTest;
+
+struct PoolTest
+{
+	CoprocPool *pool;
+	int id;
+	int failures;
+};
+
+typedef struct AsyncTest AsyncTest;
+
+struct AsyncTest
+{
+	int exits;
+	int statuses;
+	int eofs;
+	size_t out;
+	size_t err;
+};
+
+static void async_output_test(pid_t pid, int fd, const char *buf, size_t size, void *arg)
+{
+	AsyncTest *test = (AsyncTest *)arg;
+
+	if (size == 0)
+		++test->eofs;
+	else if (fd == STDOUT_FILENO)
+		test->out += size;
+	else
+		test->err += size;
+}
+
+static void async_exit_test(pid_t pid, int status, void *arg)
+{
+	AsyncTest *test = (AsyncTest *)arg;
+
+	++test->exits;
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 3)
+		++test->statuses;
+}
+
+static void *pool_client(void *arg)
+{
+	PoolTest *test = (PoolTest *)arg;
+	char req[32], *rsp;
+	ssize_t length;
+	int i;
+
+	for (i = 0; i < 25; ++i)
+	{
+		snprintf(req, 32, "client %d request %d", test->id, i);
+
+		if ((length = coproc_pool_request(test->pool, req, strlen(req), &rsp, 10000)) == -1)
+		{
+			++test->failures;
+			continue;
+		}
+
+		if ((size_t)length != strlen(req) || strcmp(rsp, req))
+			++test->failures;
+
+		free(rsp);
+	}
+
+	return NULL;
+}
+
 int main()
 {
 	int errors = 0;
@@ -1504,8 +2932,271 @@ int main()
 	else if (errno != EINVAL)
 		++errors, printf("Test188: coproc_pty_close(pid = -1) failed (errno == %s, not %s)\n", strerror(errno), strerror(EINVAL));
 
+	/* Test that coproc_open() doesn't leak file descriptors into the coprocess */
+
+	if ((fd = dup2(STDIN_FILENO, 9)) != 9)
+		++errors, printf("Test189: failed to run test: dup2() failed (%s)\n", strerror(errno));
+	else if ((pid = coproc_open(&to, &from, &err, "echo leaked >&9 2>/dev/null || echo closed", NULL, NULL, NULL, NULL)) == -1)
+		++errors, printf("Test190: coproc_open(\"echo leaked >&9 || echo closed\") failed (%s)\n", strerror(errno));
+	else
+	{
+		if (read_timeout(from, 5, 0) == -1)
+			++errors, printf("Test191: read_timeout(from) failed (%s)\n", strerror(errno));
+		else if ((bytes = read(from, buf, 7)) != 7 || memcmp(buf, "closed\n", 7))
+		{
+			++errors, printf("Test192: coprocess inherited fd 9 ");
+			print_error_details(buf, (int)bytes, "closed\\n");
+		}
+
+		if ((status = coproc_close(pid, &to, &from, &err)) == -1)
+			++errors, printf("Test193: coproc_close() failed (%s)\n", strerror(errno));
+	}
+
+	close(9);
+
+	/* Test that coproc_open() with an action (i.e. using fork() rather than posix_spawn()) invokes it */
+
+	if ((pid = coproc_open(&to, &from, &err, "echo $COPROC_ACTION", NULL, NULL, set_action_env, "COPROC_ACTION=invoked")) == -1)
+		++errors, printf("Test194: coproc_open(\"echo $COPROC_ACTION\", action) failed (%s)\n", strerror(errno));
+	else
+	{
+		if (read_timeout(from, 5, 0) == -1)
+			++errors, printf("Test195: read_timeout(from) failed (%s)\n", strerror(errno));
+		else if ((bytes = read(from, buf, 8)) != 8 || memcmp(buf, "invoked\n", 8))
+		{
+			++errors, printf("Test196: coproc_open(action) didn't invoke action ");
+			print_error_details(buf, (int)bytes, "invoked\\n");
+		}
+
+		if ((status = coproc_close(pid, &to, &from, &err)) == -1)
+			++errors, printf("Test197: coproc_close() failed (%s)\n", strerror(errno));
+	}
+
+	/* Test that coproc_open() of a missing command still reports failure via the exit status */
+
+	if ((pid = coproc_open(&to, &from, &err, "./coproc-no-such-command", argv, NULL, NULL, NULL)) == -1)
+		++errors, printf("Test198: coproc_open(\"./coproc-no-such-command\") failed (%s)\n", strerror(errno));
+	else if ((status = coproc_close(pid, &to, &from, &err)) == -1)
+		++errors, printf("Test199: coproc_close() failed (%s)\n", strerror(errno));
+	else if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_FAILURE)
+		++errors, printf("Test200: coproc(\"./coproc-no-such-command\") didn't exit with EXIT_FAILURE (status %d)\n", status);
+
+	/* Test coproc_pool_create(), coproc_pool_request() and coproc_pool_destroy() */
+
+	signal(SIGPIPE, SIG_IGN);
+
+	{
+		char *head_argv[4] = { "head", "-n", "1", NULL };
+		char *sleep_argv[3] = { "sleep", "10", NULL };
+		CoprocPool *pool;
+		PoolTest test[4];
+		pthread_t id[4];
+		char *rsp;
+		ssize_t length;
+		int i;
+
+		if (!(pool = coproc_pool_create(2, COPROC_POOL_LINE, "cat", argv, NULL)))
+			++errors, printf("Test201: coproc_pool_create(\"cat\", COPROC_POOL_LINE) failed (%s)\n", strerror(errno));
+		else
+		{
+			if ((length = coproc_pool_request(pool, "hello", 5, &rsp, 5000)) == -1)
+				++errors, printf("Test202: coproc_pool_request(\"hello\") failed (%s)\n", strerror(errno));
+			else
+			{
+				if (length != 5 || strcmp(rsp, "hello"))
+					++errors, printf("Test203: coproc_pool_request(\"hello\") failed (returned %d <%s>, not 5 <hello>)\n", (int)length, rsp);
+
+				free(rsp);
+			}
+
+			for (i = 0; i < 4; ++i)
+			{
+				test[i].pool = pool;
+				test[i].id = i;
+				test[i].failures = 0;
+				pthread_create(&id[i], NULL, pool_client, &test[i]);
+			}
+
+			for (i = 0; i < 4; ++i)
+			{
+				pthread_join(id[i], NULL);
+
+				if (test[i].failures)
+					++errors, printf("Test204: concurrent coproc_pool_request() failed (client %d had %d failures)\n", i, test[i].failures);
+			}
+
+			if (coproc_pool_destroy(&pool) != NULL || pool != NULL)
+				++errors, printf("Test205: coproc_pool_destroy() failed\n");
+		}
+
+		if (!(pool = coproc_pool_create(1, COPROC_POOL_FRAMED, "cat", argv, NULL)))
+			++errors, printf("Test206: coproc_pool_create(\"cat\", COPROC_POOL_FRAMED) failed (%s)\n", strerror(errno));
+		else
+		{
+			/* cat echoes the length prefix as well, so the response is the request */
+
+			if ((length = coproc_pool_request(pool, "a\0b\nc", 5, &rsp, 5000)) == -1)
+				++errors, printf("Test207: coproc_pool_request(framed) failed (%s)\n", strerror(errno));
+			else
+			{
+				if (length != 5 || memcmp(rsp, "a\0b\nc", 5))
+					++errors, printf("Test208: coproc_pool_request(framed) failed (returned %d bytes, not 5)\n", (int)length);
+
+				free(rsp);
+			}
+
+			coproc_pool_destroy(&pool);
+		}
+
+		if (!(pool = coproc_pool_create(1, COPROC_POOL_LINE, "sleep", sleep_argv, NULL)))
+			++errors, printf("Test209: coproc_pool_create(\"sleep\") failed (%s)\n", strerror(errno));
+		else
+		{
+			if (coproc_pool_request(pool, "hello", 5, &rsp, 200) != -1)
+				++errors, printf("Test210: coproc_pool_request(\"sleep\", 200ms) failed (didn't time out)\n");
+			else if (errno != ETIMEDOUT)
+				++errors, printf("Test211: coproc_pool_request(\"sleep\", 200ms) failed (errno == %s, not %s)\n", strerror(errno), strerror(ETIMEDOUT));
+
+			coproc_pool_destroy(&pool);
+		}
+
+		/* Test that workers that terminate are restarted */
+
+		if (!(pool = coproc_pool_create(1, COPROC_POOL_LINE, "head", head_argv, NULL)))
+			++errors, printf("Test212: coproc_pool_create(\"head -n 1\") failed (%s)\n", strerror(errno));
+		else
+		{
+			for (i = 0; i < 3; ++i)
+			{
+				if ((length = coproc_pool_request(pool, "again", 5, &rsp, 5000)) == -1)
+					++errors, printf("Test213: coproc_pool_request(\"head -n 1\") #%d failed (%s)\n", i, strerror(errno));
+				else
+				{
+					if (length != 5 || strcmp(rsp, "again"))
+						++errors, printf("Test214: coproc_pool_request(\"head -n 1\") #%d failed (returned <%s>, not <again>)\n", i, rsp);
+
+					free(rsp);
+				}
+
+				nap(0, 100000);
+			}
+
+			coproc_pool_destroy(&pool);
+		}
+
+		if (coproc_pool_create(0, COPROC_POOL_LINE, "cat", argv, NULL) != NULL)
+			++errors, printf("Test215: coproc_pool_create(size == 0) failed\n");
+		else if (errno != EINVAL)
+			++errors, printf("Test216: coproc_pool_create(size == 0) failed (errno == %s, not %s)\n", strerror(errno), strerror(EINVAL));
+
+		if (coproc_pool_request(NULL, "hello", 5, &rsp, 0) != -1)
+			++errors, printf("Test217: coproc_pool_request(pool == null) failed\n");
+		else if (errno != EINVAL)
+			++errors, printf("Test218: coproc_pool_request(pool == null) failed (errno == %s, not %s)\n", strerror(errno), strerror(EINVAL));
+
+		/* Test that nothing after the newline is lost, and that embedded newlines are rejected */
+
+		if (!(pool = coproc_pool_create(1, COPROC_POOL_LINE, "while read l; do echo \"A:$l\"; echo \"B:$l\"; done", NULL, NULL)))
+			++errors, printf("Test230: coproc_pool_create(two lines per request) failed (%s)\n", strerror(errno));
+		else
+		{
+			const char *expected[4] = { "A:1", "B:1", "A:2", "B:2" };
+			char req[2];
+
+			for (i = 0; i < 4; ++i)
+			{
+				snprintf(req, sizeof req, "%d", i + 1);
+
+				if ((length = coproc_pool_request(pool, req, 1, &rsp, 5000)) == -1)
+					++errors, printf("Test231: coproc_pool_request(two lines) #%d failed (%s)\n", i, strerror(errno));
+				else
+				{
+					if (strcmp(rsp, expected[i]))
+						++errors, printf("Test231: coproc_pool_request(two lines) #%d failed (returned <%s>, not <%s>)\n", i, rsp, expected[i]);
+
+					free(rsp);
+				}
+
+				/* Give the second line time to arrive with the first */
+
+				if (i == 0)
+					nap(0, 100000);
+			}
+
+			if (coproc_pool_request(pool, "a\nb", 3, &rsp, 5000) != -1)
+				++errors, printf("Test232: coproc_pool_request(embedded newline) failed\n");
+			else if (errno != EINVAL)
+				++errors, printf("Test232: coproc_pool_request(embedded newline) failed (errno == %s, not %s)\n", strerror(errno), strerror(EINVAL));
+
+			coproc_pool_destroy(&pool);
+		}
+
+		/* Test that responses that are too long are rejected and the worker restarted */
+
+		if (!(pool = coproc_pool_create(1, COPROC_POOL_FRAMED, "printf '\\377\\377\\377\\377'; exec cat", NULL, NULL)))
+			++errors, printf("Test233: coproc_pool_create(huge framed response) failed (%s)\n", strerror(errno));
+		else
+		{
+			if (coproc_pool_request(pool, "hello", 5, &rsp, 5000) != -1)
+				++errors, printf("Test234: coproc_pool_request(huge framed response) failed\n");
+			else if (errno != EMSGSIZE)
+				++errors, printf("Test234: coproc_pool_request(huge framed response) failed (errno == %s, not %s)\n", strerror(errno), strerror(EMSGSIZE));
+
+			coproc_pool_destroy(&pool);
+		}
+	}
+
+	/* Test coproc_async_open() */
+
+	{
+		Agent *agent;
+		AsyncTest test[1];
+		int i;
+
+		memset(test, 0, sizeof(AsyncTest));
+
+		if (!(agent = agent_create()))
+			++errors, printf("Test219: agent_create() failed (%s)\n", strerror(errno));
+		else
+		{
+			for (i = 0; i < 50; ++i)
+				if (coproc_async_open(agent, NULL, "echo out; echo error >&2; exit 3", NULL, NULL, NULL, NULL, async_output_test, async_exit_test, test) == -1)
+					++errors, printf("Test220: coproc_async_open() #%d failed (%s)\n", i, strerror(errno));
+
+			if ((pid = coproc_async_open(agent, &to, "cat", argv, NULL, NULL, NULL, async_output_test, NULL, test)) == -1)
+				++errors, printf("Test221: coproc_async_open(\"cat\") failed (%s)\n", strerror(errno));
+			else if (write(to, "abc\n", 4) != 4)
+				++errors, printf("Test222: write(to, \"abc\\n\") failed (%s)\n", strerror(errno));
+
+			if (pid != -1)
+				close(to);
+
+			if (agent_start(agent) == -1)
+				++errors, printf("Test223: agent_start() failed (%s)\n", strerror(errno));
+
+			if (test->exits != 50)
+				++errors, printf("Test224: coproc_async_open() failed (%d exits, not 50)\n", test->exits);
+
+			if (test->statuses != 50)
+				++errors, printf("Test225: coproc_async_open() failed (%d exit statuses of 3, not 50)\n", test->statuses);
+
+			if (test->out != 50 * 4 + 4 || test->err != 50 * 6)
+				++errors, printf("Test226: coproc_async_open() failed (%d bytes of output and %d of errors, not %d and %d)\n", (int)test->out, (int)test->err, 50 * 4 + 4, 50 * 6);
+
+			if (test->eofs != 51 * 2)
+				++errors, printf("Test227: coproc_async_open() failed (%d eofs, not %d)\n", test->eofs, 51 * 2);
+
+			agent_destroy(&agent);
+		}
+
+		if (coproc_async_open(NULL, NULL, "cat", argv, NULL, NULL, NULL, NULL, NULL, NULL) != -1)
+			++errors, printf("Test228: coproc_async_open(agent == null) failed\n");
+		else if (errno != EINVAL)
+			++errors, printf("Test229: coproc_async_open(agent == null) failed (errno == %s, not %s)\n", strerror(errno), strerror(EINVAL));
+	}
+
 	if (errors)
-		printf("%d/%d tests failed\n", errors, 188);
+		printf("%d/%d tests failed\n", errors, 234);
 	else
 		printf("All tests passed\n");
 
@@ -28,12 +28,26 @@
 #include <sys/types.h>
 
 #include <slack/hdr.h>
+#include <slack/agent.h>
+
+#define COPROC_POOL_LINE 0
+#define COPROC_POOL_FRAMED 1
+#define COPROC_POOL_MAX_RESPONSE (16 * 1024 * 1024)
+
+typedef struct CoprocPool CoprocPool;
+typedef void coproc_output_t(pid_t pid, int fd, const char *buf, size_t size, void *arg);
+typedef void coproc_exit_t(pid_t pid, int status, void *arg);
 
 _begin_decls
 pid_t coproc_open(int *to, int *from, int *err, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data);
 int coproc_close(pid_t pid, int *to, int *from, int *err);
 pid_t coproc_pty_open(int *pty_user_fd, char *pty_device_name, size_t pty_device_name_size, const struct termios *pty_device_termios, const struct winsize *pty_device_winsize, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data);
 int coproc_pty_close(pid_t pid, int *pty_user_fd, const char *pty_device_name);
+CoprocPool *coproc_pool_create(size_t size, int framing, const char *cmd, char * const *argv, char * const *envv);
+void coproc_pool_release(CoprocPool *pool);
+void *coproc_pool_destroy(CoprocPool **pool);
+ssize_t coproc_pool_request(CoprocPool *pool, const char *req, size_t reqlen, char **rsp, long msec);
+pid_t coproc_async_open(Agent *agent, int *to, const char *cmd, char * const *argv, char * const *envv, void (*action)(void *data), void *data, coproc_output_t *output, coproc_exit_t *exited, void *arg);
 _end_decls
 
 #endif
@@ -912,7 +912,6 @@ appropriately.
 int daemon_init(const char *name)
 {
 	pid_t pid;
-	long nopen;
 	int fd;
 
 	/*
@@ -1003,46 +1002,28 @@ int daemon_init(const char *name)
 
 	umask(0);
 
-	/*
-	** We need to close all open file descriptors. Check how
-	** many file descriptors we have (If indefinite, a usable
-	** number (1024) will be returned).
-	**
-	** Flaw: If many files were opened and then this limit
-	** was reduced to below the highest file descriptor,
-	** we may not close all file descriptors.
-	*/
-
-	if ((nopen = limit_open()) == -1)
-		return -1;
-
 	/*
 	** Close all open file descriptors. If started by inetd,
 	** we don't close stdin, stdout and stderr.
 	** Don't forget to open any future tty devices with O_NOCTTY
 	** so as to prevent gaining a controlling terminal
 	** (not necessary with SVR4 or modern versions of BSD).
+	**
+	** Note: close_from() uses close_range(2) or /proc/self/fd
+	** when available so it doesn't make one close(2) per possible
+	** file descriptor, and it doesn't miss file descriptors that
+	** are above a reduced RLIMIT_NOFILE limit.
 	*/
 
 	if (daemon_started_by_inetd())
 	{
-		for (fd = 0; fd < nopen; ++fd)
-		{
-			switch (fd)
-			{
-				case STDIN_FILENO:
-				case STDOUT_FILENO:
-				case STDERR_FILENO:
-					break;
-				default:
-					close(fd);
-			}
-		}
+		if (close_from(STDERR_FILENO + 1) == -1)
+			return -1;
 	}
 	else
 	{
-		for (fd = 0; fd < nopen; ++fd)
-			close(fd);
+		if (close_from(STDIN_FILENO) == -1)
+			return -1;
 
 		/*
 		** Open stdin, stdout and stderr to /dev/null just in case some
@@ -0,0 +1,1611 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+
+/*
+
+=head1 NAME
+
+I<libslack(filter)> - probabilistic membership filter module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/filter.h>
+
+    typedef struct Bloom Bloom;
+    typedef struct Cuckoo Cuckoo;
+
+    Bloom *bloom_create(size_t items, double fp_rate);
+    void bloom_release(Bloom *bloom);
+    void *bloom_destroy(Bloom **bloom);
+    int bloom_add(Bloom *bloom, const void *key, size_t length);
+    int bloom_add_unlocked(Bloom *bloom, const void *key, size_t length);
+    int bloom_test(const Bloom *bloom, const void *key, size_t length);
+    ssize_t bloom_serialise(const Bloom *bloom, void *buf, size_t size);
+    Bloom *bloom_deserialise(const void *buf, size_t size);
+    Cuckoo *cuckoo_create(size_t items, double fp_rate);
+    Cuckoo *cuckoo_create_with_locker(Locker *locker, size_t items, double fp_rate);
+    int cuckoo_rdlock(const Cuckoo *cuckoo);
+    int cuckoo_wrlock(const Cuckoo *cuckoo);
+    int cuckoo_unlock(const Cuckoo *cuckoo);
+    void cuckoo_release(Cuckoo *cuckoo);
+    void *cuckoo_destroy(Cuckoo **cuckoo);
+    int cuckoo_add(Cuckoo *cuckoo, const void *key, size_t length);
+    int cuckoo_add_unlocked(Cuckoo *cuckoo, const void *key, size_t length);
+    int cuckoo_remove(Cuckoo *cuckoo, const void *key, size_t length);
+    int cuckoo_remove_unlocked(Cuckoo *cuckoo, const void *key, size_t length);
+    int cuckoo_test(const Cuckoo *cuckoo, const void *key, size_t length);
+    int cuckoo_test_unlocked(const Cuckoo *cuckoo, const void *key, size_t length);
+    ssize_t cuckoo_size(const Cuckoo *cuckoo);
+    ssize_t cuckoo_size_unlocked(const Cuckoo *cuckoo);
+    ssize_t cuckoo_serialise(const Cuckoo *cuckoo, void *buf, size_t size);
+    ssize_t cuckoo_serialise_unlocked(const Cuckoo *cuckoo, void *buf, size_t size);
+    Cuckoo *cuckoo_deserialise(const void *buf, size_t size);
+    Cuckoo *cuckoo_deserialise_with_locker(Locker *locker, const void *buf, size_t size);
+
+=head1 DESCRIPTION
+
+This module provides compact, probabilistic sets of keys that answer the
+question "might this key be present?". When the answer is no, the key is
+definitely not present. When the answer is yes, the key is present, or the
+answer is a false positive. The false positive rate is chosen when the
+filter is created. A filter placed in front of a I<Map> (or a database)
+answers most lookups of missing keys without touching the map at all, and
+is much smaller than the map. Keys are arbitrary bytes (e.g. C<strlen(str)>
+bytes of a string). Only their hashes are stored.
+
+A I<Bloom> filter is a blocked Bloom filter. Each key sets several bits
+within a single 64-byte block (a cache line), so adding or testing a key
+costs a single cache miss however many bits are involved. Keys can't be
+removed. I<bloom_add(3)> uses atomic operations, so any number of threads
+can add and test keys concurrently without a lock.
+
+A I<Cuckoo> filter stores a small fingerprint of each key in one of two
+buckets of four. Keys can be removed (a key that was added more than once
+must be removed as many times). Its size is less finely tuned than a Bloom
+filter's (fingerprints are 8, 16 or 32 bits, and the number of buckets is a
+power of two), but its false positive rate stays low at any size. Adding
+keys can fail when the filter is nearly full (more items than it was created
+for). Like other libslack data types, a I<Cuckoo> can be synchronised with a
+I<Locker>.
+
+Both kinds of filter can be serialised into a compact, portable form (the
+filter's parameters in network byte order followed by its table), saved or
+sent elsewhere, and deserialised.
+
+=over 4
+
+=cut
+
+*/
+
+#ifndef _BSD_SOURCE
+#define _BSD_SOURCE /* For posix_memalign() */
+#endif
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE /* New name for _BSD_SOURCE */
+#endif
+
+#include "config.h"
+#include "std.h"
+
+#include "filter.h"
+#include "hash.h"
+#include "mem.h"
+#include "err.h"
+#include "locker.h"
+#include "net.h"
+
+/* Bytes per Bloom filter block (a cache line) */
+
+#define BLOOM_BLOCK 64
+
+/* Maximum number of bits set per key in a Bloom filter */
+
+#define BLOOM_MAX_HASHES 16
+
+/* Fingerprints per cuckoo filter bucket */
+
+#define CUCKOO_SLOTS 4
+
+/* Maximum load of a cuckoo filter created for a given number of items */
+
+#define CUCKOO_LOAD 0.9
+
+/* Maximum number of relocations when adding to a cuckoo filter */
+
+#define CUCKOO_MAX_KICKS 500
+
+/* Size of the serialised header: magic, version, parameter, table size, items */
+
+#define FILTER_HEADER 14
+
+#define FILTER_VERSION 1
+
+struct Bloom
+{
+	unsigned char *bits;     /* the blocks, aligned to BLOOM_BLOCK */
+	size_t blocks;           /* the number of blocks */
+	int hashes;              /* the number of bits set per key */
+};
+
+struct Cuckoo
+{
+	unsigned char *table;    /* the buckets of fingerprints */
+	size_t buckets;          /* the number of buckets (a power of two) */
+	size_t items;            /* the number of fingerprints stored */
+	int width;               /* the number of bytes per fingerprint */
+	unsigned long random;    /* xorshift state for choosing victims */
+	Locker *locker;          /* locking strategy for this object */
+};
+
+#ifndef TEST
+
+/*
+
+C<double log2_of(double x)>
+
+Returns the base 2 logarithm of C<x>, which must be positive. Only used for
+sizing filters, so it avoids a dependency on the maths library.
+
+*/
+
+static double log2_of(double x)
+{
+	double z, z2, term, sum;
+	int exponent = 0, i;
+
+	while (x >= 2.0)
+		x /= 2.0, ++exponent;
+
+	while (x < 1.0)
+		x *= 2.0, --exponent;
+
+	/* ln(x) = 2 * atanh((x - 1) / (x + 1)), where |z| <= 1/3 */
+
+	z = (x - 1.0) / (x + 1.0);
+	z2 = z * z;
+
+	for (sum = 0.0, term = z, i = 1; i < 40; i += 2, term *= z2)
+		sum += term / i;
+
+	return exponent + 2.0 * sum / M_LN2;
+}
+
+/*
+
+C<Bloom *bloom_alloc(size_t blocks, int hashes)>
+
+Creates an empty I<Bloom> filter with C<blocks> blocks that sets C<hashes>
+bits per key. On success, returns the new filter. On error, returns
+C<null> with C<errno> set appropriately.
+
+*/
+
+static Bloom *bloom_alloc(size_t blocks, int hashes)
+{
+	Bloom *bloom;
+	void *bits;
+	int err;
+
+	if (blocks > (size_t)-1 / BLOOM_BLOCK)
+		return set_errnull(ENOMEM);
+
+	if ((err = posix_memalign(&bits, BLOOM_BLOCK, blocks * BLOOM_BLOCK)))
+		return set_errnull(err);
+
+	if (!(bloom = mem_new(Bloom))) /* XXX decouple */
+	{
+		free(bits);
+		return NULL;
+	}
+
+	memset(bits, 0, blocks * BLOOM_BLOCK);
+	bloom->bits = bits;
+	bloom->blocks = blocks;
+	bloom->hashes = hashes;
+
+	return bloom;
+}
+
+/*
+
+C<unsigned char *bloom_block(const Bloom *bloom, unsigned long long h, unsigned long *a, unsigned long *b)>
+
+Returns the block for a key whose hash is C<h>, and stores the two values
+from which the key's bit positions in the block are derived in C<*a> and
+C<*b>. The bit positions are the top nine bits of the 32-bit values C<*a +
+i * *b>, for C<i> from C<0> to C<bloom-E<gt>hashes - 1>.
+
+*/
+
+static unsigned char *bloom_block(const Bloom *bloom, unsigned long long h, unsigned long *a, unsigned long *b)
+{
+	unsigned long long g = hash_mix64(h);
+	size_t block;
+
+	if (bloom->blocks <= 0xffffffffUL)
+		block = (size_t)(((h >> 32) * bloom->blocks) >> 32);
+	else
+		block = (size_t)(h % bloom->blocks);
+
+	*a = (unsigned long)(g & 0xffffffffUL);
+	*b = (unsigned long)(g >> 32) | 1;
+
+	return bloom->bits + block * BLOOM_BLOCK;
+}
+
+/*
+
+=item C<Bloom *bloom_create(size_t items, double fp_rate)>
+
+Creates an empty blocked Bloom filter, sized so that after C<items> keys
+have been added, the probability of a false positive is about C<fp_rate>
+(which must be between C<0> and C<1>). It uses about
+C<-1.44 * log2(fp_rate)> bits per item, plus a little more to compensate
+for the blocking (e.g. 1.35 bytes per item for 1%). Below about 0.1%, the
+blocking makes the actual rate up to several times C<fp_rate> (a
+I<Cuckoo> filter is better for such low rates). Adding more keys than
+C<items> increases the false positive rate. It is the caller's
+responsibility to deallocate the new filter with I<bloom_release(3)> or
+I<bloom_destroy(3)>. On success, returns the new filter. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Bloom *bloom_create(size_t items, double fp_rate)
+{
+	double bits, hashes;
+	size_t blocks;
+
+	if (!(fp_rate > 0.0 && fp_rate < 1.0))
+		return set_errnull(EINVAL);
+
+	if (!items)
+		items = 1;
+
+	/* Standard sizing, plus 2% per hash for the uneven filling of blocks */
+
+	hashes = -log2_of(fp_rate);
+	bits = (double)items * hashes / M_LN2 * (1.0 + hashes / 50.0);
+
+	if (bits / (BLOOM_BLOCK * 8) >= (double)((size_t)-1 / BLOOM_BLOCK))
+		return set_errnull(ENOMEM);
+
+	blocks = (size_t)(bits / (BLOOM_BLOCK * 8)) + 1;
+	hashes = (double)(int)(hashes + 0.5);
+
+	if (hashes < 1)
+		hashes = 1;
+
+	if (hashes > BLOOM_MAX_HASHES)
+		hashes = BLOOM_MAX_HASHES;
+
+	return bloom_alloc(blocks, (int)hashes);
+}
+
+/*
+
+=item C<void bloom_release(Bloom *bloom)>
+
+Releases (deallocates) C<bloom>.
+
+=cut
+
+*/
+
+void bloom_release(Bloom *bloom)
+{
+	if (!bloom)
+		return;
+
+	free(bloom->bits);
+	mem_release(bloom);
+}
+
+/*
+
+=item C<void *bloom_destroy(Bloom **bloom)>
+
+Destroys (deallocates and sets to C<null>) C<*bloom>. Returns C<null>.
+
+=cut
+
+*/
+
+void *bloom_destroy(Bloom **bloom)
+{
+	if (bloom && *bloom)
+	{
+		bloom_release(*bloom);
+		*bloom = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int bloom_add(Bloom *bloom, const void *key, size_t length)>
+
+Adds the C<length> bytes at C<key> to C<bloom>. The bits are set with
+atomic operations, so multiple threads may call I<bloom_add(3)> and
+I<bloom_test(3)> on the same filter at the same time without locking. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int bloom_add(Bloom *bloom, const void *key, size_t length)
+{
+	unsigned char *block;
+	unsigned long a, b, pos;
+	int i;
+
+	if (!bloom || (!key && length))
+		return set_errno(EINVAL);
+
+	block = bloom_block(bloom, hash_bytes(key, length, 0), &a, &b);
+
+	for (i = 0; i < bloom->hashes; ++i, a += b)
+	{
+		pos = (a & 0xffffffffUL) >> 23;
+		__atomic_fetch_or(&block[pos >> 3], (unsigned char)(1 << (pos & 7)), __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+/*
+
+=item C<int bloom_add_unlocked(Bloom *bloom, const void *key, size_t length)>
+
+Equivalent to I<bloom_add(3)> except that atomic operations are not used,
+so it must not be called while other threads are using C<bloom>. This is
+faster for building a filter in a single thread.
+
+=cut
+
+*/
+
+int bloom_add_unlocked(Bloom *bloom, const void *key, size_t length)
+{
+	unsigned char *block;
+	unsigned long a, b, pos;
+	int i;
+
+	if (!bloom || (!key && length))
+		return set_errno(EINVAL);
+
+	block = bloom_block(bloom, hash_bytes(key, length, 0), &a, &b);
+
+	for (i = 0; i < bloom->hashes; ++i, a += b)
+	{
+		pos = (a & 0xffffffffUL) >> 23;
+		block[pos >> 3] |= (unsigned char)(1 << (pos & 7));
+	}
+
+	return 0;
+}
+
+/*
+
+=item C<int bloom_test(const Bloom *bloom, const void *key, size_t length)>
+
+Returns whether or not the C<length> bytes at C<key> might have been added
+to C<bloom>. Returns C<1> if so (which might be a false positive), or C<0>
+if not (which is always correct). On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int bloom_test(const Bloom *bloom, const void *key, size_t length)
+{
+	const unsigned char *block;
+	unsigned long a, b, pos;
+	int i;
+
+	if (!bloom || (!key && length))
+		return set_errno(EINVAL);
+
+	block = bloom_block(bloom, hash_bytes(key, length, 0), &a, &b);
+
+	for (i = 0; i < bloom->hashes; ++i, a += b)
+	{
+		pos = (a & 0xffffffffUL) >> 23;
+
+		if (!(__atomic_load_n(&block[pos >> 3], __ATOMIC_RELAXED) & (1 << (pos & 7))))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+
+=item C<ssize_t bloom_serialise(const Bloom *bloom, void *buf, size_t size)>
+
+Stores a portable copy of C<bloom> in the C<size> bytes at C<buf>. If
+C<buf> is C<null>, just returns the number of bytes needed. The serialised
+form is a 14-byte header followed by the filter's blocks. On success,
+returns the number of bytes stored. On error, returns C<-1> with C<errno>
+set appropriately (C<ENOSPC> if C<size> is too small).
+
+=cut
+
+*/
+
+ssize_t bloom_serialise(const Bloom *bloom, void *buf, size_t size)
+{
+	size_t bytes;
+
+	if (!bloom)
+		return set_errno(EINVAL);
+
+	if (bloom->blocks > 0x7fffffffUL)
+		return set_errno(ERANGE);
+
+	bytes = bloom->blocks * BLOOM_BLOCK;
+
+	if (!buf)
+		return FILTER_HEADER + bytes;
+
+	if (size < FILTER_HEADER + bytes)
+		return set_errno(ENOSPC);
+
+	if (pack(buf, size, "a4ccii", "SLbf", FILTER_VERSION, bloom->hashes, (int)bloom->blocks, 0) != FILTER_HEADER)
+		return -1;
+
+	memcpy((char *)buf + FILTER_HEADER, bloom->bits, bytes);
+
+	return FILTER_HEADER + bytes;
+}
+
+/*
+
+=item C<Bloom *bloom_deserialise(const void *buf, size_t size)>
+
+Creates a I<Bloom> filter from the C<size> bytes at C<buf> that were stored
+by I<bloom_serialise(3)>. It is the caller's responsibility to deallocate
+the new filter with I<bloom_release(3)> or I<bloom_destroy(3)>. On success,
+returns the new filter. On error, returns C<null> with C<errno> set
+appropriately (C<EINVAL> if C<buf> doesn't contain a serialised
+I<Bloom> filter).
+
+=cut
+
+*/
+
+Bloom *bloom_deserialise(const void *buf, size_t size)
+{
+	char magic[4];
+	signed char version, hashes;
+	int blocks, items;
+	Bloom *bloom;
+
+	if (!buf || size < FILTER_HEADER)
+		return set_errnull(EINVAL);
+
+	if (unpack((void *)buf, size, "a4ccii", magic, &version, &hashes, &blocks, &items) != FILTER_HEADER)
+		return NULL;
+
+	if (memcmp(magic, "SLbf", 4) || version != FILTER_VERSION || hashes < 1 || hashes > BLOOM_MAX_HASHES || blocks < 1)
+		return set_errnull(EINVAL);
+
+	if ((size - FILTER_HEADER) / BLOOM_BLOCK < (size_t)blocks)
+		return set_errnull(EINVAL);
+
+	if (!(bloom = bloom_alloc((size_t)blocks, hashes)))
+		return NULL;
+
+	memcpy(bloom->bits, (const char *)buf + FILTER_HEADER, bloom->blocks * BLOOM_BLOCK);
+
+	return bloom;
+}
+
+/*
+
+C<unsigned long fingerprint_get(const Cuckoo *cuckoo, size_t bucket, int slot)>
+
+Returns the fingerprint in C<slot> of C<bucket> (C<0> if it is empty).
+Fingerprints are stored in little-endian order, so the table is portable.
+
+*/
+
+static unsigned long fingerprint_get(const Cuckoo *cuckoo, size_t bucket, int slot)
+{
+	const unsigned char *p = cuckoo->table + (bucket * CUCKOO_SLOTS + slot) * cuckoo->width;
+
+	switch (cuckoo->width)
+	{
+		case 1: return p[0];
+		case 2: return p[0] | (unsigned long)p[1] << 8;
+		default: return p[0] | (unsigned long)p[1] << 8 | (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+	}
+}
+
+/*
+
+C<void fingerprint_set(Cuckoo *cuckoo, size_t bucket, int slot, unsigned long fingerprint)>
+
+Stores C<fingerprint> in C<slot> of C<bucket> (C<0> empties it).
+
+*/
+
+static void fingerprint_set(Cuckoo *cuckoo, size_t bucket, int slot, unsigned long fingerprint)
+{
+	unsigned char *p = cuckoo->table + (bucket * CUCKOO_SLOTS + slot) * cuckoo->width;
+	int i;
+
+	for (i = 0; i < cuckoo->width; ++i, fingerprint >>= 8)
+		p[i] = (unsigned char)(fingerprint & 0xff);
+}
+
+/*
+
+C<unsigned long fingerprint(const Cuckoo *cuckoo, const void *key, size_t length, size_t *bucket)>
+
+Returns the (non-zero) fingerprint of the C<length> bytes at C<key>, and
+stores the index of its first bucket in C<*bucket>.
+
+*/
+
+static unsigned long fingerprint(const Cuckoo *cuckoo, const void *key, size_t length, size_t *bucket)
+{
+	unsigned long long h = hash_bytes(key, length, 0);
+	unsigned long long max = (1ULL << (cuckoo->width * 8)) - 1;
+
+	*bucket = (size_t)(h & (cuckoo->buckets - 1));
+
+	return (unsigned long)((h >> 32) % max + 1);
+}
+
+/*
+
+C<size_t alternate(const Cuckoo *cuckoo, size_t bucket, unsigned long fingerprint)>
+
+Returns the other bucket for C<fingerprint> when it is in C<bucket>. The
+alternate of the alternate is the original bucket, so a fingerprint can be
+moved between its two buckets without knowing its key.
+
+*/
+
+static size_t alternate(const Cuckoo *cuckoo, size_t bucket, unsigned long fingerprint)
+{
+	return (bucket ^ (size_t)hash_mix64(fingerprint)) & (cuckoo->buckets - 1);
+}
+
+/*
+
+C<int bucket_insert(Cuckoo *cuckoo, size_t bucket, unsigned long fingerprint)>
+
+Stores C<fingerprint> in an empty slot of C<bucket>. Returns C<1> if it was
+stored, or C<0> if the bucket is full.
+
+*/
+
+static int bucket_insert(Cuckoo *cuckoo, size_t bucket, unsigned long fingerprint)
+{
+	int slot;
+
+	for (slot = 0; slot < CUCKOO_SLOTS; ++slot)
+	{
+		if (!fingerprint_get(cuckoo, bucket, slot))
+		{
+			fingerprint_set(cuckoo, bucket, slot, fingerprint);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+
+C<int bucket_find(const Cuckoo *cuckoo, size_t bucket, unsigned long fingerprint)>
+
+Returns the slot in C<bucket> that contains C<fingerprint>, or C<-1> if
+there is none.
+
+*/
+
+static int bucket_find(const Cuckoo *cuckoo, size_t bucket, unsigned long fingerprint)
+{
+	int slot;
+
+	for (slot = 0; slot < CUCKOO_SLOTS; ++slot)
+		if (fingerprint_get(cuckoo, bucket, slot) == fingerprint)
+			return slot;
+
+	return -1;
+}
+
+/*
+
+C<Cuckoo *cuckoo_alloc(Locker *locker, size_t buckets, int width)>
+
+Creates an empty I<Cuckoo> filter with C<buckets> buckets of fingerprints
+that are C<width> bytes long. On success, returns the new filter. On error,
+returns C<null> with C<errno> set appropriately.
+
+*/
+
+static Cuckoo *cuckoo_alloc(Locker *locker, size_t buckets, int width)
+{
+	Cuckoo *cuckoo;
+
+	if (buckets > (size_t)-1 / (CUCKOO_SLOTS * width))
+		return set_errnull(ENOMEM);
+
+	if (!(cuckoo = mem_new(Cuckoo))) /* XXX decouple */
+		return NULL;
+
+	if (!(cuckoo->table = mem_create(buckets * CUCKOO_SLOTS * width, unsigned char)))
+	{
+		mem_release(cuckoo);
+		return NULL;
+	}
+
+	memset(cuckoo->table, 0, buckets * CUCKOO_SLOTS * width);
+	cuckoo->buckets = buckets;
+	cuckoo->items = 0;
+	cuckoo->width = width;
+	cuckoo->random = 2463534242UL;
+	cuckoo->locker = locker;
+
+	return cuckoo;
+}
+
+/*
+
+=item C<Cuckoo *cuckoo_create(size_t items, double fp_rate)>
+
+Creates an empty cuckoo filter with room for at least C<items> keys, with a
+false positive rate of at most about C<fp_rate> (which must be between
+C<0> and C<1>). Fingerprints are 1, 2 or 4 bytes long, whichever is the
+smallest that achieves C<fp_rate>, and the number of buckets is a power of
+two. So a filter often has more room, and a lower false positive rate, than
+requested. It is the caller's responsibility to deallocate the new filter
+with I<cuckoo_release(3)> or I<cuckoo_destroy(3)>. On success, returns the
+new filter. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Cuckoo *cuckoo_create(size_t items, double fp_rate)
+{
+	return cuckoo_create_with_locker(NULL, items, fp_rate);
+}
+
+/*
+
+=item C<Cuckoo *cuckoo_create_with_locker(Locker *locker, size_t items, double fp_rate)>
+
+Equivalent to I<cuckoo_create(3)> except that multiple threads accessing the
+new filter will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+Cuckoo *cuckoo_create_with_locker(Locker *locker, size_t items, double fp_rate)
+{
+	double needed;
+	size_t buckets;
+	int width;
+
+	if (!(fp_rate > 0.0 && fp_rate < 1.0))
+		return set_errnull(EINVAL);
+
+	/* A test compares against two buckets of fingerprints */
+
+	needed = log2_of(2.0 * CUCKOO_SLOTS / fp_rate);
+	width = (needed <= 8) ? 1 : (needed <= 16) ? 2 : 4;
+
+	needed = (double)items / (CUCKOO_SLOTS * CUCKOO_LOAD);
+
+	for (buckets = 1; (double)buckets < needed; buckets <<= 1)
+		if (buckets > (size_t)-1 / 4)
+			return set_errnull(ENOMEM);
+
+	return cuckoo_alloc(locker, buckets, width);
+}
+
+/*
+
+=item C<int cuckoo_rdlock(const Cuckoo *cuckoo)>
+
+Claims a read lock on C<cuckoo> (if C<cuckoo> was created with a
+I<Locker>). This is needed when multiple read-only I<filter(3)> module
+functions need to be called atomically. It is the client's responsibility
+to call I<cuckoo_unlock(3)> after the atomic operation. The only functions
+that may be called on C<cuckoo> between calls to I<cuckoo_rdlock(3)> and
+I<cuckoo_unlock(3)> are any read-only I<cuckoo> functions whose name ends
+with C<_unlocked>. On success, returns C<0>. On error, returns an error
+code.
+
+=cut
+
+*/
+
+#define cuckoo_rdlock(cuckoo) ((cuckoo) ? locker_rdlock((cuckoo)->locker) : EINVAL)
+#define cuckoo_wrlock(cuckoo) ((cuckoo) ? locker_wrlock((cuckoo)->locker) : EINVAL)
+#define cuckoo_unlock(cuckoo) ((cuckoo) ? locker_unlock((cuckoo)->locker) : EINVAL)
+
+int (cuckoo_rdlock)(const Cuckoo *cuckoo)
+{
+	return cuckoo_rdlock(cuckoo);
+}
+
+/*
+
+=item C<int cuckoo_wrlock(const Cuckoo *cuckoo)>
+
+Claims a write lock on C<cuckoo> (if C<cuckoo> was created with a
+I<Locker>). This is needed when multiple read/write I<filter(3)> module
+functions need to be called atomically. It is the client's responsibility
+to call I<cuckoo_unlock(3)> after the atomic operation. The only functions
+that may be called on C<cuckoo> between calls to I<cuckoo_wrlock(3)> and
+I<cuckoo_unlock(3)> are any I<cuckoo> functions whose name ends with
+C<_unlocked>. On success, returns C<0>. On error, returns an error code.
+
+=cut
+
+*/
+
+int (cuckoo_wrlock)(const Cuckoo *cuckoo)
+{
+	return cuckoo_wrlock(cuckoo);
+}
+
+/*
+
+=item C<int cuckoo_unlock(const Cuckoo *cuckoo)>
+
+Unlocks a read or write lock on C<cuckoo> obtained with
+I<cuckoo_rdlock(3)> or I<cuckoo_wrlock(3)> (if C<cuckoo> was created with a
+C<locker>). On success, returns C<0>. On error, returns an error code.
+
+=cut
+
+*/
+
+int (cuckoo_unlock)(const Cuckoo *cuckoo)
+{
+	return cuckoo_unlock(cuckoo);
+}
+
+/*
+
+=item C<void cuckoo_release(Cuckoo *cuckoo)>
+
+Releases (deallocates) C<cuckoo>.
+
+=cut
+
+*/
+
+void cuckoo_release(Cuckoo *cuckoo)
+{
+	if (!cuckoo)
+		return;
+
+	mem_release(cuckoo->table);
+	mem_release(cuckoo);
+}
+
+/*
+
+=item C<void *cuckoo_destroy(Cuckoo **cuckoo)>
+
+Destroys (deallocates and sets to C<null>) C<*cuckoo>. Returns C<null>.
+B<Note:> Filters shared by multiple threads must not be destroyed until
+after all threads have finished with it.
+
+=cut
+
+*/
+
+void *cuckoo_destroy(Cuckoo **cuckoo)
+{
+	if (cuckoo && *cuckoo)
+	{
+		cuckoo_release(*cuckoo);
+		*cuckoo = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int cuckoo_add(Cuckoo *cuckoo, const void *key, size_t length)>
+
+Adds the C<length> bytes at C<key> to C<cuckoo>. If neither of the key's
+buckets has room, other fingerprints are moved to their alternate buckets
+to make room. If that fails, C<cuckoo> is left unchanged and the filter
+should be considered full. On success, returns C<0>. On error, returns
+C<-1> with C<errno> set appropriately (C<ENOSPC> when the filter is full).
+
+=cut
+
+*/
+
+int cuckoo_add(Cuckoo *cuckoo, const void *key, size_t length)
+{
+	int ret;
+	int err;
+
+	if (!cuckoo)
+		return set_errno(EINVAL);
+
+	if ((err = cuckoo_wrlock(cuckoo)))
+		return set_errno(err);
+
+	ret = cuckoo_add_unlocked(cuckoo, key, length);
+
+	if ((err = cuckoo_unlock(cuckoo)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int cuckoo_add_unlocked(Cuckoo *cuckoo, const void *key, size_t length)>
+
+Equivalent to I<cuckoo_add(3)> except that C<cuckoo> is not write-locked.
+
+=cut
+
+*/
+
+int cuckoo_add_unlocked(Cuckoo *cuckoo, const void *key, size_t length)
+{
+	size_t path_bucket[CUCKOO_MAX_KICKS];
+	unsigned char path_slot[CUCKOO_MAX_KICKS];
+	unsigned long fp, victim;
+	size_t bucket;
+	int kicks, slot;
+
+	if (!cuckoo || (!key && length))
+		return set_errno(EINVAL);
+
+	fp = fingerprint(cuckoo, key, length, &bucket);
+
+	if (bucket_insert(cuckoo, bucket, fp) || bucket_insert(cuckoo, bucket = alternate(cuckoo, bucket, fp), fp))
+	{
+		++cuckoo->items;
+		return 0;
+	}
+
+	/* Evict random fingerprints to their alternate buckets */
+
+	for (kicks = 0; kicks < CUCKOO_MAX_KICKS; ++kicks)
+	{
+		cuckoo->random ^= (cuckoo->random << 13) & 0xffffffffUL;
+		cuckoo->random ^= cuckoo->random >> 17;
+		cuckoo->random ^= (cuckoo->random << 5) & 0xffffffffUL;
+
+		slot = (int)(cuckoo->random % CUCKOO_SLOTS);
+		victim = fingerprint_get(cuckoo, bucket, slot);
+		fingerprint_set(cuckoo, bucket, slot, fp);
+		path_bucket[kicks] = bucket;
+		path_slot[kicks] = (unsigned char)slot;
+
+		fp = victim;
+		bucket = alternate(cuckoo, bucket, fp);
+
+		if (bucket_insert(cuckoo, bucket, fp))
+		{
+			++cuckoo->items;
+			return 0;
+		}
+	}
+
+	/* Undo the evictions so that nothing is lost */
+
+	while (kicks--)
+	{
+		victim = fingerprint_get(cuckoo, path_bucket[kicks], path_slot[kicks]);
+		fingerprint_set(cuckoo, path_bucket[kicks], path_slot[kicks], fp);
+		fp = victim;
+	}
+
+	return set_errno(ENOSPC);
+}
+
+/*
+
+=item C<int cuckoo_remove(Cuckoo *cuckoo, const void *key, size_t length)>
+
+Removes the C<length> bytes at C<key> from C<cuckoo>. The key must have
+been added (otherwise, another key with the same fingerprint might be
+removed instead). On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately (C<ENOENT> when the key isn't present).
+
+=cut
+
+*/
+
+int cuckoo_remove(Cuckoo *cuckoo, const void *key, size_t length)
+{
+	int ret;
+	int err;
+
+	if (!cuckoo)
+		return set_errno(EINVAL);
+
+	if ((err = cuckoo_wrlock(cuckoo)))
+		return set_errno(err);
+
+	ret = cuckoo_remove_unlocked(cuckoo, key, length);
+
+	if ((err = cuckoo_unlock(cuckoo)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int cuckoo_remove_unlocked(Cuckoo *cuckoo, const void *key, size_t length)>
+
+Equivalent to I<cuckoo_remove(3)> except that C<cuckoo> is not
+write-locked.
+
+=cut
+
+*/
+
+int cuckoo_remove_unlocked(Cuckoo *cuckoo, const void *key, size_t length)
+{
+	unsigned long fp;
+	size_t bucket;
+	int slot;
+
+	if (!cuckoo || (!key && length))
+		return set_errno(EINVAL);
+
+	fp = fingerprint(cuckoo, key, length, &bucket);
+
+	if ((slot = bucket_find(cuckoo, bucket, fp)) == -1)
+		if ((slot = bucket_find(cuckoo, bucket = alternate(cuckoo, bucket, fp), fp)) == -1)
+			return set_errno(ENOENT);
+
+	fingerprint_set(cuckoo, bucket, slot, 0);
+	--cuckoo->items;
+
+	return 0;
+}
+
+/*
+
+=item C<int cuckoo_test(const Cuckoo *cuckoo, const void *key, size_t length)>
+
+Returns whether or not the C<length> bytes at C<key> might be present in
+C<cuckoo>. Returns C<1> if so (which might be a false positive), or C<0> if
+not (which is always correct). On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int cuckoo_test(const Cuckoo *cuckoo, const void *key, size_t length)
+{
+	int ret;
+	int err;
+
+	if (!cuckoo)
+		return set_errno(EINVAL);
+
+	if ((err = cuckoo_rdlock(cuckoo)))
+		return set_errno(err);
+
+	ret = cuckoo_test_unlocked(cuckoo, key, length);
+
+	if ((err = cuckoo_unlock(cuckoo)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int cuckoo_test_unlocked(const Cuckoo *cuckoo, const void *key, size_t length)>
+
+Equivalent to I<cuckoo_test(3)> except that C<cuckoo> is not read-locked.
+
+=cut
+
+*/
+
+int cuckoo_test_unlocked(const Cuckoo *cuckoo, const void *key, size_t length)
+{
+	unsigned long fp;
+	size_t bucket;
+
+	if (!cuckoo || (!key && length))
+		return set_errno(EINVAL);
+
+	fp = fingerprint(cuckoo, key, length, &bucket);
+
+	return bucket_find(cuckoo, bucket, fp) != -1 || bucket_find(cuckoo, alternate(cuckoo, bucket, fp), fp) != -1;
+}
+
+/*
+
+=item C<ssize_t cuckoo_size(const Cuckoo *cuckoo)>
+
+Returns the number of keys in C<cuckoo>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t cuckoo_size(const Cuckoo *cuckoo)
+{
+	ssize_t size;
+	int err;
+
+	if (!cuckoo)
+		return set_errno(EINVAL);
+
+	if ((err = cuckoo_rdlock(cuckoo)))
+		return set_errno(err);
+
+	size = cuckoo_size_unlocked(cuckoo);
+
+	if ((err = cuckoo_unlock(cuckoo)))
+		return set_errno(err);
+
+	return size;
+}
+
+/*
+
+=item C<ssize_t cuckoo_size_unlocked(const Cuckoo *cuckoo)>
+
+Equivalent to I<cuckoo_size(3)> except that C<cuckoo> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t cuckoo_size_unlocked(const Cuckoo *cuckoo)
+{
+	if (!cuckoo)
+		return set_errno(EINVAL);
+
+	return cuckoo->items;
+}
+
+/*
+
+=item C<ssize_t cuckoo_serialise(const Cuckoo *cuckoo, void *buf, size_t size)>
+
+Stores a portable copy of C<cuckoo> in the C<size> bytes at C<buf>. If
+C<buf> is C<null>, just returns the number of bytes needed. The serialised
+form is a 14-byte header followed by the filter's fingerprints. On
+success, returns the number of bytes stored. On error, returns C<-1> with
+C<errno> set appropriately (C<ENOSPC> if C<size> is too small).
+
+=cut
+
+*/
+
+ssize_t cuckoo_serialise(const Cuckoo *cuckoo, void *buf, size_t size)
+{
+	ssize_t ret;
+	int err;
+
+	if (!cuckoo)
+		return set_errno(EINVAL);
+
+	if ((err = cuckoo_rdlock(cuckoo)))
+		return set_errno(err);
+
+	ret = cuckoo_serialise_unlocked(cuckoo, buf, size);
+
+	if ((err = cuckoo_unlock(cuckoo)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<ssize_t cuckoo_serialise_unlocked(const Cuckoo *cuckoo, void *buf, size_t size)>
+
+Equivalent to I<cuckoo_serialise(3)> except that C<cuckoo> is not
+read-locked.
+
+=cut
+
+*/
+
+ssize_t cuckoo_serialise_unlocked(const Cuckoo *cuckoo, void *buf, size_t size)
+{
+	size_t bytes;
+
+	if (!cuckoo)
+		return set_errno(EINVAL);
+
+	if (cuckoo->buckets > 0x7fffffffUL || cuckoo->items > 0x7fffffffUL)
+		return set_errno(ERANGE);
+
+	bytes = cuckoo->buckets * CUCKOO_SLOTS * cuckoo->width;
+
+	if (!buf)
+		return FILTER_HEADER + bytes;
+
+	if (size < FILTER_HEADER + bytes)
+		return set_errno(ENOSPC);
+
+	if (pack(buf, size, "a4ccii", "SLcf", FILTER_VERSION, cuckoo->width, (int)cuckoo->buckets, (int)cuckoo->items) != FILTER_HEADER)
+		return -1;
+
+	memcpy((char *)buf + FILTER_HEADER, cuckoo->table, bytes);
+
+	return FILTER_HEADER + bytes;
+}
+
+/*
+
+=item C<Cuckoo *cuckoo_deserialise(const void *buf, size_t size)>
+
+Creates a I<Cuckoo> filter from the C<size> bytes at C<buf> that were
+stored by I<cuckoo_serialise(3)>. It is the caller's responsibility to
+deallocate the new filter with I<cuckoo_release(3)> or
+I<cuckoo_destroy(3)>. On success, returns the new filter. On error,
+returns C<null> with C<errno> set appropriately (C<EINVAL> if C<buf>
+doesn't contain a serialised I<Cuckoo> filter).
+
+=cut
+
+*/
+
+Cuckoo *cuckoo_deserialise(const void *buf, size_t size)
+{
+	return cuckoo_deserialise_with_locker(NULL, buf, size);
+}
+
+/*
+
+=item C<Cuckoo *cuckoo_deserialise_with_locker(Locker *locker, const void *buf, size_t size)>
+
+Equivalent to I<cuckoo_deserialise(3)> except that multiple threads
+accessing the new filter will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+Cuckoo *cuckoo_deserialise_with_locker(Locker *locker, const void *buf, size_t size)
+{
+	char magic[4];
+	signed char version, width;
+	int buckets, items;
+	Cuckoo *cuckoo;
+
+	if (!buf || size < FILTER_HEADER)
+		return set_errnull(EINVAL);
+
+	if (unpack((void *)buf, size, "a4ccii", magic, &version, &width, &buckets, &items) != FILTER_HEADER)
+		return NULL;
+
+	if (memcmp(magic, "SLcf", 4) || version != FILTER_VERSION || (width != 1 && width != 2 && width != 4))
+		return set_errnull(EINVAL);
+
+	if (buckets < 1 || (buckets & (buckets - 1)) || items < 0 || (size_t)items > (size_t)buckets * CUCKOO_SLOTS)
+		return set_errnull(EINVAL);
+
+	if ((size - FILTER_HEADER) / (CUCKOO_SLOTS * width) < (size_t)buckets)
+		return set_errnull(EINVAL);
+
+	if (!(cuckoo = cuckoo_alloc(locker, (size_t)buckets, width)))
+		return NULL;
+
+	memcpy(cuckoo->table, (const char *)buf + FILTER_HEADER, cuckoo->buckets * CUCKOO_SLOTS * width);
+	cuckoo->items = (size_t)items;
+
+	return cuckoo;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range, or a buffer doesn't contain a
+serialised filter.
+
+=item C<ENOSPC>
+
+When a cuckoo filter is full, or a buffer is too small.
+
+=item C<ENOENT>
+
+When removing a key that isn't in a cuckoo filter.
+
+=item C<ERANGE>
+
+When a filter is too big to serialise (more than 2^31 blocks or buckets).
+
+=back
+
+=head1 MT-Level
+
+I<MT-Disciplined>
+
+I<bloom_add(3)> and I<bloom_test(3)> are I<MT-Safe> (they use atomic
+operations rather than locks). I<bloom_add_unlocked(3)> is not.
+
+By default, I<Cuckoo> filters are not I<MT-Safe>. I<Cuckoo> filters created
+with I<cuckoo_create_with_locker(3)> are synchronised by the given
+I<Locker>, in the same way as I<List>s (see I<list(3)> for details).
+
+=head1 EXAMPLES
+
+Check a blocklist of client IDs without looking most of them up:
+
+    #include <slack/std.h>
+    #include <slack/map.h>
+    #include <slack/filter.h>
+
+    int main()
+    {
+        Map *blocked = map_create(NULL);
+        Bloom *filter = bloom_create(100000, 0.01);
+        const char *id = "client-42";
+
+        map_add(blocked, "client-13", "spam");
+        bloom_add(filter, "client-13", 9);
+
+        if (bloom_test(filter, id, strlen(id)) && map_get(blocked, id))
+            printf("%s is blocked\n", id);
+        else
+            printf("%s is not blocked\n", id);
+
+        bloom_destroy(&filter);
+        map_destroy(&blocked);
+
+        return EXIT_SUCCESS;
+    }
+
+Maintain a set of active sessions with deletion, and save it:
+
+    #include <slack/std.h>
+    #include <slack/filter.h>
+
+    int main()
+    {
+        Cuckoo *sessions = cuckoo_create(1000000, 0.001);
+        ssize_t size;
+        void *buf;
+
+        cuckoo_add(sessions, "abc123", 6);
+        cuckoo_add(sessions, "def456", 6);
+        cuckoo_remove(sessions, "abc123", 6);
+
+        if ((size = cuckoo_serialise(sessions, NULL, 0)) != -1 && (buf = malloc(size)))
+        {
+            cuckoo_serialise(sessions, buf, size);
+            // write buf to a file, and later...
+            cuckoo_destroy(&sessions);
+            sessions = cuckoo_deserialise(buf, size);
+            free(buf);
+        }
+
+        printf("%d\n", cuckoo_test(sessions, "def456", 6)); // prints 1
+
+        cuckoo_destroy(&sessions);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<hash(3)>,
+I<map(3)>,
+I<locker(3)>,
+I<net(3)>
+
+=head1 AUTHOR
+
+20230824 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#define TEST_ACT(i, action) \
+	if (!(action)) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define KEYS 10000
+#define THREADS 4
+
+static char keys[KEYS][16];
+
+static Bloom *shared_bloom;
+static Cuckoo *shared_cuckoo;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *bloom_adder(void *arg)
+{
+	size_t t = (size_t)arg, i;
+
+	for (i = t; i < KEYS; i += THREADS)
+		bloom_add(shared_bloom, keys[i], strlen(keys[i]));
+
+	return NULL;
+}
+
+static void *cuckoo_adder(void *arg)
+{
+	size_t t = (size_t)arg, i;
+
+	for (i = t; i < KEYS; i += THREADS)
+		cuckoo_add(shared_cuckoo, keys[i], strlen(keys[i]));
+
+	return NULL;
+}
+
+int main(int ac, char **av)
+{
+	int errors = 0;
+	Bloom *bloom, *bloom2;
+	Cuckoo *cuckoo, *cuckoo2;
+	Locker *locker;
+	pthread_t thread[THREADS];
+	char key[32];
+	void *buf;
+	ssize_t size;
+	int i, ok, hits, added;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	printf("Testing: %s\n", "filter");
+
+	for (i = 0; i < KEYS; ++i)
+		snprintf(keys[i], sizeof keys[i], "key%d", i);
+
+	/* Test Bloom filters */
+
+	TEST_ACT(1, (bloom = bloom_create(KEYS, 0.01)))
+
+	for (i = 0; i < KEYS; ++i)
+		bloom_add_unlocked(bloom, keys[i], strlen(keys[i]));
+
+	for (ok = 1, i = 0; i < KEYS; ++i)
+		if (bloom_test(bloom, keys[i], strlen(keys[i])) != 1)
+			ok = 0;
+
+	TEST_ACT(2, ok)
+
+	for (hits = 0, i = 0; i < 100000; ++i)
+	{
+		snprintf(key, sizeof key, "missing%d", i);
+		hits += bloom_test(bloom, key, strlen(key));
+	}
+
+	if (hits > 1500)
+		++errors, printf("Test3: bloom false positive rate %d/100000 (expected about 1000)\n", hits);
+
+	TEST_ACT(4, (size = bloom_serialise(bloom, NULL, 0)) > 14 && (buf = malloc(size)))
+	TEST_ACT(5, bloom_serialise(bloom, buf, size - 1) == -1 && errno == ENOSPC)
+	TEST_ACT(6, bloom_serialise(bloom, buf, size) == size)
+	TEST_ACT(7, (bloom2 = bloom_deserialise(buf, size)))
+
+	for (ok = 1, i = 0; i < KEYS; ++i)
+		if (bloom_test(bloom2, keys[i], strlen(keys[i])) != 1)
+			ok = 0;
+
+	for (i = 0; i < 1000; ++i)
+	{
+		snprintf(key, sizeof key, "missing%d", i);
+
+		if (bloom_test(bloom2, key, strlen(key)) != bloom_test(bloom, key, strlen(key)))
+			ok = 0;
+	}
+
+	TEST_ACT(8, ok)
+	bloom_destroy(&bloom2);
+	TEST_ACT(9, !bloom2)
+	TEST_ACT(10, !bloom_deserialise(buf, size - 1) && errno == EINVAL)
+	((char *)buf)[0] = 'X';
+	TEST_ACT(11, !bloom_deserialise(buf, size) && errno == EINVAL)
+	free(buf);
+	bloom_destroy(&bloom);
+
+	TEST_ACT(12, (shared_bloom = bloom_create(KEYS, 0.001)))
+
+	for (i = 0; i < THREADS; ++i)
+		pthread_create(&thread[i], NULL, bloom_adder, (void *)(size_t)i);
+
+	for (i = 0; i < THREADS; ++i)
+		pthread_join(thread[i], NULL);
+
+	for (ok = 1, i = 0; i < KEYS; ++i)
+		if (bloom_test(shared_bloom, keys[i], strlen(keys[i])) != 1)
+			ok = 0;
+
+	TEST_ACT(13, ok)
+	bloom_destroy(&shared_bloom);
+
+	/* Test cuckoo filters */
+
+	TEST_ACT(14, (cuckoo = cuckoo_create(KEYS, 0.01)))
+	TEST_ACT(15, cuckoo_size(cuckoo) == 0)
+	TEST_ACT(16, cuckoo_test(cuckoo, "abc", 3) == 0)
+	TEST_ACT(17, cuckoo_add(cuckoo, "abc", 3) == 0 && cuckoo_test(cuckoo, "abc", 3) == 1)
+	TEST_ACT(18, cuckoo_add(cuckoo, "abc", 3) == 0 && cuckoo_size(cuckoo) == 2)
+	TEST_ACT(19, cuckoo_remove(cuckoo, "abc", 3) == 0 && cuckoo_test(cuckoo, "abc", 3) == 1)
+	TEST_ACT(20, cuckoo_remove(cuckoo, "abc", 3) == 0 && cuckoo_test(cuckoo, "abc", 3) == 0)
+	TEST_ACT(21, cuckoo_remove(cuckoo, "abc", 3) == -1 && errno == ENOENT)
+	TEST_ACT(22, cuckoo_size(cuckoo) == 0)
+
+	for (ok = 1, i = 0; i < KEYS; ++i)
+		if (cuckoo_add(cuckoo, keys[i], strlen(keys[i])) == -1)
+			ok = 0;
+
+	TEST_ACT(23, ok && cuckoo_size(cuckoo) == KEYS)
+
+	for (ok = 1, i = 0; i < KEYS; ++i)
+		if (cuckoo_test(cuckoo, keys[i], strlen(keys[i])) != 1)
+			ok = 0;
+
+	TEST_ACT(24, ok)
+
+	for (hits = 0, i = 0; i < 100000; ++i)
+	{
+		snprintf(key, sizeof key, "missing%d", i);
+		hits += cuckoo_test(cuckoo, key, strlen(key));
+	}
+
+	if (hits > 1500)
+		++errors, printf("Test25: cuckoo false positive rate %d/100000 (expected under 1000)\n", hits);
+
+	TEST_ACT(26, (size = cuckoo_serialise(cuckoo, NULL, 0)) > 14 && (buf = malloc(size)))
+	TEST_ACT(27, cuckoo_serialise(cuckoo, buf, size - 1) == -1 && errno == ENOSPC)
+	TEST_ACT(28, cuckoo_serialise(cuckoo, buf, size) == size)
+	TEST_ACT(29, (cuckoo2 = cuckoo_deserialise(buf, size)) && cuckoo_size(cuckoo2) == KEYS)
+
+	for (ok = 1, i = 0; i < KEYS; ++i)
+		if (cuckoo_test(cuckoo2, keys[i], strlen(keys[i])) != 1)
+			ok = 0;
+
+	TEST_ACT(30, ok)
+	TEST_ACT(31, !bloom_deserialise(buf, size) && errno == EINVAL)
+	TEST_ACT(32, !cuckoo_deserialise(buf, 13) && errno == EINVAL)
+	free(buf);
+
+	for (ok = 1, i = 0; i < KEYS; i += 2)
+		if (cuckoo_remove(cuckoo2, keys[i], strlen(keys[i])) == -1)
+			ok = 0;
+
+	for (i = 1; i < KEYS; i += 2)
+		if (cuckoo_test(cuckoo2, keys[i], strlen(keys[i])) != 1)
+			ok = 0;
+
+	TEST_ACT(33, ok && cuckoo_size(cuckoo2) == KEYS / 2)
+	cuckoo_destroy(&cuckoo2);
+	TEST_ACT(34, !cuckoo2)
+
+	/* Fill it up: the key that doesn't fit must not displace the others */
+
+	for (added = KEYS, i = 0; added < 100 * KEYS; ++i, ++added)
+	{
+		snprintf(key, sizeof key, "more%d", i);
+
+		if (cuckoo_add(cuckoo, key, strlen(key)) == -1)
+			break;
+	}
+
+	TEST_ACT(35, added < 100 * KEYS && errno == ENOSPC && cuckoo_size(cuckoo) == added)
+
+	for (ok = 1, i = 0; i < KEYS; ++i)
+		if (cuckoo_test(cuckoo, keys[i], strlen(keys[i])) != 1)
+			ok = 0;
+
+	for (i = 0; i < added - KEYS; ++i)
+	{
+		snprintf(key, sizeof key, "more%d", i);
+
+		if (cuckoo_test(cuckoo, key, strlen(key)) != 1)
+			ok = 0;
+	}
+
+	TEST_ACT(36, ok)
+	cuckoo_destroy(&cuckoo);
+
+	TEST_ACT(37, (locker = locker_create_mutex(&mutex)))
+	TEST_ACT(38, (shared_cuckoo = cuckoo_create_with_locker(locker, KEYS, 0.0001)))
+
+	for (i = 0; i < THREADS; ++i)
+		pthread_create(&thread[i], NULL, cuckoo_adder, (void *)(size_t)i);
+
+	for (i = 0; i < THREADS; ++i)
+		pthread_join(thread[i], NULL);
+
+	for (ok = 1, i = 0; i < KEYS; ++i)
+		if (cuckoo_test(shared_cuckoo, keys[i], strlen(keys[i])) != 1)
+			ok = 0;
+
+	TEST_ACT(39, ok && cuckoo_size(shared_cuckoo) == KEYS)
+	cuckoo_destroy(&shared_cuckoo);
+	locker_destroy(&locker);
+
+	/* Test errors */
+
+	TEST_ACT(40, !bloom_create(100, 0.0) && errno == EINVAL)
+	TEST_ACT(41, !bloom_create(100, 1.0) && errno == EINVAL)
+	TEST_ACT(42, bloom_add(NULL, "a", 1) == -1 && errno == EINVAL)
+	TEST_ACT(43, bloom_test(NULL, "a", 1) == -1 && errno == EINVAL)
+	TEST_ACT(44, bloom_serialise(NULL, NULL, 0) == -1 && errno == EINVAL)
+	TEST_ACT(45, !bloom_deserialise(NULL, 100) && errno == EINVAL)
+	TEST_ACT(46, !cuckoo_create(100, -1.0) && errno == EINVAL)
+	TEST_ACT(47, cuckoo_add(NULL, "a", 1) == -1 && errno == EINVAL)
+	TEST_ACT(48, cuckoo_remove(NULL, "a", 1) == -1 && errno == EINVAL)
+	TEST_ACT(49, cuckoo_test(NULL, "a", 1) == -1 && errno == EINVAL)
+	TEST_ACT(50, cuckoo_size(NULL) == -1 && errno == EINVAL)
+	TEST_ACT(51, cuckoo_serialise(NULL, NULL, 0) == -1 && errno == EINVAL)
+	TEST_ACT(52, !cuckoo_deserialise(NULL, 100) && errno == EINVAL)
+
+	if (errors)
+		printf("%d/52 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,65 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_FILTER_H
+#define LIBSLACK_FILTER_H
+
+#include <sys/types.h>
+
+#include <slack/hdr.h>
+#include <slack/locker.h>
+
+typedef struct Bloom Bloom;
+typedef struct Cuckoo Cuckoo;
+
+_begin_decls
+Bloom *bloom_create(size_t items, double fp_rate);
+void bloom_release(Bloom *bloom);
+void *bloom_destroy(Bloom **bloom);
+int bloom_add(Bloom *bloom, const void *key, size_t length);
+int bloom_add_unlocked(Bloom *bloom, const void *key, size_t length);
+int bloom_test(const Bloom *bloom, const void *key, size_t length);
+ssize_t bloom_serialise(const Bloom *bloom, void *buf, size_t size);
+Bloom *bloom_deserialise(const void *buf, size_t size);
+Cuckoo *cuckoo_create(size_t items, double fp_rate);
+Cuckoo *cuckoo_create_with_locker(Locker *locker, size_t items, double fp_rate);
+int cuckoo_rdlock(const Cuckoo *cuckoo);
+int cuckoo_wrlock(const Cuckoo *cuckoo);
+int cuckoo_unlock(const Cuckoo *cuckoo);
+void cuckoo_release(Cuckoo *cuckoo);
+void *cuckoo_destroy(Cuckoo **cuckoo);
+int cuckoo_add(Cuckoo *cuckoo, const void *key, size_t length);
+int cuckoo_add_unlocked(Cuckoo *cuckoo, const void *key, size_t length);
+int cuckoo_remove(Cuckoo *cuckoo, const void *key, size_t length);
+int cuckoo_remove_unlocked(Cuckoo *cuckoo, const void *key, size_t length);
+int cuckoo_test(const Cuckoo *cuckoo, const void *key, size_t length);
+int cuckoo_test_unlocked(const Cuckoo *cuckoo, const void *key, size_t length);
+ssize_t cuckoo_size(const Cuckoo *cuckoo);
+ssize_t cuckoo_size_unlocked(const Cuckoo *cuckoo);
+ssize_t cuckoo_serialise(const Cuckoo *cuckoo, void *buf, size_t size);
+ssize_t cuckoo_serialise_unlocked(const Cuckoo *cuckoo, void *buf, size_t size);
+Cuckoo *cuckoo_deserialise(const void *buf, size_t size);
+Cuckoo *cuckoo_deserialise_with_locker(Locker *locker, const void *buf, size_t size);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -47,13 +47,16 @@ I<libslack(fio)> - fifo and file control module and some I/O
     int fifo_exists(const char *path, int prepare);
     int fifo_has_reader(const char *path, int prepare);
     int fifo_open(const char *path, mode_t mode, int lock, int *writefd);
+    int close_from(int fd);
+    int cloexec_from(int fd);
 
 =head1 DESCRIPTION
 
 This module provides various I/O related functions: reading a line of text
 no matter what line endings are used; timeouts for read/write operations
-without signals; exclusively opening a fifo for reading; and some random
-shorthand functions for manipulating file flags and locks.
+without signals; exclusively opening a fifo for reading; closing (or
+marking close-on-exec) every file descriptor above a given one; and some
+random shorthand functions for manipulating file flags and locks.
 
 =over 4
 
@@ -67,6 +70,14 @@ shorthand functions for manipulating file flags and locks.
 #define NO_POSIX_SOURCE /* For ETIMEDOUT, EADDRINUSE, EOPNOTSUPP on FreeBSD-8.0 */
 #endif
 
+#ifndef _BSD_SOURCE
+#define _BSD_SOURCE /* For syscall(2) on Linux */
+#endif
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE /* New name for _BSD_SOURCE */
+#endif
+
 #include "std.h"
 
 #include <fcntl.h>
@@ -77,9 +88,13 @@ shorthand functions for manipulating file flags and locks.
 #endif
 #include <sys/time.h>
 #include <sys/stat.h>
+#if defined(HAVE_CLOSE_RANGE) || defined(HAVE_PROC_SELF_FD)
+#include <sys/syscall.h>
+#endif
 
 #include "err.h"
 #include "fio.h"
+#include "lim.h"
 
 #ifndef TEST
 
@@ -770,6 +785,181 @@ int fifo_open(const char *path, mode_t mode, int lock, int *writefd)
 	return rfd;
 }
 
+#if defined(HAVE_CLOSE_RANGE) && defined(SYS_close_range)
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+#endif
+
+/*
+
+C<void fd_apply(int fd, int cloexec)>
+
+Closes C<fd> or, if C<cloexec> is non-zero, sets its C<FD_CLOEXEC> flag.
+Errors (e.g. C<EBADF> for a descriptor that isn't open) are ignored.
+
+*/
+
+static void fd_apply(int fd, int cloexec)
+{
+	int flags;
+
+	if (!cloexec)
+		close(fd);
+	else if ((flags = fcntl(fd, F_GETFD, 0)) != -1 && !(flags & FD_CLOEXEC))
+		fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+#if defined(HAVE_PROC_SELF_FD) && defined(SYS_getdents64)
+
+/*
+
+C<int fd_from_proc(int lowfd, int cloexec)>
+
+Applies I<fd_apply()> to every open file descriptor greater than or equal
+to C<lowfd> by enumerating C</proc/self/fd> with I<getdents64(2)>. The
+directory entries are read into a buffer on the stack and parsed by hand so
+that this is safe to call in a child process between I<fork(2)> and
+I<execve(2)> (i.e. no I<malloc(3)> via I<opendir(3)>). Closing descriptors
+while enumerating is safe because the position within C</proc/self/fd> is
+the descriptor number. On success, returns C<0>. On error (e.g. C</proc>
+isn't mounted), returns C<-1>.
+
+*/
+
+struct fd_dirent64
+{
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[1];
+};
+
+static int fd_from_proc(int lowfd, int cloexec)
+{
+	union { char buf[4096]; long long align; } ents[1];
+	struct fd_dirent64 *ent;
+	long bytes, pos;
+	int dirfd, fd;
+	char *s;
+
+	if ((dirfd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		return -1;
+
+	while ((bytes = syscall(SYS_getdents64, dirfd, ents->buf, sizeof ents->buf)) > 0)
+	{
+		for (pos = 0; pos < bytes; pos += ent->d_reclen)
+		{
+			ent = (struct fd_dirent64 *)(ents->buf + pos);
+
+			for (fd = 0, s = ent->d_name; *s >= '0' && *s <= '9'; ++s)
+				fd = fd * 10 + *s - '0';
+
+			if (s == ent->d_name || *s != '\0' || fd < lowfd || fd == dirfd)
+				continue;
+
+			fd_apply(fd, cloexec);
+		}
+	}
+
+	close(dirfd);
+
+	return (bytes == 0) ? 0 : -1;
+}
+
+#endif
+
+/*
+
+C<int fd_from(int lowfd, int cloexec)>
+
+Applies I<fd_apply()> to every open file descriptor greater than or equal
+to C<lowfd>. Uses I<close_range(2)> when available, then enumeration of
+C</proc/self/fd>, then a loop up to I<limit_open(3)> as a last resort.
+
+*/
+
+static int fd_from(int lowfd, int cloexec)
+{
+	long nopen;
+	int fd;
+
+	if (lowfd < 0)
+		return set_errno(EINVAL);
+
+#if defined(HAVE_CLOSE_RANGE) && defined(SYS_close_range)
+	/* Fails with ENOSYS before Linux-5.9 and EINVAL for CLOSE_RANGE_CLOEXEC before Linux-5.11 */
+
+	if (syscall(SYS_close_range, (unsigned int)lowfd, ~0U, (cloexec) ? CLOSE_RANGE_CLOEXEC : 0) == 0)
+		return 0;
+#endif
+
+#if defined(HAVE_PROC_SELF_FD) && defined(SYS_getdents64)
+	if (fd_from_proc(lowfd, cloexec) == 0)
+		return 0;
+#endif
+
+	/*
+	** Flaw: If many files were opened and then this limit
+	** was reduced to below the highest file descriptor,
+	** we may not reach all file descriptors.
+	*/
+
+	nopen = limit_open();
+
+	for (fd = lowfd; fd < nopen; ++fd)
+		fd_apply(fd, cloexec);
+
+	return 0;
+}
+
+/*
+
+=item C<int close_from(int fd)>
+
+Closes every open file descriptor that is greater than or equal to C<fd>.
+Uses I<close_range(2)> where available. Otherwise, only the descriptors that
+are actually open are closed by enumerating C</proc/self/fd> where
+available. Both of these are async-signal-safe, so they may be used in a
+child process between I<fork(2)> and I<execve(2)>. Otherwise, every
+possible descriptor up to I<limit_open(3)> is closed. That calls
+I<sysconf(3)>, which isn't async-signal-safe, so on such systems it isn't
+safe in the child of a multi-threaded process. On success, returns C<0>. On
+error, returns C<-1> with C<errno> set appropriately.
+
+    if (close_from(STDERR_FILENO + 1) == -1)
+        return -1;
+
+=cut
+
+*/
+
+int close_from(int fd)
+{
+	return fd_from(fd, 0);
+}
+
+/*
+
+=item C<int cloexec_from(int fd)>
+
+Equivalent to I<close_from(3)> except that the file descriptors are not
+closed. Instead, their C<FD_CLOEXEC> flag is set so that they will be closed
+when the process next calls I<execve(2)>. This is useful between I<fork(2)>
+and I<execve(2)> when the child process may still need its descriptors in
+the meantime. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+int cloexec_from(int fd)
+{
+	return fd_from(fd, 1);
+}
+
 /*
 
 =back
@@ -791,6 +981,11 @@ set this when a timeout occurs.
 I<fifo_open(3)> sets this when the path refers to a fifo that already has
 another process reading from it.
 
+=item C<EINVAL>
+
+I<close_from(3)> and I<cloexec_from(3)> set this when the file descriptor
+is negative.
+
 =back
 
 =head1 MT-Level
@@ -963,7 +1158,8 @@ I<fstat(2)>,
 I<open(2)>,
 I<write(2)>,
 I<read(2)>,
-I<mkfifo(2)>
+I<mkfifo(2)>,
+I<close_range(2)>
 
 =head1 AUTHOR
 
@@ -1128,9 +1324,34 @@ int main(int ac, char **av)
 	TEST_ERR(34, rw_timeout(0, 0, -1))
 	TEST_ERR(35, nap(-1, 0))
 	TEST_ERR(36, nap(0, -1))
+	TEST_ERR(37, close_from(-1))
+	TEST_ERR(38, cloexec_from(-1))
+
+	/* Test cloexec_from() and close_from() */
+
+	if ((fd = dup2(STDIN_FILENO, 100)) != 100 || dup2(STDIN_FILENO, 102) != 102)
+		++errors, printf("Test39: failed to run test: dup2() failed (%s)\n", strerror(errno));
+	else
+	{
+		if (cloexec_from(101) == -1)
+			++errors, printf("Test40: cloexec_from(101) failed (%s)\n", strerror(errno));
+		else if (fcntl(100, F_GETFD, 0) & FD_CLOEXEC)
+			++errors, printf("Test41: cloexec_from(101) set FD_CLOEXEC on fd 100\n");
+		else if (!(fcntl(102, F_GETFD, 0) & FD_CLOEXEC))
+			++errors, printf("Test42: cloexec_from(101) didn't set FD_CLOEXEC on fd 102\n");
+
+		if (close_from(101) == -1)
+			++errors, printf("Test43: close_from(101) failed (%s)\n", strerror(errno));
+		else if (fcntl(100, F_GETFD, 0) == -1)
+			++errors, printf("Test44: close_from(101) closed fd 100\n");
+		else if (fcntl(102, F_GETFD, 0) != -1 || errno != EBADF)
+			++errors, printf("Test45: close_from(101) didn't close fd 102\n");
+
+		close(100);
+	}
 
 	if (errors)
-		printf("%d/36 tests failed\n", errors);
+		printf("%d/45 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -45,6 +45,8 @@ int nonblock_off(int fd);
 int fifo_exists(const char *path, int prepare);
 int fifo_has_reader(const char *path, int prepare);
 int fifo_open(const char *path, mode_t mode, int lock, int *writefd);
+int close_from(int fd);
+int cloexec_from(int fd);
 _end_decls
 
 #endif
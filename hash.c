@@ -0,0 +1,978 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+
+/*
+
+=head1 NAME
+
+I<libslack(hash)> - hashing module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/hash.h>
+
+    typedef struct HashState HashState;
+
+    struct HashState
+    {
+        unsigned long long acc[4];
+        unsigned long long seed;
+        unsigned long long total;
+        unsigned char buf[32];
+        size_t buffered;
+    };
+
+    unsigned long long hash_bytes(const void *data, size_t length, unsigned long long seed);
+    unsigned long long hash_str(const char *str, unsigned long long seed);
+    int hash_init(HashState *state, unsigned long long seed);
+    int hash_update(HashState *state, const void *data, size_t length);
+    unsigned long long hash_final(const HashState *state);
+    unsigned long long hash_mix64(unsigned long long x);
+    unsigned int hash_mix32(unsigned int x);
+    unsigned int hash_crc32c(unsigned int crc, const void *data, size_t length);
+    size_t hash_map_str(size_t table_size, const void *key);
+    size_t hash_map_int(size_t table_size, const void *key);
+
+=head1 DESCRIPTION
+
+This module provides hash functions for hash tables and checksums.
+
+I<hash_bytes(3)> and I<hash_str(3)> are fast, seeded, 64-bit
+non-cryptographic hash functions (they compute I<XXH64>, so their values
+match other implementations of it). I<hash_init(3)>, I<hash_update(3)> and
+I<hash_final(3)> compute the same hash incrementally, for data that arrives
+in pieces. The members of a I<HashState> are private, but it is declared in
+full so that it can be a local variable. I<hash_mix64(3)> and
+I<hash_mix32(3)> mix the bits of integers, for hash tables with integer
+keys. I<hash_map_str(3)> and I<hash_map_int(3)> are ready-made
+I<map_hash_t> (and I<list_hash_t>) functions for string and integer keys.
+
+I<hash_crc32c(3)> computes the I<CRC-32C> (Castagnoli) checksum, using the
+I<SSE4.2> or I<ARMv8> CRC instructions where available, and slicing-by-8
+table lookups otherwise.
+
+None of these functions are suitable for cryptographic purposes, or for
+hash tables whose keys are chosen by an adversary unless the seed is
+secret.
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include "hash.h"
+#include "err.h"
+
+#if !defined(NO_CRC32C_INSTRUCTIONS) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HASH_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#elif !defined(NO_CRC32C_INSTRUCTIONS) && defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define HASH_CRC32C_ARMV8 1
+#include <arm_acle.h>
+#endif
+
+#ifndef TEST
+
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+#define PRIME64_4 0x85ebca77c2b2ae63ULL
+#define PRIME64_5 0x27d4eb2f165667c5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* CRC-32C polynomial (reversed) */
+
+#define CRC32C_POLY 0x82f63b78U
+
+/*
+
+C<unsigned long long read64(const unsigned char *p)>
+
+Returns the little-endian 64-bit integer at C<p>, which needn't be aligned.
+
+*/
+
+static unsigned long long read64(const unsigned char *p)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	unsigned long long v;
+
+	memcpy(&v, p, sizeof v);
+
+	return v;
+#else
+	return (unsigned long long)p[0] | (unsigned long long)p[1] << 8 |
+		(unsigned long long)p[2] << 16 | (unsigned long long)p[3] << 24 |
+		(unsigned long long)p[4] << 32 | (unsigned long long)p[5] << 40 |
+		(unsigned long long)p[6] << 48 | (unsigned long long)p[7] << 56;
+#endif
+}
+
+/*
+
+C<unsigned long long read32(const unsigned char *p)>
+
+Returns the little-endian 32-bit integer at C<p>, which needn't be aligned.
+
+*/
+
+static unsigned long long read32(const unsigned char *p)
+{
+	return (unsigned long long)p[0] | (unsigned long long)p[1] << 8 |
+		(unsigned long long)p[2] << 16 | (unsigned long long)p[3] << 24;
+}
+
+/*
+
+C<unsigned long long round64(unsigned long long acc, unsigned long long input)>
+
+Mixes 8 bytes of C<input> into the accumulator C<acc>.
+
+*/
+
+static unsigned long long round64(unsigned long long acc, unsigned long long input)
+{
+	acc += input * PRIME64_2;
+	acc = ROTL64(acc, 31);
+
+	return acc * PRIME64_1;
+}
+
+/*
+
+C<const unsigned char *stripes(unsigned long long *acc, const unsigned char *p, size_t count)>
+
+Mixes C<count> 32-byte stripes starting at C<p> into the four accumulators
+C<acc>. Returns the position after the last stripe.
+
+*/
+
+static const unsigned char *stripes(unsigned long long *acc, const unsigned char *p, size_t count)
+{
+	unsigned long long v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+
+	for (; count; --count, p += 32)
+	{
+		v1 = round64(v1, read64(p));
+		v2 = round64(v2, read64(p + 8));
+		v3 = round64(v3, read64(p + 16));
+		v4 = round64(v4, read64(p + 24));
+	}
+
+	acc[0] = v1, acc[1] = v2, acc[2] = v3, acc[3] = v4;
+
+	return p;
+}
+
+/*
+
+C<void start(unsigned long long *acc, unsigned long long seed)>
+
+Initialises the four accumulators C<acc> for C<seed>.
+
+*/
+
+static void start(unsigned long long *acc, unsigned long long seed)
+{
+	acc[0] = seed + PRIME64_1 + PRIME64_2;
+	acc[1] = seed + PRIME64_2;
+	acc[2] = seed;
+	acc[3] = seed - PRIME64_1;
+}
+
+/*
+
+C<unsigned long long finish(const unsigned long long *acc, unsigned long long seed, unsigned long long total, const unsigned char *p, size_t length)>
+
+Returns the hash of C<total> bytes, given the accumulators C<acc> after all
+complete stripes, and the C<length> (less than 32) remaining bytes at C<p>.
+
+*/
+
+static unsigned long long finish(const unsigned long long *acc, unsigned long long seed, unsigned long long total, const unsigned char *p, size_t length)
+{
+	unsigned long long h;
+	int i;
+
+	if (total >= 32)
+	{
+		h = ROTL64(acc[0], 1) + ROTL64(acc[1], 7) + ROTL64(acc[2], 12) + ROTL64(acc[3], 18);
+
+		for (i = 0; i < 4; ++i)
+		{
+			h ^= round64(0, acc[i]);
+			h = h * PRIME64_1 + PRIME64_4;
+		}
+	}
+	else
+		h = seed + PRIME64_5;
+
+	h += total;
+
+	for (; length >= 8; p += 8, length -= 8)
+	{
+		h ^= round64(0, read64(p));
+		h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+
+	if (length >= 4)
+	{
+		h ^= read32(p) * PRIME64_1;
+		h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4, length -= 4;
+	}
+
+	for (; length; ++p, --length)
+	{
+		h ^= *p * PRIME64_5;
+		h = ROTL64(h, 11) * PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+/*
+
+=item C<unsigned long long hash_bytes(const void *data, size_t length, unsigned long long seed)>
+
+Returns the 64-bit hash of the C<length> bytes at C<data>, using C<seed>.
+Different seeds give unrelated hashes. On error, returns C<0> with C<errno>
+set appropriately.
+
+=cut
+
+*/
+
+unsigned long long hash_bytes(const void *data, size_t length, unsigned long long seed)
+{
+	const unsigned char *p = data;
+	unsigned long long acc[4];
+
+	if (!data && length)
+		return errno = EINVAL, 0;
+
+	if (length >= 32)
+	{
+		start(acc, seed);
+		p = stripes(acc, p, length / 32);
+	}
+
+	return finish(acc, seed, length, p, length % 32);
+}
+
+/*
+
+=item C<unsigned long long hash_str(const char *str, unsigned long long seed)>
+
+Returns the 64-bit hash of the nul-terminated string C<str> (not including
+the nul), using C<seed>. Equivalent to C<hash_bytes(str, strlen(str),
+seed)>. On error, returns C<0> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+unsigned long long hash_str(const char *str, unsigned long long seed)
+{
+	if (!str)
+		return errno = EINVAL, 0;
+
+	return hash_bytes(str, strlen(str), seed);
+}
+
+/*
+
+=item C<int hash_init(HashState *state, unsigned long long seed)>
+
+Initialises C<*state> for computing a hash incrementally with
+I<hash_update(3)> and I<hash_final(3)>, using C<seed>. A I<HashState> is
+usually a local variable. It needs no other initialisation and no
+deallocation. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+int hash_init(HashState *state, unsigned long long seed)
+{
+	if (!state)
+		return set_errno(EINVAL);
+
+	start(state->acc, seed);
+	state->seed = seed;
+	state->total = 0;
+	state->buffered = 0;
+
+	return 0;
+}
+
+/*
+
+=item C<int hash_update(HashState *state, const void *data, size_t length)>
+
+Adds the C<length> bytes at C<data> to the hash being computed in
+C<*state>. However the data is divided among calls to I<hash_update(3)>,
+the result is the same as I<hash_bytes(3)> of all the data at once. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int hash_update(HashState *state, const void *data, size_t length)
+{
+	const unsigned char *p = data;
+
+	if (!state || (!data && length))
+		return set_errno(EINVAL);
+
+	state->total += length;
+
+	if (state->buffered + length < 32)
+	{
+		if (length)
+			memcpy(state->buf + state->buffered, p, length);
+
+		state->buffered += length;
+
+		return 0;
+	}
+
+	if (state->buffered)
+	{
+		size_t fill = 32 - state->buffered;
+
+		memcpy(state->buf + state->buffered, p, fill);
+		stripes(state->acc, state->buf, 1);
+		p += fill, length -= fill;
+		state->buffered = 0;
+	}
+
+	p = stripes(state->acc, p, length / 32);
+
+	if ((state->buffered = length % 32))
+		memcpy(state->buf, p, state->buffered);
+
+	return 0;
+}
+
+/*
+
+=item C<unsigned long long hash_final(const HashState *state)>
+
+Returns the hash of the data added to C<*state>. C<*state> is unchanged, so
+more data may be added afterwards. On error, returns C<0> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+unsigned long long hash_final(const HashState *state)
+{
+	if (!state)
+		return errno = EINVAL, 0;
+
+	return finish(state->acc, state->seed, state->total, state->buf, state->buffered);
+}
+
+/*
+
+=item C<unsigned long long hash_mix64(unsigned long long x)>
+
+Returns C<x> with its bits thoroughly mixed (the I<splitmix64> finaliser).
+Every bit of the result depends on every bit of C<x>, and different values
+of C<x> give different results. This turns integer keys that differ in only
+a few bits (e.g. sequential numbers or aligned addresses) into good hashes.
+
+=cut
+
+*/
+
+unsigned long long hash_mix64(unsigned long long x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+	return x ^ (x >> 31);
+}
+
+/*
+
+=item C<unsigned int hash_mix32(unsigned int x)>
+
+Equivalent to I<hash_mix64(3)> for 32-bit integers (the I<MurmurHash3>
+finaliser).
+
+=cut
+
+*/
+
+unsigned int hash_mix32(unsigned int x)
+{
+	x &= 0xffffffffU;
+	x ^= x >> 16;
+	x = (x * 0x85ebca6bU) & 0xffffffffU;
+	x ^= x >> 13;
+	x = (x * 0xc2b2ae35U) & 0xffffffffU;
+
+	return x ^ (x >> 16);
+}
+
+/* CRC-32C */
+
+static unsigned int crc32c_table[8][256];
+static unsigned int (*crc32c_impl)(unsigned int crc, const unsigned char *p, size_t length);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/*
+
+C<unsigned int crc32c_sw(unsigned int crc, const unsigned char *p, size_t length)>
+
+Computes the CRC-32C of the C<length> bytes at C<p>, continuing from
+C<crc>, using slicing-by-8: eight table lookups per eight bytes.
+
+*/
+
+static unsigned int crc32c_sw(unsigned int crc, const unsigned char *p, size_t length)
+{
+	unsigned int lo, hi;
+
+	crc = ~crc & 0xffffffffU;
+
+	for (; length && ((size_t)p & 7); ++p, --length)
+		crc = crc32c_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+
+	for (; length >= 8; p += 8, length -= 8)
+	{
+		lo = crc ^ (unsigned int)read32(p);
+		hi = (unsigned int)read32(p + 4);
+
+		crc = crc32c_table[7][lo & 0xff] ^
+			crc32c_table[6][(lo >> 8) & 0xff] ^
+			crc32c_table[5][(lo >> 16) & 0xff] ^
+			crc32c_table[4][lo >> 24] ^
+			crc32c_table[3][hi & 0xff] ^
+			crc32c_table[2][(hi >> 8) & 0xff] ^
+			crc32c_table[1][(hi >> 16) & 0xff] ^
+			crc32c_table[0][hi >> 24];
+	}
+
+	for (; length; ++p, --length)
+		crc = crc32c_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+
+	return ~crc & 0xffffffffU;
+}
+
+#ifdef HASH_CRC32C_SSE42
+
+/*
+
+C<unsigned int crc32c_sse42(unsigned int crc, const unsigned char *p, size_t length)>
+
+Equivalent to I<crc32c_sw()> using the I<SSE4.2> C<crc32> instruction.
+
+*/
+
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_sse42(unsigned int crc, const unsigned char *p, size_t length)
+{
+	crc = ~crc;
+
+	for (; length && ((size_t)p & 7); ++p, --length)
+		crc = _mm_crc32_u8(crc, *p);
+
+#ifdef __x86_64__
+	{
+		unsigned long long c = crc, w;
+
+		for (; length >= 8; p += 8, length -= 8)
+		{
+			memcpy(&w, p, sizeof w);
+			c = _mm_crc32_u64(c, w);
+		}
+
+		crc = (unsigned int)c;
+	}
+#else
+	{
+		unsigned int w;
+
+		for (; length >= 4; p += 4, length -= 4)
+		{
+			memcpy(&w, p, sizeof w);
+			crc = _mm_crc32_u32(crc, w);
+		}
+	}
+#endif
+
+	for (; length; ++p, --length)
+		crc = _mm_crc32_u8(crc, *p);
+
+	return ~crc;
+}
+
+#endif
+
+#ifdef HASH_CRC32C_ARMV8
+
+/*
+
+C<unsigned int crc32c_armv8(unsigned int crc, const unsigned char *p, size_t length)>
+
+Equivalent to I<crc32c_sw()> using the I<ARMv8> C<crc32c> instructions.
+
+*/
+
+static unsigned int crc32c_armv8(unsigned int crc, const unsigned char *p, size_t length)
+{
+	unsigned long long w;
+
+	crc = ~crc;
+
+	for (; length && ((size_t)p & 7); ++p, --length)
+		crc = __crc32cb(crc, *p);
+
+	for (; length >= 8; p += 8, length -= 8)
+	{
+		memcpy(&w, p, sizeof w);
+		crc = __crc32cd(crc, w);
+	}
+
+	for (; length; ++p, --length)
+		crc = __crc32cb(crc, *p);
+
+	return ~crc;
+}
+
+#endif
+
+/*
+
+C<void crc32c_init(void)>
+
+Chooses the CRC-32C implementation, and builds the tables for
+I<crc32c_sw()> if they are needed. Called once, by I<pthread_once(3)>.
+
+*/
+
+static void crc32c_init(void)
+{
+	unsigned int crc;
+	int i, j;
+
+#ifdef HASH_CRC32C_SSE42
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse4.2"))
+	{
+		crc32c_impl = crc32c_sse42;
+		return;
+	}
+#endif
+
+#ifdef HASH_CRC32C_ARMV8
+	crc32c_impl = crc32c_armv8;
+	return;
+#endif
+
+	for (i = 0; i < 256; ++i)
+	{
+		for (crc = i, j = 0; j < 8; ++j)
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+
+		crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; ++i)
+		for (j = 1; j < 8; ++j)
+			crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+
+	crc32c_impl = crc32c_sw;
+}
+
+/*
+
+=item C<unsigned int hash_crc32c(unsigned int crc, const void *data, size_t length)>
+
+Returns the I<CRC-32C> (Castagnoli) checksum of the C<length> bytes at
+C<data>, continuing from C<crc>. Pass C<0> as C<crc> for the first (or
+only) piece of data, and the previous result for each subsequent piece. The
+checksum of C<"123456789"> is C<0xe3069283>. Uses the I<SSE4.2> C<crc32>
+instruction when the CPU supports it (checked at run time), or the
+I<ARMv8> C<crc32c> instructions when compiled for a CPU with them, and
+slicing-by-8 table lookups otherwise. Define C<NO_CRC32C_INSTRUCTIONS>
+when compiling libslack to always use the tables. On error, returns C<0>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+unsigned int hash_crc32c(unsigned int crc, const void *data, size_t length)
+{
+	if (!data && length)
+		return errno = EINVAL, 0;
+
+	pthread_once(&crc32c_once, crc32c_init);
+
+	return crc32c_impl(crc, data, length);
+}
+
+/*
+
+=item C<size_t hash_map_str(size_t table_size, const void *key)>
+
+A I<map_hash_t> (or I<list_hash_t>) function for nul-terminated string
+keys, for use with I<map_create_with_hash(3)> and the like. Returns
+I<hash_str(3)> of C<key> (with seed C<0>) reduced to the range
+C<0..table_size-1>.
+
+=cut
+
+*/
+
+size_t hash_map_str(size_t table_size, const void *key)
+{
+	return (size_t)(hash_str(key, 0) % table_size);
+}
+
+/*
+
+=item C<size_t hash_map_int(size_t table_size, const void *key)>
+
+A I<map_hash_t> (or I<list_hash_t>) function for integer keys that are
+stored in the key pointer itself (e.g. C<(void *)(long)n>), or for keys that
+are compared by address. Returns I<hash_mix64(3)> of C<key> reduced to the
+range C<0..table_size-1>.
+
+=cut
+
+*/
+
+size_t hash_map_int(size_t table_size, const void *key)
+{
+	return (size_t)(hash_mix64((unsigned long long)(size_t)key) % table_size);
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null>.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe> (a I<HashState> must not be updated by multiple threads at the
+same time).
+
+=head1 EXAMPLES
+
+Hash a message that arrives in pieces, and checksum it:
+
+    #include <slack/std.h>
+    #include <slack/hash.h>
+
+    int main()
+    {
+        const char *pieces[] = { "Hello", ", ", "world", NULL };
+        unsigned int crc = 0;
+        HashState state[1];
+        int i;
+
+        hash_init(state, 0);
+
+        for (i = 0; pieces[i]; ++i)
+        {
+            hash_update(state, pieces[i], strlen(pieces[i]));
+            crc = hash_crc32c(crc, pieces[i], strlen(pieces[i]));
+        }
+
+        // Same as hash_str("Hello, world", 0) and hash_crc32c(0, "Hello, world", 12)
+        printf("%016llx %08x\n", hash_final(state), crc);
+
+        return EXIT_SUCCESS;
+    }
+
+Use a better hash function for a map with string keys, and one for a map
+with integer keys:
+
+    #include <slack/std.h>
+    #include <slack/map.h>
+    #include <slack/hash.h>
+
+    static void *id_copy(const void *id)
+    {
+        return (void *)id;
+    }
+
+    static int id_cmp(const void *a, const void *b)
+    {
+        return ((long)a > (long)b) - ((long)a < (long)b);
+    }
+
+    int main()
+    {
+        Map *names = map_create_with_hash(hash_map_str, NULL);
+        Map *ids = map_create_generic(id_copy, id_cmp, hash_map_int, NULL, NULL);
+
+        map_add(names, "one", "1");
+        map_add(ids, (void *)(long)1, "one");
+
+        printf("%s %s\n", (char *)map_get(names, "one"), (char *)map_get(ids, (void *)(long)1));
+
+        map_destroy(&names);
+        map_destroy(&ids);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<map(3)>,
+I<list(3)>,
+I<https://github.com/Cyan4973/xxHash>,
+I<RFC 3720 (CRC-32C)>
+
+=head1 AUTHOR
+
+20230824 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <slack/map.h>
+
+#define TEST_ACT(i, action) \
+	if (!(action)) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_HASH(i, action, value) \
+	if ((h = (action)) != (value)) \
+		++errors, printf("Test%d: %s failed (returned %016llx, not %016llx)\n", (i), (#action), h, (unsigned long long)(value));
+
+/* Bit-at-a-time CRC-32C for comparison */
+
+static unsigned int crc32c_ref(const unsigned char *p, size_t length)
+{
+	unsigned int crc = 0xffffffffU;
+	int i;
+
+	for (; length; ++p, --length)
+		for (crc ^= *p, i = 0; i < 8; ++i)
+			crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78U : crc >> 1;
+
+	return ~crc & 0xffffffffU;
+}
+
+static int bits(unsigned long long x)
+{
+	int count = 0;
+
+	for (; x; x &= x - 1)
+		++count;
+
+	return count;
+}
+
+int main(int ac, char **av)
+{
+	int errors = 0;
+	unsigned char data[1000];
+	unsigned long long h, expected;
+	unsigned int crc;
+	HashState state[1];
+	Map *map;
+	char key[32];
+	size_t i, j, step;
+	int ok, flips;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	printf("Testing: %s\n", "hash");
+
+	for (i = 0; i < sizeof data; ++i)
+		data[i] = (unsigned char)(i * 131 + (i >> 3));
+
+	/* Test XXH64 reference values */
+
+	TEST_HASH(1, hash_bytes("", 0, 0), 0xef46db3751d8e999ULL)
+	TEST_HASH(2, hash_str("a", 0), 0xd24ec4f1a98c6e5bULL)
+	TEST_HASH(3, hash_str("abc", 0), 0x44bc2cf5ad770999ULL)
+	TEST_HASH(4, hash_str("Nobody inspects the spammish repetition", 0), 0xfbcea83c8a378bf1ULL)
+	TEST_HASH(5, hash_str("abc", 1), 0xbea9ca8199328908ULL)
+
+	{
+		unsigned char seq[100];
+
+		for (i = 0; i < 100; ++i)
+			seq[i] = (unsigned char)i;
+
+		TEST_HASH(6, hash_bytes(seq, 100, 0x123456789ULL), 0xec4f56411033e963ULL)
+	}
+
+	/* Test incremental hashing with every piece size */
+
+	expected = hash_bytes(data, sizeof data, 42);
+
+	for (ok = 1, step = 1; step <= 70; ++step)
+	{
+		hash_init(state, 42);
+
+		for (i = 0; i < sizeof data; i += step)
+			hash_update(state, data + i, (i + step <= sizeof data) ? step : sizeof data - i);
+
+		if (hash_final(state) != expected)
+			ok = 0;
+	}
+
+	TEST_ACT(7, ok)
+	TEST_ACT(8, hash_init(state, 42) == 0 && hash_update(state, data, 10) == 0 && hash_final(state) == hash_bytes(data, 10, 42))
+	TEST_ACT(9, hash_update(state, data + 10, 90) == 0 && hash_final(state) == hash_bytes(data, 100, 42))
+	TEST_ACT(10, hash_update(state, NULL, 0) == 0 && hash_final(state) == hash_bytes(data, 100, 42))
+
+	for (ok = 1, i = 0; i <= 64; ++i)
+		if (hash_bytes(data, i, 0) == hash_bytes(data, i, 1))
+			ok = 0;
+
+	TEST_ACT(11, ok)
+
+	/* Test the integer mixers */
+
+	TEST_ACT(12, hash_mix64(1) != 1 && hash_mix64(1) != hash_mix64(2))
+
+	for (flips = 0, i = 0; i < 1000; ++i)
+		for (j = 0; j < 64; ++j)
+			flips += bits(hash_mix64(i) ^ hash_mix64(i ^ (1ULL << j)));
+
+	TEST_ACT(13, flips > 1000 * 64 * 30 && flips < 1000 * 64 * 34)
+
+	for (flips = 0, i = 0; i < 1000; ++i)
+		for (j = 0; j < 32; ++j)
+			flips += bits(hash_mix32((unsigned int)i) ^ hash_mix32((unsigned int)i ^ (1U << j)));
+
+	TEST_ACT(14, flips > 1000 * 32 * 14 && flips < 1000 * 32 * 18)
+
+	/* Test CRC-32C */
+
+	TEST_HASH(15, hash_crc32c(0, "123456789", 9), 0xe3069283U)
+	TEST_HASH(16, hash_crc32c(0, "", 0), 0)
+	TEST_HASH(17, hash_crc32c(0, data, sizeof data), crc32c_ref(data, sizeof data))
+
+	for (ok = 1, i = 0; i < 16; ++i)
+		for (j = 0; j < 80; ++j)
+			if (hash_crc32c(0, data + i, j) != crc32c_ref(data + i, j))
+				ok = 0;
+
+	TEST_ACT(18, ok)
+
+	for (ok = 1, step = 1; step <= 40; ++step)
+	{
+		for (crc = 0, i = 0; i < sizeof data; i += step)
+			crc = hash_crc32c(crc, data + i, (i + step <= sizeof data) ? step : sizeof data - i);
+
+		if (crc != crc32c_ref(data, sizeof data))
+			ok = 0;
+	}
+
+	TEST_ACT(19, ok)
+
+	/* Test the map adapters */
+
+	TEST_ACT(20, hash_map_str(11, "abc") == hash_str("abc", 0) % 11 && hash_map_int(11, (void *)7) < 11)
+
+	if (!(map = map_create_with_hash(hash_map_str, free)))
+		++errors, printf("Test21: map_create_with_hash() failed\n");
+	else
+	{
+		for (i = 0; i < 1000; ++i)
+		{
+			snprintf(key, sizeof key, "key%d", (int)i);
+			map_add(map, key, strdup(key));
+		}
+
+		for (ok = 1, i = 0; i < 1000; ++i)
+		{
+			const char *value;
+
+			snprintf(key, sizeof key, "key%d", (int)i);
+
+			if (!(value = map_get(map, key)) || strcmp(value, key))
+				ok = 0;
+		}
+
+		TEST_ACT(21, ok && map_size(map) == 1000)
+		map_destroy(&map);
+	}
+
+	/* Test errors */
+
+	TEST_ACT(22, hash_init(NULL, 0) == -1 && errno == EINVAL)
+	TEST_ACT(23, hash_update(state, NULL, 1) == -1 && errno == EINVAL)
+	TEST_ACT(24, hash_str(NULL, 0) == 0 && errno == EINVAL)
+	TEST_ACT(25, hash_crc32c(0, NULL, 1) == 0 && errno == EINVAL)
+
+	if (errors)
+		printf("%d/25 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
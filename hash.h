@@ -0,0 +1,55 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_HASH_H
+#define LIBSLACK_HASH_H
+
+#include <sys/types.h>
+
+#include <slack/hdr.h>
+
+typedef struct HashState HashState;
+
+struct HashState
+{
+	unsigned long long acc[4];   /* private: use hash_init() */
+	unsigned long long seed;
+	unsigned long long total;
+	unsigned char buf[32];
+	size_t buffered;
+};
+
+_begin_decls
+unsigned long long hash_bytes(const void *data, size_t length, unsigned long long seed);
+unsigned long long hash_str(const char *str, unsigned long long seed);
+int hash_init(HashState *state, unsigned long long seed);
+int hash_update(HashState *state, const void *data, size_t length);
+unsigned long long hash_final(const HashState *state);
+unsigned long long hash_mix64(unsigned long long x);
+unsigned int hash_mix32(unsigned int x);
+unsigned int hash_crc32c(unsigned int crc, const void *data, size_t length);
+size_t hash_map_str(size_t table_size, const void *key);
+size_t hash_map_int(size_t table_size, const void *key);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -27,7 +27,9 @@
 #include <slack/coproc.h>
 #include <slack/daemon.h>
 #include <slack/err.h>
+#include <slack/filter.h>
 #include <slack/fio.h>
+#include <slack/hash.h>
 #include <slack/hsort.h>
 #include <slack/lim.h>
 #include <slack/link.h>
@@ -40,6 +42,8 @@
 #include <slack/prog.h>
 #include <slack/prop.h>
 #include <slack/pseudo.h>
+#include <slack/rope.h>
+#include <slack/shm.h>
 #include <slack/sig.h>
 #include <slack/str.h>
 
@@ -38,6 +38,7 @@ I<libslack(list)> - list module
     typedef void list_action_t(void *item, size_t *index, void *data);
     typedef void *list_map_t(void *item, size_t *index, void *data);
     typedef int list_query_t(void *item, size_t *index, void *data);
+    typedef size_t list_hash_t(size_t table_size, const void *item);
 
     List *list_create(list_release_t *destroy);
     List *list_make(list_release_t *destroy, ...);
@@ -47,6 +48,8 @@ I<libslack(list)> - list module
     List *list_make_with_locker(Locker *locker, list_release_t *destroy, ...);
     List *list_vmake_with_locker(Locker *locker, list_release_t *destroy, va_list args);
     List *list_copy_with_locker(Locker *locker, const List *src, list_copy_t *copy);
+    List *list_adopt(void **items, size_t length, size_t size, list_release_t *destroy);
+    List *list_adopt_with_locker(Locker *locker, void **items, size_t length, size_t size, list_release_t *destroy);
     int list_rdlock(const List *list);
     int list_wrlock(const List *list);
     int list_unlock(const List *list);
@@ -56,6 +59,12 @@ I<libslack(list)> - list module
     int list_own_unlocked(List *list, list_release_t *destroy);
     list_release_t *list_disown(List *list);
     list_release_t *list_disown_unlocked(List *list);
+    int list_reserve(List *list, size_t size);
+    int list_reserve_unlocked(List *list, size_t size);
+    int list_shrink_to_fit(List *list);
+    int list_shrink_to_fit_unlocked(List *list);
+    int list_set_growth(List *list, int percent);
+    int list_set_growth_unlocked(List *list, int percent);
     void *list_item(const List *list, ssize_t index);
     void *list_item_unlocked(const List *list, ssize_t index);
     int list_item_int(const List *list, ssize_t index);
@@ -120,6 +129,28 @@ I<libslack(list)> - list module
     List *list_splice_with_locker_unlocked(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy);
     List *list_sort(List *list, list_cmp_t *cmp);
     List *list_sort_unlocked(List *list, list_cmp_t *cmp);
+    List *list_reverse(List *list);
+    List *list_reverse_unlocked(List *list);
+    List *list_rotate(List *list, ssize_t count);
+    List *list_rotate_unlocked(List *list, ssize_t count);
+    List *list_retain(List *list, list_query_t *query, void *data);
+    List *list_retain_unlocked(List *list, list_query_t *query, void *data);
+    ssize_t list_partition(List *list, list_query_t *query, void *data);
+    ssize_t list_partition_unlocked(List *list, list_query_t *query, void *data);
+    List *list_unique(List *list, list_cmp_t *cmp);
+    List *list_unique_unlocked(List *list, list_cmp_t *cmp);
+    List *list_unique_hashed(List *list, list_hash_t *hash, list_cmp_t *cmp);
+    List *list_unique_hashed_unlocked(List *list, list_hash_t *hash, list_cmp_t *cmp);
+    ssize_t list_bsearch(const List *list, const void *item, list_cmp_t *cmp);
+    ssize_t list_bsearch_unlocked(const List *list, const void *item, list_cmp_t *cmp);
+    ssize_t list_lower_bound(const List *list, const void *item, list_cmp_t *cmp);
+    ssize_t list_lower_bound_unlocked(const List *list, const void *item, list_cmp_t *cmp);
+    ssize_t list_upper_bound(const List *list, const void *item, list_cmp_t *cmp);
+    ssize_t list_upper_bound_unlocked(const List *list, const void *item, list_cmp_t *cmp);
+    List *list_insert_sorted(List *list, void *item, list_cmp_t *cmp);
+    List *list_insert_sorted_unlocked(List *list, void *item, list_cmp_t *cmp);
+    List *list_merge(List *list, const List *src, list_cmp_t *cmp, list_copy_t *copy);
+    List *list_merge_unlocked(List *list, const List *src, list_cmp_t *cmp, list_copy_t *copy);
     void list_apply(List *list, list_action_t *action, void *data);
     void list_apply_rdlocked(List *list, list_action_t *action, void *data);
     void list_apply_wrlocked(List *list, list_action_t *action, void *data);
@@ -182,16 +213,6 @@ outlive the destination list.
 #define iff(a, b) !xor(a, b)
 #define implies(a, b) (!(a) || (b))
 
-struct List
-{
-	size_t size;             /* number of item slots allocated */
-	size_t length;           /* number of items used */
-	void **list;             /* vector of items (void *) */
-	list_release_t *destroy; /* item destructor, if any */
-	Lister *lister;          /* built-in iterator */
-	Locker *locker;          /* locking strategy for this object */
-};
-
 struct Lister
 {
 	List *list;              /* the list being iterated over */
@@ -204,33 +225,61 @@ struct Lister
 
 static const size_t MIN_LIST_SIZE = 4;
 
+/* Default percentage by which a full list grows (doubling) */
+
+static const int LIST_GROWTH = 100;
+
+/*
+
+C<int resize(List *list, size_t size)>
+
+Resizes C<list>'s vector of items to hold C<size> items. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately, and C<list>
+is unchanged.
+
+*/
+
+static int resize(List *list, size_t size)
+{
+	if (size == list->size)
+		return 0;
+
+	if (!size)
+	{
+		mem_release(list->list);
+		list->list = NULL;
+	}
+	else if (!mem_resize(&list->list, size))
+		return -1;
+
+	list->size = size;
+
+	return 0;
+}
+
 /*
 
 C<int grow(List *list, size_t items)>
 
-Allocates enough memory to add C<item> extra items to C<list> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+Allocates enough memory to add C<item> extra items to C<list> if necessary,
+growing it by C<list-E<gt>growth> percent at a time. On success, returns
+C<0>. On error, returns C<-1>.
 
 */
 
 static int grow(List *list, size_t items)
 {
-	int grown = 0;
+	size_t size = list->size;
 
-	while (list->length + items > list->size)
+	while (list->length + items > size)
 	{
-		if (list->size)
-			list->size <<= 1;
+		if (size)
+			size += (size * list->growth + 99) / 100;
 		else
-			list->size = MIN_LIST_SIZE;
-
-		grown = 1;
+			size = MIN_LIST_SIZE;
 	}
 
-	if (grown)
-		return mem_resize(&list->list, list->size) ? 0 : -1;
-
-	return 0;
+	return resize(list, size);
 }
 
 /*
@@ -238,27 +287,26 @@ static int grow(List *list, size_t items)
 C<int shrink(List *list, size_t items)>
 
 Allocates less memory for removing C<items> items from C<list> if necessary.
+The vector is halved only while it would be less than a quarter full, so a
+list whose length oscillates around a boundary doesn't reallocate on every
+change. It never shrinks below C<MIN_LIST_SIZE> or C<list>'s reserved size.
 On success, returns C<0>. On error, returns C<-1>.
 
 */
 
 static int shrink(List *list, size_t items)
 {
-	int shrunk = 0;
+	size_t size = list->size;
 
-	while (list->length - items < list->size >> 1)
+	while (list->length - items < size >> 2)
 	{
-		if (list->size == MIN_LIST_SIZE)
+		if (size >> 1 < MIN_LIST_SIZE || size >> 1 < list->reserve)
 			break;
 
-		list->size >>= 1;
-		shrunk = 1;
+		size >>= 1;
 	}
 
-	if (shrunk)
-		return mem_resize(&list->list, list->size) ? 0 : -1;
-
-	return 0;
+	return resize(list, size);
 }
 
 /*
@@ -445,6 +493,8 @@ List *list_create_with_locker(Locker *locker, list_release_t *destroy)
 	list->destroy = destroy;
 	list->lister = NULL;
 	list->locker = locker;
+	list->reserve = 0;
+	list->growth = LIST_GROWTH;
 
 	return list;
 }
@@ -529,6 +579,60 @@ List *list_copy_with_locker(Locker *locker, const List *src, list_copy_t *copy)
 
 /*
 
+=item C<List *list_adopt(void **items, size_t length, size_t size, list_release_t *destroy)>
+
+Creates a I<List> that takes ownership of the vector C<items> without
+copying it, with C<destroy> as its item destructor. C<items> must have been
+allocated with I<malloc(3)> (or I<mem_create(3)>), must have room for
+C<size> items, and must contain C<length> items (C<length> must not be
+greater than C<size>). C<items> may be C<null> if C<size> is zero. From
+then on, C<items> belongs to the new list and is resized with I<realloc(3)>
+and deallocated with I<free(3)> as needed. It is the caller's responsibility
+to deallocate the new list with I<list_release(3)> or I<list_destroy(3)>. It
+is strongly recommended to use I<list_destroy(3)>, because it also sets the
+pointer variable to C<null>. On success, returns the new list. On error,
+returns C<null> with C<errno> set appropriately, and C<items> still belongs
+to the caller.
+
+=cut
+
+*/
+
+List *list_adopt(void **items, size_t length, size_t size, list_release_t *destroy)
+{
+	return list_adopt_with_locker(NULL, items, length, size, destroy);
+}
+
+/*
+
+=item C<List *list_adopt_with_locker(Locker *locker, void **items, size_t length, size_t size, list_release_t *destroy)>
+
+Equivalent to I<list_adopt(3)> except that multiple threads accessing the
+new list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *list_adopt_with_locker(Locker *locker, void **items, size_t length, size_t size, list_release_t *destroy)
+{
+	List *list;
+
+	if ((!items && size) || length > size)
+		return set_errnull(EINVAL);
+
+	if (!(list = list_create_with_locker(locker, destroy)))
+		return NULL;
+
+	list->size = size;
+	list->length = length;
+	list->list = items;
+
+	return list;
+}
+
+/*
+
 =item C<int list_rdlock(const List *list)>
 
 Claims a read lock on C<list> (if C<list> was created with a I<Locker>).
@@ -746,6 +850,168 @@ list_release_t *list_disown_unlocked(List *list)
 
 /*
 
+=item C<int list_reserve(List *list, size_t size)>
+
+Makes sure that at least C<size> item slots are allocated for C<list>, so
+that it can grow to that length without reallocating. C<list> will not be
+shrunk automatically below C<size> slots until I<list_shrink_to_fit(3)> is
+called. On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int list_reserve(List *list, size_t size)
+{
+	int ret;
+	int err;
+
+	if (!list)
+		return set_errno(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errno(err);
+
+	ret = list_reserve_unlocked(list, size);
+
+	if ((err = list_unlock(list)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int list_reserve_unlocked(List *list, size_t size)>
+
+Equivalent to I<list_reserve(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+int list_reserve_unlocked(List *list, size_t size)
+{
+	if (!list)
+		return set_errno(EINVAL);
+
+	if (size > list->size && resize(list, size) == -1)
+		return -1;
+
+	list->reserve = size;
+
+	return 0;
+}
+
+/*
+
+=item C<int list_shrink_to_fit(List *list)>
+
+Releases any memory allocated for C<list> beyond what its current items
+need, and cancels any reservation made with I<list_reserve(3)>. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int list_shrink_to_fit(List *list)
+{
+	int ret;
+	int err;
+
+	if (!list)
+		return set_errno(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errno(err);
+
+	ret = list_shrink_to_fit_unlocked(list);
+
+	if ((err = list_unlock(list)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int list_shrink_to_fit_unlocked(List *list)>
+
+Equivalent to I<list_shrink_to_fit(3)> except that C<list> is not
+write-locked.
+
+=cut
+
+*/
+
+int list_shrink_to_fit_unlocked(List *list)
+{
+	if (!list)
+		return set_errno(EINVAL);
+
+	list->reserve = 0;
+
+	return resize(list, list->length);
+}
+
+/*
+
+=item C<int list_set_growth(List *list, int percent)>
+
+Sets the percentage by which C<list>'s vector of items grows when it is
+full. The default is C<100> (doubling). Smaller values waste less memory but
+reallocate more often. Lists shrink only when less than a quarter full,
+regardless of C<percent>. On success, returns C<0>. On error, returns C<-1>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int list_set_growth(List *list, int percent)
+{
+	int ret;
+	int err;
+
+	if (!list)
+		return set_errno(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errno(err);
+
+	ret = list_set_growth_unlocked(list, percent);
+
+	if ((err = list_unlock(list)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int list_set_growth_unlocked(List *list, int percent)>
+
+Equivalent to I<list_set_growth(3)> except that C<list> is not
+write-locked.
+
+=cut
+
+*/
+
+int list_set_growth_unlocked(List *list, int percent)
+{
+	if (!list || percent < 1)
+		return set_errno(EINVAL);
+
+	list->growth = percent;
+
+	return 0;
+}
+
+/*
+
 =item C<void *list_item(const List *list, ssize_t index)>
 
 Returns the C<index>'th item in C<list>. If C<index> is negative, it refers
@@ -757,7 +1023,7 @@ error, returns C<null> with C<errno> set appropriately.
 
 */
 
-void *list_item(const List *list, ssize_t index)
+void *(list_item)(const List *list, ssize_t index)
 {
 	void *item;
 	int err;
@@ -786,7 +1052,7 @@ Equivalent to I<list_item(3)> except that C<list> is not read-locked.
 
 */
 
-void *list_item_unlocked(const List *list, ssize_t index)
+void *(list_item_unlocked)(const List *list, ssize_t index)
 {
 	if (!list)
 		return set_errnull(EINVAL);
@@ -887,26 +1153,33 @@ int list_empty_unlocked(const List *list)
 =item C<ssize_t list_length(const List *list)>
 
 Returns the length of C<list>. On error, returns C<-1> with C<errno> set
-appropriately.
+appropriately. If C<list>'s I<Locker> was created by
+I<locker_create_seqlock(3)>, this is an optimistic read (see
+I<locker_read_begin(3)>).
 
 =cut
 
 */
 
-ssize_t list_length(const List *list)
+ssize_t (list_length)(const List *list)
 {
+	unsigned long seq;
 	size_t length;
 	int err;
 
 	if (!list)
 		return set_errno(EINVAL);
 
-	if ((err = list_rdlock(list)))
-		return set_errno(err);
+	do
+	{
+		if ((err = locker_read_begin(list->locker, &seq)))
+			return set_errno(err);
 
-	length = list->length;
+		length = list->length;
+	}
+	while ((err = locker_read_validate(list->locker, seq)) == EAGAIN);
 
-	if ((err = list_unlock(list)))
+	if (err)
 		return set_errno(err);
 
 	return length;
@@ -922,7 +1195,7 @@ Equivalent to I<list_length(3)> except that C<list> is not read-locked.
 
 */
 
-ssize_t list_length_unlocked(const List *list)
+ssize_t (list_length_unlocked)(const List *list)
 {
 	if (!list)
 		return set_errno(EINVAL);
@@ -2067,68 +2340,851 @@ List *list_unshift_int(List *list, int item)
 
 =item C<List *list_unshift_int_unlocked(List *list, int item)>
 
-Equivalent to I<list_unshift_int(3)> except that C<list> is not
-write-locked.
+Equivalent to I<list_unshift_int(3)> except that C<list> is not
+write-locked.
+
+=cut
+
+*/
+
+List *list_unshift_int_unlocked(List *list, int item)
+{
+	return list_prepend_int_unlocked(list, item);
+}
+
+/*
+
+=item C<List *list_splice(List *list, ssize_t index, ssize_t range, list_copy_t *copy)>
+
+Removes a sublist from C<list> starting at C<index>, with length C<range>,
+after copying the items with C<copy> (if not C<null>). If C<index> or
+C<range> are negative, they refer to item positions relative to the end of
+the list (C<-1> is the position after the last item, C<-2> is the position
+of the last item and so on). On success, returns the sublist. It is the
+caller's responsibility to deallocate the new list with I<list_release(3)>
+or I<list_destroy(3)>. It is strongly recommended to use I<list_destroy(3)>,
+because it also sets the pointer variable to C<null>. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_splice(List *list, ssize_t index, ssize_t range, list_copy_t *copy)
+{
+	return list_splice_with_locker(NULL, list, index, range, copy);
+}
+
+/*
+
+=item C<List *list_splice_unlocked(List *list, ssize_t index, ssize_t range, list_copy_t *copy)>
+
+Equivalent to I<list_splice(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+List *list_splice_unlocked(List *list, ssize_t index, ssize_t range, list_copy_t *copy)
+{
+	return list_splice_with_locker_unlocked(NULL, list, index, range, copy);
+}
+
+/*
+
+=item C<List *list_splice_with_locker(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy)>
+
+Equivalent to I<list_splice(3)> except that multiple threads accessing the
+new list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *list_splice_with_locker(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy)
+{
+	List *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	ret = list_splice_with_locker_unlocked(locker, list, index, range, copy);
+
+	if ((err = list_unlock(list)))
+	{
+		list_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_splice_with_locker_unlocked(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy)>
+
+Equivalent to I<list_splice_with_locker(3)> except that C<list> is not
+write-locked.
+
+=cut
+
+*/
+
+List *list_splice_with_locker_unlocked(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy)
+{
+	List *ret;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if (!(ret = list_extract_with_locker_unlocked(locker, list, index, range, copy)))
+		return NULL;
+
+	if (!list_remove_range_unlocked(list, index, range))
+	{
+		list_release(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_sort(List *list, list_cmp_t *cmp)>
+
+Sorts the items in C<list>, using the item comparison function C<cmp>, and
+I<qsort(3)> for lists of fewer than 10000 items, and I<hsort(3)> for larger
+lists. On success, returns C<list>. On error, returns C<null> with C<errno>
+set appropriately.
+
+=cut
+
+*/
+
+List *list_sort(List *list, list_cmp_t *cmp)
+{
+	List *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	ret = list_sort_unlocked(list, cmp);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_sort_unlocked(List *list, list_cmp_t *cmp)>
+
+Equivalent to I<list_sort(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+List *list_sort_unlocked(List *list, list_cmp_t *cmp)
+{
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if (!list->list || !list->length)
+		return set_errnull(EINVAL);
+
+	((list->length >= 10000) ? hsort : qsort)(list->list, list->length, sizeof list->list[0], cmp);
+
+	return list;
+}
+
+/*
+
+C<void reverse(void **items, size_t length)>
+
+Reverses the order of the C<length> items in C<items>.
+
+*/
+
+static void reverse(void **items, size_t length)
+{
+	size_t i, j;
+	void *tmp;
+
+	for (i = 0, j = length; i + 1 < j; ++i)
+	{
+		tmp = items[i];
+		items[i] = items[--j];
+		items[j] = tmp;
+	}
+}
+
+/*
+
+C<void compact(List *list, size_t length)>
+
+Truncates C<list> to its first C<length> items, after the items that remain
+have been moved there, and releases memory if it is now less than a quarter
+full. Failing to release memory leaves C<list> intact, so it isn't an error.
+
+*/
+
+static void compact(List *list, size_t length)
+{
+	shrink(list, list->length - length);
+	list->length = length;
+}
+
+/*
+
+=item C<List *list_reverse(List *list)>
+
+Reverses the order of the items in C<list> in place. On success, returns
+C<list>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_reverse(List *list)
+{
+	List *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	ret = list_reverse_unlocked(list);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_reverse_unlocked(List *list)>
+
+Equivalent to I<list_reverse(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+List *list_reverse_unlocked(List *list)
+{
+	if (!list)
+		return set_errnull(EINVAL);
+
+	reverse(list->list, list->length);
+
+	return list;
+}
+
+/*
+
+=item C<List *list_rotate(List *list, ssize_t count)>
+
+Rotates the items in C<list> C<count> positions to the left in place, so
+that the item at index C<count> becomes the first item. If C<count> is
+negative, the items are rotated to the right (i.e. C<-1> makes the last item
+the first). C<count> may be larger than the length of C<list>. Takes linear
+time and no extra memory. On success, returns C<list>. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_rotate(List *list, ssize_t count)
+{
+	List *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	ret = list_rotate_unlocked(list, count);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_rotate_unlocked(List *list, ssize_t count)>
+
+Equivalent to I<list_rotate(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+List *list_rotate_unlocked(List *list, ssize_t count)
+{
+	size_t left;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if (list->length < 2)
+		return list;
+
+	if (count < 0)
+		left = (list->length - ((size_t)0 - (size_t)count) % list->length) % list->length;
+	else
+		left = (size_t)count % list->length;
+
+	if (left)
+	{
+		reverse(list->list, left);
+		reverse(list->list + left, list->length - left);
+		reverse(list->list, list->length);
+	}
+
+	return list;
+}
+
+/*
+
+=item C<List *list_retain(List *list, list_query_t *query, void *data)>
+
+Removes the items in C<list> that don't satisfy C<query>, in a single pass,
+keeping the remaining items in their original order. The arguments passed
+to C<query> are the item, a pointer to the item's original position within
+C<list>, and C<data>. The removed items are destroyed if C<list> owns them.
+Unlike removing items one at a time (e.g. with I<lister_remove(3)>), this
+takes linear time regardless of how many items are removed. Unlike
+I<list_grep(3)>, no new list is created. On success, returns C<list>. On
+error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_retain(List *list, list_query_t *query, void *data)
+{
+	List *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	ret = list_retain_unlocked(list, query, data);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_retain_unlocked(List *list, list_query_t *query, void *data)>
+
+Equivalent to I<list_retain(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+List *list_retain_unlocked(List *list, list_query_t *query, void *data)
+{
+	size_t i, kept;
+	void *item;
+
+	if (!list || !query)
+		return set_errnull(EINVAL);
+
+	for (i = kept = 0; i < list->length; ++i)
+	{
+		item = list->list[i];
+
+		if (query(item, &i, data))
+			list->list[kept++] = item;
+		else if (list->destroy)
+			list->destroy(item);
+	}
+
+	compact(list, kept);
+
+	return list;
+}
+
+/*
+
+=item C<ssize_t list_partition(List *list, list_query_t *query, void *data)>
+
+Reorders the items in C<list> so that the items that satisfy C<query> come
+before the items that don't. The partition is stable: each group keeps its
+original relative order. The arguments passed to C<query> are the item, a
+pointer to the item's original position within C<list>, and C<data>. Takes
+linear time and temporarily allocates space for one pointer per item. On
+success, returns the number of items that satisfied C<query> (i.e. the index
+of the first item that didn't). On error, returns C<-1> with C<errno> set
+appropriately, and C<list> is unchanged.
+
+=cut
+
+*/
+
+ssize_t list_partition(List *list, list_query_t *query, void *data)
+{
+	ssize_t ret;
+	int err;
+
+	if (!list)
+		return set_errno(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errno(err);
+
+	ret = list_partition_unlocked(list, query, data);
+
+	if ((err = list_unlock(list)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<ssize_t list_partition_unlocked(List *list, list_query_t *query, void *data)>
+
+Equivalent to I<list_partition(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+ssize_t list_partition_unlocked(List *list, list_query_t *query, void *data)
+{
+	void **rejects;
+	size_t i, kept, rejected;
+	void *item;
+
+	if (!list || !query)
+		return set_errno(EINVAL);
+
+	if (!list->length)
+		return 0;
+
+	if (!(rejects = mem_create(list->length, void *)))
+		return -1;
+
+	for (i = kept = rejected = 0; i < list->length; ++i)
+	{
+		item = list->list[i];
+
+		if (query(item, &i, data))
+			list->list[kept++] = item;
+		else
+			rejects[rejected++] = item;
+	}
+
+	memcpy(list->list + kept, rejects, rejected * sizeof(*rejects));
+	mem_release(rejects);
+
+	return kept;
+}
+
+/*
+
+=item C<List *list_unique(List *list, list_cmp_t *cmp)>
+
+Removes each item in C<list> that is equal to the item before it, according
+to the item comparison function C<cmp> (which is passed pointers to the
+items as for I<list_sort(3)>), in a single pass. When C<list> is sorted,
+this removes all duplicates. The first item of each run of equal items is
+kept, and the others are destroyed if C<list> owns them. On success, returns
+C<list>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *list_unique(List *list, list_cmp_t *cmp)
+{
+	List *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	ret = list_unique_unlocked(list, cmp);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_unique_unlocked(List *list, list_cmp_t *cmp)>
+
+Equivalent to I<list_unique(3)> except that C<list> is not write-locked.
+
+=cut
+
+*/
+
+List *list_unique_unlocked(List *list, list_cmp_t *cmp)
+{
+	size_t i, kept;
+
+	if (!list || !cmp)
+		return set_errnull(EINVAL);
+
+	if (list->length < 2)
+		return list;
+
+	for (i = kept = 1; i < list->length; ++i)
+	{
+		if (cmp(&list->list[kept - 1], &list->list[i]))
+			list->list[kept++] = list->list[i];
+		else if (list->destroy)
+			list->destroy(list->list[i]);
+	}
+
+	compact(list, kept);
+
+	return list;
+}
+
+/*
+
+=item C<List *list_unique_hashed(List *list, list_hash_t *hash, list_cmp_t *cmp)>
+
+Removes all duplicate items from C<list>, whether or not they are adjacent,
+keeping the first occurrence of each item, and keeping the remaining items
+in their original order. Duplicates are found with a temporary hash table,
+using the hash function C<hash> (which is passed the size of the table and
+an item, and returns an index into the table, like a I<map_hash_t>), and the
+item comparison function C<cmp> (which is passed pointers to the items as
+for I<list_sort(3)>, and returns zero for equal items). Items that are equal
+according to C<cmp> must have the same hash. The removed items are destroyed
+if C<list> owns them. Takes expected linear time. On success, returns
+C<list>. On error, returns C<null> with C<errno> set appropriately, and
+C<list> is unchanged.
+
+=cut
+
+*/
+
+List *list_unique_hashed(List *list, list_hash_t *hash, list_cmp_t *cmp)
+{
+	List *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_wrlock(list)))
+		return set_errnull(err);
+
+	ret = list_unique_hashed_unlocked(list, hash, cmp);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<List *list_unique_hashed_unlocked(List *list, list_hash_t *hash, list_cmp_t *cmp)>
+
+Equivalent to I<list_unique_hashed(3)> except that C<list> is not
+write-locked.
+
+=cut
+
+*/
+
+List *list_unique_hashed_unlocked(List *list, list_hash_t *hash, list_cmp_t *cmp)
+{
+	size_t *table, size, slot, i, kept;
+	void *item;
+
+	if (!list || !hash || !cmp)
+		return set_errnull(EINVAL);
+
+	if (list->length < 2)
+		return list;
+
+	/* Open addressing with linear probing, at most half full */
+
+	for (size = MIN_LIST_SIZE; size < list->length << 1; size <<= 1)
+		;
+
+	if (!(table = mem_create(size, size_t)))
+		return NULL;
+
+	memset(table, 0, size * sizeof(*table));
+
+	/* Each slot holds the index (plus one) of a kept item, or zero */
+
+	for (i = kept = 0; i < list->length; ++i)
+	{
+		item = list->list[i];
+
+		for (slot = hash(size, item) & (size - 1); table[slot]; slot = (slot + 1) & (size - 1))
+			if (!cmp(&list->list[table[slot] - 1], &item))
+				break;
+
+		if (table[slot])
+		{
+			if (list->destroy)
+				list->destroy(item);
+
+			continue;
+		}
+
+		list->list[kept++] = item;
+		table[slot] = kept;
+	}
+
+	mem_release(table);
+	compact(list, kept);
+
+	return list;
+}
+
+/*
+
+C<size_t bound(const List *list, const void *item, list_cmp_t *cmp, int upper)>
+
+Returns the index of the first item in the sorted C<list> that is not less
+than C<item> (or greater than C<item> if C<upper> is non-zero), according to
+C<cmp>, or the length of C<list> if there is no such item.
+
+*/
+
+static size_t bound(const List *list, const void *item, list_cmp_t *cmp, int upper)
+{
+	size_t lo = 0, hi = list->length, mid;
+	int c;
+
+	while (lo < hi)
+	{
+		mid = lo + ((hi - lo) >> 1);
+		c = cmp(&item, &list->list[mid]);
+
+		if (c > 0 || (upper && c == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+
+=item C<ssize_t list_bsearch(const List *list, const void *item, list_cmp_t *cmp)>
+
+Searches C<list>, which must be sorted according to the item comparison
+function C<cmp> (e.g. by I<list_sort(3)>), for an item equal to C<item>,
+using binary search. As for I<list_sort(3)>, C<cmp> is passed pointers to
+the items (the first is a pointer to C<item>). Takes logarithmic time.
+Returns the index of the first item equal to C<item>, or C<-1> if there is
+none. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t list_bsearch(const List *list, const void *item, list_cmp_t *cmp)
+{
+	ssize_t ret;
+	int err;
+
+	if (!list)
+		return set_errno(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errno(err);
+
+	ret = list_bsearch_unlocked(list, item, cmp);
+
+	if ((err = list_unlock(list)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<ssize_t list_bsearch_unlocked(const List *list, const void *item, list_cmp_t *cmp)>
+
+Equivalent to I<list_bsearch(3)> except that C<list> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t list_bsearch_unlocked(const List *list, const void *item, list_cmp_t *cmp)
+{
+	size_t index;
+
+	if (!list || !cmp)
+		return set_errno(EINVAL);
+
+	index = bound(list, item, cmp, 0);
+
+	if (index == list->length || cmp(&item, &list->list[index]))
+		return -1;
+
+	return index;
+}
+
+/*
+
+=item C<ssize_t list_lower_bound(const List *list, const void *item, list_cmp_t *cmp)>
+
+Returns the index of the first item in C<list>, which must be sorted
+according to C<cmp>, that is not less than C<item> (i.e. the first position
+where C<item> could be inserted without breaking the order), or the length
+of C<list> if all items are less than C<item>. C<cmp> is passed pointers to
+the items as for I<list_bsearch(3)>. Takes logarithmic time. On error,
+returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t list_lower_bound(const List *list, const void *item, list_cmp_t *cmp)
+{
+	ssize_t ret;
+	int err;
+
+	if (!list)
+		return set_errno(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errno(err);
+
+	ret = list_lower_bound_unlocked(list, item, cmp);
+
+	if ((err = list_unlock(list)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<ssize_t list_lower_bound_unlocked(const List *list, const void *item, list_cmp_t *cmp)>
+
+Equivalent to I<list_lower_bound(3)> except that C<list> is not
+read-locked.
 
 =cut
 
 */
 
-List *list_unshift_int_unlocked(List *list, int item)
+ssize_t list_lower_bound_unlocked(const List *list, const void *item, list_cmp_t *cmp)
 {
-	return list_prepend_int_unlocked(list, item);
+	if (!list || !cmp)
+		return set_errno(EINVAL);
+
+	return bound(list, item, cmp, 0);
 }
 
 /*
 
-=item C<List *list_splice(List *list, ssize_t index, ssize_t range, list_copy_t *copy)>
+=item C<ssize_t list_upper_bound(const List *list, const void *item, list_cmp_t *cmp)>
 
-Removes a sublist from C<list> starting at C<index>, with length C<range>,
-after copying the items with C<copy> (if not C<null>). If C<index> or
-C<range> are negative, they refer to item positions relative to the end of
-the list (C<-1> is the position after the last item, C<-2> is the position
-of the last item and so on). On success, returns the sublist. It is the
-caller's responsibility to deallocate the new list with I<list_release(3)>
-or I<list_destroy(3)>. It is strongly recommended to use I<list_destroy(3)>,
-because it also sets the pointer variable to C<null>. On error, returns
-C<null> with C<errno> set appropriately.
+Returns the index of the first item in C<list>, which must be sorted
+according to C<cmp>, that is greater than C<item> (i.e. the last position
+where C<item> could be inserted without breaking the order), or the length
+of C<list> if no items are greater than C<item>. C<cmp> is passed pointers
+to the items as for I<list_bsearch(3)>. Takes logarithmic time. On error,
+returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-List *list_splice(List *list, ssize_t index, ssize_t range, list_copy_t *copy)
+ssize_t list_upper_bound(const List *list, const void *item, list_cmp_t *cmp)
 {
-	return list_splice_with_locker(NULL, list, index, range, copy);
+	ssize_t ret;
+	int err;
+
+	if (!list)
+		return set_errno(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errno(err);
+
+	ret = list_upper_bound_unlocked(list, item, cmp);
+
+	if ((err = list_unlock(list)))
+		return set_errno(err);
+
+	return ret;
 }
 
 /*
 
-=item C<List *list_splice_unlocked(List *list, ssize_t index, ssize_t range, list_copy_t *copy)>
+=item C<ssize_t list_upper_bound_unlocked(const List *list, const void *item, list_cmp_t *cmp)>
 
-Equivalent to I<list_splice(3)> except that C<list> is not write-locked.
+Equivalent to I<list_upper_bound(3)> except that C<list> is not
+read-locked.
 
 =cut
 
 */
 
-List *list_splice_unlocked(List *list, ssize_t index, ssize_t range, list_copy_t *copy)
+ssize_t list_upper_bound_unlocked(const List *list, const void *item, list_cmp_t *cmp)
 {
-	return list_splice_with_locker_unlocked(NULL, list, index, range, copy);
+	if (!list || !cmp)
+		return set_errno(EINVAL);
+
+	return bound(list, item, cmp, 1);
 }
 
 /*
 
-=item C<List *list_splice_with_locker(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy)>
+=item C<List *list_insert_sorted(List *list, void *item, list_cmp_t *cmp)>
 
-Equivalent to I<list_splice(3)> except that multiple threads accessing the
-new list will be synchronised by C<locker>.
+Inserts C<item> into C<list>, which must be sorted according to C<cmp>, at
+the position that keeps it sorted (after any equal items), found by binary
+search. C<cmp> is passed pointers to the items as for I<list_bsearch(3)>.
+On success, returns C<list>. On error, returns C<null> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-List *list_splice_with_locker(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy)
+List *list_insert_sorted(List *list, void *item, list_cmp_t *cmp)
 {
 	List *ret;
 	int err;
@@ -2139,72 +3195,73 @@ List *list_splice_with_locker(Locker *locker, List *list, ssize_t index, ssize_t
 	if ((err = list_wrlock(list)))
 		return set_errnull(err);
 
-	ret = list_splice_with_locker_unlocked(locker, list, index, range, copy);
+	ret = list_insert_sorted_unlocked(list, item, cmp);
 
 	if ((err = list_unlock(list)))
-	{
-		list_release(ret);
 		return set_errnull(err);
-	}
 
 	return ret;
 }
 
 /*
 
-=item C<List *list_splice_with_locker_unlocked(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy)>
+=item C<List *list_insert_sorted_unlocked(List *list, void *item, list_cmp_t *cmp)>
 
-Equivalent to I<list_splice_with_locker(3)> except that C<list> is not
+Equivalent to I<list_insert_sorted(3)> except that C<list> is not
 write-locked.
 
 =cut
 
 */
 
-List *list_splice_with_locker_unlocked(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy)
+List *list_insert_sorted_unlocked(List *list, void *item, list_cmp_t *cmp)
 {
-	List *ret;
-
-	if (!list)
+	if (!list || !cmp)
 		return set_errnull(EINVAL);
 
-	if (!(ret = list_extract_with_locker_unlocked(locker, list, index, range, copy)))
-		return NULL;
-
-	if (!list_remove_range_unlocked(list, index, range))
-	{
-		list_release(ret);
-		return NULL;
-	}
-
-	return ret;
+	return list_insert_unlocked(list, bound(list, item, cmp, 1), item);
 }
 
 /*
 
-=item C<List *list_sort(List *list, list_cmp_t *cmp)>
+=item C<List *list_merge(List *list, const List *src, list_cmp_t *cmp, list_copy_t *copy)>
 
-Sorts the items in C<list>, using the item comparison function C<cmp>, and
-I<qsort(3)> for lists of fewer than 10000 items, and I<hsort(3)> for larger
-lists. On success, returns C<list>. On error, returns C<null> with C<errno>
-set appropriately.
+Merges the items in C<src> into C<list>, both of which must be sorted
+according to C<cmp>, so that C<list> stays sorted, using C<copy> as the copy
+constructor (if not C<null>). The merge is stable: items from C<list> come
+before equal items from C<src>. C<cmp> is passed pointers to the items as
+for I<list_sort(3)>. Takes linear time and no extra memory, rather than the
+I<O(n log n)> time of appending and sorting again. On success, returns
+C<list>. On error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-List *list_sort(List *list, list_cmp_t *cmp)
+List *list_merge(List *list, const List *src, list_cmp_t *cmp, list_copy_t *copy)
 {
 	List *ret;
 	int err;
 
-	if (!list)
+	if (!src || !list)
 		return set_errnull(EINVAL);
 
 	if ((err = list_wrlock(list)))
 		return set_errnull(err);
 
-	ret = list_sort_unlocked(list, cmp);
+	if ((err = list_rdlock(src)))
+	{
+		list_unlock(list);
+		return set_errnull(err);
+	}
+
+	ret = list_merge_unlocked(list, src, cmp, copy);
+
+	if ((err = list_unlock(src)))
+	{
+		list_unlock(list);
+		return set_errnull(err);
+	}
 
 	if ((err = list_unlock(list)))
 		return set_errnull(err);
@@ -2214,23 +3271,48 @@ List *list_sort(List *list, list_cmp_t *cmp)
 
 /*
 
-=item C<List *list_sort_unlocked(List *list, list_cmp_t *cmp)>
+=item C<List *list_merge_unlocked(List *list, const List *src, list_cmp_t *cmp, list_copy_t *copy)>
 
-Equivalent to I<list_sort(3)> except that C<list> is not write-locked.
+Equivalent to I<list_merge(3)> except that C<list> is not write-locked and
+C<src> is not read-locked. Note: If C<src> needs to be read-locked, it is
+the caller's responsibility to lock and unlock it explicitly with
+I<list_rdlock(3)> and I<list_unlock(3)>.
 
 =cut
 
 */
 
-List *list_sort_unlocked(List *list, list_cmp_t *cmp)
+List *list_merge_unlocked(List *list, const List *src, list_cmp_t *cmp, list_copy_t *copy)
 {
-	if (!list)
+	size_t i, j, k;
+
+	if (!src || !list || !cmp)
 		return set_errnull(EINVAL);
 
-	if (!list->list || !list->length)
+	if (xor(list->destroy, copy))
 		return set_errnull(EINVAL);
 
-	((list->length >= 10000) ? hsort : qsort)(list->list, list->length, sizeof list->list[0], cmp);
+	if (grow(list, src->length) == -1)
+		return NULL;
+
+	/* Merge from the back, so that no item is overwritten before it moves */
+
+	i = list->length;
+	j = src->length;
+	k = i + j;
+
+	while (j)
+	{
+		if (i && cmp(&list->list[i - 1], &src->list[j - 1]) > 0)
+			list->list[--k] = list->list[--i];
+		else
+		{
+			--j;
+			list->list[--k] = (copy) ? copy(src->list[j]) : src->list[j];
+		}
+	}
+
+	list->length += src->length;
 
 	return list;
 }
@@ -2841,7 +3923,9 @@ void *lister_next(Lister *lister)
 	if (!lister)
 		return set_errnull(EINVAL);
 
-	return list_item_unlocked(lister->list, (size_t)++lister->index);
+	++lister->index;
+
+	return list_item_unlocked(lister->list, lister->index);
 }
 
 /*
@@ -3078,6 +4162,19 @@ for each application, on a case by case basis.
 I<MT-Disciplined> means that the application developer has a mechanism for
 specifying the synchronisation requirements to be applied to library code.
 
+Most programs don't use a I<Locker> at all, and then the cost of calling
+I<list_item(3)> and I<list_length(3)> can dominate tight loops. When client
+code is compiled with C<INLINE_ACCESSORS> defined, I<list_item_unlocked(3)>
+and I<list_length_unlocked(3)> become macros that access the I<List>
+directly, and I<list_item(3)> and I<list_length(3)> become macros that do
+the same when the I<List> has no I<Locker> (and call the functions
+otherwise). When client code is compiled with C<NO_LOCKERS> defined (i.e.
+none of its I<List>s have a I<Locker>), I<list_item(3)> and
+I<list_length(3)> don't even check for a I<Locker>. Either way, a loop over
+I<list_item(3)> compiles to array indexing. Errors (e.g. invalid indexes)
+are still handled by the functions. Note that the macros evaluate their
+arguments more than once, so the arguments mustn't have side effects.
+
 =head1 EXAMPLES
 
 Create a list that doesn't own its items, populate it, and then iterate over
@@ -3576,6 +4673,40 @@ int grepf(int item, size_t *index, int *data)
 	return !(item & 1);
 }
 
+int oddf(int item, size_t *index, int *data)
+{
+	return item & 1;
+}
+
+int int_cmp(void * const *a, void * const *b)
+{
+	return (int)(long)*a - (int)(long)*b;
+}
+
+size_t int_hash(size_t size, const void *item)
+{
+	return (size_t)(long)item % 7 % size; /* Plenty of collisions */
+}
+
+int first_cmp(const char **a, const char **b)
+{
+	return **a - **b;
+}
+
+int check_ints(List *list, const int *values, size_t length)
+{
+	size_t i;
+
+	if (list_length(list) != length)
+		return 0;
+
+	for (i = 0; i < length; ++i)
+		if (list_item_int(list, i) != values[i])
+			return 0;
+
+	return 1;
+}
+
 #define RD 0
 #define WR 1
 List *mtlist = NULL;
@@ -4523,8 +5654,358 @@ int main(int ac, char **av)
 	if (sizeof(int) > sizeof(void *))
 		++errors, printf("Test176: assumption failed: sizeof(int) > sizeof(void *): int lists are limited to %d bytes\n", (int)sizeof(void *));
 
+	/* Test list_adopt */
+
+	{
+		void **items;
+
+		TEST_ACT(177, items = mem_create(8, void *))
+		else
+		{
+			items[0] = mem_strdup("a");
+			items[1] = mem_strdup("b");
+			items[2] = mem_strdup("c");
+
+			TEST_ACT(177, a = list_adopt(items, 3, 8, free))
+			else
+			{
+				TEST_ACT(177, a->list == items && a->size == 8)
+				CHECK_LENGTH(177, list_adopt(items, 3, 8, free), a, 3)
+				CHECK_ITEM(177, list_adopt(items, 3, 8, free), a, 0, "a")
+				CHECK_ITEM(177, list_adopt(items, 3, 8, free), a, 2, "c")
+
+				for (i = 0; i < 100; ++i)
+					list_append(a, mem_strdup("x"));
+
+				CHECK_LENGTH(177, list_append(), a, 103)
+				CHECK_ITEM(177, list_append(), a, 1, "b")
+				list_destroy(&a);
+			}
+		}
+
+		TEST_ACT(178, a = list_adopt(NULL, 0, 0, NULL))
+		TEST_ACT(178, list_append(a, "a"))
+		CHECK_ITEM(178, list_append(a, "a"), a, 0, "a")
+		list_destroy(&a);
+		TEST_ACT(178, !list_adopt(NULL, 0, 1, NULL))
+		TEST_ACT(178, !list_adopt((void **)&a, 2, 1, NULL))
+	}
+
+	/* Test list_reserve, list_shrink_to_fit */
+
+	TEST_ACT(179, a = list_create(NULL))
+	else
+	{
+		void **items;
+
+		TEST_EQ(179, list_reserve(a, 1000), 0)
+		TEST_ACT(179, a->size == 1000)
+		items = a->list;
+
+		for (i = 0; i < 1000; ++i)
+			if (!list_append_int(a, i))
+				break;
+
+		TEST_ACT(179, i == 1000 && a->list == items)
+		TEST_ACT(179, list_remove_range(a, 0, 999))
+		TEST_ACT(179, a->size == 1000)
+		TEST_EQ(179, list_shrink_to_fit(a), 0)
+		TEST_ACT(179, a->size == 1 && a->length == 1)
+		CHECK_INT_ITEM(179, list_shrink_to_fit(a), a, 0, 999)
+		TEST_ACT(179, list_remove(a, 0))
+		TEST_EQ(179, list_shrink_to_fit(a), 0)
+		TEST_ACT(179, a->size == 0 && !a->list)
+		TEST_ACT(179, list_append_int(a, 1))
+		CHECK_INT_ITEM(179, list_append_int(a, 1), a, 0, 1)
+		TEST_EQ(179, list_reserve(NULL, 1), -1)
+		TEST_EQ(179, list_shrink_to_fit(NULL), -1)
+		list_destroy(&a);
+	}
+
+	/* Test shrinking hysteresis: a list only shrinks below a quarter full */
+
+	TEST_ACT(180, a = list_create(NULL))
+	else
+	{
+		for (i = 0; i < 1024; ++i)
+			list_append_int(a, i);
+
+		TEST_ACT(180, a->size == 1024)
+		TEST_ACT(180, list_remove_range(a, 0, 512))
+		TEST_ACT(180, a->size == 1024)
+
+		for (i = 0; i < 100; ++i)
+			if (!list_push_int(a, i) || list_pop_int(a) != i || a->size != 1024)
+				break;
+
+		TEST_ACT(180, i == 100)
+		TEST_ACT(180, list_remove_range(a, 0, 300))
+		TEST_ACT(180, a->size == 512 && list_length(a) == 212)
+		list_destroy(&a);
+	}
+
+	/* Test list_set_growth */
+
+	TEST_ACT(181, a = list_create(NULL))
+	else
+	{
+		TEST_EQ(181, list_set_growth(a, 50), 0)
+
+		for (i = 0; i < 5; ++i)
+			list_append_int(a, i);
+
+		TEST_ACT(181, a->size == 6)
+
+		for (; i < 7; ++i)
+			list_append_int(a, i);
+
+		TEST_ACT(181, a->size == 9)
+		TEST_EQ(181, list_set_growth(a, 0), -1)
+		TEST_EQ(181, list_set_growth(NULL, 100), -1)
+		list_destroy(&a);
+	}
+
+	/* Test list_reverse, list_rotate */
+
+	TEST_ACT(182, a = list_create(NULL))
+	else
+	{
+		static const int reversed[] = { 6, 5, 4, 3, 2, 1, 0 };
+		static const int rotated[] = { 2, 3, 4, 5, 6, 0, 1 };
+		static const int identity[] = { 0, 1, 2, 3, 4, 5, 6 };
+
+		TEST_ACT(182, list_reverse(a) == a && list_empty(a))
+		TEST_ACT(182, list_rotate(a, 3) == a && list_empty(a))
+
+		for (i = 0; i < 7; ++i)
+			list_append_int(a, i);
+
+		TEST_ACT(182, list_reverse(a) && check_ints(a, reversed, 7))
+		TEST_ACT(182, list_reverse(a) && check_ints(a, identity, 7))
+		TEST_ACT(183, list_rotate(a, 2) && check_ints(a, rotated, 7))
+		TEST_ACT(183, list_rotate(a, -2) && check_ints(a, identity, 7))
+		TEST_ACT(183, list_rotate(a, 9) && check_ints(a, rotated, 7))
+		TEST_ACT(183, list_rotate(a, -9) && check_ints(a, identity, 7))
+		TEST_ACT(183, list_rotate(a, 7) && check_ints(a, identity, 7))
+		TEST_ACT(183, list_rotate(a, -7) && check_ints(a, identity, 7))
+		TEST_ACT(183, list_rotate(a, 0) && check_ints(a, identity, 7))
+		TEST_ACT(183, !list_reverse(NULL) && !list_rotate(NULL, 1))
+		list_destroy(&a);
+	}
+
+	/* Test list_retain, list_partition */
+
+	TEST_ACT(184, a = list_create(NULL))
+	else
+	{
+		static const int odd[] = { 1, 3, 5, 7, 9 };
+		static const int partitioned[] = { 1, 3, 5, 7, 9, 0, 2, 4, 6, 8 };
+
+		for (i = 0; i < 10; ++i)
+			list_append_int(a, i);
+
+		TEST_EQ(185, list_partition(a, (list_query_t *)oddf, NULL), 5)
+		TEST_ACT(185, check_ints(a, partitioned, 10))
+		TEST_EQ(185, list_partition(a, (list_query_t *)oddf, NULL), 5)
+		TEST_ACT(185, check_ints(a, partitioned, 10))
+		TEST_ACT(184, list_retain(a, (list_query_t *)oddf, NULL))
+		TEST_ACT(184, check_ints(a, odd, 5))
+		TEST_ACT(184, list_retain(a, (list_query_t *)grepf, NULL))
+		TEST_ACT(184, list_empty(a))
+		TEST_EQ(185, list_partition(a, (list_query_t *)oddf, NULL), 0)
+		TEST_ACT(184, !list_retain(NULL, (list_query_t *)oddf, NULL) && !list_retain(a, NULL, NULL))
+		TEST_EQ(185, list_partition(a, NULL, NULL), -1)
+		list_destroy(&a);
+	}
+
+	TEST_ACT(184, a = list_make(free, mem_strdup("abc"), mem_strdup("def"), mem_strdup("ghi"), mem_strdup("def"), NULL))
+	else
+	{
+		TEST_ACT(184, list_retain(a, (list_query_t *)query, NULL))
+		CHECK_LENGTH(184, list_retain(a, query, NULL), a, 2)
+		CHECK_ITEM(184, list_retain(a, query, NULL), a, 0, "def")
+		CHECK_ITEM(184, list_retain(a, query, NULL), a, 1, "def")
+		list_destroy(&a);
+	}
+
+	/* Test list_unique, list_unique_hashed */
+
+	TEST_ACT(186, a = list_create(NULL))
+	else
+	{
+		static const int dups[] = { 1, 1, 2, 2, 2, 3, 1, 1 };
+		static const int adjacent[] = { 1, 2, 3, 1 };
+		static const int scattered[] = { 3, 1, 3, 2, 1, 4, 2, 3 };
+		static const int unique[] = { 3, 1, 2, 4 };
+
+		for (i = 0; i < 8; ++i)
+			list_append_int(a, dups[i]);
+
+		TEST_ACT(186, list_unique(a, (list_cmp_t *)int_cmp))
+		TEST_ACT(186, check_ints(a, adjacent, 4))
+		TEST_ACT(186, list_unique(a, (list_cmp_t *)int_cmp))
+		TEST_ACT(186, check_ints(a, adjacent, 4))
+		TEST_ACT(186, !list_unique(a, NULL) && !list_unique(NULL, (list_cmp_t *)int_cmp))
+		list_remove_range(a, 0, -1);
+
+		for (i = 0; i < 8; ++i)
+			list_append_int(a, scattered[i]);
+
+		TEST_ACT(187, list_unique_hashed(a, int_hash, (list_cmp_t *)int_cmp))
+		TEST_ACT(187, check_ints(a, unique, 4))
+		TEST_ACT(187, !list_unique_hashed(a, NULL, (list_cmp_t *)int_cmp) && !list_unique_hashed(a, int_hash, NULL))
+		list_remove_range(a, 0, -1);
+
+		for (i = 0; i < 10000; ++i)
+			list_append_int(a, (i * 37) % 100);
+
+		TEST_ACT(187, list_unique_hashed(a, int_hash, (list_cmp_t *)int_cmp))
+		CHECK_LENGTH(187, list_unique_hashed(a, int_hash, int_cmp), a, 100)
+
+		for (i = 0; i < 100; ++i)
+			if (list_item_int(a, i) != (i * 37) % 100)
+				break;
+
+		TEST_ACT(187, i == 100)
+		list_destroy(&a);
+	}
+
+	/* Test list_bsearch, list_lower_bound, list_upper_bound */
+
+	TEST_ACT(188, a = list_create(NULL))
+	else
+	{
+		static const int sorted[] = { 1, 3, 3, 3, 5, 7 };
+
+		TEST_EQ(188, list_bsearch(a, (void *)3, (list_cmp_t *)int_cmp), -1)
+		TEST_EQ(189, list_lower_bound(a, (void *)3, (list_cmp_t *)int_cmp), 0)
+		TEST_EQ(189, list_upper_bound(a, (void *)3, (list_cmp_t *)int_cmp), 0)
+
+		for (i = 0; i < 6; ++i)
+			list_append_int(a, sorted[i]);
+
+		TEST_EQ(188, list_bsearch(a, (void *)3, (list_cmp_t *)int_cmp), 1)
+		TEST_EQ(188, list_bsearch(a, (void *)1, (list_cmp_t *)int_cmp), 0)
+		TEST_EQ(188, list_bsearch(a, (void *)7, (list_cmp_t *)int_cmp), 5)
+		TEST_EQ(188, list_bsearch(a, (void *)4, (list_cmp_t *)int_cmp), -1)
+		TEST_EQ(188, list_bsearch(a, (void *)0, (list_cmp_t *)int_cmp), -1)
+		TEST_EQ(188, list_bsearch(a, (void *)8, (list_cmp_t *)int_cmp), -1)
+		TEST_EQ(188, list_bsearch(a, (void *)3, NULL), -1)
+		TEST_EQ(189, list_lower_bound(a, (void *)3, (list_cmp_t *)int_cmp), 1)
+		TEST_EQ(189, list_upper_bound(a, (void *)3, (list_cmp_t *)int_cmp), 4)
+		TEST_EQ(189, list_lower_bound(a, (void *)4, (list_cmp_t *)int_cmp), 4)
+		TEST_EQ(189, list_upper_bound(a, (void *)4, (list_cmp_t *)int_cmp), 4)
+		TEST_EQ(189, list_lower_bound(a, (void *)0, (list_cmp_t *)int_cmp), 0)
+		TEST_EQ(189, list_upper_bound(a, (void *)7, (list_cmp_t *)int_cmp), 6)
+		TEST_EQ(189, list_lower_bound(a, (void *)8, (list_cmp_t *)int_cmp), 6)
+		TEST_EQ(189, list_lower_bound(NULL, (void *)8, (list_cmp_t *)int_cmp), -1)
+		list_destroy(&a);
+	}
+
+	/* Test list_insert_sorted */
+
+	TEST_ACT(190, a = list_create(NULL))
+	else
+	{
+		TEST_ACT(190, b = list_create(NULL))
+		else
+		{
+			srand(1);
+
+			for (i = 0; i < 1000; ++i)
+			{
+				val = rand() % 100;
+				list_insert_sorted(a, (void *)(long)val, (list_cmp_t *)int_cmp);
+				list_append_int(b, val);
+			}
+
+			list_sort(b, (list_cmp_t *)int_cmp);
+			CHECK_LENGTH(190, list_insert_sorted(), a, 1000)
+
+			for (i = 0; i < 1000; ++i)
+				if (list_item_int(a, i) != list_item_int(b, i))
+					break;
+
+			TEST_ACT(190, i == 1000)
+			list_destroy(&b);
+		}
+
+		TEST_ACT(190, !list_insert_sorted(a, (void *)1, NULL))
+		list_destroy(&a);
+	}
+
+	TEST_ACT(190, a = list_create(NULL))
+	else
+	{
+		TEST_ACT(190, list_insert_sorted(a, "b1", (list_cmp_t *)first_cmp))
+		TEST_ACT(190, list_insert_sorted(a, "a1", (list_cmp_t *)first_cmp))
+		TEST_ACT(190, list_insert_sorted(a, "b2", (list_cmp_t *)first_cmp))
+		TEST_ACT(190, list_insert_sorted(a, "a2", (list_cmp_t *)first_cmp))
+		CHECK_ITEM(190, list_insert_sorted(), a, 0, "a1")
+		CHECK_ITEM(190, list_insert_sorted(), a, 1, "a2")
+		CHECK_ITEM(190, list_insert_sorted(), a, 2, "b1")
+		CHECK_ITEM(190, list_insert_sorted(), a, 3, "b2")
+		list_destroy(&a);
+	}
+
+	/* Test list_merge */
+
+	TEST_ACT(191, a = list_make(NULL, "a1", "c1", "e1", NULL))
+	else
+	{
+		TEST_ACT(191, b = list_make(NULL, "a2", "b2", "c2", "f2", NULL))
+		else
+		{
+			TEST_ACT(191, list_merge(a, b, (list_cmp_t *)first_cmp, NULL))
+			CHECK_LENGTH(191, list_merge(), a, 7)
+			CHECK_ITEM(191, list_merge(), a, 0, "a1")
+			CHECK_ITEM(191, list_merge(), a, 1, "a2")
+			CHECK_ITEM(191, list_merge(), a, 2, "b2")
+			CHECK_ITEM(191, list_merge(), a, 3, "c1")
+			CHECK_ITEM(191, list_merge(), a, 4, "c2")
+			CHECK_ITEM(191, list_merge(), a, 5, "e1")
+			CHECK_ITEM(191, list_merge(), a, 6, "f2")
+			CHECK_LENGTH(191, list_merge(), b, 4)
+			TEST_ACT(191, !list_merge(a, b, (list_cmp_t *)first_cmp, (list_copy_t *)mem_strdup))
+			TEST_ACT(191, !list_merge(a, b, NULL, NULL))
+			list_destroy(&b);
+		}
+
+		TEST_ACT(191, b = list_create(NULL))
+		else
+		{
+			TEST_ACT(191, list_merge(a, b, (list_cmp_t *)first_cmp, NULL))
+			CHECK_LENGTH(191, list_merge(), a, 7)
+			TEST_ACT(191, list_merge(b, a, (list_cmp_t *)first_cmp, NULL))
+			CHECK_LENGTH(191, list_merge(), b, 7)
+			CHECK_ITEM(191, list_merge(), b, 0, "a1")
+			CHECK_ITEM(191, list_merge(), b, 6, "f2")
+			list_destroy(&b);
+		}
+
+		list_destroy(&a);
+	}
+
+	TEST_ACT(192, a = list_make(free, mem_strdup("b"), mem_strdup("d"), NULL))
+	else
+	{
+		TEST_ACT(192, b = list_make(NULL, "a", "c", "e", NULL))
+		else
+		{
+			TEST_ACT(192, list_merge(a, b, (list_cmp_t *)sort_cmp, (list_copy_t *)mem_strdup))
+			CHECK_LENGTH(192, list_merge(), a, 5)
+			CHECK_ITEM(192, list_merge(), a, 0, "a")
+			CHECK_ITEM(192, list_merge(), a, 2, "c")
+			CHECK_ITEM(192, list_merge(), a, 4, "e")
+			TEST_ACT(192, list_item(a, 0) != list_item(b, 0))
+			list_destroy(&b);
+		}
+
+		list_destroy(&a);
+	}
+
 	if (errors)
-		printf("%d/176 tests failed\n", errors);
+		printf("%d/192 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -37,6 +37,7 @@ typedef int list_cmp_t(const void *a, const void *b);
 typedef void list_action_t(void *item, size_t *index, void *data);
 typedef void *list_map_t(void *item, size_t *index, void *data);
 typedef int list_query_t(void *item, size_t *index, void *data);
+typedef size_t list_hash_t(size_t table_size, const void *item);
 
 _begin_decls
 List *list_create(list_release_t *destroy);
@@ -47,6 +48,8 @@ List *list_create_with_locker(Locker *locker, list_release_t *destroy);
 List *list_make_with_locker(Locker *locker, list_release_t *destroy, ...);
 List *list_vmake_with_locker(Locker *locker, list_release_t *destroy, va_list args);
 List *list_copy_with_locker(Locker *locker, const List *src, list_copy_t *copy);
+List *list_adopt(void **items, size_t length, size_t size, list_release_t *destroy);
+List *list_adopt_with_locker(Locker *locker, void **items, size_t length, size_t size, list_release_t *destroy);
 int list_rdlock(const List *list);
 int list_wrlock(const List *list);
 int list_unlock(const List *list);
@@ -56,6 +59,12 @@ int list_own(List *list, list_release_t *destroy);
 int list_own_unlocked(List *list, list_release_t *destroy);
 list_release_t *list_disown(List *list);
 list_release_t *list_disown_unlocked(List *list);
+int list_reserve(List *list, size_t size);
+int list_reserve_unlocked(List *list, size_t size);
+int list_shrink_to_fit(List *list);
+int list_shrink_to_fit_unlocked(List *list);
+int list_set_growth(List *list, int percent);
+int list_set_growth_unlocked(List *list, int percent);
 void *list_item(const List *list, ssize_t index);
 void *list_item_unlocked(const List *list, ssize_t index);
 int list_item_int(const List *list, ssize_t index);
@@ -120,6 +129,28 @@ List *list_splice_with_locker(Locker *locker, List *list, ssize_t index, ssize_t
 List *list_splice_with_locker_unlocked(Locker *locker, List *list, ssize_t index, ssize_t range, list_copy_t *copy);
 List *list_sort(List *list, list_cmp_t *cmp);
 List *list_sort_unlocked(List *list, list_cmp_t *cmp);
+List *list_reverse(List *list);
+List *list_reverse_unlocked(List *list);
+List *list_rotate(List *list, ssize_t count);
+List *list_rotate_unlocked(List *list, ssize_t count);
+List *list_retain(List *list, list_query_t *query, void *data);
+List *list_retain_unlocked(List *list, list_query_t *query, void *data);
+ssize_t list_partition(List *list, list_query_t *query, void *data);
+ssize_t list_partition_unlocked(List *list, list_query_t *query, void *data);
+List *list_unique(List *list, list_cmp_t *cmp);
+List *list_unique_unlocked(List *list, list_cmp_t *cmp);
+List *list_unique_hashed(List *list, list_hash_t *hash, list_cmp_t *cmp);
+List *list_unique_hashed_unlocked(List *list, list_hash_t *hash, list_cmp_t *cmp);
+ssize_t list_bsearch(const List *list, const void *item, list_cmp_t *cmp);
+ssize_t list_bsearch_unlocked(const List *list, const void *item, list_cmp_t *cmp);
+ssize_t list_lower_bound(const List *list, const void *item, list_cmp_t *cmp);
+ssize_t list_lower_bound_unlocked(const List *list, const void *item, list_cmp_t *cmp);
+ssize_t list_upper_bound(const List *list, const void *item, list_cmp_t *cmp);
+ssize_t list_upper_bound_unlocked(const List *list, const void *item, list_cmp_t *cmp);
+List *list_insert_sorted(List *list, void *item, list_cmp_t *cmp);
+List *list_insert_sorted_unlocked(List *list, void *item, list_cmp_t *cmp);
+List *list_merge(List *list, const List *src, list_cmp_t *cmp, list_copy_t *copy);
+List *list_merge_unlocked(List *list, const List *src, list_cmp_t *cmp, list_copy_t *copy);
 void list_apply(List *list, list_action_t *action, void *data);
 void list_apply_rdlocked(List *list, list_action_t *action, void *data);
 void list_apply_wrlocked(List *list, list_action_t *action, void *data);
@@ -153,6 +184,32 @@ int list_next_int(List *list);
 void list_remove_current(List *list);
 _end_decls
 
+/* Don't look below here - optimisations only */
+
+struct List
+{
+	size_t size;             /* number of item slots allocated */
+	size_t length;           /* number of items used */
+	void **list;             /* vector of items (void *) */
+	list_release_t *destroy; /* item destructor, if any */
+	Lister *lister;          /* built-in iterator */
+	Locker *locker;          /* locking strategy for this object */
+	size_t reserve;          /* minimum number of item slots to keep allocated */
+	int growth;              /* percentage to grow by when full */
+};
+
+#if defined(INLINE_ACCESSORS) || defined(NO_LOCKERS)
+#define list_item_unlocked(l, index) (((l) && (size_t)(index) < (l)->length) ? (l)->list[(index)] : (list_item_unlocked)((l), (index)))
+#define list_length_unlocked(l) ((l) ? (ssize_t)(l)->length : (list_length_unlocked)(l))
+#ifdef NO_LOCKERS
+#define list_item(l, index) list_item_unlocked((l), (index))
+#define list_length(l) list_length_unlocked(l)
+#else
+#define list_item(l, index) (((l) && !(l)->locker && (size_t)(index) < (l)->length) ? (l)->list[(index)] : (list_item)((l), (index)))
+#define list_length(l) (((l) && !(l)->locker) ? (ssize_t)(l)->length : (list_length)(l))
+#endif
+#endif
+
 #endif
 
 /* vi:set ts=4 sw=4: */
@@ -37,6 +37,14 @@ I<libslack(locker)> - abstract locking, rwlocks
     Locker *locker_create_rwlock(pthread_rwlock_t *rwlock);
     Locker *locker_create_debug_mutex(pthread_mutex_t *mutex);
     Locker *locker_create_debug_rwlock(pthread_rwlock_t *rwlock);
+    Locker *locker_create_profile(Locker *locker, const char *name);
+    int locker_profile_dump(Locker *locker, FILE *stream);
+    int locker_profile_reset(Locker *locker);
+    Locker *locker_create_spin_mutex(void);
+    Locker *locker_create_ticket_mutex(void);
+    Locker *locker_create_writer_rwlock(void);
+    Locker *locker_create_seqlock(void);
+    Locker *locker_create_brlock(void);
     Locker *locker_create(void *lock, lockerf_t *tryrdlock, lockerf_t *rdlock, lockerf_t *trywrlock, lockerf_t *wrlock, lockerf_t *unlock);
     void locker_release(Locker *locker);
     void *locker_destroy(Locker **locker);
@@ -45,6 +53,8 @@ I<libslack(locker)> - abstract locking, rwlocks
     int locker_trywrlock(Locker *locker);
     int locker_wrlock(Locker *locker);
     int locker_unlock(Locker *locker);
+    int locker_read_begin(Locker *locker, unsigned long *seq);
+    int locker_read_validate(Locker *locker, unsigned long seq);
 
     int pthread_rwlock_init(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr);
     int pthread_rwlock_destroy(pthread_rwlock_t *rwlock);
@@ -120,6 +130,8 @@ and was then completed and made robust.
 #include "mem.h"
 #include "err.h"
 
+#include <sys/time.h>
+
 #ifndef HAVE_PTHREAD_PROCESS_PRIVATE
 #define PTHREAD_PROCESS_PRIVATE 0
 #endif
@@ -149,6 +161,9 @@ struct Locker
 	lockerf_t *trywrlock;
 	lockerf_t *wrlock;
 	lockerf_t *unlock;
+	int (*read_begin)(void *lock, unsigned long *seq);
+	int (*read_validate)(void *lock, unsigned long seq);
+	void (*release)(void *lock);
 };
 #endif
 
@@ -261,81 +276,1771 @@ static int debug_pthread_mutex_lock(pthread_mutex_t *mutex)
 	return debug_invoke("pthread_mutex_lock", (lockerf_t *)pthread_mutex_lock, mutex);
 }
 
-static int debug_pthread_mutex_unlock(pthread_mutex_t *mutex)
-{
-	return debug_invoke("pthread_mutex_unlock", (lockerf_t *)pthread_mutex_unlock, mutex);
+static int debug_pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	return debug_invoke("pthread_mutex_unlock", (lockerf_t *)pthread_mutex_unlock, mutex);
+}
+
+Locker *locker_create_debug_mutex(pthread_mutex_t *mutex)
+{
+	return locker_create
+	(
+		mutex,
+		(lockerf_t *)debug_pthread_mutex_trylock,
+		(lockerf_t *)debug_pthread_mutex_lock,
+		(lockerf_t *)debug_pthread_mutex_trylock,
+		(lockerf_t *)debug_pthread_mutex_lock,
+		(lockerf_t *)debug_pthread_mutex_unlock
+	);
+}
+
+/*
+
+=item C<Locker *locker_create_debug_rwlock(pthread_rwlock_t *rwlock)>
+
+Equivalent to I<locker_create_rwlock(3)> except that debug messages are
+printed to standard output before and after each locking function is called
+to help locate deadlocks. The debug messages look like:
+
+    [thread id] funcname(rwlock address) ...
+    [thread id] funcname(rwlock address) done
+
+On success, returns the new I<Locker>. On error, returns C<null> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+static int debug_pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock)
+{
+	return debug_invoke("pthread_rwlock_tryrdlock", (lockerf_t *)pthread_rwlock_tryrdlock, rwlock);
+}
+
+static int debug_pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+	return debug_invoke("pthread_rwlock_rdlock", (lockerf_t *)pthread_rwlock_rdlock, rwlock);
+}
+
+static int debug_pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock)
+{
+	return debug_invoke("pthread_rwlock_trywrlock", (lockerf_t *)pthread_rwlock_trywrlock, rwlock);
+}
+
+static int debug_pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+	return debug_invoke("pthread_rwlock_wrlock", (lockerf_t *)pthread_rwlock_wrlock, rwlock);
+}
+
+static int debug_pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+	return debug_invoke("pthread_rwlock_unlock", (lockerf_t *)pthread_rwlock_unlock, rwlock);
+}
+
+Locker *locker_create_debug_rwlock(pthread_rwlock_t *rwlock)
+{
+	return locker_create
+	(
+		rwlock,
+		(lockerf_t *)debug_pthread_rwlock_tryrdlock,
+		(lockerf_t *)debug_pthread_rwlock_rdlock,
+		(lockerf_t *)debug_pthread_rwlock_trywrlock,
+		(lockerf_t *)debug_pthread_rwlock_wrlock,
+		(lockerf_t *)debug_pthread_rwlock_unlock
+	);
+}
+
+#endif
+
+#ifndef NO_PROFILE_LOCKERS
+
+#ifndef LOCKER_PROFILE_BUCKETS
+#define LOCKER_PROFILE_BUCKETS 32 /* Histogram buckets (powers of 2 nanoseconds) */
+#endif
+
+#ifndef LOCKER_PROFILE_SITES
+#define LOCKER_PROFILE_SITES 32 /* Call sites tracked per lock */
+#endif
+
+#ifndef LOCKER_PROFILE_TOP
+#define LOCKER_PROFILE_TOP 8 /* Call sites reported per lock */
+#endif
+
+#ifndef LOCKER_PROFILE_HELD
+#define LOCKER_PROFILE_HELD 16 /* Nested locks timed per thread */
+#endif
+
+#ifdef __GNUC__
+#define profile_add(profile, var, n) ((void)__atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED))
+#define profile_return_address() __builtin_return_address(0)
+#else
+#define profile_add(profile, var, n) (pthread_mutex_lock(&(profile)->stats), (var) += (n), pthread_mutex_unlock(&(profile)->stats))
+#define profile_return_address() NULL
+#endif
+
+typedef unsigned long long nsec_t;
+typedef struct LockerProfile LockerProfile;
+typedef struct LockerProfileSite LockerProfileSite;
+typedef struct LockerProfileHeld LockerProfileHeld;
+
+struct LockerProfileSite
+{
+	const void *site;      /* return address of the contended locking call */
+	unsigned long count;   /* number of contended acquisitions from here */
+	nsec_t wait;           /* total time spent waiting from here */
+};
+
+struct LockerProfile
+{
+	Locker *locker;                                 /* the Locker being profiled */
+	char *name;                                     /* name to report */
+	pthread_mutex_t stats;                          /* lock for sites (and counters without atomics) */
+	unsigned long rdlocks;                          /* read lock acquisitions */
+	unsigned long wrlocks;                          /* write lock acquisitions */
+	unsigned long contended;                        /* acquisitions that had to wait */
+	unsigned long tryfails;                         /* failed trylock calls */
+	nsec_t wait;                                    /* total wait time */
+	nsec_t hold;                                    /* total hold time */
+	unsigned long wait_histogram[LOCKER_PROFILE_BUCKETS]; /* wait times */
+	unsigned long hold_histogram[LOCKER_PROFILE_BUCKETS]; /* hold times */
+	LockerProfileSite sites[LOCKER_PROFILE_SITES]; /* contending call sites */
+	unsigned long other_sites;                      /* contended acquisitions from untracked sites */
+};
+
+struct LockerProfileHeld
+{
+	size_t count;                                   /* number of locks held */
+	struct
+	{
+		LockerProfile *profile;                     /* the lock held */
+		nsec_t since;                               /* when it was acquired */
+	}
+	held[LOCKER_PROFILE_HELD];
+};
+
+static pthread_once_t profile_once = PTHREAD_ONCE_INIT;
+static pthread_key_t profile_key;
+static int profile_key_err;
+
+/*
+
+C<static void profile_init(void)>
+
+Creates the thread-specific data key for the locks held by each thread.
+
+*/
+
+static void profile_held_release(void *held)
+{
+	mem_release(held);
+}
+
+static void profile_init(void)
+{
+	profile_key_err = pthread_key_create(&profile_key, profile_held_release);
+}
+
+/*
+
+C<static nsec_t profile_now(void)>
+
+Returns the current (monotonic, if possible) time in nanoseconds.
+
+*/
+
+static nsec_t profile_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts[1];
+
+	if (clock_gettime(CLOCK_MONOTONIC, ts) == 0)
+		return (nsec_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+#endif
+	{
+		struct timeval tv[1];
+
+		gettimeofday(tv, NULL);
+
+		return (nsec_t)tv->tv_sec * 1000000000 + tv->tv_usec * 1000;
+	}
+}
+
+/*
+
+C<static size_t profile_bucket(nsec_t nsec)>
+
+Returns the histogram bucket for the duration C<nsec>. Bucket C<i> counts
+durations less than C<2^i> nanoseconds (and at least C<2^(i-1)>). The last
+bucket counts everything longer.
+
+*/
+
+static size_t profile_bucket(nsec_t nsec)
+{
+	size_t bucket = 0;
+
+	while (nsec && bucket < LOCKER_PROFILE_BUCKETS - 1)
+		nsec >>= 1, ++bucket;
+
+	return bucket;
+}
+
+/*
+
+C<static void profile_acquired(LockerProfile *profile, int write, nsec_t start, int contended, const void *site)>
+
+Records the acquisition of a lock that was requested at C<start>. If the
+lock was C<contended>, the wait time is attributed to C<site>. Also records
+when the calling thread acquired the lock so that I<profile_unlock()> can
+measure how long it was held.
+
+*/
+
+static void profile_acquired(LockerProfile *profile, int write, nsec_t start, int contended, const void *site)
+{
+	LockerProfileHeld *held;
+	nsec_t now = profile_now();
+
+	if (write)
+		profile_add(profile, profile->wrlocks, 1);
+	else
+		profile_add(profile, profile->rdlocks, 1);
+
+	if (contended)
+	{
+		nsec_t wait = now - start;
+		size_t i;
+
+		profile_add(profile, profile->contended, 1);
+		profile_add(profile, profile->wait, wait);
+		profile_add(profile, profile->wait_histogram[profile_bucket(wait)], 1);
+
+		pthread_mutex_lock(&profile->stats);
+
+		for (i = 0; i < LOCKER_PROFILE_SITES; ++i)
+		{
+			if (profile->sites[i].site == site || !profile->sites[i].site)
+			{
+				profile->sites[i].site = site;
+				++profile->sites[i].count;
+				profile->sites[i].wait += wait;
+				break;
+			}
+		}
+
+		if (i == LOCKER_PROFILE_SITES)
+			++profile->other_sites;
+
+		pthread_mutex_unlock(&profile->stats);
+	}
+	else
+		profile_add(profile, profile->wait_histogram[0], 1);
+
+	if (pthread_once(&profile_once, profile_init) || profile_key_err)
+		return;
+
+	if (!(held = pthread_getspecific(profile_key)))
+	{
+		if (!(held = mem_new(LockerProfileHeld)))
+			return;
+
+		held->count = 0;
+
+		if (pthread_setspecific(profile_key, held))
+		{
+			mem_release(held);
+			return;
+		}
+	}
+
+	if (held->count < LOCKER_PROFILE_HELD)
+	{
+		held->held[held->count].profile = profile;
+		held->held[held->count].since = now;
+		++held->count;
+	}
+}
+
+/*
+
+C<static int profile_lock(LockerProfile *profile, int write, const void *site)>
+
+Claims a read or write lock on the lock being profiled. First tries to
+claim it without blocking. If that fails, the acquisition is contended, so
+it blocks and measures how long it waited. On success, returns C<0>. On
+error, returns an error code.
+
+*/
+
+static int profile_lock(LockerProfile *profile, int write, const void *site)
+{
+	nsec_t start = profile_now();
+	int contended = 0;
+	int err;
+
+	if ((err = (write) ? locker_trywrlock(profile->locker) : locker_tryrdlock(profile->locker)))
+	{
+		if (err != EBUSY)
+			return err;
+
+		contended = 1;
+
+		if ((err = (write) ? locker_wrlock(profile->locker) : locker_rdlock(profile->locker)))
+			return err;
+	}
+
+	profile_acquired(profile, write, start, contended, site);
+
+	return 0;
+}
+
+/*
+
+C<static int profile_trylock(LockerProfile *profile, int write)>
+
+Tries to claim a read or write lock on the lock being profiled, counting
+failures. On success, returns C<0>. On error, returns an error code.
+
+*/
+
+static int profile_trylock(LockerProfile *profile, int write)
+{
+	nsec_t start = profile_now();
+	int err;
+
+	if ((err = (write) ? locker_trywrlock(profile->locker) : locker_tryrdlock(profile->locker)))
+	{
+		profile_add(profile, profile->tryfails, 1);
+		return err;
+	}
+
+	profile_acquired(profile, write, start, 0, NULL);
+
+	return 0;
+}
+
+static int profile_tryrdlock(LockerProfile *profile)
+{
+	return profile_trylock(profile, 0);
+}
+
+static int profile_rdlock(LockerProfile *profile)
+{
+	return profile_lock(profile, 0, profile_return_address());
+}
+
+static int profile_trywrlock(LockerProfile *profile)
+{
+	return profile_trylock(profile, 1);
+}
+
+static int profile_wrlock(LockerProfile *profile)
+{
+	return profile_lock(profile, 1, profile_return_address());
+}
+
+/*
+
+C<static int profile_unlock(LockerProfile *profile)>
+
+Unlocks the lock being profiled, recording how long the calling thread held
+it. On success, returns C<0>. On error, returns an error code.
+
+*/
+
+static int profile_unlock(LockerProfile *profile)
+{
+	LockerProfileHeld *held;
+	nsec_t now = profile_now();
+
+	if (!profile_key_err && (held = pthread_getspecific(profile_key)))
+	{
+		size_t i;
+
+		for (i = held->count; i--; )
+		{
+			if (held->held[i].profile == profile)
+			{
+				nsec_t hold = now - held->held[i].since;
+
+				profile_add(profile, profile->hold, hold);
+				profile_add(profile, profile->hold_histogram[profile_bucket(hold)], 1);
+				held->held[i] = held->held[--held->count];
+				break;
+			}
+		}
+	}
+
+	return locker_unlock(profile->locker);
+}
+
+static void profile_release(LockerProfile *profile)
+{
+	pthread_mutex_destroy(&profile->stats);
+	mem_release(profile->name);
+	mem_release(profile);
+}
+
+/*
+
+=item C<Locker *locker_create_profile(Locker *locker, const char *name)>
+
+Creates a I<Locker> that profiles the use of another I<Locker>, C<locker>,
+for finding the locks that limit scalability under a real load. Each
+locking function calls the corresponding function of C<locker>, and
+records, for each lock: the number of read and write lock acquisitions; the
+number of them that were contended (i.e. the lock wasn't immediately
+available); the number of failed I<locker_tryrdlock(3)> and
+I<locker_trywrlock(3)> calls; histograms of the time spent waiting for, and
+holding, the lock; and the call sites (return addresses) that most often had
+to wait. Contention is detected by first trying to claim the lock without
+blocking, so C<locker> must support that (all of the standard I<Locker>
+types do). C<name> identifies the lock in the output of
+I<locker_profile_dump(3)>. To exclude start-up activity, reset the
+statistics with I<locker_profile_reset(3)> once the program has warmed up.
+It is the caller's responsibility to
+deallocate C<locker> after the new I<Locker> has been released. On success,
+returns the new I<Locker>. On error, returns C<null> with C<errno> set
+appropriately.
+
+Call sites are only recorded when compiled with I<gcc(1)> or I<clang(1)>.
+They can be translated into function names and line numbers with
+I<addr2line(1)> (after subtracting the load address for shared libraries
+and position-independent executables). Since they are the callers of the
+locking functions, they identify the library functions (e.g.
+I<list_append(3)>) that waited for the lock.
+
+=cut
+
+*/
+
+Locker *locker_create_profile(Locker *locker, const char *name)
+{
+	LockerProfile *profile;
+	Locker *profiler;
+	int err;
+
+	if (!locker || !name)
+		return set_errnull(EINVAL);
+
+	if (!(profile = mem_new(LockerProfile))) /* XXX decouple */
+		return NULL;
+
+	memset(profile, 0, sizeof(LockerProfile));
+	profile->locker = locker;
+
+	if (!(profile->name = mem_strdup(name)))
+	{
+		mem_release(profile);
+		return NULL;
+	}
+
+	if ((err = pthread_mutex_init(&profile->stats, NULL)))
+	{
+		mem_release(profile->name);
+		mem_release(profile);
+		return set_errnull(err);
+	}
+
+	if (!(profiler = locker_create
+	(
+		profile,
+		(lockerf_t *)profile_tryrdlock,
+		(lockerf_t *)profile_rdlock,
+		(lockerf_t *)profile_trywrlock,
+		(lockerf_t *)profile_wrlock,
+		(lockerf_t *)profile_unlock
+	)))
+	{
+		profile_release(profile);
+		return NULL;
+	}
+
+	profiler->release = (void (*)(void *))profile_release;
+
+	return profiler;
+}
+
+/*
+
+C<static LockerProfile *profile_of(Locker *locker)>
+
+Returns the profile of C<locker>. If C<locker> wasn't created by
+I<locker_create_profile(3)>, returns C<null> with C<errno> set to C<EINVAL>.
+
+*/
+
+static LockerProfile *profile_of(Locker *locker)
+{
+	if (!locker || locker->unlock != (lockerf_t *)profile_unlock)
+		return set_errnull(EINVAL);
+
+	return (LockerProfile *)locker->lock;
+}
+
+/*
+
+C<static void profile_dump_histogram(FILE *stream, const char *label, const unsigned long *histogram)>
+
+Prints the non-empty buckets of C<histogram> to C<stream>.
+
+*/
+
+static void profile_dump_histogram(FILE *stream, const char *label, const unsigned long *histogram)
+{
+	size_t i;
+
+	fprintf(stream, "  %s:", label);
+
+	for (i = 0; i < LOCKER_PROFILE_BUCKETS; ++i)
+		if (histogram[i])
+			fprintf(stream, " %s%lluns:%lu", (i == LOCKER_PROFILE_BUCKETS - 1) ? ">=" : "<", (i == LOCKER_PROFILE_BUCKETS - 1) ? 1ULL << (i - 1) : 1ULL << i, histogram[i]);
+
+	fprintf(stream, "\n");
+}
+
+/*
+
+=item C<int locker_profile_dump(Locker *locker, FILE *stream)>
+
+Prints the statistics recorded by C<locker> (which must have been created by
+I<locker_create_profile(3)>) to C<stream>. The output looks like:
+
+    locker name: rdlocks 9000 wrlocks 1000 contended 312 (3.1%) tryfails 0
+      wait: total 1713254ns mean 5491ns
+      wait histogram: <1ns:9688 <4096ns:201 <8192ns:96 <16384ns:15
+      hold: total 823456ns mean 82ns
+      hold histogram: <64ns:7213 <128ns:2650 <256ns:137
+      site 0x55d4e1a2b3c4: contended 280 wait 1502312ns
+      site 0x55d4e1a2b4f0: contended 32 wait 210942ns
+
+Wait times of uncontended acquisitions are counted in the first bucket of
+the wait histogram. Sites are listed in decreasing order of total wait time.
+On success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int locker_profile_dump(Locker *locker, FILE *stream)
+{
+	LockerProfile *profile, snapshot[1];
+	unsigned long locks;
+	size_t i, j;
+	int err;
+
+	if (!(profile = profile_of(locker)) || !stream)
+		return set_errno(EINVAL);
+
+	if ((err = pthread_mutex_lock(&profile->stats)))
+		return set_errno(err);
+
+	*snapshot = *profile;
+	pthread_mutex_unlock(&profile->stats);
+
+	locks = snapshot->rdlocks + snapshot->wrlocks;
+
+	fprintf(stream, "locker %s: rdlocks %lu wrlocks %lu contended %lu (%.1f%%) tryfails %lu\n",
+		snapshot->name, snapshot->rdlocks, snapshot->wrlocks, snapshot->contended,
+		(locks) ? 100.0 * snapshot->contended / locks : 0.0, snapshot->tryfails);
+
+	fprintf(stream, "  wait: total %lluns mean %lluns\n", snapshot->wait, (snapshot->contended) ? snapshot->wait / snapshot->contended : 0);
+	profile_dump_histogram(stream, "wait histogram", snapshot->wait_histogram);
+	fprintf(stream, "  hold: total %lluns mean %lluns\n", snapshot->hold, (locks) ? snapshot->hold / locks : 0);
+	profile_dump_histogram(stream, "hold histogram", snapshot->hold_histogram);
+
+	/* Sort the sites by wait time (there aren't many) */
+
+	for (i = 1; i < LOCKER_PROFILE_SITES && snapshot->sites[i].site; ++i)
+	{
+		LockerProfileSite site = snapshot->sites[i];
+
+		for (j = i; j && snapshot->sites[j - 1].wait < site.wait; --j)
+			snapshot->sites[j] = snapshot->sites[j - 1];
+
+		snapshot->sites[j] = site;
+	}
+
+	for (i = 0; i < LOCKER_PROFILE_TOP && i < LOCKER_PROFILE_SITES && snapshot->sites[i].site; ++i)
+		fprintf(stream, "  site %p: contended %lu wait %lluns\n", snapshot->sites[i].site, snapshot->sites[i].count, snapshot->sites[i].wait);
+
+	if (snapshot->other_sites)
+		fprintf(stream, "  other sites: contended %lu\n", snapshot->other_sites);
+
+	return (ferror(stream)) ? -1 : 0;
+}
+
+/*
+
+=item C<int locker_profile_reset(Locker *locker)>
+
+Resets the statistics recorded by C<locker> (which must have been created by
+I<locker_create_profile(3)>) to zero. On success, returns C<0>. On error,
+returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int locker_profile_reset(Locker *locker)
+{
+	LockerProfile *profile;
+	int err;
+
+	if (!(profile = profile_of(locker)))
+		return -1;
+
+	if ((err = pthread_mutex_lock(&profile->stats)))
+		return set_errno(err);
+
+	profile->rdlocks = profile->wrlocks = 0;
+	profile->contended = profile->tryfails = 0;
+	profile->wait = profile->hold = 0;
+	memset(profile->wait_histogram, 0, sizeof profile->wait_histogram);
+	memset(profile->hold_histogram, 0, sizeof profile->hold_histogram);
+	memset(profile->sites, 0, sizeof profile->sites);
+	profile->other_sites = 0;
+
+	pthread_mutex_unlock(&profile->stats);
+
+	return 0;
+}
+
+#endif
+
+#ifdef __GNUC__
+
+#ifndef LOCKER_SPIN_LIMIT
+#define LOCKER_SPIN_LIMIT 100 /* Attempts before parking */
+#endif
+
+#ifndef LOCKER_TICKET_SLOTS
+#define LOCKER_TICKET_SLOTS 8 /* Places to park waiting for a ticket */
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __asm__ __volatile__ ("pause")
+#elif defined(__aarch64__) || defined(__arm__)
+#define cpu_relax() __asm__ __volatile__ ("yield")
+#else
+#define cpu_relax() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+typedef struct Parking Parking;
+typedef struct SpinMutex SpinMutex;
+typedef struct TicketMutex TicketMutex;
+
+struct Parking
+{
+	pthread_mutex_t lock;  /* lock for sleeping */
+	pthread_cond_t cond;   /* signalled when the lock may be available */
+	unsigned int sleepers; /* number of threads sleeping (or about to) */
+};
+
+struct SpinMutex
+{
+	unsigned int locked;   /* 1 if locked, 0 if not */
+	Parking parking[1];    /* where to wait after spinning */
+};
+
+struct TicketMutex
+{
+	unsigned int next;     /* next ticket to issue */
+	unsigned int serving;  /* ticket that holds the lock */
+	Parking parking[LOCKER_TICKET_SLOTS]; /* where to wait after spinning (by ticket) */
+};
+
+/*
+
+C<static int parking_init(Parking *parking)>
+
+Initialises C<parking>. On success, returns C<0>. On error, returns an error
+code.
+
+*/
+
+static int parking_init(Parking *parking)
+{
+	try(pthread_mutex_init(&parking->lock, NULL))
+	try_catch(pthread_cond_init(&parking->cond, NULL), pthread_mutex_destroy(&parking->lock))
+	parking->sleepers = 0;
+
+	return 0;
+}
+
+static void parking_destroy(Parking *parking)
+{
+	pthread_cond_destroy(&parking->cond);
+	pthread_mutex_destroy(&parking->lock);
+}
+
+/*
+
+C<static void parking_wake(Parking *parking, int all)>
+
+Wakes one sleeping thread (or C<all> of them) if there are any. Must be
+called after the lock has been made available so that a thread that is
+about to sleep sees it.
+
+*/
+
+static void parking_wake(Parking *parking, int all)
+{
+	if (!__atomic_load_n(&parking->sleepers, __ATOMIC_SEQ_CST))
+		return;
+
+	pthread_mutex_lock(&parking->lock);
+
+	if (all)
+		pthread_cond_broadcast(&parking->cond);
+	else
+		pthread_cond_signal(&parking->cond);
+
+	pthread_mutex_unlock(&parking->lock);
+}
+
+/*
+
+C<static int spin_mutex_trylock(SpinMutex *spin)>
+
+Tries to claim C<spin> without waiting. On success, returns C<0>. If it is
+already locked, returns C<EBUSY>.
+
+*/
+
+static int spin_mutex_trylock(SpinMutex *spin)
+{
+	unsigned int unlocked = 0;
+
+	if (__atomic_load_n(&spin->locked, __ATOMIC_RELAXED) == 0 &&
+		__atomic_compare_exchange_n(&spin->locked, &unlocked, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return 0;
+
+	return EBUSY;
+}
+
+/*
+
+C<static int spin_mutex_lock(SpinMutex *spin)>
+
+Claims C<spin>. Spins (with exponential backoff) for a while in case the
+lock is only held briefly, and then sleeps until it's available. Returns
+C<0>.
+
+*/
+
+static int spin_mutex_lock(SpinMutex *spin)
+{
+	unsigned int backoff = 1, i;
+	int spins;
+
+	for (spins = 0; spins < LOCKER_SPIN_LIMIT; ++spins)
+	{
+		if (spin_mutex_trylock(spin) == 0)
+			return 0;
+
+		for (i = 0; i < backoff; ++i)
+			cpu_relax();
+
+		if (backoff < 64)
+			backoff <<= 1;
+	}
+
+	pthread_mutex_lock(&spin->parking->lock);
+	__atomic_add_fetch(&spin->parking->sleepers, 1, __ATOMIC_SEQ_CST);
+
+	while (spin_mutex_trylock(spin) != 0)
+		pthread_cond_wait(&spin->parking->cond, &spin->parking->lock);
+
+	__atomic_sub_fetch(&spin->parking->sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&spin->parking->lock);
+
+	return 0;
+}
+
+static int spin_mutex_unlock(SpinMutex *spin)
+{
+	__atomic_store_n(&spin->locked, 0, __ATOMIC_SEQ_CST);
+	parking_wake(spin->parking, 0);
+
+	return 0;
+}
+
+static void spin_mutex_release(SpinMutex *spin)
+{
+	parking_destroy(spin->parking);
+	mem_release(spin);
+}
+
+/*
+
+C<static int ticket_mutex_trylock(TicketMutex *ticket)>
+
+Tries to claim C<ticket> without waiting. This only succeeds when nobody
+holds or is waiting for the lock. On success, returns C<0>. Otherwise,
+returns C<EBUSY>.
+
+*/
+
+static int ticket_mutex_trylock(TicketMutex *ticket)
+{
+	unsigned int serving = __atomic_load_n(&ticket->serving, __ATOMIC_ACQUIRE);
+	unsigned int next = serving;
+
+	if (__atomic_compare_exchange_n(&ticket->next, &next, serving + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return 0;
+
+	return EBUSY;
+}
+
+/*
+
+C<static int ticket_mutex_lock(TicketMutex *ticket)>
+
+Claims C<ticket>. Takes the next ticket and waits for its turn. Threads
+acquire the lock in the order they asked for it. Spins for a while, backing
+off in proportion to the number of threads ahead, and then sleeps until
+its turn. Returns C<0>.
+
+*/
+
+static int ticket_mutex_lock(TicketMutex *ticket)
+{
+	unsigned int mine = __atomic_fetch_add(&ticket->next, 1, __ATOMIC_SEQ_CST);
+	unsigned int serving, i;
+	Parking *parking;
+	int spins;
+
+	for (spins = 0; spins < LOCKER_SPIN_LIMIT; ++spins)
+	{
+		if ((serving = __atomic_load_n(&ticket->serving, __ATOMIC_ACQUIRE)) == mine)
+			return 0;
+
+		for (i = 0; i < (mine - serving) * 16 && i < 1024; ++i)
+			cpu_relax();
+	}
+
+	parking = &ticket->parking[mine % LOCKER_TICKET_SLOTS];
+	pthread_mutex_lock(&parking->lock);
+	__atomic_add_fetch(&parking->sleepers, 1, __ATOMIC_SEQ_CST);
+
+	while (__atomic_load_n(&ticket->serving, __ATOMIC_SEQ_CST) != mine)
+		pthread_cond_wait(&parking->cond, &parking->lock);
+
+	__atomic_sub_fetch(&parking->sleepers, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&parking->lock);
+
+	return 0;
+}
+
+static int ticket_mutex_unlock(TicketMutex *ticket)
+{
+	/* Only the holder changes serving, so no read-modify-write is needed */
+
+	unsigned int serving = ticket->serving + 1;
+
+	__atomic_store_n(&ticket->serving, serving, __ATOMIC_SEQ_CST);
+
+	/* Wake the threads parked for the next ticket (there might be more than one) */
+
+	parking_wake(&ticket->parking[serving % LOCKER_TICKET_SLOTS], 1);
+
+	return 0;
+}
+
+static void ticket_mutex_release(TicketMutex *ticket)
+{
+	int i;
+
+	for (i = 0; i < LOCKER_TICKET_SLOTS; ++i)
+		parking_destroy(&ticket->parking[i]);
+
+	mem_release(ticket);
+}
+
+#endif
+
+/*
+
+=item C<Locker *locker_create_spin_mutex(void)>
+
+Creates a I<Locker> object that will operate on its own adaptive mutex
+lock. This is intended for locks that are only held for very short periods
+(e.g. by the accessor functions of I<list(3)>, I<map(3)> and I<str(3)>
+objects). A thread that finds the lock held spins (with exponential
+backoff) for a while, on the assumption that the lock will soon be
+released, and only then goes to sleep. This avoids the cost of sleeping and
+waking up (and of the associated context switches) in the common case. Read
+locks and write locks are the same (as for I<locker_create_mutex(3)>). The
+lock isn't recursive and isn't fair. The lock is deallocated when the
+I<Locker> is released. On success, returns the new I<Locker>. On error,
+returns C<null> with C<errno> set appropriately. This is only available when
+compiled with I<gcc(1)> or I<clang(1)>. Otherwise, it fails with C<errno>
+set to C<ENOSYS>.
+
+=cut
+
+*/
+
+Locker *locker_create_spin_mutex(void)
+{
+#ifdef __GNUC__
+	SpinMutex *spin;
+	Locker *locker;
+	int err;
+
+	if (!(spin = mem_new(SpinMutex))) /* XXX decouple */
+		return NULL;
+
+	spin->locked = 0;
+
+	if ((err = parking_init(spin->parking)))
+	{
+		mem_release(spin);
+		return set_errnull(err);
+	}
+
+	if (!(locker = locker_create
+	(
+		spin,
+		(lockerf_t *)spin_mutex_trylock,
+		(lockerf_t *)spin_mutex_lock,
+		(lockerf_t *)spin_mutex_trylock,
+		(lockerf_t *)spin_mutex_lock,
+		(lockerf_t *)spin_mutex_unlock
+	)))
+	{
+		spin_mutex_release(spin);
+		return NULL;
+	}
+
+	locker->release = (void (*)(void *))spin_mutex_release;
+
+	return locker;
+#else
+	return set_errnull(ENOSYS);
+#endif
+}
+
+/*
+
+=item C<Locker *locker_create_ticket_mutex(void)>
+
+Creates a I<Locker> object that will operate on its own fair (ticket) mutex
+lock. Threads acquire the lock in the order that they asked for it, so no
+thread can be starved by others that repeatedly reacquire the lock. Like
+I<locker_create_spin_mutex(3)>, waiting threads spin for a while before
+sleeping. I<locker_tryrdlock(3)> and I<locker_trywrlock(3)> only succeed
+when no other thread holds, or is waiting for, the lock. Read locks and write
+locks are the same. The lock isn't recursive. Note that fairness costs
+throughput when there are more threads than CPUs, because the lock can't be
+handed to a thread that is running when the next thread in line isn't. The
+lock is deallocated when the I<Locker> is released. On success, returns the
+new I<Locker>. On error, returns C<null> with C<errno> set appropriately.
+This is only available when compiled with I<gcc(1)> or I<clang(1)>.
+Otherwise, it fails with C<errno> set to C<ENOSYS>.
+
+=cut
+
+*/
+
+Locker *locker_create_ticket_mutex(void)
+{
+#ifdef __GNUC__
+	TicketMutex *ticket;
+	Locker *locker;
+	int err, i;
+
+	if (!(ticket = mem_new(TicketMutex))) /* XXX decouple */
+		return NULL;
+
+	ticket->next = ticket->serving = 0;
+
+	for (i = 0; i < LOCKER_TICKET_SLOTS; ++i)
+	{
+		if ((err = parking_init(&ticket->parking[i])))
+		{
+			while (i--)
+				parking_destroy(&ticket->parking[i]);
+
+			mem_release(ticket);
+			return set_errnull(err);
+		}
+	}
+
+	if (!(locker = locker_create
+	(
+		ticket,
+		(lockerf_t *)ticket_mutex_trylock,
+		(lockerf_t *)ticket_mutex_lock,
+		(lockerf_t *)ticket_mutex_trylock,
+		(lockerf_t *)ticket_mutex_lock,
+		(lockerf_t *)ticket_mutex_unlock
+	)))
+	{
+		ticket_mutex_release(ticket);
+		return NULL;
+	}
+
+	locker->release = (void (*)(void *))ticket_mutex_release;
+
+	return locker;
+#else
+	return set_errnull(ENOSYS);
+#endif
+}
+
+#if defined(HAVE_PTHREAD_RWLOCK) && !defined(HAVE_PTHREAD_RWLOCKATTR_SETKIND_NP)
+
+/*
+** The system's rwlocks might prefer readers, and can't be told not to, so
+** readers pass through a gate that is closed while writers are waiting.
+*/
+
+#define WRITER_RWLOCK_GATE
+
+typedef struct WriterRwlock WriterRwlock;
+
+struct WriterRwlock
+{
+	pthread_rwlock_t rwlock; /* the lock itself */
+	pthread_mutex_t gate;    /* lock for the fields below */
+	pthread_cond_t open;     /* signalled when there are no more writers */
+	int writers;             /* number of writers waiting for or holding the lock */
+	int writing;             /* does a writer hold the lock? */
+};
+
+/*
+
+C<int writer_rwlock_enter(WriterRwlock *lock)>
+
+Counts a writer that wants C<lock>, which closes the gate to new readers.
+On success, returns C<0>. On error, returns an error code.
+
+*/
+
+static int writer_rwlock_enter(WriterRwlock *lock)
+{
+	try(pthread_mutex_lock(&lock->gate))
+	++lock->writers;
+
+	return pthread_mutex_unlock(&lock->gate);
+}
+
+/*
+
+C<int writer_rwlock_leave(WriterRwlock *lock)>
+
+Uncounts a writer that no longer wants C<lock>, and opens the gate to
+readers when it was the last one. On success, returns C<0>. On error,
+returns an error code.
+
+*/
+
+static int writer_rwlock_leave(WriterRwlock *lock)
+{
+	try(pthread_mutex_lock(&lock->gate))
+
+	if (--lock->writers == 0)
+		pthread_cond_broadcast(&lock->open);
+
+	return pthread_mutex_unlock(&lock->gate);
+}
+
+/*
+
+C<int writer_rwlock_rdlock(WriterRwlock *lock)>
+
+Waits until no writers are waiting for (or holding) C<lock>, and then
+claims a read lock. On success, returns C<0>. On error, returns an error
+code.
+
+*/
+
+static int writer_rwlock_rdlock(WriterRwlock *lock)
+{
+	int err = 0;
+
+	try(pthread_mutex_lock(&lock->gate))
+
+	while (lock->writers && !err)
+		err = pthread_cond_wait(&lock->open, &lock->gate);
+
+	pthread_mutex_unlock(&lock->gate);
+
+	return (err) ? err : pthread_rwlock_rdlock(&lock->rwlock);
+}
+
+/*
+
+C<int writer_rwlock_tryrdlock(WriterRwlock *lock)>
+
+Claims a read lock on C<lock> if no writers are waiting for (or holding)
+it. On success, returns C<0>. On error, returns an error code (C<EBUSY> if
+the lock isn't available).
+
+*/
+
+static int writer_rwlock_tryrdlock(WriterRwlock *lock)
+{
+	int writers;
+
+	try(pthread_mutex_lock(&lock->gate))
+	writers = lock->writers;
+	pthread_mutex_unlock(&lock->gate);
+
+	return (writers) ? EBUSY : pthread_rwlock_tryrdlock(&lock->rwlock);
+}
+
+/*
+
+C<int writer_rwlock_wrlock(WriterRwlock *lock)>
+
+Claims a write lock on C<lock>, keeping new readers out while waiting. On
+success, returns C<0>. On error, returns an error code.
+
+*/
+
+static int writer_rwlock_wrlock(WriterRwlock *lock)
+{
+	int err;
+
+	try(writer_rwlock_enter(lock))
+
+	if ((err = pthread_rwlock_wrlock(&lock->rwlock)))
+		return writer_rwlock_leave(lock), err;
+
+	lock->writing = 1;
+
+	return 0;
+}
+
+/*
+
+C<int writer_rwlock_trywrlock(WriterRwlock *lock)>
+
+Claims a write lock on C<lock> if it is available. On success, returns
+C<0>. On error, returns an error code (C<EBUSY> if the lock isn't
+available).
+
+*/
+
+static int writer_rwlock_trywrlock(WriterRwlock *lock)
+{
+	int err;
+
+	try(writer_rwlock_enter(lock))
+
+	if ((err = pthread_rwlock_trywrlock(&lock->rwlock)))
+		return writer_rwlock_leave(lock), err;
+
+	lock->writing = 1;
+
+	return 0;
+}
+
+/*
+
+C<int writer_rwlock_unlock(WriterRwlock *lock)>
+
+Unlocks a read or write lock on C<lock>. Only the writer can see
+C<writing> set, because readers can't hold the lock at the same time. On
+success, returns C<0>. On error, returns an error code.
+
+*/
+
+static int writer_rwlock_unlock(WriterRwlock *lock)
+{
+	if (lock->writing)
+	{
+		lock->writing = 0;
+		try(pthread_rwlock_unlock(&lock->rwlock))
+
+		return writer_rwlock_leave(lock);
+	}
+
+	return pthread_rwlock_unlock(&lock->rwlock);
+}
+
+/*
+
+C<void writer_rwlock_release(WriterRwlock *lock)>
+
+Destroys and deallocates C<lock>.
+
+*/
+
+static void writer_rwlock_release(WriterRwlock *lock)
+{
+	pthread_rwlock_destroy(&lock->rwlock);
+	pthread_cond_destroy(&lock->open);
+	pthread_mutex_destroy(&lock->gate);
+	mem_release(lock);
+}
+
+#else
+
+/*
+
+C<void writer_rwlock_release(pthread_rwlock_t *rwlock)>
+
+Destroys and deallocates C<rwlock>.
+
+*/
+
+static void writer_rwlock_release(pthread_rwlock_t *rwlock)
+{
+	pthread_rwlock_destroy(rwlock);
+	mem_release(rwlock);
+}
+
+#endif
+
+/*
+
+=item C<Locker *locker_create_writer_rwlock(void)>
+
+Creates a I<Locker> object that will operate on its own readers/writer lock
+that prefers writers. When a writer is waiting for the lock, new readers
+wait as well, so a steady stream of readers can't starve writers (which
+they can with the default rwlocks in I<glibc>). With I<glibc>, this uses
+I<pthread_rwlockattr_setkind_np(3)>. On other systems with rwlocks, whose
+preference is unknown, readers first wait at a gate that is closed while
+any writer is waiting for (or holding) the lock, which costs an extra mutex
+lock and unlock per read lock. Without system rwlocks, the implementation
+in this module already prefers writers. Either way, this means that a
+thread that holds a read lock mustn't try to claim another read lock on the
+same I<Locker> (it could deadlock). The lock is deallocated when the
+I<Locker> is released. On success, returns the new I<Locker>. On error,
+returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Locker *locker_create_writer_rwlock(void)
+{
+#ifdef WRITER_RWLOCK_GATE
+	WriterRwlock *lock;
+	Locker *locker;
+	int err;
+
+	if (!(lock = mem_new(WriterRwlock))) /* XXX decouple */
+		return NULL;
+
+	lock->writers = lock->writing = 0;
+
+	if ((err = pthread_rwlock_init(&lock->rwlock, NULL)))
+	{
+		mem_release(lock);
+		return set_errnull(err);
+	}
+
+	if ((err = pthread_mutex_init(&lock->gate, NULL)))
+	{
+		pthread_rwlock_destroy(&lock->rwlock);
+		mem_release(lock);
+		return set_errnull(err);
+	}
+
+	if ((err = pthread_cond_init(&lock->open, NULL)))
+	{
+		pthread_mutex_destroy(&lock->gate);
+		pthread_rwlock_destroy(&lock->rwlock);
+		mem_release(lock);
+		return set_errnull(err);
+	}
+
+	if (!(locker = locker_create
+	(
+		lock,
+		(lockerf_t *)writer_rwlock_tryrdlock,
+		(lockerf_t *)writer_rwlock_rdlock,
+		(lockerf_t *)writer_rwlock_trywrlock,
+		(lockerf_t *)writer_rwlock_wrlock,
+		(lockerf_t *)writer_rwlock_unlock
+	)))
+	{
+		writer_rwlock_release(lock);
+		return NULL;
+	}
+#else
+	pthread_rwlock_t *rwlock;
+	pthread_rwlockattr_t attr;
+	Locker *locker;
+	int err;
+
+	if (!(rwlock = mem_new(pthread_rwlock_t))) /* XXX decouple */
+		return NULL;
+
+	if ((err = pthread_rwlockattr_init(&attr)))
+	{
+		mem_release(rwlock);
+		return set_errnull(err);
+	}
+
+#ifdef HAVE_PTHREAD_RWLOCKATTR_SETKIND_NP
+	if ((err = pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP)))
+	{
+		pthread_rwlockattr_destroy(&attr);
+		mem_release(rwlock);
+		return set_errnull(err);
+	}
+#endif
+
+	err = pthread_rwlock_init(rwlock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	if (err)
+	{
+		mem_release(rwlock);
+		return set_errnull(err);
+	}
+
+	if (!(locker = locker_create_rwlock(rwlock)))
+	{
+		writer_rwlock_release(rwlock);
+		return NULL;
+	}
+#endif
+
+	locker->release = (void (*)(void *))writer_rwlock_release;
+
+	return locker;
+}
+
+#ifdef __GNUC__
+
+typedef struct SeqLock SeqLock;
+
+struct SeqLock
+{
+	unsigned long seq;       /* sequence number (odd while a writer holds the lock) */
+	int writing;             /* does a writer hold the lock? */
+	pthread_rwlock_t rwlock; /* lock for readers that don't read optimistically, and writers */
+};
+
+static int seqlock_tryrdlock(SeqLock *seqlock)
+{
+	return pthread_rwlock_tryrdlock(&seqlock->rwlock);
+}
+
+static int seqlock_rdlock(SeqLock *seqlock)
+{
+	return pthread_rwlock_rdlock(&seqlock->rwlock);
+}
+
+/*
+
+C<static void seqlock_write_begin(SeqLock *seqlock)>
+
+Called once a writer holds C<seqlock>. Makes the sequence number odd so that
+optimistic readers wait, or retry.
+
+*/
+
+static void seqlock_write_begin(SeqLock *seqlock)
+{
+	seqlock->writing = 1;
+	__atomic_store_n(&seqlock->seq, seqlock->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static int seqlock_trywrlock(SeqLock *seqlock)
+{
+	try(pthread_rwlock_trywrlock(&seqlock->rwlock))
+	seqlock_write_begin(seqlock);
+
+	return 0;
+}
+
+static int seqlock_wrlock(SeqLock *seqlock)
+{
+	try(pthread_rwlock_wrlock(&seqlock->rwlock))
+	seqlock_write_begin(seqlock);
+
+	return 0;
+}
+
+/*
+
+C<static int seqlock_unlock(SeqLock *seqlock)>
+
+Unlocks C<seqlock>. When a writer unlocks, the sequence number is made even
+again (and different) so that optimistic readers that overlapped it retry.
+
+*/
+
+static int seqlock_unlock(SeqLock *seqlock)
+{
+	if (seqlock->writing)
+	{
+		seqlock->writing = 0;
+		__atomic_store_n(&seqlock->seq, seqlock->seq + 1, __ATOMIC_RELEASE);
+	}
+
+	return pthread_rwlock_unlock(&seqlock->rwlock);
+}
+
+/*
+
+C<static int seqlock_read_begin(SeqLock *seqlock, unsigned long *seq)>
+
+Starts an optimistic read by storing the current sequence number in
+C<*seq>, first waiting until there is no writer. Returns C<0>.
+
+*/
+
+static int seqlock_read_begin(SeqLock *seqlock, unsigned long *seq)
+{
+	int spins = 0;
+
+	while ((*seq = __atomic_load_n(&seqlock->seq, __ATOMIC_ACQUIRE)) & 1)
+	{
+		if (++spins < LOCKER_SPIN_LIMIT)
+			cpu_relax();
+		else
+			sched_yield();
+	}
+
+	return 0;
+}
+
+/*
+
+C<static int seqlock_read_validate(SeqLock *seqlock, unsigned long seq)>
+
+Ends an optimistic read that started with the sequence number C<seq>.
+Returns C<0> if no writer intervened, or C<EAGAIN> if one did (and the read
+must be retried).
+
+*/
+
+static int seqlock_read_validate(SeqLock *seqlock, unsigned long seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return (__atomic_load_n(&seqlock->seq, __ATOMIC_RELAXED) == seq) ? 0 : EAGAIN;
+}
+
+static void seqlock_release(SeqLock *seqlock)
+{
+	pthread_rwlock_destroy(&seqlock->rwlock);
+	mem_release(seqlock);
+}
+
+#endif
+
+/*
+
+=item C<Locker *locker_create_seqlock(void)>
+
+Creates a I<Locker> object that will operate on its own sequence lock. This
+is intended for objects that are read far more often than they are
+modified. Optimistic readers, that use I<locker_read_begin(3)> and
+I<locker_read_validate(3)>, never write to the lock, so they don't contend
+with each other for its cache line. Instead, they check that no writer
+modified the object while they were reading it, and if one did, they read
+it again. Writers, that use I<locker_wrlock(3)>, are exclusive as usual.
+I<locker_rdlock(3)> and I<locker_tryrdlock(3)> still claim an ordinary read
+lock (using a readers/writer lock) for readers that need a stable view of
+the object (e.g. to follow pointers in it). The functions that read objects
+optimistically are I<list_length(3)>, I<map_size(3)>, I<str_length(3)>, and
+the I<prog(3)> functions that get settings. The lock is deallocated when the
+I<Locker> is released. On success, returns the new I<Locker>. On error,
+returns C<null> with C<errno> set appropriately. This is only available when
+compiled with I<gcc(1)> or I<clang(1)>. Otherwise, it fails with C<errno>
+set to C<ENOSYS>.
+
+=cut
+
+*/
+
+Locker *locker_create_seqlock(void)
+{
+#ifdef __GNUC__
+	SeqLock *seqlock;
+	Locker *locker;
+	int err;
+
+	if (!(seqlock = mem_new(SeqLock))) /* XXX decouple */
+		return NULL;
+
+	seqlock->seq = 0;
+	seqlock->writing = 0;
+
+	if ((err = pthread_rwlock_init(&seqlock->rwlock, NULL)))
+	{
+		mem_release(seqlock);
+		return set_errnull(err);
+	}
+
+	if (!(locker = locker_create
+	(
+		seqlock,
+		(lockerf_t *)seqlock_tryrdlock,
+		(lockerf_t *)seqlock_rdlock,
+		(lockerf_t *)seqlock_trywrlock,
+		(lockerf_t *)seqlock_wrlock,
+		(lockerf_t *)seqlock_unlock
+	)))
+	{
+		seqlock_release(seqlock);
+		return NULL;
+	}
+
+	locker->read_begin = (int (*)(void *, unsigned long *))seqlock_read_begin;
+	locker->read_validate = (int (*)(void *, unsigned long))seqlock_read_validate;
+	locker->release = (void (*)(void *))seqlock_release;
+
+	return locker;
+#else
+	return set_errnull(ENOSYS);
+#endif
+}
+
+#ifdef __GNUC__
+
+#ifndef LOCKER_CACHE_LINE
+#define LOCKER_CACHE_LINE 64 /* Bytes per cache line (to avoid false sharing) */
+#endif
+
+#ifndef LOCKER_BRLOCK_SLOTS
+#define LOCKER_BRLOCK_SLOTS 64 /* Maximum number of reader slots */
+#endif
+
+typedef union BrLockSlot BrLockSlot;
+typedef struct BrLock BrLock;
+
+union BrLockSlot
+{
+	pthread_rwlock_t rwlock; /* the lock for the readers that use this slot */
+	char pad[(sizeof(pthread_rwlock_t) + LOCKER_CACHE_LINE - 1) / LOCKER_CACHE_LINE * LOCKER_CACHE_LINE];
+};
+
+struct BrLock
+{
+	int writing;             /* does a writer hold the lock (i.e. all slots)? */
+	unsigned int slots;      /* number of reader slots (a power of 2) */
+	BrLockSlot *slot;        /* the reader slots (each on its own cache lines) */
+};
+
+static unsigned int brlock_threads = 0;         /* number of threads that have been given a slot index */
+static __thread unsigned int brlock_thread = 0; /* this thread's slot index + 1 (0 if not yet given) */
+
+/*
+
+C<static pthread_rwlock_t *brlock_reader_slot(BrLock *brlock)>
+
+Returns the lock in the reader slot in C<brlock> for the current thread.
+Each thread is given the next index the first time it reads any big reader
+lock, so threads are spread evenly over the slots, and a thread always uses
+the same slot (and so unlocks the slot it locked).
+
+*/
+
+static pthread_rwlock_t *brlock_reader_slot(BrLock *brlock)
+{
+	if (!brlock_thread)
+		brlock_thread = __atomic_add_fetch(&brlock_threads, 1, __ATOMIC_RELAXED);
+
+	return &brlock->slot[(brlock_thread - 1) & (brlock->slots - 1)].rwlock;
+}
+
+static int brlock_tryrdlock(BrLock *brlock)
+{
+	return pthread_rwlock_tryrdlock(brlock_reader_slot(brlock));
+}
+
+static int brlock_rdlock(BrLock *brlock)
+{
+	return pthread_rwlock_rdlock(brlock_reader_slot(brlock));
+}
+
+/*
+
+C<static int brlock_trywrlock(BrLock *brlock)>
+
+Tries to claim every reader slot in C<brlock> for writing without waiting.
+If any of them is busy, the slots already claimed are released again. On
+success, returns C<0>. On error, returns an error code (C<EBUSY> when the
+lock is held).
+
+*/
+
+static int brlock_trywrlock(BrLock *brlock)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < brlock->slots; ++i)
+	{
+		if ((err = pthread_rwlock_trywrlock(&brlock->slot[i].rwlock)))
+		{
+			while (i--)
+				pthread_rwlock_unlock(&brlock->slot[i].rwlock);
+
+			return err;
+		}
+	}
+
+	__atomic_store_n(&brlock->writing, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/*
+
+C<static int brlock_wrlock(BrLock *brlock)>
+
+Claims every reader slot in C<brlock> for writing, always in the same order
+so that concurrent writers can't deadlock. On success, returns C<0>. On
+error, returns an error code.
+
+*/
+
+static int brlock_wrlock(BrLock *brlock)
+{
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < brlock->slots; ++i)
+	{
+		if ((err = pthread_rwlock_wrlock(&brlock->slot[i].rwlock)))
+		{
+			while (i--)
+				pthread_rwlock_unlock(&brlock->slot[i].rwlock);
+
+			return err;
+		}
+	}
+
+	__atomic_store_n(&brlock->writing, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/*
+
+C<static int brlock_unlock(BrLock *brlock)>
+
+Unlocks C<brlock>. A writer releases every slot. A reader releases its own
+slot. A reader can't see C<writing> set because no writer can claim the
+slot that the reader holds.
+
+*/
+
+static int brlock_unlock(BrLock *brlock)
+{
+	unsigned int i;
+
+	if (__atomic_load_n(&brlock->writing, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n(&brlock->writing, 0, __ATOMIC_RELAXED);
+
+		for (i = brlock->slots; i--;)
+			pthread_rwlock_unlock(&brlock->slot[i].rwlock);
+
+		return 0;
+	}
+
+	return pthread_rwlock_unlock(brlock_reader_slot(brlock));
 }
 
-Locker *locker_create_debug_mutex(pthread_mutex_t *mutex)
+static void brlock_release(BrLock *brlock)
 {
-	return locker_create
-	(
-		mutex,
-		(lockerf_t *)debug_pthread_mutex_trylock,
-		(lockerf_t *)debug_pthread_mutex_lock,
-		(lockerf_t *)debug_pthread_mutex_trylock,
-		(lockerf_t *)debug_pthread_mutex_lock,
-		(lockerf_t *)debug_pthread_mutex_unlock
-	);
-}
+	unsigned int i;
 
-/*
+	for (i = 0; i < brlock->slots; ++i)
+		pthread_rwlock_destroy(&brlock->slot[i].rwlock);
 
-=item C<Locker *locker_create_debug_rwlock(pthread_rwlock_t *rwlock)>
+	mem_release(brlock);
+}
 
-Equivalent to I<locker_create_rwlock(3)> except that debug messages are
-printed to standard output before and after each locking function is called
-to help locate deadlocks. The debug messages look like:
+#endif
 
-    [thread id] funcname(rwlock address) ...
-    [thread id] funcname(rwlock address) done
+/*
 
-On success, returns the new I<Locker>. On error, returns C<null> with
-C<errno> set appropriately.
+=item C<Locker *locker_create_brlock(void)>
+
+Creates a I<Locker> object that will operate on its own "big reader" lock.
+This is intended for objects that are read by many threads at once, and
+are rarely modified. With an ordinary readers/writer lock, every reader
+modifies the same lock, so its cache line bounces between all of the CPUs
+that are reading. A big reader lock contains several readers/writer locks
+(one for each online CPU, up to 64), each on its own cache line, and each
+reader thread only claims one of them (the threads are spread evenly over
+them). Writers claim all of them, so writing is much slower than with an
+ordinary readers/writer lock. Note that a thread that holds a read lock
+mustn't try to claim a write lock on the same I<Locker> (it will deadlock).
+The lock is deallocated when the I<Locker> is released. On success, returns
+the new I<Locker>. On error, returns C<null> with C<errno> set
+appropriately. This is only available when compiled with I<gcc(1)> or
+I<clang(1)>. Otherwise, it fails with C<errno> set to C<ENOSYS>.
 
 =cut
 
 */
 
-static int debug_pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock)
+Locker *locker_create_brlock(void)
 {
-	return debug_invoke("pthread_rwlock_tryrdlock", (lockerf_t *)pthread_rwlock_tryrdlock, rwlock);
-}
+#ifdef __GNUC__
+	BrLock *brlock;
+	Locker *locker;
+	unsigned int slots, i;
+	long cpus;
+	int err;
 
-static int debug_pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
-{
-	return debug_invoke("pthread_rwlock_rdlock", (lockerf_t *)pthread_rwlock_rdlock, rwlock);
-}
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
 
-static int debug_pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock)
-{
-	return debug_invoke("pthread_rwlock_trywrlock", (lockerf_t *)pthread_rwlock_trywrlock, rwlock);
-}
+	slots = 1;
 
-static int debug_pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
-{
-	return debug_invoke("pthread_rwlock_wrlock", (lockerf_t *)pthread_rwlock_wrlock, rwlock);
-}
+	while (slots < LOCKER_BRLOCK_SLOTS && slots < cpus)
+		slots <<= 1;
 
-static int debug_pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
-{
-	return debug_invoke("pthread_rwlock_unlock", (lockerf_t *)pthread_rwlock_unlock, rwlock);
-}
+	/* Allocate the slots after the BrLock, aligned to a cache line */
 
-Locker *locker_create_debug_rwlock(pthread_rwlock_t *rwlock)
-{
-	return locker_create
+	if (!(brlock = mem_create(sizeof(BrLock) + (slots + 1) * sizeof(BrLockSlot), char))) /* XXX decouple */
+		return NULL;
+
+	brlock->writing = 0;
+	brlock->slots = slots;
+	brlock->slot = (BrLockSlot *)(((unsigned long)(brlock + 1) + LOCKER_CACHE_LINE - 1) & ~(unsigned long)(LOCKER_CACHE_LINE - 1));
+
+	for (i = 0; i < slots; ++i)
+	{
+		if ((err = pthread_rwlock_init(&brlock->slot[i].rwlock, NULL)))
+		{
+			while (i--)
+				pthread_rwlock_destroy(&brlock->slot[i].rwlock);
+
+			mem_release(brlock);
+			return set_errnull(err);
+		}
+	}
+
+	if (!(locker = locker_create
 	(
-		rwlock,
-		(lockerf_t *)debug_pthread_rwlock_tryrdlock,
-		(lockerf_t *)debug_pthread_rwlock_rdlock,
-		(lockerf_t *)debug_pthread_rwlock_trywrlock,
-		(lockerf_t *)debug_pthread_rwlock_wrlock,
-		(lockerf_t *)debug_pthread_rwlock_unlock
-	);
-}
+		brlock,
+		(lockerf_t *)brlock_tryrdlock,
+		(lockerf_t *)brlock_rdlock,
+		(lockerf_t *)brlock_trywrlock,
+		(lockerf_t *)brlock_wrlock,
+		(lockerf_t *)brlock_unlock
+	)))
+	{
+		brlock_release(brlock);
+		return NULL;
+	}
 
+	locker->release = (void (*)(void *))brlock_release;
+
+	return locker;
+#else
+	return set_errnull(ENOSYS);
 #endif
+}
 
 /*
 
@@ -370,6 +2075,9 @@ Locker *locker_create(void *lock, lockerf_t *tryrdlock, lockerf_t *rdlock, locke
 	locker->trywrlock = trywrlock;
 	locker->wrlock = wrlock;
 	locker->unlock = unlock;
+	locker->read_begin = NULL;
+	locker->read_validate = NULL;
+	locker->release = NULL;
 
 	return locker;
 }
@@ -390,6 +2098,9 @@ void locker_release(Locker *locker)
 	if (!locker)
 		return;
 
+	if (locker->release)
+		locker->release(locker->lock);
+
 	mem_release(locker);
 }
 
@@ -508,6 +2219,64 @@ int (locker_unlock)(Locker *locker)
 	return locker ? locker->unlock(locker->lock) : 0;
 }
 
+/*
+
+=item C<int locker_read_begin(Locker *locker, unsigned long *seq)>
+
+Starts an optimistic read of an object that is synchronised by C<locker>.
+The reader then copies what it needs from the object (without following
+any pointers in it), and calls I<locker_read_validate(3)> with the value
+stored in C<*seq>, repeating the whole read if told to. If C<locker> was
+created by I<locker_create_seqlock(3)>, no lock is claimed. Otherwise, this
+is equivalent to I<locker_rdlock(3)>, so that the same code can be used
+with any I<Locker>. On success, returns C<0>. On error, returns an error
+code.
+
+    unsigned long seq;
+    size_t length;
+    int err;
+
+    do
+    {
+        if ((err = locker_read_begin(locker, &seq)))
+            return set_errno(err);
+
+        length = obj->length;
+    }
+    while ((err = locker_read_validate(locker, seq)) == EAGAIN);
+
+    if (err)
+        return set_errno(err);
+
+=cut
+
+*/
+
+int (locker_read_begin)(Locker *locker, unsigned long *seq)
+{
+	return locker_read_begin(locker, seq);
+}
+
+/*
+
+=item C<int locker_read_validate(Locker *locker, unsigned long seq)>
+
+Ends an optimistic read that was started by I<locker_read_begin(3)>. If
+C<locker> was created by I<locker_create_seqlock(3)>, returns C<0> if the
+object wasn't modified during the read, or C<EAGAIN> if it might have been
+(in which case, the read must be repeated and the data read discarded).
+Otherwise, this is equivalent to I<locker_unlock(3)>. On error, returns an
+error code.
+
+=cut
+
+*/
+
+int (locker_read_validate)(Locker *locker, unsigned long seq)
+{
+	return locker_read_validate(locker, seq);
+}
+
 #ifndef HAVE_PTHREAD_RWLOCK
 
 /*
@@ -1040,17 +2809,12 @@ C<https://raf.org/papers/mt-disciplined.html>
 
 #include <time.h>
 
-#include <slack/list.h>
+#define INLINE_ACCESSORS
 
-struct List                  /* identical to list.c */
-{
-	size_t size;             /* number of item slots allocated */
-	size_t length;           /* number of items used */
-	void **list;             /* vector of items (void *) */
-	list_release_t *destroy; /* item destructor, if any */
-	Lister *lister;          /* built-in iterator */
-	Locker *locker;          /* locking strategy for this object */
-};
+#include <slack/fio.h>
+#include <slack/list.h>
+#include <slack/map.h>
+#include <slack/str.h>
 
 /* Unsafe */
 
@@ -1272,6 +3036,119 @@ ssize_t list_length_test_builtin_locker_1test_cacheaddr(const List *list)
 	return length;
 }
 
+static int hammer_counter;
+
+static void *hammer(void *arg)
+{
+	Locker *locker = (Locker *)arg;
+	int i;
+
+	for (i = 0; i < 10000; ++i)
+	{
+		locker_wrlock(locker);
+		++hammer_counter;
+		locker_unlock(locker);
+	}
+
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	Locker *locker = (Locker *)arg;
+
+	locker_wrlock(locker);
+	++hammer_counter;
+	locker_unlock(locker);
+
+	return NULL;
+}
+
+static struct
+{
+	Locker *locker;
+	volatile long a, b;
+	volatile int done;
+	int torn;
+}
+seq_test;
+
+static void *seq_writer(void *arg)
+{
+	int i;
+
+	for (i = 0; i < 100000; ++i)
+	{
+		locker_wrlock(seq_test.locker);
+		++seq_test.a;
+		++seq_test.b;
+		locker_unlock(seq_test.locker);
+	}
+
+	seq_test.done = 1;
+
+	return NULL;
+}
+
+static void *seq_reader(void *arg)
+{
+	unsigned long seq;
+	long a, b;
+
+	while (!seq_test.done)
+	{
+		do
+		{
+			locker_read_begin(seq_test.locker, &seq);
+			a = seq_test.a;
+			b = seq_test.b;
+		}
+		while (locker_read_validate(seq_test.locker, seq) == EAGAIN);
+
+		if (a != b)
+			++seq_test.torn;
+	}
+
+	return NULL;
+}
+
+static void *brlock_reader(void *arg)
+{
+	Locker *locker = (Locker *)arg;
+	int err;
+
+	if ((err = locker_rdlock(locker)))
+		return (void *)(long)err;
+
+	nap(0, 200000);
+	locker_unlock(locker);
+
+	return NULL;
+}
+
+static int profile_contains(Locker *locker, const char *expected)
+{
+	char buf[BUFSIZ];
+	FILE *stream;
+	size_t bytes;
+
+	if (!(stream = tmpfile()))
+		return 0;
+
+	if (locker_profile_dump(locker, stream) == -1)
+	{
+		fclose(stream);
+		return 0;
+	}
+
+	rewind(stream);
+	bytes = fread(buf, 1, BUFSIZ - 1, stream);
+	buf[bytes] = '\0';
+	fclose(stream);
+
+	return strstr(buf, expected) != NULL;
+}
+
 int main(int ac, char **av)
 {
 	int errors = 0;
@@ -1370,6 +3247,376 @@ int main(int ac, char **av)
 
 	pthread_rwlock_destroy(rwlock);
 
+	/* Test profile lockers */
+
+	if ((errno = pthread_mutex_init(mutex, NULL)))
+		++errors, printf("Test21: failed to perform test: pthread_mutex_init() failed: err = %d\n", errno);
+	else if (!(locker = locker_create_mutex(mutex)))
+		++errors, printf("Test21: locker_create_mutex() failed (%s)\n", strerror(errno));
+	else
+	{
+		Locker *profiler;
+		pthread_t id[4];
+		int i;
+
+		if (!(profiler = locker_create_profile(locker, "test")))
+			++errors, printf("Test22: locker_create_profile() failed (%s)\n", strerror(errno));
+		else
+		{
+			if ((errno = locker_rdlock(profiler)))
+				++errors, printf("Test23: locker_rdlock(profiler) failed (%s)\n", strerror(errno));
+			else
+			{
+				if (locker_trywrlock(profiler) != EBUSY)
+					++errors, printf("Test24: locker_trywrlock(profiler) failed (didn't return EBUSY)\n");
+
+				if ((errno = locker_unlock(profiler)))
+					++errors, printf("Test25: locker_unlock(profiler) failed (%s)\n", strerror(errno));
+			}
+
+			if (!profile_contains(profiler, "locker test: rdlocks 1 wrlocks 0 contended 0 (0.0%) tryfails 1\n"))
+				++errors, printf("Test26: locker_profile_dump() failed (after rdlock and trywrlock)\n");
+
+			for (i = 0; i < 4; ++i)
+				pthread_create(&id[i], NULL, hammer, profiler);
+
+			for (i = 0; i < 4; ++i)
+				pthread_join(id[i], NULL);
+
+			if (hammer_counter != 40000)
+				++errors, printf("Test27: locker_create_profile() failed (counter is %d, not 40000)\n", hammer_counter);
+
+			if (!profile_contains(profiler, "wrlocks 40000 "))
+				++errors, printf("Test28: locker_profile_dump() failed (after 40000 wrlocks)\n");
+
+			if (!profile_contains(profiler, "  hold histogram:"))
+				++errors, printf("Test29: locker_profile_dump() failed (no hold histogram)\n");
+
+			if (locker_profile_reset(profiler) == -1)
+				++errors, printf("Test30: locker_profile_reset() failed (%s)\n", strerror(errno));
+			else if (!profile_contains(profiler, "locker test: rdlocks 0 wrlocks 0 contended 0 (0.0%) tryfails 0\n"))
+				++errors, printf("Test31: locker_profile_reset() failed (stats not reset)\n");
+
+			if (locker_profile_dump(locker, stdout) != -1)
+				++errors, printf("Test32: locker_profile_dump(not a profile locker) failed\n");
+			else if (errno != EINVAL)
+				++errors, printf("Test33: locker_profile_dump(not a profile locker) failed (errno == %s, not %s)\n", strerror(errno), strerror(EINVAL));
+
+			locker_destroy(&profiler);
+		}
+
+		if (locker_create_profile(NULL, "test") != NULL)
+			++errors, printf("Test34: locker_create_profile(null) failed\n");
+		else if (errno != EINVAL)
+			++errors, printf("Test35: locker_create_profile(null) failed (errno == %s, not %s)\n", strerror(errno), strerror(EINVAL));
+
+		locker_destroy(&locker);
+	}
+
+	pthread_mutex_destroy(mutex);
+
+	/* Test spin, ticket and writer-preferring lockers */
+
+	{
+		static struct
+		{
+			const char *name;
+			Locker *(*create)(void);
+		}
+		lockers[3] =
+		{
+			{ "locker_create_spin_mutex", locker_create_spin_mutex },
+			{ "locker_create_ticket_mutex", locker_create_ticket_mutex },
+			{ "locker_create_writer_rwlock", locker_create_writer_rwlock }
+		};
+
+		pthread_t id[4];
+		int i, j;
+
+		for (i = 0; i < 3; ++i)
+		{
+			int test = 36 + i * 10;
+
+			if (!(locker = lockers[i].create()))
+			{
+				++errors, printf("Test%d: %s() failed (%s)\n", test, lockers[i].name, strerror(errno));
+				continue;
+			}
+
+			if ((errno = locker_tryrdlock(locker)))
+				++errors, printf("Test%d: %s: locker_tryrdlock() failed (%s)\n", test + 1, lockers[i].name, strerror(errno));
+			else if ((errno = locker_unlock(locker)))
+				++errors, printf("Test%d: %s: locker_unlock() failed (%s)\n", test + 1, lockers[i].name, strerror(errno));
+
+			if ((errno = locker_rdlock(locker)))
+				++errors, printf("Test%d: %s: locker_rdlock() failed (%s)\n", test + 2, lockers[i].name, strerror(errno));
+			else if ((errno = locker_unlock(locker)))
+				++errors, printf("Test%d: %s: locker_unlock() failed (%s)\n", test + 2, lockers[i].name, strerror(errno));
+
+			if ((errno = locker_trywrlock(locker)))
+				++errors, printf("Test%d: %s: locker_trywrlock() failed (%s)\n", test + 3, lockers[i].name, strerror(errno));
+			else if ((errno = locker_unlock(locker)))
+				++errors, printf("Test%d: %s: locker_unlock() failed (%s)\n", test + 3, lockers[i].name, strerror(errno));
+
+			if ((errno = locker_wrlock(locker)))
+				++errors, printf("Test%d: %s: locker_wrlock() failed (%s)\n", test + 4, lockers[i].name, strerror(errno));
+			else
+			{
+				if (locker_trywrlock(locker) != EBUSY)
+					++errors, printf("Test%d: %s: locker_trywrlock() while locked failed (didn't return EBUSY)\n", test + 5, lockers[i].name);
+
+				if (locker_tryrdlock(locker) != EBUSY)
+					++errors, printf("Test%d: %s: locker_tryrdlock() while locked failed (didn't return EBUSY)\n", test + 6, lockers[i].name);
+
+				if ((errno = locker_unlock(locker)))
+					++errors, printf("Test%d: %s: locker_unlock() failed (%s)\n", test + 7, lockers[i].name, strerror(errno));
+			}
+
+			hammer_counter = 0;
+
+			for (j = 0; j < 4; ++j)
+				pthread_create(&id[j], NULL, hammer, locker);
+
+			for (j = 0; j < 4; ++j)
+				pthread_join(id[j], NULL);
+
+			if (hammer_counter != 40000)
+				++errors, printf("Test%d: %s: mutual exclusion failed (counter is %d, not 40000)\n", test + 8, lockers[i].name, hammer_counter);
+
+			/* Test that a waiting writer blocks new readers */
+
+			if (lockers[i].create == locker_create_writer_rwlock)
+			{
+				if ((errno = locker_rdlock(locker)))
+					++errors, printf("Test%d: %s: locker_rdlock() failed (%s)\n", test + 9, lockers[i].name, strerror(errno));
+				else
+				{
+					hammer_counter = 0;
+					pthread_create(&id[0], NULL, writer, locker);
+
+					for (j = 0; j < 100 && locker_tryrdlock(locker) == 0; ++j)
+					{
+						locker_unlock(locker);
+						nap(0, 10000);
+					}
+
+					if (j == 100)
+						++errors, printf("Test%d: %s: locker_tryrdlock() succeeded while a writer was waiting\n", test + 9, lockers[i].name);
+
+					locker_unlock(locker);
+					pthread_join(id[0], NULL);
+
+					if (hammer_counter != 1)
+						++errors, printf("Test%d: %s: writer failed\n", test + 9, lockers[i].name);
+				}
+			}
+
+			locker_destroy(&locker);
+		}
+	}
+
+	/* Test seqlock lockers */
+
+	if (!(locker = locker_create_seqlock()))
+		++errors, printf("Test66: locker_create_seqlock() failed (%s)\n", strerror(errno));
+	else
+	{
+		unsigned long seq, seq2;
+		pthread_t id[3];
+		List *list;
+
+		if ((errno = locker_read_begin(locker, &seq)))
+			++errors, printf("Test67: locker_read_begin(seqlock) failed (%s)\n", strerror(errno));
+		else if ((errno = locker_read_validate(locker, seq)))
+			++errors, printf("Test68: locker_read_validate(seqlock) failed (%s)\n", strerror(errno));
+
+		if ((errno = locker_read_begin(locker, &seq)))
+			++errors, printf("Test69: locker_read_begin(seqlock) failed (%s)\n", strerror(errno));
+		else
+		{
+			locker_wrlock(locker);
+			locker_unlock(locker);
+
+			if (locker_read_validate(locker, seq) != EAGAIN)
+				++errors, printf("Test70: locker_read_validate(seqlock) failed (didn't return EAGAIN after a write)\n");
+			else if ((errno = locker_read_begin(locker, &seq2)) || seq2 == seq)
+				++errors, printf("Test71: locker_read_begin(seqlock) failed (sequence not advanced)\n");
+		}
+
+		if ((errno = locker_rdlock(locker)))
+			++errors, printf("Test72: locker_rdlock(seqlock) failed (%s)\n", strerror(errno));
+		else
+		{
+			if (locker_trywrlock(locker) != EBUSY)
+				++errors, printf("Test73: locker_trywrlock(seqlock) while read locked failed (didn't return EBUSY)\n");
+
+			if ((errno = locker_unlock(locker)))
+				++errors, printf("Test74: locker_unlock(seqlock) failed (%s)\n", strerror(errno));
+		}
+
+		seq_test.locker = locker;
+		pthread_create(&id[0], NULL, seq_writer, NULL);
+		pthread_create(&id[1], NULL, seq_reader, NULL);
+		pthread_create(&id[2], NULL, seq_reader, NULL);
+		pthread_join(id[0], NULL);
+		pthread_join(id[1], NULL);
+		pthread_join(id[2], NULL);
+
+		if (seq_test.torn || seq_test.a != 100000)
+			++errors, printf("Test75: optimistic reads failed (%d torn reads, a = %ld)\n", seq_test.torn, seq_test.a);
+
+		if (!(list = list_create_with_locker(locker, NULL)))
+			++errors, printf("Test76: list_create_with_locker(seqlock) failed (%s)\n", strerror(errno));
+		else
+		{
+			list_append(list, "a");
+			list_append(list, "b");
+
+			if (list_length(list) != 2)
+				++errors, printf("Test77: list_length(seqlock list) failed (%d, not 2)\n", (int)list_length(list));
+
+			list_release(list);
+		}
+
+		locker_destroy(&locker);
+	}
+
+	{
+		Locker *nolocker = NULL;
+		unsigned long seq = 1;
+
+		if ((errno = locker_read_begin(nolocker, &seq)) || seq != 0)
+			++errors, printf("Test78: locker_read_begin(null) failed (%s)\n", strerror(errno));
+		else if ((errno = locker_read_validate(nolocker, seq)))
+			++errors, printf("Test78: locker_read_validate(null) failed (%s)\n", strerror(errno));
+	}
+
+	/* Test big reader lockers */
+
+	if (!(locker = locker_create_brlock()))
+		++errors, printf("Test79: locker_create_brlock() failed (%s)\n", strerror(errno));
+	else
+	{
+		pthread_t id[4];
+		Map *map;
+		void *ret;
+		int j;
+
+		if ((errno = locker_rdlock(locker)))
+			++errors, printf("Test80: locker_rdlock(brlock) failed (%s)\n", strerror(errno));
+		else
+		{
+			if ((errno = locker_tryrdlock(locker)))
+				++errors, printf("Test81: locker_tryrdlock(brlock) while read locked failed (%s)\n", strerror(errno));
+			else
+				locker_unlock(locker);
+
+			if (locker_trywrlock(locker) != EBUSY)
+				++errors, printf("Test82: locker_trywrlock(brlock) while read locked failed (didn't return EBUSY)\n");
+
+			if ((errno = locker_unlock(locker)))
+				++errors, printf("Test83: locker_unlock(brlock) failed (%s)\n", strerror(errno));
+		}
+
+		if ((errno = locker_wrlock(locker)))
+			++errors, printf("Test84: locker_wrlock(brlock) failed (%s)\n", strerror(errno));
+		else
+		{
+			if (locker_tryrdlock(locker) != EBUSY)
+				++errors, printf("Test85: locker_tryrdlock(brlock) while write locked failed (didn't return EBUSY)\n");
+
+			if ((errno = locker_unlock(locker)))
+				++errors, printf("Test86: locker_unlock(brlock) failed (%s)\n", strerror(errno));
+		}
+
+		/* Readers in other threads (and so other slots) exclude writers */
+
+		for (j = 0; j < 4; ++j)
+			pthread_create(&id[j], NULL, brlock_reader, locker);
+
+		nap(0, 50000);
+
+		if (locker_trywrlock(locker) != EBUSY)
+			++errors, printf("Test87: locker_trywrlock(brlock) while other threads read failed (didn't return EBUSY)\n"), locker_unlock(locker);
+
+		for (j = 0; j < 4; ++j)
+			if (pthread_join(id[j], &ret) || ret)
+				++errors, printf("Test87: locker_rdlock(brlock) in thread %d failed (%s)\n", j, strerror((int)(long)ret));
+
+		hammer_counter = 0;
+
+		for (j = 0; j < 4; ++j)
+			pthread_create(&id[j], NULL, hammer, locker);
+
+		for (j = 0; j < 4; ++j)
+			pthread_join(id[j], NULL);
+
+		if (hammer_counter != 40000)
+			++errors, printf("Test88: brlock: mutual exclusion failed (counter is %d, not 40000)\n", hammer_counter);
+
+		if (!(map = map_create_with_locker(locker, NULL)))
+			++errors, printf("Test89: map_create_with_locker(brlock) failed (%s)\n", strerror(errno));
+		else
+		{
+			if (map_add(map, "key", "value") == -1 || !map_get(map, "key") || strcmp(map_get(map, "key"), "value"))
+				++errors, printf("Test89: map_add/map_get(brlock map) failed\n");
+
+			map_release(map);
+		}
+
+		locker_destroy(&locker);
+	}
+
+	/* Test the inline accessors (INLINE_ACCESSORS is defined above) */
+
+	{
+		pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+		Locker *mutex_locker = locker_create_mutex(&mutex);
+		List *list = list_make(NULL, "a", "b", "c", NULL);
+		List *locked_list = list_create_with_locker(mutex_locker, NULL);
+		Map *map = map_create(NULL);
+		String *str = str_create("%s", "abc");
+		ssize_t i, length = 0;
+
+		for (i = 0; i < list_length(list); ++i)
+			length += strlen(list_item(list, i));
+
+		if (length != 3)
+			++errors, printf("Test90: list_item() (inline) failed (total length %d, not 3)\n", (int)length);
+
+		if (!list_item(list, -2) || strcmp(list_item(list, -2), "c"))
+			++errors, printf("Test91: list_item(-2) (inline) failed\n");
+
+		errno = 0;
+
+		if (list_item(list, 3) || errno != EINVAL)
+			++errors, printf("Test92: list_item(3) (inline) failed (errno %s, not EINVAL)\n", strerror(errno));
+
+		if (list_length_unlocked(list) != 3 || list_item_unlocked(list, 2) != list_item(list, 2))
+			++errors, printf("Test93: list_length_unlocked()/list_item_unlocked() (inline) failed\n");
+
+		if (!locked_list || !list_append(locked_list, "x") || list_length(locked_list) != 1 || strcmp(list_item(locked_list, 0), "x"))
+			++errors, printf("Test94: list_length()/list_item() (inline) with a locker failed\n");
+
+		if (list_length((List *)NULL) != -1 || list_item((List *)NULL, 0) != NULL)
+			++errors, printf("Test95: list_length()/list_item() (inline) on null failed\n");
+
+		if (!map || map_add(map, "k", "v") == -1 || map_size(map) != 1 || map_size_unlocked(map) != 1)
+			++errors, printf("Test96: map_size() (inline) failed\n");
+
+		if (!str || str_length(str) != 3 || str_length_unlocked(str) != 3 || strcmp(cstr(str), "abc"))
+			++errors, printf("Test97: str_length()/cstr() (inline) failed\n");
+
+		if (str_length((String *)NULL) != -1 || cstr((String *)NULL) != NULL)
+			++errors, printf("Test98: str_length()/cstr() (inline) on null failed\n");
+
+		list_release(list);
+		list_release(locked_list);
+		locker_release(mutex_locker);
+		map_release(map);
+		str_release(str);
+	}
+
 	/* Timing tests */
 
 	if (av[1] && !strcmp(av[1], "time"))
@@ -1381,7 +3628,7 @@ int main(int ac, char **av)
 		Locker *mutex_locker;
 		pthread_rwlock_t rwlock;
 		Locker *rwlock_locker;
-		double nm, nf;
+		double nm, nf, ni, nil;
 		double dm, dr;
 		double np, mp, rp, np1, mp1, rp1;
 		double nsl, msl, rsl, nsl1, msl1, rsl1;
@@ -1421,6 +3668,8 @@ int main(int ac, char **av)
 
 		TIME_TEST("nolock/macro", 1, 0.0, nm, length = list_length_test_nolock_macro(list))
 		TIME_TEST("nolock/func", 1, 0.0, nf, length = list_length_test_nolock_func(list))
+		TIME_TEST("nolock/inline unlocked", 0, nm, ni, length = list_length_unlocked(list))
+		TIME_TEST("nolock/inline", 0, nm, nil, length = list_length(list))
 		printf("\n");
 
 		printf(" MT-Safe:\n");
@@ -1475,7 +3724,7 @@ int main(int ac, char **av)
 	}
 
 	if (errors)
-		printf("%d/20 tests failed\n", errors);
+		printf("%d/98 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -22,6 +22,7 @@
 #ifndef LIBSLACK_LOCKER_H
 #define LIBSLACK_LOCKER_H
 
+#include <stdio.h>
 #include <pthread.h>
 
 #include <slack/hdr.h>
@@ -63,6 +64,14 @@ Locker *locker_create_mutex(pthread_mutex_t *mutex);
 Locker *locker_create_rwlock(pthread_rwlock_t *rwlock);
 Locker *locker_create_debug_mutex(pthread_mutex_t *mutex);
 Locker *locker_create_debug_rwlock(pthread_rwlock_t *rwlock);
+Locker *locker_create_profile(Locker *locker, const char *name);
+int locker_profile_dump(Locker *locker, FILE *stream);
+int locker_profile_reset(Locker *locker);
+Locker *locker_create_spin_mutex(void);
+Locker *locker_create_ticket_mutex(void);
+Locker *locker_create_writer_rwlock(void);
+Locker *locker_create_seqlock(void);
+Locker *locker_create_brlock(void);
 Locker *locker_create(void *lock, lockerf_t *tryrdlock, lockerf_t *rdlock, lockerf_t *trywrlock, lockerf_t *wrlock, lockerf_t *unlock);
 void locker_release(Locker *locker);
 void *locker_destroy(Locker **locker);
@@ -71,6 +80,8 @@ int locker_rdlock(Locker *locker);
 int locker_trywrlock(Locker *locker);
 int locker_wrlock(Locker *locker);
 int locker_unlock(Locker *locker);
+int locker_read_begin(Locker *locker, unsigned long *seq);
+int locker_read_validate(Locker *locker, unsigned long seq);
 #ifndef HAVE_PTHREAD_RWLOCK
 int pthread_rwlock_init(pthread_rwlock_t *rwlock, const pthread_rwlockattr_t *attr);
 int pthread_rwlock_destroy(pthread_rwlock_t *rwlock);
@@ -96,6 +107,9 @@ struct Locker
 	lockerf_t *trywrlock;
 	lockerf_t *wrlock;
 	lockerf_t *unlock;
+	int (*read_begin)(void *lock, unsigned long *seq);
+	int (*read_validate)(void *lock, unsigned long seq);
+	void (*release)(void *lock);
 };
 
 #define locker_tryrdlock(locker) ((locker) ? (locker)->tryrdlock((locker)->lock) : 0)
@@ -103,6 +117,8 @@ struct Locker
 #define locker_trywrlock(locker) ((locker) ? (locker)->trywrlock((locker)->lock) : 0)
 #define locker_wrlock(locker)    ((locker) ? (locker)->wrlock((locker)->lock) : 0)
 #define locker_unlock(locker)    ((locker) ? (locker)->unlock((locker)->lock) : 0)
+#define locker_read_begin(locker, seq) ((locker) ? ((locker)->read_begin ? (locker)->read_begin((locker)->lock, (seq)) : (locker)->rdlock((locker)->lock)) : (*(seq) = 0, 0))
+#define locker_read_validate(locker, seq) ((locker) ? ((locker)->read_validate ? (locker)->read_validate((locker)->lock, (seq)) : (locker)->unlock((locker)->lock)) : 0)
 
 #endif
 
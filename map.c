@@ -33,6 +33,7 @@ I<libslack(map)> - map module
     typedef struct Map Map;
     typedef struct Mapper Mapper;
     typedef struct Mapping Mapping;
+    typedef struct MapSnapshot MapSnapshot;
     typedef list_release_t map_release_t;
     typedef list_copy_t map_copy_t;
     typedef list_cmp_t map_cmp_t;
@@ -101,6 +102,15 @@ I<libslack(map)> - map module
     void map_apply_rdlocked(Map *map, map_action_t *action, void *data);
     void map_apply_wrlocked(Map *map, map_action_t *action, void *data);
     void map_apply_unlocked(Map *map, map_action_t *action, void *data);
+    int map_apply_parallel(Map *map, map_action_t *action, void *data, int threads);
+    int map_apply_parallel_unlocked(Map *map, map_action_t *action, void *data, int threads);
+    MapSnapshot *map_snapshot(Map *map);
+    MapSnapshot *map_snapshot_unlocked(Map *map);
+    void map_snapshot_release(MapSnapshot *snapshot);
+    void *map_snapshot_destroy(MapSnapshot **snapshot);
+    ssize_t map_snapshot_size(const MapSnapshot *snapshot);
+    const Mapping *map_snapshot_mapping(const MapSnapshot *snapshot, size_t index);
+    int map_snapshot_apply(const MapSnapshot *snapshot, map_action_t *action, void *data, int threads);
     ssize_t map_size(Map *map);
     ssize_t map_size_unlocked(const Map *map);
 
@@ -137,26 +147,19 @@ size of C<26,214,401> buckets.
 #include "err.h"
 #include "locker.h"
 
-struct Map
-{
-	size_t size;                  /* number of buckets */
-	size_t items;                 /* number of items */
-	List **chain;                 /* array of hash buckets */
-	map_hash_t *hash;             /* hash function */
-	map_copy_t *copy;             /* key copy function */
-	map_cmp_t *cmp;               /* key comparison function */
-	map_release_t *key_destroy;   /* destructor function for keys */
-	map_release_t *value_destroy; /* destructor function for items */
-	Mapper *mapper;               /* built-in iterator */
-	Locker *locker;               /* locking strategy for this object */
-};
-
 struct Mapping
 {
 	void *key;                    /* a map key */
 	void *value;                  /* a map value */
 	map_release_t *key_destroy;   /* destructor function for key */
 	map_release_t *value_destroy; /* destructor function for value */
+	unsigned long refs;           /* references from the map and snapshots */
+};
+
+struct MapSnapshot
+{
+	size_t size;       /* number of mappings */
+	Mapping **mapping; /* the mappings (shared with the map) */
 };
 
 struct Mapper
@@ -248,6 +251,7 @@ static Mapping *mapping_create(void *key, void *value, map_release_t *key_destro
 	mapping->value = value;
 	mapping->key_destroy = key_destroy;
 	mapping->value_destroy = value_destroy;
+	mapping->refs = 1;
 
 	return mapping;
 }
@@ -256,7 +260,9 @@ static Mapping *mapping_create(void *key, void *value, map_release_t *key_destro
 
 C<void mapping_release(Mapping *mapping)>
 
-Releases (deallocates) C<mapping>, destroying its value if necessary.
+Releases (deallocates) C<mapping>, destroying its value if necessary. If
+C<mapping> is still referenced by a snapshot, this just drops a reference,
+and the last reference to go releases it.
 
 */
 
@@ -265,6 +271,9 @@ static void mapping_release(Mapping *mapping)
 	if (!mapping)
 		return;
 
+	if (__atomic_sub_fetch(&mapping->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
 	if (mapping->key_destroy)
 		mapping->key_destroy(mapping->key);
 
@@ -791,18 +800,20 @@ map_release_t *map_disown_unlocked(Map *map)
 C<static int map_resize(Map *map)>
 
 Resizes C<map> to use the next prime in a prebuilt sequence of primes
-between C<11> and C<26,214,401> that is greater than the current size. On
-success, returns C<0>. On error, returns C<-1> with C<errno> set
-appropriately.
+between C<11> and C<26,214,401> that is greater than the current size. The
+existing mappings are moved to the new buckets rather than recreated, so
+keys aren't copied again and snapshots still share them. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately, and
+C<map> is unchanged.
 
 */
 
 static int map_resize(Map *map)
 {
 	size_t size = 0;
-	size_t i;
-	Mapper *mapper;
-	Map *new_map;
+	size_t i, c, h;
+	ssize_t length;
+	List **chain;
 
 	if (!map)
 		return set_errno(EINVAL);
@@ -819,47 +830,65 @@ static int map_resize(Map *map)
 	if (i == num_table_sizes || size == 0)
 		return set_errno(EINVAL);
 
-	if (!(new_map = map_create_generic_sized(size, map->copy, map->cmp, map->hash, map->key_destroy, map->value_destroy)))
+	if (!(chain = mem_create(size, List *)))
 		return -1;
 
-	if (!(mapper = mapper_create_unlocked(map)))
-	{
-		map_release(new_map);
-		return -1;
-	}
+	memset(chain, 0, size * sizeof(List *));
 
-	while (mapper_has_next(mapper) == 1)
+	/* The new chains don't own the mappings until they all have them */
+
+	for (c = 0; c < map->size; ++c)
 	{
-		const Mapping *mapping = mapper_next_mapping(mapper);
+		if (!map->chain[c])
+			continue;
+
+		if ((length = list_length_unlocked(map->chain[c])) == -1)
+			goto failed;
 
-		if (map_add_unlocked(new_map, mapping->key, mapping->value) == -1)
+		for (i = 0; i < length; ++i)
 		{
-			mapper_release_unlocked(mapper);
-			map_release(new_map);
-			return -1;
+			Mapping *mapping = (Mapping *)list_item_unlocked(map->chain[c], i);
+
+			if ((h = map->hash(size, mapping->key)) >= size)
+			{
+				set_errno(EINVAL);
+				goto failed;
+			}
+
+			if (!chain[h] && !(chain[h] = list_create(NULL)))
+				goto failed;
+
+			if (!list_append_unlocked(chain[h], mapping))
+				goto failed;
 		}
 	}
 
-	mapper_release_unlocked(mapper);
+	for (h = 0; h < size; ++h)
+		if (chain[h])
+			list_own_unlocked(chain[h], (list_release_t *)mapping_release);
 
-	errno = 0;
-	if (map_disown_unlocked(map) == NULL && errno)
+	for (c = 0; c < map->size; ++c)
 	{
-		map_release(new_map);
-		return -1;
+		if (map->chain[c])
+		{
+			list_disown_unlocked(map->chain[c]);
+			list_release(map->chain[c]);
+		}
 	}
 
-	for (i = 0; i < map->size; ++i)
-		list_release(map->chain[i]);
 	mem_release(map->chain);
-
-	map->size = new_map->size;
-	map->items = new_map->items;
-	map->chain = new_map->chain;
-	map->value_destroy = new_map->value_destroy;
-	mem_release(new_map);
+	map->chain = chain;
+	map->size = size;
 
 	return 0;
+
+failed:
+	for (h = 0; h < size; ++h)
+		list_release(chain[h]);
+
+	mem_release(chain);
+
+	return -1;
 }
 
 /*
@@ -1001,7 +1030,10 @@ int map_insert_unlocked(Map *map, const void *key, void *value, int replace)
 		if (!map->cmp(mapping->key, key))
 		{
 			if (replace && list_remove_unlocked(chain, c))
+			{
+				--map->items;
 				break;
+			}
 
 			return -1;
 		}
@@ -2005,31 +2037,456 @@ void map_apply_unlocked(Map *map, map_action_t *action, void *data)
 	mapper_release_unlocked(mapper);
 }
 
+#ifndef MAP_APPLY_CHUNK
+#define MAP_APPLY_CHUNK 4096
+#endif
+
+#define MAP_APPLY_THREADS 256
+
+typedef struct MapApply MapApply;
+
+struct MapApply
+{
+	const Map *map;       /* the map whose buckets are visited, or null */
+	Mapping **mapping;    /* the snapshot mappings that are visited, or null */
+	size_t start;         /* the first bucket (or snapshot mapping) */
+	size_t end;           /* one past the last bucket (or snapshot mapping) */
+	map_action_t *action; /* the action to invoke on each mapping */
+	void *data;           /* the action's data */
+};
+
+/*
+
+C<static void *apply_range(void *arg)>
+
+Invokes the action described by C<arg> for each mapping in its range of
+buckets (or snapshot mappings). Runs in its own thread.
+
+*/
+
+static void *apply_range(void *arg)
+{
+	MapApply *range = (MapApply *)arg;
+	ssize_t length;
+	size_t c, i;
+
+	if (range->mapping)
+	{
+		for (i = range->start; i < range->end; ++i)
+			range->action(range->mapping[i]->key, range->mapping[i]->value, range->data);
+
+		return NULL;
+	}
+
+	for (c = range->start; c < range->end; ++c)
+	{
+		List *chain = range->map->chain[c];
+
+		if (!chain || (length = list_length_unlocked(chain)) == -1)
+			continue;
+
+		for (i = 0; i < length; ++i)
+		{
+			Mapping *mapping = (Mapping *)list_item_unlocked(chain, i);
+			range->action(mapping->key, mapping->value, range->data);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+
+C<static void apply_parallel(const Map *map, Mapping **mapping, size_t length, size_t items, map_action_t *action, void *data, int threads)>
+
+Divides the C<length> buckets of C<map> (or the C<length> snapshot
+mappings in C<mapping>), containing C<items> mappings, into equal ranges,
+and invokes C<action> for each mapping, with one range per thread. Uses up
+to C<threads> threads (or one per online processor if C<threads> is zero or
+less), and each thread gets at least C<MAP_APPLY_CHUNK> mappings on
+average. The calling thread handles the first range, and any ranges whose
+threads can't be started.
+
+*/
+
+static void apply_parallel(const Map *map, Mapping **mapping, size_t length, size_t items, map_action_t *action, void *data, int threads)
+{
+	MapApply single[1], *range;
+	pthread_t *thread;
+	int started, i;
+
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (threads > MAP_APPLY_THREADS)
+		threads = MAP_APPLY_THREADS;
+
+	if ((size_t)threads > items / MAP_APPLY_CHUNK)
+		threads = (int)(items / MAP_APPLY_CHUNK);
+
+	if (threads > 1 && !(range = mem_create(threads, MapApply)))
+		threads = 1;
+
+	if (threads <= 1)
+	{
+		single->map = map;
+		single->mapping = mapping;
+		single->start = 0;
+		single->end = length;
+		single->action = action;
+		single->data = data;
+		apply_range(single);
+		return;
+	}
+
+	if (!(thread = mem_create(threads, pthread_t)))
+	{
+		mem_release(range);
+		apply_parallel(map, mapping, length, items, action, data, 1);
+		return;
+	}
+
+	for (i = 0; i < threads; ++i)
+	{
+		range[i].map = map;
+		range[i].mapping = mapping;
+		range[i].start = length * i / threads;
+		range[i].end = length * (i + 1) / threads;
+		range[i].action = action;
+		range[i].data = data;
+	}
+
+	for (started = 1; started < threads; ++started)
+		if (pthread_create(thread + started, NULL, apply_range, range + started))
+			break;
+
+	apply_range(range);
+
+	for (i = started; i < threads; ++i)
+		apply_range(range + i);
+
+	for (i = 1; i < started; ++i)
+		pthread_join(thread[i], NULL);
+
+	mem_release(thread);
+	mem_release(range);
+}
+
+/*
+
+=item C<int map_apply_parallel(Map *map, map_action_t *action, void *data, int threads)>
+
+Equivalent to I<map_apply_rdlocked(3)> except that the buckets of C<map>
+are divided into equal ranges that are processed by up to C<threads>
+threads at once (or one per online processor if C<threads> is zero or
+less). Small maps aren't divided. C<action> is invoked concurrently, so it
+must be thread safe, and it must not modify C<map>. The order in which the
+mappings are visited is unspecified. C<map> is read-locked for the
+duration, but for a much shorter time than by I<map_apply_rdlocked(3)>. To
+let writers proceed during the traversal, use I<map_snapshot(3)> and
+I<map_snapshot_apply(3)> instead. On success, returns C<0>. On error,
+returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int map_apply_parallel(Map *map, map_action_t *action, void *data, int threads)
+{
+	int ret;
+	int err;
+
+	if (!map || !action)
+		return set_errno(EINVAL);
+
+	if ((err = map_rdlock(map)))
+		return set_errno(err);
+
+	ret = map_apply_parallel_unlocked(map, action, data, threads);
+
+	if ((err = map_unlock(map)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int map_apply_parallel_unlocked(Map *map, map_action_t *action, void *data, int threads)>
+
+Equivalent to I<map_apply_parallel(3)> except that C<map> is not
+read-locked.
+
+=cut
+
+*/
+
+int map_apply_parallel_unlocked(Map *map, map_action_t *action, void *data, int threads)
+{
+	if (!map || !action)
+		return set_errno(EINVAL);
+
+	apply_parallel(map, NULL, map->size, map->items, action, data, threads);
+
+	return 0;
+}
+
+/*
+
+=item C<MapSnapshot *map_snapshot(Map *map)>
+
+Creates a snapshot of the mappings in C<map>: a read-only view of C<map>'s
+contents at the time of the call that can be traversed (e.g. with
+I<map_snapshot_mapping(3)> or I<map_snapshot_apply(3)>) without locking
+C<map>, while other threads continue to modify it. C<map> is only
+read-locked while the snapshot records a reference to each mapping, which
+takes much less time than traversing C<map> while locked. The mappings are
+shared with C<map>, not copied, and they are reference counted, so mappings
+that are removed from (or replaced in) C<map> remain valid until the
+snapshot is released. Their values are destroyed (if C<map> owns them) when
+the last reference goes, which might be when the snapshot is released, by
+the thread that releases it. Note that the values themselves are shared, so
+changes made to them through C<map> are visible in the snapshot. It is the
+caller's responsibility to deallocate the snapshot with
+I<map_snapshot_release(3)> or I<map_snapshot_destroy(3)>. On success,
+returns the snapshot. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+MapSnapshot *map_snapshot(Map *map)
+{
+	MapSnapshot *ret;
+	int err;
+
+	if (!map)
+		return set_errnull(EINVAL);
+
+	if ((err = map_rdlock(map)))
+		return set_errnull(err);
+
+	ret = map_snapshot_unlocked(map);
+
+	if ((err = map_unlock(map)))
+	{
+		map_snapshot_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<MapSnapshot *map_snapshot_unlocked(Map *map)>
+
+Equivalent to I<map_snapshot(3)> except that C<map> is not read-locked.
+
+=cut
+
+*/
+
+MapSnapshot *map_snapshot_unlocked(Map *map)
+{
+	MapSnapshot *snapshot;
+	ssize_t length;
+	size_t c, i;
+
+	if (!map)
+		return set_errnull(EINVAL);
+
+	if (!(snapshot = mem_new(MapSnapshot))) /* XXX decouple */
+		return NULL;
+
+	if (!(snapshot->mapping = mem_create(map->items ? map->items : 1, Mapping *)))
+	{
+		mem_release(snapshot);
+		return NULL;
+	}
+
+	snapshot->size = 0;
+
+	for (c = 0; c < map->size; ++c)
+	{
+		List *chain = map->chain[c];
+
+		if (!chain || (length = list_length_unlocked(chain)) == -1)
+			continue;
+
+		for (i = 0; i < length && snapshot->size < map->items; ++i)
+		{
+			Mapping *mapping = (Mapping *)list_item_unlocked(chain, i);
+
+			__atomic_add_fetch(&mapping->refs, 1, __ATOMIC_RELAXED);
+			snapshot->mapping[snapshot->size++] = mapping;
+		}
+	}
+
+	return snapshot;
+}
+
+/*
+
+=item C<void map_snapshot_release(MapSnapshot *snapshot)>
+
+Releases (deallocates) C<snapshot>, and its references to the mappings of
+the map it was taken from. Any mappings that were removed from the map
+since the snapshot was taken (and aren't in other snapshots) are released,
+destroying their values if necessary.
+
+=cut
+
+*/
+
+void map_snapshot_release(MapSnapshot *snapshot)
+{
+	size_t i;
+
+	if (!snapshot)
+		return;
+
+	for (i = 0; i < snapshot->size; ++i)
+		mapping_release(snapshot->mapping[i]);
+
+	mem_release(snapshot->mapping);
+	mem_release(snapshot);
+}
+
+/*
+
+=item C<void *map_snapshot_destroy(MapSnapshot **snapshot)>
+
+Destroys (deallocates and sets to C<null>) C<*snapshot>. Returns C<null>.
+
+=cut
+
+*/
+
+void *map_snapshot_destroy(MapSnapshot **snapshot)
+{
+	if (snapshot && *snapshot)
+	{
+		map_snapshot_release(*snapshot);
+		*snapshot = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<ssize_t map_snapshot_size(const MapSnapshot *snapshot)>
+
+Returns the number of mappings in C<snapshot>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t map_snapshot_size(const MapSnapshot *snapshot)
+{
+	if (!snapshot)
+		return set_errno(EINVAL);
+
+	return snapshot->size;
+}
+
+/*
+
+=item C<const Mapping *map_snapshot_mapping(const MapSnapshot *snapshot, size_t index)>
+
+Returns the mapping at position C<index> in C<snapshot> (in no particular
+order), for use with I<mapping_key(3)> and I<mapping_value(3)>. The mapping
+remains valid until C<snapshot> is released. No locking is needed. On
+error, returns C<null> with C<errno> set appropriately.
+
+    MapSnapshot *snapshot = map_snapshot(map);
+    size_t i;
+
+    for (i = 0; i < map_snapshot_size(snapshot); ++i)
+    {
+        const Mapping *mapping = map_snapshot_mapping(snapshot, i);
+        printf("%s=%s\n", (char *)mapping_key(mapping), (char *)mapping_value(mapping));
+    }
+
+    map_snapshot_destroy(&snapshot);
+
+=cut
+
+*/
+
+const Mapping *map_snapshot_mapping(const MapSnapshot *snapshot, size_t index)
+{
+	if (!snapshot || index >= snapshot->size)
+		return set_errnull(EINVAL);
+
+	return snapshot->mapping[index];
+}
+
+/*
+
+=item C<int map_snapshot_apply(const MapSnapshot *snapshot, map_action_t *action, void *data, int threads)>
+
+Invokes C<action> for each mapping in C<snapshot>, dividing them into equal
+ranges that are processed by up to C<threads> threads at once (or one per
+online processor if C<threads> is zero or less). Small snapshots aren't
+divided, and C<threads> may be C<1> to process them all in the calling
+thread. The arguments passed to C<action> are the key, the item, and
+C<data>. If C<action> is invoked by multiple threads at once, it must be
+thread safe. Nothing is locked, so the map the snapshot was taken from can
+be modified by other threads at the same time. On success, returns C<0>.
+On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int map_snapshot_apply(const MapSnapshot *snapshot, map_action_t *action, void *data, int threads)
+{
+	if (!snapshot || !action)
+		return set_errno(EINVAL);
+
+	if (snapshot->size)
+		apply_parallel(NULL, snapshot->mapping, snapshot->size, snapshot->size, action, data, threads);
+
+	return 0;
+}
+
 /*
 
 =item C<ssize_t map_size(Map *map)>
 
 Returns the number of mappings in C<map>. On error, returns C<-1> with
-C<errno> set appropriately.
+C<errno> set appropriately. If C<map>'s I<Locker> was created by
+I<locker_create_seqlock(3)>, this is an optimistic read (see
+I<locker_read_begin(3)>).
 
 =cut
 
 */
 
-ssize_t map_size(Map *map)
+ssize_t (map_size)(Map *map)
 {
+	unsigned long seq;
 	size_t size;
 	int err;
 
 	if (!map)
 		return set_errno(EINVAL);
 
-	if ((err = map_rdlock(map)))
-		return set_errno(err);
+	do
+	{
+		if ((err = locker_read_begin(map->locker, &seq)))
+			return set_errno(err);
 
-	size = map->items;
+		size = map->items;
+	}
+	while ((err = locker_read_validate(map->locker, seq)) == EAGAIN);
 
-	if ((err = map_unlock(map)))
+	if (err)
 		return set_errno(err);
 
 	return size;
@@ -2045,7 +2502,7 @@ Equivalent to I<map_size(3)> except that C<map> is not read-locked.
 
 */
 
-ssize_t map_size_unlocked(const Map *map)
+ssize_t (map_size_unlocked)(const Map *map)
 {
 	if (!map)
 		return set_errno(EINVAL);
@@ -2108,6 +2565,15 @@ for each application on a case by case basis.
 I<MT-Disciplined> means that the application developer has a mechanism for
 specifying the synchronisation requirements to be applied to library code.
 
+When client code is compiled with C<INLINE_ACCESSORS> defined,
+I<map_size_unlocked(3)> becomes a macro that accesses the I<Map> directly,
+and I<map_size(3)> becomes a macro that does the same when the I<Map> has no
+I<Locker> (and calls the function otherwise). When client code is compiled
+with C<NO_LOCKERS> defined (i.e. none of its I<Map>s have a I<Locker>),
+I<map_size(3)> doesn't even check for a I<Locker>. Note that the macros
+evaluate their arguments more than once, so the arguments mustn't have side
+effects.
+
 =head1 EXAMPLES
 
 Create a map that doesn't own its items, populate it, and then iterate over
@@ -2487,6 +2953,26 @@ static size_t direct_hash(size_t size, int key)
 	return key % size;
 }
 
+static void sum_action(int key, int value, long *sum)
+{
+	__atomic_add_fetch(sum, value, __ATOMIC_RELAXED);
+}
+
+static void *snapshot_writer(void *arg)
+{
+	Map *map = (Map *)arg;
+	char key[32];
+	int i;
+
+	for (i = 0; i < 1000; ++i)
+	{
+		snprintf(key, sizeof key, "key%d", i);
+		map_put(map, key, mem_strdup("replaced"));
+	}
+
+	return NULL;
+}
+
 #define RD 0
 #define WR 1
 Map *mtmap = NULL;
@@ -3140,6 +3626,130 @@ int main(int ac, char **av)
 		map_destroy(&map);
 	}
 
+	/* Test map_snapshot: the snapshot stays valid while the map changes */
+
+	TEST_ACT(224, locker = locker_create_mutex(&mutex))
+	TEST_ACT(224, map = map_create_with_locker(locker, free))
+	else
+	{
+		MapSnapshot *snapshot;
+		char key[32];
+		int i, ok;
+
+		for (i = 0; i < 1000; ++i)
+		{
+			snprintf(key, sizeof key, "key%d", i);
+			map_add(map, key, mem_strdup(key));
+		}
+
+		TEST_ACT(224, snapshot = map_snapshot(map))
+		else
+		{
+			pthread_t writer;
+
+			TEST_EQ(224, (int)map_snapshot_size(snapshot), 1000)
+
+			/* Replace every value and grow the map while the snapshot is read */
+
+			pthread_create(&writer, NULL, snapshot_writer, map);
+
+			for (i = 0; i < 10000; ++i)
+			{
+				snprintf(key, sizeof key, "new%d", i);
+				map_add(map, key, mem_strdup(key));
+			}
+
+			pthread_join(writer, NULL);
+
+			for (i = 0, ok = 1; i < map_snapshot_size(snapshot); ++i)
+			{
+				const Mapping *mapping = map_snapshot_mapping(snapshot, i);
+
+				if (!mapping || strcmp(mapping_key(mapping), mapping_value(mapping)))
+					ok = 0;
+			}
+
+			TEST_ACT(224, ok)
+			TEST_EQ(224, (int)map_size(map), 11000)
+			CHECK_ITEM(224, map_get(map, "key7"), "key7", "replaced")
+			CHECK_ITEM(224, map_get(map, "new7"), "new7", "new7")
+			TEST_ACT(224, !map_snapshot_mapping(snapshot, 1000))
+			map_snapshot_destroy(&snapshot);
+			TEST_ACT(224, !snapshot)
+		}
+
+		TEST_ACT(225, snapshot = map_snapshot(map))
+		TEST_EQ(225, (int)map_snapshot_size(snapshot), 11000)
+		map_destroy(&map);
+		TEST_ACT(225, !strcmp(mapping_value(map_snapshot_mapping(snapshot, 0)), "replaced") || !strncmp(mapping_value(map_snapshot_mapping(snapshot, 0)), "new", 3))
+		map_snapshot_destroy(&snapshot);
+	}
+
+	locker_destroy(&locker);
+
+	TEST_ACT(225, map = map_create(NULL))
+	else
+	{
+		MapSnapshot *snapshot;
+		long sum = 0;
+
+		TEST_ACT(225, snapshot = map_snapshot(map))
+		TEST_EQ(225, (int)map_snapshot_size(snapshot), 0)
+		TEST_ACT(225, !map_snapshot_mapping(snapshot, 0))
+		TEST_EQ(225, map_snapshot_apply(snapshot, (map_action_t *)sum_action, &sum, 0), 0)
+		TEST_ACT(225, sum == 0)
+		map_snapshot_destroy(&snapshot);
+		map_destroy(&map);
+	}
+
+	/* Test map_snapshot_apply, map_apply_parallel */
+
+	TEST_ACT(226, map = map_create_generic((map_copy_t *)direct_copy, (map_cmp_t *)direct_cmp, (map_hash_t *)direct_hash, NULL, NULL))
+	else
+	{
+		MapSnapshot *snapshot;
+		long sum, expected = 0;
+		int i, threads;
+
+		for (i = 1; i <= 100000; ++i)
+		{
+			map_add(map, (void *)(long)i, (void *)(long)(i % 1000));
+			expected += i % 1000;
+		}
+
+		TEST_ACT(226, snapshot = map_snapshot(map))
+		else
+		{
+			for (threads = 0; threads <= 8; threads += 4)
+			{
+				sum = 0;
+				TEST_EQ(226, map_snapshot_apply(snapshot, (map_action_t *)sum_action, &sum, threads), 0)
+				TEST_ACT(226, sum == expected)
+			}
+
+			map_snapshot_destroy(&snapshot);
+		}
+
+		for (threads = 0; threads <= 8; threads += 4)
+		{
+			sum = 0;
+			TEST_EQ(227, map_apply_parallel(map, (map_action_t *)sum_action, &sum, threads), 0)
+			TEST_ACT(227, sum == expected)
+		}
+
+		sum = 0;
+		TEST_EQ(227, map_apply_parallel(map, (map_action_t *)sum_action, &sum, 1), 0)
+		TEST_ACT(227, sum == expected)
+		map_destroy(&map);
+	}
+
+	TEST_ACT(228, !map_snapshot(NULL))
+	TEST_EQ(228, (int)map_snapshot_size(NULL), -1)
+	TEST_ACT(228, !map_snapshot_mapping(NULL, 0))
+	TEST_EQ(228, map_snapshot_apply(NULL, (map_action_t *)sum_action, NULL, 1), -1)
+	TEST_EQ(228, map_apply_parallel(NULL, (map_action_t *)sum_action, NULL, 1), -1)
+	TEST_EQ(228, map_apply_parallel_unlocked(NULL, (map_action_t *)sum_action, NULL, 1), -1)
+
 	/* Test MT Safety */
 
 	debug = ac == 2 && !strcmp(av[1], "debug");
@@ -3189,7 +3799,7 @@ int main(int ac, char **av)
 		++errors, printf("Test223: assumption failed: memset(&ptr, 0, sizeof(void *)) not same as NULL\n");
 
 	if (errors)
-		printf("%d/223 tests failed\n", errors);
+		printf("%d/228 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -29,6 +29,7 @@
 typedef struct Map Map;
 typedef struct Mapper Mapper;
 typedef struct Mapping Mapping;
+typedef struct MapSnapshot MapSnapshot;
 typedef list_release_t map_release_t;
 typedef list_copy_t map_copy_t;
 typedef list_cmp_t map_cmp_t;
@@ -98,10 +99,44 @@ void map_apply(Map *map, map_action_t *action, void *data);
 void map_apply_rdlocked(Map *map, map_action_t *action, void *data);
 void map_apply_wrlocked(Map *map, map_action_t *action, void *data);
 void map_apply_unlocked(Map *map, map_action_t *action, void *data);
+int map_apply_parallel(Map *map, map_action_t *action, void *data, int threads);
+int map_apply_parallel_unlocked(Map *map, map_action_t *action, void *data, int threads);
+MapSnapshot *map_snapshot(Map *map);
+MapSnapshot *map_snapshot_unlocked(Map *map);
+void map_snapshot_release(MapSnapshot *snapshot);
+void *map_snapshot_destroy(MapSnapshot **snapshot);
+ssize_t map_snapshot_size(const MapSnapshot *snapshot);
+const Mapping *map_snapshot_mapping(const MapSnapshot *snapshot, size_t index);
+int map_snapshot_apply(const MapSnapshot *snapshot, map_action_t *action, void *data, int threads);
 ssize_t map_size(Map *map);
 ssize_t map_size_unlocked(const Map *map);
 _end_decls
 
+/* Don't look below here - optimisations only */
+
+struct Map
+{
+	size_t size;                  /* number of buckets */
+	size_t items;                 /* number of items */
+	List **chain;                 /* array of hash buckets */
+	map_hash_t *hash;             /* hash function */
+	map_copy_t *copy;             /* key copy function */
+	map_cmp_t *cmp;               /* key comparison function */
+	map_release_t *key_destroy;   /* destructor function for keys */
+	map_release_t *value_destroy; /* destructor function for items */
+	Mapper *mapper;               /* built-in iterator */
+	Locker *locker;               /* locking strategy for this object */
+};
+
+#if defined(INLINE_ACCESSORS) || defined(NO_LOCKERS)
+#define map_size_unlocked(map) ((map) ? (ssize_t)(map)->items : (map_size_unlocked)(map))
+#ifdef NO_LOCKERS
+#define map_size(map) map_size_unlocked(map)
+#else
+#define map_size(map) (((map) && !(map)->locker) ? (ssize_t)(map)->items : (map_size)(map))
+#endif
+#endif
+
 #endif
 
 /* vi:set ts=4 sw=4: */
@@ -268,7 +268,6 @@ C<null> with C<errno> set appropriately.
 
 */
 
-#define RDLOCK(ret) { int rc; if ((rc = locker_rdlock(g.locker))) { set_errno(rc); return (ret); } }
 #define WRLOCK(ret) { int rc; if ((rc = locker_wrlock(g.locker))) { set_errno(rc); return (ret); } }
 #define UNLOCK(ret) { int rc; if ((rc = locker_unlock(g.locker))) { set_errno(rc); return (ret); } }
 
@@ -300,19 +299,23 @@ C<null> with C<errno> set appropriately.
 	UNLOCK(-1) \
 	return prev
 
-#define PROG_GET_PTR_AND_RETURN(name) \
-	void *value; \
-	RDLOCK(NULL) \
-	value = (void *)name; \
-	UNLOCK(NULL) \
+#define PROG_GET_AND_RETURN(type, name, ret) \
+	unsigned long seq; \
+	type value; \
+	int rc; \
+	do \
+	{ \
+		if ((rc = locker_read_begin(g.locker, &seq))) \
+			{ set_errno(rc); return (ret); } \
+		value = (type)name; \
+	} \
+	while ((rc = locker_read_validate(g.locker, seq)) == EAGAIN); \
+	if (rc) \
+		{ set_errno(rc); return (ret); } \
 	return value
 
-#define PROG_GET_INT_AND_RETURN(name) \
-	int value; \
-	RDLOCK(0) \
-	value = name; \
-	UNLOCK(0) \
-	return value
+#define PROG_GET_PTR_AND_RETURN(name) PROG_GET_AND_RETURN(void *, name, NULL)
+#define PROG_GET_INT_AND_RETURN(name) PROG_GET_AND_RETURN(int, name, 0)
 
 const char *prog_set_name(const char *name)
 {
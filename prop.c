@@ -653,11 +653,57 @@ const char *prop_set(const char *name, const char *value)
 
 /*
 
+C<static int prop_parse_int(const char *prop, int *val)>
+
+Parses the decimal integer at the start of C<prop> (after any whitespace)
+into C<*val> with I<parse_long(3)>, like C<sscanf(prop, " %d", val)>
+except that values that don't fit in an C<int> are rejected. Returns C<1>
+on success, or C<0> on error.
+
+*/
+
+static int prop_parse_int(const char *prop, int *val)
+{
+	long l;
+
+	while (is_space(*prop))
+		++prop;
+
+	if (parse_long(prop, strlen(prop), 10, &l) == -1 || l < INT_MIN || l > INT_MAX)
+		return 0;
+
+	*val = (int)l;
+
+	return 1;
+}
+
+/*
+
+C<static int prop_parse_double(const char *prop, double *val)>
+
+Parses the floating point number at the start of C<prop> (after any
+whitespace) into C<*val> with I<parse_double(3)>, like
+C<sscanf(prop, "%lg", val)> except that the decimal point is always
+C<'.'> and values that overflow are rejected. Returns C<1> on success, or
+C<0> on error.
+
+*/
+
+static int prop_parse_double(const char *prop, double *val)
+{
+	while (is_space(*prop))
+		++prop;
+
+	return parse_double(prop, strlen(prop), val) != -1;
+}
+
+/*
+
 =item C<int prop_get_int(const char *name)>
 
 Returns the value of the property named C<name> as an integer. Returns C<0>
 on error, or if there is no such property, or if it is not interpretable as
-a decimal integer.
+a decimal integer (or doesn't fit in an C<int>).
 
 =cut
 
@@ -674,7 +720,7 @@ int prop_get_int(const char *name)
 
 Returns the value of the property named C<name> as an integer. Returns
 C<default_value> on error, or if there is no such property, or if it is not
-interpretable as a decimal integer.
+interpretable as a decimal integer (or doesn't fit in an C<int>).
 
 =cut
 
@@ -685,7 +731,7 @@ int prop_get_int_or(const char *name, int default_value)
 	const char *prop = prop_get(name);
 	int val;
 
-	return (prop && sscanf(prop, " %d ", &val)) ? val : default_value;
+	return (prop && prop_parse_int(prop, &val)) ? val : default_value;
 }
 
 /*
@@ -742,7 +788,7 @@ double prop_get_double_or(const char *name, double default_value)
 	const char *prop = prop_get(name);
 	double val;
 
-	return (prop && sscanf(prop, "%lg", &val)) ? val : default_value;
+	return (prop && prop_parse_double(prop, &val)) ? val : default_value;
 }
 
 /*
@@ -807,7 +853,7 @@ int prop_get_bool_or(const char *name, int default_value)
 	if (!prop)
 		return default_value;
 
-	if (sscanf(prop, " %d ", &val))
+	if (prop_parse_int(prop, &val))
 		return val;
 
 	if (sscanf(prop, " %127s ", buf))
@@ -1545,8 +1591,28 @@ int main(int ac, char **av)
 	if ((bool_val = prop_get_bool_or("b", 0)) != 0)
 		++errors, printf("Test65: prop_get_bool_or() failed (%d not 0)\n", bool_val);
 
+	prop_set("i", " -42 apples");
+	if ((int_val = prop_get_int_or("i", 13)) != -42)
+		++errors, printf("Test66: prop_get_int_or() failed (%d not -42)\n", int_val);
+
+	prop_set("i", "99999999999");
+	if ((int_val = prop_get_int_or("i", 13)) != 13)
+		++errors, printf("Test67: prop_get_int_or() failed (%d not 13)\n", int_val);
+
+	prop_set("i", "twelve");
+	if ((int_val = prop_get_int_or("i", 13)) != 13)
+		++errors, printf("Test68: prop_get_int_or() failed (%d not 13)\n", int_val);
+
+	prop_set("d", " 2.5e-3 ");
+	if ((double_val = prop_get_double_or("d", 13.0)) != 2.5e-3)
+		++errors, printf("Test69: prop_get_double_or() failed (%g not 0.0025)\n", double_val);
+
+	prop_set("d", "1e999");
+	if ((double_val = prop_get_double_or("d", 13.0)) != 13.0)
+		++errors, printf("Test70: prop_get_double_or() failed (%g not 13.0)\n", double_val);
+
 	if (errors)
-		printf("%d/65 tests failed\n", errors);
+		printf("%d/70 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
@@ -122,6 +122,7 @@ attached to a pseudo terminal which is made the controlling terminal.
 #include <sys/ioctl.h>
 
 #include "pseudo.h"
+#include "fio.h"
 
 #ifndef HAVE_STRLCPY
 #include "str.h"
@@ -774,7 +775,11 @@ A safe version of I<forkpty(3)>. Creates a pseudo terminal, and then calls
 I<fork(2)>. In the parent process, the process side of the pseudo terminal
 is closed. In the child process, the user side of the pseudo terminal is
 closed, and the process side is made the controlling terminal. It is
-duplicated onto standard input, output, and error, and is then closed. The
+duplicated onto standard input, output, and error, and is then closed. All
+other file descriptors that the child process inherited are marked
+close-on-exec (with I<cloexec_from(3)>) so that they don't leak into any
+program that the child process subsequently executes. They remain usable by
+the child process until then. The
 user (or controlling process) side of the pseudo terminal is stored in
 C<*pty_user_fd> for the parent process. The device name of the process side
 of the pseudo terminal is stored in the buffer pointed to by
@@ -845,6 +850,10 @@ pid_t pty_fork(int *pty_user_fd, char *pty_device_name, size_t pty_device_name_s
 
 			close(*pty_user_fd);
 
+			/* Don't leak inherited file descriptors into a later exec */
+
+			cloexec_from(STDERR_FILENO + 1);
+
 			return 0;
 		}
 
@@ -0,0 +1,1869 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<libslack(rope)> - rope module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/rope.h>
+
+    typedef struct Rope Rope;
+
+    Rope *rope_create(const char *str, size_t length);
+    Rope *rope_create_with_locker(Locker *locker, const char *str, size_t length);
+    int rope_rdlock(const Rope *rope);
+    int rope_wrlock(const Rope *rope);
+    int rope_unlock(const Rope *rope);
+    void rope_release(Rope *rope);
+    void *rope_destroy(Rope **rope);
+    ssize_t rope_length(const Rope *rope);
+    ssize_t rope_length_unlocked(const Rope *rope);
+    int rope_get(const Rope *rope, ssize_t index);
+    int rope_get_unlocked(const Rope *rope, ssize_t index);
+    Rope *rope_insert(Rope *rope, ssize_t index, const char *str, size_t length);
+    Rope *rope_insert_unlocked(Rope *rope, ssize_t index, const char *str, size_t length);
+    Rope *rope_append(Rope *rope, const char *str, size_t length);
+    Rope *rope_append_unlocked(Rope *rope, const char *str, size_t length);
+    Rope *rope_remove_range(Rope *rope, ssize_t index, ssize_t range);
+    Rope *rope_remove_range_unlocked(Rope *rope, ssize_t index, ssize_t range);
+    Rope *rope_replace(Rope *rope, ssize_t index, ssize_t range, const char *str, size_t length);
+    Rope *rope_replace_unlocked(Rope *rope, ssize_t index, ssize_t range, const char *str, size_t length);
+    Rope *rope_concat(Rope *rope, Rope *src);
+    Rope *rope_concat_unlocked(Rope *rope, Rope *src);
+    String *rope_substr(const Rope *rope, ssize_t index, ssize_t range);
+    String *rope_substr_unlocked(const Rope *rope, ssize_t index, ssize_t range);
+    String *rope_str(const Rope *rope);
+    String *rope_str_unlocked(const Rope *rope);
+    ssize_t rope_iovecs(const Rope *rope, struct iovec *iov, size_t iovcnt);
+    ssize_t rope_iovecs_unlocked(const Rope *rope, struct iovec *iov, size_t iovcnt);
+    ssize_t rope_writev(const Rope *rope, int fd);
+    ssize_t rope_writev_unlocked(const Rope *rope, int fd);
+
+=head1 DESCRIPTION
+
+This module provides a text type for editing large texts. Inserting into or
+removing from a I<String> moves the rest of the string, so editing the front
+of a large I<String> takes time proportional to its length. A I<Rope> stores
+its text in chunks of about a kilobyte held in a balanced binary tree (a
+treap ordered by position, with each node recording the length of the text
+in its subtree). Inserting, removing, replacing and indexing take
+logarithmic time (plus the time to copy any new text), and concatenating two
+I<Rope>s takes logarithmic time without copying either text. Small edits are
+made in place when the affected chunk has room, and neighbouring chunks are
+coalesced when they would fit in one, so chunks stay reasonably full.
+
+When the editing is done, the text can be flattened into a I<String> with
+I<rope_str(3)> or I<rope_substr(3)>, described as a list of I<iovec>s with
+I<rope_iovecs(3)>, or written to a file descriptor without flattening with
+I<rope_writev(3)>.
+
+A I<Rope> contains bytes, not characters, and may contain nul bytes. Like
+I<String> indexes, negative indexes refer to positions relative to the end
+of the text (C<-1> is the position after the last byte, C<-2> is the
+position of the last byte, and so on).
+
+=over 4
+
+=cut
+
+*/
+
+#include "config.h"
+#include "std.h"
+
+#include "rope.h"
+#include "mem.h"
+#include "err.h"
+#include "locker.h"
+
+/* Bytes per chunk: a node (with its header) is about 1KiB */
+
+#define ROPE_CHUNK (1024 - 5 * sizeof(void *))
+
+/* Number of chunks written per writev(2) */
+
+#if defined(IOV_MAX) && IOV_MAX < 256
+#define ROPE_IOV_MAX IOV_MAX
+#else
+#define ROPE_IOV_MAX 256
+#endif
+
+typedef struct RopeNode RopeNode;
+
+struct RopeNode
+{
+	RopeNode *left;          /* the chunks before this one */
+	RopeNode *right;         /* the chunks after this one */
+	size_t size;             /* the number of bytes in this subtree */
+	size_t length;           /* the number of bytes in this chunk */
+	unsigned long priority;  /* the heap priority of this node */
+	char data[ROPE_CHUNK];   /* the bytes in this chunk */
+};
+
+struct Rope
+{
+	RopeNode *root;          /* the tree of chunks */
+	size_t chunks;           /* the number of chunks in the tree */
+	Locker *locker;          /* locking strategy for this object */
+};
+
+#ifndef TEST
+
+#define SIZE(node) ((node) ? (node)->size : 0)
+
+/*
+
+C<RopeNode *node_create(void)>
+
+Creates an empty node. Its heap priority is a hash of its address, so the
+priorities of live nodes are distinct and unrelated to their positions, even
+when nodes from different I<Rope>s are concatenated. On success, returns the
+new node. On error, returns C<null>.
+
+*/
+
+static RopeNode *node_create(void)
+{
+	RopeNode *node;
+	unsigned long long h;
+
+	if (!(node = mem_new(RopeNode)))
+		return NULL;
+
+	h = (unsigned long long)(size_t)node;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+
+	node->left = node->right = NULL;
+	node->size = node->length = 0;
+	node->priority = (unsigned long)h;
+
+	return node;
+}
+
+/*
+
+C<void node_release(Rope *rope, RopeNode *node)>
+
+Releases C<node> and its subtrees, which belong to C<rope>.
+
+*/
+
+static void node_release(Rope *rope, RopeNode *node)
+{
+	RopeNode *right;
+
+	for (; node; node = right)
+	{
+		node_release(rope, node->left);
+		right = node->right;
+		mem_release(node);
+		--rope->chunks;
+	}
+}
+
+/*
+
+C<void node_update(RopeNode *node)>
+
+Recalculates the size of C<node>'s subtree from its children.
+
+*/
+
+static void node_update(RopeNode *node)
+{
+	node->size = SIZE(node->left) + node->length + SIZE(node->right);
+}
+
+/*
+
+C<RopeNode *node_merge(RopeNode *l, RopeNode *r)>
+
+Returns the tree containing the chunks of C<l> followed by the chunks of
+C<r>.
+
+*/
+
+static RopeNode *node_merge(RopeNode *l, RopeNode *r)
+{
+	if (!l)
+		return r;
+
+	if (!r)
+		return l;
+
+	if (l->priority > r->priority)
+	{
+		l->right = node_merge(l->right, r);
+		node_update(l);
+		return l;
+	}
+
+	r->left = node_merge(l, r->left);
+	node_update(r);
+	return r;
+}
+
+/*
+
+C<void node_cut(RopeNode *node, size_t index, RopeNode **spare, RopeNode **l, RopeNode **r)>
+
+Splits the tree C<node> into the first C<index> bytes, C<*l>, and the rest,
+C<*r>. If C<index> is inside a chunk, the chunk is split in two and the
+second half is copied into C<*spare> (which is then set to C<null>), but is
+not added to C<*r>.
+
+*/
+
+static void node_cut(RopeNode *node, size_t index, RopeNode **spare, RopeNode **l, RopeNode **r)
+{
+	size_t left;
+
+	if (!node)
+	{
+		*l = *r = NULL;
+		return;
+	}
+
+	left = SIZE(node->left);
+
+	if (index <= left)
+	{
+		node_cut(node->left, index, spare, l, &node->left);
+		node_update(node);
+		*r = node;
+	}
+	else if (index >= left + node->length)
+	{
+		node_cut(node->right, index - left - node->length, spare, &node->right, r);
+		node_update(node);
+		*l = node;
+	}
+	else
+	{
+		RopeNode *tail = *spare;
+		size_t offset = index - left;
+
+		*spare = NULL;
+		tail->length = tail->size = node->length - offset;
+		memcpy(tail->data, node->data + offset, tail->length);
+
+		node->length = offset;
+		*r = node->right;
+		node->right = NULL;
+		node_update(node);
+		*l = node;
+	}
+}
+
+/*
+
+C<void node_split(Rope *rope, RopeNode *node, size_t index, RopeNode **spare, RopeNode **l, RopeNode **r)>
+
+Splits the tree C<node> into the first C<index> bytes, C<*l>, and the rest,
+C<*r>. If C<index> is inside a chunk, the chunk is split in two and the
+second half is copied into C<*spare> (which is then set to C<null>). So that
+splitting can't fail, the caller must supply C<*spare> unless C<index> is
+known to be at a chunk boundary.
+
+*/
+
+static void node_split(Rope *rope, RopeNode *node, size_t index, RopeNode **spare, RopeNode **l, RopeNode **r)
+{
+	RopeNode *tail = (spare) ? *spare : NULL;
+
+	node_cut(node, index, spare, l, r);
+
+	if (tail && !*spare)
+	{
+		*r = node_merge(tail, *r);
+		++rope->chunks;
+	}
+}
+
+/*
+
+C<RopeNode *node_join(Rope *rope, RopeNode *l, RopeNode *r)>
+
+Like I<node_merge()> except that when the last chunk of C<l> and the first
+chunk of C<r> fit in a single chunk, they are coalesced.
+
+*/
+
+static RopeNode *node_join(Rope *rope, RopeNode *l, RopeNode *r)
+{
+	RopeNode *last, *first, *node, **link;
+
+	if (!l)
+		return r;
+
+	if (!r)
+		return l;
+
+	for (last = l; last->right; last = last->right)
+	{}
+
+	for (first = r; first->left; first = first->left)
+	{}
+
+	if (last->length + first->length <= ROPE_CHUNK)
+	{
+		memcpy(last->data + last->length, first->data, first->length);
+		last->length += first->length;
+
+		for (node = l; node; node = node->right)
+			node->size += first->length;
+
+		for (link = &r; *link != first; link = &(*link)->left)
+			(*link)->size -= first->length;
+
+		*link = first->right;
+		mem_release(first);
+		--rope->chunks;
+	}
+
+	return node_merge(l, r);
+}
+
+/*
+
+C<int build(Rope *rope, const char *str, size_t length, RopeNode **tree)>
+
+Creates a tree of chunks for C<rope> containing the first C<length> bytes of
+C<str>. On success, returns C<0>. On error, returns C<-1>.
+
+*/
+
+static int build(Rope *rope, const char *str, size_t length, RopeNode **tree)
+{
+	RopeNode *node;
+
+	for (*tree = NULL; length; str += node->length, length -= node->length)
+	{
+		if (!(node = node_create()))
+		{
+			node_release(rope, *tree);
+			*tree = NULL;
+			return -1;
+		}
+
+		node->length = node->size = (length < ROPE_CHUNK) ? length : ROPE_CHUNK;
+		memcpy(node->data, str, node->length);
+		++rope->chunks;
+		*tree = node_merge(*tree, node);
+	}
+
+	return 0;
+}
+
+/*
+
+C<int insert_in_place(RopeNode *node, size_t index, const char *str, size_t length)>
+
+Inserts C<length> bytes of C<str> into the chunk at C<index> in the tree
+C<node> if the chunk has room. An C<index> at the boundary between two
+chunks belongs to the first of them. Returns C<1> if the bytes were
+inserted, or C<0> if not.
+
+*/
+
+static int insert_in_place(RopeNode *node, size_t index, const char *str, size_t length)
+{
+	size_t left;
+
+	if (!node)
+		return 0;
+
+	left = SIZE(node->left);
+
+	if (index < left || (index == left && node->left))
+	{
+		if (!insert_in_place(node->left, index, str, length))
+			return 0;
+	}
+	else if (index <= left + node->length)
+	{
+		size_t offset = index - left;
+
+		if (node->length + length > ROPE_CHUNK)
+			return 0;
+
+		memmove(node->data + offset + length, node->data + offset, node->length - offset);
+		memcpy(node->data + offset, str, length);
+		node->length += length;
+	}
+	else if (!insert_in_place(node->right, index - left - node->length, str, length))
+		return 0;
+
+	node->size += length;
+
+	return 1;
+}
+
+/*
+
+C<int remove_in_place(RopeNode *node, size_t index, size_t range, size_t *start, size_t *length)>
+
+Removes C<range> bytes at C<index> in the tree C<node> if they are all in
+the same chunk and it wouldn't become empty. If so, the position and length
+of the chunk afterwards are stored in C<*start> and C<*length>. Returns C<1>
+if the bytes were removed, or C<0> if not.
+
+*/
+
+static int remove_in_place(RopeNode *node, size_t index, size_t range, size_t *start, size_t *length)
+{
+	size_t left;
+
+	if (!node)
+		return 0;
+
+	left = SIZE(node->left);
+
+	if (index < left)
+	{
+		if (!remove_in_place(node->left, index, range, start, length))
+			return 0;
+	}
+	else if (index < left + node->length)
+	{
+		size_t offset = index - left;
+
+		if (offset + range > node->length || range == node->length)
+			return 0;
+
+		memmove(node->data + offset, node->data + offset + range, node->length - offset - range);
+		node->length -= range;
+		*start = left;
+		*length = node->length;
+	}
+	else if (!remove_in_place(node->right, index - left - node->length, range, start, length))
+		return 0;
+	else
+		*start += left + node->length;
+
+	node->size -= range;
+
+	return 1;
+}
+
+/*
+
+C<void coalesce(Rope *rope, size_t start, size_t length)>
+
+Coalesces the chunk at C<start> of length C<length> in C<rope> with its
+neighbours if they fit in a single chunk.
+
+*/
+
+static void coalesce(Rope *rope, size_t start, size_t length)
+{
+	RopeNode *l, *m, *r;
+
+	node_split(rope, rope->root, start, NULL, &l, &m);
+	node_split(rope, m, length, NULL, &m, &r);
+	rope->root = node_join(rope, node_join(rope, l, m), r);
+}
+
+/*
+
+C<int normalise(const Rope *rope, ssize_t *index, ssize_t *range)>
+
+Converts C<*index> and C<*range> (if C<range> is not C<null>) from possibly
+negative positions into a valid position and length in C<rope>. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set to C<EINVAL>.
+
+*/
+
+static int normalise(const Rope *rope, ssize_t *index, ssize_t *range)
+{
+	ssize_t length = SIZE(rope->root);
+
+	if (*index < 0)
+		*index = length + 1 + *index;
+
+	if (*index < 0 || *index > length)
+		return set_errno(EINVAL);
+
+	if (!range)
+		return 0;
+
+	if (*range < 0)
+		*range = length + 1 + *range - *index;
+
+	if (*range < 0 || *index + *range > length)
+		return set_errno(EINVAL);
+
+	return 0;
+}
+
+/*
+
+=item C<Rope *rope_create(const char *str, size_t length)>
+
+Creates a I<Rope> containing the first C<length> bytes of C<str> (which may
+be C<null> if C<length> is zero). It is the caller's responsibility to
+deallocate the new rope with I<rope_release(3)> or I<rope_destroy(3)>. It is
+strongly recommended to use I<rope_destroy(3)>, because it also sets the
+pointer variable to C<null>. On success, returns the new rope. On error,
+returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Rope *rope_create(const char *str, size_t length)
+{
+	return rope_create_with_locker(NULL, str, length);
+}
+
+/*
+
+=item C<Rope *rope_create_with_locker(Locker *locker, const char *str, size_t length)>
+
+Equivalent to I<rope_create(3)> except that multiple threads accessing the
+new rope will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+Rope *rope_create_with_locker(Locker *locker, const char *str, size_t length)
+{
+	Rope *rope;
+
+	if (!str && length)
+		return set_errnull(EINVAL);
+
+	if (!(rope = mem_new(Rope))) /* XXX decouple */
+		return NULL;
+
+	rope->root = NULL;
+	rope->chunks = 0;
+	rope->locker = locker;
+
+	if (build(rope, str, length, &rope->root) == -1)
+	{
+		mem_release(rope);
+		return NULL;
+	}
+
+	return rope;
+}
+
+/*
+
+=item C<int rope_rdlock(const Rope *rope)>
+
+Claims a read lock on C<rope> (if C<rope> was created with a I<Locker>).
+This is needed when multiple read-only I<rope(3)> module functions need to
+be called atomically. It is the client's responsibility to call
+I<rope_unlock(3)> after the atomic operation. The only functions that may be
+called on C<rope> between calls to I<rope_rdlock(3)> and I<rope_unlock(3)>
+are any read-only I<rope(3)> module functions whose name ends with
+C<_unlocked>. On success, returns C<0>. On error, returns an error code.
+
+=cut
+
+*/
+
+#define rope_rdlock(rope) ((rope) ? locker_rdlock((rope)->locker) : EINVAL)
+#define rope_wrlock(rope) ((rope) ? locker_wrlock((rope)->locker) : EINVAL)
+#define rope_unlock(rope) ((rope) ? locker_unlock((rope)->locker) : EINVAL)
+
+int (rope_rdlock)(const Rope *rope)
+{
+	return rope_rdlock(rope);
+}
+
+/*
+
+=item C<int rope_wrlock(const Rope *rope)>
+
+Claims a write lock on C<rope> (if C<rope> was created with a I<Locker>).
+This is needed when multiple read/write I<rope(3)> module functions need to
+be called atomically. It is the client's responsibility to call
+I<rope_unlock(3)> after the atomic operation. The only functions that may be
+called on C<rope> between calls to I<rope_wrlock(3)> and I<rope_unlock(3)>
+are any I<rope(3)> module functions whose name ends with C<_unlocked>. On
+success, returns C<0>. On error, returns an error code.
+
+=cut
+
+*/
+
+int (rope_wrlock)(const Rope *rope)
+{
+	return rope_wrlock(rope);
+}
+
+/*
+
+=item C<int rope_unlock(const Rope *rope)>
+
+Unlocks a read or write lock on C<rope> obtained with I<rope_rdlock(3)> or
+I<rope_wrlock(3)> (if C<rope> was created with a C<locker>). On success,
+returns C<0>. On error, returns an error code.
+
+=cut
+
+*/
+
+int (rope_unlock)(const Rope *rope)
+{
+	return rope_unlock(rope);
+}
+
+/*
+
+=item C<void rope_release(Rope *rope)>
+
+Releases (deallocates) C<rope>.
+
+=cut
+
+*/
+
+void rope_release(Rope *rope)
+{
+	if (!rope)
+		return;
+
+	node_release(rope, rope->root);
+	mem_release(rope);
+}
+
+/*
+
+=item C<void *rope_destroy(Rope **rope)>
+
+Destroys (deallocates and sets to C<null>) C<*rope>. Returns C<null>.
+B<Note:> Ropes shared by multiple threads must not be destroyed until after
+all threads have finished with it.
+
+=cut
+
+*/
+
+void *rope_destroy(Rope **rope)
+{
+	if (rope && *rope)
+	{
+		rope_release(*rope);
+		*rope = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<ssize_t rope_length(const Rope *rope)>
+
+Returns the number of bytes in C<rope>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t rope_length(const Rope *rope)
+{
+	ssize_t length;
+	int err;
+
+	if (!rope)
+		return set_errno(EINVAL);
+
+	if ((err = rope_rdlock(rope)))
+		return set_errno(err);
+
+	length = rope_length_unlocked(rope);
+
+	if ((err = rope_unlock(rope)))
+		return set_errno(err);
+
+	return length;
+}
+
+/*
+
+=item C<ssize_t rope_length_unlocked(const Rope *rope)>
+
+Equivalent to I<rope_length(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t rope_length_unlocked(const Rope *rope)
+{
+	if (!rope)
+		return set_errno(EINVAL);
+
+	return SIZE(rope->root);
+}
+
+/*
+
+=item C<int rope_get(const Rope *rope, ssize_t index)>
+
+Returns the byte at position C<index> in C<rope> (as an C<unsigned char>
+converted to an C<int>). If C<index> is negative, it refers to a position
+relative to the end of C<rope> (C<-2> is the position of the last byte). On
+error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int rope_get(const Rope *rope, ssize_t index)
+{
+	int ret;
+	int err;
+
+	if (!rope)
+		return set_errno(EINVAL);
+
+	if ((err = rope_rdlock(rope)))
+		return set_errno(err);
+
+	ret = rope_get_unlocked(rope, index);
+
+	if ((err = rope_unlock(rope)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int rope_get_unlocked(const Rope *rope, ssize_t index)>
+
+Equivalent to I<rope_get(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+int rope_get_unlocked(const Rope *rope, ssize_t index)
+{
+	const RopeNode *node;
+	size_t pos, left;
+
+	if (!rope)
+		return set_errno(EINVAL);
+
+	if (normalise(rope, &index, NULL) == -1 || index == SIZE(rope->root))
+		return set_errno(EINVAL);
+
+	for (node = rope->root, pos = index;;)
+	{
+		left = SIZE(node->left);
+
+		if (pos < left)
+			node = node->left;
+		else if (pos < left + node->length)
+			return (unsigned char)node->data[pos - left];
+		else
+			pos -= left + node->length, node = node->right;
+	}
+}
+
+/*
+
+=item C<Rope *rope_insert(Rope *rope, ssize_t index, const char *str, size_t length)>
+
+Inserts the first C<length> bytes of C<str> into C<rope> at position
+C<index>. If C<index> is negative, it refers to a position relative to the
+end of C<rope> (C<-1> is the position after the last byte, C<-2> is the
+position of the last byte, and so on). On success, returns C<rope>. On
+error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Rope *rope_insert(Rope *rope, ssize_t index, const char *str, size_t length)
+{
+	Rope *ret;
+	int err;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if ((err = rope_wrlock(rope)))
+		return set_errnull(err);
+
+	ret = rope_insert_unlocked(rope, index, str, length);
+
+	if ((err = rope_unlock(rope)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_insert_unlocked(Rope *rope, ssize_t index, const char *str, size_t length)>
+
+Equivalent to I<rope_insert(3)> except that C<rope> is not write-locked.
+
+=cut
+
+*/
+
+Rope *rope_insert_unlocked(Rope *rope, ssize_t index, const char *str, size_t length)
+{
+	return rope_replace_unlocked(rope, index, 0, str, length);
+}
+
+/*
+
+=item C<Rope *rope_append(Rope *rope, const char *str, size_t length)>
+
+Appends the first C<length> bytes of C<str> to C<rope>. On success, returns
+C<rope>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Rope *rope_append(Rope *rope, const char *str, size_t length)
+{
+	return rope_insert(rope, -1, str, length);
+}
+
+/*
+
+=item C<Rope *rope_append_unlocked(Rope *rope, const char *str, size_t length)>
+
+Equivalent to I<rope_append(3)> except that C<rope> is not write-locked.
+
+=cut
+
+*/
+
+Rope *rope_append_unlocked(Rope *rope, const char *str, size_t length)
+{
+	return rope_insert_unlocked(rope, -1, str, length);
+}
+
+/*
+
+=item C<Rope *rope_remove_range(Rope *rope, ssize_t index, ssize_t range)>
+
+Removes C<range> bytes from C<rope> starting at C<index>. If C<index> or
+C<range> are negative, they refer to positions relative to the end of
+C<rope> (C<-1> is the position after the last byte, C<-2> is the position
+of the last byte, and so on). On success, returns C<rope>. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Rope *rope_remove_range(Rope *rope, ssize_t index, ssize_t range)
+{
+	return rope_replace(rope, index, range, NULL, 0);
+}
+
+/*
+
+=item C<Rope *rope_remove_range_unlocked(Rope *rope, ssize_t index, ssize_t range)>
+
+Equivalent to I<rope_remove_range(3)> except that C<rope> is not
+write-locked.
+
+=cut
+
+*/
+
+Rope *rope_remove_range_unlocked(Rope *rope, ssize_t index, ssize_t range)
+{
+	return rope_replace_unlocked(rope, index, range, NULL, 0);
+}
+
+/*
+
+=item C<Rope *rope_replace(Rope *rope, ssize_t index, ssize_t range, const char *str, size_t length)>
+
+Replaces C<range> bytes in C<rope>, starting at C<index>, with the first
+C<length> bytes of C<str>. If C<index> or C<range> are negative, they refer
+to positions relative to the end of C<rope> (C<-1> is the position after
+the last byte, C<-2> is the position of the last byte, and so on). On
+success, returns C<rope>. On error, returns C<null> with C<errno> set
+appropriately, and C<rope> is unchanged.
+
+=cut
+
+*/
+
+Rope *rope_replace(Rope *rope, ssize_t index, ssize_t range, const char *str, size_t length)
+{
+	Rope *ret;
+	int err;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if ((err = rope_wrlock(rope)))
+		return set_errnull(err);
+
+	ret = rope_replace_unlocked(rope, index, range, str, length);
+
+	if ((err = rope_unlock(rope)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_replace_unlocked(Rope *rope, ssize_t index, ssize_t range, const char *str, size_t length)>
+
+Equivalent to I<rope_replace(3)> except that C<rope> is not write-locked.
+
+=cut
+
+*/
+
+Rope *rope_replace_unlocked(Rope *rope, ssize_t index, ssize_t range, const char *str, size_t length)
+{
+	RopeNode *spare[2], *l, *m, *r, *mid;
+	size_t start, chunk;
+
+	if (!rope || (!str && length))
+		return set_errnull(EINVAL);
+
+	if (normalise(rope, &index, &range) == -1)
+		return NULL;
+
+	/* Small edits within a single chunk are made in place */
+
+	if (!range && length && insert_in_place(rope->root, index, str, length))
+		return rope;
+
+	if (range && !length && remove_in_place(rope->root, index, range, &start, &chunk))
+	{
+		if (chunk < ROPE_CHUNK / 2)
+			coalesce(rope, start, chunk);
+
+		return rope;
+	}
+
+	if (!range && !length)
+		return rope;
+
+	/* Otherwise, allocate everything first, so that nothing can fail later */
+
+	if (build(rope, str, length, &mid) == -1)
+		return NULL;
+
+	spare[0] = spare[1] = NULL;
+
+	if (!(spare[0] = node_create()) || (range && !(spare[1] = node_create())))
+	{
+		mem_release(spare[0]);
+		node_release(rope, mid);
+		return NULL;
+	}
+
+	node_split(rope, rope->root, index, &spare[0], &l, &r);
+
+	if (range)
+	{
+		node_split(rope, r, range, (spare[0]) ? &spare[0] : &spare[1], &m, &r);
+		node_release(rope, m);
+	}
+
+	rope->root = node_join(rope, node_join(rope, l, mid), r);
+
+	mem_release(spare[0]);
+	mem_release(spare[1]);
+
+	return rope;
+}
+
+/*
+
+=item C<Rope *rope_concat(Rope *rope, Rope *src)>
+
+Moves the text of C<src> to the end of C<rope>, leaving C<src> empty. No
+text is copied (except to coalesce the two chunks at the join). On success,
+returns C<rope>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Rope *rope_concat(Rope *rope, Rope *src)
+{
+	Rope *ret;
+	int err;
+
+	if (!rope || !src)
+		return set_errnull(EINVAL);
+
+	if ((err = rope_wrlock(rope)))
+		return set_errnull(err);
+
+	if ((err = rope_wrlock(src)))
+	{
+		rope_unlock(rope);
+		return set_errnull(err);
+	}
+
+	ret = rope_concat_unlocked(rope, src);
+
+	if ((err = rope_unlock(src)))
+	{
+		rope_unlock(rope);
+		return set_errnull(err);
+	}
+
+	if ((err = rope_unlock(rope)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<Rope *rope_concat_unlocked(Rope *rope, Rope *src)>
+
+Equivalent to I<rope_concat(3)> except that C<rope> and C<src> are not
+write-locked. Note: If C<src> needs to be write-locked, it is the caller's
+responsibility to lock and unlock it explicitly with I<rope_wrlock(3)> and
+I<rope_unlock(3)>.
+
+=cut
+
+*/
+
+Rope *rope_concat_unlocked(Rope *rope, Rope *src)
+{
+	if (!rope || !src || rope == src)
+		return set_errnull(EINVAL);
+
+	rope->chunks += src->chunks;
+	rope->root = node_join(rope, rope->root, src->root);
+	src->root = NULL;
+	src->chunks = 0;
+
+	return rope;
+}
+
+/*
+
+C<void span(const RopeNode *node, size_t index, size_t range, struct iovec *iov, size_t *count)>
+
+Describes the C<range> bytes starting at C<index> in the tree C<node> as
+I<iovec>s stored in C<iov> starting at C<iov[*count]>, incrementing
+C<*count>. If C<iov> is C<null>, they are only counted.
+
+*/
+
+static void span(const RopeNode *node, size_t index, size_t range, struct iovec *iov, size_t *count)
+{
+	size_t left, offset, bytes;
+
+	for (; node && range; node = node->right)
+	{
+		left = SIZE(node->left);
+
+		if (index < left)
+		{
+			bytes = (range < left - index) ? range : left - index;
+			span(node->left, index, bytes, iov, count);
+			range -= bytes, index = left;
+		}
+
+		if (range && index < left + node->length)
+		{
+			offset = index - left;
+			bytes = (range < node->length - offset) ? range : node->length - offset;
+
+			if (iov)
+			{
+				iov[*count].iov_base = (void *)(node->data + offset);
+				iov[*count].iov_len = bytes;
+			}
+
+			++*count;
+			range -= bytes, index += bytes;
+		}
+
+		index -= left + node->length;
+	}
+}
+
+/*
+
+=item C<String *rope_substr(const Rope *rope, ssize_t index, ssize_t range)>
+
+Creates a I<String> containing the C<range> bytes of C<rope> starting at
+C<index>. If C<index> or C<range> are negative, they refer to positions
+relative to the end of C<rope> (C<-1> is the position after the last byte,
+C<-2> is the position of the last byte, and so on). It is the caller's
+responsibility to deallocate the new string with I<str_release(3)> or
+I<str_destroy(3)>. On success, returns the new string. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+String *rope_substr(const Rope *rope, ssize_t index, ssize_t range)
+{
+	String *ret;
+	int err;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if ((err = rope_rdlock(rope)))
+		return set_errnull(err);
+
+	ret = rope_substr_unlocked(rope, index, range);
+
+	if ((err = rope_unlock(rope)))
+	{
+		str_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<String *rope_substr_unlocked(const Rope *rope, ssize_t index, ssize_t range)>
+
+Equivalent to I<rope_substr(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+String *rope_substr_unlocked(const Rope *rope, ssize_t index, ssize_t range)
+{
+	struct iovec *iov;
+	size_t count = 0;
+	String *ret;
+
+	if (!rope)
+		return set_errnull(EINVAL);
+
+	if (normalise(rope, &index, &range) == -1)
+		return NULL;
+
+	span(rope->root, index, range, NULL, &count);
+
+	if (!(iov = mem_create(count + 1, struct iovec)))
+		return NULL;
+
+	count = 0;
+	span(rope->root, index, range, iov, &count);
+	ret = str_create_iovecs(iov, count);
+	mem_release(iov);
+
+	return ret;
+}
+
+/*
+
+=item C<String *rope_str(const Rope *rope)>
+
+Creates a I<String> containing the text of C<rope>. It is the caller's
+responsibility to deallocate the new string with I<str_release(3)> or
+I<str_destroy(3)>. On success, returns the new string. On error, returns
+C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+String *rope_str(const Rope *rope)
+{
+	return rope_substr(rope, 0, -1);
+}
+
+/*
+
+=item C<String *rope_str_unlocked(const Rope *rope)>
+
+Equivalent to I<rope_str(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+String *rope_str_unlocked(const Rope *rope)
+{
+	return rope_substr_unlocked(rope, 0, -1);
+}
+
+/*
+
+C<void gather(const RopeNode *node, struct iovec *iov, size_t iovcnt, size_t *count)>
+
+Stores the chunks of the tree C<node> in C<iov> starting at C<iov[*count]>,
+incrementing C<*count>, until C<iovcnt> I<iovec>s have been stored.
+
+*/
+
+static void gather(const RopeNode *node, struct iovec *iov, size_t iovcnt, size_t *count)
+{
+	for (; node && *count < iovcnt; node = node->right)
+	{
+		gather(node->left, iov, iovcnt, count);
+
+		if (*count == iovcnt)
+			break;
+
+		iov[*count].iov_base = (void *)node->data;
+		iov[*count].iov_len = node->length;
+		++*count;
+	}
+}
+
+/*
+
+=item C<ssize_t rope_iovecs(const Rope *rope, struct iovec *iov, size_t iovcnt)>
+
+Stores the chunks of C<rope> in order in C<iov>, which has room for
+C<iovcnt> I<iovec>s (C<iov> may be C<null> if C<iovcnt> is zero). The
+I<iovec>s point into C<rope>, so they are only valid until it is next
+modified. If C<rope> has more than C<iovcnt> chunks, only the first
+C<iovcnt> are stored. On success, returns the number of chunks in C<rope>
+(so that the client can find out how many I<iovec>s are needed by calling
+this with C<iovcnt> zero). On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+ssize_t rope_iovecs(const Rope *rope, struct iovec *iov, size_t iovcnt)
+{
+	ssize_t ret;
+	int err;
+
+	if (!rope)
+		return set_errno(EINVAL);
+
+	if ((err = rope_rdlock(rope)))
+		return set_errno(err);
+
+	ret = rope_iovecs_unlocked(rope, iov, iovcnt);
+
+	if ((err = rope_unlock(rope)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<ssize_t rope_iovecs_unlocked(const Rope *rope, struct iovec *iov, size_t iovcnt)>
+
+Equivalent to I<rope_iovecs(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t rope_iovecs_unlocked(const Rope *rope, struct iovec *iov, size_t iovcnt)
+{
+	size_t count = 0;
+
+	if (!rope || (!iov && iovcnt))
+		return set_errno(EINVAL);
+
+	gather(rope->root, iov, iovcnt, &count);
+
+	return rope->chunks;
+}
+
+typedef struct RopeWriter RopeWriter;
+
+struct RopeWriter
+{
+	int fd;                         /* the file descriptor to write to */
+	struct iovec iov[ROPE_IOV_MAX]; /* the chunks waiting to be written */
+	int count;                      /* the number of chunks in iov */
+	ssize_t written;                /* the number of bytes written so far */
+};
+
+/*
+
+C<int flush(RopeWriter *writer)>
+
+Writes the chunks in C<writer>, continuing after partial writes and
+interrupts. On success, returns C<0>. On error, returns C<-1> with C<errno>
+set by I<writev(2)>.
+
+*/
+
+static int flush(RopeWriter *writer)
+{
+	struct iovec *iov = writer->iov;
+	int count = writer->count;
+	ssize_t bytes;
+
+	while (count)
+	{
+		if ((bytes = writev(writer->fd, iov, count)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		writer->written += bytes;
+
+		for (; count && (size_t)bytes >= iov->iov_len; --count)
+			bytes -= (iov++)->iov_len;
+
+		if (count)
+		{
+			iov->iov_base = (char *)iov->iov_base + bytes;
+			iov->iov_len -= bytes;
+		}
+	}
+
+	writer->count = 0;
+
+	return 0;
+}
+
+/*
+
+C<int write_chunks(RopeWriter *writer, const RopeNode *node)>
+
+Writes the chunks of the tree C<node> with C<writer>, C<ROPE_IOV_MAX> at a
+time. On success, returns C<0>. On error, returns C<-1> with C<errno> set
+by I<writev(2)>.
+
+*/
+
+static int write_chunks(RopeWriter *writer, const RopeNode *node)
+{
+	for (; node; node = node->right)
+	{
+		if (write_chunks(writer, node->left) == -1)
+			return -1;
+
+		writer->iov[writer->count].iov_base = (void *)node->data;
+		writer->iov[writer->count].iov_len = node->length;
+
+		if (++writer->count == ROPE_IOV_MAX && flush(writer) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+
+=item C<ssize_t rope_writev(const Rope *rope, int fd)>
+
+Writes the text of C<rope> to the file descriptor C<fd> with I<writev(2)>,
+without flattening it first. Partial writes and interrupted writes are
+continued, so C<fd> should be in blocking mode. On success, returns the
+number of bytes written. On error, returns C<-1> with C<errno> set
+appropriately, and some of the text may have been written.
+
+=cut
+
+*/
+
+ssize_t rope_writev(const Rope *rope, int fd)
+{
+	ssize_t ret;
+	int err;
+
+	if (!rope)
+		return set_errno(EINVAL);
+
+	if ((err = rope_rdlock(rope)))
+		return set_errno(err);
+
+	ret = rope_writev_unlocked(rope, fd);
+
+	if ((err = rope_unlock(rope)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<ssize_t rope_writev_unlocked(const Rope *rope, int fd)>
+
+Equivalent to I<rope_writev(3)> except that C<rope> is not read-locked.
+
+=cut
+
+*/
+
+ssize_t rope_writev_unlocked(const Rope *rope, int fd)
+{
+	RopeWriter writer[1];
+
+	if (!rope || fd < 0)
+		return set_errno(EINVAL);
+
+	writer->fd = fd;
+	writer->count = 0;
+	writer->written = 0;
+
+	if (write_chunks(writer, rope->root) == -1 || flush(writer) == -1)
+		return -1;
+
+	return writer->written;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Disciplined>
+
+By default, I<Rope>s are not I<MT-Safe>. I<Rope>s created with
+I<rope_create_with_locker(3)> are synchronised by the given I<Locker>, in
+the same way as I<List>s (see I<list(3)> for details).
+
+=head1 EXAMPLES
+
+Build a document by editing a template, then write it out without
+flattening it:
+
+    #include <slack/std.h>
+    #include <slack/rope.h>
+
+    int main()
+    {
+        Rope *doc;
+
+        if (!(doc = rope_create("Hello [name], welcome to [place].\n", 34)))
+            return EXIT_FAILURE;
+
+        rope_replace(doc, 6, 6, "world", 5);
+        rope_replace(doc, 24, 7, "the rope", 8);
+        rope_insert(doc, 0, ">> ", 3);
+
+        if (rope_writev(doc, STDOUT_FILENO) == -1)
+            return EXIT_FAILURE;
+
+        rope_destroy(&doc);
+
+        return EXIT_SUCCESS;
+    }
+
+Flatten a rope into a I<String>:
+
+    #include <slack/std.h>
+    #include <slack/rope.h>
+
+    int main()
+    {
+        Rope *rope = rope_create("abc", 3);
+        Rope *tail = rope_create("def", 3);
+        String *str;
+
+        rope_concat(rope, tail);
+        rope_destroy(&tail);
+
+        str = rope_str(rope);
+        printf("%s\n", cstr(str)); // prints "abcdef"
+
+        str_destroy(&str);
+        rope_destroy(&rope);
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<str(3)>,
+I<list(3)>,
+I<locker(3)>,
+I<writev(2)>
+
+=head1 AUTHOR
+
+20230824 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <slack/str.h>
+
+/* Checks the tree invariants: sizes, heap order, no empty or overfull chunks */
+
+static size_t check_node(const RopeNode *node, size_t *chunks, int *bad)
+{
+	size_t size;
+
+	if (!node)
+		return 0;
+
+	++*chunks;
+
+	if (!node->length || node->length > ROPE_CHUNK)
+		*bad = 1;
+
+	if ((node->left && node->left->priority > node->priority) || (node->right && node->right->priority > node->priority))
+		*bad = 1;
+
+	size = check_node(node->left, chunks, bad) + node->length + check_node(node->right, chunks, bad);
+
+	if (size != node->size)
+		*bad = 1;
+
+	return size;
+}
+
+static int check_rope(const Rope *rope)
+{
+	size_t chunks = 0;
+	int bad = 0;
+
+	check_node(rope->root, &chunks, &bad);
+
+	return !bad && chunks == rope->chunks;
+}
+
+static unsigned long seed = 12345;
+
+static size_t rnd(size_t n)
+{
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 16) % n;
+}
+
+#define TEST_ACT(i, action) \
+	if (!(action)) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_EQ(i, action, value) \
+	if ((val = (action)) != (value)) \
+		++errors, printf("Test%d: %s failed (returned %d, not %d)\n", (i), (#action), (int)val, (int)(value));
+
+#define CHECK_ROPE(i, rope, text, length) \
+	if (!check_rope(rope)) \
+		++errors, printf("Test%d: rope invariants failed\n", (i)); \
+	else if (!(str = rope_str(rope))) \
+		++errors, printf("Test%d: rope_str() failed\n", (i)); \
+	else \
+	{ \
+		if (str_length(str) != (length) || memcmp(cstr(str), (text), (length))) \
+			++errors, printf("Test%d: rope is \"%.*s\", not \"%.*s\"\n", (i), (int)str_length(str), cstr(str), (int)(length), (text)); \
+		str_destroy(&str); \
+	}
+
+int main(int ac, char **av)
+{
+	int errors = 0;
+	Rope *rope, *src;
+	String *str;
+	struct iovec iov[4];
+	char *text, *buf, *copy;
+	size_t length, i;
+	ssize_t val;
+	FILE *tmp;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	printf("Testing: %s\n", "rope");
+
+	/* Test small edits */
+
+	if (!(rope = rope_create("hello world", 11)))
+		++errors, printf("Test1: rope_create() failed\n");
+	else
+	{
+		CHECK_ROPE(1, rope, "hello world", 11)
+		TEST_EQ(2, rope_length(rope), 11)
+		TEST_EQ(3, rope_get(rope, 0), 'h')
+		TEST_EQ(4, rope_get(rope, -2), 'd')
+		TEST_EQ(5, rope_get(rope, 11), -1)
+		TEST_ACT(6, rope_insert(rope, 5, ",", 1))
+		CHECK_ROPE(6, rope, "hello, world", 12)
+		TEST_ACT(7, rope_append(rope, "!", 1))
+		CHECK_ROPE(7, rope, "hello, world!", 13)
+		TEST_ACT(8, rope_replace(rope, 7, 5, "rope", 4))
+		CHECK_ROPE(8, rope, "hello, rope!", 12)
+		TEST_ACT(9, rope_remove_range(rope, 0, 7))
+		CHECK_ROPE(9, rope, "rope!", 5)
+		TEST_ACT(10, rope_remove_range(rope, -2, -1))
+		CHECK_ROPE(10, rope, "rope", 4)
+		TEST_ACT(11, !rope_remove_range(rope, 2, 3))
+		TEST_ACT(12, !rope_insert(rope, 5, "x", 1))
+		TEST_ACT(13, !rope_insert(rope, -6, "x", 1))
+		TEST_ACT(14, rope_insert(rope, -5, "\0", 1))
+		CHECK_ROPE(14, rope, "\0rope", 5)
+
+		if (!(str = rope_substr(rope, 1, 3)))
+			++errors, printf("Test15: rope_substr() failed\n");
+		else
+		{
+			if (strcmp(cstr(str), "rop"))
+				++errors, printf("Test15: rope_substr(rope, 1, 3) = \"%s\", not \"rop\"\n", cstr(str));
+			str_destroy(&str);
+		}
+
+		TEST_ACT(16, rope_remove_range(rope, 0, -1))
+		CHECK_ROPE(16, rope, "", 0)
+		TEST_EQ(17, rope_iovecs(rope, NULL, 0), 0)
+		rope_destroy(&rope);
+		TEST_ACT(18, !rope)
+	}
+
+	/* Test large texts: several chunks */
+
+	length = 100000;
+	text = malloc(length * 4);
+	buf = malloc(length * 4);
+	copy = malloc(length * 4);
+
+	for (i = 0; i < length; ++i)
+		text[i] = 'a' + i % 26;
+
+	if (!(rope = rope_create(text, length)))
+		++errors, printf("Test19: rope_create() failed\n");
+	else
+	{
+		CHECK_ROPE(19, rope, text, length)
+		TEST_EQ(20, rope_get(rope, 54321), 'a' + 54321 % 26)
+		TEST_ACT(21, rope_iovecs(rope, NULL, 0) >= (ssize_t)(length / ROPE_CHUNK))
+
+		/* Test rope_iovecs() */
+
+		val = rope_iovecs(rope, iov, 4);
+		TEST_ACT(22, val > 4)
+
+		if (val > 4)
+		{
+			struct iovec *all = malloc(val * sizeof(struct iovec));
+			size_t total = 0;
+
+			if (rope_iovecs(rope, all, val) != val)
+				++errors, printf("Test22: rope_iovecs(rope, all, %d) failed\n", (int)val);
+
+			for (i = 0; i < (size_t)val; ++i)
+			{
+				if (!all[i].iov_len || memcmp(all[i].iov_base, text + total, all[i].iov_len))
+					++errors, printf("Test22: rope_iovecs() chunk %d is wrong\n", (int)i);
+				total += all[i].iov_len;
+			}
+
+			if (total != length)
+				++errors, printf("Test22: rope_iovecs() total is %d, not %d\n", (int)total, (int)length);
+
+			if (iov[3].iov_base != all[3].iov_base)
+				++errors, printf("Test22: rope_iovecs() with 4 iovecs differs\n");
+
+			free(all);
+		}
+
+		/* Test rope_writev() */
+
+		if (!(tmp = tmpfile()))
+			++errors, printf("Test23: failed to perform test: tmpfile() failed\n");
+		else
+		{
+			TEST_EQ(23, rope_writev(rope, fileno(tmp)), length)
+			rewind(tmp);
+
+			if (fread(buf, 1, length + 1, tmp) != length || memcmp(buf, text, length))
+				++errors, printf("Test23: rope_writev() wrote the wrong text\n");
+
+			fclose(tmp);
+		}
+
+		TEST_EQ(24, rope_writev(rope, -1), -1)
+
+		/* Test random edits against a flat copy */
+
+		memcpy(buf, text, length);
+
+		for (i = 0; i < 20000; ++i)
+		{
+			size_t index = rnd(length + 1);
+			size_t range = (index < length) ? rnd((length - index < 1000) ? length - index + 1 : 1000) : 0;
+			size_t n = rnd(4) ? rnd(10) : rnd(5000);
+			const char *s = text + rnd(100000 - n);
+
+			if (length + n > 3 * 100000 && n > range)
+				n = range;
+
+			switch (rnd(3))
+			{
+				case 0:
+					if (!rope_insert(rope, index, s, n))
+						++errors, printf("Test25: rope_insert(%d, %d) failed\n", (int)index, (int)n);
+					memmove(buf + index + n, buf + index, length - index);
+					memcpy(buf + index, s, n);
+					length += n;
+					break;
+
+				case 1:
+					if (!rope_remove_range(rope, index, range))
+						++errors, printf("Test25: rope_remove_range(%d, %d) failed\n", (int)index, (int)range);
+					memmove(buf + index, buf + index + range, length - index - range);
+					length -= range;
+					break;
+
+				case 2:
+					if (!rope_replace(rope, index, range, s, n))
+						++errors, printf("Test25: rope_replace(%d, %d, %d) failed\n", (int)index, (int)range, (int)n);
+					memmove(buf + index + n, buf + index + range, length - index - range);
+					memcpy(buf + index, s, n);
+					length += n - range;
+					break;
+			}
+
+			if (length && rope_get(rope, index % length) != (unsigned char)buf[index % length])
+			{
+				++errors, printf("Test25: rope_get(%d) failed after edit %d\n", (int)(index % length), (int)i);
+				break;
+			}
+
+			if (i % 1000 == 0)
+			{
+				CHECK_ROPE(25, rope, buf, length)
+			}
+		}
+
+		CHECK_ROPE(25, rope, buf, length)
+		TEST_EQ(26, rope_length(rope), length)
+
+		/* Test that chunks stay reasonably full */
+
+		if ((val = rope_iovecs(rope, NULL, 0)) > (ssize_t)(3 * length / ROPE_CHUNK + 2))
+			++errors, printf("Test27: %d chunks for %d bytes\n", (int)val, (int)length);
+
+		/* Test rope_concat() */
+
+		if (!(src = rope_create(text, 5000)))
+			++errors, printf("Test28: rope_create() failed\n");
+		else
+		{
+			TEST_ACT(28, rope_concat(rope, src))
+			memcpy(buf + length, text, 5000);
+			length += 5000;
+			CHECK_ROPE(28, rope, buf, length)
+			CHECK_ROPE(29, src, "", 0)
+			TEST_ACT(30, !rope_concat(rope, rope))
+			TEST_ACT(31, rope_insert(src, 0, "xyz", 3))
+			TEST_ACT(31, rope_concat(src, rope))
+			memcpy(copy, "xyz", 3);
+			memcpy(copy + 3, buf, length);
+			CHECK_ROPE(31, src, copy, length + 3)
+			CHECK_ROPE(31, rope, "", 0)
+			rope_destroy(&src);
+		}
+
+		rope_destroy(&rope);
+	}
+
+	/* Test building from many small ropes and editing at the front */
+
+	if (!(rope = rope_create(NULL, 0)))
+		++errors, printf("Test32: rope_create(NULL, 0) failed\n");
+	else
+	{
+		for (i = 0; i < 1000; ++i)
+		{
+			if (!(src = rope_create(text + i, 1)))
+				break;
+			rope_concat(rope, src);
+			rope_destroy(&src);
+		}
+
+		CHECK_ROPE(32, rope, text, 1000)
+
+		for (i = 0; i < 50000; ++i)
+			rope_insert(rope, 0, text + i % 26, 1);
+
+		TEST_EQ(33, rope_length(rope), 51000)
+		TEST_EQ(34, rope_get(rope, 0), text[49999 % 26])
+		TEST_ACT(35, check_rope(rope))
+		rope_destroy(&rope);
+	}
+
+	free(text);
+	free(buf);
+	free(copy);
+
+	/* Test errors */
+
+	TEST_ACT(36, !rope_create(NULL, 1))
+	TEST_EQ(37, rope_length(NULL), -1)
+	TEST_ACT(38, !rope_insert(NULL, 0, "x", 1))
+	TEST_ACT(39, !rope_str(NULL))
+
+	if (errors)
+		printf("%d/39 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
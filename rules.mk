@@ -31,7 +31,7 @@ $(SLACK_TARGET): $(SLACK_OFILES)
 	$(AR) cr $(SLACK_TARGET) $(SLACK_OFILES)
 	$(RANLIB) $(SLACK_TARGET)
 
-.PHONY: ready-slack test-slack man-slack html-slack
+.PHONY: ready-slack test-slack bench-slack man-slack html-slack
 
 ready-slack:
 	@[ -h $(SLACK_INCLINK) ] || ln -s . $(SLACK_INCLINK)
@@ -39,6 +39,9 @@ ready-slack:
 test-slack: $(SLACK_TESTS)
 	@cd $(SLACK_TESTDIR); for test in $(patsubst $(SLACK_TESTDIR)/%, %, $(SLACK_TESTS)); do echo; ./$$test; done
 
+bench-slack: $(SLACK_BENCH)
+	@cd $(SLACK_TESTDIR); ./$(notdir $(SLACK_BENCH)) $(BENCH_ARGS)
+
 man-slack: $(SLACK_LIB_MANFILES) $(SLACK_APP_MANFILES)
 
 html-slack: $(SLACK_LIB_HTMLFILES) $(SLACK_APP_HTMLFILES)
@@ -576,6 +579,10 @@ $(SLACK_TESTDIR)/%: $(SLACK_SRCDIR)/%.c $(SLACK_TARGET)
 	@[ -d $(SLACK_TESTDIR) ] || mkdir $(SLACK_TESTDIR) 2>/dev/null || [ -d $(SLACK_TESTDIR) ]
 	$(CC) -DTEST $(SLACK_TEST_CFLAGS) -o $@ $< $(SLACK_TEST_LDFLAGS)
 
+$(SLACK_BENCH): $(SLACK_SRCDIR)/tools/bench-slack.c $(SLACK_TARGET)
+	@[ -d $(SLACK_TESTDIR) ] || mkdir $(SLACK_TESTDIR) 2>/dev/null || [ -d $(SLACK_TESTDIR) ]
+	$(CC) $(SLACK_TEST_CFLAGS) $(SLACK_CLIENT_CFLAGS) -o $@ $< $(SLACK_TEST_LDFLAGS)
+
 $(SLACK_SRCDIR)/%.$(LIB_MANSECT): $(SLACK_SRCDIR)/%.c
 	$(POD2MAN) --section=$(LIB_MANSECT) --center='$(LIB_MANSECTNAME)' --name=$(shell basename $< .c | tr abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ) --release=$(SLACK_ID) --date=$(SLACK_DATE) --quotes=none $< > $@
 
@@ -0,0 +1,2428 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+
+/*
+
+=head1 NAME
+
+I<libslack(shm)> - shared memory module
+
+=head1 SYNOPSIS
+
+    #include <slack/std.h>
+    #include <slack/shm.h>
+
+    typedef struct Shm Shm;
+    typedef struct ShmList ShmList;
+    typedef struct ShmMap ShmMap;
+    typedef size_t shm_off_t;
+    typedef void shm_map_action_t(const char *key, const void *value, size_t size, void *data);
+
+    Shm *shm_create(const char *name, size_t size, mode_t mode);
+    Shm *shm_attach(const char *name, int writable);
+    Shm *shm_attach_fd(int fd, int writable);
+    void shm_release(Shm *shm);
+    void *shm_destroy(Shm **shm);
+    int shm_fd(const Shm *shm);
+    Locker *shm_locker(const Shm *shm);
+    int shm_rdlock(const Shm *shm);
+    int shm_wrlock(const Shm *shm);
+    int shm_unlock(const Shm *shm);
+    ssize_t shm_size(const Shm *shm);
+    ssize_t shm_used(const Shm *shm);
+    ssize_t shm_used_unlocked(const Shm *shm);
+    shm_off_t shm_alloc(Shm *shm, size_t size);
+    shm_off_t shm_alloc_unlocked(Shm *shm, size_t size);
+    void shm_free(Shm *shm, shm_off_t off);
+    void shm_free_unlocked(Shm *shm, shm_off_t off);
+    void *shm_ptr(const Shm *shm, shm_off_t off);
+    shm_off_t shm_off(const Shm *shm, const void *ptr);
+    shm_off_t shm_root(const Shm *shm);
+    shm_off_t shm_root_unlocked(const Shm *shm);
+    int shm_set_root(Shm *shm, shm_off_t root);
+    int shm_set_root_unlocked(Shm *shm, shm_off_t root);
+    ShmList *shm_list_create(Shm *shm);
+    ShmList *shm_list_create_unlocked(Shm *shm);
+    void shm_list_release(Shm *shm, ShmList *list);
+    void shm_list_release_unlocked(Shm *shm, ShmList *list);
+    ssize_t shm_list_length(const Shm *shm, const ShmList *list);
+    ssize_t shm_list_length_unlocked(const Shm *shm, const ShmList *list);
+    const void *shm_list_item(const Shm *shm, const ShmList *list, ssize_t index, size_t *size);
+    const void *shm_list_item_unlocked(const Shm *shm, const ShmList *list, ssize_t index, size_t *size);
+    int shm_list_append(Shm *shm, ShmList *list, const void *item, size_t size);
+    int shm_list_append_unlocked(Shm *shm, ShmList *list, const void *item, size_t size);
+    int shm_list_remove(Shm *shm, ShmList *list, ssize_t index);
+    int shm_list_remove_unlocked(Shm *shm, ShmList *list, ssize_t index);
+    ShmMap *shm_map_create(Shm *shm, size_t size);
+    ShmMap *shm_map_create_unlocked(Shm *shm, size_t size);
+    void shm_map_release(Shm *shm, ShmMap *map);
+    void shm_map_release_unlocked(Shm *shm, ShmMap *map);
+    ssize_t shm_map_size(const Shm *shm, const ShmMap *map);
+    ssize_t shm_map_size_unlocked(const Shm *shm, const ShmMap *map);
+    const void *shm_map_get(const Shm *shm, const ShmMap *map, const char *key, size_t *size);
+    const void *shm_map_get_unlocked(const Shm *shm, const ShmMap *map, const char *key, size_t *size);
+    int shm_map_put(Shm *shm, ShmMap *map, const char *key, const void *value, size_t size);
+    int shm_map_put_unlocked(Shm *shm, ShmMap *map, const char *key, const void *value, size_t size);
+    int shm_map_remove(Shm *shm, ShmMap *map, const char *key);
+    int shm_map_remove_unlocked(Shm *shm, ShmMap *map, const char *key);
+    int shm_map_apply(const Shm *shm, const ShmMap *map, shm_map_action_t *action, void *data);
+    int shm_map_apply_unlocked(const Shm *shm, const ShmMap *map, shm_map_action_t *action, void *data);
+
+=head1 DESCRIPTION
+
+This module provides shared memory segments that can be mapped by several
+processes, and lists and maps that live entirely inside them. It lets one
+process build a large table once and any number of other processes (e.g.
+pre-forked workers) read it, instead of each process building its own copy.
+
+A segment is a POSIX shared memory object (see I<shm_open(3)>) when it has
+a name. Without a name, it is a I<memfd_create(2)> file (where available)
+whose file descriptor can be passed to other processes, or else an
+anonymous shared mapping that is only inherited by child processes. A
+segment has a fixed size, but its pages are only allocated when they are
+first written, so it can be created as large as the table might need.
+
+Each process may map a segment at a different address, so nothing inside a
+segment refers to anything else with a pointer. Instead, locations in a
+segment are offsets (C<shm_off_t>) from its start. The offset C<0> is never
+allocated and plays the part of C<null>. I<shm_ptr(3)> converts an offset
+into a pointer in the calling process, and I<shm_off(3)> converts back. A
+segment has a root offset (see I<shm_set_root(3)>) where the process that
+builds its contents can leave the offset of the top level list or map for
+other processes to find.
+
+Memory within a segment is allocated with I<shm_alloc(3)> and deallocated
+with I<shm_free(3)>. The allocator keeps its state in the segment, so any
+process with a writable mapping can allocate and deallocate. Sizes are
+rounded up to one of four size classes per power of two (so no more than
+a fifth of an allocation is wasted) and freed blocks are reused for later
+allocations of the same size class. Freed blocks are not coalesced, and
+the space they occupy is not returned to the system.
+
+I<ShmList>s and I<ShmMap>s are the offset-based equivalents of I<List>s and
+I<Map>s. Their items and values are copied into the segment (they are
+arbitrary bytes, so they must not contain pointers either), and map keys
+are nul-terminated strings, copied into the segment too. The items and
+values returned by I<shm_list_item(3)> and I<shm_map_get(3)> point into the
+segment and remain valid until they are removed or replaced.
+
+Every segment contains a process-shared reader/writer lock, and each
+writable mapping has a I<Locker> for it (see I<shm_locker(3)>). All
+functions whose names don't end with C<_unlocked> claim it, so any number of
+processes and threads can read and write the same segment. A segment mapped
+read-only can't be locked (claiming the lock writes to it), so its readers
+don't lock at all. That is the fastest way to read a table that is
+complete and will no longer change.
+
+=over 4
+
+=cut
+
+*/
+
+#ifndef _BSD_SOURCE
+#define _BSD_SOURCE /* For MAP_ANONYMOUS */
+#endif
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE /* New name for _BSD_SOURCE */
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* For memfd_create() on Linux */
+#endif
+
+#include "config.h"
+#include "std.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "shm.h"
+#include "mem.h"
+#include "err.h"
+#include "locker.h"
+
+/* Identifies an initialised segment: "slackshm" */
+
+#define SHM_MAGIC 0x736c61636b73686dULL
+
+/* Alignment of allocated memory */
+
+#define SHM_ALIGN 16
+
+/* Number of allocator size classes (four per power of two) */
+
+#define SHM_CLASSES 256
+
+/* Initial number of items in an ShmList */
+
+#define SHM_LIST_SIZE 4
+
+typedef struct ShmSegment ShmSegment;
+typedef struct ShmMapping ShmMapping;
+
+struct ShmSegment
+{
+	unsigned long long magic;       /* identifies an initialised segment */
+	size_t size;                    /* the size of the segment */
+	size_t brk;                     /* the offset of the unallocated space */
+	size_t used;                    /* the number of bytes in allocated blocks */
+	shm_off_t root;                 /* the offset of the top level object */
+	pthread_rwlock_t rwlock;        /* process-shared lock for the segment */
+	shm_off_t free[SHM_CLASSES];    /* lists of free blocks by size class */
+};
+
+struct Shm
+{
+	ShmSegment *segment;     /* the segment mapped into this process */
+	size_t size;             /* the size of the mapping */
+	int fd;                  /* the segment's file descriptor (or -1) */
+	int writable;            /* is the mapping writable? */
+	Locker *locker;          /* locking strategy for the segment */
+};
+
+struct ShmList
+{
+	size_t length;           /* number of items in the list */
+	size_t size;             /* number of slots in the vector */
+	shm_off_t list;          /* offset of the vector of item offsets */
+};
+
+struct ShmMap
+{
+	size_t size;             /* number of buckets */
+	size_t items;            /* number of mappings */
+	shm_off_t table;         /* offset of the vector of bucket offsets */
+};
+
+struct ShmMapping
+{
+	shm_off_t next;          /* offset of the next mapping in the bucket */
+	size_t hash;             /* the hash of the key (not reduced) */
+	size_t length;           /* the size of the value */
+	size_t value;            /* position of the value within this block */
+};
+
+#ifndef TEST
+
+/* Increasing sequence of valid (i.e. prime) table sizes to choose from. */
+
+static const size_t table_sizes[] =
+{
+	11, 23, 47, 101, 199, 401, 797, 1601, 3203, 6397, 12799, 25601,
+	51199, 102397, 204803, 409597, 819187, 1638431, 3276799, 6553621,
+	13107197, 26214401, 52428799, 104857601, 209715263, 419430419
+};
+
+static const size_t num_table_sizes = sizeof(table_sizes) / sizeof(table_sizes[0]);
+
+/* Average bucket length threshold that must be reached before a map grows */
+
+static const size_t table_resize_factor = 2;
+
+#define BASE(shm) ((char *)(shm)->segment)
+#define PTR(shm, off) ((void *)(BASE(shm) + (off)))
+#define BLOCK_SIZE(shm, off) (*(size_t *)(BASE(shm) + (off) - sizeof(size_t)))
+#define OFFSETS(shm, off) ((shm_off_t *)PTR(shm, off))
+#define MAPPING(shm, off) ((ShmMapping *)PTR(shm, off))
+#define MAPPING_KEY(mapping) ((char *)((mapping) + 1))
+#define MAPPING_VALUE(mapping) ((char *)(mapping) + (mapping)->value)
+
+#define shm_rdlock(shm) ((shm) ? locker_rdlock((shm)->locker) : EINVAL)
+#define shm_wrlock(shm) ((shm) ? locker_wrlock((shm)->locker) : EINVAL)
+#define shm_unlock(shm) ((shm) ? locker_unlock((shm)->locker) : EINVAL)
+
+/*
+
+C<size_t size_class(size_t size, size_t *rounded)>
+
+Returns the allocator size class for a block of C<size> bytes (including
+its header), and stores the size of the blocks in that class in
+C<*rounded>. There are four size classes for each power of two, so blocks
+are never more than a quarter bigger than needed (after rounding up to
+C<SHM_ALIGN>).
+
+*/
+
+static size_t size_class(size_t size, size_t *rounded)
+{
+	size_t bits, step;
+
+	size = (size + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+
+	if (size <= 4 * SHM_ALIGN)
+	{
+		*rounded = size;
+		return size / SHM_ALIGN - 1;
+	}
+
+	for (bits = 6; ((size_t)1 << (bits + 1)) < size; ++bits)
+	{}
+
+	step = (size_t)1 << (bits - 2);
+	*rounded = (size + step - 1) & ~(step - 1);
+
+	return 4 + (bits - 6) * 4 + (*rounded - ((size_t)1 << bits)) / step - 1;
+}
+
+/*
+
+C<Shm *segment_map(int fd, size_t size, int writable)>
+
+Maps C<size> bytes of the shared memory object C<fd> (or anonymous shared
+memory if C<fd> is C<-1>) into the calling process, and creates a handle
+for it. The handle takes ownership of C<fd>. On success, returns the new
+handle. On error, returns C<null> with C<errno> set appropriately, and
+C<fd> is closed.
+
+*/
+
+static Shm *segment_map(int fd, size_t size, int writable)
+{
+	Shm *shm;
+	void *addr;
+	int err;
+
+	addr = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, (fd == -1) ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED, fd, 0);
+
+	if (addr == MAP_FAILED)
+	{
+		err = errno;
+
+		if (fd != -1)
+			close(fd);
+
+		return set_errnull(err);
+	}
+
+	if (!(shm = mem_new(Shm))) /* XXX decouple */
+	{
+		err = errno;
+		munmap(addr, size);
+
+		if (fd != -1)
+			close(fd);
+
+		return set_errnull(err);
+	}
+
+	shm->segment = addr;
+	shm->size = size;
+	shm->fd = fd;
+	shm->writable = writable;
+	shm->locker = NULL;
+
+	if (writable && !(shm->locker = locker_create_rwlock(&shm->segment->rwlock)))
+	{
+		err = errno;
+		shm_release(shm);
+		return set_errnull(err);
+	}
+
+	return shm;
+}
+
+/*
+
+=item C<Shm *shm_create(const char *name, size_t size, mode_t mode)>
+
+Creates a shared memory segment of C<size> bytes and maps it into the
+calling process. If C<name> is not C<null>, it is the name of a new POSIX
+shared memory object to create with permissions C<mode> (see
+I<shm_open(3)>). Other processes can map it with I<shm_attach(3)>. It
+persists until it is removed with I<shm_unlink(3)>. If C<name> is
+C<null>, C<mode> is ignored and the segment is an anonymous
+I<memfd_create(2)> file (where available) whose file descriptor (see
+I<shm_fd(3)>) can be passed to other processes over a UNIX domain socket
+and mapped with I<shm_attach_fd(3)>. Either way, child processes created
+after this call inherit the mapping and can use the handle directly. The
+file descriptor is close-on-exec.
+
+The first few kilobytes of the segment are used for its header and the
+allocator's state. The rest is available to I<shm_alloc(3)>. Pages are only
+allocated when they are first written to, so C<size> can be generous. It
+is the caller's responsibility to deallocate the handle with
+I<shm_release(3)> or I<shm_destroy(3)>. On success, returns the new handle.
+On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Shm *shm_create(const char *name, size_t size, mode_t mode)
+{
+	pthread_rwlockattr_t attr;
+	ShmSegment *segment;
+	Shm *shm;
+	int fd = -1;
+	int err;
+
+	if (size <= sizeof(ShmSegment) + SHM_ALIGN)
+		return set_errnull(EINVAL);
+
+	if (name)
+	{
+		if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode)) == -1)
+			return NULL;
+
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+#ifdef MFD_CLOEXEC
+	else if ((fd = memfd_create("libslack-shm", MFD_CLOEXEC)) == -1)
+		return NULL;
+#endif
+
+	if (fd != -1 && ftruncate(fd, size) == -1)
+	{
+		err = errno;
+		close(fd);
+
+		if (name)
+			shm_unlink(name);
+
+		return set_errnull(err);
+	}
+
+	if (!(shm = segment_map(fd, size, 1)))
+	{
+		if (name)
+		{
+			err = errno;
+			shm_unlink(name);
+			errno = err;
+		}
+
+		return NULL;
+	}
+
+	segment = shm->segment;
+	segment->size = size;
+	segment->brk = ((sizeof(ShmSegment) + sizeof(size_t) + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1)) - sizeof(size_t);
+	segment->used = 0;
+	segment->root = 0;
+	memset(segment->free, 0, sizeof(segment->free));
+
+	if ((err = pthread_rwlockattr_init(&attr)))
+		goto failed;
+
+	if ((err = pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED)) || (err = pthread_rwlock_init(&segment->rwlock, &attr)))
+	{
+		pthread_rwlockattr_destroy(&attr);
+		goto failed;
+	}
+
+	pthread_rwlockattr_destroy(&attr);
+	segment->magic = SHM_MAGIC;
+
+	return shm;
+
+failed:
+	shm_release(shm);
+
+	if (name)
+		shm_unlink(name);
+
+	return set_errnull(err);
+}
+
+/*
+
+=item C<Shm *shm_attach(const char *name, int writable)>
+
+Maps the existing shared memory segment called C<name> (created by
+I<shm_create(3)>) into the calling process. If C<writable> is non-zero, the
+segment is mapped for reading and writing, and the segment's lock is used
+to synchronise with other processes. Otherwise, the segment is mapped
+read-only, functions that would modify it fail with C<EPERM>, and the
+segment isn't locked at all, so the segment should no longer be modified
+by anyone. It is the caller's responsibility to deallocate the handle with
+I<shm_release(3)> or I<shm_destroy(3)>. On success, returns the new handle.
+On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Shm *shm_attach(const char *name, int writable)
+{
+	Shm *shm;
+	int fd;
+	int err;
+
+	if (!name)
+		return set_errnull(EINVAL);
+
+	if ((fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0)) == -1)
+		return NULL;
+
+	shm = shm_attach_fd(fd, writable);
+	err = errno;
+	close(fd);
+	errno = err;
+
+	return shm;
+}
+
+/*
+
+=item C<Shm *shm_attach_fd(int fd, int writable)>
+
+Equivalent to I<shm_attach(3)> except that the segment is identified by the
+file descriptor C<fd> (e.g. received from the process that created it). The
+handle uses a duplicate of C<fd>, so the caller may close C<fd> afterwards.
+
+=cut
+
+*/
+
+Shm *shm_attach_fd(int fd, int writable)
+{
+	struct stat status[1];
+	Shm *shm;
+	int dupfd;
+
+	if (fd < 0)
+		return set_errnull(EINVAL);
+
+	if (fstat(fd, status) == -1)
+		return NULL;
+
+	if (status->st_size <= (off_t)sizeof(ShmSegment))
+		return set_errnull(EINVAL);
+
+	if ((dupfd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1)
+		return NULL;
+
+	if (!(shm = segment_map(dupfd, (size_t)status->st_size, writable)))
+		return NULL;
+
+	if (shm->segment->magic != SHM_MAGIC || shm->segment->size != shm->size)
+	{
+		shm_release(shm);
+		return set_errnull(EINVAL);
+	}
+
+	return shm;
+}
+
+/*
+
+=item C<void shm_release(Shm *shm)>
+
+Unmaps the segment from the calling process and releases (deallocates)
+C<shm>. The segment itself remains for any other processes that have it
+mapped. A named segment also remains until it is removed with
+I<shm_unlink(3)>.
+
+=cut
+
+*/
+
+void shm_release(Shm *shm)
+{
+	if (!shm)
+		return;
+
+	locker_release(shm->locker);
+	munmap((void *)shm->segment, shm->size);
+
+	if (shm->fd != -1)
+		close(shm->fd);
+
+	mem_release(shm);
+}
+
+/*
+
+=item C<void *shm_destroy(Shm **shm)>
+
+Destroys (unmaps, deallocates and sets to C<null>) C<*shm>. Returns
+C<null>.
+
+=cut
+
+*/
+
+void *shm_destroy(Shm **shm)
+{
+	if (shm && *shm)
+	{
+		shm_release(*shm);
+		*shm = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int shm_fd(const Shm *shm)>
+
+Returns the file descriptor for the segment mapped by C<shm>, or C<-1> if it
+is an anonymous mapping without one. On error, returns C<-1> with C<errno>
+set appropriately.
+
+=cut
+
+*/
+
+int shm_fd(const Shm *shm)
+{
+	if (!shm)
+		return set_errno(EINVAL);
+
+	return shm->fd;
+}
+
+/*
+
+=item C<Locker *shm_locker(const Shm *shm)>
+
+Returns the I<Locker> for the process-shared reader/writer lock in the
+segment mapped by C<shm>, or C<null> if it was mapped read-only. It belongs
+to C<shm> and must not be released by the caller. It can be used to
+synchronise access to other data in the segment that is accessed via
+I<shm_ptr(3)>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+Locker *shm_locker(const Shm *shm)
+{
+	if (!shm)
+		return set_errnull(EINVAL);
+
+	return shm->locker;
+}
+
+/*
+
+=item C<int shm_rdlock(const Shm *shm)>
+
+Claims a read lock on the segment mapped by C<shm> (unless it was mapped
+read-only). This is needed when multiple read-only I<shm(3)> module
+functions need to be called atomically. It is the client's responsibility
+to call I<shm_unlock(3)> after the atomic operation. The only functions
+that may be called on C<shm> between calls to I<shm_rdlock(3)> and
+I<shm_unlock(3)> are any read-only I<shm(3)> module functions whose name
+ends with C<_unlocked>, and I<shm_ptr(3)> and I<shm_off(3)>. On success,
+returns C<0>. On error, returns an error code.
+
+=cut
+
+*/
+
+int (shm_rdlock)(const Shm *shm)
+{
+	return shm_rdlock(shm);
+}
+
+/*
+
+=item C<int shm_wrlock(const Shm *shm)>
+
+Claims a write lock on the segment mapped by C<shm>. This is needed when
+multiple read/write I<shm(3)> module functions need to be called
+atomically (e.g. when building a large map, it is much faster to claim the
+write lock once and call I<shm_map_put_unlocked(3)> for each item). It is
+the client's responsibility to call I<shm_unlock(3)> after the atomic
+operation. The only functions that may be called on C<shm> between calls
+to I<shm_wrlock(3)> and I<shm_unlock(3)> are any I<shm(3)> module functions
+whose name ends with C<_unlocked>, and I<shm_ptr(3)> and I<shm_off(3)>. On
+success, returns C<0>. On error, returns an error code.
+
+=cut
+
+*/
+
+int (shm_wrlock)(const Shm *shm)
+{
+	return shm_wrlock(shm);
+}
+
+/*
+
+=item C<int shm_unlock(const Shm *shm)>
+
+Unlocks a read or write lock on the segment mapped by C<shm> obtained with
+I<shm_rdlock(3)> or I<shm_wrlock(3)>. On success, returns C<0>. On error,
+returns an error code.
+
+=cut
+
+*/
+
+int (shm_unlock)(const Shm *shm)
+{
+	return shm_unlock(shm);
+}
+
+/*
+
+=item C<ssize_t shm_size(const Shm *shm)>
+
+Returns the size of the segment mapped by C<shm>. On error, returns C<-1>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t shm_size(const Shm *shm)
+{
+	if (!shm)
+		return set_errno(EINVAL);
+
+	return shm->size;
+}
+
+/*
+
+=item C<ssize_t shm_used(const Shm *shm)>
+
+Returns the number of bytes in the blocks that are currently allocated in
+the segment mapped by C<shm>, including the allocator's per-block overhead.
+On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t shm_used(const Shm *shm)
+{
+	ssize_t used;
+	int err;
+
+	if (!shm)
+		return set_errno(EINVAL);
+
+	if ((err = shm_rdlock(shm)))
+		return set_errno(err);
+
+	used = shm_used_unlocked(shm);
+
+	if ((err = shm_unlock(shm)))
+		return set_errno(err);
+
+	return used;
+}
+
+/*
+
+=item C<ssize_t shm_used_unlocked(const Shm *shm)>
+
+Equivalent to I<shm_used(3)> except that the segment is not read-locked.
+
+=cut
+
+*/
+
+ssize_t shm_used_unlocked(const Shm *shm)
+{
+	if (!shm)
+		return set_errno(EINVAL);
+
+	return shm->segment->used;
+}
+
+/*
+
+=item C<shm_off_t shm_alloc(Shm *shm, size_t size)>
+
+Allocates C<size> bytes in the segment mapped by C<shm>. The memory is
+aligned for any type, and is not initialised. It is the caller's
+responsibility to deallocate it with I<shm_free(3)>. Use I<shm_ptr(3)> to
+access it. On success, returns the offset of the new memory. On error,
+returns C<0> with C<errno> set appropriately (C<ENOSPC> when the segment is
+full).
+
+=cut
+
+*/
+
+shm_off_t shm_alloc(Shm *shm, size_t size)
+{
+	shm_off_t off;
+	int err;
+
+	if (!shm)
+		return errno = EINVAL, 0;
+
+	if ((err = shm_wrlock(shm)))
+		return errno = err, 0;
+
+	off = shm_alloc_unlocked(shm, size);
+
+	if ((err = shm_unlock(shm)))
+		return errno = err, 0;
+
+	return off;
+}
+
+/*
+
+=item C<shm_off_t shm_alloc_unlocked(Shm *shm, size_t size)>
+
+Equivalent to I<shm_alloc(3)> except that the segment is not write-locked.
+
+=cut
+
+*/
+
+shm_off_t shm_alloc_unlocked(Shm *shm, size_t size)
+{
+	ShmSegment *segment;
+	size_t class, rounded;
+	shm_off_t off;
+
+	if (!shm)
+		return errno = EINVAL, 0;
+
+	if (!shm->writable)
+		return errno = EPERM, 0;
+
+	segment = shm->segment;
+
+	if (size >= segment->size)
+		return errno = ENOSPC, 0;
+
+	class = size_class(size + sizeof(size_t), &rounded);
+
+	if ((off = segment->free[class]))
+		segment->free[class] = *OFFSETS(shm, off);
+	else
+	{
+		if (rounded > segment->size - segment->brk)
+			return errno = ENOSPC, 0;
+
+		off = segment->brk + sizeof(size_t);
+		segment->brk += rounded;
+	}
+
+	BLOCK_SIZE(shm, off) = size;
+	segment->used += rounded;
+
+	return off;
+}
+
+/*
+
+=item C<void shm_free(Shm *shm, shm_off_t off)>
+
+Deallocates the memory at C<off> in the segment mapped by C<shm>, which
+must have been returned by I<shm_alloc(3)>. If C<off> is C<0>, does nothing.
+On error, sets C<errno> appropriately.
+
+=cut
+
+*/
+
+void shm_free(Shm *shm, shm_off_t off)
+{
+	int err;
+
+	if (!shm)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((err = shm_wrlock(shm)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	shm_free_unlocked(shm, off);
+
+	if ((err = shm_unlock(shm)))
+		set_errno(err);
+}
+
+/*
+
+=item C<void shm_free_unlocked(Shm *shm, shm_off_t off)>
+
+Equivalent to I<shm_free(3)> except that the segment is not write-locked.
+
+=cut
+
+*/
+
+void shm_free_unlocked(Shm *shm, shm_off_t off)
+{
+	size_t class, rounded;
+
+	if (!shm || off >= shm->size)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if (!off)
+		return;
+
+	if (!shm->writable)
+	{
+		set_errno(EPERM);
+		return;
+	}
+
+	class = size_class(BLOCK_SIZE(shm, off) + sizeof(size_t), &rounded);
+	*OFFSETS(shm, off) = shm->segment->free[class];
+	shm->segment->free[class] = off;
+	shm->segment->used -= rounded;
+}
+
+/*
+
+=item C<void *shm_ptr(const Shm *shm, shm_off_t off)>
+
+Returns a pointer to the memory at offset C<off> in the segment mapped by
+C<shm> in the calling process. If C<off> is C<0>, returns C<null>. On error,
+returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+void *shm_ptr(const Shm *shm, shm_off_t off)
+{
+	if (!shm || off >= shm->size)
+		return set_errnull(EINVAL);
+
+	return (off) ? PTR(shm, off) : NULL;
+}
+
+/*
+
+=item C<shm_off_t shm_off(const Shm *shm, const void *ptr)>
+
+Returns the offset of C<ptr> in the segment mapped by C<shm>. If C<ptr> is
+C<null>, returns C<0>. On error (including when C<ptr> is not in the
+segment), returns C<0> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+shm_off_t shm_off(const Shm *shm, const void *ptr)
+{
+	if (!shm)
+		return errno = EINVAL, 0;
+
+	if (!ptr)
+		return 0;
+
+	if ((const char *)ptr < BASE(shm) || (const char *)ptr >= BASE(shm) + shm->size)
+		return errno = EINVAL, 0;
+
+	return (const char *)ptr - BASE(shm);
+}
+
+/*
+
+=item C<shm_off_t shm_root(const Shm *shm)>
+
+Returns the root offset of the segment mapped by C<shm> (see
+I<shm_set_root(3)>). On error, returns C<0> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+shm_off_t shm_root(const Shm *shm)
+{
+	shm_off_t root;
+	int err;
+
+	if (!shm)
+		return errno = EINVAL, 0;
+
+	if ((err = shm_rdlock(shm)))
+		return errno = err, 0;
+
+	root = shm_root_unlocked(shm);
+
+	if ((err = shm_unlock(shm)))
+		return errno = err, 0;
+
+	return root;
+}
+
+/*
+
+=item C<shm_off_t shm_root_unlocked(const Shm *shm)>
+
+Equivalent to I<shm_root(3)> except that the segment is not read-locked.
+
+=cut
+
+*/
+
+shm_off_t shm_root_unlocked(const Shm *shm)
+{
+	if (!shm)
+		return errno = EINVAL, 0;
+
+	return shm->segment->root;
+}
+
+/*
+
+=item C<int shm_set_root(Shm *shm, shm_off_t root)>
+
+Sets the root offset of the segment mapped by C<shm> to C<root>. This is
+where the process that builds the segment's contents leaves the offset of
+its top level object (e.g. an I<ShmMap>) for other processes to find with
+I<shm_root(3)>. The root offset of a new segment is C<0>. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int shm_set_root(Shm *shm, shm_off_t root)
+{
+	int ret;
+	int err;
+
+	if (!shm)
+		return set_errno(EINVAL);
+
+	if ((err = shm_wrlock(shm)))
+		return set_errno(err);
+
+	ret = shm_set_root_unlocked(shm, root);
+
+	if ((err = shm_unlock(shm)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int shm_set_root_unlocked(Shm *shm, shm_off_t root)>
+
+Equivalent to I<shm_set_root(3)> except that the segment is not
+write-locked.
+
+=cut
+
+*/
+
+int shm_set_root_unlocked(Shm *shm, shm_off_t root)
+{
+	if (!shm || root >= shm->size)
+		return set_errno(EINVAL);
+
+	if (!shm->writable)
+		return set_errno(EPERM);
+
+	shm->segment->root = root;
+
+	return 0;
+}
+
+/*
+
+=item C<ShmList *shm_list_create(Shm *shm)>
+
+Creates an empty I<ShmList> in the segment mapped by C<shm>. Its items are
+byte strings of any size that are copied into the segment. It is the
+caller's responsibility to deallocate the new list with
+I<shm_list_release(3)>. Use I<shm_off(3)> to obtain its offset, so that
+other processes can find it (e.g. with I<shm_set_root(3)>). On success,
+returns the new list. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+ShmList *shm_list_create(Shm *shm)
+{
+	ShmList *list;
+	int err;
+
+	if (!shm)
+		return set_errnull(EINVAL);
+
+	if ((err = shm_wrlock(shm)))
+		return set_errnull(err);
+
+	list = shm_list_create_unlocked(shm);
+
+	if ((err = shm_unlock(shm)))
+		return set_errnull(err);
+
+	return list;
+}
+
+/*
+
+=item C<ShmList *shm_list_create_unlocked(Shm *shm)>
+
+Equivalent to I<shm_list_create(3)> except that the segment is not
+write-locked.
+
+=cut
+
+*/
+
+ShmList *shm_list_create_unlocked(Shm *shm)
+{
+	ShmList *list;
+	shm_off_t off;
+
+	if (!(off = shm_alloc_unlocked(shm, sizeof(ShmList))))
+		return NULL;
+
+	list = PTR(shm, off);
+	list->length = list->size = 0;
+	list->list = 0;
+
+	return list;
+}
+
+/*
+
+=item C<void shm_list_release(Shm *shm, ShmList *list)>
+
+Releases (deallocates) C<list> and its items in the segment mapped by
+C<shm>. On error, sets C<errno> appropriately.
+
+=cut
+
+*/
+
+void shm_list_release(Shm *shm, ShmList *list)
+{
+	int err;
+
+	if (!shm || !list)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((err = shm_wrlock(shm)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	shm_list_release_unlocked(shm, list);
+
+	if ((err = shm_unlock(shm)))
+		set_errno(err);
+}
+
+/*
+
+=item C<void shm_list_release_unlocked(Shm *shm, ShmList *list)>
+
+Equivalent to I<shm_list_release(3)> except that the segment is not
+write-locked.
+
+=cut
+
+*/
+
+void shm_list_release_unlocked(Shm *shm, ShmList *list)
+{
+	size_t i;
+
+	if (!shm || !list)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if (!shm->writable)
+	{
+		set_errno(EPERM);
+		return;
+	}
+
+	for (i = 0; i < list->length; ++i)
+		shm_free_unlocked(shm, OFFSETS(shm, list->list)[i]);
+
+	shm_free_unlocked(shm, list->list);
+	shm_free_unlocked(shm, shm_off(shm, list));
+}
+
+/*
+
+=item C<ssize_t shm_list_length(const Shm *shm, const ShmList *list)>
+
+Returns the number of items in C<list> in the segment mapped by C<shm>. On
+error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t shm_list_length(const Shm *shm, const ShmList *list)
+{
+	ssize_t length;
+	int err;
+
+	if (!shm || !list)
+		return set_errno(EINVAL);
+
+	if ((err = shm_rdlock(shm)))
+		return set_errno(err);
+
+	length = shm_list_length_unlocked(shm, list);
+
+	if ((err = shm_unlock(shm)))
+		return set_errno(err);
+
+	return length;
+}
+
+/*
+
+=item C<ssize_t shm_list_length_unlocked(const Shm *shm, const ShmList *list)>
+
+Equivalent to I<shm_list_length(3)> except that the segment is not
+read-locked.
+
+=cut
+
+*/
+
+ssize_t shm_list_length_unlocked(const Shm *shm, const ShmList *list)
+{
+	if (!shm || !list)
+		return set_errno(EINVAL);
+
+	return list->length;
+}
+
+/*
+
+=item C<const void *shm_list_item(const Shm *shm, const ShmList *list, ssize_t index, size_t *size)>
+
+Returns the C<index>'th item in C<list> in the segment mapped by C<shm>,
+and stores its size in C<*size> (if C<size> is not C<null>). The item
+remains valid until it is removed or the list is released. On error,
+returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+const void *shm_list_item(const Shm *shm, const ShmList *list, ssize_t index, size_t *size)
+{
+	const void *item;
+	int err;
+
+	if (!shm || !list)
+		return set_errnull(EINVAL);
+
+	if ((err = shm_rdlock(shm)))
+		return set_errnull(err);
+
+	item = shm_list_item_unlocked(shm, list, index, size);
+
+	if ((err = shm_unlock(shm)))
+		return set_errnull(err);
+
+	return item;
+}
+
+/*
+
+=item C<const void *shm_list_item_unlocked(const Shm *shm, const ShmList *list, ssize_t index, size_t *size)>
+
+Equivalent to I<shm_list_item(3)> except that the segment is not
+read-locked.
+
+=cut
+
+*/
+
+const void *shm_list_item_unlocked(const Shm *shm, const ShmList *list, ssize_t index, size_t *size)
+{
+	shm_off_t off;
+
+	if (!shm || !list || index < 0 || (size_t)index >= list->length)
+		return set_errnull(EINVAL);
+
+	off = OFFSETS(shm, list->list)[index];
+
+	if (size)
+		*size = BLOCK_SIZE(shm, off);
+
+	return PTR(shm, off);
+}
+
+/*
+
+=item C<int shm_list_append(Shm *shm, ShmList *list, const void *item, size_t size)>
+
+Appends a copy of the C<size> bytes at C<item> to C<list> in the segment
+mapped by C<shm>. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+=cut
+
+*/
+
+int shm_list_append(Shm *shm, ShmList *list, const void *item, size_t size)
+{
+	int ret;
+	int err;
+
+	if (!shm || !list)
+		return set_errno(EINVAL);
+
+	if ((err = shm_wrlock(shm)))
+		return set_errno(err);
+
+	ret = shm_list_append_unlocked(shm, list, item, size);
+
+	if ((err = shm_unlock(shm)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int shm_list_append_unlocked(Shm *shm, ShmList *list, const void *item, size_t size)>
+
+Equivalent to I<shm_list_append(3)> except that the segment is not
+write-locked.
+
+=cut
+
+*/
+
+int shm_list_append_unlocked(Shm *shm, ShmList *list, const void *item, size_t size)
+{
+	shm_off_t off;
+
+	if (!shm || !list || (!item && size))
+		return set_errno(EINVAL);
+
+	if (list->length == list->size)
+	{
+		size_t new_size = (list->size) ? list->size * 2 : SHM_LIST_SIZE;
+		shm_off_t vector;
+
+		if (!(vector = shm_alloc_unlocked(shm, new_size * sizeof(shm_off_t))))
+			return -1;
+
+		if (list->length)
+			memcpy(PTR(shm, vector), PTR(shm, list->list), list->length * sizeof(shm_off_t));
+
+		shm_free_unlocked(shm, list->list);
+		list->list = vector;
+		list->size = new_size;
+	}
+
+	if (!(off = shm_alloc_unlocked(shm, size)))
+		return -1;
+
+	if (size)
+		memcpy(PTR(shm, off), item, size);
+
+	OFFSETS(shm, list->list)[list->length++] = off;
+
+	return 0;
+}
+
+/*
+
+=item C<int shm_list_remove(Shm *shm, ShmList *list, ssize_t index)>
+
+Removes and deallocates the C<index>'th item in C<list> in the segment
+mapped by C<shm>. The following items are moved down. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int shm_list_remove(Shm *shm, ShmList *list, ssize_t index)
+{
+	int ret;
+	int err;
+
+	if (!shm || !list)
+		return set_errno(EINVAL);
+
+	if ((err = shm_wrlock(shm)))
+		return set_errno(err);
+
+	ret = shm_list_remove_unlocked(shm, list, index);
+
+	if ((err = shm_unlock(shm)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int shm_list_remove_unlocked(Shm *shm, ShmList *list, ssize_t index)>
+
+Equivalent to I<shm_list_remove(3)> except that the segment is not
+write-locked.
+
+=cut
+
+*/
+
+int shm_list_remove_unlocked(Shm *shm, ShmList *list, ssize_t index)
+{
+	shm_off_t *vector;
+
+	if (!shm || !list || index < 0 || (size_t)index >= list->length)
+		return set_errno(EINVAL);
+
+	if (!shm->writable)
+		return set_errno(EPERM);
+
+	vector = OFFSETS(shm, list->list);
+	shm_free_unlocked(shm, vector[index]);
+	memmove(vector + index, vector + index + 1, (--list->length - index) * sizeof(shm_off_t));
+
+	return 0;
+}
+
+/*
+
+C<size_t hash(const char *key)>
+
+Hash function from The Practice of Programming by Kernighan and Pike (p57),
+as used by I<map(3)>. Returns the hash of C<key> (not reduced to the table
+size, so mappings can move to a bigger table without rehashing their keys).
+
+*/
+
+static size_t hash(const char *key)
+{
+	const unsigned char *k = (const unsigned char *)key;
+	size_t h = 0;
+
+	while (*k)
+		h *= 31, h += *k++;
+
+	return h;
+}
+
+/*
+
+C<shm_off_t *map_find(const Shm *shm, const ShmMap *map, const char *key, size_t h)>
+
+Returns the location of the offset of the mapping for C<key> (whose hash is
+C<h>) in C<map>. If there is no such mapping, the offset there is C<0>.
+
+*/
+
+static shm_off_t *map_find(const Shm *shm, const ShmMap *map, const char *key, size_t h)
+{
+	shm_off_t *link = OFFSETS(shm, map->table) + h % map->size;
+	ShmMapping *mapping;
+
+	for (; *link; link = &mapping->next)
+	{
+		mapping = MAPPING(shm, *link);
+
+		if (mapping->hash == h && !strcmp(MAPPING_KEY(mapping), key))
+			break;
+	}
+
+	return link;
+}
+
+/*
+
+C<size_t table_size(size_t size)>
+
+Returns the smallest valid table size that is at least C<size>.
+
+*/
+
+static size_t table_size(size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < num_table_sizes; ++i)
+		if (table_sizes[i] >= size)
+			return table_sizes[i];
+
+	return size | 1;
+}
+
+/*
+
+C<int map_resize(Shm *shm, ShmMap *map)>
+
+Moves the mappings in C<map> into a bigger table. Each mapping stores its
+key's hash, so keys aren't rehashed. On success, returns C<0>. On error,
+returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int map_resize(Shm *shm, ShmMap *map)
+{
+	size_t size = table_size(map->size * 2);
+	shm_off_t table, *old, *new;
+	size_t i;
+
+	if (!(table = shm_alloc_unlocked(shm, size * sizeof(shm_off_t))))
+		return -1;
+
+	old = OFFSETS(shm, map->table);
+	new = OFFSETS(shm, table);
+	memset(new, 0, size * sizeof(shm_off_t));
+
+	for (i = 0; i < map->size; ++i)
+	{
+		while (old[i])
+		{
+			shm_off_t off = old[i];
+			ShmMapping *mapping = MAPPING(shm, off);
+
+			old[i] = mapping->next;
+			mapping->next = new[mapping->hash % size];
+			new[mapping->hash % size] = off;
+		}
+	}
+
+	shm_free_unlocked(shm, map->table);
+	map->table = table;
+	map->size = size;
+
+	return 0;
+}
+
+/*
+
+=item C<ShmMap *shm_map_create(Shm *shm, size_t size)>
+
+Creates an empty I<ShmMap> in the segment mapped by C<shm>, with at least
+C<size> buckets (if C<size> is C<0>, a small default is used). The map
+grows as needed, but when the number of items is known in advance, sizing
+the map for them avoids growing it repeatedly (which leaves a trail of
+freed bucket tables in the segment). Keys are nul-terminated strings, and
+values are byte strings of any size. Both are copied into the segment. It
+is the caller's responsibility to deallocate the new map with
+I<shm_map_release(3)>. Use I<shm_off(3)> to obtain its offset, so that
+other processes can find it (e.g. with I<shm_set_root(3)>). On success,
+returns the new map. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+ShmMap *shm_map_create(Shm *shm, size_t size)
+{
+	ShmMap *map;
+	int err;
+
+	if (!shm)
+		return set_errnull(EINVAL);
+
+	if ((err = shm_wrlock(shm)))
+		return set_errnull(err);
+
+	map = shm_map_create_unlocked(shm, size);
+
+	if ((err = shm_unlock(shm)))
+		return set_errnull(err);
+
+	return map;
+}
+
+/*
+
+=item C<ShmMap *shm_map_create_unlocked(Shm *shm, size_t size)>
+
+Equivalent to I<shm_map_create(3)> except that the segment is not
+write-locked.
+
+=cut
+
+*/
+
+ShmMap *shm_map_create_unlocked(Shm *shm, size_t size)
+{
+	shm_off_t off, table;
+	ShmMap *map;
+
+	if (!shm)
+		return set_errnull(EINVAL);
+
+	size = table_size(size);
+
+	if (size > shm->size / sizeof(shm_off_t))
+		return set_errnull(ENOSPC);
+
+	if (!(off = shm_alloc_unlocked(shm, sizeof(ShmMap))))
+		return NULL;
+
+	if (!(table = shm_alloc_unlocked(shm, size * sizeof(shm_off_t))))
+	{
+		shm_free_unlocked(shm, off);
+		return NULL;
+	}
+
+	memset(PTR(shm, table), 0, size * sizeof(shm_off_t));
+	map = PTR(shm, off);
+	map->size = size;
+	map->items = 0;
+	map->table = table;
+
+	return map;
+}
+
+/*
+
+=item C<void shm_map_release(Shm *shm, ShmMap *map)>
+
+Releases (deallocates) C<map> and its keys and values in the segment mapped
+by C<shm>. On error, sets C<errno> appropriately.
+
+=cut
+
+*/
+
+void shm_map_release(Shm *shm, ShmMap *map)
+{
+	int err;
+
+	if (!shm || !map)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if ((err = shm_wrlock(shm)))
+	{
+		set_errno(err);
+		return;
+	}
+
+	shm_map_release_unlocked(shm, map);
+
+	if ((err = shm_unlock(shm)))
+		set_errno(err);
+}
+
+/*
+
+=item C<void shm_map_release_unlocked(Shm *shm, ShmMap *map)>
+
+Equivalent to I<shm_map_release(3)> except that the segment is not
+write-locked.
+
+=cut
+
+*/
+
+void shm_map_release_unlocked(Shm *shm, ShmMap *map)
+{
+	shm_off_t *table;
+	size_t i;
+
+	if (!shm || !map)
+	{
+		set_errno(EINVAL);
+		return;
+	}
+
+	if (!shm->writable)
+	{
+		set_errno(EPERM);
+		return;
+	}
+
+	table = OFFSETS(shm, map->table);
+
+	for (i = 0; i < map->size; ++i)
+	{
+		while (table[i])
+		{
+			shm_off_t off = table[i];
+
+			table[i] = MAPPING(shm, off)->next;
+			shm_free_unlocked(shm, off);
+		}
+	}
+
+	shm_free_unlocked(shm, map->table);
+	shm_free_unlocked(shm, shm_off(shm, map));
+}
+
+/*
+
+=item C<ssize_t shm_map_size(const Shm *shm, const ShmMap *map)>
+
+Returns the number of mappings in C<map> in the segment mapped by C<shm>.
+On error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+ssize_t shm_map_size(const Shm *shm, const ShmMap *map)
+{
+	ssize_t size;
+	int err;
+
+	if (!shm || !map)
+		return set_errno(EINVAL);
+
+	if ((err = shm_rdlock(shm)))
+		return set_errno(err);
+
+	size = shm_map_size_unlocked(shm, map);
+
+	if ((err = shm_unlock(shm)))
+		return set_errno(err);
+
+	return size;
+}
+
+/*
+
+=item C<ssize_t shm_map_size_unlocked(const Shm *shm, const ShmMap *map)>
+
+Equivalent to I<shm_map_size(3)> except that the segment is not
+read-locked.
+
+=cut
+
+*/
+
+ssize_t shm_map_size_unlocked(const Shm *shm, const ShmMap *map)
+{
+	if (!shm || !map)
+		return set_errno(EINVAL);
+
+	return map->items;
+}
+
+/*
+
+=item C<const void *shm_map_get(const Shm *shm, const ShmMap *map, const char *key, size_t *size)>
+
+Returns the value associated with C<key> in C<map> in the segment mapped by
+C<shm>, and stores its size in C<*size> (if C<size> is not C<null>). The
+value remains valid until it is replaced or removed, or the map is
+released. On error (including when there is no such key), returns C<null>
+with C<errno> set appropriately (C<ENOENT> when there is no such key).
+
+=cut
+
+*/
+
+const void *shm_map_get(const Shm *shm, const ShmMap *map, const char *key, size_t *size)
+{
+	const void *value;
+	int err;
+
+	if (!shm || !map)
+		return set_errnull(EINVAL);
+
+	if ((err = shm_rdlock(shm)))
+		return set_errnull(err);
+
+	value = shm_map_get_unlocked(shm, map, key, size);
+
+	if ((err = shm_unlock(shm)))
+		return set_errnull(err);
+
+	return value;
+}
+
+/*
+
+=item C<const void *shm_map_get_unlocked(const Shm *shm, const ShmMap *map, const char *key, size_t *size)>
+
+Equivalent to I<shm_map_get(3)> except that the segment is not
+read-locked.
+
+=cut
+
+*/
+
+const void *shm_map_get_unlocked(const Shm *shm, const ShmMap *map, const char *key, size_t *size)
+{
+	ShmMapping *mapping;
+	shm_off_t off;
+
+	if (!shm || !map || !key)
+		return set_errnull(EINVAL);
+
+	if (!(off = *map_find(shm, map, key, hash(key))))
+		return set_errnull(ENOENT);
+
+	mapping = MAPPING(shm, off);
+
+	if (size)
+		*size = mapping->length;
+
+	return MAPPING_VALUE(mapping);
+}
+
+/*
+
+=item C<int shm_map_put(Shm *shm, ShmMap *map, const char *key, const void *value, size_t size)>
+
+Maps C<key> to a copy of the C<size> bytes at C<value> in C<map> in the
+segment mapped by C<shm>, replacing (and deallocating) any existing value
+for C<key>. The value is aligned for any type. On success, returns C<0>. On
+error, returns C<-1> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int shm_map_put(Shm *shm, ShmMap *map, const char *key, const void *value, size_t size)
+{
+	int ret;
+	int err;
+
+	if (!shm || !map)
+		return set_errno(EINVAL);
+
+	if ((err = shm_wrlock(shm)))
+		return set_errno(err);
+
+	ret = shm_map_put_unlocked(shm, map, key, value, size);
+
+	if ((err = shm_unlock(shm)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int shm_map_put_unlocked(Shm *shm, ShmMap *map, const char *key, const void *value, size_t size)>
+
+Equivalent to I<shm_map_put(3)> except that the segment is not
+write-locked.
+
+=cut
+
+*/
+
+int shm_map_put_unlocked(Shm *shm, ShmMap *map, const char *key, const void *value, size_t size)
+{
+	ShmMapping *mapping;
+	shm_off_t off, *link;
+	size_t h, length, position;
+
+	if (!shm || !map || !key || (!value && size))
+		return set_errno(EINVAL);
+
+	if (!shm->writable)
+		return set_errno(EPERM);
+
+	length = strlen(key) + 1;
+	position = (sizeof(ShmMapping) + length + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+
+	if (size > shm->size - position)
+		return set_errno(ENOSPC);
+
+	if (!(off = shm_alloc_unlocked(shm, position + size)))
+		return -1;
+
+	h = hash(key);
+	mapping = MAPPING(shm, off);
+	mapping->hash = h;
+	mapping->length = size;
+	mapping->value = position;
+	memcpy(MAPPING_KEY(mapping), key, length);
+
+	if (size)
+		memcpy(MAPPING_VALUE(mapping), value, size);
+
+	if (*(link = map_find(shm, map, key, h)))
+	{
+		shm_off_t old = *link;
+
+		mapping->next = MAPPING(shm, old)->next;
+		*link = off;
+		shm_free_unlocked(shm, old);
+
+		return 0;
+	}
+
+	link = OFFSETS(shm, map->table) + h % map->size;
+	mapping->next = *link;
+	*link = off;
+
+	if (++map->items > map->size * table_resize_factor)
+		map_resize(shm, map);
+
+	return 0;
+}
+
+/*
+
+=item C<int shm_map_remove(Shm *shm, ShmMap *map, const char *key)>
+
+Removes (and deallocates) the mapping for C<key> from C<map> in the segment
+mapped by C<shm>. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately (C<ENOENT> when there is no such key).
+
+=cut
+
+*/
+
+int shm_map_remove(Shm *shm, ShmMap *map, const char *key)
+{
+	int ret;
+	int err;
+
+	if (!shm || !map)
+		return set_errno(EINVAL);
+
+	if ((err = shm_wrlock(shm)))
+		return set_errno(err);
+
+	ret = shm_map_remove_unlocked(shm, map, key);
+
+	if ((err = shm_unlock(shm)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int shm_map_remove_unlocked(Shm *shm, ShmMap *map, const char *key)>
+
+Equivalent to I<shm_map_remove(3)> except that the segment is not
+write-locked.
+
+=cut
+
+*/
+
+int shm_map_remove_unlocked(Shm *shm, ShmMap *map, const char *key)
+{
+	shm_off_t off, *link;
+
+	if (!shm || !map || !key)
+		return set_errno(EINVAL);
+
+	if (!shm->writable)
+		return set_errno(EPERM);
+
+	if (!(off = *(link = map_find(shm, map, key, hash(key)))))
+		return set_errno(ENOENT);
+
+	*link = MAPPING(shm, off)->next;
+	shm_free_unlocked(shm, off);
+	--map->items;
+
+	return 0;
+}
+
+/*
+
+=item C<int shm_map_apply(const Shm *shm, const ShmMap *map, shm_map_action_t *action, void *data)>
+
+Invokes C<action> for each mapping in C<map> in the segment mapped by
+C<shm>. The arguments passed to C<action> are the key, the value, the size
+of the value, and C<data>. C<action> must not modify the segment. On
+success, returns C<0>. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int shm_map_apply(const Shm *shm, const ShmMap *map, shm_map_action_t *action, void *data)
+{
+	int ret;
+	int err;
+
+	if (!shm || !map)
+		return set_errno(EINVAL);
+
+	if ((err = shm_rdlock(shm)))
+		return set_errno(err);
+
+	ret = shm_map_apply_unlocked(shm, map, action, data);
+
+	if ((err = shm_unlock(shm)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int shm_map_apply_unlocked(const Shm *shm, const ShmMap *map, shm_map_action_t *action, void *data)>
+
+Equivalent to I<shm_map_apply(3)> except that the segment is not
+read-locked.
+
+=cut
+
+*/
+
+int shm_map_apply_unlocked(const Shm *shm, const ShmMap *map, shm_map_action_t *action, void *data)
+{
+	const shm_off_t *table;
+	const ShmMapping *mapping;
+	shm_off_t off;
+	size_t i;
+
+	if (!shm || !map || !action)
+		return set_errno(EINVAL);
+
+	table = OFFSETS(shm, map->table);
+
+	for (i = 0; i < map->size; ++i)
+	{
+		for (off = table[i]; off; off = mapping->next)
+		{
+			mapping = MAPPING(shm, off);
+			action(MAPPING_KEY(mapping), MAPPING_VALUE(mapping), mapping->length, data);
+		}
+	}
+
+	return 0;
+}
+
+/*
+
+=back
+
+=head1 ERRORS
+
+On error, C<errno> is set either by an underlying function, or as follows:
+
+=over 4
+
+=item C<EINVAL>
+
+When arguments are C<null> or out of range, or when a segment being
+attached was not created by I<shm_create(3)>.
+
+=item C<ENOSPC>
+
+When there is not enough free space in the segment.
+
+=item C<EPERM>
+
+When trying to modify a segment that was attached read-only.
+
+=item C<ENOENT>
+
+When a key is not in an I<ShmMap>.
+
+=back
+
+=head1 MT-Level
+
+I<MT-Safe> (between threads and between processes) for segments mapped for
+writing, except for functions whose names end with C<_unlocked>. Segments
+mapped read-only are not locked, so they are only I<MT-Safe> when nothing
+modifies them.
+
+=head1 CAVEATS
+
+The lock is not robust. If a process dies while holding it, other
+processes will wait for it forever.
+
+Each process maps the whole segment, so a 32-bit process can't map a
+segment bigger than its free address space.
+
+The items and values in a segment are only usable by processes that agree
+on their layout (i.e. the same program, or programs compiled with the same
+definitions on the same platform).
+
+=head1 EXAMPLES
+
+Build a table in the parent process and read it in pre-forked workers:
+
+    #include <slack/std.h>
+    #include <slack/shm.h>
+    #include <sys/wait.h>
+
+    int main()
+    {
+        Shm *shm;
+        ShmMap *map;
+        char key[32];
+        int i;
+
+        if (!(shm = shm_create(NULL, 1024 * 1024 * 1024, 0)))
+            return EXIT_FAILURE;
+
+        if (!(map = shm_map_create(shm, 1000000)))
+            return EXIT_FAILURE;
+
+        shm_wrlock(shm);
+
+        for (i = 0; i < 1000000; ++i)
+        {
+            snprintf(key, sizeof key, "key%d", i);
+            shm_map_put_unlocked(shm, map, key, &i, sizeof i);
+        }
+
+        shm_unlock(shm);
+
+        for (i = 0; i < 4; ++i)
+        {
+            if (fork() == 0)
+            {
+                const int *value = shm_map_get(shm, map, "key1234", NULL);
+
+                printf("%d\n", value ? *value : -1); // prints 1234
+                _exit(EXIT_SUCCESS);
+            }
+        }
+
+        while (wait(NULL) != -1)
+        {}
+
+        shm_destroy(&shm);
+
+        return EXIT_SUCCESS;
+    }
+
+Share a table between unrelated processes:
+
+    #include <slack/std.h>
+    #include <slack/shm.h>
+
+    int build(void)
+    {
+        Shm *shm = shm_create("/table", 64 * 1024 * 1024, 0600);
+        ShmMap *map = shm_map_create(shm, 0);
+
+        shm_map_put(shm, map, "answer", "42", 3);
+        shm_set_root(shm, shm_off(shm, map));
+        shm_destroy(&shm);
+
+        return 0;
+    }
+
+    int lookup(void)
+    {
+        Shm *shm = shm_attach("/table", 0);
+        ShmMap *map = shm_ptr(shm, shm_root(shm));
+
+        printf("%s\n", (const char *)shm_map_get(shm, map, "answer", NULL));
+        shm_destroy(&shm);
+
+        return 0;
+    }
+
+    int main()
+    {
+        build();
+        lookup();
+        shm_unlink("/table");
+
+        return EXIT_SUCCESS;
+    }
+
+=head1 SEE ALSO
+
+I<libslack(3)>,
+I<list(3)>,
+I<map(3)>,
+I<locker(3)>,
+I<mem(3)>,
+I<shm_open(3)>,
+I<shm_unlink(3)>,
+I<memfd_create(2)>,
+I<mmap(2)>,
+I<pthread_rwlockattr_setpshared(3)>
+
+=head1 AUTHOR
+
+20230824 raf <raf@raf.org>
+
+=cut
+
+*/
+
+#endif
+
+#ifdef TEST
+
+#include <sys/wait.h>
+
+#define TEST_ACT(i, action) \
+	if (!(action)) \
+		++errors, printf("Test%d: %s failed\n", (i), (#action));
+
+#define TEST_EQ(i, action, value) \
+	if ((val = (action)) != (value)) \
+		++errors, printf("Test%d: %s failed (returned %d, not %d)\n", (i), (#action), (int)val, (int)(value));
+
+static void sum_action(const char *key, const void *value, size_t size, void *data)
+{
+	if (size == sizeof(int))
+		*(long *)data += *(const int *)value;
+}
+
+/* Checks that map holds key%d -> %d for 0 <= i < n */
+
+static int check_map(const Shm *shm, const ShmMap *map, int n)
+{
+	char key[32];
+	const int *value;
+	size_t size;
+	int i;
+
+	if (shm_map_size(shm, map) != n)
+		return 0;
+
+	for (i = 0; i < n; ++i)
+	{
+		snprintf(key, sizeof key, "key%d", i);
+
+		if (!(value = shm_map_get(shm, map, key, &size)) || size != sizeof(int) || *value != i)
+			return 0;
+	}
+
+	return 1;
+}
+
+int main(int ac, char **av)
+{
+	int errors = 0;
+	Shm *shm, *other, *ro;
+	ShmList *list;
+	ShmMap *map;
+	const char *item;
+	shm_off_t off, off2;
+	char name[64], key[32];
+	size_t size;
+	ssize_t val;
+	long sum;
+	pid_t pid;
+	int status, i;
+
+	if (ac == 2 && !strcmp(av[1], "help"))
+	{
+		printf("usage: %s\n", *av);
+		return EXIT_SUCCESS;
+	}
+
+	printf("Testing: %s\n", "shm");
+
+	/* Test the allocator */
+
+	if (!(shm = shm_create(NULL, 64 * 1024, 0)))
+		++errors, printf("Test1: shm_create() failed\n");
+	else
+	{
+		TEST_EQ(1, shm_size(shm), 64 * 1024)
+		TEST_EQ(2, shm_used(shm), 0)
+		TEST_ACT(3, (off = shm_alloc(shm, 100)) && off % 16 == 0)
+		TEST_EQ(4, shm_used(shm), 112)
+		TEST_ACT(5, shm_ptr(shm, off) && shm_off(shm, shm_ptr(shm, off)) == off)
+		memset(shm_ptr(shm, off), 'x', 100);
+		shm_free(shm, off);
+		TEST_EQ(6, shm_used(shm), 0)
+		TEST_ACT(7, shm_alloc(shm, 90) == off)
+		TEST_ACT(8, (off2 = shm_alloc(shm, 0)) && off2 != off)
+		TEST_ACT(9, !shm_alloc(shm, 64 * 1024) && errno == ENOSPC)
+
+		for (i = 0; shm_alloc(shm, 1000); ++i)
+		{}
+
+		TEST_ACT(10, i > 50 && errno == ENOSPC)
+		TEST_ACT(11, shm_used(shm) <= shm_size(shm))
+		shm_destroy(&shm);
+	}
+
+	/* Test lists */
+
+	if (!(shm = shm_create(NULL, 1024 * 1024, 0)))
+		++errors, printf("Test12: shm_create() failed\n");
+	else
+	{
+		TEST_ACT(12, (list = shm_list_create(shm)))
+		TEST_EQ(13, shm_list_length(shm, list), 0)
+
+		for (i = 0; i < 100; ++i)
+		{
+			snprintf(key, sizeof key, "item%d", i);
+
+			if (shm_list_append(shm, list, key, strlen(key) + 1) == -1)
+				break;
+		}
+
+		TEST_EQ(14, shm_list_length(shm, list), 100)
+		TEST_ACT(15, (item = shm_list_item(shm, list, 42, &size)) && size == 7 && !strcmp(item, "item42"))
+		TEST_ACT(16, shm_list_remove(shm, list, 0) == 0)
+		TEST_ACT(17, (item = shm_list_item(shm, list, 0, NULL)) && !strcmp(item, "item1"))
+		TEST_ACT(18, (item = shm_list_item(shm, list, 98, NULL)) && !strcmp(item, "item99"))
+		TEST_ACT(19, !shm_list_item(shm, list, 99, NULL) && errno == EINVAL)
+		TEST_ACT(20, shm_list_append(shm, list, NULL, 0) == 0 && shm_list_item(shm, list, 99, &size) && size == 0)
+		shm_list_release(shm, list);
+		TEST_EQ(21, shm_used(shm), 0)
+
+		/* Test maps */
+
+		TEST_ACT(22, (map = shm_map_create(shm, 0)))
+
+		for (i = 0; i < 1000; ++i)
+		{
+			snprintf(key, sizeof key, "key%d", i);
+
+			if (shm_map_put(shm, map, key, &i, sizeof i) == -1)
+				break;
+		}
+
+		TEST_ACT(23, check_map(shm, map, 1000))
+		TEST_ACT(24, !shm_map_get(shm, map, "key1000", NULL) && errno == ENOENT)
+		TEST_ACT(25, shm_map_put(shm, map, "key999", "replaced", 9) == 0)
+		TEST_ACT(26, (item = shm_map_get(shm, map, "key999", &size)) && size == 9 && !strcmp(item, "replaced"))
+		TEST_EQ(27, shm_map_size(shm, map), 1000)
+		TEST_ACT(28, shm_map_remove(shm, map, "key999") == 0)
+		TEST_ACT(29, shm_map_remove(shm, map, "key999") == -1 && errno == ENOENT)
+		TEST_ACT(30, check_map(shm, map, 999))
+		sum = 0;
+		TEST_ACT(31, shm_map_apply(shm, map, sum_action, &sum) == 0 && sum == 998L * 999 / 2)
+
+		/* Test sharing with a child process (inherited mapping, shared lock) */
+
+		TEST_ACT(32, shm_set_root(shm, shm_off(shm, map)) == 0 && shm_root(shm) == shm_off(shm, map))
+
+		switch (pid = fork())
+		{
+			case -1:
+				++errors, printf("Test33: fork() failed\n");
+				break;
+
+			case 0:
+			{
+				ShmMap *child = shm_ptr(shm, shm_root(shm));
+
+				i = 999;
+				_exit(check_map(shm, child, 999) && shm_map_put(shm, child, "key999", &i, sizeof i) == 0 ? 0 : 1);
+			}
+
+			default:
+				TEST_ACT(33, waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+				TEST_ACT(34, check_map(shm, map, 1000))
+				break;
+		}
+
+		shm_map_release(shm, map);
+		TEST_EQ(35, shm_used(shm), 0)
+		shm_destroy(&shm);
+	}
+
+	/* Test attaching by name at a different address, and read-only */
+
+	snprintf(name, sizeof name, "/libslack-shm-test-%d", (int)getpid());
+
+	if (!(shm = shm_create(name, 1024 * 1024, 0600)))
+		++errors, printf("Test36: shm_create(%s) failed (%s)\n", name, strerror(errno));
+	else
+	{
+		TEST_ACT(36, !shm_create(name, 1024 * 1024, 0600) && errno == EEXIST)
+		TEST_ACT(37, (map = shm_map_create(shm, 2000)))
+
+		shm_wrlock(shm);
+
+		for (i = 0; i < 2000; ++i)
+		{
+			snprintf(key, sizeof key, "key%d", i);
+
+			if (shm_map_put_unlocked(shm, map, key, &i, sizeof i) == -1)
+				break;
+		}
+
+		shm_set_root_unlocked(shm, shm_off(shm, map));
+		shm_unlock(shm);
+
+		if (!(other = shm_attach(name, 1)))
+			++errors, printf("Test38: shm_attach(%s) failed (%s)\n", name, strerror(errno));
+		else
+		{
+			ShmMap *other_map = shm_ptr(other, shm_root(other));
+
+			TEST_ACT(38, (void *)other_map != (void *)map)
+			TEST_ACT(39, check_map(other, other_map, 2000))
+			i = 2000;
+			TEST_ACT(40, shm_map_put(other, other_map, "key2000", &i, sizeof i) == 0)
+			TEST_ACT(41, check_map(shm, map, 2001))
+			shm_destroy(&other);
+		}
+
+		if (!(ro = shm_attach_fd(shm_fd(shm), 0)))
+			++errors, printf("Test42: shm_attach_fd() failed (%s)\n", strerror(errno));
+		else
+		{
+			ShmMap *ro_map = shm_ptr(ro, shm_root(ro));
+
+			TEST_ACT(42, shm_locker(ro) == NULL && shm_locker(shm) != NULL)
+			TEST_ACT(43, check_map(ro, ro_map, 2001))
+			TEST_ACT(44, shm_map_put(ro, ro_map, "key", "x", 1) == -1 && errno == EPERM)
+			TEST_ACT(45, !shm_alloc(ro, 1) && errno == EPERM)
+			shm_destroy(&ro);
+		}
+
+		shm_destroy(&shm);
+		TEST_ACT(46, shm_unlink(name) == 0)
+		TEST_ACT(47, !shm_attach(name, 0) && errno == ENOENT)
+	}
+
+	/* Test errors */
+
+	TEST_ACT(48, !shm_create(NULL, 16, 0) && errno == EINVAL)
+	TEST_ACT(49, !shm_attach(NULL, 0) && errno == EINVAL)
+	TEST_ACT(50, !shm_attach_fd(STDIN_FILENO, 0))
+	TEST_EQ(51, shm_size(NULL), -1)
+	TEST_ACT(52, !shm_alloc(NULL, 1) && errno == EINVAL)
+	TEST_ACT(53, !shm_list_create(NULL))
+	TEST_ACT(54, !shm_map_get(NULL, NULL, "x", NULL))
+
+	if (errors)
+		printf("%d/54 tests failed\n", errors);
+	else
+		printf("All tests passed\n");
+
+	return (errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -0,0 +1,90 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+#ifndef LIBSLACK_SHM_H
+#define LIBSLACK_SHM_H
+
+#include <sys/types.h>
+
+#include <slack/hdr.h>
+#include <slack/locker.h>
+
+typedef struct Shm Shm;
+typedef struct ShmList ShmList;
+typedef struct ShmMap ShmMap;
+typedef size_t shm_off_t;
+typedef void shm_map_action_t(const char *key, const void *value, size_t size, void *data);
+
+_begin_decls
+Shm *shm_create(const char *name, size_t size, mode_t mode);
+Shm *shm_attach(const char *name, int writable);
+Shm *shm_attach_fd(int fd, int writable);
+void shm_release(Shm *shm);
+void *shm_destroy(Shm **shm);
+int shm_fd(const Shm *shm);
+Locker *shm_locker(const Shm *shm);
+int shm_rdlock(const Shm *shm);
+int shm_wrlock(const Shm *shm);
+int shm_unlock(const Shm *shm);
+ssize_t shm_size(const Shm *shm);
+ssize_t shm_used(const Shm *shm);
+ssize_t shm_used_unlocked(const Shm *shm);
+shm_off_t shm_alloc(Shm *shm, size_t size);
+shm_off_t shm_alloc_unlocked(Shm *shm, size_t size);
+void shm_free(Shm *shm, shm_off_t off);
+void shm_free_unlocked(Shm *shm, shm_off_t off);
+void *shm_ptr(const Shm *shm, shm_off_t off);
+shm_off_t shm_off(const Shm *shm, const void *ptr);
+shm_off_t shm_root(const Shm *shm);
+shm_off_t shm_root_unlocked(const Shm *shm);
+int shm_set_root(Shm *shm, shm_off_t root);
+int shm_set_root_unlocked(Shm *shm, shm_off_t root);
+ShmList *shm_list_create(Shm *shm);
+ShmList *shm_list_create_unlocked(Shm *shm);
+void shm_list_release(Shm *shm, ShmList *list);
+void shm_list_release_unlocked(Shm *shm, ShmList *list);
+ssize_t shm_list_length(const Shm *shm, const ShmList *list);
+ssize_t shm_list_length_unlocked(const Shm *shm, const ShmList *list);
+const void *shm_list_item(const Shm *shm, const ShmList *list, ssize_t index, size_t *size);
+const void *shm_list_item_unlocked(const Shm *shm, const ShmList *list, ssize_t index, size_t *size);
+int shm_list_append(Shm *shm, ShmList *list, const void *item, size_t size);
+int shm_list_append_unlocked(Shm *shm, ShmList *list, const void *item, size_t size);
+int shm_list_remove(Shm *shm, ShmList *list, ssize_t index);
+int shm_list_remove_unlocked(Shm *shm, ShmList *list, ssize_t index);
+ShmMap *shm_map_create(Shm *shm, size_t size);
+ShmMap *shm_map_create_unlocked(Shm *shm, size_t size);
+void shm_map_release(Shm *shm, ShmMap *map);
+void shm_map_release_unlocked(Shm *shm, ShmMap *map);
+ssize_t shm_map_size(const Shm *shm, const ShmMap *map);
+ssize_t shm_map_size_unlocked(const Shm *shm, const ShmMap *map);
+const void *shm_map_get(const Shm *shm, const ShmMap *map, const char *key, size_t *size);
+const void *shm_map_get_unlocked(const Shm *shm, const ShmMap *map, const char *key, size_t *size);
+int shm_map_put(Shm *shm, ShmMap *map, const char *key, const void *value, size_t size);
+int shm_map_put_unlocked(Shm *shm, ShmMap *map, const char *key, const void *value, size_t size);
+int shm_map_remove(Shm *shm, ShmMap *map, const char *key);
+int shm_map_remove_unlocked(Shm *shm, ShmMap *map, const char *key);
+int shm_map_apply(const Shm *shm, const ShmMap *map, shm_map_action_t *action, void *data);
+int shm_map_apply_unlocked(const Shm *shm, const ShmMap *map, shm_map_action_t *action, void *data);
+_end_decls
+
+#endif
+
+/* vi:set ts=4 sw=4: */
@@ -63,6 +63,7 @@ I<libslack(str)> - string module
 
     typedef struct String String;
     typedef struct StringTR StringTR;
+    typedef struct Regex Regex;
 
     enum StringAlignment
     {
@@ -82,6 +83,10 @@ I<libslack(str)> - string module
 
     typedef enum StringAlignment StringAlignment;
     typedef enum StringTROption StringTROption;
+    typedef int str_regsub_t(String *dst, const char *text, const regmatch_t *match, void *data);
+    typedef int regexpr_search_t(void *engine, const char *text, size_t start, size_t end, regmatch_t *match, int eflags);
+
+    #define REG_DFA 0x100000
 
     String *str_create(const char *format, ...);
     String *str_create_with_locker(Locker *locker, const char *format, ...);
@@ -91,10 +96,26 @@ I<libslack(str)> - string module
     String *str_create_with_locker_sized(Locker *locker, size_t size, const char *format, ...);
     String *str_vcreate_sized(size_t size, const char *format, va_list args);
     String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *format, va_list args);
+    String *str_create_iovecs(const struct iovec *iov, size_t iovcnt);
+    String *str_create_with_locker_iovecs(Locker *locker, const struct iovec *iov, size_t iovcnt);
     String *str_copy(const String *str);
     String *str_copy_unlocked(const String *str);
     String *str_copy_with_locker(Locker *locker, const String *str);
     String *str_copy_with_locker_unlocked(Locker *locker, const String *str);
+    String *str_share(const String *str);
+    String *str_share_unlocked(const String *str);
+    String *str_share_with_locker(Locker *locker, const String *str);
+    String *str_share_with_locker_unlocked(Locker *locker, const String *str);
+    int str_unshare(String *str);
+    int str_unshare_unlocked(String *str);
+    String *str_adopt(char *buf, size_t length, size_t size);
+    String *str_adopt_with_locker(Locker *locker, char *buf, size_t length, size_t size);
+    int str_reserve(String *str, size_t size);
+    int str_reserve_unlocked(String *str, size_t size);
+    int str_shrink_to_fit(String *str);
+    int str_shrink_to_fit_unlocked(String *str);
+    int str_set_growth(String *str, int percent);
+    int str_set_growth_unlocked(String *str, int percent);
     String *str_fgetline(FILE *stream);
     String *str_fgetline_with_locker(Locker *locker, FILE *stream);
     void str_release(String *str);
@@ -171,6 +192,12 @@ I<libslack(str)> - string module
     int str_tr_compiled(String *str, StringTR *table);
     int str_tr_compiled_unlocked(String *str, StringTR *table);
     int tr_compiled(char *str, StringTR *table);
+    Regex *regex_create(const char *pattern, int cflags);
+    Regex *regex_create_with_locker(Locker *locker, const char *pattern, int cflags);
+    void regex_release(Regex *regex);
+    void *regex_destroy(Regex **regex);
+    int regex_exec(Regex *regex, const char *text, size_t length, size_t nmatch, regmatch_t *match, int eflags);
+    int regex_is_dfa(const Regex *regex);
     List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags);
     List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags);
     List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags);
@@ -189,12 +216,24 @@ I<libslack(str)> - string module
     String *str_regsub_unlocked(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all);
     String *str_regsub_compiled(const regex_t *compiled, const char *replacement, String *text, int eflags, int all);
     String *str_regsub_compiled_unlocked(const regex_t *compiled, const char *replacement, String *text, int eflags, int all);
+    String *str_regsub_callback(const char *pattern, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all);
+    String *str_regsub_callback_unlocked(const char *pattern, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all);
+    String *str_regsub_callback_compiled(const regex_t *compiled, str_regsub_t *callback, void *data, String *text, int eflags, int all);
+    String *str_regsub_callback_compiled_unlocked(const regex_t *compiled, str_regsub_t *callback, void *data, String *text, int eflags, int all);
+    List *str_regexpr_grep(const char *pattern, const String *text, int cflags, int eflags, int threads, int lines);
+    List *str_regexpr_grep_unlocked(const char *pattern, const String *text, int cflags, int eflags, int threads, int lines);
+    List *regexpr_grep(const char *pattern, const char *text, size_t length, int cflags, int eflags, int threads, int lines);
+    List *regexpr_grep_compiled(const regex_t *compiled, int ncompiled, const char *text, size_t length, int eflags, int lines);
+    List *regexpr_grep_callback(regexpr_search_t *search, void **engines, int threads, const char *text, size_t length, int eflags, int lines);
     List *str_fmt(const String *str, size_t line_width, StringAlignment alignment);
     List *str_fmt_unlocked(const String *str, size_t line_width, StringAlignment alignment);
     List *str_fmt_with_locker(Locker *locker, const String *str, size_t line_width, StringAlignment alignment);
     List *str_fmt_with_locker_unlocked(Locker *locker, const String *str, size_t line_width, StringAlignment alignment);
     List *fmt(const char *str, size_t line_width, StringAlignment alignment);
     List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment);
+    List *str_fmt_utf8(const String *str, size_t line_width, StringAlignment alignment);
+    List *str_fmt_utf8_unlocked(const String *str, size_t line_width, StringAlignment alignment);
+    List *fmt_utf8(const char *str, size_t line_width, StringAlignment alignment);
     List *str_split(const String *str, const char *delim);
     List *str_split_unlocked(const String *str, const char *delim);
     List *str_split_with_locker(Locker *locker, const String *str, const char *delim);
@@ -225,6 +264,9 @@ I<libslack(str)> - string module
     String *str_trim_right(String *str);
     String *str_trim_right_unlocked(String *str);
     char *trim_right(char *str);
+    String *str_trim_utf8(String *str);
+    String *str_trim_utf8_unlocked(String *str);
+    char *trim_utf8(char *str);
     String *str_squeeze(String *str);
     String *str_squeeze_unlocked(String *str);
     char *squeeze(char *str);
@@ -252,6 +294,28 @@ I<libslack(str)> - string module
     String *encode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable);
     String *decode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable);
     String *decode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable);
+    String *str_hex_encode(const String *str);
+    String *str_hex_encode_unlocked(const String *str);
+    String *str_hex_decode(const String *str);
+    String *str_hex_decode_unlocked(const String *str);
+    String *str_base64_encode(const String *str, int url);
+    String *str_base64_encode_unlocked(const String *str, int url);
+    String *str_base64_decode(const String *str, int url);
+    String *str_base64_decode_unlocked(const String *str, int url);
+    ssize_t hex_encode(char *dst, const void *src, size_t length);
+    ssize_t hex_decode(void *dst, const char *src, size_t length);
+    ssize_t base64_encode(char *dst, const void *src, size_t length, int url);
+    ssize_t base64_decode(void *dst, const char *src, size_t length, int url);
+    int str_utf8_valid(const String *str, size_t *error);
+    int str_utf8_valid_unlocked(const String *str, size_t *error);
+    ssize_t str_utf8_length(const String *str);
+    ssize_t str_utf8_length_unlocked(const String *str);
+    String *str_utf8_truncate(String *str, size_t length);
+    String *str_utf8_truncate_unlocked(String *str, size_t length);
+    int utf8_valid(const char *str, size_t length, size_t *error);
+    size_t utf8_length(const char *str, size_t length);
+    size_t utf8_boundary(const char *str, size_t length, size_t max);
+    char *utf8_truncate(char *str, size_t length);
     String *str_lc(String *str);
     String *str_lc_unlocked(String *str);
     char *lc(char *str);
@@ -279,6 +343,9 @@ I<libslack(str)> - string module
     int str_oct(const String *str);
     int str_oct_unlocked(const String *str);
     int oct(const char *str);
+    ssize_t parse_ulong(const char *str, size_t length, int base, unsigned long *value);
+    ssize_t parse_long(const char *str, size_t length, int base, long *value);
+    ssize_t parse_double(const char *str, size_t length, double *value);
     int strcasecmp(const char *s1, const char *s2);
     int strncasecmp(const char *s1, const char *s2, size_t n);
     size_t strlcpy(char *dst, const char *src, size_t size);
@@ -326,6 +393,12 @@ operators in I<perlfunc(1)> and I<perlop(1)>. Others came from I<OpenBSD>.
 
 #include <netinet/in.h>
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && !defined(NO_SIMD)
+#define STR_SIMD 1
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#endif
+
 #include "err.h"
 #include "str.h"
 #include "mem.h"
@@ -335,14 +408,6 @@ operators in I<perlfunc(1)> and I<perlop(1)>. Others came from I<OpenBSD>.
 #include "snprintf.h"
 #endif
 
-struct String
-{
-	size_t size;    /* number of bytes allocated */
-	size_t length;  /* number of bytes used (including nul) */
-	char *str;      /* vector of characters */
-	Locker *locker; /* locking strategy for this string */
-};
-
 #define CHARSET 256
 
 struct StringTR
@@ -378,6 +443,10 @@ static const size_t MIN_STRING_SIZE = 32;
 
 static const size_t MIN_EMPTY_STRING_SIZE = 1024;
 
+/* Default percentage by which a full string grows (doubling) */
+
+static const int STRING_GROWTH = 100;
+
 void (flockfile)(FILE *stream); /* Missing from old glibc headers */
 void (funlockfile)(FILE *stream);
 
@@ -389,31 +458,171 @@ void (funlockfile)(FILE *stream);
 
 /*
 
+A I<String>'s bytes are stored after a header that counts the I<String>s
+sharing them. I<str_share(3)> shares the buffer, and the first modification
+of a shared buffer copies it. The count is atomic because the I<String>s
+sharing a buffer may have different I<Locker>s (or none). Buffers adopted
+with I<str_adopt(3)> have no header, so they are plain I<malloc(3)> blocks
+that are never shared.
+
+*/
+
+typedef union StringBuffer StringBuffer;
+
+union StringBuffer
+{
+	unsigned long refs; /* the number of strings sharing this buffer */
+	char align[16];     /* keeps the bytes 16-byte aligned */
+};
+
+#define BUFFER(s) ((StringBuffer *)((s) - sizeof(StringBuffer)))
+
+/*
+
+C<char *buffer_resize(char **buf, size_t size)>
+
+Resizes the buffer C<*buf> (which may be C<null>, and must not be shared) to
+hold C<size> bytes. A new buffer is unshared. On success, returns the new
+buffer (and stores it in C<*buf>). On error, returns C<null> with C<errno>
+set appropriately, and C<*buf> is unchanged.
+
+*/
+
+static char *buffer_resize(char **buf, size_t size)
+{
+	char *block = (*buf) ? (char *)BUFFER(*buf) : NULL;
+
+	if (!mem_resize(&block, sizeof(StringBuffer) + size))
+		return NULL;
+
+	if (!*buf)
+		((StringBuffer *)block)->refs = 1;
+
+	return *buf = block + sizeof(StringBuffer);
+}
+
+/*
+
+C<void buffer_release(char *buf)>
+
+Releases C<buf> (which may be C<null>) if it isn't shared. Otherwise, just
+stops sharing it.
+
+*/
+
+static void buffer_release(char *buf)
+{
+	if (buf && __atomic_sub_fetch(&BUFFER(buf)->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		mem_release(BUFFER(buf));
+}
+
+/*
+
+C<int shared(const String *str)>
+
+Returns whether or not C<str>'s buffer is shared with another string. Only
+C<str> itself can add to the number of strings sharing its buffer, so an
+unshared buffer can't become shared while C<str> is being modified.
+
+*/
+
+static int shared(const String *str)
+{
+	return !str->adopted && str->str && __atomic_load_n(&BUFFER(str->str)->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+/*
+
+C<int unshare(String *str, size_t size)>
+
+Gives C<str> its own copy of its buffer, with room for C<size> bytes, if it
+is shared. On success, returns C<0>. On error, returns C<-1>.
+
+*/
+
+static int unshare(String *str, size_t size)
+{
+	char *buf = NULL;
+
+	if (!shared(str))
+		return 0;
+
+	if (!buffer_resize(&buf, size))
+		return -1;
+
+	memcpy(buf, str->str, str->length);
+	buffer_release(str->str);
+	str->str = buf;
+	str->size = size;
+
+	return 0;
+}
+
+/*
+
+C<int resize(String *str, size_t size)>
+
+Resizes C<str>'s (unshared) buffer to hold C<size> bytes. On success,
+returns C<0>. On error, returns C<-1> with C<errno> set appropriately, and
+C<str> is unchanged.
+
+*/
+
+static int resize(String *str, size_t size)
+{
+	if (size == str->size)
+		return 0;
+
+	if (!((str->adopted) ? mem_resize(&str->str, size) : buffer_resize(&str->str, size)))
+		return -1;
+
+	str->size = size;
+
+	return 0;
+}
+
+/*
+
+C<void release(String *str)>
+
+Releases C<str>'s buffer (or stops sharing it).
+
+*/
+
+static void release(String *str)
+{
+	if (str->adopted)
+		mem_release(str->str);
+	else
+		buffer_release(str->str);
+}
+
+/*
+
 C<int grow(String *str, size_t bytes)>
 
-Allocates enough memory to add C<bytes> extra bytes to C<str> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+Allocates enough memory to add C<bytes> extra bytes to C<str> if necessary,
+growing it by C<str-E<gt>growth> percent at a time. On success, returns
+C<0>. On error, returns C<-1>.
 
 */
 
 static int grow(String *str, size_t bytes)
 {
-	int grown = 0;
+	size_t size = str->size;
 
-	while (str->length + bytes > str->size)
+	while (str->length + bytes > size)
 	{
-		if (str->size)
-			str->size <<= 1;
+		if (size)
+			size += (size * str->growth + 99) / 100;
 		else
-			str->size = MIN_STRING_SIZE;
-
-		grown = 1;
+			size = MIN_STRING_SIZE;
 	}
 
-	if (grown)
-		return mem_resize(&str->str, str->size) ? 0 : -1;
+	if (shared(str))
+		return unshare(str, size);
 
-	return 0;
+	return resize(str, size);
 }
 
 /*
@@ -421,27 +630,29 @@ static int grow(String *str, size_t bytes)
 C<int shrink(String *str, size_t bytes)>
 
 Allocates less memory for removing C<bytes> bytes from C<str> if necessary.
-On success, returns C<0>. On error, returns C<-1>.
+The buffer is halved only while it would be less than a quarter full, so a
+string whose length oscillates around a boundary doesn't reallocate on every
+change. It never shrinks below C<MIN_EMPTY_STRING_SIZE> or C<str>'s reserved
+size. On success, returns C<0>. On error, returns C<-1>.
 
 */
 
 static int shrink(String *str, size_t bytes)
 {
-	int shrunk = 0;
+	size_t size = str->size;
 
-	while (str->length - bytes < str->size >> 1)
+	while (str->length - bytes < size >> 2)
 	{
-		if (str->size <= MIN_EMPTY_STRING_SIZE)
+		if (size >> 1 < MIN_EMPTY_STRING_SIZE || size >> 1 < str->reserve)
 			break;
 
-		str->size >>= 1;
-		shrunk = 1;
+		size >>= 1;
 	}
 
-	if (shrunk)
-		return mem_resize(&str->str, str->size) ? 0 : -1;
+	if (shared(str))
+		return unshare(str, size);
 
-	return 0;
+	return resize(str, size);
 }
 
 /*
@@ -476,6 +687,9 @@ On error, returns C<-1>.
 
 static int contract(String *str, ssize_t index, size_t range)
 {
+	if (unshare(str, str->size) == -1)
+		return -1;
+
 	memmove(str->str + index, str->str + index + range, (str->length - index - range) * sizeof(*str->str));
 
 	if (shrink(str, range) == -1)
@@ -504,7 +718,7 @@ static int adjust(String *str, ssize_t index, size_t range, size_t length)
 	if (range > length)
 		return contract(str, index + length, range - length);
 
-	return 0;
+	return unshare(str, str->size);
 }
 
 /*
@@ -697,9 +911,9 @@ String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *f
 
 	for (;; size <<= 1)
 	{
-		if (!mem_resize(&buf, size))
+		if (!buffer_resize(&buf, size))
 		{
-			mem_release(buf);
+			buffer_release(buf);
 			return NULL;
 		}
 
@@ -716,7 +930,7 @@ String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *f
 
 	if (!(str = mem_new(String))) /* XXX decouple */
 	{
-		mem_release(buf);
+		buffer_release(buf);
 		return NULL;
 	}
 
@@ -724,6 +938,75 @@ String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *f
 	str->length = length + 1;
 	str->str = buf;
 	str->locker = locker;
+	str->reserve = 0;
+	str->growth = STRING_GROWTH;
+	str->adopted = 0;
+
+	return str;
+}
+
+/*
+
+=item C<String *str_create_iovecs(const struct iovec *iov, size_t iovcnt)>
+
+Creates a I<String> containing the concatenation of the C<iovcnt> buffers
+described by C<iov> (which may contain C<nul> bytes, and may be C<null> if
+C<iovcnt> is zero). The string's buffer is allocated once, at its final
+size. On success, returns the new string. It is the caller's responsibility
+to deallocate the new string with I<str_release(3)> or I<str_destroy(3)>.
+It is strongly recommended to use I<str_destroy(3)>, because it also sets
+the pointer variable to C<null>. On error, returns C<null> with C<errno>
+set appropriately.
+
+=cut
+
+*/
+
+String *str_create_iovecs(const struct iovec *iov, size_t iovcnt)
+{
+	return str_create_with_locker_iovecs(NULL, iov, iovcnt);
+}
+
+/*
+
+=item C<String *str_create_with_locker_iovecs(Locker *locker, const struct iovec *iov, size_t iovcnt)>
+
+Equivalent to I<str_create_iovecs(3)> except that multiple threads
+accessing the new string will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+String *str_create_with_locker_iovecs(Locker *locker, const struct iovec *iov, size_t iovcnt)
+{
+	String *str;
+	size_t length, i;
+
+	if (!iov && iovcnt)
+		return set_errnull(EINVAL);
+
+	for (length = i = 0; i < iovcnt; ++i)
+	{
+		if (iov[i].iov_len >= (size_t)SSIZE_MAX - length)
+			return set_errnull(EINVAL);
+
+		length += iov[i].iov_len;
+	}
+
+	if (!(str = str_create_with_locker_sized(locker, length + 1, NULL)))
+		return NULL;
+
+	for (length = i = 0; i < iovcnt; ++i)
+	{
+		if (iov[i].iov_len)
+			memcpy(str->str + length, iov[i].iov_base, iov[i].iov_len);
+
+		length += iov[i].iov_len;
+	}
+
+	str->length = length + 1;
+	str->str[length] = '\0';
 
 	return str;
 }
@@ -796,324 +1079,303 @@ String *str_copy_with_locker_unlocked(Locker *locker, const String *str)
 
 /*
 
-=item C<String *str_fgetline(FILE *stream)>
+=item C<String *str_share(const String *str)>
 
-Similar to I<fgets(3)> except that it recognises UNIX (C<"\n">), DOS/Windows
-(C<"\r\n">) and old Macintosh (C<"\r">) line endings (even different line
-endings in the same file), and it can read a line of any size into the
-I<String> that it returns. Reading stops after the C<EOF>, or after the end
-of the line is reached. Line endings are always stored as a single C<"\n">
-character. A C<nul> is placed after the last character in the buffer. On
-success, returns a new I<String>. It is the caller's responsibility to
-deallocate the new string with I<str_release(3)> or I<str_destroy(3)>. It is
-strongly recommended to use I<str_destroy(3)>, because it also sets the
-pointer variable to C<null>. On error, or when the end of file occurs while
-no characters have been read, returns C<null>. Calls to this function can be
-mixed with calls to other input functions from the I<stdio> library on the
-same input stream.
+Creates a copy of C<str> that shares C<str>'s buffer until either of them
+is modified by the I<str(3)> module functions (at which point the modified
+string gets its own copy of the buffer), so sharing takes constant time
+regardless of the length of C<str>. Since the buffer is shared, neither
+string may be modified directly via I<cstr(3)> without first calling
+I<str_unshare(3)>. A string whose buffer was adopted with I<str_adopt(3)>
+is copied instead. On success, returns the copy. It is the caller's
+responsibility to deallocate the new string with I<str_release(3)> or
+I<str_destroy(3)>. It is strongly recommended to use I<str_destroy(3)>,
+because it also sets the pointer variable to C<null>. On error, returns
+C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_fgetline(FILE *stream)
+String *str_share(const String *str)
 {
-	return str_fgetline_with_locker(NULL, stream);
+	return str_share_with_locker(NULL, str);
 }
 
 /*
 
-=item C<String *str_fgetline_with_locker(Locker *locker, FILE *stream)>
+=item C<String *str_share_unlocked(const String *str)>
 
-Equivalent to I<str_fgetline(3)> except that multiple threads accessing the
-new string will be synchronised by C<locker>.
+Equivalent to I<str_share(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_fgetline_with_locker(Locker *locker, FILE *stream)
+String *str_share_unlocked(const String *str)
 {
-	String *ret = NULL;
-	char buf[BUFSIZ];
-
-	flockfile(stream);
-
-	while (fgetline_unlocked(buf, BUFSIZ, stream))
-	{
-		if (!ret)
-		{
-			if (!(ret = str_create_with_locker(locker, "%s", buf)))
-				break;
-		}
-		else if (!str_append(ret, "%s", buf))
-		{
-			str_destroy(&ret);
-			break;
-		}
-
-		if (cstr(ret)[ret->length - 2] == '\n')
-			break;
-	}
-
-	funlockfile(stream);
-	return ret;
+	return str_share_with_locker_unlocked(NULL, str);
 }
 
 /*
 
-=item C<void str_release(String *str)>
+=item C<String *str_share_with_locker(Locker *locker, const String *str)>
 
-Releases (deallocates) C<str>.
+Equivalent to I<str_share(3)> except that multiple threads accessing the
+new string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-void str_release(String *str)
+String *str_share_with_locker(Locker *locker, const String *str)
 {
-	Locker *locker;
+	String *ret;
+	int err;
 
 	if (!str)
-		return;
+		return set_errnull(EINVAL);
 
-	if (str_wrlock(str))
-		return;
+	if ((err = str_rdlock(str)))
+		return set_errnull(err);
 
-	locker = str->locker;
-	mem_release(str->str);
-	mem_release(str);
-	locker_unlock(locker);
+	ret = str_share_with_locker_unlocked(locker, str);
+
+	if ((err = str_unlock(str)))
+	{
+		str_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
 }
 
 /*
 
-=item C<void *str_destroy(String **str)>
+=item C<String *str_share_with_locker_unlocked(Locker *locker, const String *str)>
 
-Destroys (deallocates and sets to C<null>) C<*str>. Returns C<null>.
-B<Note:> strings shared by multiple threads must not be destroyed until
-after all threads have finished with it.
+Equivalent to I<str_share_with_locker(3)> except that C<str> is not
+read-locked.
 
 =cut
 
 */
 
-void *str_destroy(String **str)
+String *str_share_with_locker_unlocked(Locker *locker, const String *str)
 {
-	if (str && *str)
-	{
-		str_release(*str);
-		*str = NULL;
-	}
+	String *ret;
 
-	return NULL;
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if (str->adopted)
+		return str_copy_with_locker_unlocked(locker, str);
+
+	if (!(ret = mem_new(String))) /* XXX decouple */
+		return NULL;
+
+	__atomic_add_fetch(&BUFFER(str->str)->refs, 1, __ATOMIC_RELAXED);
+	ret->size = str->size;
+	ret->length = str->length;
+	ret->str = str->str;
+	ret->locker = locker;
+	ret->reserve = 0;
+	ret->growth = str->growth;
+	ret->adopted = 0;
+
+	return ret;
 }
 
 /*
 
-=item C<int str_rdlock(const String *str)>
+=item C<int str_unshare(String *str)>
 
-Claims a read lock on C<str> (if C<str> was created with a I<Locker>).
-Clients must call this before calling I<cstr(3)> (for the purpose of reading
-the raw string data) on a string that was created with a I<Locker>. It is
-the client's responsibility to call I<str_unlock(3)> when finished with the
-raw string data. It is also needed when multiple read-only I<str(3)> module
-functions need to be called atomically. It is the caller's responsibility to
-call I<str_unlock(3)> after the atomic operation. The only functions that
-may be called on C<str> between calls to I<str_rdlock(3)> and
-I<str_unlock(3)> are I<cstr(3)> and any read-only I<str(3)> module functions
-whose name ends with C<_unlocked>. On success, returns C<0>. On error,
-returns an error code.
+Gives C<str> its own copy of its buffer if it is shared with another string
+(see I<str_share(3)>). The I<str(3)> module functions do this automatically
+before modifying a string, so this is only needed before modifying C<str>'s
+bytes directly via I<cstr(3)>. On success, returns C<0>. On error, returns
+C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-#define str_rdlock(str) ((str) ? locker_rdlock((str)->locker) : EINVAL)
-#define str_wrlock(str) ((str) ? locker_wrlock((str)->locker) : EINVAL)
-#define str_unlock(str) ((str) ? locker_unlock((str)->locker) : EINVAL)
-
-int (str_rdlock)(const String *str)
+int str_unshare(String *str)
 {
-	return str_rdlock(str);
-}
+	int ret;
+	int err;
 
-/*
-
-=item C<int str_wrlock(const String *str)>
+	if (!str)
+		return set_errno(EINVAL);
 
-Claims a write lock on C<str> (if C<str> was created with a I<Locker>).
-Clients need to call this before calling I<cstr(3)> (for the purpose of
-modifying the raw string data) on a string that was created with a
-I<Locker>. It is the client's responsibility to call I<str_unlock(3)> when
-finished with the raw string data. It is also needed when multiple
-read/write I<str(3)> module functions need to be called atomically. It is
-the caller's responsibility to call I<str_unlock(3)> after the atomic
-operation. The only functions that may be called on C<str> between calls to
-I<str_wrlock(3)> and I<str_unlock(3)> are I<cstr(3)> and any I<str(3)>
-module functions whose name ends with C<_unlocked>. On success, returns
-C<0>. On error, returns an error code.
+	if ((err = str_wrlock(str)))
+		return set_errno(err);
 
-=cut
+	ret = str_unshare_unlocked(str);
 
-*/
+	if ((err = str_unlock(str)))
+		return set_errno(err);
 
-int (str_wrlock)(const String *str)
-{
-	return str_wrlock(str);
+	return ret;
 }
 
 /*
 
-=item C<int str_unlock(const String *str)>
+=item C<int str_unshare_unlocked(String *str)>
 
-Unlocks a read lock or a write lock on C<str> obtained with I<str_rdlock(3)>
-or I<str_wrlock(3)> (if C<str> was created with a I<Locker>). On success,
-returns C<0>. On error, returns an error code.
+Equivalent to I<str_unshare(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-int (str_unlock)(const String *str)
+int str_unshare_unlocked(String *str)
 {
-	return str_unlock(str);
+	if (!str)
+		return set_errno(EINVAL);
+
+	return unshare(str, str->size);
 }
 
 /*
 
-=item C<int str_empty(const String *str)>
-
-Returns whether or not C<str> is the empty string. On error, returns C<-1>
-with C<errno> set appropriately.
+=item C<String *str_adopt(char *buf, size_t length, size_t size)>
+
+Creates a I<String> that takes ownership of C<buf> without copying it.
+C<buf> must have been allocated with I<malloc(3)> (or I<mem_create(3)>),
+must be C<size> bytes long, and must contain a string of C<length> bytes
+(C<length> must be less than C<size>). A C<nul> byte is stored at
+C<buf[length]>. From then on, C<buf> belongs to the new string and is
+resized with I<realloc(3)> and deallocated with I<free(3)> as needed. An
+adopted buffer is never shared, so I<str_share(3)> copies it. On success,
+returns the new string. It is the caller's responsibility to deallocate the
+new string with I<str_release(3)> or I<str_destroy(3)>. It is strongly
+recommended to use I<str_destroy(3)>, because it also sets the pointer
+variable to C<null>. On error, returns C<null> with C<errno> set
+appropriately, and C<buf> still belongs to the caller.
 
 =cut
 
 */
 
-int str_empty(const String *str)
+String *str_adopt(char *buf, size_t length, size_t size)
 {
-	int empty;
-	int err;
-
-	if (!str)
-		return set_errno(EINVAL);
-
-	if ((err = str_rdlock(str)))
-		return set_errno(err);
-
-	empty = str_empty_unlocked(str);
-
-	if ((err = str_unlock(str)))
-		return set_errno(err);
-
-	return empty;
+	return str_adopt_with_locker(NULL, buf, length, size);
 }
 
 /*
 
-=item C<int str_empty_unlocked(const String *str)>
+=item C<String *str_adopt_with_locker(Locker *locker, char *buf, size_t length, size_t size)>
 
-Equivalent to I<str_empty(3)> except that C<str> is not read-locked.
+Equivalent to I<str_adopt(3)> except that multiple threads accessing the new
+string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-int str_empty_unlocked(const String *str)
+String *str_adopt_with_locker(Locker *locker, char *buf, size_t length, size_t size)
 {
-	if (!str)
-		return set_errno(EINVAL);
+	String *str;
 
-	return (str->length == 1);
+	if (!buf || length >= size)
+		return set_errnull(EINVAL);
+
+	if (!(str = mem_new(String))) /* XXX decouple */
+		return NULL;
+
+	buf[length] = nul;
+	str->size = size;
+	str->length = length + 1;
+	str->str = buf;
+	str->locker = locker;
+	str->reserve = 0;
+	str->growth = STRING_GROWTH;
+	str->adopted = 1;
+
+	return str;
 }
 
 /*
 
-=item C<ssize_t str_length(const String *str)>
+=item C<int str_reserve(String *str, size_t size)>
 
-Returns the length of C<str>. On error, returns C<-1> with C<errno> set
-appropriately.
+Makes sure that at least C<size> bytes (including the terminating C<nul>
+byte) are allocated for C<str>, so that it can grow to that length without
+reallocating. C<str> will not be shrunk automatically below C<size> bytes
+until I<str_shrink_to_fit(3)> is called. On success, returns C<0>. On
+error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-ssize_t str_length(const String *str)
+int str_reserve(String *str, size_t size)
 {
-	size_t length;
+	int ret;
 	int err;
 
 	if (!str)
 		return set_errno(EINVAL);
 
-	if ((err = str_rdlock(str)))
+	if ((err = str_wrlock(str)))
 		return set_errno(err);
 
-	length = str_length_unlocked(str);
+	ret = str_reserve_unlocked(str, size);
 
 	if ((err = str_unlock(str)))
 		return set_errno(err);
 
-	return length;
+	return ret;
 }
+
 /*
 
-=item C<ssize_t str_length_unlocked(const String *str)>
+=item C<int str_reserve_unlocked(String *str, size_t size)>
 
-Equivalent to I<str_length(3)> except that C<str> is not read-locked.
+Equivalent to I<str_reserve(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-ssize_t str_length_unlocked(const String *str)
+int str_reserve_unlocked(String *str, size_t size)
 {
 	if (!str)
 		return set_errno(EINVAL);
 
-	return str->length - 1;
-}
-
-/*
-
-=item C<char *cstr(const String *str)>
-
-Returns the raw I<C> string in C<str>. Do not use this pointer to extend the
-length of the string. It's OK to use it to reduce the length of the string,
-provided that you call I<str_set_length_unlocked(3)> or
-I<str_recalc_length_unlocked(3)> immediately afterwards. When used on a
-string that is shared by multiple threads, I<cstr(3)> must appear between
-calls to I<str_rdlock(3)> or I<str_wrlock(3)> and I<str_unlock(3)>.
-
-=cut
-
-*/
+	if (size > str->size)
+	{
+		if (shared(str))
+		{
+			if (unshare(str, size) == -1)
+				return -1;
+		}
+		else if (resize(str, size) == -1)
+			return -1;
+	}
 
-char *cstr(const String *str)
-{
-	if (!str)
-		return set_errnull(EINVAL);
+	str->reserve = size;
 
-	return str->str;
+	return 0;
 }
 
 /*
 
-=item C<ssize_t str_set_length(String *str, size_t length)>
+=item C<int str_shrink_to_fit(String *str)>
 
-Sets the length of C<str> to C<length>. Only needed after the raw I<C>
-string returned by I<cstr(3)> has been used to shorten a string. On success,
-returns the length of C<str>. On error, returns C<-1> with C<errno> set
-appropriately.
+Releases any memory allocated for C<str> beyond what its current contents
+need, and cancels any reservation made with I<str_reserve(3)>. If C<str>'s
+buffer is shared (see I<str_share(3)>), it is left alone. On success, returns
+C<0>. On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-ssize_t str_set_length(String *str, size_t length)
+int str_shrink_to_fit(String *str)
 {
-	ssize_t len;
+	int ret;
 	int err;
 
 	if (!str)
@@ -1122,52 +1384,55 @@ ssize_t str_set_length(String *str, size_t length)
 	if ((err = str_wrlock(str)))
 		return set_errno(err);
 
-	len = str_set_length_unlocked(str, length);
+	ret = str_shrink_to_fit_unlocked(str);
 
 	if ((err = str_unlock(str)))
 		return set_errno(err);
 
-	return len;
+	return ret;
 }
 
 /*
 
-=item C<ssize_t str_set_length_unlocked(String *str, size_t length)>
+=item C<int str_shrink_to_fit_unlocked(String *str)>
 
-Equivalent to I<str_set_length(3)> except that C<str> is not write-locked.
+Equivalent to I<str_shrink_to_fit(3)> except that C<str> is not
+write-locked.
 
 =cut
 
 */
 
-ssize_t str_set_length_unlocked(String *str, size_t length)
+int str_shrink_to_fit_unlocked(String *str)
 {
-	if (!str || length >= str->length)
+	if (!str)
 		return set_errno(EINVAL);
 
-	str->length = length + 1;
-	str->str[str->length - 1] = '\0';
+	str->reserve = 0;
 
-	return str->length - 1;
+	if (shared(str))
+		return 0;
+
+	return resize(str, str->length);
 }
 
 /*
 
-=item C<ssize_t str_recalc_length(String *str)>
+=item C<int str_set_growth(String *str, int percent)>
 
-Calculates and stores the length of C<str>. Only needed after the raw I<C>
-string returned by I<cstr(3)> has been used to shorten a string. Note:
-Treats C<str> as a C<nul>-terminated string and should be avoided. Use
-I<str_set_length(3)> instead. On success, returns the length of C<str>. On
-error, returns C<-1> with C<errno> set appropriately.
+Sets the percentage by which C<str>'s buffer grows when it is full. The
+default is C<100> (doubling). Smaller values waste less memory but
+reallocate more often. Strings shrink only when less than a quarter full,
+regardless of C<percent>. On success, returns C<0>. On error, returns C<-1>
+with C<errno> set appropriately.
 
 =cut
 
 */
 
-ssize_t str_recalc_length(String *str)
+int str_set_growth(String *str, int percent)
 {
-	ssize_t len;
+	int ret;
 	int err;
 
 	if (!str)
@@ -1176,666 +1441,694 @@ ssize_t str_recalc_length(String *str)
 	if ((err = str_wrlock(str)))
 		return set_errno(err);
 
-	len = str_recalc_length_unlocked(str);
+	ret = str_set_growth_unlocked(str, percent);
 
 	if ((err = str_unlock(str)))
 		return set_errno(err);
 
-	return len;
+	return ret;
 }
 
 /*
 
-=item C<ssize_t str_recalc_length_unlocked(String *str)>
+=item C<int str_set_growth_unlocked(String *str, int percent)>
 
-Equivalent to I<str_recalc_length(3)> except that C<str> is not
-write-locked.
+Equivalent to I<str_set_growth(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-ssize_t str_recalc_length_unlocked(String *str)
+int str_set_growth_unlocked(String *str, int percent)
 {
-	if (!str)
+	if (!str || percent < 1)
 		return set_errno(EINVAL);
 
-	str->length = strlen(str->str) + 1;
+	str->growth = percent;
 
-	return str->length - 1;
+	return 0;
 }
 
 /*
 
-=item C<String *str_clear(String *str)>
+=item C<String *str_fgetline(FILE *stream)>
 
-Makes C<str> the empty string. On success, returns C<str>. On error, returns
-C<null> with C<errno> set appropriately.
+Similar to I<fgets(3)> except that it recognises UNIX (C<"\n">), DOS/Windows
+(C<"\r\n">) and old Macintosh (C<"\r">) line endings (even different line
+endings in the same file), and it can read a line of any size into the
+I<String> that it returns. Reading stops after the C<EOF>, or after the end
+of the line is reached. Line endings are always stored as a single C<"\n">
+character. A C<nul> is placed after the last character in the buffer. On
+success, returns a new I<String>. It is the caller's responsibility to
+deallocate the new string with I<str_release(3)> or I<str_destroy(3)>. It is
+strongly recommended to use I<str_destroy(3)>, because it also sets the
+pointer variable to C<null>. On error, or when the end of file occurs while
+no characters have been read, returns C<null>. Calls to this function can be
+mixed with calls to other input functions from the I<stdio> library on the
+same input stream.
 
 =cut
 
 */
 
-String *str_clear(String *str)
+String *str_fgetline(FILE *stream)
 {
-	return str_remove_range(str, 0, -1);
+	return str_fgetline_with_locker(NULL, stream);
 }
 
 /*
 
-=item C<String *str_clear_unlocked(String *str)>
+=item C<String *str_fgetline_with_locker(Locker *locker, FILE *stream)>
 
-Equivalent to I<str_clear(3)> except that C<str> is not write-locked.
+Equivalent to I<str_fgetline(3)> except that multiple threads accessing the
+new string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-String *str_clear_unlocked(String *str)
+String *str_fgetline_with_locker(Locker *locker, FILE *stream)
 {
-	return str_remove_range_unlocked(str, 0, -1);
-}
-
-/*
-
-=item C<String *str_remove(String *str, ssize_t index)>
+	String *ret = NULL;
+	char buf[BUFSIZ];
 
-Removes the C<index>'th character from C<str>. If C<index> is negative, it
-refers to a character position relative to the end of the string (C<-1> is
-the position after the last character, C<-2> is the position of the last
-character, and so on). On success, returns C<str>. On error, returns C<null>
-with C<errno> set appropriately.
+	flockfile(stream);
 
-=cut
+	while (fgetline_unlocked(buf, BUFSIZ, stream))
+	{
+		if (!ret)
+		{
+			if (!(ret = str_create_with_locker(locker, "%s", buf)))
+				break;
+		}
+		else if (!str_append(ret, "%s", buf))
+		{
+			str_destroy(&ret);
+			break;
+		}
 
-*/
+		if (cstr(ret)[ret->length - 2] == '\n')
+			break;
+	}
 
-String *str_remove(String *str, ssize_t index)
-{
-	return str_remove_range(str, index, 1);
+	funlockfile(stream);
+	return ret;
 }
 
 /*
 
-=item C<String *str_remove_unlocked(String *str, ssize_t index)>
+=item C<void str_release(String *str)>
 
-Equivalent to I<str_remove(3)> except that C<str> is not write-locked.
+Releases (deallocates) C<str>.
 
 =cut
 
 */
 
-String *str_remove_unlocked(String *str, ssize_t index)
+void str_release(String *str)
 {
-	return str_remove_range_unlocked(str, index, 1);
+	Locker *locker;
+
+	if (!str)
+		return;
+
+	if (str_wrlock(str))
+		return;
+
+	locker = str->locker;
+	release(str);
+	mem_release(str);
+	locker_unlock(locker);
 }
 
 /*
 
-=item C<String *str_remove_range(String *str, ssize_t index, ssize_t range)>
+=item C<void *str_destroy(String **str)>
 
-Removes C<range> characters from C<str> starting at C<index>. If C<index> or
-C<range> are negative, they refer to character positions relative to the end
-of the string (C<-1> is the position after the last character, C<-2> is the
-position of the last character, and so on). On success, returns C<str>. On
-error, returns C<null> with C<errno> set appropriately.
+Destroys (deallocates and sets to C<null>) C<*str>. Returns C<null>.
+B<Note:> strings shared by multiple threads must not be destroyed until
+after all threads have finished with it.
 
 =cut
 
 */
 
-String *str_remove_range(String *str, ssize_t index, ssize_t range)
+void *str_destroy(String **str)
 {
-	String *ret;
-	int err;
+	if (str && *str)
+	{
+		str_release(*str);
+		*str = NULL;
+	}
 
-	if (!str)
-		return set_errnull(EINVAL);
-
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
-
-	ret = str_remove_range_unlocked(str, index, range);
-
-	if ((err = str_unlock(str)))
-		return set_errnull(err);
-
-	return ret;
+	return NULL;
 }
 
 /*
 
-=item C<String *str_remove_range_unlocked(String *str, ssize_t index, ssize_t range)>
+=item C<int str_rdlock(const String *str)>
 
-Equivalent to I<str_remove_range(3)> except that C<str> is not write-locked.
+Claims a read lock on C<str> (if C<str> was created with a I<Locker>).
+Clients must call this before calling I<cstr(3)> (for the purpose of reading
+the raw string data) on a string that was created with a I<Locker>. It is
+the client's responsibility to call I<str_unlock(3)> when finished with the
+raw string data. It is also needed when multiple read-only I<str(3)> module
+functions need to be called atomically. It is the caller's responsibility to
+call I<str_unlock(3)> after the atomic operation. The only functions that
+may be called on C<str> between calls to I<str_rdlock(3)> and
+I<str_unlock(3)> are I<cstr(3)> and any read-only I<str(3)> module functions
+whose name ends with C<_unlocked>. On success, returns C<0>. On error,
+returns an error code.
 
 =cut
 
 */
 
-String *str_remove_range_unlocked(String *str, ssize_t index, ssize_t range)
-{
-	if (!str)
-		return set_errnull(EINVAL);
-
-	if (index < 0)
-		index = str->length + index;
-
-	if (index < 0)
-		return set_errnull(EINVAL);
-
-	if (range < 0)
-		range = str->length + range - index;
-
-	if (range < 0)
-		return set_errnull(EINVAL);
-
-	if (str->length - 1 < index + range)
-		return set_errnull(EINVAL);
-
-	contract(str, index, range);
+#define str_rdlock(str) ((str) ? locker_rdlock((str)->locker) : EINVAL)
+#define str_wrlock(str) ((str) ? locker_wrlock((str)->locker) : EINVAL)
+#define str_unlock(str) ((str) ? locker_unlock((str)->locker) : EINVAL)
 
-	return str;
+int (str_rdlock)(const String *str)
+{
+	return str_rdlock(str);
 }
 
 /*
 
-=item C<String *str_insert(String *str, ssize_t index, const char *format, ...)>
+=item C<int str_wrlock(const String *str)>
 
-Adds the string specified by C<format> to C<str> at position C<index>. If
-C<index> is negative, it refers to a character position relative to the end
-of the string (C<-1> is the position after the last character, C<-2> is the
-position of the last character, and so on). On success, returns C<str>. On
-error, returns C<null> with C<errno> set appropriately.
+Claims a write lock on C<str> (if C<str> was created with a I<Locker>).
+Clients need to call this before calling I<cstr(3)> (for the purpose of
+modifying the raw string data) on a string that was created with a
+I<Locker>. It is the client's responsibility to call I<str_unlock(3)> when
+finished with the raw string data. It is also needed when multiple
+read/write I<str(3)> module functions need to be called atomically. It is
+the caller's responsibility to call I<str_unlock(3)> after the atomic
+operation. The only functions that may be called on C<str> between calls to
+I<str_wrlock(3)> and I<str_unlock(3)> are I<cstr(3)> and any I<str(3)>
+module functions whose name ends with C<_unlocked>. On success, returns
+C<0>. On error, returns an error code.
 
 =cut
 
 */
 
-String *str_insert(String *str, ssize_t index, const char *format, ...)
+int (str_wrlock)(const String *str)
 {
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vinsert(str, index, format, args);
-	va_end(args);
-	return ret;
+	return str_wrlock(str);
 }
 
 /*
 
-=item C<String *str_insert_unlocked(String *str, ssize_t index, const char *format, ...)>
+=item C<int str_unlock(const String *str)>
 
-Equivalent to I<str_insert(3)> except that C<str> is not write-locked.
+Unlocks a read lock or a write lock on C<str> obtained with I<str_rdlock(3)>
+or I<str_wrlock(3)> (if C<str> was created with a I<Locker>). On success,
+returns C<0>. On error, returns an error code.
 
 =cut
 
 */
 
-String *str_insert_unlocked(String *str, ssize_t index, const char *format, ...)
+int (str_unlock)(const String *str)
 {
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vinsert_unlocked(str, index, format, args);
-	va_end(args);
-	return ret;
+	return str_unlock(str);
 }
 
 /*
 
-=item C<String *str_vinsert(String *str, ssize_t index, const char *format, va_list args)>
+=item C<int str_empty(const String *str)>
 
-Equivalent to I<str_insert(3)> with the variable argument list specified
-directly as for I<vprintf(3)>.
+Returns whether or not C<str> is the empty string. On error, returns C<-1>
+with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_vinsert(String *str, ssize_t index, const char *format, va_list args)
+int str_empty(const String *str)
 {
-	String *ret;
+	int empty;
 	int err;
 
 	if (!str)
-		return set_errnull(EINVAL);
+		return set_errno(EINVAL);
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
+	if ((err = str_rdlock(str)))
+		return set_errno(err);
 
-	ret = str_vinsert_unlocked(str, index, format, args);
+	empty = str_empty_unlocked(str);
 
 	if ((err = str_unlock(str)))
-		return set_errnull(err);
+		return set_errno(err);
 
-	return ret;
+	return empty;
 }
 
 /*
 
-=item C<String *str_vinsert_unlocked(String *str, ssize_t index, const char *format, va_list args)>
+=item C<int str_empty_unlocked(const String *str)>
 
-Equivalent to I<str_vinsert(3)> except that C<str> is not write-locked.
+Equivalent to I<str_empty(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_vinsert_unlocked(String *str, ssize_t index, const char *format, va_list args)
+int str_empty_unlocked(const String *str)
 {
-	String *tmp, *ret;
-
 	if (!str)
-		return set_errnull(EINVAL);
-
-	if (index < 0)
-		index = str->length + index;
-
-	if (index < 0)
-		return set_errnull(EINVAL);
-
-	if (str->length - 1 < index)
-		return set_errnull(EINVAL);
-
-	if (!(tmp = str_vcreate(format, args)))
-		return NULL;
-
-	ret = str_insert_str_unlocked(str, index, tmp);
-	str_release(tmp);
+		return set_errno(EINVAL);
 
-	return ret;
+	return (str->length == 1);
 }
 
 /*
 
-=item C<String *str_insert_str(String *str, ssize_t index, const String *src)>
+=item C<ssize_t str_length(const String *str)>
 
-Inserts C<src> into C<str>, starting at position C<index>. If C<index> is
-negative, it refers to a character position relative to the end of the
-string (C<-1> is the position after the last character, C<-2> is the
-position of the last character, and so on). On success, returns C<str>. On
-error, returns C<null> with C<errno> set appropriately.
+Returns the length of C<str>. On error, returns C<-1> with C<errno> set
+appropriately. If C<str>'s I<Locker> was created by
+I<locker_create_seqlock(3)>, this is an optimistic read (see
+I<locker_read_begin(3)>).
 
 =cut
 
 */
 
-String *str_insert_str(String *str, ssize_t index, const String *src)
+ssize_t (str_length)(const String *str)
 {
-	String *ret;
+	unsigned long seq;
+	size_t length;
 	int err;
 
-	if (!str || !src)
-		return set_errnull(EINVAL);
-
-	if ((err = str_rdlock(src)))
-		return set_errnull(err);
+	if (!str)
+		return set_errno(EINVAL);
 
-	if ((err = str_wrlock(str)))
+	do
 	{
-		str_unlock(src);
-		return set_errnull(err);
-	}
+		if ((err = locker_read_begin(str->locker, &seq)))
+			return set_errno(err);
 
-	ret = str_insert_str_unlocked(str, index, src);
-
-	if ((err = str_unlock(str)))
-	{
-		str_unlock(src);
-		return set_errnull(err);
+		length = str->length - 1;
 	}
+	while ((err = locker_read_validate(str->locker, seq)) == EAGAIN);
 
-	if ((err = str_unlock(src)))
-		return set_errnull(err);
+	if (err)
+		return set_errno(err);
 
-	return ret;
+	return length;
 }
-
 /*
 
-=item C<String *str_insert_str_unlocked(String *str, ssize_t index, const String *src)>
+=item C<ssize_t str_length_unlocked(const String *str)>
 
-Equivalent to I<str_insert_str(3)> except that C<str> is not write-locked
-and C<src> is not read-locked. Note: If C<src> needs to be read-locked, it
-is the caller's responsibility to lock and unlock it explicitly with
-I<str_rdlock(3)> and I<str_unlock(3)>.
+Equivalent to I<str_length(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_insert_str_unlocked(String *str, ssize_t index, const String *src)
+ssize_t (str_length_unlocked)(const String *str)
 {
-	size_t length;
+	if (!str)
+		return set_errno(EINVAL);
 
-	if (!str || !src)
-		return set_errnull(EINVAL);
+	return str->length - 1;
+}
 
-	if (index < 0)
-		index = str->length + index;
+/*
 
-	if (index < 0)
-		return set_errnull(EINVAL);
+=item C<char *cstr(const String *str)>
 
-	if (str->length - 1 < index)
-		return set_errnull(EINVAL);
+Returns the raw I<C> string in C<str>. Do not use this pointer to extend the
+length of the string. It's OK to use it to reduce the length of the string,
+provided that you call I<str_set_length_unlocked(3)> or
+I<str_recalc_length_unlocked(3)> immediately afterwards. If the string was
+created with I<str_share(3)> (or shared by it), call I<str_unshare(3)>
+before modifying it via this pointer. When used on a string that is shared
+by multiple threads, I<cstr(3)> must appear between calls to
+I<str_rdlock(3)> or I<str_wrlock(3)> and I<str_unlock(3)>.
 
-	length = src->length - 1;
+=cut
 
-	if (expand(str, index, length) == -1)
-		return NULL;
+*/
 
-	memcpy(str->str + index, src->str, length);
+char *(cstr)(const String *str)
+{
+	if (!str)
+		return set_errnull(EINVAL);
 
-	return str;
+	return str->str;
 }
 
 /*
 
-=item C<String *str_append(String *str, const char *format, ...)>
+=item C<ssize_t str_set_length(String *str, size_t length)>
 
-Appends the string specified by C<format> to C<str>. On success, returns
-C<str>. On error, returns C<null> with C<errno> set appropriately.
+Sets the length of C<str> to C<length>. Only needed after the raw I<C>
+string returned by I<cstr(3)> has been used to shorten a string. On success,
+returns the length of C<str>. On error, returns C<-1> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-String *str_append(String *str, const char *format, ...)
+ssize_t str_set_length(String *str, size_t length)
 {
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vinsert(str, -1, format, args);
-	va_end(args);
-	return ret;
+	ssize_t len;
+	int err;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if ((err = str_wrlock(str)))
+		return set_errno(err);
+
+	len = str_set_length_unlocked(str, length);
+
+	if ((err = str_unlock(str)))
+		return set_errno(err);
+
+	return len;
 }
 
 /*
 
-=item C<String *str_append_unlocked(String *str, const char *format, ...)>
+=item C<ssize_t str_set_length_unlocked(String *str, size_t length)>
 
-Equivalent to I<str_append(3)> except that C<str> is not write-locked.
+Equivalent to I<str_set_length(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_append_unlocked(String *str, const char *format, ...)
+ssize_t str_set_length_unlocked(String *str, size_t length)
 {
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vinsert_unlocked(str, -1, format, args);
-	va_end(args);
-	return ret;
+	if (!str || length >= str->length)
+		return set_errno(EINVAL);
+
+	if (unshare(str, str->size) == -1)
+		return -1;
+
+	str->length = length + 1;
+	str->str[str->length - 1] = '\0';
+
+	return str->length - 1;
 }
 
 /*
 
-=item C<String *str_vappend(String *str, const char *format, va_list args)>
+=item C<ssize_t str_recalc_length(String *str)>
 
-Equivalent to I<str_append(3)> with the variable argument list specified
-directly as for I<vprintf(3)>.
+Calculates and stores the length of C<str>. Only needed after the raw I<C>
+string returned by I<cstr(3)> has been used to shorten a string. Note:
+Treats C<str> as a C<nul>-terminated string and should be avoided. Use
+I<str_set_length(3)> instead. On success, returns the length of C<str>. On
+error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_vappend(String *str, const char *format, va_list args)
+ssize_t str_recalc_length(String *str)
 {
-	return str_vinsert(str, -1, format, args);
+	ssize_t len;
+	int err;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if ((err = str_wrlock(str)))
+		return set_errno(err);
+
+	len = str_recalc_length_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errno(err);
+
+	return len;
 }
 
 /*
 
-=item C<String *str_vappend_unlocked(String *str, const char *format, va_list args)>
+=item C<ssize_t str_recalc_length_unlocked(String *str)>
 
-Equivalent to I<str_vappend(3)> except that C<str> is not write-locked.
+Equivalent to I<str_recalc_length(3)> except that C<str> is not
+write-locked.
 
 =cut
 
 */
 
-String *str_vappend_unlocked(String *str, const char *format, va_list args)
+ssize_t str_recalc_length_unlocked(String *str)
 {
-	return str_vinsert_unlocked(str, -1, format, args);
+	if (!str)
+		return set_errno(EINVAL);
+
+	str->length = strlen(str->str) + 1;
+
+	return str->length - 1;
 }
 
 /*
 
-=item C<String *str_append_str(String *str, const String *src)>
+=item C<String *str_clear(String *str)>
 
-Appends C<src> to C<str>. On success, returns C<str>. On error, returns
+Makes C<str> the empty string. On success, returns C<str>. On error, returns
 C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_append_str(String *str, const String *src)
+String *str_clear(String *str)
 {
-	return str_insert_str(str, -1, src);
+	return str_remove_range(str, 0, -1);
 }
 
 /*
 
-=item C<String *str_append_str_unlocked(String *str, const String *src)>
+=item C<String *str_clear_unlocked(String *str)>
 
-Equivalent to I<str_append_str(3)> except that C<str> is not write-locked
-and C<src> is not read-locked. Note: If C<src> needs to be read-locked, it
-is the caller's responsibility to lock and unlock it explicitly with
-I<str_rdlock(3)> and I<str_unlock(3)>.
+Equivalent to I<str_clear(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_append_str_unlocked(String *str, const String *src)
+String *str_clear_unlocked(String *str)
 {
-	return str_insert_str_unlocked(str, -1, src);
+	return str_remove_range_unlocked(str, 0, -1);
 }
 
 /*
 
-=item C<String *str_prepend(String *str, const char *format, ...)>
+=item C<String *str_remove(String *str, ssize_t index)>
 
-Prepends the string specified by C<format> to C<str>. On success, returns
-C<str>. On error, returns C<null> with C<errno> set appropriately.
+Removes the C<index>'th character from C<str>. If C<index> is negative, it
+refers to a character position relative to the end of the string (C<-1> is
+the position after the last character, C<-2> is the position of the last
+character, and so on). On success, returns C<str>. On error, returns C<null>
+with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_prepend(String *str, const char *format, ...)
+String *str_remove(String *str, ssize_t index)
 {
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vinsert(str, 0, format, args);
-	va_end(args);
-	return ret;
+	return str_remove_range(str, index, 1);
 }
 
 /*
 
-=item C<String *str_prepend_unlocked(String *str, const char *format, ...)>
+=item C<String *str_remove_unlocked(String *str, ssize_t index)>
 
-Equivalent to I<str_prepend(3)> except that C<str> is not write-locked.
+Equivalent to I<str_remove(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_prepend_unlocked(String *str, const char *format, ...)
+String *str_remove_unlocked(String *str, ssize_t index)
 {
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vinsert_unlocked(str, 0, format, args);
-	va_end(args);
-	return ret;
+	return str_remove_range_unlocked(str, index, 1);
 }
 
 /*
 
-=item C<String *str_vprepend(String *str, const char *format, va_list args)>
+=item C<String *str_remove_range(String *str, ssize_t index, ssize_t range)>
 
-Equivalent to I<str_prepend(3)> with the variable argument list specified
-directly as for I<vprintf(3)>.
+Removes C<range> characters from C<str> starting at C<index>. If C<index> or
+C<range> are negative, they refer to character positions relative to the end
+of the string (C<-1> is the position after the last character, C<-2> is the
+position of the last character, and so on). On success, returns C<str>. On
+error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_vprepend(String *str, const char *format, va_list args)
+String *str_remove_range(String *str, ssize_t index, ssize_t range)
 {
-	return str_vinsert(str, 0, format, args);
-}
-
-/*
+	String *ret;
+	int err;
 
-=item C<String *str_vprepend_unlocked(String *str, const char *format, va_list args)>
+	if (!str)
+		return set_errnull(EINVAL);
 
-Equivalent to I<str_vprepend(3)> except that C<str> is not write-locked.
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
 
-=cut
+	ret = str_remove_range_unlocked(str, index, range);
 
-*/
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
 
-String *str_vprepend_unlocked(String *str, const char *format, va_list args)
-{
-	return str_vinsert_unlocked(str, 0, format, args);
+	return ret;
 }
 
 /*
 
-=item C<String *str_prepend_str(String *str, const String *src)>
+=item C<String *str_remove_range_unlocked(String *str, ssize_t index, ssize_t range)>
 
-Prepends C<src> to C<str>. On success, returns C<str>. On error, returns
-C<null> with C<errno> set appropriately.
+Equivalent to I<str_remove_range(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_prepend_str(String *str, const String *src)
+String *str_remove_range_unlocked(String *str, ssize_t index, ssize_t range)
 {
-	return str_insert_str(str, 0, src);
-}
+	if (!str)
+		return set_errnull(EINVAL);
 
-/*
+	if (index < 0)
+		index = str->length + index;
 
-=item C<String *str_prepend_str_unlocked(String *str, const String *src)>
+	if (index < 0)
+		return set_errnull(EINVAL);
 
-Equivalent to I<str_prepend_str(3)> except that C<str> is not write-locked
-and C<src> is not read-locked. Note: If C<src> needs to be read-locked, it
-is the caller's responsibility to lock and unlock it explicitly with
-I<str_rdlock(3)> and I<str_unlock(3)>.
+	if (range < 0)
+		range = str->length + range - index;
 
-=cut
+	if (range < 0)
+		return set_errnull(EINVAL);
 
-*/
+	if (str->length - 1 < index + range)
+		return set_errnull(EINVAL);
 
-String *str_prepend_str_unlocked(String *str, const String *src)
-{
-	return str_insert_str_unlocked(str, 0, src);
+	contract(str, index, range);
+
+	return str;
 }
 
 /*
 
-=item C<String *str_replace(String *str, ssize_t index, ssize_t range, const char *format, ...)>
+=item C<String *str_insert(String *str, ssize_t index, const char *format, ...)>
 
-Replaces C<range> characters in C<str>, starting at C<index>, with the
-string specified by C<format>. If C<index> or C<range> are negative, they
-refer to character positions relative to the end of the string (C<-1> is the
-position after the last character, C<-2> is the position of the last
-character, and so on). On success, returns C<str>. On error, returns C<null>
-with C<errno> set appropriately.
+Adds the string specified by C<format> to C<str> at position C<index>. If
+C<index> is negative, it refers to a character position relative to the end
+of the string (C<-1> is the position after the last character, C<-2> is the
+position of the last character, and so on). On success, returns C<str>. On
+error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_replace(String *str, ssize_t index, ssize_t range, const char *format, ...)
+String *str_insert(String *str, ssize_t index, const char *format, ...)
 {
 	String *ret;
 	va_list args;
 	va_start(args, format);
-	ret = str_vreplace(str, index, range, format, args);
+	ret = str_vinsert(str, index, format, args);
 	va_end(args);
 	return ret;
 }
 
 /*
 
-=item C<String *str_replace_unlocked(String *str, ssize_t index, ssize_t range, const char *format, ...)>
+=item C<String *str_insert_unlocked(String *str, ssize_t index, const char *format, ...)>
 
-Equivalent to I<str_replace(3)> except that C<str> is not write-locked.
+Equivalent to I<str_insert(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_replace_unlocked(String *str, ssize_t index, ssize_t range, const char *format, ...)
+String *str_insert_unlocked(String *str, ssize_t index, const char *format, ...)
 {
 	String *ret;
 	va_list args;
 	va_start(args, format);
-	ret = str_vreplace_unlocked(str, index, range, format, args);
+	ret = str_vinsert_unlocked(str, index, format, args);
 	va_end(args);
 	return ret;
 }
 
 /*
 
-=item C<String *str_vreplace(String *str, ssize_t index, ssize_t range, const char *format, va_list args)>
+=item C<String *str_vinsert(String *str, ssize_t index, const char *format, va_list args)>
 
-Equivalent to I<str_replace(3)> with the variable argument list specified
+Equivalent to I<str_insert(3)> with the variable argument list specified
 directly as for I<vprintf(3)>.
 
 =cut
 
 */
 
-String *str_vreplace(String *str, ssize_t index, ssize_t range, const char *format, va_list args)
+String *str_vinsert(String *str, ssize_t index, const char *format, va_list args)
 {
-	String *tmp, *ret;
+	String *ret;
+	int err;
 
 	if (!str)
 		return set_errnull(EINVAL);
 
-	if (!(tmp = str_vcreate(format, args)))
-		return NULL;
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
 
-	ret = str_replace_str(str, index, range, tmp);
-	str_release(tmp);
+	ret = str_vinsert_unlocked(str, index, format, args);
+
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_vreplace_unlocked(String *str, ssize_t index, ssize_t range, const char *format, va_list args)>
+=item C<String *str_vinsert_unlocked(String *str, ssize_t index, const char *format, va_list args)>
 
-Equivalent to I<str_vreplace(3)> except that C<str> is not write-locked.
+Equivalent to I<str_vinsert(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_vreplace_unlocked(String *str, ssize_t index, ssize_t range, const char *format, va_list args)
+String *str_vinsert_unlocked(String *str, ssize_t index, const char *format, va_list args)
 {
 	String *tmp, *ret;
 
 	if (!str)
 		return set_errnull(EINVAL);
 
+	if (index < 0)
+		index = str->length + index;
+
+	if (index < 0)
+		return set_errnull(EINVAL);
+
+	if (str->length - 1 < index)
+		return set_errnull(EINVAL);
+
 	if (!(tmp = str_vcreate(format, args)))
 		return NULL;
 
-	ret = str_replace_str_unlocked(str, index, range, tmp);
+	ret = str_insert_str_unlocked(str, index, tmp);
 	str_release(tmp);
 
 	return ret;
@@ -1843,25 +2136,24 @@ String *str_vreplace_unlocked(String *str, ssize_t index, ssize_t range, const c
 
 /*
 
-=item C<String *str_replace_str(String *str, ssize_t index, ssize_t range, const String *src)>
+=item C<String *str_insert_str(String *str, ssize_t index, const String *src)>
 
-Replaces C<range> characters in C<str>, starting at C<index>, with C<src>.
-If C<index> or C<range> are negative, they refer to character positions
-relative to the end of the string (C<-1> is the position after the last
-character, C<-2> is the position of the last character, and so on). On
-success, return C<str>. On error, returns C<null> with C<errno> set
-appropriately.
+Inserts C<src> into C<str>, starting at position C<index>. If C<index> is
+negative, it refers to a character position relative to the end of the
+string (C<-1> is the position after the last character, C<-2> is the
+position of the last character, and so on). On success, returns C<str>. On
+error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_replace_str(String *str, ssize_t index, ssize_t range, const String *src)
+String *str_insert_str(String *str, ssize_t index, const String *src)
 {
 	String *ret;
 	int err;
 
-	if (!src || !str)
+	if (!str || !src)
 		return set_errnull(EINVAL);
 
 	if ((err = str_rdlock(src)))
@@ -1873,7 +2165,7 @@ String *str_replace_str(String *str, ssize_t index, ssize_t range, const String
 		return set_errnull(err);
 	}
 
-	ret = str_replace_str_unlocked(str, index, range, src);
+	ret = str_insert_str_unlocked(str, index, src);
 
 	if ((err = str_unlock(str)))
 	{
@@ -1889,9 +2181,9 @@ String *str_replace_str(String *str, ssize_t index, ssize_t range, const String
 
 /*
 
-=item C<String *str_replace_str_unlocked(String *str, ssize_t index, ssize_t range, const String *src)>
+=item C<String *str_insert_str_unlocked(String *str, ssize_t index, const String *src)>
 
-Equivalent to I<str_replace_str(3)> except that C<str> is not write-locked
+Equivalent to I<str_insert_str(3)> except that C<str> is not write-locked
 and C<src> is not read-locked. Note: If C<src> needs to be read-locked, it
 is the caller's responsibility to lock and unlock it explicitly with
 I<str_rdlock(3)> and I<str_unlock(3)>.
@@ -1900,11 +2192,11 @@ I<str_rdlock(3)> and I<str_unlock(3)>.
 
 */
 
-String *str_replace_str_unlocked(String *str, ssize_t index, ssize_t range, const String *src)
+String *str_insert_str_unlocked(String *str, ssize_t index, const String *src)
 {
 	size_t length;
 
-	if (!src || !str)
+	if (!str || !src)
 		return set_errnull(EINVAL);
 
 	if (index < 0)
@@ -1913,18 +2205,12 @@ String *str_replace_str_unlocked(String *str, ssize_t index, ssize_t range, cons
 	if (index < 0)
 		return set_errnull(EINVAL);
 
-	if (range < 0)
-		range = str->length + range - index;
-
-	if (range < 0)
-		return set_errnull(EINVAL);
-
-	if (str->length - 1 < index + range)
+	if (str->length - 1 < index)
 		return set_errnull(EINVAL);
 
 	length = src->length - 1;
 
-	if (adjust(str, index, range, length) == -1)
+	if (expand(str, index, length) == -1)
 		return NULL;
 
 	memcpy(str->str + index, src->str, length);
@@ -1934,753 +2220,1154 @@ String *str_replace_str_unlocked(String *str, ssize_t index, ssize_t range, cons
 
 /*
 
-=item C<String *str_substr(const String *str, ssize_t index, ssize_t range)>
+=item C<String *str_append(String *str, const char *format, ...)>
 
-Creates a new I<String> object consisting of C<range> characters from
-C<str>, starting at C<index>. If C<index> or C<range> are negative, they
-refer to character positions relative to the end of the string (C<-1> is the
-position after the last character, C<-2> is the position of the last
-character, and so on). On success, returns the new string. It is the
-caller's responsibility to deallocate the new string with I<str_release(3)>
-or I<str_destroy(3)>. On error, returns C<null> with C<errno> set
-appropriately.
+Appends the string specified by C<format> to C<str>. On success, returns
+C<str>. On error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_substr(const String *str, ssize_t index, ssize_t range)
+String *str_append(String *str, const char *format, ...)
 {
-	return str_substr_with_locker(NULL, str, index, range);
+	String *ret;
+	va_list args;
+	va_start(args, format);
+	ret = str_vinsert(str, -1, format, args);
+	va_end(args);
+	return ret;
 }
 
 /*
 
-=item C<String *str_substr_unlocked(const String *str, ssize_t index, ssize_t range)>
+=item C<String *str_append_unlocked(String *str, const char *format, ...)>
 
-Equivalent to I<str_substr(3)> except that C<str> is not read-locked.
+Equivalent to I<str_append(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_substr_unlocked(const String *str, ssize_t index, ssize_t range)
+String *str_append_unlocked(String *str, const char *format, ...)
 {
-	return str_substr_with_locker_unlocked(NULL, str, index, range);
+	String *ret;
+	va_list args;
+	va_start(args, format);
+	ret = str_vinsert_unlocked(str, -1, format, args);
+	va_end(args);
+	return ret;
 }
 
 /*
 
-=item C<String *str_substr_with_locker(Locker *locker, const String *str, ssize_t index, ssize_t range)>
+=item C<String *str_vappend(String *str, const char *format, va_list args)>
 
-Equivalent to I<str_substr(3)> except that multiple threads accessing the
-new substring will be synchronised by C<locker>.
+Equivalent to I<str_append(3)> with the variable argument list specified
+directly as for I<vprintf(3)>.
 
 =cut
 
 */
 
-String *str_substr_with_locker(Locker *locker, const String *str, ssize_t index, ssize_t range)
+String *str_vappend(String *str, const char *format, va_list args)
 {
-	String *ret;
-	int err;
+	return str_vinsert(str, -1, format, args);
+}
 
-	if (!str)
-		return set_errnull(EINVAL);
+/*
 
-	if ((err = str_rdlock(str)))
-		return set_errnull(err);
+=item C<String *str_vappend_unlocked(String *str, const char *format, va_list args)>
 
-	ret = str_substr_with_locker_unlocked(locker, str, index, range);
+Equivalent to I<str_vappend(3)> except that C<str> is not write-locked.
 
-	if ((err = str_unlock(str)))
-		return set_errnull(err);
+=cut
 
-	return ret;
+*/
+
+String *str_vappend_unlocked(String *str, const char *format, va_list args)
+{
+	return str_vinsert_unlocked(str, -1, format, args);
 }
 
 /*
 
-=item C<String *str_substr_with_locker_unlocked(Locker *locker, const String *str, ssize_t index, ssize_t range)>
+=item C<String *str_append_str(String *str, const String *src)>
 
-Equivalent to I<str_substr_with_locker(3)> except that C<str> is not
-read-locked.
+Appends C<src> to C<str>. On success, returns C<str>. On error, returns
+C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_substr_with_locker_unlocked(Locker *locker, const String *str, ssize_t index, ssize_t range)
+String *str_append_str(String *str, const String *src)
 {
-	String *ret;
-
-	if (!str)
-		return set_errnull(EINVAL);
-
-	if (index < 0)
-		index = str->length + index;
-
-	if (index < 0)
-		return set_errnull(EINVAL);
+	return str_insert_str(str, -1, src);
+}
 
-	if (range < 0)
-		range = str->length + range - index;
+/*
 
-	if (range < 0)
-		return set_errnull(EINVAL);
+=item C<String *str_append_str_unlocked(String *str, const String *src)>
 
-	if (str->length - 1 < index + range)
-		return set_errnull(EINVAL);
+Equivalent to I<str_append_str(3)> except that C<str> is not write-locked
+and C<src> is not read-locked. Note: If C<src> needs to be read-locked, it
+is the caller's responsibility to lock and unlock it explicitly with
+I<str_rdlock(3)> and I<str_unlock(3)>.
 
-	if (!(ret = str_create_with_locker_sized(locker, range + 1, NULL)))
-		return NULL;
+=cut
 
-	memcpy(ret->str, str->str + index, range);
-	ret->length = range + 1;
-	ret->str[ret->length - 1] = '\0';
+*/
 
-	return ret;
+String *str_append_str_unlocked(String *str, const String *src)
+{
+	return str_insert_str_unlocked(str, -1, src);
 }
 
 /*
 
-=item C<String *substr(const char *str, ssize_t index, ssize_t range)>
+=item C<String *str_prepend(String *str, const char *format, ...)>
 
-Equivalent to I<str_substr(3)> but works on an ordinary I<C> string.
+Prepends the string specified by C<format> to C<str>. On success, returns
+C<str>. On error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *substr(const char *str, ssize_t index, ssize_t range)
+String *str_prepend(String *str, const char *format, ...)
 {
-	return substr_with_locker(NULL, str, index, range);
+	String *ret;
+	va_list args;
+	va_start(args, format);
+	ret = str_vinsert(str, 0, format, args);
+	va_end(args);
+	return ret;
 }
 
 /*
 
-=item C<String *substr_with_locker(Locker *locker, const char *str, ssize_t index, ssize_t range)>
+=item C<String *str_prepend_unlocked(String *str, const char *format, ...)>
 
-Equivalent to I<substr(3)> except that multiple threads accessing the new
-substring will be synchronised by C<locker>. Note that no locking is
-performed on C<str> as it is a raw I<C> string.
+Equivalent to I<str_prepend(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *substr_with_locker(Locker *locker, const char *str, ssize_t index, ssize_t range)
+String *str_prepend_unlocked(String *str, const char *format, ...)
 {
 	String *ret;
-	size_t len = 0;
-
-	if (!str)
-		return set_errnull(EINVAL);
-
-	if (index < 0 || range < 0)
-		len = strlen(str) + 1;
-
-	if (index < 0)
-		index = len + index;
+	va_list args;
+	va_start(args, format);
+	ret = str_vinsert_unlocked(str, 0, format, args);
+	va_end(args);
+	return ret;
+}
 
-	if (index < 0)
-		return set_errnull(EINVAL);
+/*
 
-	if (range < 0)
-		range = len + range - index;
+=item C<String *str_vprepend(String *str, const char *format, va_list args)>
 
-	if (range < 0)
-		return set_errnull(EINVAL);
+Equivalent to I<str_prepend(3)> with the variable argument list specified
+directly as for I<vprintf(3)>.
 
-	if (!(ret = str_create_with_locker_sized(locker, range + 1, NULL)))
-		return NULL;
+=cut
 
-	memcpy(ret->str, str + index, range);
-	ret->length = range + 1;
-	ret->str[ret->length - 1] = '\0';
+*/
 
-	return ret;
+String *str_vprepend(String *str, const char *format, va_list args)
+{
+	return str_vinsert(str, 0, format, args);
 }
 
 /*
 
-=item C<String *str_splice(String *str, ssize_t index, ssize_t range)>
+=item C<String *str_vprepend_unlocked(String *str, const char *format, va_list args)>
 
-Removes a substring from C<str> starting at C<index> of length C<range>
-characters. If C<index> or C<range> are negative, they refer to character
-positions relative to the end of the string (C<-1> is the position after the
-last character, C<-2> is the position of the last character, and so on). On
-success, returns the substring. It is the caller's responsibility to
-deallocate the new substring with I<str_release(3)> or I<str_destroy(3)>. It
-is strongly recommended to use I<str_destroy(3)>, because it also sets the
-pointer variable to C<null>. On error, returns C<null> with C<errno> set
-appropriately.
+Equivalent to I<str_vprepend(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_splice(String *str, ssize_t index, ssize_t range)
+String *str_vprepend_unlocked(String *str, const char *format, va_list args)
 {
-	return str_splice_with_locker(NULL, str, index, range);
+	return str_vinsert_unlocked(str, 0, format, args);
 }
 
 /*
 
-=item C<String *str_splice_unlocked(String *str, ssize_t index, ssize_t range)>
+=item C<String *str_prepend_str(String *str, const String *src)>
 
-Equivalent to I<str_splice(3)> except that C<str> is not write-locked.
+Prepends C<src> to C<str>. On success, returns C<str>. On error, returns
+C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_splice_unlocked(String *str, ssize_t index, ssize_t range)
+String *str_prepend_str(String *str, const String *src)
 {
-	return str_splice_with_locker_unlocked(NULL, str, index, range);
+	return str_insert_str(str, 0, src);
 }
 
 /*
 
-=item C<String *str_splice_with_locker(Locker *locker, String *str, ssize_t index, ssize_t range)>
+=item C<String *str_prepend_str_unlocked(String *str, const String *src)>
 
-Equivalent to I<str_splice(3)> except that multiple threads accessing the
-new string will be synchronised by C<locker>.
+Equivalent to I<str_prepend_str(3)> except that C<str> is not write-locked
+and C<src> is not read-locked. Note: If C<src> needs to be read-locked, it
+is the caller's responsibility to lock and unlock it explicitly with
+I<str_rdlock(3)> and I<str_unlock(3)>.
 
 =cut
 
 */
 
-String *str_splice_with_locker(Locker *locker, String *str, ssize_t index, ssize_t range)
+String *str_prepend_str_unlocked(String *str, const String *src)
 {
-	String *ret;
-	int err;
+	return str_insert_str_unlocked(str, 0, src);
+}
 
-	if (!str)
-		return set_errnull(EINVAL);
+/*
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
+=item C<String *str_replace(String *str, ssize_t index, ssize_t range, const char *format, ...)>
 
-	ret = str_splice_with_locker_unlocked(locker, str, index, range);
+Replaces C<range> characters in C<str>, starting at C<index>, with the
+string specified by C<format>. If C<index> or C<range> are negative, they
+refer to character positions relative to the end of the string (C<-1> is the
+position after the last character, C<-2> is the position of the last
+character, and so on). On success, returns C<str>. On error, returns C<null>
+with C<errno> set appropriately.
 
-	if ((err = str_unlock(str)))
-	{
-		str_release(ret);
-		return set_errnull(err);
-	}
+=cut
 
+*/
+
+String *str_replace(String *str, ssize_t index, ssize_t range, const char *format, ...)
+{
+	String *ret;
+	va_list args;
+	va_start(args, format);
+	ret = str_vreplace(str, index, range, format, args);
+	va_end(args);
 	return ret;
 }
 
 /*
 
-=item C<String *str_splice_with_locker_unlocked(Locker *locker, String *str, ssize_t index, ssize_t range)>
+=item C<String *str_replace_unlocked(String *str, ssize_t index, ssize_t range, const char *format, ...)>
 
-Equivalent to I<str_splice_with_locker(3)> except that C<str> is not
-write-locked.
+Equivalent to I<str_replace(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_splice_with_locker_unlocked(Locker *locker, String *str, ssize_t index, ssize_t range)
+String *str_replace_unlocked(String *str, ssize_t index, ssize_t range, const char *format, ...)
 {
 	String *ret;
-
-	if (!str)
-		return set_errnull(EINVAL);
-
-	if (!(ret = str_substr_with_locker_unlocked(locker, str, index, range)))
-		return NULL;
-
-	if (!str_remove_range_unlocked(str, index, range))
-	{
-		str_release(ret);
-		return NULL;
-	}
-
+	va_list args;
+	va_start(args, format);
+	ret = str_vreplace_unlocked(str, index, range, format, args);
+	va_end(args);
 	return ret;
 }
 
 /*
 
-=item C<String *str_repeat(size_t count, const char *format, ...)>
+=item C<String *str_vreplace(String *str, ssize_t index, ssize_t range, const char *format, va_list args)>
 
-Creates a new I<String> containing the string determined by C<format>
-repeated C<count> times. On success, return the new string. It is the
-caller's responsibility to deallocate the new string with I<str_release(3)>
-or I<str_destroy(3)>. It is strongly recommended to use I<str_destroy(3)>,
-because it also sets the pointer variable to C<null>. On error, returns
-C<null> with C<errno> set appropriately.
+Equivalent to I<str_replace(3)> with the variable argument list specified
+directly as for I<vprintf(3)>.
 
 =cut
 
 */
 
-String *str_repeat(size_t count, const char *format, ...)
+String *str_vreplace(String *str, ssize_t index, ssize_t range, const char *format, va_list args)
 {
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vrepeat_with_locker(NULL, count, format, args);
-	va_end(args);
-	return ret;
-}
-
-/*
-
-=item C<String *str_repeat_with_locker(Locker *locker, size_t count, const char *format, ...)>
+	String *tmp, *ret;
 
-Equivalent to I<str_repeat(3)> except that multiple threads accessing the
-new string will be synchronised by C<locker>.
+	if (!str)
+		return set_errnull(EINVAL);
 
-=cut
+	if (!(tmp = str_vcreate(format, args)))
+		return NULL;
 
-*/
+	ret = str_replace_str(str, index, range, tmp);
+	str_release(tmp);
 
-String *str_repeat_with_locker(Locker *locker, size_t count, const char *format, ...)
-{
-	String *ret;
-	va_list args;
-	va_start(args, format);
-	ret = str_vrepeat_with_locker(locker, count, format, args);
-	va_end(args);
 	return ret;
 }
 
 /*
 
-=item C<String *str_vrepeat(size_t count, const char *format, va_list args)>
+=item C<String *str_vreplace_unlocked(String *str, ssize_t index, ssize_t range, const char *format, va_list args)>
 
-Equivalent to I<str_repeat(3)> with the variable argument list specified
-directly as for I<vprintf(3)>.
+Equivalent to I<str_vreplace(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_vrepeat(size_t count, const char *format, va_list args)
+String *str_vreplace_unlocked(String *str, ssize_t index, ssize_t range, const char *format, va_list args)
 {
-	return str_vrepeat_with_locker(NULL, count, format, args);
+	String *tmp, *ret;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if (!(tmp = str_vcreate(format, args)))
+		return NULL;
+
+	ret = str_replace_str_unlocked(str, index, range, tmp);
+	str_release(tmp);
+
+	return ret;
 }
 
 /*
 
-=item C<String *str_vrepeat_with_locker(Locker *locker, size_t count, const char *format, va_list args)>
+=item C<String *str_replace_str(String *str, ssize_t index, ssize_t range, const String *src)>
 
-Equivalent to I<str_vrepeat(3)> except that multiple threads accessing the
-new string will be synchronised by C<locker>.
+Replaces C<range> characters in C<str>, starting at C<index>, with C<src>.
+If C<index> or C<range> are negative, they refer to character positions
+relative to the end of the string (C<-1> is the position after the last
+character, C<-2> is the position of the last character, and so on). On
+success, return C<str>. On error, returns C<null> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-String *str_vrepeat_with_locker(Locker *locker, size_t count, const char *format, va_list args)
+String *str_replace_str(String *str, ssize_t index, ssize_t range, const String *src)
 {
-	String *tmp, *ret;
-	ssize_t length;
-	size_t i;
+	String *ret;
+	int err;
 
-	if (!(tmp = str_vcreate(format, args)))
-		return NULL;
+	if (!src || !str)
+		return set_errnull(EINVAL);
 
-	if ((length = str_length(tmp)) == -1)
-		return NULL;
+	if ((err = str_rdlock(src)))
+		return set_errnull(err);
 
-	if (!(ret = str_create_with_locker_sized(locker, length * count + 1, NULL)))
+	if ((err = str_wrlock(str)))
 	{
-		str_release(tmp);
-		return NULL;
+		str_unlock(src);
+		return set_errnull(err);
 	}
 
-	for (i = 0; i < count; ++i)
+	ret = str_replace_str_unlocked(str, index, range, src);
+
+	if ((err = str_unlock(str)))
 	{
-		if (!str_append_str(ret, tmp))
-		{
-			str_release(tmp);
-			str_release(ret);
-			return NULL;
-		}
+		str_unlock(src);
+		return set_errnull(err);
 	}
 
-	str_release(tmp);
+	if ((err = str_unlock(src)))
+		return set_errnull(err);
 
 	return ret;
 }
 
 /*
 
-=item C<int str_tr(String *str, const char *from, const char *to, int option)>
-
-This is just like the I<perl(1) tr> operator. The following documentation
-was taken from I<perlop(1)>.
-
-Transliterates all occurrences of the characters in C<from> with the
-corresponding character in C<to>. On success, returns the number of
-characters replaced or deleted. On error, returns C<-1> with C<errno> set
-appropriately.
+=item C<String *str_replace_str_unlocked(String *str, ssize_t index, ssize_t range, const String *src)>
 
-A character range can be specified with a hyphen, so C<str_tr(str, "A-J",
-"0-9")> does the same replacement as C<str_tr(str, "ACEGIBDFHJ",
-"0246813579")>.
+Equivalent to I<str_replace_str(3)> except that C<str> is not write-locked
+and C<src> is not read-locked. Note: If C<src> needs to be read-locked, it
+is the caller's responsibility to lock and unlock it explicitly with
+I<str_rdlock(3)> and I<str_unlock(3)>.
 
-Note also that the whole range idea is rather unportable between character
-sets - and even within character sets they might cause results you probably
-didn't expect. A sound principle is to use only ranges that begin from and
-end at either alphabets of equal case (a-e, A-E), or digits (0-4). Anything
-else is unsafe. If in doubt, spell out the character sets in full.
+=cut
 
-Options:
+*/
 
-    TR_COMPLEMENT Complement from.
-    TR_DELETE     Delete found but unreplaced characters.
-    TR_SQUASH     Squash duplicate replaced characters.
+String *str_replace_str_unlocked(String *str, ssize_t index, ssize_t range, const String *src)
+{
+	size_t length;
 
-If C<TR_COMPLEMENT> is specified, C<from> is complemented. If C<TR_DELETE>
-is specified, any characters specified by C<from> not found in C<to> are
-deleted. (Note that this is slightly more flexible than the behavior of some
-tr programs, which delete anything they find in C<from>.) If C<TR_SQUASH> is
-specified, sequences of characters that were transliterated to the same
-character are squashed down to a single instance of the character.
+	if (!src || !str)
+		return set_errnull(EINVAL);
 
-If C<TR_DELETE> is used, C<to> is always interpreted exactly as specified.
-Otherwise, if C<to> is shorter than C<from>, the final character is
-replicated till it is long enough. If C<to> is empty or C<null>, C<from> is
-replicated. This latter is useful for counting characters in a class or for
-squashing character sequences in a class.
+	if (index < 0)
+		index = str->length + index;
 
-Examples:
+	if (index < 0)
+		return set_errnull(EINVAL);
 
-    str_tr(s, "A-Z", "a-z", 0);             // canonicalize to lower case
-    str_tr(s, "a-z", "A-Z", 0);             // canonicalize to upper case
-    str_tr(s, "a-zA-Z", "A-Za-z", 0);       // swap upper and lower case
-    str_tr(s, "*", "*", 0);                 // count the stars in str
-    str_tr(s, "0-9", "", 0);                // count the digits in $_
-    str_tr(s, "a-zA-Z", "", TR_SQUASH);     // bookkeeper -> bokeper
-    str_tr(s, "a-zA-Z", " ", TR_COMPLEMENT | TR_SQUASH); // change non-alphas to single space
-    str_tr(c, "a-zA-Z", "n-za-mN-ZA-M", 0); // Rot13
+	if (range < 0)
+		range = str->length + range - index;
 
-    from = str_create("\200-\377");
-    to = str_create("%c-\177", '\000');
-    str_tr_str(s, from, to, 0);             // clear 8th bit
+	if (range < 0)
+		return set_errnull(EINVAL);
 
-If multiple transliterations are given for a character, only the first one
-is used:
+	if (str->length - 1 < index + range)
+		return set_errnull(EINVAL);
 
-    str_tr(str, "AAA", "XYZ", 0);
+	length = src->length - 1;
 
-will transliterate any A to X.
+	if (adjust(str, index, range, length) == -1)
+		return NULL;
 
-=cut
+	memcpy(str->str + index, src->str, length);
 
-*/
+	return str;
+}
 
-static StringTR *tr_compile_table(StringTR *table, const char *from, const char *to, int option);
+/*
 
-int str_tr(String *str, const char *from, const char *to, int option)
-{
-	StringTR table[1];
+=item C<String *str_substr(const String *str, ssize_t index, ssize_t range)>
 
-	if (!str || !from)
-		return set_errno(EINVAL);
+Creates a new I<String> object consisting of C<range> characters from
+C<str>, starting at C<index>. If C<index> or C<range> are negative, they
+refer to character positions relative to the end of the string (C<-1> is the
+position after the last character, C<-2> is the position of the last
+character, and so on). On success, returns the new string. It is the
+caller's responsibility to deallocate the new string with I<str_release(3)>
+or I<str_destroy(3)>. On error, returns C<null> with C<errno> set
+appropriately.
 
-	table->locker = NULL;
+=cut
 
-	if (!tr_compile_table(table, from, to, option))
-		return -1;
+*/
 
-	return str_tr_compiled(str, table);
+String *str_substr(const String *str, ssize_t index, ssize_t range)
+{
+	return str_substr_with_locker(NULL, str, index, range);
 }
 
 /*
 
-=item C<int str_tr_unlocked(String *str, const char *from, const char *to, int option)>
+=item C<String *str_substr_unlocked(const String *str, ssize_t index, ssize_t range)>
 
-Equivalent to I<str_tr(3)> except that C<str> is not write-locked.
+Equivalent to I<str_substr(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-int str_tr_unlocked(String *str, const char *from, const char *to, int option)
+String *str_substr_unlocked(const String *str, ssize_t index, ssize_t range)
 {
-	StringTR table[1];
-
-	if (!str || !from)
-		return set_errno(EINVAL);
-
-	table->locker = NULL;
-
-	if (!tr_compile_table(table, from, to, option))
-		return -1;
-
-	return str_tr_compiled_unlocked(str, table);
+	return str_substr_with_locker_unlocked(NULL, str, index, range);
 }
 
 /*
 
-=item C<int str_tr_str(String *str, const String *from, const String *to, int option)>
+=item C<String *str_substr_with_locker(Locker *locker, const String *str, ssize_t index, ssize_t range)>
 
-Equivalent to I<str_tr(3)> except that C<from> and C<to> are I<String>
-objects. This is needed when C<from> or C<to> need to contain C<nul>
-characters.
+Equivalent to I<str_substr(3)> except that multiple threads accessing the
+new substring will be synchronised by C<locker>.
 
 =cut
 
 */
 
-static StringTR *str_tr_compile_table(StringTR *table, const String *from, const String *to, int option);
-
-int str_tr_str(String *str, const String *from, const String *to, int option)
+String *str_substr_with_locker(Locker *locker, const String *str, ssize_t index, ssize_t range)
 {
-	StringTR table[1];
+	String *ret;
+	int err;
 
-	if (!str || !from)
-		return set_errno(EINVAL);
+	if (!str)
+		return set_errnull(EINVAL);
 
-	table->locker = NULL;
+	if ((err = str_rdlock(str)))
+		return set_errnull(err);
 
-	if (!str_tr_compile_table(table, from, to, option))
-		return -1;
+	ret = str_substr_with_locker_unlocked(locker, str, index, range);
 
-	return str_tr_compiled(str, table);
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
+
+	return ret;
 }
 
 /*
 
-=item C<int str_tr_str_unlocked(String *str, const String *from, const String *to, int option)>
+=item C<String *str_substr_with_locker_unlocked(Locker *locker, const String *str, ssize_t index, ssize_t range)>
 
-Equivalent to I<str_tr_str(3)> except that C<str> is not write-locked and
-C<from> and C<to> are not read-locked. Note: If C<to> and C<from> need to be
-read-locked, it is the caller's responsibility to lock and unlock them
-explicitly with I<str_rdlock(3)> and I<str_unlock(3)>.
+Equivalent to I<str_substr_with_locker(3)> except that C<str> is not
+read-locked.
 
 =cut
 
 */
 
-static StringTR *str_tr_compile_table_unlocked(StringTR *table, const String *from, const String *to, int option);
-
-int str_tr_str_unlocked(String *str, const String *from, const String *to, int option)
+String *str_substr_with_locker_unlocked(Locker *locker, const String *str, ssize_t index, ssize_t range)
 {
-	StringTR table[1];
+	String *ret;
 
-	if (!str || !from)
-		return set_errno(EINVAL);
+	if (!str)
+		return set_errnull(EINVAL);
 
-	table->locker = NULL;
+	if (index < 0)
+		index = str->length + index;
 
-	if (!str_tr_compile_table_unlocked(table, from, to, option))
-		return -1;
+	if (index < 0)
+		return set_errnull(EINVAL);
 
-	return str_tr_compiled_unlocked(str, table);
+	if (range < 0)
+		range = str->length + range - index;
+
+	if (range < 0)
+		return set_errnull(EINVAL);
+
+	if (str->length - 1 < index + range)
+		return set_errnull(EINVAL);
+
+	if (!(ret = str_create_with_locker_sized(locker, range + 1, NULL)))
+		return NULL;
+
+	memcpy(ret->str, str->str + index, range);
+	ret->length = range + 1;
+	ret->str[ret->length - 1] = '\0';
+
+	return ret;
 }
 
 /*
 
-=item C<int tr(char *str, const char *from, const char *to, int option)>
+=item C<String *substr(const char *str, ssize_t index, ssize_t range)>
 
-Equivalent to I<str_tr(3)> but works on an ordinary I<C> string.
+Equivalent to I<str_substr(3)> but works on an ordinary I<C> string.
 
 =cut
 
 */
 
-int tr(char *str, const char *from, const char *to, int option)
+String *substr(const char *str, ssize_t index, ssize_t range)
 {
-	StringTR table[1];
-
-	if (!str || !from)
-		return set_errno(EINVAL);
-
-	table->locker = NULL;
-
-	if (!tr_compile_table(table, from, to, option))
-		return -1;
-
-	return tr_compiled(str, table);
+	return substr_with_locker(NULL, str, index, range);
 }
 
 /*
 
-=item C<StringTR *tr_compile(const char *from, const char *to, int option)>
+=item C<String *substr_with_locker(Locker *locker, const char *str, ssize_t index, ssize_t range)>
 
-Compiles C<from>, C<to> and C<option> into a translation table to be passed
-to I<str_tr_compiled(3)> or I<tr_compiled(3)>. On success, returns the new
-translation table. It is the caller's responsibility to deallocate the
-translation table with I<tr_release(3)> or I<tr_destroy(3)>. It is strongly
-recommended to use I<tr_destroy(3)>, because it also sets the pointer
-variable to C<null>. On error, returns C<null> with C<errno> set
-appropriately.
+Equivalent to I<substr(3)> except that multiple threads accessing the new
+substring will be synchronised by C<locker>. Note that no locking is
+performed on C<str> as it is a raw I<C> string.
 
 =cut
 
 */
 
-StringTR *tr_compile(const char *from, const char *to, int option)
+String *substr_with_locker(Locker *locker, const char *str, ssize_t index, ssize_t range)
 {
-	return tr_compile_with_locker(NULL, from, to, option);
-}
+	String *ret;
+	size_t len = 0;
 
-/*
+	if (!str)
+		return set_errnull(EINVAL);
 
-=item C<StringTR *tr_compile_with_locker(Locker *locker, const char *from, const char *to, int option)>
+	if (index < 0 || range < 0)
+		len = strlen(str) + 1;
 
-Equivalent to I<tr_compile(3)> except that multiple threads accessing the new
-translation table will be synchronised by C<locker>.
+	if (index < 0)
+		index = len + index;
 
-=cut
+	if (index < 0)
+		return set_errnull(EINVAL);
 
-*/
+	if (range < 0)
+		range = len + range - index;
 
-StringTR *tr_compile_with_locker(Locker *locker, const char *from, const char *to, int option)
-{
-	StringTR *ret;
+	if (range < 0)
+		return set_errnull(EINVAL);
 
-	if (!(ret = mem_new(StringTR))) /* XXX decouple */
+	if (!(ret = str_create_with_locker_sized(locker, range + 1, NULL)))
 		return NULL;
 
-	ret->locker = locker;
+	memcpy(ret->str, str + index, range);
+	ret->length = range + 1;
+	ret->str[ret->length - 1] = '\0';
 
-	return tr_compile_table(ret, from, to, option);
+	return ret;
 }
 
 /*
 
-=item C<StringTR *str_tr_compile(const String *from, const String *to, int option)>
+=item C<String *str_splice(String *str, ssize_t index, ssize_t range)>
 
-Equivalent to I<tr_compile(3)> except that C<from> and C<to> are I<String>
-objects. This is needed when C<from> or C<to> need to contain C<nul>
-characters.
+Removes a substring from C<str> starting at C<index> of length C<range>
+characters. If C<index> or C<range> are negative, they refer to character
+positions relative to the end of the string (C<-1> is the position after the
+last character, C<-2> is the position of the last character, and so on). On
+success, returns the substring. It is the caller's responsibility to
+deallocate the new substring with I<str_release(3)> or I<str_destroy(3)>. It
+is strongly recommended to use I<str_destroy(3)>, because it also sets the
+pointer variable to C<null>. On error, returns C<null> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-StringTR *str_tr_compile(const String *from, const String *to, int option)
+String *str_splice(String *str, ssize_t index, ssize_t range)
 {
-	return str_tr_compile_with_locker(NULL, from, to, option);
+	return str_splice_with_locker(NULL, str, index, range);
 }
 
 /*
 
-=item C<StringTR *str_tr_compile_unlocked(const String *from, const String *to, int option)>
+=item C<String *str_splice_unlocked(String *str, ssize_t index, ssize_t range)>
 
-Equivalent to I<str_tr_compile(3)> except that C<from> and C<to> are not
-read-locked.
+Equivalent to I<str_splice(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-StringTR *str_tr_compile_unlocked(const String *from, const String *to, int option)
+String *str_splice_unlocked(String *str, ssize_t index, ssize_t range)
 {
-	return str_tr_compile_with_locker_unlocked(NULL, from, to, option);
+	return str_splice_with_locker_unlocked(NULL, str, index, range);
 }
 
 /*
 
-=item C<StringTR *str_tr_compile_with_locker(Locker *locker, const String *from, const String *to, int option)>
+=item C<String *str_splice_with_locker(Locker *locker, String *str, ssize_t index, ssize_t range)>
 
-Equivalent to I<str_tr_compile(3)> except that multiple threads accessing
-the new translation table will be synchronised by C<locker>.
+Equivalent to I<str_splice(3)> except that multiple threads accessing the
+new string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-StringTR *str_tr_compile_with_locker(Locker *locker, const String *from, const String *to, int option)
+String *str_splice_with_locker(Locker *locker, String *str, ssize_t index, ssize_t range)
 {
-	StringTR *ret;
+	String *ret;
+	int err;
 
-	if (!(ret = mem_new(StringTR))) /* XXX decouple */
-		return NULL;
+	if (!str)
+		return set_errnull(EINVAL);
 
-	ret->locker = locker;
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
 
-	return str_tr_compile_table(ret, from, to, option);
+	ret = str_splice_with_locker_unlocked(locker, str, index, range);
+
+	if ((err = str_unlock(str)))
+	{
+		str_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
 }
 
 /*
 
-=item C<StringTR *str_tr_compile_with_locker_unlocked(Locker *locker, const String *from, const String *to, int option)>
+=item C<String *str_splice_with_locker_unlocked(Locker *locker, String *str, ssize_t index, ssize_t range)>
 
-Equivalent to I<str_tr_compile_with_locker(3)> except that C<from> and C<to>
-are not read-locked. Note: If C<to> and C<from> need to be read-locked, it
-is the caller's responsibility to lock and unlock them explicitly with
-I<str_rdlock(3)> and I<str_unlock(3)>.
+Equivalent to I<str_splice_with_locker(3)> except that C<str> is not
+write-locked.
 
 =cut
 
 */
 
-StringTR *str_tr_compile_with_locker_unlocked(Locker *locker, const String *from, const String *to, int option)
+String *str_splice_with_locker_unlocked(Locker *locker, String *str, ssize_t index, ssize_t range)
 {
-	StringTR *ret;
+	String *ret;
 
-	if (!(ret = mem_new(StringTR))) /* XXX decouple */
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if (!(ret = str_substr_with_locker_unlocked(locker, str, index, range)))
 		return NULL;
 
-	ret->locker = locker;
+	if (!str_remove_range_unlocked(str, index, range))
+	{
+		str_release(ret);
+		return NULL;
+	}
 
-	return str_tr_compile_table_unlocked(ret, from, to, option);
+	return ret;
 }
 
 /*
 
-=item C<void tr_release(StringTR *table)>
+=item C<String *str_repeat(size_t count, const char *format, ...)>
 
-Releases (deallocates) C<table>.
+Creates a new I<String> containing the string determined by C<format>
+repeated C<count> times. On success, return the new string. It is the
+caller's responsibility to deallocate the new string with I<str_release(3)>
+or I<str_destroy(3)>. It is strongly recommended to use I<str_destroy(3)>,
+because it also sets the pointer variable to C<null>. On error, returns
+C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-void tr_release(StringTR *table)
+String *str_repeat(size_t count, const char *format, ...)
 {
-	Locker *locker;
-
-	if (!table)
-		return;
-
-	locker = table->locker;
-	if (locker_wrlock(locker))
-		return;
-
-	mem_release(table);
-	locker_unlock(locker);
+	String *ret;
+	va_list args;
+	va_start(args, format);
+	ret = str_vrepeat_with_locker(NULL, count, format, args);
+	va_end(args);
+	return ret;
 }
 
 /*
 
-=item C<void *tr_destroy(StringTR **table)>
+=item C<String *str_repeat_with_locker(Locker *locker, size_t count, const char *format, ...)>
 
-Destroys (deallocates and sets to C<null>) C<*table>. Returns C<null>.
-B<Note:> translation tables shared by multiple threads must not be destroyed
-until after all threads have finished with it.
+Equivalent to I<str_repeat(3)> except that multiple threads accessing the
+new string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-void *tr_destroy(StringTR **table)
+String *str_repeat_with_locker(Locker *locker, size_t count, const char *format, ...)
 {
-	if (table && *table)
-	{
-		tr_release(*table);
-		*table = NULL;
-	}
-
-	return NULL;
+	String *ret;
+	va_list args;
+	va_start(args, format);
+	ret = str_vrepeat_with_locker(locker, count, format, args);
+	va_end(args);
+	return ret;
 }
 
 /*
 
-C<static StringTR *do_tr_compile_table(StringTR *table, const char *from, ssize_t fromlen, const char *to, ssize_t tolen, int option)>
+=item C<String *str_vrepeat(size_t count, const char *format, va_list args)>
 
-Compiles C<from>, C<to> and C<option> into the translation table, C<table>,
-to be passed to I<str_tr_compiled(3)> or I<tr_compiled(3)>. If C<fromlen> is
+Equivalent to I<str_repeat(3)> with the variable argument list specified
+directly as for I<vprintf(3)>.
+
+=cut
+
+*/
+
+String *str_vrepeat(size_t count, const char *format, va_list args)
+{
+	return str_vrepeat_with_locker(NULL, count, format, args);
+}
+
+/*
+
+=item C<String *str_vrepeat_with_locker(Locker *locker, size_t count, const char *format, va_list args)>
+
+Equivalent to I<str_vrepeat(3)> except that multiple threads accessing the
+new string will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+String *str_vrepeat_with_locker(Locker *locker, size_t count, const char *format, va_list args)
+{
+	String *tmp, *ret;
+	ssize_t length;
+	size_t i;
+
+	if (!(tmp = str_vcreate(format, args)))
+		return NULL;
+
+	if ((length = str_length(tmp)) == -1)
+		return NULL;
+
+	if (!(ret = str_create_with_locker_sized(locker, length * count + 1, NULL)))
+	{
+		str_release(tmp);
+		return NULL;
+	}
+
+	for (i = 0; i < count; ++i)
+	{
+		if (!str_append_str(ret, tmp))
+		{
+			str_release(tmp);
+			str_release(ret);
+			return NULL;
+		}
+	}
+
+	str_release(tmp);
+
+	return ret;
+}
+
+/*
+
+=item C<int str_tr(String *str, const char *from, const char *to, int option)>
+
+This is just like the I<perl(1) tr> operator. The following documentation
+was taken from I<perlop(1)>.
+
+Transliterates all occurrences of the characters in C<from> with the
+corresponding character in C<to>. On success, returns the number of
+characters replaced or deleted. On error, returns C<-1> with C<errno> set
+appropriately.
+
+A character range can be specified with a hyphen, so C<str_tr(str, "A-J",
+"0-9")> does the same replacement as C<str_tr(str, "ACEGIBDFHJ",
+"0246813579")>.
+
+Note also that the whole range idea is rather unportable between character
+sets - and even within character sets they might cause results you probably
+didn't expect. A sound principle is to use only ranges that begin from and
+end at either alphabets of equal case (a-e, A-E), or digits (0-4). Anything
+else is unsafe. If in doubt, spell out the character sets in full.
+
+Options:
+
+    TR_COMPLEMENT Complement from.
+    TR_DELETE     Delete found but unreplaced characters.
+    TR_SQUASH     Squash duplicate replaced characters.
+
+If C<TR_COMPLEMENT> is specified, C<from> is complemented. If C<TR_DELETE>
+is specified, any characters specified by C<from> not found in C<to> are
+deleted. (Note that this is slightly more flexible than the behavior of some
+tr programs, which delete anything they find in C<from>.) If C<TR_SQUASH> is
+specified, sequences of characters that were transliterated to the same
+character are squashed down to a single instance of the character.
+
+If C<TR_DELETE> is used, C<to> is always interpreted exactly as specified.
+Otherwise, if C<to> is shorter than C<from>, the final character is
+replicated till it is long enough. If C<to> is empty or C<null>, C<from> is
+replicated. This latter is useful for counting characters in a class or for
+squashing character sequences in a class.
+
+Examples:
+
+    str_tr(s, "A-Z", "a-z", 0);             // canonicalize to lower case
+    str_tr(s, "a-z", "A-Z", 0);             // canonicalize to upper case
+    str_tr(s, "a-zA-Z", "A-Za-z", 0);       // swap upper and lower case
+    str_tr(s, "*", "*", 0);                 // count the stars in str
+    str_tr(s, "0-9", "", 0);                // count the digits in $_
+    str_tr(s, "a-zA-Z", "", TR_SQUASH);     // bookkeeper -> bokeper
+    str_tr(s, "a-zA-Z", " ", TR_COMPLEMENT | TR_SQUASH); // change non-alphas to single space
+    str_tr(c, "a-zA-Z", "n-za-mN-ZA-M", 0); // Rot13
+
+    from = str_create("\200-\377");
+    to = str_create("%c-\177", '\000');
+    str_tr_str(s, from, to, 0);             // clear 8th bit
+
+If multiple transliterations are given for a character, only the first one
+is used:
+
+    str_tr(str, "AAA", "XYZ", 0);
+
+will transliterate any A to X.
+
+=cut
+
+*/
+
+static StringTR *tr_compile_table(StringTR *table, const char *from, const char *to, int option);
+
+int str_tr(String *str, const char *from, const char *to, int option)
+{
+	StringTR table[1];
+
+	if (!str || !from)
+		return set_errno(EINVAL);
+
+	table->locker = NULL;
+
+	if (!tr_compile_table(table, from, to, option))
+		return -1;
+
+	return str_tr_compiled(str, table);
+}
+
+/*
+
+=item C<int str_tr_unlocked(String *str, const char *from, const char *to, int option)>
+
+Equivalent to I<str_tr(3)> except that C<str> is not write-locked.
+
+=cut
+
+*/
+
+int str_tr_unlocked(String *str, const char *from, const char *to, int option)
+{
+	StringTR table[1];
+
+	if (!str || !from)
+		return set_errno(EINVAL);
+
+	table->locker = NULL;
+
+	if (!tr_compile_table(table, from, to, option))
+		return -1;
+
+	return str_tr_compiled_unlocked(str, table);
+}
+
+/*
+
+=item C<int str_tr_str(String *str, const String *from, const String *to, int option)>
+
+Equivalent to I<str_tr(3)> except that C<from> and C<to> are I<String>
+objects. This is needed when C<from> or C<to> need to contain C<nul>
+characters.
+
+=cut
+
+*/
+
+static StringTR *str_tr_compile_table(StringTR *table, const String *from, const String *to, int option);
+
+int str_tr_str(String *str, const String *from, const String *to, int option)
+{
+	StringTR table[1];
+
+	if (!str || !from)
+		return set_errno(EINVAL);
+
+	table->locker = NULL;
+
+	if (!str_tr_compile_table(table, from, to, option))
+		return -1;
+
+	return str_tr_compiled(str, table);
+}
+
+/*
+
+=item C<int str_tr_str_unlocked(String *str, const String *from, const String *to, int option)>
+
+Equivalent to I<str_tr_str(3)> except that C<str> is not write-locked and
+C<from> and C<to> are not read-locked. Note: If C<to> and C<from> need to be
+read-locked, it is the caller's responsibility to lock and unlock them
+explicitly with I<str_rdlock(3)> and I<str_unlock(3)>.
+
+=cut
+
+*/
+
+static StringTR *str_tr_compile_table_unlocked(StringTR *table, const String *from, const String *to, int option);
+
+int str_tr_str_unlocked(String *str, const String *from, const String *to, int option)
+{
+	StringTR table[1];
+
+	if (!str || !from)
+		return set_errno(EINVAL);
+
+	table->locker = NULL;
+
+	if (!str_tr_compile_table_unlocked(table, from, to, option))
+		return -1;
+
+	return str_tr_compiled_unlocked(str, table);
+}
+
+/*
+
+=item C<int tr(char *str, const char *from, const char *to, int option)>
+
+Equivalent to I<str_tr(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+int tr(char *str, const char *from, const char *to, int option)
+{
+	StringTR table[1];
+
+	if (!str || !from)
+		return set_errno(EINVAL);
+
+	table->locker = NULL;
+
+	if (!tr_compile_table(table, from, to, option))
+		return -1;
+
+	return tr_compiled(str, table);
+}
+
+/*
+
+=item C<StringTR *tr_compile(const char *from, const char *to, int option)>
+
+Compiles C<from>, C<to> and C<option> into a translation table to be passed
+to I<str_tr_compiled(3)> or I<tr_compiled(3)>. On success, returns the new
+translation table. It is the caller's responsibility to deallocate the
+translation table with I<tr_release(3)> or I<tr_destroy(3)>. It is strongly
+recommended to use I<tr_destroy(3)>, because it also sets the pointer
+variable to C<null>. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+StringTR *tr_compile(const char *from, const char *to, int option)
+{
+	return tr_compile_with_locker(NULL, from, to, option);
+}
+
+/*
+
+=item C<StringTR *tr_compile_with_locker(Locker *locker, const char *from, const char *to, int option)>
+
+Equivalent to I<tr_compile(3)> except that multiple threads accessing the new
+translation table will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+StringTR *tr_compile_with_locker(Locker *locker, const char *from, const char *to, int option)
+{
+	StringTR *ret;
+
+	if (!(ret = mem_new(StringTR))) /* XXX decouple */
+		return NULL;
+
+	ret->locker = locker;
+
+	return tr_compile_table(ret, from, to, option);
+}
+
+/*
+
+=item C<StringTR *str_tr_compile(const String *from, const String *to, int option)>
+
+Equivalent to I<tr_compile(3)> except that C<from> and C<to> are I<String>
+objects. This is needed when C<from> or C<to> need to contain C<nul>
+characters.
+
+=cut
+
+*/
+
+StringTR *str_tr_compile(const String *from, const String *to, int option)
+{
+	return str_tr_compile_with_locker(NULL, from, to, option);
+}
+
+/*
+
+=item C<StringTR *str_tr_compile_unlocked(const String *from, const String *to, int option)>
+
+Equivalent to I<str_tr_compile(3)> except that C<from> and C<to> are not
+read-locked.
+
+=cut
+
+*/
+
+StringTR *str_tr_compile_unlocked(const String *from, const String *to, int option)
+{
+	return str_tr_compile_with_locker_unlocked(NULL, from, to, option);
+}
+
+/*
+
+=item C<StringTR *str_tr_compile_with_locker(Locker *locker, const String *from, const String *to, int option)>
+
+Equivalent to I<str_tr_compile(3)> except that multiple threads accessing
+the new translation table will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+StringTR *str_tr_compile_with_locker(Locker *locker, const String *from, const String *to, int option)
+{
+	StringTR *ret;
+
+	if (!(ret = mem_new(StringTR))) /* XXX decouple */
+		return NULL;
+
+	ret->locker = locker;
+
+	return str_tr_compile_table(ret, from, to, option);
+}
+
+/*
+
+=item C<StringTR *str_tr_compile_with_locker_unlocked(Locker *locker, const String *from, const String *to, int option)>
+
+Equivalent to I<str_tr_compile_with_locker(3)> except that C<from> and C<to>
+are not read-locked. Note: If C<to> and C<from> need to be read-locked, it
+is the caller's responsibility to lock and unlock them explicitly with
+I<str_rdlock(3)> and I<str_unlock(3)>.
+
+=cut
+
+*/
+
+StringTR *str_tr_compile_with_locker_unlocked(Locker *locker, const String *from, const String *to, int option)
+{
+	StringTR *ret;
+
+	if (!(ret = mem_new(StringTR))) /* XXX decouple */
+		return NULL;
+
+	ret->locker = locker;
+
+	return str_tr_compile_table_unlocked(ret, from, to, option);
+}
+
+/*
+
+=item C<void tr_release(StringTR *table)>
+
+Releases (deallocates) C<table>.
+
+=cut
+
+*/
+
+void tr_release(StringTR *table)
+{
+	Locker *locker;
+
+	if (!table)
+		return;
+
+	locker = table->locker;
+	if (locker_wrlock(locker))
+		return;
+
+	mem_release(table);
+	locker_unlock(locker);
+}
+
+/*
+
+=item C<void *tr_destroy(StringTR **table)>
+
+Destroys (deallocates and sets to C<null>) C<*table>. Returns C<null>.
+B<Note:> translation tables shared by multiple threads must not be destroyed
+until after all threads have finished with it.
+
+=cut
+
+*/
+
+void *tr_destroy(StringTR **table)
+{
+	if (table && *table)
+	{
+		tr_release(*table);
+		*table = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+C<static StringTR *do_tr_compile_table(StringTR *table, const char *from, ssize_t fromlen, const char *to, ssize_t tolen, int option)>
+
+Compiles C<from>, C<to> and C<option> into the translation table, C<table>,
+to be passed to I<str_tr_compiled(3)> or I<tr_compiled(3)>. If C<fromlen> is
 C<-1>, then C<from> is interpreted as a C<nul>-terminated I<C> string.
 Otherwise, C<from> is an arbitrary string of length C<fromlen>. If C<tolen>
 is C<-1>, then C<to> is interpreted as a C<nul>-terminated I<C> string.
@@ -2689,157 +3376,5053 @@ returns C<table>. On error, returns C<null> with C<errno> set appropriately.
 
 */
 
-static StringTR *do_tr_compile_table(StringTR *table, const char *from, ssize_t fromlen, const char *to, ssize_t tolen, int option)
+static StringTR *do_tr_compile_table(StringTR *table, const char *from, ssize_t fromlen, const char *to, ssize_t tolen, int option)
+{
+	const char *f, *t;
+	char *xf, *xt;
+	char xfrom[CHARSET], xto[CHARSET];
+	short tbl[CHARSET];
+	int i, j, k;
+	int err;
+
+	if (!table || !from)
+		return set_errnull(EINVAL);
+
+	for (i = 0; i < CHARSET; ++i)
+		tbl[i] = TRCODE_NOMAP;
+
+	/* Parse the from string */
+
+	for (xf = xfrom, f = from; ((fromlen == -1) ? *f : (f - from < fromlen)) && xf - xfrom < CHARSET; ++f)
+	{
+		i = j = *f;
+
+		if (f[1] == '-' && f[2])
+			j = f[2], f += 2;
+
+		if ((unsigned char)j < (unsigned char)i)
+			return set_errnull(EINVAL);
+
+		for (k = (unsigned char)i; k <= (unsigned char)j; ++k)
+			*xf++ = tbl[k] = k;
+	}
+
+	if (xf - xfrom == CHARSET)
+		return set_errnull(EINVAL);
+
+	if (option & TR_COMPLEMENT)
+	{
+		char tmp[CHARSET];
+
+		for (xf = tmp, k = 0; k < CHARSET; ++k)
+			if (tbl[k] == TRCODE_NOMAP)
+				*xf++ = k;
+
+		memcpy(xfrom, tmp, xf - tmp);
+		xf = xfrom + (xf - tmp);
+	}
+
+	/* Parse the to string */
+
+	if (!to || ((tolen == -1) ? *to == '\0' : tolen == 0))
+		to = (option & TR_DELETE) ? "" : from;
+
+	for (xt = xto, t = to; ((tolen == -1) ? *t : (t - to < tolen)) && xt - xto < CHARSET; ++t)
+	{
+		i = j = *t;
+
+		if (t[1] == '-' && t[2])
+			j = t[2], t += 2;
+
+		if ((unsigned char)j < (unsigned char)i)
+			return set_errnull(EINVAL);
+
+		for (k = (unsigned char)i; k <= (unsigned char)j; ++k)
+			*xt++ = k;
+	}
+
+	if (xt - xto == CHARSET)
+		return set_errnull(EINVAL);
+
+	if (!(option & TR_DELETE))
+	{
+		size_t flen = xf - xfrom;
+		size_t tlen = xt - xto;
+
+		if (tlen < flen)
+		{
+			memset(xt, xt[-1], flen - tlen);
+			xt += flen - tlen;
+		}
+	}
+
+	/* Build the translation table */
+
+	if ((err = locker_wrlock(table->locker)))
+		return set_errnull(err);
+
+	table->squash = option & TR_SQUASH;
+	for (i = 0; i < CHARSET; ++i)
+		table->table[i] = TRCODE_NOMAP;
+
+	for (i = j = 0; xfrom + i < xf; ++i, ++j)
+	{
+		unsigned char fc = xfrom[i];
+		unsigned char tc = xto[j];
+		if (table->table[fc] == TRCODE_NOMAP)
+			table->table[fc] = (xto + j < xt) ? tc : TRCODE_DELETE;
+	}
+
+	if ((err = locker_unlock(table->locker)))
+		return set_errnull(err);
+
+	return table;
+}
+
+/*
+
+C<StringTR *tr_compile_table(StringTR *table, const char *from, const char *to, int option)>
+
+Equivalent to I<tr_compile(3)> except that C<from>, C<to> and C<option> are
+compiled into the translation table pointed to by C<table>. On success,
+returns C<table>. On error, returns C<null> with C<errno> set appropriately.
+
+*/
+
+static StringTR *tr_compile_table(StringTR *table, const char *from, const char *to, int option)
+{
+	return do_tr_compile_table(table, from, -1, to, -1, option);
+}
+
+/*
+
+C<StringTR *str_tr_compile_table(StringTR *table, const String *from, const String *to, int option)>
+
+Equivalent to I<tr_compile_table(3)> except that C<from> and C<to> are
+I<String> objects. This is needed when C<from> or C<to> need to contain
+C<nul> characters.
+
+*/
+
+static StringTR *str_tr_compile_table(StringTR *table, const String *from, const String *to, int option)
+{
+	StringTR *ret;
+	int err;
+
+	if ((err = str_rdlock(from)))
+		return set_errnull(err);
+
+	if ((err = str_rdlock(to)))
+	{
+		str_unlock(from);
+		return set_errnull(err);
+	}
+
+	ret = str_tr_compile_table_unlocked(table, from, to, option);
+
+	if ((err = str_unlock(from)))
+	{
+		str_unlock(to);
+		return set_errnull(err);
+	}
+
+	if ((err = str_unlock(to)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+C<StringTR *str_tr_compile_table_unlocked(StringTR *table, const String *from, const String *to, int option)>
+
+Equivalent to I<str_tr_compile_table(3)> except that C<from> and C<to> are
+not read-locked.
+
+*/
+
+static StringTR *str_tr_compile_table_unlocked(StringTR *table, const String *from, const String *to, int option)
+{
+	return do_tr_compile_table(table, from->str, str_length_unlocked(from), to->str, str_length_unlocked(to), option);
+}
+
+/*
+
+C<static int do_tr_compiled(unsigned char *str, size_t *length, StringTR *table)>
+
+Performs the character translation specified by C<table> (as created by
+I<tr_compile(3)> or equivalent) on C<str>. If C<length> is C<null>, C<str> is
+interpreted as a C<nul>-terminated I<C> string. Otherwise, C<str> is
+interpreted as an arbitrary string of length C<*length>. The integer that
+C<length> points to is decremented by the number of bytes deleted by the
+translation. On success, returns the number of characters replaced or
+deleted. On error, returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int do_tr_compiled(unsigned char *str, size_t *length, StringTR *table)
+{
+	int ret = 0;
+	int deleted = 0;
+	unsigned char *r, *s;
+	short t;
+	int err;
+
+	if (!str || !table)
+		return set_errno(EINVAL);
+
+	if ((err = locker_rdlock(table->locker)))
+		return set_errno(err);
+
+	for (r = s = str; (length) ? s - str < *length - 1 : *s; ++s)
+	{
+		switch (t = table->table[(int)*s])
+		{
+			case TRCODE_DELETE:
+				++deleted;
+				++ret;
+				break;
+
+			case TRCODE_NOMAP:
+				if (!table->squash || r == str || r[-1] != *s)
+					*r++ = *s;
+				else
+					++deleted;
+				break;
+
+			default:
+				if (!table->squash || r == str || r[-1] != t)
+					*r++ = t;
+				else
+					++deleted;
+				++ret;
+				break;
+		}
+	}
+
+	if ((err = locker_unlock(table->locker)))
+		return set_errno(err);
+
+	*r = '\0';
+	if (length && deleted)
+		*length -= deleted;
+
+	return ret;
+}
+
+/*
+
+=item C<int str_tr_compiled(String *str, StringTR *table)>
+
+Performs the character translation specified by C<table> (as created by
+I<tr_compile(3)> or equivalent) on C<str>. Use this whenever the same
+translation will be performed multiple times. On success, returns the number
+of characters replaced or deleted. On error, returns C<-1> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+int str_tr_compiled(String *str, StringTR *table)
+{
+	int ret;
+	int err;
+
+	if (!str || !table)
+		return set_errno(EINVAL);
+
+	if ((err = locker_rdlock(table->locker)))
+		return set_errno(err);
+
+	if ((err = str_wrlock(str)))
+	{
+		locker_unlock(table->locker);
+		return set_errno(err);
+	}
+
+	ret = str_tr_compiled_unlocked(str, table);
+
+	if ((err = str_unlock(str)))
+	{
+		locker_unlock(table->locker);
+		return set_errno(err);
+	}
+
+	if ((err = locker_unlock(table->locker)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int str_tr_compiled_unlocked(String *str, StringTR *table)>
+
+Equivalent to I<str_tr_compiled(3)> except that C<str> is not write-locked.
+
+=cut
+
+*/
+
+int str_tr_compiled_unlocked(String *str, StringTR *table)
+{
+	if (!str || !table)
+		return set_errno(EINVAL);
+
+	if (unshare(str, str->size) == -1)
+		return -1;
+
+	return do_tr_compiled((unsigned char *)str->str, &str->length, table);
+}
+
+/*
+
+=item C<int tr_compiled(char *str, StringTR *table)>
+
+Equivalent to I<str_tr_compiled(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+int tr_compiled(char *str, StringTR *table)
+{
+	int ret;
+	int err;
+
+	if (!str || !table)
+		return set_errno(EINVAL);
+
+	if ((err = locker_rdlock(table->locker)))
+		return set_errno(err);
+
+	ret = do_tr_compiled((unsigned char *)str, NULL, table);
+
+	if ((err = locker_unlock(table->locker)))
+		return set_errno(err);
+
+	return ret;
+}
+
+#ifdef HAVE_REGEX_H
+
+#define REGEX_MAX_INSTS 10000       /* Larger programs fall back to regcomp(3) */
+#define REGEX_MAX_GROUPS 255        /* More groups fall back to regcomp(3) */
+#define REGEX_DUP_MAX 255           /* Largest {m,n} bound (as in glibc) */
+#define REGEX_DFA_BUCKETS 1024      /* Hash table size for DFA states */
+#define REGEX_DFA_MEMORY (1 << 21)  /* Flush the DFA states beyond this size */
+
+/* NFA instructions */
+
+typedef enum
+{
+	RX_CLASS, /* consume a byte in class[x] then continue at pc + 1 */
+	RX_SPLIT, /* continue at x (preferred) and at y */
+	RX_JMP,   /* continue at x */
+	RX_SAVE,  /* record the position in capture slot y then continue at x */
+	RX_BOL,   /* continue at x if at the beginning of a line */
+	RX_EOL,   /* continue at x if at the end of a line */
+	RX_MATCH  /* success */
+}
+RegexOpCode;
+
+/* Parse tree nodes */
+
+typedef enum
+{
+	RN_CLASS,  /* class[arg] */
+	RN_BOL,    /* ^ */
+	RN_EOL,    /* $ */
+	RN_CAT,    /* left right */
+	RN_ALT,    /* left|right */
+	RN_GROUP,  /* (left) is subexpression arg */
+	RN_REPEAT  /* left{min,max} (max is -1 for no limit) */
+}
+RegexNodeType;
+
+/* DFA state flags */
+
+enum
+{
+	RS_BOL = 1,   /* the previous byte was a newline (or this is the start) */
+	RS_MATCH = 2, /* a match ended just before the byte that led here */
+	RS_EMPTY = 4  /* no partial matches are in progress */
+};
+
+typedef struct RegexInst RegexInst;
+typedef struct RegexNode RegexNode;
+typedef struct RegexParser RegexParser;
+typedef struct RegexState RegexState;
+typedef struct RegexThreads RegexThreads;
+typedef unsigned char RegexClass[CHARSET / 8];
+
+struct RegexInst
+{
+	RegexOpCode code; /* what to do */
+	int x;            /* next instruction, or class index for RX_CLASS */
+	int y;            /* alternative instruction or capture slot */
+};
+
+struct RegexNode
+{
+	RegexNodeType type; /* kind of node */
+	int left;           /* first (or only) child node */
+	int right;          /* second child node */
+	int arg;            /* class index or subexpression number */
+	int min, max;       /* repetition bounds */
+};
+
+struct RegexParser
+{
+	const unsigned char *p; /* current position in the pattern */
+	int cflags;             /* flags passed to regex_create() */
+	int depth;              /* parenthesis nesting level */
+	int groups;             /* number of subexpressions so far */
+	RegexNode *node;        /* parse tree */
+	int nodes;              /* number of nodes */
+	int nodes_size;         /* allocated nodes */
+	RegexClass *class;      /* byte sets */
+	int classes;            /* number of byte sets */
+	int classes_size;       /* allocated byte sets */
+	RegexInst *inst;        /* program */
+	int insts;              /* number of instructions */
+	int insts_size;         /* allocated instructions */
+};
+
+struct RegexState
+{
+	RegexState *chain;    /* next state in the same hash bucket */
+	unsigned int hash;    /* hash of flags and insts */
+	int flags;            /* RS_BOL, RS_MATCH and RS_EMPTY */
+	int skip;             /* the only byte that leaves an empty state, or -1 */
+	int ninsts;           /* number of NFA instructions */
+	int *insts;           /* NFA instructions waiting for the next byte */
+	RegexState *next[1];  /* transitions by byte class (null until needed) */
+};
+
+struct RegexThreads
+{
+	int *sparse;        /* index into dense of each visited instruction */
+	int *dense;         /* visited instructions */
+	int visited;        /* number of visited instructions */
+	int *pc;            /* instructions that consume a byte or match */
+	regoff_t *caps;     /* capture slots of each thread */
+	int threads;        /* number of threads */
+};
+
+struct Regex
+{
+	int cflags;              /* compilation flags */
+	size_t nsub;             /* number of subexpressions */
+	regex_t *posix;          /* fallback when the pattern isn't supported */
+	RegexInst *inst;         /* NFA program */
+	int insts;               /* number of instructions */
+	RegexClass *class;       /* byte sets for RX_CLASS */
+	int classes;             /* number of byte sets */
+	unsigned char byteclass[CHARSET]; /* bytes that behave identically share a class */
+	int byteclasses;         /* number of byte classes */
+	int anchors;             /* whether the program contains RX_BOL or RX_EOL */
+	RegexState **bucket;     /* DFA states hashed by contents */
+	size_t memory;           /* size of the DFA states */
+	unsigned long flushes;   /* number of times the DFA states were discarded */
+	int *work;               /* scratch space for DFA transitions */
+	int *stack;              /* scratch space for closures */
+	int *mark;               /* scratch space for closures */
+	regoff_t *capstack;      /* scratch space for NFA threads */
+	int ncaps;               /* capture slots per thread */
+	RegexThreads threads[2]; /* NFA simulation (allocated when needed) */
+	regoff_t *caps;          /* scratch capture slots */
+	regoff_t *best;          /* capture slots of the best match */
+	Locker *locker;          /* locking strategy for this object */
+};
+
+#define regex_inset(class, c) ((class)[(c) >> 3] & (1 << ((c) & 7)))
+#define regex_addset(class, c) ((class)[(c) >> 3] |= (1 << ((c) & 7)))
+
+/*
+
+C<static int regex_node(RegexParser *parser, RegexNodeType type, int left, int right, int arg)>
+
+Adds a node to the parse tree. On success, returns the index of the new
+node. On error, returns C<-1>.
+
+*/
+
+static int regex_node(RegexParser *parser, RegexNodeType type, int left, int right, int arg)
+{
+	RegexNode *node;
+
+	if (parser->nodes == parser->nodes_size)
+	{
+		int size = parser->nodes_size ? parser->nodes_size * 2 : 32;
+
+		if (!mem_resize(&parser->node, size))
+			return -1;
+
+		parser->nodes_size = size;
+	}
+
+	node = parser->node + parser->nodes;
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	node->arg = arg;
+	node->min = node->max = 0;
+
+	return parser->nodes++;
+}
+
+/*
+
+C<static int regex_class(RegexParser *parser)>
+
+Adds an empty byte set. On success, returns its index. On error, returns
+C<-1>.
+
+*/
+
+static int regex_class(RegexParser *parser)
+{
+	if (parser->classes == parser->classes_size)
+	{
+		int size = parser->classes_size ? parser->classes_size * 2 : 16;
+
+		if (!mem_resize(&parser->class, size))
+			return -1;
+
+		parser->classes_size = size;
+	}
+
+	memset(parser->class[parser->classes], 0, sizeof(RegexClass));
+
+	return parser->classes++;
+}
+
+/*
+
+C<static int regex_literal(RegexParser *parser, int c)>
+
+Adds a parse tree node that matches the byte, C<c> (either case when
+C<REG_ICASE> is set). On success, returns the index of the new node. On
+error, returns C<-1>.
+
+*/
+
+static int regex_literal(RegexParser *parser, int c)
+{
+	int class;
+
+	if ((class = regex_class(parser)) == -1)
+		return -1;
+
+	regex_addset(parser->class[class], c);
+
+	if (parser->cflags & REG_ICASE)
+	{
+		regex_addset(parser->class[class], tolower(c));
+		regex_addset(parser->class[class], toupper(c));
+	}
+
+	return regex_node(parser, RN_CLASS, -1, -1, class);
+}
+
+/*
+
+C<static int regex_bracket(RegexParser *parser)>
+
+Parses a bracket expression (after the C<'['>). Collating symbols and
+equivalence classes aren't supported. On success, returns the index of the
+new node. On error, returns C<-1>.
+
+*/
+
+static int regex_bracket(RegexParser *parser)
+{
+	static const struct
+	{
+		const char *name;
+		int (*test)(int);
+	}
+	ctypes[] =
+	{
+		{ "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum },
+		{ "upper", isupper }, { "lower", islower }, { "space", isspace },
+		{ "blank", isblank }, { "punct", ispunct }, { "print", isprint },
+		{ "graph", isgraph }, { "cntrl", iscntrl }, { "xdigit", isxdigit },
+		{ NULL, NULL }
+	};
+
+	const unsigned char *p = parser->p;
+	unsigned char *set;
+	int negate, first, class;
+	int c, i;
+
+	if ((class = regex_class(parser)) == -1)
+		return -1;
+
+	set = parser->class[class];
+
+	if ((negate = (*p == '^')))
+		++p;
+
+	for (first = 1;; first = 0)
+	{
+		int lo, hi;
+
+		if (!*p)
+			return -1;
+
+		if (*p == ']' && !first)
+		{
+			++p;
+			break;
+		}
+
+		if (*p == '[' && (p[1] == '.' || p[1] == '='))
+			return -1;
+
+		if (*p == '[' && p[1] == ':')
+		{
+			const unsigned char *end = (const unsigned char *)strstr((const char *)p + 2, ":]");
+
+			if (!end)
+				return -1;
+
+			for (i = 0; ctypes[i].name; ++i)
+				if (strlen(ctypes[i].name) == end - p - 2 && !strncmp(ctypes[i].name, (const char *)p + 2, end - p - 2))
+					break;
+
+			if (!ctypes[i].name)
+				return -1;
+
+			for (c = 0; c < CHARSET; ++c)
+				if (ctypes[i].test(c))
+					regex_addset(set, c);
+
+			p = end + 2;
+
+			if (*p == '-' && p[1] != ']')
+				return -1;
+
+			continue;
+		}
+
+		lo = hi = *p++;
+
+		if (*p == '-' && p[1] && p[1] != ']')
+		{
+			if (p[1] == '[')
+				return -1;
+
+			hi = p[1];
+			p += 2;
+
+			if (lo > hi)
+				return -1;
+		}
+
+		for (c = lo; c <= hi; ++c)
+			regex_addset(set, c);
+	}
+
+	if (parser->cflags & REG_ICASE)
+		for (c = 0; c < CHARSET; ++c)
+			if (regex_inset(set, c))
+				regex_addset(set, tolower(c)), regex_addset(set, toupper(c));
+
+	if (negate)
+	{
+		for (i = 0; i < CHARSET / 8; ++i)
+			set[i] = ~set[i];
+
+		if (parser->cflags & REG_NEWLINE)
+			set['\n' >> 3] &= ~(1 << ('\n' & 7));
+	}
+
+	parser->p = p;
+
+	return regex_node(parser, RN_CLASS, -1, -1, class);
+}
+
+static int regex_alt(RegexParser *parser);
+
+/*
+
+C<static int regex_atom(RegexParser *parser)>
+
+Parses a subexpression, bracket expression, anchor, C<'.'> or (possibly
+escaped) literal. Back references and other extensions to I<POSIX> syntax
+aren't supported. On success, returns the index of the new node. On error,
+returns C<-1>.
+
+*/
+
+static int regex_atom(RegexParser *parser)
+{
+	int c = *parser->p++;
+	int node, class, group;
+
+	if (c >= 0x80 && MB_CUR_MAX > 1)
+		return -1;
+
+	switch (c)
+	{
+		case '(':
+			if (*parser->p == ')' || ++parser->groups > REGEX_MAX_GROUPS)
+				return -1;
+
+			group = parser->groups;
+			++parser->depth;
+
+			if ((node = regex_alt(parser)) == -1 || *parser->p != ')')
+				return -1;
+
+			++parser->p;
+			--parser->depth;
+
+			return regex_node(parser, RN_GROUP, node, -1, group);
+
+		case '^':
+			return regex_node(parser, RN_BOL, -1, -1, 0);
+
+		case '$':
+			return regex_node(parser, RN_EOL, -1, -1, 0);
+
+		case '.':
+			if (MB_CUR_MAX > 1 || (class = regex_class(parser)) == -1)
+				return -1;
+
+			memset(parser->class[class], 0xff, sizeof(RegexClass));
+			parser->class[class][0] &= ~1;
+
+			if (parser->cflags & REG_NEWLINE)
+				parser->class[class]['\n' >> 3] &= ~(1 << ('\n' & 7));
+
+			return regex_node(parser, RN_CLASS, -1, -1, class);
+
+		case '[':
+			return (MB_CUR_MAX > 1) ? -1 : regex_bracket(parser);
+
+		case '\\':
+			c = *parser->p++;
+
+			if (!c || !strchr("^.[]$()|*+?{}\\", c))
+				return -1;
+
+			return regex_literal(parser, c);
+
+		case '\0':
+		case ')':
+		case '|':
+		case '*':
+		case '+':
+		case '?':
+		case '{':
+			return -1;
+
+		default:
+			return regex_literal(parser, c);
+	}
+}
+
+/*
+
+C<static int regex_piece(RegexParser *parser)>
+
+Parses an atom followed by any number of C<'*'>, C<'+'>, C<'?'> or
+C<'{m,n}'> repetitions. On success, returns the index of the new node. On
+error, returns C<-1>.
+
+*/
+
+static int regex_piece(RegexParser *parser)
+{
+	int node, min, max;
+
+	if ((node = regex_atom(parser)) == -1)
+		return -1;
+
+	while (*parser->p && strchr("*+?{", *parser->p))
+	{
+		if (parser->node[node].type == RN_BOL || parser->node[node].type == RN_EOL)
+			return -1;
+
+		switch (*parser->p++)
+		{
+			case '*': min = 0, max = -1; break;
+			case '+': min = 1, max = -1; break;
+			case '?': min = 0, max = 1; break;
+
+			default:
+				if (!is_digit(*parser->p))
+					return -1;
+
+				for (min = 0; is_digit(*parser->p); ++parser->p)
+					if ((min = min * 10 + *parser->p - '0') > REGEX_DUP_MAX)
+						return -1;
+
+				max = min;
+
+				if (*parser->p == ',')
+				{
+					max = -1;
+
+					if (is_digit(*++parser->p))
+						for (max = 0; is_digit(*parser->p); ++parser->p)
+							if ((max = max * 10 + *parser->p - '0') > REGEX_DUP_MAX)
+								return -1;
+				}
+
+				if (*parser->p++ != '}' || (max != -1 && max < min))
+					return -1;
+
+				break;
+		}
+
+		if ((node = regex_node(parser, RN_REPEAT, node, -1, 0)) == -1)
+			return -1;
+
+		parser->node[node].min = min;
+		parser->node[node].max = max;
+	}
+
+	return node;
+}
+
+/*
+
+C<static int regex_alt(RegexParser *parser)>
+
+Parses one or more non-empty branches separated by C<'|'>. On success,
+returns the index of the new node. On error, returns C<-1>.
+
+*/
+
+static int regex_alt(RegexParser *parser)
+{
+	int node = -1;
+
+	for (;;)
+	{
+		int branch = -1, piece;
+
+		while (*parser->p && *parser->p != '|' && *parser->p != ')')
+		{
+			if ((piece = regex_piece(parser)) == -1)
+				return -1;
+
+			if (branch != -1 && (piece = regex_node(parser, RN_CAT, branch, piece, 0)) == -1)
+				return -1;
+
+			branch = piece;
+		}
+
+		if (branch == -1 || (*parser->p == ')' && !parser->depth))
+			return -1;
+
+		if (node != -1 && (branch = regex_node(parser, RN_ALT, node, branch, 0)) == -1)
+			return -1;
+
+		node = branch;
+
+		if (*parser->p != '|')
+			return node;
+
+		++parser->p;
+	}
+}
+
+/*
+
+C<static int regex_inst(RegexParser *parser, RegexOpCode code, int x, int y)>
+
+Appends an instruction to the program. On success, returns its index. On
+error (including a program that is too large), returns C<-1>.
+
+*/
+
+static int regex_inst(RegexParser *parser, RegexOpCode code, int x, int y)
+{
+	RegexInst *inst;
+
+	if (parser->insts == parser->insts_size)
+	{
+		int size = parser->insts_size ? parser->insts_size * 2 : 64;
+
+		if (parser->insts >= REGEX_MAX_INSTS || !mem_resize(&parser->inst, size))
+			return -1;
+
+		parser->insts_size = size;
+	}
+
+	inst = parser->inst + parser->insts;
+	inst->code = code;
+	inst->x = x;
+	inst->y = y;
+
+	return parser->insts++;
+}
+
+/*
+
+C<static int regex_emit(RegexParser *parser, int node)>
+
+Appends the instructions for the parse tree rooted at C<node> to the
+program. Counted repetitions are expanded. On success, returns C<0>. On
+error, returns C<-1>.
+
+*/
+
+static int regex_emit(RegexParser *parser, int node)
+{
+	RegexNode *n = parser->node + node;
+	int split, jmp, loop, i;
+
+	switch (n->type)
+	{
+		case RN_CLASS:
+			return (regex_inst(parser, RX_CLASS, n->arg, 0) == -1) ? -1 : 0;
+
+		case RN_BOL:
+		case RN_EOL:
+			return (regex_inst(parser, (n->type == RN_BOL) ? RX_BOL : RX_EOL, parser->insts + 1, 0) == -1) ? -1 : 0;
+
+		case RN_CAT:
+			return (regex_emit(parser, n->left) == -1 || regex_emit(parser, n->right) == -1) ? -1 : 0;
+
+		case RN_ALT:
+			if ((split = regex_inst(parser, RX_SPLIT, parser->insts + 1, 0)) == -1 || regex_emit(parser, n->left) == -1)
+				return -1;
+
+			if ((jmp = regex_inst(parser, RX_JMP, 0, 0)) == -1)
+				return -1;
+
+			parser->inst[split].y = parser->insts;
+
+			if (regex_emit(parser, parser->node[node].right) == -1)
+				return -1;
+
+			parser->inst[jmp].x = parser->insts;
+
+			return 0;
+
+		case RN_GROUP:
+			if (regex_inst(parser, RX_SAVE, parser->insts + 1, 2 * n->arg) == -1 || regex_emit(parser, n->left) == -1)
+				return -1;
+
+			return (regex_inst(parser, RX_SAVE, parser->insts + 1, 2 * parser->node[node].arg + 1) == -1) ? -1 : 0;
+
+		case RN_REPEAT:
+		{
+			int left = n->left, min = n->min, max = n->max;
+
+			for (i = 0; i < min; ++i)
+				if (regex_emit(parser, left) == -1)
+					return -1;
+
+			if (max == -1)
+			{
+				if ((loop = regex_inst(parser, RX_SPLIT, parser->insts + 1, 0)) == -1 || regex_emit(parser, left) == -1)
+					return -1;
+
+				if (regex_inst(parser, RX_JMP, loop, 0) == -1)
+					return -1;
+
+				parser->inst[loop].y = parser->insts;
+
+				return 0;
+			}
+
+			/* Optional copies nest: x{1,3} is x(x(x)?)? */
+
+			for (loop = -1, i = min; i < max; ++i)
+			{
+				if ((split = regex_inst(parser, RX_SPLIT, parser->insts + 1, loop)) == -1 || regex_emit(parser, left) == -1)
+					return -1;
+
+				loop = split;
+			}
+
+			/* Point each optional copy's escape to the end */
+
+			while (loop != -1)
+			{
+				split = parser->inst[loop].y;
+				parser->inst[loop].y = parser->insts;
+				loop = split;
+			}
+
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+
+C<static void regex_byteclasses(Regex *regex)>
+
+Partitions the bytes into classes whose members are in exactly the same
+byte sets (and treats newline specially when C<REG_NEWLINE> is set), so
+that DFA states only need a transition per class rather than per byte.
+
+*/
+
+static void regex_byteclasses(Regex *regex)
+{
+	unsigned char map[CHARSET * 2];
+	int c, i, n;
+
+	memset(regex->byteclass, 0, sizeof regex->byteclass);
+	regex->byteclasses = 1;
+
+	for (i = -1; i < regex->classes; ++i)
+	{
+		memset(map, 0xff, sizeof map);
+
+		for (n = 0, c = 0; c < CHARSET; ++c)
+		{
+			int in = (i == -1) ? (c == '\n' && (regex->cflags & REG_NEWLINE)) : !!regex_inset(regex->class[i], c);
+			int key = regex->byteclass[c] * 2 + in;
+
+			if (map[key] == 0xff)
+				map[key] = n++;
+
+			regex->byteclass[c] = map[key];
+		}
+
+		regex->byteclasses = n;
+	}
+}
+
+/*
+
+C<static int regex_compile(Regex *regex, const char *pattern)>
+
+Parses C<pattern> and compiles it into an NFA program in C<regex>. On
+success, returns C<0>. If the pattern uses syntax that isn't supported (or
+is invalid), returns C<-1>, and the caller falls back to I<regcomp(3)>.
+
+*/
+
+static int regex_compile(Regex *regex, const char *pattern)
+{
+	RegexParser parser[1];
+	int root;
+
+	memset(parser, 0, sizeof parser);
+	parser->p = (const unsigned char *)pattern;
+	parser->cflags = regex->cflags;
+
+	if ((root = regex_alt(parser)) == -1 || *parser->p ||
+		regex_emit(parser, root) == -1 ||
+		regex_inst(parser, RX_MATCH, 0, 0) == -1)
+	{
+		mem_release(parser->node);
+		mem_release(parser->class);
+		mem_release(parser->inst);
+		return -1;
+	}
+
+	mem_release(parser->node);
+	regex->inst = parser->inst;
+	regex->insts = parser->insts;
+	regex->class = parser->class;
+	regex->classes = parser->classes;
+	regex->nsub = parser->groups;
+	regex_byteclasses(regex);
+
+	for (root = 0; root < regex->insts; ++root)
+		if (regex->inst[root].code == RX_BOL || regex->inst[root].code == RX_EOL)
+			regex->anchors = 1;
+
+	return 0;
+}
+
+/*
+
+C<static void regex_flush(Regex *regex)>
+
+Deallocates all of C<regex>'s DFA states.
+
+*/
+
+static void regex_flush(Regex *regex)
+{
+	int i;
+
+	for (i = 0; i < REGEX_DFA_BUCKETS; ++i)
+	{
+		while (regex->bucket[i])
+		{
+			RegexState *state = regex->bucket[i];
+			regex->bucket[i] = state->chain;
+			mem_release(state);
+		}
+	}
+
+	regex->memory = 0;
+	++regex->flushes;
+}
+
+/*
+
+C<static int regex_closure(Regex *regex, const int *insts, int ninsts, int bol, int eol, int *out)>
+
+Follows the non-consuming instructions reachable from C<insts> and the
+start of the program, given whether the current position is at the
+beginning (C<bol>) or end (C<eol>) of a line. Stores the reachable
+C<RX_CLASS> instructions in C<out> and returns how many there are. If
+C<RX_MATCH> is reachable, the count is returned negated, minus one.
+
+*/
+
+static int regex_closure(Regex *regex, const int *insts, int ninsts, int bol, int eol, int *out)
+{
+	int *stack = regex->stack, *mark = regex->mark;
+	int sp = 0, n = 0, matched = 0;
+	int i, pc;
+
+	memset(mark, 0, regex->insts * sizeof(int));
+
+	/* Start a new match here (after existing threads) */
+
+	stack[sp++] = 0;
+
+	for (i = ninsts - 1; i >= 0; --i)
+		stack[sp++] = insts[i];
+
+	while (sp)
+	{
+		RegexInst *inst;
+
+		if (mark[pc = stack[--sp]])
+			continue;
+
+		mark[pc] = 1;
+		inst = regex->inst + pc;
+
+		switch (inst->code)
+		{
+			case RX_CLASS: out[n++] = pc; break;
+			case RX_MATCH: matched = 1; break;
+			case RX_SPLIT: stack[sp++] = inst->y; stack[sp++] = inst->x; break;
+			case RX_JMP:
+			case RX_SAVE: stack[sp++] = inst->x; break;
+			case RX_BOL: if (bol) stack[sp++] = inst->x; break;
+			case RX_EOL: if (eol) stack[sp++] = inst->x; break;
+		}
+	}
+
+	return matched ? -n - 1 : n;
+}
+
+/*
+
+C<static int regex_skip(Regex *regex, int flags)>
+
+When there is only one byte that can start a match from a DFA state with no
+partial matches in progress, returns that byte, so the search can use
+I<memchr(3)> to skip to it. Otherwise, returns C<-1>.
+
+*/
+
+static int regex_skip(Regex *regex, int flags)
+{
+	RegexClass away;
+	int n, i, c, skip;
+
+	if (flags & RS_BOL || (n = regex_closure(regex, regex->work, 0, 0, 0, regex->work)) < 0)
+		return -1;
+
+	memset(away, 0, sizeof away);
+
+	for (i = 0; i < n; ++i)
+		for (c = 0; c < CHARSET / 8; ++c)
+			away[c] |= regex->class[regex->inst[regex->work[i]].x][c];
+
+	if ((regex->cflags & REG_NEWLINE) && regex->anchors)
+		regex_addset(away, '\n');
+
+	for (skip = -1, c = 0; c < CHARSET; ++c)
+	{
+		if (regex_inset(away, c))
+		{
+			if (skip != -1)
+				return -1;
+
+			skip = c;
+		}
+	}
+
+	return skip;
+}
+
+/*
+
+C<static RegexState *regex_state(Regex *regex, const int *insts, int ninsts, int flags)>
+
+Returns the DFA state for the sorted set of NFA instructions, C<insts>, and
+C<flags>, creating it if necessary. When the states use too much memory,
+they are all discarded first. On error, returns C<null>.
+
+*/
+
+static RegexState *regex_state(Regex *regex, const int *insts, int ninsts, int flags)
+{
+	RegexState *state;
+	unsigned int hash;
+	size_t size;
+	int i;
+
+	if (!ninsts)
+		flags |= RS_EMPTY;
+
+	hash = 2166136261u ^ flags;
+
+	for (i = 0; i < ninsts; ++i)
+		hash = (hash ^ insts[i]) * 16777619u;
+
+	for (state = regex->bucket[hash % REGEX_DFA_BUCKETS]; state; state = state->chain)
+		if (state->hash == hash && state->flags == flags && state->ninsts == ninsts && !memcmp(state->insts, insts, ninsts * sizeof(int)))
+			return state;
+
+	size = sizeof(RegexState) + (regex->byteclasses - 1) * sizeof(RegexState *) + ninsts * sizeof(int);
+
+	if (regex->memory + size > REGEX_DFA_MEMORY)
+		regex_flush(regex);
+
+	if (!(state = (RegexState *)mem_create(size, char)))
+		return NULL;
+
+	state->insts = (int *)(state->next + regex->byteclasses);
+	memset(state->next, 0, regex->byteclasses * sizeof(RegexState *));
+	memcpy(state->insts, insts, ninsts * sizeof(int));
+	state->ninsts = ninsts;
+	state->flags = flags;
+	state->hash = hash;
+	state->skip = (flags & RS_EMPTY) ? regex_skip(regex, flags) : -1;
+	state->chain = regex->bucket[hash % REGEX_DFA_BUCKETS];
+	regex->bucket[hash % REGEX_DFA_BUCKETS] = state;
+	regex->memory += size;
+
+	return state;
+}
+
+static int regex_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+
+C<static RegexState *regex_next(Regex *regex, RegexState *state, int c)>
+
+Computes (and caches) the transition from C<state> on the byte, C<c>. On
+error, returns C<null>.
+
+*/
+
+static RegexState *regex_next(Regex *regex, RegexState *state, int c)
+{
+	int newline = (regex->cflags & REG_NEWLINE) && c == '\n';
+	int *work = regex->work, *next = regex->work + regex->insts;
+	int n, m, i, flags;
+	unsigned long flushes;
+	RegexState *dst;
+
+	if ((n = regex_closure(regex, state->insts, state->ninsts, state->flags & RS_BOL, newline, work)) < 0)
+		n = -n - 1, flags = RS_MATCH;
+	else
+		flags = 0;
+
+	/* regex_closure() visits each instruction once, so there are no duplicates */
+
+	for (m = 0, i = 0; i < n; ++i)
+		if (regex_inset(regex->class[regex->inst[work[i]].x], c))
+			next[m++] = work[i] + 1;
+
+	qsort(next, m, sizeof(int), regex_cmp);
+
+	if (newline && regex->anchors)
+		flags |= RS_BOL;
+
+	/* Only cache the transition if state wasn't flushed to make room for dst */
+
+	flushes = regex->flushes;
+
+	if (!(dst = regex_state(regex, next, m, flags)))
+		return NULL;
+
+	if (regex->flushes == flushes)
+		state->next[regex->byteclass[c]] = dst;
+
+	return dst;
+}
+
+/*
+
+C<static int regex_threads(Regex *regex, int ncaps)>
+
+Allocates (or enlarges) the thread lists for simulating C<regex>'s NFA with
+C<ncaps> capture slots per thread. On success, returns C<0>. On error,
+returns C<-1>.
+
+*/
+
+static int regex_threads(Regex *regex, int ncaps)
+{
+	int i;
+
+	if (!regex->threads[0].sparse)
+	{
+		for (i = 0; i < 2; ++i)
+		{
+			RegexThreads *list = regex->threads + i;
+
+			if (!(list->sparse = mem_create(regex->insts, int)) ||
+				!(list->dense = mem_create(regex->insts, int)) ||
+				!(list->pc = mem_create(regex->insts, int)))
+				return -1;
+
+			memset(list->sparse, 0, regex->insts * sizeof(int));
+		}
+
+		if (!(regex->capstack = mem_create(3 * regex->insts + 2, regoff_t)))
+			return -1;
+	}
+
+	if (ncaps > regex->ncaps)
+	{
+		for (i = 0; i < 2; ++i)
+			if (!mem_resize(&regex->threads[i].caps, regex->insts * ncaps))
+				return -1;
+
+		if (!mem_resize(&regex->caps, ncaps) || !mem_resize(&regex->best, ncaps))
+			return -1;
+
+		regex->ncaps = ncaps;
+	}
+
+	return 0;
+}
+
+/*
+
+C<static void regex_add(Regex *regex, RegexThreads *list, int pc, const regoff_t *caps, int ncaps, const char *text, size_t pos, size_t length, int eflags)>
+
+Adds a thread at instruction C<pc> with capture slots C<caps> (or a new
+thread starting at C<pos> when C<caps> is C<null>) to C<list>, following
+non-consuming instructions in priority order. Instructions that are already
+in C<list> belong to higher priority threads, and aren't added again.
+
+*/
+
+static void regex_add(Regex *regex, RegexThreads *list, int pc, const regoff_t *caps, int ncaps, const char *text, size_t pos, size_t length, int eflags)
+{
+	int newline = regex->cflags & REG_NEWLINE;
+	regoff_t *tmp = regex->caps, *stack = regex->capstack;
+	regoff_t v;
+	int sp = 0, i;
+
+	if (caps)
+		memcpy(tmp, caps, ncaps * sizeof(regoff_t));
+	else
+		for (tmp[0] = pos, i = 1; i < ncaps; ++i)
+			tmp[i] = -1;
+
+	stack[sp++] = pc;
+
+	while (sp)
+	{
+		RegexInst *inst;
+
+		/* Restore a capture slot after trying everything that follows it */
+
+		if ((v = stack[--sp]) < 0)
+		{
+			tmp[-v - 1] = stack[--sp];
+			continue;
+		}
+
+		pc = v;
+
+		if (list->sparse[pc] < list->visited && list->dense[list->sparse[pc]] == pc)
+			continue;
+
+		list->sparse[pc] = list->visited;
+		list->dense[list->visited++] = pc;
+		inst = regex->inst + pc;
+
+		switch (inst->code)
+		{
+			case RX_CLASS:
+			case RX_MATCH:
+				list->pc[list->threads] = pc;
+				memcpy(list->caps + list->threads * ncaps, tmp, ncaps * sizeof(regoff_t));
+				++list->threads;
+				break;
+
+			case RX_SPLIT:
+				stack[sp++] = inst->y;
+				stack[sp++] = inst->x;
+				break;
+
+			case RX_JMP:
+				stack[sp++] = inst->x;
+				break;
+
+			case RX_SAVE:
+				if (inst->y < ncaps)
+				{
+					stack[sp++] = tmp[inst->y];
+					stack[sp++] = -inst->y - 1;
+					tmp[inst->y] = pos;
+				}
+
+				stack[sp++] = inst->x;
+				break;
+
+			case RX_BOL:
+				if ((pos == 0) ? !(eflags & REG_NOTBOL) : newline && text[pos - 1] == '\n')
+					stack[sp++] = inst->x;
+				break;
+
+			case RX_EOL:
+				if ((pos == length) ? !(eflags & REG_NOTEOL) : newline && text[pos] == '\n')
+					stack[sp++] = inst->x;
+				break;
+		}
+	}
+}
+
+/*
+
+C<static int regex_pike(Regex *regex, const char *text, size_t from, size_t length, int ncaps, int eflags)>
+
+Simulates C<regex>'s NFA over C<text> from C<from> to C<length>, keeping
+track of C<ncaps> capture slots per thread, to find the leftmost longest
+match. Threads are kept in order of their starting position (and then
+priority), so the subexpressions are those of the first alternatives that
+produce the leftmost longest match. This takes time proportional to the
+length of the text times the size of the program. If there's a match,
+stores its capture slots in C<regex->best> and returns C<1>. Otherwise,
+returns C<0>.
+
+*/
+
+static int regex_pike(Regex *regex, const char *text, size_t from, size_t length, int ncaps, int eflags)
+{
+	RegexThreads *clist = regex->threads, *nlist = regex->threads + 1, *swap;
+	regoff_t *best = regex->best;
+	size_t i;
+	int t;
+
+	best[0] = -1;
+	clist->threads = clist->visited = 0;
+
+	for (i = from;; ++i)
+	{
+		/* Start new threads until there's a match (later ones can't be leftmost) */
+
+		if (best[0] == -1)
+			regex_add(regex, clist, 0, NULL, ncaps, text, i, length, eflags);
+
+		if (!clist->threads)
+			break;
+
+		nlist->threads = nlist->visited = 0;
+
+		for (t = 0; t < clist->threads; ++t)
+		{
+			regoff_t *caps = clist->caps + t * ncaps;
+			int pc = clist->pc[t];
+
+			if (best[0] != -1 && caps[0] > best[0])
+				break;
+
+			if (regex->inst[pc].code == RX_MATCH)
+			{
+				if (best[0] == -1 || caps[0] < best[0] || (caps[0] == best[0] && (regoff_t)i > best[1]))
+				{
+					memcpy(best, caps, ncaps * sizeof(regoff_t));
+					best[1] = i;
+				}
+
+				continue;
+			}
+
+			if (i < length && regex_inset(regex->class[regex->inst[pc].x], (unsigned char)text[i]))
+				regex_add(regex, nlist, pc + 1, caps, ncaps, text, i + 1, length, eflags);
+		}
+
+		if (i >= length)
+			break;
+
+		swap = clist, clist = nlist, nlist = swap;
+	}
+
+	return best[0] != -1;
+}
+
+/*
+
+C<static int regex_posix(const regex_t *compiled, const char *text, size_t from, size_t length, size_t nmatch, regmatch_t *match, int eflags, int terminated)>
+
+Searches C<text> from C<from> to C<length> with C<compiled> using
+I<regexec(3)>, for patterns that the DFA doesn't support. Offsets in
+C<match> are relative to C<text>. C<terminated> is non-zero when the caller
+knows that C<text[length]> is a C<nul> byte. Otherwise, C<text> might end at
+C<length> (e.g. a memory mapped file), so without C<REG_STARTEND>, the text
+is always copied. Returns I<regexec(3)>'s result.
+
+*/
+
+static int regex_posix(const regex_t *compiled, const char *text, size_t from, size_t length, size_t nmatch, regmatch_t *match, int eflags, int terminated)
+{
+#ifdef REG_STARTEND
+	regmatch_t range[1];
+
+	if (!nmatch)
+		match = range;
+
+	match[0].rm_so = from;
+	match[0].rm_eo = length;
+
+	return regexec(compiled, text, nmatch, match, eflags | REG_STARTEND);
+#else
+	char *copy = NULL;
+	size_t i;
+	int err;
+
+	/* Without REG_STARTEND, regexec() needs a nul-terminated copy */
+
+	if (!terminated)
+	{
+		if (!(copy = mem_create(length - from + 1, char)))
+			return REG_ESPACE;
+
+		memcpy(copy, text + from, length - from);
+		copy[length - from] = nul;
+	}
+
+	err = regexec(compiled, copy ? copy : text + from, nmatch, match, eflags | (from ? REG_NOTBOL : 0));
+	mem_release(copy);
+
+	for (i = 0; !err && i < nmatch; ++i)
+	{
+		if (match[i].rm_so != -1)
+		{
+			match[i].rm_so += from;
+			match[i].rm_eo += from;
+		}
+	}
+
+	return err;
+#endif
+}
+
+/*
+
+C<static int regex_newline(const Regex *regex)>
+
+Returns whether or not a match of C<regex> can contain a newline. Even with
+C<REG_NEWLINE>, a newline in the pattern (or in a bracket expression)
+matches one. Only the NFA program is examined, so C<regex> mustn't have
+fallen back to I<regcomp(3)>.
+
+*/
+
+static int regex_newline(const Regex *regex)
+{
+	int i;
+
+	for (i = 0; i < regex->insts; ++i)
+		if (regex->inst[i].code == RX_CLASS && regex_inset(regex->class[regex->inst[i].x], '\n'))
+			return 1;
+
+	return 0;
+}
+
+/*
+
+C<static int regex_search(Regex *regex, const char *text, size_t from, size_t length, size_t nmatch, regmatch_t *match, int eflags, int terminated)>
+
+Searches C<text> from C<from> to C<length> for the leftmost longest match
+of C<regex>. The text before C<from> is only examined to see whether C<^>
+can match at C<from>. First, the DFA finds the end of the earliest ending
+match (or that there isn't one), and the last position before it where no
+partial match was in progress. The leftmost longest match can't start
+before that position, so the NFA is only simulated from there (and only
+when the caller wants the offsets). Offsets in C<match> are relative to
+C<text>. C<terminated> is as for I<regex_posix()>, for patterns that the
+DFA doesn't support. Returns C<0> if there's a match, C<REG_NOMATCH> if
+there isn't, or C<REG_ESPACE> when out of memory.
+
+*/
+
+static int regex_search(Regex *regex, const char *text, size_t from, size_t length, size_t nmatch, regmatch_t *match, int eflags, int terminated)
+{
+	int newline = regex->cflags & REG_NEWLINE;
+	RegexState *state, *next;
+	size_t i, reset, k;
+	int ncaps, bol;
+
+	if (regex->posix)
+		return regex_posix(regex->posix, text, from, length, nmatch, match, eflags, terminated);
+
+	if (regex->cflags & REG_NOSUB)
+		nmatch = 0;
+
+	bol = (from == 0) ? !(eflags & REG_NOTBOL) : newline && text[from - 1] == '\n';
+
+	if (!(state = regex_state(regex, regex->work, 0, (bol && regex->anchors) ? RS_BOL : 0)))
+		return REG_ESPACE;
+
+	for (reset = i = from; i < length; ++i, state = next)
+	{
+		/* No partial matches in progress, so skip to where one could start */
+
+		if (state->flags & RS_EMPTY)
+		{
+			if (state->skip != -1)
+			{
+				const char *p = memchr(text + i, state->skip, length - i);
+
+				if (!p)
+				{
+					reset = length;
+					break;
+				}
+
+				i = p - text;
+			}
+
+			reset = i;
+		}
+
+		if (!(next = state->next[regex->byteclass[(unsigned char)text[i]]]) &&
+			!(next = regex_next(regex, state, (unsigned char)text[i])))
+			return REG_ESPACE;
+
+		if (next->flags & RS_MATCH)
+			break;
+	}
+
+	if (i >= length)
+	{
+		if (state->flags & RS_EMPTY)
+			reset = length;
+
+		if (regex_closure(regex, state->insts, state->ninsts, state->flags & RS_BOL, !(eflags & REG_NOTEOL), regex->work) >= 0)
+			return REG_NOMATCH;
+	}
+
+	if (!nmatch)
+		return 0;
+
+	ncaps = 2 * (int)((nmatch < regex->nsub + 1) ? nmatch : regex->nsub + 1);
+
+	if (regex_threads(regex, ncaps) == -1)
+		return REG_ESPACE;
+
+	if (!regex_pike(regex, text, reset, length, ncaps, eflags))
+		return REG_NOMATCH;
+
+	for (k = 0; k < nmatch; ++k)
+	{
+		if (2 * k < (size_t)ncaps && regex->best[2 * k] != -1 && regex->best[2 * k + 1] != -1)
+		{
+			match[k].rm_so = regex->best[2 * k];
+			match[k].rm_eo = regex->best[2 * k + 1];
+		}
+		else
+			match[k].rm_so = match[k].rm_eo = -1;
+	}
+
+	return 0;
+}
+
+/*
+
+=item C<Regex *regex_create(const char *pattern, int cflags)>
+
+Compiles the extended regular expression, C<pattern>, for use with
+I<regex_exec(3)>. C<cflags> may contain C<REG_ICASE>, C<REG_NEWLINE> and
+C<REG_NOSUB> (C<REG_EXTENDED> is implied and C<REG_DFA> is ignored).
+Patterns that only use I<POSIX> extended regular expression syntax without
+back references are compiled into an NFA that is matched with a lazily
+built DFA. Matching takes time that is linear in the length of the text
+(and the size of the pattern), no matter how much backtracking
+I<regexec(3)> would do. Any other pattern is compiled with I<regcomp(3)>
+instead, so the same patterns work either way. On success, returns the new
+I<Regex>. It is the caller's responsibility to deallocate it with
+I<regex_release(3)> or I<regex_destroy(3)>. On error, returns C<null> with
+C<errno> set appropriately (to a I<regcomp(3)> error code when C<pattern>
+is invalid).
+
+The DFA works on bytes. The characters matched by bracket expressions and
+case insensitive matching depend on the locale's I<ctype(3)> functions, and
+ranges are ordered by byte value. In locales with multibyte characters,
+patterns containing C<'.'>, bracket expressions or non-ASCII bytes are
+compiled with I<regcomp(3)>. The longest match is always found, but when a
+pattern is ambiguous, subexpressions are matched by the first alternatives
+that produce it, which can differ from the I<POSIX> rules. Up to 255
+subexpressions are supported.
+
+=cut
+
+*/
+
+Regex *regex_create(const char *pattern, int cflags)
+{
+	return regex_create_with_locker(NULL, pattern, cflags);
+}
+
+/*
+
+=item C<Regex *regex_create_with_locker(Locker *locker, const char *pattern, int cflags)>
+
+Equivalent to I<regex_create(3)> except that multiple threads using the new
+I<Regex> will be synchronised by C<locker>. A I<Regex> caches DFA states as
+it is used, so it can't be shared between threads without a locker.
+
+=cut
+
+*/
+
+Regex *regex_create_with_locker(Locker *locker, const char *pattern, int cflags)
+{
+	Regex *regex;
+	int err;
+
+	if (!pattern)
+		return set_errnull(EINVAL);
+
+	if (!(regex = mem_new(Regex)))
+		return NULL;
+
+	memset(regex, 0, sizeof(Regex));
+	regex->cflags = cflags & ~REG_DFA;
+	regex->locker = locker;
+
+	if (regex_compile(regex, pattern) == -1)
+	{
+		if (!(regex->posix = mem_new(regex_t)))
+		{
+			regex_release(regex);
+			return NULL;
+		}
+
+		if ((err = regcomp(regex->posix, pattern, regex->cflags | REG_EXTENDED)))
+		{
+			mem_destroy(&regex->posix);
+			regex_release(regex);
+			return set_errnull(err);
+		}
+
+		regex->nsub = regex->posix->re_nsub;
+
+		return regex;
+	}
+
+	if (!(regex->bucket = mem_create(REGEX_DFA_BUCKETS, RegexState *)) ||
+		!(regex->work = mem_create(2 * regex->insts, int)) ||
+		!(regex->stack = mem_create(3 * regex->insts + 2, int)) ||
+		!(regex->mark = mem_create(regex->insts, int)))
+	{
+		regex_release(regex);
+		return NULL;
+	}
+
+	memset(regex->bucket, 0, REGEX_DFA_BUCKETS * sizeof(RegexState *));
+
+	return regex;
+}
+
+/*
+
+=item C<void regex_release(Regex *regex)>
+
+Releases (deallocates) C<regex>.
+
+=cut
+
+*/
+
+void regex_release(Regex *regex)
+{
+	Locker *locker;
+	int i;
+
+	if (!regex)
+		return;
+
+	locker = regex->locker;
+	if (locker_wrlock(locker))
+		return;
+
+	if (regex->posix)
+	{
+		regfree(regex->posix);
+		mem_release(regex->posix);
+	}
+
+	if (regex->bucket)
+	{
+		regex_flush(regex);
+		mem_release(regex->bucket);
+	}
+
+	for (i = 0; i < 2; ++i)
+	{
+		mem_release(regex->threads[i].sparse);
+		mem_release(regex->threads[i].dense);
+		mem_release(regex->threads[i].pc);
+		mem_release(regex->threads[i].caps);
+	}
+
+	mem_release(regex->inst);
+	mem_release(regex->class);
+	mem_release(regex->work);
+	mem_release(regex->stack);
+	mem_release(regex->mark);
+	mem_release(regex->capstack);
+	mem_release(regex->caps);
+	mem_release(regex->best);
+	mem_release(regex);
+	locker_unlock(locker);
+}
+
+/*
+
+=item C<void *regex_destroy(Regex **regex)>
+
+Destroys (deallocates and sets to C<null>) C<*regex>. Returns C<null>.
+B<Note:> a I<Regex> shared by multiple threads must not be destroyed until
+after all threads have finished with it.
+
+=cut
+
+*/
+
+void *regex_destroy(Regex **regex)
+{
+	if (regex && *regex)
+	{
+		regex_release(*regex);
+		*regex = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+
+=item C<int regex_exec(Regex *regex, const char *text, size_t length, size_t nmatch, regmatch_t *match, int eflags)>
+
+Searches the first C<length> bytes of C<text> (which needn't be
+C<nul>-terminated, and may contain C<nul> bytes) for the leftmost longest
+match of C<regex>. C<eflags> may contain C<REG_NOTBOL> and C<REG_NOTEOL>.
+If there's a match and C<nmatch> is not zero, the offsets of the match and
+its subexpressions are stored in the first C<nmatch> elements of C<match>
+(as with I<regexec(3)>). Returns C<0> if there's a match, or
+C<REG_NOMATCH> if there isn't. On error, returns an error code.
+
+=cut
+
+*/
+
+int regex_exec(Regex *regex, const char *text, size_t length, size_t nmatch, regmatch_t *match, int eflags)
+{
+	int ret;
+	int err;
+
+	if (!regex || !text || (nmatch && !match))
+		return REG_BADPAT;
+
+	if ((err = locker_wrlock(regex->locker)))
+		return err;
+
+	ret = regex_search(regex, text, 0, length, nmatch, match, eflags, 0);
+
+	if ((err = locker_unlock(regex->locker)))
+		return err;
+
+	return ret;
+}
+
+/*
+
+=item C<int regex_is_dfa(const Regex *regex)>
+
+Returns whether or not C<regex> is matched with the DFA (rather than by
+I<regexec(3)>).
+
+=cut
+
+*/
+
+int regex_is_dfa(const Regex *regex)
+{
+	return regex && !regex->posix;
+}
+
+/*
+
+C<static List *regexpr_list(Locker *locker, const char *text, const regmatch_t *match)>
+
+Returns a new I<List> of the substrings of C<text> described by the 33
+elements of C<match>, to be synchronised by C<locker>. On error, returns
+C<null> with C<errno> set appropriately.
+
+*/
+
+static List *regexpr_list(Locker *locker, const char *text, const regmatch_t *match)
+{
+	List *ret;
+	int i;
+
+	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
+		return NULL;
+
+	for (i = 0; i < 33 && match[i].rm_so != -1; ++i)
+	{
+		String *m = substr(text, (ssize_t)match[i].rm_so, (ssize_t)(match[i].rm_eo - match[i].rm_so));
+
+		if (!m)
+		{
+			list_release(ret);
+			return NULL;
+		}
+
+		if (!list_append(ret, m))
+		{
+			str_release(m);
+			list_release(ret);
+			return NULL;
+		}
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags)>
+
+I<str_regexpr(3)> is an interface to I<POSIX 1003.2>-compliant regular
+expression matching. C<pattern> is a regular expression. C<text> is the
+string to be searched for matches. C<cflags> is passed to I<regcomp(3)>
+along with C<REG_EXTENDED>. C<eflags> is passed to I<regexec(3)>. If
+C<cflags> contains C<REG_DFA>, C<pattern> is compiled with
+I<regex_create(3)> instead, and matching takes linear time. On
+success, returns a I<List> of (at most 33) I<String>s containing the
+matching substring followed by the matching substrings of any parenthesised
+subexpressions. It is the caller's responsibility to deallocate the list
+with I<list_release(3)> or I<list_destroy(3)>. On error (including no
+match), returns C<null> with C<errno> set appropriately. Only use this
+function when the regular expression will be used only once. Otherwise, use
+I<regexpr_compile(3)> or I<regcomp(3)> and I<str_regexpr_compiled(3)> or
+I<regexpr_compiled(3)> or I<regexec(3)>.
+
+Note: If you require perl pattern matching, you could use Philip Hazel's
+I<PCRE> package, C<ftp://ftp.cus.cam.ac.uk/pub/software/programs/pcre/> or
+link against the perl library itself.
+
+=cut
+
+*/
+
+List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags)
+{
+	return str_regexpr_with_locker(NULL, pattern, text, cflags, eflags);
+}
+
+/*
+
+=item C<List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr(3)> except that C<text> is not read-locked.
+
+=cut
+
+*/
+
+List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags)
+{
+	return str_regexpr_with_locker_unlocked(NULL, pattern, text, cflags, eflags);
+}
+
+/*
+
+=item C<List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr(3)> except that multiple threads accessing the
+new list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)
+{
+	List *ret;
+	int err;
+
+	if (!pattern || !text)
+		return set_errnull(EINVAL);
+
+	if ((err = str_rdlock(text)))
+		return set_errnull(err);
+
+	ret = str_regexpr_with_locker_unlocked(locker, pattern, text, cflags, eflags);
+
+	if ((err = str_unlock(text)))
+	{
+		list_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_regexpr_with_locker_unlocked(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr_with_locker(3)> except that C<text> is not
+read-locked.
+
+=cut
+
+*/
+
+List *str_regexpr_with_locker_unlocked(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)
+{
+	if (!pattern || !text)
+		return set_errnull(EINVAL);
+
+	return regexpr_with_locker(locker, pattern, text->str, cflags, eflags);
+}
+
+/*
+
+=item C<List *regexpr(const char *pattern, const char *text, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+List *regexpr(const char *pattern, const char *text, int cflags, int eflags)
+{
+	return regexpr_with_locker(NULL, pattern, text, cflags, eflags);
+}
+
+/*
+
+=item C<List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags)>
+
+Equivalent to I<regexpr(3)> except that multiple threads accessing the new
+list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags)
+{
+	regex_t compiled[1];
+	regmatch_t match[33];
+	Regex *regex;
+	List *ret;
+	int err;
+
+	if (!pattern || !text)
+		return set_errnull(EINVAL);
+
+	if (cflags & REG_DFA)
+	{
+		if (!(regex = regex_create(pattern, cflags)))
+			return NULL;
+
+		err = regex_search(regex, text, 0, strlen(text), 33, match, eflags, 1);
+		regex_release(regex);
+
+		return (err) ? set_errnull(err) : regexpr_list(locker, text, match);
+	}
+
+	if ((err = regexpr_compile(compiled, pattern, cflags)))
+		return set_errnull(err);
+
+	ret = regexpr_compiled_with_locker(locker, compiled, text, eflags);
+	regfree(compiled);
+
+	return ret;
+}
+
+/*
+
+=item C<int regexpr_compile(regex_t *compiled, const char *pattern, int cflags)>
+
+Compiles a I<POSIX 1003.2>-compliant regular expression. C<compiled> is the
+location in which to compile the expression. C<pattern> is the regular
+expression. C<cflags> is passed to I<regcomp(3)> along with C<REG_EXTENDED>.
+Call this, followed by I<re_compiled(3)> when the regular expression will be
+used multiple times. A I<regex_t> is always compiled by I<regcomp(3)>, so
+C<REG_DFA> isn't allowed here (use I<regex_create(3)> for the linear-time
+engine instead). On success, returns C<0>. On error, returns an error code
+(C<REG_BADPAT>, with C<errno> set to C<EINVAL>, when C<cflags> contains
+C<REG_DFA>).
+
+=cut
+
+*/
+
+int regexpr_compile(regex_t *compiled, const char *pattern, int cflags)
+{
+	if (!compiled || !pattern)
+		return REG_BADPAT;
+
+	if (cflags & REG_DFA)
+		return errno = EINVAL, REG_BADPAT;
+
+	return regcomp(compiled, pattern, cflags | REG_EXTENDED);
+}
+
+/*
+
+=item C<void regexpr_release(regex_t *compiled)>
+
+Just another name for I<regfree(3)>.
+
+=cut
+
+*/
+
+void regexpr_release(regex_t *compiled)
+{
+	if (compiled)
+		regfree(compiled);
+}
+
+/*
+
+=item C<List *str_regexpr_compiled(const regex_t *compiled, const String *text, int eflags)>
+
+I<regexpr_compiled(3)> is an interface to the I<POSIX 1003.2> regular
+expression function, I<regexec(3)>. C<compiled> is the compiled regular
+expression prepared by I<regexpr_compile(3)> or I<regcomp(3)>. C<text> is
+the string to be searched for a match. C<eflags> is passed to I<regexec(3)>.
+On success, returns a I<List> of (at most 33) I<String>s containing the
+matching substring followed by the matching substrings of any parenthesised
+subexpressions. It is the caller's responsibility to deallocate the list
+with I<list_release(3)> or I<list_destroy(3)>. On error (including no
+match), returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *str_regexpr_compiled(const regex_t *compiled, const String *text, int eflags)
+{
+	return str_regexpr_compiled_with_locker(NULL, compiled, text, eflags);
+}
+
+/*
+
+=item C<List *str_regexpr_compiled_unlocked(const regex_t *compiled, const String *text, int eflags)>
+
+Equivalent to I<str_regexpr_compiled(3)> except that C<text> is not
+write-locked.
+
+=cut
+
+*/
+
+List *str_regexpr_compiled_unlocked(const regex_t *compiled, const String *text, int eflags)
+{
+	return str_regexpr_compiled_with_locker_unlocked(NULL, compiled, text, eflags);
+}
+
+/*
+
+=item C<List *str_regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const String *text, int eflags)>
+
+Equivalent to I<str_regexpr_compiled(3)> except that multiple threads
+accessing the new list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *str_regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const String *text, int eflags)
+{
+	List *ret;
+	int err;
+
+	if (!compiled || !text)
+		return set_errnull(EINVAL);
+
+	if ((err = str_rdlock(text)))
+		return set_errnull(err);
+
+	ret = str_regexpr_compiled_with_locker_unlocked(locker, compiled, text, eflags);
+
+	if ((err = str_unlock(text)))
+	{
+		list_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_regexpr_compiled_with_locker_unlocked(Locker *locker, const regex_t *compiled, const String *text, int eflags)>
+
+Equivalent to I<str_regexpr_compiled_with_locker(3)> except that C<text> is
+not read-locked.
+
+=cut
+
+*/
+
+List *str_regexpr_compiled_with_locker_unlocked(Locker *locker, const regex_t *compiled, const String *text, int eflags)
+{
+	if (!compiled || !text)
+		return set_errnull(EINVAL);
+
+	return regexpr_compiled_with_locker(locker, compiled, text->str, eflags);
+}
+
+/*
+
+=item C<List *regexpr_compiled(const regex_t *compiled, const char *text, int eflags)>
+
+Equivalent to I<str_regexpr_compiled(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+List *regexpr_compiled(const regex_t *compiled, const char *text, int eflags)
+{
+	return regexpr_compiled_with_locker(NULL, compiled, text, eflags);
+}
+
+/*
+
+=item C<List *regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const char *text, int eflags)>
+
+Equivalent to I<regexpr_compiled(3)> except that multiple threads accessing
+the new list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const char *text, int eflags)
+{
+	regmatch_t match[33];
+	int err;
+
+	if (!compiled || !text)
+		return set_errnull(EINVAL);
+
+	if ((err = regexec(compiled, text, 33, match, eflags)))
+		return set_errnull(err);
+
+	return regexpr_list(locker, text, match);
+}
+
+#define REGSUB_MATCHES 33 /* Whole match plus 32 subexpressions */
+#define REGSUB_STATES 33  /* Levels of \l \L \u \U \Q nesting plus 1 */
+
+enum
+{
+	RS_LC = 1,
+	RS_UC = 2,
+	RS_QM = 4,
+	RS_FIRST = 8,
+	RS_LCFIRST = RS_LC | RS_FIRST,
+	RS_UCFIRST = RS_UC | RS_FIRST
+};
+
+typedef enum
+{
+	RSOP_TEXT,   /* literal text (case/quotemeta modified) */
+	RSOP_RAW,    /* literal text (unmodified, i.e. from \\) */
+	RSOP_REF,    /* subexpression matching substring */
+	RSOP_PUSH,   /* \l \L \u \U \Q */
+	RSOP_POP     /* \E */
+}
+RegsubOpCode;
+
+typedef struct RegsubOp RegsubOp;
+typedef struct RegsubTemplate RegsubTemplate;
+
+struct RegsubOp
+{
+	RegsubOpCode code; /* what to do */
+	int arg;           /* subexpression number or escape character */
+	const char *text;  /* literal text */
+	size_t length;     /* length of literal text */
+};
+
+struct RegsubTemplate
+{
+	RegsubOp *op;      /* the operations to perform for each match */
+	size_t ops;        /* number of operations */
+	int modifies;      /* are there any \l \L \u \U \Q \E sequences? */
+};
+
+/*
+
+C<static int regsub_append(String *dst, const char *src, size_t length)>
+
+Appends C<length> bytes of C<src> to C<dst>. On success, returns C<0>. On
+error, returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int regsub_append(String *dst, const char *src, size_t length)
+{
+	if (grow(dst, length) == -1)
+		return -1;
+
+	memcpy(dst->str + dst->length - 1, src, length);
+	dst->length += length;
+	dst->str[dst->length - 1] = nul;
+
+	return 0;
+}
+
+/*
+
+C<static RegsubTemplate *regsub_compile(RegsubTemplate *template, const char *replacement)>
+
+Parses C<replacement> (see I<str_regsub(3)>) into C<template> so that it
+can be expanded for each match without parsing it again. The template
+refers to C<replacement> so C<replacement> must outlive it. On success,
+returns C<template>. On error, returns C<null> with C<errno> set
+appropriately. The template must be deallocated with I<regsub_release()>.
+
+*/
+
+static RegsubTemplate *regsub_compile(RegsubTemplate *template, const char *replacement)
+{
+	const char *s, *text;
+	RegsubOp *op;
+
+	if (!(template->op = mem_create(strlen(replacement) + 1, RegsubOp)))
+		return NULL;
+
+	template->ops = 0;
+	template->modifies = 0;
+
+#define RSOP(c, a, t, l) \
+	(op = template->op + template->ops++, op->code = (c), op->arg = (a), op->text = (t), op->length = (l))
+
+	for (s = text = replacement; *s; )
+	{
+		if (*s == '$')
+		{
+			if (s > text)
+				RSOP(RSOP_TEXT, 0, text, s - text);
+
+			if (s[1] == '$')
+			{
+				RSOP(RSOP_TEXT, 0, s + 1, 1);
+				s += 2;
+			}
+			else
+			{
+				int ref = 0;
+
+				if (s[1] == '{')
+				{
+					for (s += 2; is_digit(*s) && ref < REGSUB_MATCHES; ++s)
+						ref *= 10, ref += *s - '0';
+
+					if (*s++ != '}')
+						goto invalid;
+				}
+				else if (is_digit(s[1]))
+				{
+					ref = s[1] - '0';
+					s += 2;
+				}
+				else
+					goto invalid;
+
+				if (ref >= REGSUB_MATCHES)
+					goto invalid;
+
+				RSOP(RSOP_REF, ref, NULL, 0);
+			}
+
+			text = s;
+		}
+		else if (*s == '\\' && s[1] && strchr("lLuUQE\\", s[1]))
+		{
+			if (s > text)
+				RSOP(RSOP_TEXT, 0, text, s - text);
+
+			if (s[1] == '\\')
+				RSOP(RSOP_RAW, 0, s + 1, 1);
+			else
+			{
+				RSOP((s[1] == 'E') ? RSOP_POP : RSOP_PUSH, s[1], NULL, 0);
+				template->modifies = 1;
+			}
+
+			text = s += 2;
+		}
+		else if (*s == '\\')
+		{
+			if (s > text)
+				RSOP(RSOP_TEXT, 0, text, s - text);
+
+			RSOP(RSOP_RAW, 0, s, 1);
+			text = ++s;
+		}
+		else
+			++s;
+	}
+
+	if (s > text)
+		RSOP(RSOP_TEXT, 0, text, s - text);
+
+#undef RSOP
+
+	return template;
+
+invalid:
+	mem_release(template->op);
+
+	return set_errnull(EINVAL);
+}
+
+static void regsub_release(RegsubTemplate *template)
+{
+	mem_release(template->op);
+}
+
+/*
+
+C<static int regsub_modify(String *dst, const char *src, size_t length, int *states, int *s)>
+
+Appends C<length> bytes of C<src> to C<dst>, lowercasing, uppercasing and
+quoting them according to the case/quotemeta state stack, C<states>, whose
+top is at C<*s>. On success, returns C<0>. On error, returns C<-1> with
+C<errno> set appropriately.
+
+*/
+
+static int regsub_modify(String *dst, const char *src, size_t length, int *states, int *s)
+{
+	size_t i;
+
+	for (i = 0; i < length; ++i)
+	{
+		char c = src[i];
+
+		if (states[*s] & RS_LC)
+			c = to_lower(c);
+
+		if (states[*s] & RS_UC)
+			c = to_upper(c);
+
+		if (states[*s] & RS_QM && !is_alnum(c))
+			if (regsub_append(dst, "\\", 1) == -1)
+				return -1;
+
+		if (regsub_append(dst, &c, 1) == -1)
+			return -1;
+
+		if (states[*s] & RS_FIRST)
+			--*s;
+	}
+
+	return 0;
+}
+
+/*
+
+C<static int regsub_expand(String *dst, const char *text, const regmatch_t *match, RegsubTemplate *template)>
+
+The I<str_regsub_t> callback for I<str_regsub(3)>. Appends the expansion of
+C<template> for C<match> in C<text> to C<dst>. On success, returns C<0>. On
+error, returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int regsub_expand(String *dst, const char *text, const regmatch_t *match, RegsubTemplate *template)
+{
+	int states[REGSUB_STATES];
+	RegsubOp *op, *end;
+	int s = 0;
+
+	states[0] = 0;
+
+	for (op = template->op, end = op + template->ops; op < end; ++op)
+	{
+		const char *src = op->text;
+		size_t length = op->length;
+
+		switch (op->code)
+		{
+			case RSOP_REF:
+				if (match[op->arg].rm_so == -1)
+					return set_errno(EINVAL);
+
+				src = text + match[op->arg].rm_so;
+				length = match[op->arg].rm_eo - match[op->arg].rm_so;
+				/* FALLTHROUGH */
+
+			case RSOP_TEXT:
+				if ((template->modifies ? regsub_modify(dst, src, length, states, &s) : regsub_append(dst, src, length)) == -1)
+					return -1;
+				break;
+
+			case RSOP_RAW:
+				if (regsub_append(dst, src, length) == -1)
+					return -1;
+				break;
+
+			case RSOP_PUSH:
+				if (s >= REGSUB_STATES - 1)
+					return set_errno(EINVAL);
+
+				switch (op->arg)
+				{
+					case 'l': states[s + 1] = (states[s] | RS_LCFIRST) & ~RS_UC; break;
+					case 'L': states[s + 1] = (states[s] | RS_LC) & ~RS_UC; break;
+					case 'u': states[s + 1] = (states[s] | RS_UCFIRST) & ~RS_LC; break;
+					case 'U': states[s + 1] = (states[s] | RS_UC) & ~RS_LC; break;
+					case 'Q': states[s + 1] = states[s] | RS_QM; break;
+				}
+
+				++s;
+				break;
+
+			case RSOP_POP:
+				if (s == 0)
+					return set_errno(EINVAL);
+
+				--s;
+				break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+
+C<static int regsub_search(const regex_t *compiled, Regex *regex, const char *text, size_t start, size_t length, regmatch_t *match, int eflags)>
+
+Searches C<text> from C<start> to C<length> with either C<compiled> or
+C<regex>. The text before C<start> is only examined to see whether C<^> can
+match at C<start> (where I<regexec(3)> supports C<REG_STARTEND>). The
+C<REGSUB_MATCHES> elements of C<match> are set relative to C<text>. Returns
+C<0> if there's a match, C<REG_NOMATCH> if there isn't, or another error
+code.
+
+*/
+
+static int regsub_search(const regex_t *compiled, Regex *regex, const char *text, size_t start, size_t length, regmatch_t *match, int eflags)
+{
+#ifndef REG_STARTEND
+	int i;
+	int err;
+#endif
+
+	if (regex)
+		return regex_search(regex, text, start, length, REGSUB_MATCHES, match, eflags, 1);
+
+#ifdef REG_STARTEND
+	/* Stop regexec() from measuring the rest of the text every time */
+
+	match[0].rm_so = start;
+	match[0].rm_eo = length;
+
+	return regexec(compiled, text, REGSUB_MATCHES, match, eflags | REG_STARTEND);
+#else
+	if ((err = regexec(compiled, text + start, REGSUB_MATCHES, match, eflags)))
+		return err;
+
+	for (i = 0; i < REGSUB_MATCHES; ++i)
+	{
+		if (match[i].rm_so != -1)
+		{
+			match[i].rm_so += start;
+			match[i].rm_eo += start;
+		}
+	}
+
+	return 0;
+#endif
+}
+
+/*
+
+C<static String *do_regsub(const regex_t *compiled, Regex *regex, str_regsub_t *callback, void *data, String *text, int eflags, int all)>
+
+Replaces the first (or C<all>) matches of either C<compiled> or C<regex> in
+C<text> with whatever C<callback> appends. On success, returns C<text>. On
+error (including no match), returns C<null> with C<errno> set
+appropriately, and C<text> is unchanged.
+
+*/
+
+static String *do_regsub(const regex_t *compiled, Regex *regex, str_regsub_t *callback, void *data, String *text, int eflags, int all)
+{
+	regmatch_t match[REGSUB_MATCHES];
+	String dst[1];
+	size_t start, done, length;
+	char *tmp;
+	int matches;
+	int err;
+
+	/*
+	** Build the result in dst in a single pass, copying the text between
+	** matches and appending the replacements. Searching continues from the
+	** end of each match in the original text, so it takes linear time.
+	*/
+
+	dst->size = 0;
+	dst->length = 1;
+	dst->str = NULL;
+	dst->locker = NULL;
+	dst->reserve = 0;
+	dst->growth = text->growth;
+	dst->adopted = 0;
+
+	if (grow(dst, text->length) == -1)
+		return NULL;
+
+	*dst->str = nul;
+	length = text->length - 1;
+
+	for (start = done = 0, matches = 0; start <= length; )
+	{
+		if ((err = regsub_search(compiled, regex, text->str, start, length, match, eflags)))
+		{
+			if (err == REG_NOMATCH)
+				break;
+
+			buffer_release(dst->str);
+			return set_errnull(err);
+		}
+
+		++matches;
+
+		if (regsub_append(dst, text->str + done, match[0].rm_so - done) == -1 ||
+			callback(dst, text->str, match, data) == -1)
+		{
+			buffer_release(dst->str);
+			return NULL;
+		}
+
+		done = start = match[0].rm_eo;
+
+		/* Zero length match: copy the next character or get stuck */
+
+		if (match[0].rm_so == match[0].rm_eo)
+		{
+			if (start < length && regsub_append(dst, text->str + start, 1) == -1)
+			{
+				buffer_release(dst->str);
+				return NULL;
+			}
+
+			done = ++start;
+		}
+
+		if (!all)
+			break;
+	}
+
+	if (!matches)
+	{
+		buffer_release(dst->str);
+		return NULL;
+	}
+
+	if (done < length && regsub_append(dst, text->str + done, length - done) == -1)
+	{
+		buffer_release(dst->str);
+		return NULL;
+	}
+
+	tmp = text->str, text->str = dst->str, dst->str = tmp;
+	dst->adopted = text->adopted;
+	text->size = dst->size;
+	text->length = dst->length;
+	text->adopted = 0;
+	release(dst);
+
+	return text;
+}
+
+/*
+
+C<static String *regsub_pattern(const char *pattern, const char *replacement, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all, int lock)>
+
+Compiles C<pattern> (with I<regex_create(3)> when C<cflags> contains
+C<REG_DFA>), and replaces the first (or C<all>) matches in C<text> with
+C<replacement> or whatever C<callback> appends. C<text> is write-locked
+when C<lock> is non-zero. On success, returns C<text>. On error, returns
+C<null> with C<errno> set appropriately.
+
+*/
+
+static String *regsub_pattern(const char *pattern, const char *replacement, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all, int lock)
+{
+	RegsubTemplate template[1];
+	regex_t compiled[1];
+	Regex *regex = NULL;
+	String *ret = NULL;
+	int err;
+
+	if (replacement)
+	{
+		if (!regsub_compile(template, replacement))
+			return NULL;
+
+		callback = (str_regsub_t *)regsub_expand;
+		data = template;
+	}
+
+	if (cflags & REG_DFA)
+	{
+		if (!(regex = regex_create(pattern, cflags)))
+			goto release_template;
+	}
+	else if ((err = regexpr_compile(compiled, pattern, cflags)))
+	{
+		errno = err;
+		goto release_template;
+	}
+
+	if (lock && (err = str_wrlock(text)))
+	{
+		errno = err;
+		goto release_regex;
+	}
+
+	ret = do_regsub(compiled, regex, callback, data, text, eflags, all);
+
+	if (lock && (err = str_unlock(text)))
+	{
+		errno = err;
+		ret = NULL;
+	}
+
+release_regex:
+	if (regex)
+		regex_release(regex);
+	else
+		regfree(compiled);
+
+release_template:
+	if (replacement)
+		regsub_release(template);
+
+	return ret;
+}
+
+/*
+
+=item C<String *str_regsub(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)>
+
+I<str_regsub(3)> is an interface to I<POSIX 1003.2>-compliant regular
+expression matching and substitution. C<pattern> is a regular expression.
+C<text> is the string to be searched for matches. C<cflags> is passed to
+I<regcomp(3)> along with C<REG_EXTENDED> (or to I<regex_create(3)> if it
+contains C<REG_DFA>). C<eflags> is passed to I<regexec(3)>. C<all> specifies
+whether to substitute the first match (if zero) or all matches (if
+non-zero). C<replacement> specifies the string that replaces each match. If
+C<replacement> contains C<"$#"> or C<"${##}"> (where C<"#"> is a decimal
+digit), the substring that matches the corresponding subexpression is
+interpolated in its place. Up to 32 subexpressions are supported. If
+C<replacement> contains C<"$$">, then C<"$"> is interpolated in its place.
+The following I<perl(1)> quote escape sequences are also understood:
+
+    \l  lowercase next character
+    \u  uppercase next character
+    \L  lowercase until matching \E
+    \U  uppercase until matching \E
+    \Q  backslash non-alphanumeric characters until matching \E
+    \E  end case/quotemeta modification
+
+Note that these sequences don't behave exactly like in I<perl(1)>. Namely,
+an C<\l> appearing between a C<\U> and an C<\E> does lowercase the next
+character and a C<\E> sequence without a matching C<\L>, C<\U> or C<\Q> is
+an error. Also note that only 32 levels of nesting are supported.
+
+On success, returns C<text>. On error (including no match), returns C<null>
+with C<errno> set appropriately. Only use this function when the regular
+expression will be used only once. Otherwise, use I<regexpr_compile(3)> or
+I<regcomp(3)> and I<str_regsub_compiled(3)>.
+
+=cut
+
+*/
+
+String *str_regsub(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)
+{
+	if (!pattern || !replacement || !text)
+		return set_errnull(EINVAL);
+
+	return regsub_pattern(pattern, replacement, NULL, NULL, text, cflags, eflags, all, 1);
+}
+
+/*
+
+=item C<String *str_regsub_unlocked(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)>
+
+Equivalent to I<str_regsub(3)> except that C<text> is not write-locked.
+
+=cut
+
+*/
+
+String *str_regsub_unlocked(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)
+{
+	if (!pattern || !replacement || !text)
+		return set_errnull(EINVAL);
+
+	return regsub_pattern(pattern, replacement, NULL, NULL, text, cflags, eflags, all, 0);
+}
+
+/*
+
+=item C<String *str_regsub_compiled(const regex_t *compiled, const char *replacement, String *text, int eflags, int all)>
+
+Equivalent to I<str_regsub(3)> but works on an already compiled I<regex_t>,
+C<compiled>.
+
+=cut
+
+*/
+
+String *str_regsub_compiled(const regex_t *compiled, const char *replacement, String *text, int eflags, int all)
+{
+	String *ret;
+	int err;
+
+	if (!compiled || !replacement || !text)
+		return set_errnull(EINVAL);
+
+	if ((err = str_wrlock(text)))
+		return set_errnull(err);
+
+	ret = str_regsub_compiled_unlocked(compiled, replacement, text, eflags, all);
+
+	if ((err = str_unlock(text)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<String *str_regsub_compiled_unlocked(const regex_t *compiled, const char *replacement, String *text, int eflags, int all)>
+
+Equivalent to I<str_regsub_compiled(3)> except that C<text> is not
+write-locked.
+
+=cut
+
+*/
+
+String *str_regsub_compiled_unlocked(const regex_t *compiled, const char *replacement, String *text, int eflags, int all)
+{
+	RegsubTemplate template[1];
+	String *ret;
+
+	if (!compiled || !replacement || !text)
+		return set_errnull(EINVAL);
+
+	if (!regsub_compile(template, replacement))
+		return NULL;
+
+	ret = str_regsub_callback_compiled_unlocked(compiled, (str_regsub_t *)regsub_expand, template, text, eflags, all);
+	regsub_release(template);
+
+	return ret;
+}
+
+/*
+
+=item C<String *str_regsub_callback(const char *pattern, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all)>
+
+Like I<str_regsub(3)> except that each match is replaced with whatever the
+function, C<callback>, appends to the I<String> that is passed to it as its
+first argument (initially empty). Its second argument is the contents of
+C<text> (before any substitutions). Its third argument is an array of 33
+I<regmatch_t> structures whose offsets are relative to the second argument.
+The first element describes the whole match, and the rest describe the
+subexpressions (C<rm_so> is C<-1> for subexpressions that didn't match).
+Its fourth argument is C<data>. On success, C<callback> must return C<0>.
+On error, it must return C<-1> with C<errno> set appropriately, and then
+I<str_regsub_callback(3)> fails as well. C<callback> must not modify
+C<text>. On success, returns C<text>. On error (including no match),
+returns C<null> with C<errno> set appropriately, and C<text> is unchanged.
+
+=cut
+
+*/
+
+String *str_regsub_callback(const char *pattern, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all)
+{
+	if (!pattern || !callback || !text)
+		return set_errnull(EINVAL);
+
+	return regsub_pattern(pattern, NULL, callback, data, text, cflags, eflags, all, 1);
+}
+
+/*
+
+=item C<String *str_regsub_callback_unlocked(const char *pattern, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all)>
+
+Equivalent to I<str_regsub_callback(3)> except that C<text> is not
+write-locked.
+
+=cut
+
+*/
+
+String *str_regsub_callback_unlocked(const char *pattern, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all)
+{
+	if (!pattern || !callback || !text)
+		return set_errnull(EINVAL);
+
+	return regsub_pattern(pattern, NULL, callback, data, text, cflags, eflags, all, 0);
+}
+
+/*
+
+=item C<String *str_regsub_callback_compiled(const regex_t *compiled, str_regsub_t *callback, void *data, String *text, int eflags, int all)>
+
+Equivalent to I<str_regsub_callback(3)> but works on an already compiled
+I<regex_t>, C<compiled>.
+
+=cut
+
+*/
+
+String *str_regsub_callback_compiled(const regex_t *compiled, str_regsub_t *callback, void *data, String *text, int eflags, int all)
+{
+	String *ret;
+	int err;
+
+	if (!compiled || !callback || !text)
+		return set_errnull(EINVAL);
+
+	if ((err = str_wrlock(text)))
+		return set_errnull(err);
+
+	ret = str_regsub_callback_compiled_unlocked(compiled, callback, data, text, eflags, all);
+
+	if ((err = str_unlock(text)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<String *str_regsub_callback_compiled_unlocked(const regex_t *compiled, str_regsub_t *callback, void *data, String *text, int eflags, int all)>
+
+Equivalent to I<str_regsub_callback_compiled(3)> except that C<text> is not
+write-locked.
+
+=cut
+
+*/
+
+String *str_regsub_callback_compiled_unlocked(const regex_t *compiled, str_regsub_t *callback, void *data, String *text, int eflags, int all)
+{
+	if (!compiled || !callback || !text)
+		return set_errnull(EINVAL);
+
+	return do_regsub(compiled, NULL, callback, data, text, eflags, all);
+}
+
+#ifndef REGEXPR_GREP_CHUNK
+#define REGEXPR_GREP_CHUNK 65536
+#endif
+
+#define REGEXPR_GREP_THREADS 256
+
+typedef struct RegexprGrep RegexprGrep;
+
+struct RegexprGrep
+{
+	regexpr_search_t *search; /* the search function */
+	void *engine;             /* the compiled pattern this chunk is searched with */
+	const char *text;         /* the whole text */
+	size_t length;            /* length of the whole text */
+	size_t start;             /* start of this chunk (always the start of a line) */
+	size_t end;               /* end of this chunk (after a newline, or the end of the text) */
+	int eflags;               /* execution flags */
+	int lines;                /* whether to find matching lines rather than matches */
+	int newline;              /* whether no match can contain a newline */
+	List *found;              /* regmatch_t items found in this chunk */
+	int err;                  /* errno of the first failure in this chunk */
+};
+
+/*
+
+C<static int grep_newline(const char *pattern)>
+
+Returns whether or not a match of the extended regular expression,
+C<pattern>, might contain a newline even when compiled with
+C<REG_NEWLINE>, which only stops C<.> and non-matching lists from matching
+one. This errs on the side of caution: a newline (or an escaped C<n>), a
+control character that might start a range, the C<\s> and C<\W> escapes,
+the C<space> and C<cntrl> character classes, and collating symbols and
+equivalence classes all count.
+
+*/
+
+static int grep_newline(const char *pattern)
+{
+	const unsigned char *p;
+
+	for (p = (const unsigned char *)pattern; *p; ++p)
+	{
+		if (*p <= '\n')
+			return 1;
+
+		if (*p == '\\' && (p[1] == 'n' || p[1] == 's' || p[1] == 'W'))
+			return 1;
+
+		if (*p == '[' && (p[1] == '.' || p[1] == '='))
+			return 1;
+	}
+
+	return strstr(pattern, "[:space:]") || strstr(pattern, "[:cntrl:]");
+}
+
+/*
+
+C<static int grep_posix(void *engine, const char *text, size_t start, size_t end, regmatch_t *match, int eflags)>
+
+The I<regexpr_search_t> for a compiled I<regex_t>, C<engine>.
+
+*/
+
+static int grep_posix(void *engine, const char *text, size_t start, size_t end, regmatch_t *match, int eflags)
+{
+	return regex_posix((const regex_t *)engine, text, start, end, 1, match, eflags, 0);
+}
+
+/*
+
+C<static int grep_regex(void *engine, const char *text, size_t start, size_t end, regmatch_t *match, int eflags)>
+
+The I<regexpr_search_t> for a I<Regex>, C<engine>, that belongs to a single
+thread.
+
+*/
+
+static int grep_regex(void *engine, const char *text, size_t start, size_t end, regmatch_t *match, int eflags)
+{
+	return regex_search((Regex *)engine, text, start, end, 1, match, eflags, 0);
+}
+
+/*
+
+C<static int grep_threads(int threads, size_t length)>
+
+Returns the number of threads worth using to search C<length> bytes when
+C<threads> are requested (or when C<threads> is zero or less, one per
+online processor). Each thread gets at least C<REGEXPR_GREP_CHUNK> bytes.
+
+*/
+
+static int grep_threads(int threads, size_t length)
+{
+	size_t chunks = length / REGEXPR_GREP_CHUNK;
+
+	if (threads <= 0)
+		threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (threads > REGEXPR_GREP_THREADS)
+		threads = REGEXPR_GREP_THREADS;
+
+	if ((size_t)threads > chunks)
+		threads = (int)chunks;
+
+	return (threads < 1) ? 1 : threads;
+}
+
+/*
+
+C<static int grep_chunks(RegexprGrep *chunk, int threads, const char *text, size_t length)>
+
+Divides C<text> into at most C<threads> chunks of similar size that start
+at the beginning of lines, and stores their bounds in C<chunk>. Returns the
+number of chunks. There are fewer when lines are long.
+
+*/
+
+static int grep_chunks(RegexprGrep *chunk, int threads, const char *text, size_t length)
+{
+	size_t start, target;
+	const char *nl;
+	int n;
+
+	for (n = 0, start = 0; n < threads; start = chunk[n++].end)
+	{
+		chunk[n].start = start;
+		target = length / threads * (n + 1);
+
+		if (n == threads - 1 || target < start)
+			target = start;
+
+		nl = (n < threads - 1 && target < length) ? memchr(text + target, '\n', length - target) : NULL;
+		chunk[n].end = nl ? (size_t)(nl - text) + 1 : length;
+
+		if (chunk[n].end == length)
+			return n + 1;
+	}
+
+	return n;
+}
+
+/*
+
+C<static void *grep_chunk(void *arg)>
+
+Searches the chunk described by C<arg> for non-overlapping matches (or
+matching lines) that start in the chunk, and appends their offsets to its
+list. Empty matches at the end of a chunk belong to the next one. When the
+pattern can't match a newline (see I<grep_newline()>), the search stops at
+the end of the chunk. Otherwise, it continues into the rest of the text, so
+that the chunk's last match is the same as a single thread would find (it
+may end in a later chunk). Runs in its own thread.
+
+*/
+
+static void *grep_chunk(void *arg)
+{
+	RegexprGrep *chunk = (RegexprGrep *)arg;
+	const char *text = chunk->text;
+	int last = chunk->end == chunk->length;
+	size_t end = (chunk->newline) ? chunk->end : chunk->length;
+	int eflags = chunk->eflags | ((end == chunk->length) ? 0 : REG_NOTEOL);
+	regmatch_t match[1], *found;
+	const char *nl;
+	size_t pos, so, eo;
+	int err;
+
+	for (pos = chunk->start; pos < chunk->end || (last && pos == chunk->end); )
+	{
+		if ((err = chunk->search(chunk->engine, text, pos, end, match, eflags)))
+		{
+			if (err != REG_NOMATCH)
+				chunk->err = err;
+
+			break;
+		}
+
+		so = match[0].rm_so;
+		eo = match[0].rm_eo;
+
+		/* The end of the text is only on a line when it doesn't follow a newline */
+
+		if (so > chunk->end || (so == chunk->end && (!last || (chunk->lines && (so == chunk->start || text[so - 1] == '\n')))))
+			break;
+
+		if (chunk->lines)
+		{
+			/* Lines start at pos so there's no need to look further back */
+
+			while (so > pos && text[so - 1] != '\n')
+				--so;
+
+			nl = memchr(text + match[0].rm_so, '\n', chunk->end - match[0].rm_so);
+			eo = nl ? (size_t)(nl - text) : chunk->end;
+			pos = eo + 1;
+		}
+		else
+			pos = (so == eo) ? eo + 1 : eo;
+
+		if (!(found = mem_new(regmatch_t)))
+		{
+			chunk->err = errno;
+			break;
+		}
+
+		found->rm_so = so;
+		found->rm_eo = eo;
+
+		if (!list_append(chunk->found, found))
+		{
+			mem_release(found);
+			chunk->err = errno;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+
+C<int grep_resync(RegexprGrep *chunk, int nchunks)>
+
+After the chunks have been searched without C<REG_NEWLINE>, a chunk's last
+match might end inside the following chunk(s), where a single thread would
+resume searching. Those chunks were searched from their start instead, so
+their matches up to the point where both searches agree are replaced by the
+result of searching again from where a single thread would resume. Only
+needed when finding matches rather than lines (lines always end inside
+their chunk). On success, returns C<0>. On error, returns an error code.
+
+*/
+
+static int grep_resync(RegexprGrep *chunk, int nchunks)
+{
+	regmatch_t match[1], *found;
+	size_t resume = 0, so, eo;
+	ssize_t length, fixed, drop;
+	int i, err;
+
+	for (i = 0; i < nchunks; ++i)
+	{
+		/* Replace matches until they agree with a single thread's */
+
+		for (fixed = 0; resume > chunk[i].start; )
+		{
+			length = list_length(chunk[i].found);
+
+			for (drop = fixed; drop < length && ((regmatch_t *)list_item(chunk[i].found, drop))->rm_so < (regoff_t)resume; ++drop)
+				free(list_item(chunk[i].found, drop));
+
+			if (drop > fixed && !list_remove_range(chunk[i].found, fixed, drop - fixed))
+				return errno;
+
+			if (resume > chunk[i].end || (resume == chunk[i].end && i < nchunks - 1))
+				break;
+
+			if ((err = chunk[i].search(chunk[0].engine, chunk[i].text, resume, chunk[i].length, match, chunk[i].eflags)))
+			{
+				if (err != REG_NOMATCH)
+					return err;
+
+				/* No more matches anywhere, so discard the rest */
+
+				resume = chunk[i].length + 1;
+				continue;
+			}
+
+			so = match[0].rm_so;
+			eo = match[0].rm_eo;
+
+			/* The next match is in a later chunk, so this one has no more */
+
+			if (so > chunk[i].end || (so == chunk[i].end && i < nchunks - 1))
+			{
+				resume = so;
+				continue;
+			}
+
+			if (fixed < list_length(chunk[i].found))
+			{
+				found = (regmatch_t *)list_item(chunk[i].found, fixed);
+
+				if ((size_t)found->rm_so == so && (size_t)found->rm_eo == eo)
+					break;
+			}
+
+			if (!(found = mem_new(regmatch_t)))
+				return errno;
+
+			found->rm_so = so;
+			found->rm_eo = eo;
+
+			if (!list_insert(chunk[i].found, fixed, found))
+			{
+				mem_release(found);
+				return errno;
+			}
+
+			resume = (so == eo) ? eo + 1 : eo;
+			++fixed;
+		}
+
+		/* Where a single thread would resume after this chunk's last match */
+
+		if (!list_empty(chunk[i].found))
+		{
+			found = (regmatch_t *)list_item(chunk[i].found, list_last(chunk[i].found));
+			resume = (found->rm_so == found->rm_eo) ? found->rm_eo + 1 : found->rm_eo;
+		}
+	}
+
+	return 0;
+}
+
+/*
+
+C<List *grep_run(regexpr_search_t *search, void **engines, int threads, const char *text, size_t length, int eflags, int lines, int newline)>
+
+Equivalent to I<regexpr_grep_callback(3)> except that the arguments aren't
+checked. If C<newline> is non-zero, no match can contain a newline (the
+pattern was compiled with C<REG_NEWLINE> and doesn't match one explicitly),
+so each chunk is searched without looking past its end.
+
+*/
+
+static List *grep_run(regexpr_search_t *search, void **engines, int threads, const char *text, size_t length, int eflags, int lines, int newline)
+{
+	RegexprGrep *chunk;
+	pthread_t *thread;
+	List *ret = NULL;
+	int nchunks, started, i;
+	int err = 0;
+
+	threads = grep_threads(threads, length);
+
+	if (!(chunk = mem_create(threads, RegexprGrep)))
+		return NULL;
+
+	nchunks = grep_chunks(chunk, threads, text, length);
+
+	for (i = 0; i < nchunks; ++i)
+	{
+		chunk[i].search = search;
+		chunk[i].engine = engines[i];
+		chunk[i].text = text;
+		chunk[i].length = length;
+		chunk[i].eflags = eflags;
+		chunk[i].lines = lines;
+		chunk[i].newline = newline;
+		chunk[i].err = 0;
+
+		if (!(chunk[i].found = list_create(NULL)))
+		{
+			while (i--)
+				list_release(chunk[i].found);
+
+			mem_release(chunk);
+			return NULL;
+		}
+	}
+
+	if (!(thread = mem_create(nchunks, pthread_t)))
+	{
+		err = errno;
+		goto release_chunks;
+	}
+
+	/* Search chunks in other threads, or in this one if they can't start */
+
+	for (started = 1; started < nchunks; ++started)
+		if (pthread_create(thread + started, NULL, grep_chunk, chunk + started))
+			break;
+
+	grep_chunk(chunk);
+
+	for (i = started; i < nchunks; ++i)
+		grep_chunk(chunk + i);
+
+	for (i = 1; i < started; ++i)
+		pthread_join(thread[i], NULL);
+
+	mem_release(thread);
+
+	/* Merge the chunks' lists in order */
+
+	for (i = 0; i < nchunks; ++i)
+		if (chunk[i].err && !err)
+			err = chunk[i].err;
+
+	if (!err && !newline && !lines)
+		err = grep_resync(chunk, nchunks);
+
+	for (i = 1; !err && i < nchunks; ++i)
+	{
+		if (!list_append_list(chunk[0].found, chunk[i].found, NULL))
+			err = errno;
+		else
+			list_destroy(&chunk[i].found);
+	}
+
+	if (!err)
+	{
+		ret = chunk[0].found;
+		chunk[0].found = NULL;
+		list_own(ret, free);
+	}
+
+release_chunks:
+	for (i = 0; i < nchunks; ++i)
+	{
+		if (chunk[i].found)
+		{
+			list_own(chunk[i].found, free);
+			list_release(chunk[i].found);
+		}
+	}
+
+	mem_release(chunk);
+
+	if (err)
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_regexpr_grep(const char *pattern, const String *text, int cflags, int eflags, int threads, int lines)>
+
+Equivalent to I<regexpr_grep(3)> except that the text to search is the
+I<String>, C<text>. C<text> is read-locked while it is searched.
+
+=cut
+
+*/
+
+List *str_regexpr_grep(const char *pattern, const String *text, int cflags, int eflags, int threads, int lines)
+{
+	List *ret;
+	int err;
+
+	if (!pattern || !text)
+		return set_errnull(EINVAL);
+
+	if ((err = str_rdlock(text)))
+		return set_errnull(err);
+
+	ret = str_regexpr_grep_unlocked(pattern, text, cflags, eflags, threads, lines);
+
+	if ((err = str_unlock(text)))
+	{
+		if (ret)
+			list_release(ret);
+
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_regexpr_grep_unlocked(const char *pattern, const String *text, int cflags, int eflags, int threads, int lines)>
+
+Equivalent to I<str_regexpr_grep(3)> except that C<text> is not read-locked.
+
+=cut
+
+*/
+
+List *str_regexpr_grep_unlocked(const char *pattern, const String *text, int cflags, int eflags, int threads, int lines)
+{
+	if (!pattern || !text)
+		return set_errnull(EINVAL);
+
+	return regexpr_grep(pattern, text->str, text->length - 1, cflags, eflags, threads, lines);
+}
+
+/*
+
+=item C<List *regexpr_grep(const char *pattern, const char *text, size_t length, int cflags, int eflags, int threads, int lines)>
+
+Searches the first C<length> bytes of C<text> (which needn't be
+C<nul>-terminated, e.g. a memory mapped file) for all non-overlapping
+matches of the extended regular expression, C<pattern>, using up to
+C<threads> threads (or one per online processor if C<threads> is zero or
+less). C<cflags> is as for I<regexpr_compile(3)>, and C<REG_DFA> selects
+I<regex_create(3)> rather than I<regcomp(3)>. C<eflags> is as for
+I<regexec(3)>. The text is divided into chunks that start at the beginning
+of lines and each thread searches one chunk with its own copy of the
+compiled pattern (since I<regexec(3)> may serialise threads sharing a
+I<regex_t>). Text less than 64KiB long isn't divided.
+
+If C<lines> is zero, the items of the returned list are I<regmatch_t>
+structures containing the offsets of each match in C<text>, in order. If
+C<lines> is non-zero, the items are the offsets of each line (excluding
+its newline) that contains the start of a match, in order, like
+I<grep(1)>. Either way, the results are the same as those of a single
+thread searching the whole text. A chunk's last match may run into the
+next chunk, whose matches up to that point are then found again. That
+isn't needed when no match can contain a newline, so each chunk is searched
+on its own. That is the case when C<cflags> contains C<REG_NEWLINE> (which
+also lets C<^> and C<$> match at the start and end of each line) and the
+pattern doesn't match a newline explicitly (e.g. with a newline, C<\s> or
+C<[[:space:]]>). On success, returns the new list. It is the caller's
+responsibility to deallocate the list with I<list_release(3)> or
+I<list_destroy(3)>. On error, returns C<null> with C<errno> set
+appropriately (to a I<regcomp(3)> or I<regexec(3)> error code when
+compiling or searching fails).
+
+    List *lines = regexpr_grep("ERROR|FATAL", map, size, REG_NEWLINE | REG_DFA, 0, 0, 1);
+    regmatch_t *line;
+
+    while ((line = list_shift(lines)))
+    {
+        printf("%.*s\n", (int)(line->rm_eo - line->rm_so), map + line->rm_so);
+        free(line);
+    }
+
+    list_destroy(&lines);
+
+=cut
+
+*/
+
+List *regexpr_grep(const char *pattern, const char *text, size_t length, int cflags, int eflags, int threads, int lines)
+{
+	regex_t *compiled = NULL;
+	Regex **regex = NULL;
+	void **engines;
+	List *ret = NULL;
+	int i, n, newline;
+	int err;
+
+	if (!pattern || !text)
+		return set_errnull(EINVAL);
+
+	threads = grep_threads(threads, length);
+
+	if (!(engines = mem_create(threads, void *)))
+		return NULL;
+
+	if (cflags & REG_DFA)
+	{
+		if (!(regex = mem_create(threads, Regex *)))
+			goto release_engines;
+
+		for (n = 0; n < threads; ++n)
+			if (!(engines[n] = regex[n] = regex_create(pattern, cflags)))
+				goto release_compiled;
+	}
+	else
+	{
+		if (!(compiled = mem_create(threads, regex_t)))
+			goto release_engines;
+
+		for (n = 0; n < threads; ++n)
+		{
+			if ((err = regexpr_compile(compiled + n, pattern, cflags)))
+			{
+				errno = err;
+				goto release_compiled;
+			}
+
+			engines[n] = compiled + n;
+		}
+	}
+
+	/* Chunks can be searched on their own when no match can contain a newline */
+
+	newline = (cflags & REG_NEWLINE) && !((regex && !regex[0]->posix) ? regex_newline(regex[0]) : grep_newline(pattern));
+	ret = grep_run((regex) ? grep_regex : grep_posix, engines, threads, text, length, eflags, lines, newline);
+
+release_compiled:
+	err = errno;
+
+	for (i = 0; i < n; ++i)
+	{
+		if (regex)
+			regex_release(regex[i]);
+		else
+			regfree(compiled + i);
+	}
+
+	mem_release(regex);
+	mem_release(compiled);
+	errno = err;
+
+release_engines:
+	mem_release(engines);
+
+	return ret;
+}
+
+/*
+
+=item C<List *regexpr_grep_compiled(const regex_t *compiled, int ncompiled, const char *text, size_t length, int eflags, int lines)>
+
+Equivalent to I<regexpr_grep(3)> except that C<text> is searched with
+already compiled I<regex_t> structures. C<compiled> is an array of
+C<ncompiled> I<regex_t> structures compiled from the same pattern, and up
+to C<ncompiled> threads are used, one per I<regex_t>. An array of one is
+fine when concurrent I<regexec(3)> calls on one I<regex_t> don't
+serialise, but not with I<glibc>. Since the compilation flags aren't known,
+matches are allowed to cross chunk boundaries as if C<REG_NEWLINE> weren't
+set.
+
+=cut
+
+*/
+
+List *regexpr_grep_compiled(const regex_t *compiled, int ncompiled, const char *text, size_t length, int eflags, int lines)
+{
+	void **engines;
+	List *ret;
+	int i;
+
+	if (!compiled || ncompiled < 1 || !text)
+		return set_errnull(EINVAL);
+
+	if (!(engines = mem_create(ncompiled, void *)))
+		return NULL;
+
+	for (i = 0; i < ncompiled; ++i)
+		engines[i] = (void *)(compiled + i);
+
+	ret = regexpr_grep_callback(grep_posix, engines, ncompiled, text, length, eflags, lines);
+	mem_release(engines);
+
+	return ret;
+}
+
+/*
+
+=item C<List *regexpr_grep_callback(regexpr_search_t *search, void **engines, int threads, const char *text, size_t length, int eflags, int lines)>
+
+Equivalent to I<regexpr_grep(3)> except that any regular expression
+engine can do the searching. C<search> is called as C<search(engine, text,
+start, end, match, eflags)> to find the leftmost match in C<text> between
+the offsets C<start> and C<end>. It must store the offsets of the match
+(relative to C<text>) in C<match[0]> and return C<0>, or return
+C<REG_NOMATCH> if there isn't a match, or return an error code that is
+passed back in C<errno>. The text before C<start> is there to decide
+whether C<^> matches at C<start> (it's a line boundary), so C<REG_NOTBOL>
+only applies at offset zero. Since matches are allowed to cross chunk
+boundaries (as if C<REG_NEWLINE> weren't set), C<end> is always the end of
+the text. C<engines> is an array of C<threads> pointers that are
+passed to C<search> as C<engine>, and each thread uses its own element.
+
+=cut
+
+*/
+
+List *regexpr_grep_callback(regexpr_search_t *search, void **engines, int threads, const char *text, size_t length, int eflags, int lines)
+{
+	if (!search || !engines || threads < 1 || !text)
+		return set_errnull(EINVAL);
+
+	return grep_run(search, engines, threads, text, length, eflags, lines, 0);
+}
+
+#endif
+
+/*
+
+C<static size_t utf8_space(const char *s, int breaking)>
+
+Returns the length in bytes of the UTF-8 whitespace character at C<s>
+(I<ASCII> whitespace, or one of the Unicode C<White_Space> characters), or
+C<0> if there isn't one. If C<breaking> is non-zero, the no-break spaces
+(C<U+00A0>, C<U+2007> and C<U+202F>) don't count.
+
+*/
+
+static size_t utf8_space(const char *s, int breaking)
+{
+	const unsigned char *u = (const unsigned char *)s;
+
+	switch (u[0])
+	{
+		case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+			return 1;
+
+		case 0xc2: /* U+0085, U+00A0 */
+			return (u[1] == 0x85 || (u[1] == 0xa0 && !breaking)) ? 2 : 0;
+
+		case 0xe1: /* U+1680 */
+			return (u[1] == 0x9a && u[2] == 0x80) ? 3 : 0;
+
+		case 0xe2: /* U+2000-U+200A, U+2028, U+2029, U+202F, U+205F */
+			if (u[1] == 0x80)
+				return ((u[2] >= 0x80 && u[2] <= 0x8a && !(u[2] == 0x87 && breaking)) || u[2] == 0xa8 || u[2] == 0xa9 || (u[2] == 0xaf && !breaking)) ? 3 : 0;
+
+			return (u[1] == 0x81 && u[2] == 0x9f) ? 3 : 0;
+
+		case 0xe3: /* U+3000 */
+			return (u[1] == 0x80 && u[2] == 0x80) ? 3 : 0;
+	}
+
+	return 0;
+}
+
+/*
+
+C<static size_t utf8_space_before(const char *str, size_t end)>
+
+Returns the length in bytes of the UTF-8 whitespace character (see
+I<utf8_space()>) that ends at offset C<end> in C<str>, or C<0> if there
+isn't one.
+
+*/
+
+static size_t utf8_space_before(const char *str, size_t end)
+{
+	size_t n;
+
+	for (n = 1; n <= 3 && n <= end; ++n)
+		if (utf8_space(str + end - n, 0) == n)
+			return n;
+
+	return 0;
+}
+
+/*
+
+C<static size_t fmt_space(const char *s, int utf8)>
+
+Returns the length in bytes of the word separator at C<s> for
+I<fmt(3)> (when C<utf8> is zero) or I<fmt_utf8(3)>, or C<0> if there
+isn't one.
+
+*/
+
+static size_t fmt_space(const char *s, int utf8)
+{
+	return (utf8) ? utf8_space(s, 1) : (is_space(*s) != 0);
+}
+
+/*
+
+C<static ssize_t fmt_width(const String *line, int utf8)>
+
+Returns the width of C<line> for I<fmt(3)> (its length in bytes, when
+C<utf8> is zero) or I<fmt_utf8(3)> (its length in characters), or C<0> if
+C<line> is C<null>.
+
+*/
+
+static ssize_t fmt_width(const String *line, int utf8)
+{
+	if (!line)
+		return 0;
+
+	return (utf8) ? utf8_length(line->str, line->length - 1) : line->length - 1;
+}
+
+/*
+
+C<static List *do_fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment, int utf8)>
+
+Performs formatting as described in I<fmt_with_locker(3)> or, when
+C<utf8> is non-zero, I<fmt_utf8(3)>.
+
+*/
+
+static List *do_fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment, int utf8)
+{
+	List *para;
+	String *line = NULL;
+	const char *s, *r;
+	ssize_t len;
+	size_t n;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	switch (alignment)
+	{
+		case ALIGN_LEFT:
+		case ALIGN_RIGHT:
+		case ALIGN_FULL:
+		{
+			if (!(para = list_create_with_locker(locker, (list_release_t *)str_release)))
+				return NULL;
+
+			for (s = str; *s; s = r)
+			{
+				while ((n = fmt_space(s, utf8)))
+					s += n;
+
+				for (r = s; *r && !fmt_space(r, utf8); ++r)
+				{}
+
+				if (r > s)
+				{
+					len = fmt_width(line, utf8);
+
+					if (len + (len != 0) + ((utf8) ? utf8_length(s, r - s) : r - s) > line_width)
+					{
+						if (len && !list_append(para, line))
+						{
+							str_release(line);
+							list_release(para);
+							return NULL;
+						}
+
+						line = NULL;
+					}
+
+					if (!line)
+					{
+						if (!(line = str_create_sized(line_width, "%.*s", r - s, s)))
+						{
+							list_release(para);
+							return NULL;
+						}
+					}
+					else if (!str_append(line, " %.*s", r - s, s))
+					{
+						str_release(line);
+						list_release(para);
+						return NULL;
+					}
+				}
+			}
+
+			if (str_length(line) > 0 && !list_append(para, line))
+			{
+				str_release(line);
+				list_release(para);
+				return NULL;
+			}
+
+			if (alignment == ALIGN_RIGHT)
+			{
+				while (list_has_next(para) == 1)
+				{
+					line = (String *)list_next(para);
+					len = fmt_width(line, utf8);
+
+					if (len >= line_width)
+						continue;
+
+					if (!str_prepend(line, "%*s", line_width - len, ""))
+					{
+						list_release(para);
+						return NULL;
+					}
+				}
+			}
+			else if (alignment == ALIGN_FULL)
+			{
+				ssize_t lines;
+				int i;
+
+				if ((lines = list_length(para)) == -1)
+				{
+					list_release(para);
+					return NULL;
+				}
+
+				for (i = 0; i < lines - 1; ++i)
+				{
+					size_t extra;
+					size_t gaps;
+
+					line = (String *)list_item(para, i);
+					len = fmt_width(line, utf8);
+
+					if (len >= line_width)
+						continue;
+
+					extra = line_width - len;
+					gaps = 0;
+
+					for (s = line->str; *s; ++s)
+						if (*s == ' ')
+							++gaps;
+
+					for (s = line->str; gaps && *s; ++s)
+					{
+						if (*s == ' ')
+						{
+							int gap = extra / gaps;
+
+							if (!str_insert(line, s - line->str, "%*s", gap, ""))
+							{
+								list_release(para);
+								return NULL;
+							}
+
+							extra -= gap;
+							--gaps;
+							s += gap;
+						}
+					}
+				}
+			}
+
+			break;
+		}
+
+		case ALIGN_CENTRE:
+		{
+			if (!(para = split_with_locker(locker, str, "\n")))
+				return NULL;
+
+			while (list_has_next(para) == 1)
+			{
+				size_t extra;
+				line = (String *)list_next(para);
+				str_squeeze(line);
+				len = fmt_width(line, utf8);
+
+				if (len >= line_width)
+					continue;
+
+				extra = (line_width - len) / 2;
+
+				if (extra && !str_prepend(line, "%*s", extra, ""))
+				{
+					list_release(para);
+					return NULL;
+				}
+			}
+
+			break;
+		}
+
+		default:
+		{
+			return set_errnull(EINVAL);
+		}
+	}
+
+	return para;
+}
+
+/*
+
+=item C<List *str_fmt(const String *str, size_t line_width, StringAlignment alignment)>
+
+Formats C<str> into a I<List> of I<String> objects with length no greater
+than C<line_width> (unless there are individual words longer than
+C<line_width>) with the alignment specified by C<alignment>:
+
+=over 4
+
+=item C<ALIGN_LEFT> (C<'<'>)
+
+The lines will be left justified (with one space between words).
+
+=item C<ALIGN_RIGHT> ('>')
+
+The lines will be right justified (with one space between words).
+
+=item C<ALIGN_CENTRE> or C<ALIGN_CENTER> (C<'|'>)
+
+C<str> will be split into lines at each newline character (C<'\n'>). The
+lines will then be centred (with one space between words) padded with spaces
+to the left.
+
+=item C<ALIGN_FULL> (C<'='>)
+
+The lines will be fully justified (possibly with multiple spaces between
+words).
+
+=back
+
+On success, returns a new I<List> of I<String> objects. It is the caller's
+responsibility to deallocate the list with I<list_release(3)> or
+I<list_destroy(3)>. On error, returns C<null> with C<errno> set
+appropriately. Note that C<str> is interpreted as a C<nul>-terminated
+string.
+
+B<Note:> I<str_fmt(3)> provides straightforward formatting completely
+lacking in any aesthetic sensibilities. If you need awesome paragraph
+formatting, pipe text through I<par(1)> instead (available from
+C<http://www.cs.berkeley.edu/~amc/Par/>).
+
+=cut
+
+*/
+
+List *str_fmt(const String *str, size_t line_width, StringAlignment alignment)
+{
+	return str_fmt_with_locker(NULL, str, line_width, alignment);
+}
+
+/*
+
+=item C<List *str_fmt_unlocked(const String *str, size_t line_width, StringAlignment alignment)>
+
+Equivalent to I<str_fmt(3)> except that C<str> is not read-locked.
+
+=cut
+
+*/
+
+List *str_fmt_unlocked(const String *str, size_t line_width, StringAlignment alignment)
+{
+	return str_fmt_with_locker_unlocked(NULL, str, line_width, alignment);
+}
+
+/*
+
+=item C<List *str_fmt_with_locker(Locker *locker, const String *str, size_t line_width, StringAlignment alignment)>
+
+Equivalent to I<str_fmt(3)> except that multiple threads accessing the new
+list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *str_fmt_with_locker(Locker *locker, const String *str, size_t line_width, StringAlignment alignment)
+{
+	List *ret;
+	int err;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if ((err = str_rdlock(str)))
+		return set_errnull(err);
+
+	ret = str_fmt_with_locker_unlocked(locker, str, line_width, alignment);
+
+	if ((err = str_unlock(str)))
+	{
+		list_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_fmt_with_locker_unlocked(Locker *locker, const String *str, size_t line_width, StringAlignment alignment)>
+
+Equivalent to I<str_fmt_with_locker(3)> except that C<str> is not
+read-locked.
+
+=cut
+
+*/
+
+List *str_fmt_with_locker_unlocked(Locker *locker, const String *str, size_t line_width, StringAlignment alignment)
+{
+	if (!str)
+		return set_errnull(EINVAL);
+
+	return fmt_with_locker(locker, str->str, line_width, alignment);
+}
+
+/*
+
+=item C<List *fmt(const char *str, size_t line_width, StringAlignment alignment)>
+
+Equivalent to I<str_fmt(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+List *fmt(const char *str, size_t line_width, StringAlignment alignment)
+{
+	return fmt_with_locker(NULL, str, line_width, alignment);
+}
+
+/*
+
+=item C<List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment)>
+
+Equivalent to I<fmt(3)> except that multiple threads accessing the new list
+will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment)
+{
+	return do_fmt_with_locker(locker, str, line_width, alignment, 0);
+}
+
+/*
+
+=item C<List *str_fmt_utf8(const String *str, size_t line_width, StringAlignment alignment)>
+
+Equivalent to I<str_fmt(3)> except that C<str> is treated as UTF-8: line
+widths are measured in characters (code points) rather than bytes, and
+words are also separated by the Unicode spaces that allow a line break
+(e.g. C<U+2003> and C<U+3000>, but not the no-break space C<U+00A0>).
+Wide (e.g. CJK) and combining characters still count as one column each.
+
+=cut
+
+*/
+
+List *str_fmt_utf8(const String *str, size_t line_width, StringAlignment alignment)
+{
+	List *ret;
+	int err;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if ((err = str_rdlock(str)))
+		return set_errnull(err);
+
+	ret = str_fmt_utf8_unlocked(str, line_width, alignment);
+
+	if ((err = str_unlock(str)))
+	{
+		list_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_fmt_utf8_unlocked(const String *str, size_t line_width, StringAlignment alignment)>
+
+Equivalent to I<str_fmt_utf8(3)> except that C<str> is not read-locked.
+
+=cut
+
+*/
+
+List *str_fmt_utf8_unlocked(const String *str, size_t line_width, StringAlignment alignment)
+{
+	if (!str)
+		return set_errnull(EINVAL);
+
+	return fmt_utf8(str->str, line_width, alignment);
+}
+
+/*
+
+=item C<List *fmt_utf8(const char *str, size_t line_width, StringAlignment alignment)>
+
+Equivalent to I<str_fmt_utf8(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+List *fmt_utf8(const char *str, size_t line_width, StringAlignment alignment)
+{
+	return do_fmt_with_locker(NULL, str, line_width, alignment, 1);
+}
+
+/*
+
+C<List *do_split_with_locker(Locker *locker, const char *str, ssize_t length, const char *delim)>
+
+Splits C<str> into tokens separated by sequences of characters occurring in
+C<delim>. If C<length> is C<-1>, C<str> is interpreted as a
+C<nul>-terminated I<C> string. Otherwise, C<str> is interpreted as an
+arbitrary string of length C<length>. On success, returns a new I<List> of
+I<String> objects. It is the caller's responsibility to deallocate the list
+with I<list_release(3)> or I<list_destroy(3)>. If C<locker> is non-C<null>,
+multiple threads accessing the new list will be synchronised by C<locker>.
+On error, returns C<null> with C<errno> set appropriately.
+
+*/
+
+static List *do_split_with_locker(Locker *locker, const char *str, ssize_t length, const char *delim)
+{
+	List *ret;
+	const char *s, *r;
+
+	if (!str || !delim)
+		return set_errnull(EINVAL);
+
+	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
+		return NULL;
+
+	for (s = str; (length == -1) ? *s : s - str < length; ++s)
+	{
+		while ((length == -1) ? (*s && strchr(delim, *s)) : (s - str < length && (*s && strchr(delim, *s))))
+			++s;
+
+		if (!*delim)
+			r = s + 1;
+		else
+			for (r = s; (length == -1) ? (*r && !strchr(delim, *r)) : (r - str < length && (!*r || !strchr(delim, *r))); ++r)
+			{}
+
+		if (r > s)
+		{
+			String *token = substr(s, 0, r - s);
+			if (!token)
+			{
+				list_release(ret);
+				return NULL;
+			}
+
+			if (!list_append(ret, token))
+			{
+				str_release(token);
+				list_release(ret);
+				return NULL;
+			}
+
+			s = r;
+			if (!*delim)
+				--s;
+		}
+
+		if ((length == -1) ? !*s : (s - str == length))
+			break;
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_split(const String *str, const char *delim)>
+
+Splits C<str> into tokens separated by sequences of characters occurring in
+C<delim>. On success, returns a new I<List> of I<String> objects. It is the
+caller's responsibility to deallocate the list with I<list_release(3)> or
+I<list_destroy(3)>. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+List *str_split(const String *str, const char *delim)
+{
+	return str_split_with_locker(NULL, str, delim);
+}
+
+/*
+
+=item C<List *str_split_unlocked(const String *str, const char *delim)>
+
+Equivalent to I<str_split(3)> except that C<str> is not read-locked.
+
+=cut
+
+*/
+
+List *str_split_unlocked(const String *str, const char *delim)
+{
+	return str_split_with_locker_unlocked(NULL, str, delim);
+}
+
+/*
+
+=item C<List *str_split_with_locker(Locker *locker, const String *str, const char *delim)>
+
+Equivalent to I<str_split(3)> except that multiple threads accessing the new
+list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *str_split_with_locker(Locker *locker, const String *str, const char *delim)
+{
+	List *ret;
+	int err;
+
+	if (!str || !delim)
+		return set_errnull(EINVAL);
+
+	if ((err = str_rdlock(str)))
+		return set_errnull(err);
+
+	ret = str_split_with_locker_unlocked(locker, str, delim);
+
+	if ((err = str_unlock(str)))
+	{
+		list_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_split_with_locker_unlocked(Locker *locker, const String *str, const char *delim)>
+
+Equivalent to I<str_split_with_locker(3)> except that C<str> is not
+read-locked.
+
+=cut
+
+*/
+
+List *str_split_with_locker_unlocked(Locker *locker, const String *str, const char *delim)
+{
+	if (!str || !delim)
+		return set_errnull(EINVAL);
+
+	return do_split_with_locker(locker, str->str, str->length - 1, delim);
+}
+
+/*
+
+=item C<List *split(const char *str, const char *delim)>
+
+Equivalent to I<str_split(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+List *split(const char *str, const char *delim)
+{
+	return split_with_locker(NULL, str, delim);
+}
+
+/*
+
+=item C<List *split_with_locker(Locker *locker, const char *str, const char *delim)>
+
+Equivalent to I<split(3)> except that multiple threads accessing the new
+list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *split_with_locker(Locker *locker, const char *str, const char *delim)
+{
+	if (!str || !delim)
+		return set_errnull(EINVAL);
+
+	return do_split_with_locker(locker, str, -1, delim);
+}
+
+#ifdef HAVE_REGEX_H
+
+/*
+
+=item C<List *str_regexpr_split(const String *str, const char *delim, int cflags, int eflags)>
+
+Splits C<str> into tokens separated by occurrences of the regular
+expression, C<delim>. C<str> is interpreted as a C<nul>-terminated I<C>
+string. C<cflags> is passed to I<regcomp(3)> along with C<REG_EXTENDED> (or
+to I<regex_create(3)> if it contains C<REG_DFA>) and C<eflags> is passed to
+I<regexec(3)>. On success, returns a new I<List> of
+I<String> objects. It is the caller's responsibility to deallocate the list
+with I<list_release(3)> or I<list_destroy(3)>. On error, returns C<null>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+List *str_regexpr_split(const String *str, const char *delim, int cflags, int eflags)
+{
+	return str_regexpr_split_with_locker(NULL, str, delim, cflags, eflags);
+}
+
+/*
+
+=item C<List *str_regexpr_split_unlocked(const String *str, const char *delim, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr_split(3)> except that C<str> is not read-locked.
+
+=cut
+
+*/
+
+List *str_regexpr_split_unlocked(const String *str, const char *delim, int cflags, int eflags)
+{
+	return str_regexpr_split_with_locker_unlocked(NULL, str, delim, cflags, eflags);
+}
+
+/*
+
+=item C<List *str_regexpr_split_with_locker(Locker *locker, const String *str, const char *delim, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr_split(3)> except that multiple threads accessing
+the new list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *str_regexpr_split_with_locker(Locker *locker, const String *str, const char *delim, int cflags, int eflags)
+{
+	List *ret;
+	int err;
+
+	if (!str || !delim)
+		return set_errnull(EINVAL);
+
+	if ((err = str_rdlock(str)))
+		return set_errnull(err);
+
+	ret = str_regexpr_split_with_locker_unlocked(locker, str, delim, cflags, eflags);
+
+	if ((err = str_unlock(str)))
+	{
+		list_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
+}
+
+/*
+
+=item C<List *str_regexpr_split_with_locker_unlocked(Locker *locker, const String *str, const char *delim, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr_split_with_locker(3)> except that C<str> is not
+read-locked.
+
+=cut
+
+*/
+
+List *str_regexpr_split_with_locker_unlocked(Locker *locker, const String *str, const char *delim, int cflags, int eflags)
+{
+	if (!str || !delim)
+		return set_errnull(EINVAL);
+
+	return regexpr_split_with_locker(locker, str->str, delim, cflags, eflags);
+}
+
+/*
+
+=item C<List *regexpr_split(const char *str, const char *delim, int cflags, int eflags)>
+
+Equivalent to I<str_regexpr_split(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+List *regexpr_split(const char *str, const char *delim, int cflags, int eflags)
+{
+	return regexpr_split_with_locker(NULL, str, delim, cflags, eflags);
+}
+
+/*
+
+=item C<List *regexpr_split_with_locker(Locker *locker, const char *str, const char *delim, int cflags, int eflags)>
+
+Equivalent to I<regexpr_split(3)> except that multiple threads accessing the
+new list will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+List *regexpr_split_with_locker(Locker *locker, const char *str, const char *delim, int cflags, int eflags)
+{
+	List *ret;
+	String *token;
+	regex_t compiled[1];
+	regmatch_t match[1];
+	Regex *regex = NULL;
+	size_t length = 0;
+	int start, matches;
+	int err;
+
+	if (!str || !delim)
+		return set_errnull(EINVAL);
+
+	if (cflags & REG_DFA)
+	{
+		if (!(regex = regex_create(delim, cflags)))
+			return NULL;
+
+		length = strlen(str);
+	}
+	else if ((err = regexpr_compile(compiled, delim, cflags)))
+		return set_errnull(err);
+
+	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
+		goto release;
+
+	for (start = 0, matches = 0; str[start]; ++matches)
+	{
+		if (regex ? regex_search(regex, str + start, 0, length - start, 1, match, eflags, 1) : regexec(compiled, str + start, 1, match, eflags))
+			break;
+
+		/* Zero length match (at every position), make a token of each character */
+
+		if (match[0].rm_so == 0 && match[0].rm_eo == 0)
+		{
+			++match[0].rm_so;
+			++match[0].rm_eo;
+		}
+
+		/* Make a token of any text before the match */
+
+		if (match[0].rm_so)
+		{
+			if (!(token = substr(str, start, (ssize_t)match[0].rm_so)))
+				goto fail;
+
+			if (!list_append(ret, token))
+			{
+				str_release(token);
+				goto fail;
+			}
+		}
+
+		start += match[0].rm_eo;
+	}
+
+	/* Make a token of any text after the last match */
+
+	if (str[start])
+	{
+		if (!(token = str_create("%s", str + start)))
+			goto fail;
+
+		if (!list_append(ret, token))
+		{
+			str_release(token);
+			goto fail;
+		}
+	}
+
+	goto release;
+
+fail:
+	list_destroy(&ret);
+
+release:
+	if (regex)
+		regex_release(regex);
+	else
+		regfree(compiled);
+
+	return ret;
+}
+
+#endif
+
+/*
+
+=item C<String *str_join(const List *list, const char *delim)>
+
+Joins the I<String> objects in C<list> with C<delim> inserted between each
+one. On success, returns the resulting I<String>. It is the caller's
+responsibility to deallocate the string with I<str_release(3)> or
+I<str_destroy(3)>. On error, returns C<null> with C<errno> set
+appropriately.
+
+=cut
+
+*/
+
+String *str_join(const List *list, const char *delim)
+{
+	return str_join_with_locker(NULL, list, delim);
+}
+
+/*
+
+=item C<String *str_join_unlocked(const List *list, const char *delim)>
+
+Equivalent to I<str_join(3)> except that C<list> is not read-locked.
+
+=cut
+
+*/
+
+String *str_join_unlocked(const List *list, const char *delim)
+{
+	return str_join_with_locker_unlocked(NULL, list, delim);
+}
+
+/*
+
+=item C<String *str_join_with_locker(Locker *locker, const List *list, const char *delim)>
+
+Equivalent to I<str_join(3)> except that multiple threads accessing the new
+string will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+String *str_join_with_locker(Locker *locker, const List *list, const char *delim)
+{
+	String *ret;
+	int err;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if ((err = list_rdlock(list)))
+		return set_errnull(err);
+
+	ret = str_join_with_locker_unlocked(locker, list, delim);
+
+	if ((err = list_unlock(list)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<String *str_join_with_locker_unlocked(Locker *locker, const List *list, const char *delim)>
+
+Equivalent to I<str_join_with_locker(3)> except that C<list> is not
+read-locked.
+
+=cut
+
+*/
+
+String *str_join_with_locker_unlocked(Locker *locker, const List *list, const char *delim)
+{
+	String *ret;
+	String *del;
+	Lister *lister;
+	int i;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if (!(ret = str_create_with_locker(locker, NULL)))
+		return NULL;
+
+	if (!(del = str_create(delim ? "%s" : NULL, delim)))
+	{
+		str_release(ret);
+		return NULL;
+	}
+
+	if (!(lister = lister_create_unlocked(list)))
+	{
+		str_release(ret);
+		str_release(del);
+		return NULL;
+	}
+
+	for (i = 0; lister_has_next(lister) == 1; ++i)
+	{
+		String *s = (String *)lister_next(lister);
+
+		if (i && !str_append_str(ret, del))
+		{
+			str_release(ret);
+			str_release(del);
+			lister_release_unlocked(lister);
+			return NULL;
+		}
+
+		if (s && !str_append_str(ret, s))
+		{
+			str_release(ret);
+			str_release(del);
+			lister_release_unlocked(lister);
+			return NULL;
+		}
+	}
+
+	str_release(del);
+	lister_release_unlocked(lister);
+
+	return ret;
+}
+
+/*
+
+=item C<String *join(const List *list, const char *delim)>
+
+Equivalent to I<str_join(3)> but works on a list of ordinary I<C> strings.
+
+=cut
+
+*/
+
+String *join(const List *list, const char *delim)
+{
+	return join_with_locker(NULL, list, delim);
+}
+
+/*
+
+=item C<String *join_with_locker(Locker *locker, const List *list, const char *delim)>
+
+Equivalent to I<join(3)> except that multiple threads accessing the new
+string will be synchronised by C<locker>.
+
+=cut
+
+*/
+
+String *join_with_locker(Locker *locker, const List *list, const char *delim)
+{
+	String *ret;
+	String *del;
+	Lister *lister;
+	int i;
+
+	if (!list)
+		return set_errnull(EINVAL);
+
+	if (!(ret = str_create_with_locker(locker, NULL)))
+		return NULL;
+
+	if (!(del = str_create(delim ? "%s" : NULL, delim)))
+	{
+		str_release(ret);
+		return NULL;
+	}
+
+	if (!(lister = lister_create((List *)list)))
+	{
+		str_release(ret);
+		str_release(del);
+		return NULL;
+	}
+
+	for (i = 0; lister_has_next(lister) == 1; ++i)
+	{
+		char *s = (char *)lister_next(lister);
+
+		if (i && !str_append_str(ret, del))
+		{
+			str_release(ret);
+			str_release(del);
+			lister_release(lister);
+			return NULL;
+		}
+
+		if (s && !str_append(ret, "%s", s))
+		{
+			str_release(ret);
+			str_release(del);
+			lister_release(lister);
+			return NULL;
+		}
+	}
+
+	str_release(del);
+	lister_release(lister);
+
+	return ret;
+}
+
+/*
+
+=item C<int str_soundex(const String *str)>
+
+Returns the soundex code of C<str> as an integer. On error, returns C<-1>
+with C<errno> set appropriately.
+
+=cut
+
+*/
+
+int str_soundex(const String *str)
+{
+	int ret;
+	int err;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if ((err = str_rdlock(str)))
+		return set_errno(err);
+
+	ret = str_soundex_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errno(err);
+
+	return ret;
+}
+
+/*
+
+=item C<int str_soundex_unlocked(const String *str)>
+
+Equivalent to I<str_soundex(3)> except that C<str> is not read-locked.
+
+=cut
+
+*/
+
+int str_soundex_unlocked(const String *str)
+{
+	if (!str)
+		return set_errno(EINVAL);
+
+	return soundex(str->str);
+}
+
+/*
+
+=item C<int soundex(const char *str)>
+
+Equivalent to I<str_soundex(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+int soundex(const char *str)
+{
+	const char * const soundex_table = "\000123\00012\000\00022455\00012623\0001\0002\0002";
+	union { char c[4]; int i; } soundex;
+	int last, small;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	soundex.i = 0;
+
+	for (last = -1, small = 0; *str && small < 4; ++str)
+	{
+		if (is_alpha(*str))
+		{
+			int code = to_upper(*str);
+
+			if (small == 0)
+			{
+				soundex.c[small++] = code;
+				last = soundex_table[code - 'A'];
+			}
+			else
+			{
+				if ((code = soundex_table[code - 'A']) != last)
+				{
+					if (code != 0)
+						soundex.c[small++] = code;
+
+					last = code;
+				}
+			}
+		}
+	}
+
+	while (small < 4)
+		soundex.c[small++] = '0';
+
+	return ntohl(soundex.i);
+}
+
+/*
+
+=item C<String *str_trim(String *str)>
+
+Trims leading and trailing whitespace from C<str>. On success, returns
+C<str>. On error, returns C<null> with C<errno> set appropriately.
+
+=cut
+
+*/
+
+String *str_trim(String *str)
+{
+	String *ret;
+	int err;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
+
+	ret = str_trim_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
+
+	return ret;
+}
+
+/*
+
+=item C<String *str_trim_unlocked(String *str)>
+
+Equivalent to I<str_trim(3)> except that C<str> is not write-locked.
+
+=cut
+
+*/
+
+String *str_trim_unlocked(String *str)
+{
+	char *s;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	for (s = str->str; is_space(*s); ++s)
+	{}
+
+	if (s > str->str)
+	{
+		if (!str_remove_range_unlocked(str, 0, s - str->str))
+			return NULL;
+	}
+
+	for (s = str->str + str->length - 1; s > str->str && is_space(s[-1]); --s)
+	{}
+
+	if (is_space(*s))
+	{
+		if (!str_remove_range_unlocked(str, s - str->str, str->length - 1 - (s - str->str)))
+			return NULL;
+	}
+
+	return str;
+}
+
+/*
+
+=item C<char *trim(char *str)>
+
+Equivalent to I<str_trim(3)> but works on an ordinary I<C> string.
+
+=cut
+
+*/
+
+char *trim(char *str)
 {
-	const char *f, *t;
-	char *xf, *xt;
-	char xfrom[CHARSET], xto[CHARSET];
-	short tbl[CHARSET];
-	int i, j, k;
-	int err;
+	char *s;
+	size_t len;
 
-	if (!table || !from)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	for (i = 0; i < CHARSET; ++i)
-		tbl[i] = TRCODE_NOMAP;
+	for (s = str; is_space(*s); ++s)
+	{}
 
-	/* Parse the from string */
+	len = strlen(s);
 
-	for (xf = xfrom, f = from; ((fromlen == -1) ? *f : (f - from < fromlen)) && xf - xfrom < CHARSET; ++f)
-	{
-		i = j = *f;
+	if (s > str)
+		memmove(str, s, len + 1);
 
-		if (f[1] == '-' && f[2])
-			j = f[2], f += 2;
+	for (s = str + len; s > str && is_space(*--s); )
+		*s = '\0';
 
-		if ((unsigned char)j < (unsigned char)i)
-			return set_errnull(EINVAL);
+	return str;
+}
 
-		for (k = (unsigned char)i; k <= (unsigned char)j; ++k)
-			*xf++ = tbl[k] = k;
-	}
+/*
 
-	if (xf - xfrom == CHARSET)
-		return set_errnull(EINVAL);
+=item C<String *str_trim_left(String *str)>
 
-	if (option & TR_COMPLEMENT)
-	{
-		char tmp[CHARSET];
+Trims leading whitespace from C<str>. On success, returns C<str>. On error,
+returns C<null> with C<errno> set appropriately.
 
-		for (xf = tmp, k = 0; k < CHARSET; ++k)
-			if (tbl[k] == TRCODE_NOMAP)
-				*xf++ = k;
+=cut
 
-		memcpy(xfrom, tmp, xf - tmp);
-		xf = xfrom + (xf - tmp);
-	}
+*/
 
-	/* Parse the to string */
+String *str_trim_left(String *str)
+{
+	String *ret;
+	int err;
 
-	if (!to || ((tolen == -1) ? *to == '\0' : tolen == 0))
-		to = (option & TR_DELETE) ? "" : from;
+	if (!str)
+		return set_errnull(EINVAL);
 
-	for (xt = xto, t = to; ((tolen == -1) ? *t : (t - to < tolen)) && xt - xto < CHARSET; ++t)
-	{
-		i = j = *t;
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
 
-		if (t[1] == '-' && t[2])
-			j = t[2], t += 2;
+	ret = str_trim_left_unlocked(str);
 
-		if ((unsigned char)j < (unsigned char)i)
-			return set_errnull(EINVAL);
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
 
-		for (k = (unsigned char)i; k <= (unsigned char)j; ++k)
-			*xt++ = k;
-	}
+	return ret;
+}
 
-	if (xt - xto == CHARSET)
-		return set_errnull(EINVAL);
+/*
 
-	if (!(option & TR_DELETE))
-	{
-		size_t flen = xf - xfrom;
-		size_t tlen = xt - xto;
+=item C<String *str_trim_left_unlocked(String *str)>
 
-		if (tlen < flen)
-		{
-			memset(xt, xt[-1], flen - tlen);
-			xt += flen - tlen;
-		}
-	}
+Equivalent to I<str_trim_left(3)> except that C<str> is not write-locked.
 
-	/* Build the translation table */
+=cut
 
-	if ((err = locker_wrlock(table->locker)))
-		return set_errnull(err);
+*/
 
-	table->squash = option & TR_SQUASH;
-	for (i = 0; i < CHARSET; ++i)
-		table->table[i] = TRCODE_NOMAP;
+String *str_trim_left_unlocked(String *str)
+{
+	char *s;
 
-	for (i = j = 0; xfrom + i < xf; ++i, ++j)
-	{
-		unsigned char fc = xfrom[i];
-		unsigned char tc = xto[j];
-		if (table->table[fc] == TRCODE_NOMAP)
-			table->table[fc] = (xto + j < xt) ? tc : TRCODE_DELETE;
-	}
+	if (!str)
+		return set_errnull(EINVAL);
 
-	if ((err = locker_unlock(table->locker)))
-		return set_errnull(err);
+	for (s = str->str; is_space(*s); ++s)
+	{}
 
-	return table;
+	if (s > str->str)
+		if (!str_remove_range_unlocked(str, 0, s - str->str))
+			return NULL;
+
+	return str;
 }
 
 /*
 
-C<StringTR *tr_compile_table(StringTR *table, const char *from, const char *to, int option)>
+=item C<char *trim_left(char *str)>
 
-Equivalent to I<tr_compile(3)> except that C<from>, C<to> and C<option> are
-compiled into the translation table pointed to by C<table>. On success,
-returns C<table>. On error, returns C<null> with C<errno> set appropriately.
+Equivalent to I<str_trim_left(3)> but works on an ordinary I<C> string.
+
+=cut
 
 */
 
-static StringTR *tr_compile_table(StringTR *table, const char *from, const char *to, int option)
+char *trim_left(char *str)
 {
-	return do_tr_compile_table(table, from, -1, to, -1, option);
+	char *s;
+	size_t len;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	for (s = str; is_space(*s); ++s)
+	{}
+
+	len = strlen(s);
+
+	if (s > str)
+		memmove(str, s, len + 1);
+
+	return str;
 }
 
 /*
 
-C<StringTR *str_tr_compile_table(StringTR *table, const String *from, const String *to, int option)>
+=item C<String *str_trim_right(String *str)>
 
-Equivalent to I<tr_compile_table(3)> except that C<from> and C<to> are
-I<String> objects. This is needed when C<from> or C<to> need to contain
-C<nul> characters.
+Trims trailing whitespace from C<str>. On success, returns C<str>. On error,
+returns C<null> with C<errno> set appropriately.
+
+=cut
 
 */
 
-static StringTR *str_tr_compile_table(StringTR *table, const String *from, const String *to, int option)
+String *str_trim_right(String *str)
 {
-	StringTR *ret;
+	String *ret;
 	int err;
 
-	if ((err = str_rdlock(from)))
-		return set_errnull(err);
+	if (!str)
+		return set_errnull(EINVAL);
 
-	if ((err = str_rdlock(to)))
-	{
-		str_unlock(from);
+	if ((err = str_wrlock(str)))
 		return set_errnull(err);
-	}
 
-	ret = str_tr_compile_table_unlocked(table, from, to, option);
-
-	if ((err = str_unlock(from)))
-	{
-		str_unlock(to);
-		return set_errnull(err);
-	}
+	ret = str_trim_right_unlocked(str);
 
-	if ((err = str_unlock(to)))
+	if ((err = str_unlock(str)))
 		return set_errnull(err);
 
 	return ret;
@@ -2847,423 +8430,416 @@ static StringTR *str_tr_compile_table(StringTR *table, const String *from, const
 
 /*
 
-C<StringTR *str_tr_compile_table_unlocked(StringTR *table, const String *from, const String *to, int option)>
+=item C<String *str_trim_right_unlocked(String *str)>
 
-Equivalent to I<str_tr_compile_table(3)> except that C<from> and C<to> are
-not read-locked.
+Equivalent to I<str_trim_right(3)> except that C<str> is not write-locked.
+
+=cut
 
 */
 
-static StringTR *str_tr_compile_table_unlocked(StringTR *table, const String *from, const String *to, int option)
+String *str_trim_right_unlocked(String *str)
 {
-	return do_tr_compile_table(table, from->str, str_length_unlocked(from), to->str, str_length_unlocked(to), option);
-}
+	char *s;
 
-/*
+	if (!str)
+		return set_errnull(EINVAL);
 
-C<static int do_tr_compiled(unsigned char *str, size_t *length, StringTR *table)>
+	for (s = str->str + str->length - 1; s > str->str && is_space(s[-1]); --s)
+	{}
 
-Performs the character translation specified by C<table> (as created by
-I<tr_compile(3)> or equivalent) on C<str>. If C<length> is C<null>, C<str> is
-interpreted as a C<nul>-terminated I<C> string. Otherwise, C<str> is
-interpreted as an arbitrary string of length C<*length>. The integer that
-C<length> points to is decremented by the number of bytes deleted by the
-translation. On success, returns the number of characters replaced or
-deleted. On error, returns C<-1> with C<errno> set appropriately.
+	if (is_space(*s))
+		if (!str_remove_range_unlocked(str, s - str->str, str->length - 1 - (s - str->str)))
+			return NULL;
 
-*/
+	return str;
+}
 
-static int do_tr_compiled(unsigned char *str, size_t *length, StringTR *table)
-{
-	int ret = 0;
-	int deleted = 0;
-	unsigned char *r, *s;
-	short t;
-	int err;
+/*
 
-	if (!str || !table)
-		return set_errno(EINVAL);
+=item C<char *trim_right(char *str)>
 
-	if ((err = locker_rdlock(table->locker)))
-		return set_errno(err);
+Equivalent to I<str_trim_right(3)> but works on an ordinary I<C> string.
 
-	for (r = s = str; (length) ? s - str < *length - 1 : *s; ++s)
-	{
-		switch (t = table->table[(int)*s])
-		{
-			case TRCODE_DELETE:
-				++deleted;
-				++ret;
-				break;
+=cut
 
-			case TRCODE_NOMAP:
-				if (!table->squash || r == str || r[-1] != *s)
-					*r++ = *s;
-				else
-					++deleted;
-				break;
+*/
 
-			default:
-				if (!table->squash || r == str || r[-1] != t)
-					*r++ = t;
-				else
-					++deleted;
-				++ret;
-				break;
-		}
-	}
+char *trim_right(char *str)
+{
+	char *s;
+	size_t len;
 
-	if ((err = locker_unlock(table->locker)))
-		return set_errno(err);
+	if (!str)
+		return set_errnull(EINVAL);
 
-	*r = '\0';
-	if (length && deleted)
-		*length -= deleted;
+	len = strlen(str);
 
-	return ret;
+	for (s = str + len; s > str && is_space(*--s); )
+		*s = '\0';
+
+	return str;
 }
 
 /*
 
-=item C<int str_tr_compiled(String *str, StringTR *table)>
+=item C<String *str_trim_utf8(String *str)>
 
-Performs the character translation specified by C<table> (as created by
-I<tr_compile(3)> or equivalent) on C<str>. Use this whenever the same
-translation will be performed multiple times. On success, returns the number
-of characters replaced or deleted. On error, returns C<-1> with C<errno> set
-appropriately.
+Equivalent to I<str_trim(3)> except that C<str> is treated as UTF-8, and
+the Unicode whitespace characters (e.g. C<U+00A0>, C<U+2028> and
+C<U+3000>) are trimmed as well as I<ASCII> whitespace.
 
 =cut
 
 */
 
-int str_tr_compiled(String *str, StringTR *table)
+String *str_trim_utf8(String *str)
 {
-	int ret;
+	String *ret;
 	int err;
 
-	if (!str || !table)
-		return set_errno(EINVAL);
-
-	if ((err = locker_rdlock(table->locker)))
-		return set_errno(err);
+	if (!str)
+		return set_errnull(EINVAL);
 
 	if ((err = str_wrlock(str)))
-	{
-		locker_unlock(table->locker);
-		return set_errno(err);
-	}
+		return set_errnull(err);
 
-	ret = str_tr_compiled_unlocked(str, table);
+	ret = str_trim_utf8_unlocked(str);
 
 	if ((err = str_unlock(str)))
-	{
-		locker_unlock(table->locker);
-		return set_errno(err);
-	}
-
-	if ((err = locker_unlock(table->locker)))
-		return set_errno(err);
+		return set_errnull(err);
 
 	return ret;
 }
 
 /*
 
-=item C<int str_tr_compiled_unlocked(String *str, StringTR *table)>
+=item C<String *str_trim_utf8_unlocked(String *str)>
 
-Equivalent to I<str_tr_compiled(3)> except that C<str> is not write-locked.
+Equivalent to I<str_trim_utf8(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-int str_tr_compiled_unlocked(String *str, StringTR *table)
+String *str_trim_utf8_unlocked(String *str)
 {
-	if (!str || !table)
-		return set_errno(EINVAL);
+	size_t start, end, n;
 
-	return do_tr_compiled((unsigned char *)str->str, &str->length, table);
+	if (!str)
+		return set_errnull(EINVAL);
+
+	for (end = str->length - 1; end && (n = utf8_space_before(str->str, end)); end -= n)
+	{}
+
+	for (start = 0; start < end && (n = utf8_space(str->str + start, 0)); start += n)
+	{}
+
+	if (end < str->length - 1 && !str_remove_range_unlocked(str, end, str->length - 1 - end))
+		return NULL;
+
+	if (start && !str_remove_range_unlocked(str, 0, start))
+		return NULL;
+
+	return str;
 }
 
 /*
 
-=item C<int tr_compiled(char *str, StringTR *table)>
+=item C<char *trim_utf8(char *str)>
 
-Equivalent to I<str_tr_compiled(3)> but works on an ordinary I<C> string.
+Equivalent to I<str_trim_utf8(3)> but works on an ordinary I<C> string.
 
 =cut
 
 */
 
-int tr_compiled(char *str, StringTR *table)
+char *trim_utf8(char *str)
 {
-	int ret;
-	int err;
+	size_t start, end, n;
 
-	if (!str || !table)
-		return set_errno(EINVAL);
+	if (!str)
+		return set_errnull(EINVAL);
 
-	if ((err = locker_rdlock(table->locker)))
-		return set_errno(err);
+	for (end = strlen(str); end && (n = utf8_space_before(str, end)); end -= n)
+	{}
 
-	ret = do_tr_compiled((unsigned char *)str, NULL, table);
+	for (start = 0; start < end && (n = utf8_space(str + start, 0)); start += n)
+	{}
 
-	if ((err = locker_unlock(table->locker)))
-		return set_errno(err);
+	if (start)
+		memmove(str, str + start, end - start);
 
-	return ret;
-}
+	str[end - start] = '\0';
 
-#ifdef HAVE_REGEX_H
+	return str;
+}
 
 /*
 
-=item C<List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags)>
-
-I<str_regexpr(3)> is an interface to I<POSIX 1003.2>-compliant regular
-expression matching. C<pattern> is a regular expression. C<text> is the
-string to be searched for matches. C<cflags> is passed to I<regcomp(3)>
-along with C<REG_EXTENDED>. C<eflags> is passed to I<regexec(3)>. On
-success, returns a I<List> of (at most 33) I<String>s containing the
-matching substring followed by the matching substrings of any parenthesised
-subexpressions. It is the caller's responsibility to deallocate the list
-with I<list_release(3)> or I<list_destroy(3)>. On error (including no
-match), returns C<null> with C<errno> set appropriately. Only use this
-function when the regular expression will be used only once. Otherwise, use
-I<regexpr_compile(3)> or I<regcomp(3)> and I<str_regexpr_compiled(3)> or
-I<regexpr_compiled(3)> or I<regexec(3)>.
+=item C<String *str_squeeze(String *str)>
 
-Note: If you require perl pattern matching, you could use Philip Hazel's
-I<PCRE> package, C<ftp://ftp.cus.cam.ac.uk/pub/software/programs/pcre/> or
-link against the perl library itself.
+Trims leading and trailing whitespace from C<str> and replaces all other
+sequences of whitespace with a single space. On success, returns C<str>. On
+error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags)
+String *str_squeeze(String *str)
 {
-	return str_regexpr_with_locker(NULL, pattern, text, cflags, eflags);
-}
-
-/*
+	String *ret;
+	int err;
 
-=item C<List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags)>
+	if (!str)
+		return set_errnull(EINVAL);
 
-Equivalent to I<str_regexpr(3)> except that C<text> is not read-locked.
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
 
-=cut
+	ret = str_squeeze_unlocked(str);
 
-*/
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
 
-List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags)
-{
-	return str_regexpr_with_locker_unlocked(NULL, pattern, text, cflags, eflags);
+	return ret;
 }
 
 /*
 
-=item C<List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)>
+=item C<String *str_squeeze_unlocked(String *str)>
 
-Equivalent to I<str_regexpr(3)> except that multiple threads accessing the
-new list will be synchronised by C<locker>.
+Equivalent to I<str_squeeze(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)
+String *str_squeeze_unlocked(String *str)
 {
-	List *ret;
-	int err;
+	char *s, *r;
+	int started = 0;
+	int was_space = 0;
 
-	if (!pattern || !text)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if ((err = str_rdlock(text)))
-		return set_errnull(err);
-
-	ret = str_regexpr_with_locker_unlocked(locker, pattern, text, cflags, eflags);
+	if (unshare(str, str->size) == -1)
+		return NULL;
 
-	if ((err = str_unlock(text)))
+	for (r = s = str->str; s - str->str < str->length - 1; ++s)
 	{
-		list_release(ret);
-		return set_errnull(err);
+		if (!is_space(*s))
+		{
+			if (was_space && started)
+				*r++ = ' ';
+			*r++ = *s;
+			started = 1;
+		}
+
+		was_space = is_space(*s);
 	}
 
-	return ret;
+	if (r - str->str < str->length)
+		if (!str_remove_range_unlocked(str, r - str->str, str->length - 1 - (r - str->str)))
+			return NULL;
+
+	return str;
 }
 
 /*
 
-=item C<List *str_regexpr_with_locker_unlocked(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)>
+=item C<char *squeeze(char *str)>
 
-Equivalent to I<str_regexpr_with_locker(3)> except that C<text> is not
-read-locked.
+Equivalent to I<str_squeeze(3)> but works on an ordinary I<C> string.
 
 =cut
 
 */
 
-List *str_regexpr_with_locker_unlocked(Locker *locker, const char *pattern, const String *text, int cflags, int eflags)
+char *squeeze(char *str)
 {
-	if (!pattern || !text)
+	char *s, *r;
+	int started = 0;
+	int was_space = 0;
+
+	if (!str)
 		return set_errnull(EINVAL);
 
-	return regexpr_with_locker(locker, pattern, text->str, cflags, eflags);
+	for (r = s = str; *s; ++s)
+	{
+		if (!is_space(*s))
+		{
+			if (was_space && started)
+				*r++ = ' ';
+			*r++ = *s;
+			started = 1;
+		}
+
+		was_space = is_space(*s);
+	}
+
+	*r = '\0';
+
+	return str;
 }
 
 /*
 
-=item C<List *regexpr(const char *pattern, const char *text, int cflags, int eflags)>
+=item C<String *str_quote(const String *str, const char *quotable, char quote_char)>
 
-Equivalent to I<str_regexpr(3)> but works on an ordinary I<C> string.
+Creates a new I<String> containing C<str> with every occurrence of any
+character in C<quotable> preceded by C<quote_char>. On success, returns the
+new string. It is the caller's responsibility to deallocate the new string
+with I<str_release(3)> or I<str_destroy(3)>. On error, returns C<null> with
+C<errno> set appropriately.
 
 =cut
 
 */
 
-List *regexpr(const char *pattern, const char *text, int cflags, int eflags)
+String *str_quote(const String *str, const char *quotable, char quote_char)
 {
-	return regexpr_with_locker(NULL, pattern, text, cflags, eflags);
+	return str_quote_with_locker(NULL, str, quotable, quote_char);
 }
 
 /*
 
-=item C<List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags)>
+=item C<String *str_quote_unlocked(const String *str, const char *quotable, char quote_char)>
 
-Equivalent to I<regexpr(3)> except that multiple threads accessing the new
-list will be synchronised by C<locker>.
+Equivalent to I<str_quote(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-List *regexpr_with_locker(Locker *locker, const char *pattern, const char *text, int cflags, int eflags)
+String *str_quote_unlocked(const String *str, const char *quotable, char quote_char)
 {
-	regex_t compiled[1];
-	List *ret;
-	int err;
-
-	if (!pattern || !text)
-		return set_errnull(EINVAL);
-
-	if ((err = regexpr_compile(compiled, pattern, cflags)))
-		return set_errnull(err);
-
-	ret = regexpr_compiled_with_locker(locker, compiled, text, eflags);
-	regfree(compiled);
-
-	return ret;
+	return str_quote_with_locker_unlocked(NULL, str, quotable, quote_char);
 }
 
 /*
 
-=item C<int regexpr_compile(regex_t *compiled, const char *pattern, int cflags)>
+=item C<String *str_quote_with_locker(Locker *locker, const String *str, const char *quotable, char quote_char)>
 
-Compiles a I<POSIX 1003.2>-compliant regular expression. C<compiled> is the
-location in which to compile the expression. C<pattern> is the regular
-expression. C<cflags> is passed to I<regcomp(3)> along with C<REG_EXTENDED>.
-Call this, followed by I<re_compiled(3)> when the regular expression will be
-used multiple times. On success, returns C<0>. On error, returns an error
-code.
+Equivalent to I<str_quote(3)> except that multiple threads accessing the new
+string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-int regexpr_compile(regex_t *compiled, const char *pattern, int cflags)
+String *str_quote_with_locker(Locker *locker, const String *str, const char *quotable, char quote_char)
 {
-	if (!compiled || !pattern)
-		return REG_BADPAT;
+	String *ret;
+	size_t i;
+
+	if (!str || !quotable)
+		return set_errnull(EINVAL);
+
+	if (!(ret = str_copy_with_locker(locker, str)))
+		return NULL;
+
+	for (i = 0; i < ret->length - 1; ++i)
+	{
+		if (ret->str[i] && strchr(quotable, ret->str[i]))
+		{
+			if (!str_insert(ret, i++, "%c", quote_char))
+			{
+				str_release(ret);
+				return NULL;
+			}
+		}
+	}
 
-	return regcomp(compiled, pattern, cflags | REG_EXTENDED);
+	return ret;
 }
 
 /*
 
-=item C<void regexpr_release(regex_t *compiled)>
+=item C<String *str_quote_with_locker_unlocked(Locker *locker, const String *str, const char *quotable, char quote_char)>
 
-Just another name for I<regfree(3)>.
+Equivalent to I<str_quote_with_locker(3)> except that C<str> is not
+read-locked.
 
 =cut
 
 */
 
-void regexpr_release(regex_t *compiled)
+String *str_quote_with_locker_unlocked(Locker *locker, const String *str, const char *quotable, char quote_char)
 {
-	if (compiled)
-		regfree(compiled);
-}
-
-/*
-
-=item C<List *str_regexpr_compiled(const regex_t *compiled, const String *text, int eflags)>
+	String *ret;
+	size_t i;
 
-I<regexpr_compiled(3)> is an interface to the I<POSIX 1003.2> regular
-expression function, I<regexec(3)>. C<compiled> is the compiled regular
-expression prepared by I<regexpr_compile(3)> or I<regcomp(3)>. C<text> is
-the string to be searched for a match. C<eflags> is passed to I<regexec(3)>.
-On success, returns a I<List> of (at most 33) I<String>s containing the
-matching substring followed by the matching substrings of any parenthesised
-subexpressions. It is the caller's responsibility to deallocate the list
-with I<list_release(3)> or I<list_destroy(3)>. On error (including no
-match), returns C<null> with C<errno> set appropriately.
+	if (!str || !quotable)
+		return set_errnull(EINVAL);
 
-=cut
+	if (!(ret = str_copy_with_locker_unlocked(locker, str)))
+		return NULL;
 
-*/
+	for (i = 0; i < ret->length - 1; ++i)
+	{
+		if (ret->str[i] && strchr(quotable, ret->str[i]))
+		{
+			if (!str_insert(ret, i++, "%c", quote_char))
+			{
+				str_release(ret);
+				return NULL;
+			}
+		}
+	}
 
-List *str_regexpr_compiled(const regex_t *compiled, const String *text, int eflags)
-{
-	return str_regexpr_compiled_with_locker(NULL, compiled, text, eflags);
+	return ret;
 }
 
 /*
 
-=item C<List *str_regexpr_compiled_unlocked(const regex_t *compiled, const String *text, int eflags)>
+=item C<String *quote(const char *str, const char *quotable, char quote_char)>
 
-Equivalent to I<str_regexpr_compiled(3)> except that C<text> is not
-write-locked.
+Equivalent to I<str_quote(3)> but works on an ordinary I<C> string.
 
 =cut
 
 */
 
-List *str_regexpr_compiled_unlocked(const regex_t *compiled, const String *text, int eflags)
+String *quote(const char *str, const char *quotable, char quote_char)
 {
-	return str_regexpr_compiled_with_locker_unlocked(NULL, compiled, text, eflags);
+	return quote_with_locker(NULL, str, quotable, quote_char);
 }
 
 /*
 
-=item C<List *str_regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const String *text, int eflags)>
+=item C<String *quote_with_locker(Locker *locker, const char *str, const char *quotable, char quote_char)>
 
-Equivalent to I<str_regexpr_compiled(3)> except that multiple threads
-accessing the new list will be synchronised by C<locker>.
+Equivalent to I<quote(3)> except that multiple threads accessing the new
+string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-List *str_regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const String *text, int eflags)
+String *quote_with_locker(Locker *locker, const char *str, const char *quotable, char quote_char)
 {
-	List *ret;
-	int err;
+	String *ret;
+	size_t i;
 
-	if (!compiled || !text)
+	if (!str || !quotable)
 		return set_errnull(EINVAL);
 
-	if ((err = str_rdlock(text)))
-		return set_errnull(err);
-
-	ret = str_regexpr_compiled_with_locker_unlocked(locker, compiled, text, eflags);
+	if (!(ret = str_create_with_locker(locker, "%s", str)))
+		return NULL;
 
-	if ((err = str_unlock(text)))
+	for (i = 0; i < ret->length - 1; ++i)
 	{
-		list_release(ret);
-		return set_errnull(err);
+		if (strchr(quotable, ret->str[i]))
+		{
+			if (!str_insert(ret, i++, "%c", quote_char))
+			{
+				str_release(ret);
+				return NULL;
+			}
+		}
 	}
 
 	return ret;
@@ -3271,80 +8847,69 @@ List *str_regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled,
 
 /*
 
-=item C<List *str_regexpr_compiled_with_locker_unlocked(Locker *locker, const regex_t *compiled, const String *text, int eflags)>
+=item C<String *str_unquote(const String *str, const char *quotable, char quote_char)>
 
-Equivalent to I<str_regexpr_compiled_with_locker(3)> except that C<text> is
-not read-locked.
+Creates a new string containing C<str> with every occurrence of
+C<quote_char> that is followed by any character in C<quotable> removed. On
+success, returns the new I<String>. It is the caller's responsibility to
+deallocate the new string with I<str_release(3)> or I<str_destroy(3)>. On
+error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-List *str_regexpr_compiled_with_locker_unlocked(Locker *locker, const regex_t *compiled, const String *text, int eflags)
+String *str_unquote(const String *str, const char *quotable, char quote_char)
 {
-	if (!compiled || !text)
-		return set_errnull(EINVAL);
-
-	return regexpr_compiled_with_locker(locker, compiled, text->str, eflags);
+	return str_unquote_with_locker(NULL, str, quotable, quote_char);
 }
 
 /*
 
-=item C<List *regexpr_compiled(const regex_t *compiled, const char *text, int eflags)>
+=item C<String *str_unquote_unlocked(const String *str, const char *quotable, char quote_char)>
 
-Equivalent to I<str_regexpr_compiled(3)> but works on an ordinary I<C> string.
+Equivalent to I<str_unquote(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-List *regexpr_compiled(const regex_t *compiled, const char *text, int eflags)
+String *str_unquote_unlocked(const String *str, const char *quotable, char quote_char)
 {
-	return regexpr_compiled_with_locker(NULL, compiled, text, eflags);
+	return str_unquote_with_locker_unlocked(NULL, str, quotable, quote_char);
 }
 
 /*
 
-=item C<List *regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const char *text, int eflags)>
+=item C<String *str_unquote_with_locker(Locker *locker, const String *str, const char *quotable, char quote_char)>
 
-Equivalent to I<regexpr_compiled(3)> except that multiple threads accessing
-the new list will be synchronised by C<locker>.
+Equivalent to I<str_unquote(3)> except that multiple threads accessing the
+new string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-List *regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, const char *text, int eflags)
+String *str_unquote_with_locker(Locker *locker, const String *str, const char *quotable, char quote_char)
 {
-	regmatch_t match[33];
-	List *ret;
+	String *ret;
 	int i;
-	int err;
 
-	if (!compiled || !text)
+	if (!str || !quotable)
 		return set_errnull(EINVAL);
 
-	if ((err = regexec(compiled, text, 33, match, eflags)))
-		return set_errnull(err);
-
-	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
+	if (!(ret = str_copy_with_locker(locker, str)))
 		return NULL;
 
-	for (i = 0; i < 33 && match[i].rm_so != -1; ++i)
+	for (i = 0; i < (int)ret->length - 2; ++i)
 	{
-		String *m = substr(text, (ssize_t)match[i].rm_so, (ssize_t)(match[i].rm_eo - match[i].rm_so));
-
-		if (!m)
-		{
-			list_release(ret);
-			return NULL;
-		}
-
-		if (!list_append(ret, m))
+		if (ret->str[i] == quote_char && ret->str[i + 1] && strchr(quotable, ret->str[i + 1]))
 		{
-			str_release(m);
-			list_release(ret);
-			return NULL;
+			if (!str_remove(ret, i))
+			{
+				str_release(ret);
+				return NULL;
+			}
 		}
 	}
 
@@ -3353,737 +8918,688 @@ List *regexpr_compiled_with_locker(Locker *locker, const regex_t *compiled, cons
 
 /*
 
-=item C<String *str_regsub(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)>
-
-I<str_regsub(3)> is an interface to I<POSIX 1003.2>-compliant regular
-expression matching and substitution. C<pattern> is a regular expression.
-C<text> is the string to be searched for matches. C<cflags> is passed to
-I<regcomp(3)> along with C<REG_EXTENDED>. C<eflags> is passed to
-I<regexec(3)>. C<all> specifies whether to substitute the first match (if
-zero) or all matches (if non-zero). C<replacement> specifies the string that
-replaces each match. If C<replacement> contains C<"$#"> or C<"${##}"> (where
-C<"#"> is a decimal digit), the substring that matches the corresponding
-subexpression is interpolated in its place. Up to 32 subexpressions are
-supported. If C<replacement> contains C<"$$">, then C<"$"> is interpolated
-in its place. The following I<perl(1)> quote escape sequences are also
-understood:
-
-    \l  lowercase next character
-    \u  uppercase next character
-    \L  lowercase until matching \E
-    \U  uppercase until matching \E
-    \Q  backslash non-alphanumeric characters until matching \E
-    \E  end case/quotemeta modification
-
-Note that these sequences don't behave exactly like in I<perl(1)>. Namely,
-an C<\l> appearing between a C<\U> and an C<\E> does lowercase the next
-character and a C<\E> sequence without a matching C<\L>, C<\U> or C<\Q> is
-an error. Also note that only 32 levels of nesting are supported.
+=item C<String *str_unquote_with_locker_unlocked(Locker *locker, const String *str, const char *quotable, char quote_char)>
 
-On success, returns C<text>. On error (including no match), returns C<null>
-with C<errno> set appropriately. Only use this function when the regular
-expression will be used only once. Otherwise, use I<regexpr_compile(3)> or
-I<regcomp(3)> and I<str_regsub_compiled(3)>.
+Equivalent to I<str_unquote_with_locker(3)> except that C<str> is not
+read-locked.
 
 =cut
 
 */
 
-String *str_regsub(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)
+String *str_unquote_with_locker_unlocked(Locker *locker, const String *str, const char *quotable, char quote_char)
 {
-	regex_t compiled[1];
 	String *ret;
-	int err;
+	int i;
 
-	if (!pattern || !replacement || !text)
+	if (!str || !quotable)
 		return set_errnull(EINVAL);
 
-	if ((err = regexpr_compile(compiled, pattern, cflags)))
-		return set_errnull(err);
+	if (!(ret = str_copy_with_locker_unlocked(locker, str)))
+		return NULL;
 
-	ret = str_regsub_compiled(compiled, replacement, text, eflags, all);
-	regfree(compiled);
+	for (i = 0; i < (int)ret->length - 2; ++i)
+	{
+		if (ret->str[i] == quote_char && ret->str[i + 1] && strchr(quotable, ret->str[i + 1]))
+		{
+			if (!str_remove(ret, i))
+			{
+				str_release(ret);
+				return NULL;
+			}
+		}
+	}
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_regsub_unlocked(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)>
+=item C<String *unquote(const char *str, const char *quotable, char quote_char)>
 
-Equivalent to I<str_regsub(3)> except that C<text> is not write-locked.
+Equivalent to I<str_unquote(3)> but works on an ordinary I<C> string.
 
 =cut
 
 */
 
-String *str_regsub_unlocked(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all)
+String *unquote(const char *str, const char *quotable, char quote_char)
 {
-	regex_t compiled[1];
-	String *ret;
-	int err;
-
-	if (!pattern || !replacement || !text)
-		return set_errnull(EINVAL);
-
-	if ((err = regexpr_compile(compiled, pattern, cflags)))
-		return set_errnull(err);
-
-	ret = str_regsub_compiled_unlocked(compiled, replacement, text, eflags, all);
-	regfree(compiled);
-
-	return ret;
+	return unquote_with_locker(NULL, str, quotable, quote_char);
 }
 
 /*
 
-=item C<String *str_regsub_compiled(const regex_t *compiled, const char *replacement, String *text, int eflags, int all)>
+=item C<String *unquote_with_locker(Locker *locker, const char *str, const char *quotable, char quote_char)>
 
-Equivalent to I<str_regsub(3)> but works on an already compiled I<regex_t>,
-C<compiled>.
+Equivalent to I<unquote(3)> except that multiple threads accessing the new
+string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-String *str_regsub_compiled(const regex_t *compiled, const char *replacement, String *text, int eflags, int all)
+String *unquote_with_locker(Locker *locker, const char *str, const char *quotable, char quote_char)
 {
 	String *ret;
-	int err;
+	int i;
 
-	if (!compiled || !replacement || !text)
+	if (!str || !quotable)
 		return set_errnull(EINVAL);
 
-	if ((err = str_wrlock(text)))
-		return set_errnull(err);
+	if (!(ret = str_create_with_locker(locker, "%s", str)))
+		return NULL;
+
+	for (i = 0; i < (int)ret->length - 2; ++i)
+	{
+		if (ret->str[i] == quote_char && strchr(quotable, ret->str[i + 1]))
+		{
+			if (!str_remove(ret, i))
+			{
+				str_release(ret);
+				return NULL;
+			}
+		}
+	}
 
-	ret = str_regsub_compiled_unlocked(compiled, replacement, text, eflags, all);
+	return ret;
+}
 
-	if ((err = str_unlock(text)))
-		return set_errnull(err);
+static const char hex_digits[] = "0123456789abcdef";
 
-	return ret;
+static const char base64_digits[2][65] =
+{
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+};
+
+typedef enum
+{
+	CODEC_SCALAR = 0,
+	CODEC_SSE2 = 1,
+	CODEC_SSSE3 = 2
 }
+CodecLevel;
 
-/*
+static pthread_once_t codec_once = PTHREAD_ONCE_INIT;
+static CodecLevel codec_level = CODEC_SCALAR;
+static signed char hex_value[CHARSET];
+static signed char base64_value[2][CHARSET];
 
-=item C<String *str_regsub_compiled_unlocked(const regex_t *compiled, const char *replacement, String *text, int eflags, int all)>
+/*
 
-Equivalent to I<str_regsub_compiled(3)> except that C<text> is not
-write-locked.
+C<static void codec_init(void)>
 
-=cut
+Builds the decoding tables and chooses the SIMD kernels that this CPU
+supports. Called once via I<pthread_once(3)>.
 
 */
 
-String *str_regsub_compiled_unlocked(const regex_t *compiled, const char *replacement, String *text, int eflags, int all)
+static void codec_init(void)
 {
-#define MAX_MATCHES 33
-#define MAX_STATES 33
-	enum
-	{
-		RS_LC = 1,
-		RS_UC = 2,
-		RS_QM = 4,
-		RS_FIRST = 8,
-		RS_LCFIRST = RS_LC | RS_FIRST,
-		RS_UCFIRST = RS_UC | RS_FIRST
-	};
+	int c, url;
 
-	regmatch_t match[MAX_MATCHES];
-	String *rep;
-	int matches;
-	size_t start;
-	int states[MAX_STATES];
-	int i, s;
-
-	if (!compiled || !replacement || !text)
-		return set_errnull(EINVAL);
+	memset(hex_value, -1, sizeof hex_value);
+	memset(base64_value, -1, sizeof base64_value);
 
-	for (start = 0, matches = 0; start <= text->length - 1; ++matches)
+	for (c = 0; c < 16; ++c)
 	{
-		if (regexec(compiled, text->str + start, MAX_MATCHES, match, eflags))
-			return (matches) ? text : NULL;
-
-		/*
-		** Interpolate any $$, $# and ${##} in replacement
-		** with subexpression matching substrings
-		*/
-
-		if (!(rep = str_create("%s", replacement)))
-			return NULL;
-
-		for (i = 0; i < rep->length - 1; ++i)
-		{
-			if (rep->str[i] == '$')
-			{
-				if (rep->str[i + 1] == '$')
-				{
-					if (!str_remove(rep, i))
-					{
-						str_release(rep);
-						return NULL;
-					}
-				}
-				else
-				{
-					int ref;
-					int j = i + 1;
+		hex_value[(unsigned char)hex_digits[c]] = c;
+		hex_value[(unsigned char)to_upper(hex_digits[c])] = c;
+	}
 
-					if (rep->str[j] == '{')
-					{
-						for (++j, ref = 0; is_digit(rep->str[j]); ++j)
-							ref *= 10, ref += rep->str[j] - '0';
+	for (url = 0; url < 2; ++url)
+		for (c = 0; c < 64; ++c)
+			base64_value[url][(unsigned char)base64_digits[url][c]] = c;
 
-						if (rep->str[j] != '}')
-						{
-							str_release(rep);
-							return set_errnull(EINVAL);
-						}
-					}
-					else if (is_digit(rep->str[i + 1]))
-					{
-						ref = rep->str[j] - '0';
-					}
-					else
-					{
-						str_release(rep);
-						return set_errnull(EINVAL);
-					}
+#ifdef STR_SIMD
+	__builtin_cpu_init();
 
-					if (ref < 0 || ref >= MAX_MATCHES || match[ref].rm_so == -1)
-					{
-						str_release(rep);
-						return set_errnull(EINVAL);
-					}
+	if (__builtin_cpu_supports("ssse3"))
+		codec_level = CODEC_SSSE3;
+	else if (__builtin_cpu_supports("sse2"))
+		codec_level = CODEC_SSE2;
+#endif
+}
 
-					if (!str_replace(rep, i, j + 1 - i, "%.*s", (int)(match[ref].rm_eo - match[ref].rm_so), text->str + match[ref].rm_so))
-					{
-						str_release(rep);
-						return NULL;
-					}
+#ifdef STR_SIMD
 
-					i += match[ref].rm_eo - match[ref].rm_so - 1;
-				}
-			}
-		}
+/*
 
-		/* Perform \l \L \u \U \Q \E transformations on replacement */
+C<static size_t hex_encode_ssse3(char *dst, const unsigned char *src, size_t length)>
 
-#define FAIL { str_release(rep); return set_errnull(EINVAL); }
-#define PUSH_STATE(state) { if (s >= MAX_STATES - 1) FAIL states[s + 1] = states[s] | (state); ++s; }
-#define POP_STATE { if (s == 0) FAIL --s; }
-#define REMOVE_CODE { if (!str_remove_range(rep, i, 2)) FAIL --i; }
-#define NEG(t) states[s] &= ~(RS_##t##C);
+Hex encodes 16 bytes of C<src> at a time into C<dst> by looking up both
+nibbles of each byte with I<pshufb>. Returns the number of bytes encoded
+(the rest are left to the caller).
 
-		for (states[s = 0] = 0, i = 0; i < rep->length - 1; ++i)
-		{
-			if (rep->str[i] == '\\')
-			{
-				switch (rep->str[i + 1])
-				{
-					case 'l': { PUSH_STATE(RS_LCFIRST) NEG(U) REMOVE_CODE break; }
-					case 'L': { PUSH_STATE(RS_LC) NEG(U) REMOVE_CODE break; }
-					case 'u': { PUSH_STATE(RS_UCFIRST) NEG(L) REMOVE_CODE break; }
-					case 'U': { PUSH_STATE(RS_UC) NEG(L) REMOVE_CODE break; }
-					case 'Q': { PUSH_STATE(RS_QM) REMOVE_CODE break; }
-					case 'E': { POP_STATE REMOVE_CODE break; }
-					case '\\': { if (!str_remove(rep, i)) FAIL break; }
-				}
-			}
-			else
-			{
-				if (states[s] & RS_LC)
-					rep->str[i] = to_lower(rep->str[i]);
+*/
 
-				if (states[s] & RS_UC)
-					rep->str[i] = to_upper(rep->str[i]);
+SIMD_TARGET("ssse3")
+static size_t hex_encode_ssse3(char *dst, const unsigned char *src, size_t length)
+{
+	const __m128i digits = _mm_loadu_si128((const __m128i *)hex_digits);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	__m128i in, hi, lo;
+	size_t i;
 
-				if (states[s] & RS_QM && !is_alnum(rep->str[i]))
-					if (!str_insert(rep, i++, "\\"))
-						FAIL
+	for (i = 0; i + 16 <= length; i += 16)
+	{
+		in = _mm_loadu_si128((const __m128i *)(src + i));
+		hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+		lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, nibble));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+	}
 
-				if (states[s] & RS_FIRST)
-					POP_STATE
-			}
-		}
+	return i;
+}
 
-		/* Replace matching substring in text with rep */
+/*
 
-		if (!str_replace_str_unlocked(text, start + match[0].rm_so, (ssize_t)(match[0].rm_eo - match[0].rm_so), rep))
-		{
-			str_release(rep);
-			return NULL;
-		}
+C<static __m128i hex_nibbles_ssse3(__m128i in, __m128i *bad)>
 
-		/* Zero length match (at every position), move on or get stuck */
+Returns the values of the 16 hex digits in C<in>. Bytes that aren't hex
+digits are flagged in C<bad>.
 
-		if (match[0].rm_so == 0 && match[0].rm_eo == 0)
-		{
-			++match[0].rm_so;
-			++match[0].rm_eo;
-		}
+*/
 
-		start += match[0].rm_so + rep->length - 1;
-		str_release(rep);
+SIMD_TARGET("ssse3")
+static __m128i hex_nibbles_ssse3(__m128i in, __m128i *bad)
+{
+	__m128i digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+	__m128i letter = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	__m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
 
-		if (!all)
-			break;
-	}
+	*bad = _mm_or_si128(*bad, _mm_andnot_si128(_mm_or_si128(is_digit, is_letter), _mm_set1_epi8(-1)));
 
-	return text;
+	return _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
 }
 
-#endif
-
 /*
 
-=item C<List *str_fmt(const String *str, size_t line_width, StringAlignment alignment)>
+C<static size_t hex_decode_ssse3(unsigned char *dst, const char *src, size_t length)>
 
-Formats C<str> into a I<List> of I<String> objects with length no greater
-than C<line_width> (unless there are individual words longer than
-C<line_width>) with the alignment specified by C<alignment>:
+Decodes 32 hex digits of C<src> at a time into C<dst>, combining pairs of
+nibbles with I<pmaddubsw>. Stops before the first block containing
+anything else. Returns the number of digits decoded.
 
-=over 4
+*/
 
-=item C<ALIGN_LEFT> (C<'<'>)
+SIMD_TARGET("ssse3")
+static size_t hex_decode_ssse3(unsigned char *dst, const char *src, size_t length)
+{
+	const __m128i weights = _mm_set1_epi16(0x0110); /* high nibble * 16 + low nibble */
+	__m128i a, b, bad;
+	size_t i;
 
-The lines will be left justified (with one space between words).
+	for (i = 0; i + 32 <= length; i += 32)
+	{
+		bad = _mm_setzero_si128();
+		a = hex_nibbles_ssse3(_mm_loadu_si128((const __m128i *)(src + i)), &bad);
+		b = hex_nibbles_ssse3(_mm_loadu_si128((const __m128i *)(src + i + 16)), &bad);
 
-=item C<ALIGN_RIGHT> ('>')
+		if (_mm_movemask_epi8(bad))
+			break;
 
-The lines will be right justified (with one space between words).
+		a = _mm_maddubs_epi16(a, weights);
+		b = _mm_maddubs_epi16(b, weights);
+		_mm_storeu_si128((__m128i *)(dst + i / 2), _mm_packus_epi16(a, b));
+	}
 
-=item C<ALIGN_CENTRE> or C<ALIGN_CENTER> (C<'|'>)
+	return i;
+}
 
-C<str> will be split into lines at each newline character (C<'\n'>). The
-lines will then be centred (with one space between words) padded with spaces
-to the left.
+/*
 
-=item C<ALIGN_FULL> (C<'='>)
+C<static size_t base64_encode_ssse3(char *dst, const unsigned char *src, size_t length, int url)>
 
-The lines will be fully justified (possibly with multiple spaces between
-words).
+Base64 encodes 12 bytes of C<src> at a time into 16 characters in C<dst>.
+Each 3 bytes are spread over 4 bytes with I<pshufb>, the 6-bit fields are
+isolated with multiplies, and the alphabet is applied as an offset per
+range of values with I<pshufb>. Returns the number of bytes encoded.
 
-=back
+*/
 
-On success, returns a new I<List> of I<String> objects. It is the caller's
-responsibility to deallocate the list with I<list_release(3)> or
-I<list_destroy(3)>. On error, returns C<null> with C<errno> set
-appropriately. Note that C<str> is interpreted as a C<nul>-terminated
-string.
+SIMD_TARGET("ssse3")
+static size_t base64_encode_ssse3(char *dst, const unsigned char *src, size_t length, int url)
+{
+	const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, (url ? '-' : '+') - 62, (url ? '_' : '/') - 63, 'A', 0, 0);
+	__m128i in, index, range;
+	size_t i, o;
 
-B<Note:> I<str_fmt(3)> provides straightforward formatting completely
-lacking in any aesthetic sensibilities. If you need awesome paragraph
-formatting, pipe text through I<par(1)> instead (available from
-C<http://www.cs.berkeley.edu/~amc/Par/>).
+	for (i = o = 0; i + 16 <= length; i += 12, o += 16)
+	{
+		in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), spread);
+		index = _mm_or_si128(
+			_mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040)),
+			_mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010)));
 
-=cut
+		/* 0-25 -> 13, 26-51 -> 0, 52-61 -> 1-10, 62 -> 11, 63 -> 12 */
 
-*/
+		range = _mm_subs_epu8(index, _mm_set1_epi8(51));
+		range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), index), _mm_set1_epi8(13)));
+		_mm_storeu_si128((__m128i *)(dst + o), _mm_add_epi8(_mm_shuffle_epi8(offsets, range), index));
+	}
 
-List *str_fmt(const String *str, size_t line_width, StringAlignment alignment)
-{
-	return str_fmt_with_locker(NULL, str, line_width, alignment);
+	return i;
 }
 
 /*
 
-=item C<List *str_fmt_unlocked(const String *str, size_t line_width, StringAlignment alignment)>
-
-Equivalent to I<str_fmt(3)> except that C<str> is not read-locked.
+C<static __m128i base64_values_ssse3(__m128i in, int url, __m128i *bad)>
 
-=cut
+Returns the 6-bit values of the 16 base64 characters in C<in>. Bytes that
+aren't in the alphabet (including padding) are flagged in C<bad>.
 
 */
 
-List *str_fmt_unlocked(const String *str, size_t line_width, StringAlignment alignment)
+SIMD_TARGET("ssse3")
+static __m128i base64_values_ssse3(__m128i in, int url, __m128i *bad)
 {
-	return str_fmt_with_locker_unlocked(NULL, str, line_width, alignment);
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+	__m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+	__m128i c62 = _mm_cmpeq_epi8(in, _mm_set1_epi8(url ? '-' : '+'));
+	__m128i c63 = _mm_cmpeq_epi8(in, _mm_set1_epi8(url ? '_' : '/'));
+	__m128i delta;
+
+	delta = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')), _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+	delta = _mm_or_si128(delta, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+	delta = _mm_or_si128(delta, _mm_and_si128(c62, _mm_set1_epi8(62 - (url ? '-' : '+'))));
+	delta = _mm_or_si128(delta, _mm_and_si128(c63, _mm_set1_epi8(63 - (url ? '_' : '/'))));
+	*bad = _mm_or_si128(*bad, _mm_andnot_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(c62, c63))), _mm_set1_epi8(-1)));
+
+	return _mm_add_epi8(in, delta);
 }
 
 /*
 
-=item C<List *str_fmt_with_locker(Locker *locker, const String *str, size_t line_width, StringAlignment alignment)>
-
-Equivalent to I<str_fmt(3)> except that multiple threads accessing the new
-list will be synchronised by C<locker>.
+C<static size_t base64_decode_ssse3(unsigned char *dst, const char *src, size_t length, int url)>
 
-=cut
+Decodes 16 base64 characters of C<src> at a time into 12 bytes in C<dst>,
+packing the 6-bit values with I<pmaddubsw> and I<pmaddwd>. Each store
+writes 16 bytes, so it stops while at least 24 characters remain (enough
+for 16 more bytes of output). Also stops before the first block
+containing anything but the alphabet. Returns the number of characters
+decoded.
 
 */
 
-List *str_fmt_with_locker(Locker *locker, const String *str, size_t line_width, StringAlignment alignment)
+SIMD_TARGET("ssse3")
+static size_t base64_decode_ssse3(unsigned char *dst, const char *src, size_t length, int url)
 {
-	List *ret;
-	int err;
+	const __m128i gather = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	__m128i in, bad;
+	size_t i, o;
 
-	if (!str)
-		return set_errnull(EINVAL);
-
-	if ((err = str_rdlock(str)))
-		return set_errnull(err);
+	for (i = o = 0; i + 24 <= length; i += 16, o += 12)
+	{
+		bad = _mm_setzero_si128();
+		in = base64_values_ssse3(_mm_loadu_si128((const __m128i *)(src + i)), url, &bad);
 
-	ret = str_fmt_with_locker_unlocked(locker, str, line_width, alignment);
+		if (_mm_movemask_epi8(bad))
+			break;
 
-	if ((err = str_unlock(str)))
-	{
-		list_release(ret);
-		return set_errnull(err);
+		in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+		in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+		_mm_storeu_si128((__m128i *)(dst + o), _mm_shuffle_epi8(in, gather));
 	}
 
-	return ret;
+	return i;
 }
 
 /*
 
-=item C<List *str_fmt_with_locker_unlocked(Locker *locker, const String *str, size_t line_width, StringAlignment alignment)>
-
-Equivalent to I<str_fmt_with_locker(3)> except that C<str> is not
-read-locked.
+C<static size_t escape_skip_sse2(const unsigned char *src, size_t length, unsigned char lo, unsigned char hi, const unsigned char *extra, int extras)>
 
-=cut
+Returns the number of bytes at the start of C<src> that are between C<lo>
+and C<hi> (inclusive) and aren't any of the C<extras> bytes in C<extra>,
+checking 16 bytes at a time.
 
 */
 
-List *str_fmt_with_locker_unlocked(Locker *locker, const String *str, size_t line_width, StringAlignment alignment)
+SIMD_TARGET("sse2")
+static size_t escape_skip_sse2(const unsigned char *src, size_t length, unsigned char lo, unsigned char hi, const unsigned char *extra, int extras)
 {
-	if (!str)
-		return set_errnull(EINVAL);
+	const __m128i vlo = _mm_set1_epi8((char)lo);
+	const __m128i vhi = _mm_set1_epi8((char)hi);
+	__m128i in, ok;
+	size_t i;
+	int mask, e;
 
-	return fmt_with_locker(locker, str->str, line_width, alignment);
-}
+	for (i = 0; i + 16 <= length; i += 16)
+	{
+		in = _mm_loadu_si128((const __m128i *)(src + i));
+		ok = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(in, vlo), in), _mm_cmpeq_epi8(_mm_min_epu8(in, vhi), in));
 
-/*
+		for (e = 0; e < extras; ++e)
+			ok = _mm_andnot_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8((char)extra[e])), ok);
 
-=item C<List *fmt(const char *str, size_t line_width, StringAlignment alignment)>
+		if ((mask = _mm_movemask_epi8(ok)) != 0xffff)
+			return i + __builtin_ctz(~mask);
+	}
 
-Equivalent to I<str_fmt(3)> but works on an ordinary I<C> string.
+	return i;
+}
 
-=cut
+#endif
 
-*/
+typedef struct Escape Escape;
 
-List *fmt(const char *str, size_t line_width, StringAlignment alignment)
+struct Escape
 {
-	return fmt_with_locker(NULL, str, line_width, alignment);
-}
+	unsigned char width[CHARSET]; /* encoded length of each byte (1, 2 or 4) */
+	char code[CHARSET];           /* what follows quote_char for bytes in uncoded */
+	unsigned char lo;             /* lowest byte checked by the SIMD kernel */
+	unsigned char hi;             /* highest byte checked by the SIMD kernel */
+	unsigned char extra[4];       /* bytes between lo and hi that are encoded */
+	int extras;                   /* number of extra bytes (-1 to not use SIMD) */
+};
 
 /*
 
-=item C<List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment)>
-
-Equivalent to I<fmt(3)> except that multiple threads accessing the new list
-will be synchronised by C<locker>.
+C<static void escape_init(Escape *escape, const char *uncoded, const char *coded, int printable)>
 
-=cut
+Builds the table that I<str_encode(3)> uses instead of searching
+C<uncoded> for every byte. When there's a range of bytes that are mostly
+unencoded, it's recorded for the SIMD kernel.
 
 */
 
-List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment)
+static void escape_init(Escape *escape, const char *uncoded, const char *coded, int printable)
 {
-	List *para;
-	String *line = NULL;
-	const char *s, *r;
-	ssize_t len;
-
-	if (!str)
-		return set_errnull(EINVAL);
-
-	switch (alignment)
-	{
-		case ALIGN_LEFT:
-		case ALIGN_RIGHT:
-		case ALIGN_FULL:
-		{
-			if (!(para = list_create_with_locker(locker, (list_release_t *)str_release)))
-				return NULL;
-
-			for (s = str; *s; ++s)
-			{
-				while (is_space(*s))
-					++s;
+	size_t ncoded = strlen(coded);
+	size_t u;
+	int c;
 
-				for (r = s; *r && !is_space(*r); ++r)
-				{}
+	pthread_once(&codec_once, codec_init);
 
-				if (r > s)
-				{
-					if ((len = str_length(line)) == -1)
-						++len;
+	for (c = 0; c < CHARSET; ++c)
+		escape->width[c] = (printable && !is_print(c)) ? 4 : 1;
 
-					if (len + (len != 0) + (r - s) > line_width)
-					{
-						if (len && !list_append(para, line))
-						{
-							str_release(line);
-							list_release(para);
-							return NULL;
-						}
+	/* The first occurrence in uncoded wins */
 
-						line = NULL;
-					}
+	for (u = strlen(uncoded); u--; )
+	{
+		escape->width[(unsigned char)uncoded[u]] = 2;
+		escape->code[(unsigned char)uncoded[u]] = (u < ncoded) ? coded[u] : nul;
+	}
 
-					if (!line)
-					{
-						if (!(line = str_create_sized(line_width, "%.*s", r - s, s)))
-						{
-							list_release(para);
-							return NULL;
-						}
-					}
-					else if (!str_append(line, " %.*s", r - s, s))
-					{
-						str_release(line);
-						list_release(para);
-						return NULL;
-					}
+	escape->extras = -1;
 
-					s = r;
+#ifdef STR_SIMD
+	if (codec_level >= CODEC_SSE2)
+	{
+		static const unsigned char range[3][2] = { { 0x00, 0xff }, { 0x20, 0xff }, { 0x20, 0x7e } };
+		int r, n;
 
-					if (!*s)
-						--s;
-				}
-			}
+		for (r = 0; r < 3 && escape->extras == -1; ++r)
+		{
+			for (n = 0, c = range[r][0]; c <= range[r][1] && n <= 4; ++c)
+				if (escape->width[c] != 1 && n++ < 4)
+					escape->extra[n - 1] = c;
 
-			if (str_length(line) > 0 && !list_append(para, line))
+			if (n <= 4)
 			{
-				str_release(line);
-				list_release(para);
-				return NULL;
+				escape->lo = range[r][0];
+				escape->hi = range[r][1];
+				escape->extras = n;
 			}
+		}
+	}
+#endif
+}
 
-			if (alignment == ALIGN_RIGHT)
-			{
-				while (list_has_next(para) == 1)
-				{
-					line = (String *)list_next(para);
-					len = str_length(line);
+/*
+
+C<static size_t escape_skip(const Escape *escape, const unsigned char *src, size_t length)>
 
-					if (len >= line_width)
-						continue;
+Returns the number of bytes at the start of C<src> that can be copied as
+they are (possibly fewer, when the SIMD kernel stops early).
 
-					if (!str_prepend(line, "%*s", line_width - len, ""))
-					{
-						list_release(para);
-						return NULL;
-					}
-				}
-			}
-			else if (alignment == ALIGN_FULL)
-			{
-				ssize_t lines;
-				int i;
+*/
 
-				if ((lines = list_length(para)) == -1)
-				{
-					list_release(para);
-					return NULL;
-				}
+static size_t escape_skip(const Escape *escape, const unsigned char *src, size_t length)
+{
+	size_t i = 0;
 
-				for (i = 0; i < lines - 1; ++i)
-				{
-					size_t extra;
-					size_t gaps;
+#ifdef STR_SIMD
+	if (escape->extras != -1 && length >= 16)
+		return escape_skip_sse2(src, length, escape->lo, escape->hi, escape->extra, escape->extras);
+#endif
 
-					line = (String *)list_item(para, i);
-					len = str_length(line);
+	while (i < length && escape->width[src[i]] == 1)
+		++i;
 
-					if (len >= line_width)
-						continue;
+	return i;
+}
 
-					extra = line_width - len;
-					gaps = 0;
+/*
 
-					for (s = line->str; *s; ++s)
-						if (*s == ' ')
-							++gaps;
+C<static String *do_encode_with_locker(Locker *locker, const char *str, ssize_t length, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-					for (s = line->str; gaps && *s; ++s)
-					{
-						if (*s == ' ')
-						{
-							int gap = extra / gaps;
+Performs encoding as described in I<str_encode(3)>. The length of the
+result is measured first, so it is written in one pass without
+reallocating. Runs of bytes that don't need encoding are copied whole.
 
-							if (!str_insert(line, s - line->str, "%*s", gap, ""))
-							{
-								list_release(para);
-								return NULL;
-							}
+*/
 
-							extra -= gap;
-							--gaps;
-							s += gap;
-						}
-					}
-				}
-			}
+static String *do_encode_with_locker(Locker *locker, const char *str, size_t length, const char *uncoded, const char *coded, char quote_char, int printable)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	Escape escape[1];
+	String *encoded;
+	size_t size, run, i;
+	char *d;
 
-			break;
-		}
+	if (!str || !uncoded || !coded)
+		return set_errnull(EINVAL);
 
-		case ALIGN_CENTRE:
-		{
-			if (!(para = split_with_locker(locker, str, "\n")))
-				return NULL;
+	escape_init(escape, uncoded, coded, printable);
 
-			while (list_has_next(para) == 1)
-			{
-				size_t extra;
-				line = (String *)list_next(para);
-				str_squeeze(line);
-				len = str_length(line);
+	for (size = i = 0; i < length; ++i)
+	{
+		i += run = escape_skip(escape, s + i, length - i);
+		size += run;
 
-				if (len >= line_width)
-					continue;
+		if (i < length)
+			size += escape->width[s[i]];
+	}
 
-				extra = (line_width - len) / 2;
+	if (!(encoded = str_create_with_locker_sized(locker, size + 1, "")))
+		return NULL;
 
-				if (extra && !str_prepend(line, "%*s", extra, ""))
-				{
-					list_release(para);
-					return NULL;
-				}
-			}
+	for (d = encoded->str, i = 0; i < length; ++i)
+	{
+		run = escape_skip(escape, s + i, length - i);
+		memcpy(d, s + i, run);
+		d += run;
 
+		if ((i += run) == length)
 			break;
-		}
 
-		default:
+		switch (escape->width[s[i]])
 		{
-			return set_errnull(EINVAL);
+			case 1:
+				*d++ = s[i];
+				break;
+
+			case 2:
+				*d++ = quote_char;
+				*d++ = escape->code[s[i]];
+				break;
+
+			default:
+				*d++ = quote_char;
+				*d++ = 'x';
+				*d++ = hex_digits[s[i] >> 4];
+				*d++ = hex_digits[s[i] & 0x0f];
+				break;
 		}
 	}
 
-	return para;
+	*d = nul;
+	encoded->length = size + 1;
+
+	return encoded;
 }
 
 /*
 
-C<List *do_split_with_locker(Locker *locker, const char *str, ssize_t length, const char *delim)>
+C<static String *do_decode_with_locker(Locker *locker, const char *str, ssize_t length, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Splits C<str> into tokens separated by sequences of characters occurring in
-C<delim>. If C<length> is C<-1>, C<str> is interpreted as a
-C<nul>-terminated I<C> string. Otherwise, C<str> is interpreted as an
-arbitrary string of length C<length>. On success, returns a new I<List> of
-I<String> objects. It is the caller's responsibility to deallocate the list
-with I<list_release(3)> or I<list_destroy(3)>. If C<locker> is non-C<null>,
-multiple threads accessing the new list will be synchronised by C<locker>.
-On error, returns C<null> with C<errno> set appropriately.
+Performs decoding as described in I<str_decode(3)>. The text between
+occurrences of C<quote_char> (found with I<memchr(3)>) is copied whole,
+directly into the result, which can't be longer than C<str>.
 
 */
 
-static List *do_split_with_locker(Locker *locker, const char *str, ssize_t length, const char *delim)
+static String *do_decode_with_locker(Locker *locker, const char *str, size_t length, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	List *ret;
-	const char *s, *r;
+	const char *end = str + length;
+	const char *start, *slosh, *s;
+	String *decoded;
+	char *target;
+	char *d;
 
-	if (!str || !delim)
+	if (!str || !uncoded || !coded)
 		return set_errnull(EINVAL);
 
-	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
+	if (!(decoded = str_create_with_locker_sized(locker, length + 1, "")))
 		return NULL;
 
-	for (s = str; (length == -1) ? *s : s - str < length; ++s)
+	pthread_once(&codec_once, codec_init);
+
+	for (d = decoded->str, start = str; start < end; start = slosh + 1)
 	{
-		while ((length == -1) ? (*s && strchr(delim, *s)) : (s - str < length && (*s && strchr(delim, *s))))
-			++s;
+		if (!(slosh = memchr(start, quote_char, end - start)))
+			slosh = end;
 
-		if (!*delim)
-			r = s + 1;
-		else
-			for (r = s; (length == -1) ? (*r && !strchr(delim, *r)) : (r - str < length && (!*r || !strchr(delim, *r))); ++r)
-			{}
+		memcpy(d, start, slosh - start);
+		d += slosh - start;
 
-		if (r > s)
+		if (slosh == end)
+			break;
+
+		if (printable)
 		{
-			String *token = substr(s, 0, r - s);
-			if (!token)
+			unsigned int c = 0;
+			int digits = 0;
+
+			s = slosh + 1;
+
+			if (s < end && *s >= '0' && *s <= '7')
 			{
-				list_release(ret);
-				return NULL;
+				do
+				{
+					c <<= 3, c |= *s++ - '0';
+				}
+				while (++digits < 3 && s < end && *s >= '0' && *s <= '7');
+			}
+			else if (s + 1 < end && *s == 'x' && hex_value[(unsigned char)s[1]] != -1)
+			{
+				for (++s; digits < 2 && s < end && hex_value[(unsigned char)*s] != -1; ++digits)
+					c <<= 4, c |= hex_value[(unsigned char)*s++];
 			}
 
-			if (!list_append(ret, token))
+			if (digits)
 			{
-				str_release(token);
-				list_release(ret);
-				return NULL;
+				*d++ = (char)c;
+				slosh = s - 1; /* Skip over ASCII code */
+				continue;
 			}
+		}
 
-			s = r;
-			if (!*delim)
-				--s;
+		if (slosh + 1 == end || !slosh[1] || !(target = strchr(coded, slosh[1])))
+		{
+			*d++ = quote_char;
+			continue;
 		}
 
-		if ((length == -1) ? !*s : (s - str == length))
-			break;
+		*d++ = uncoded[target - coded];
+		++slosh; /* Skip over quoted char */
 	}
 
-	return ret;
+	*d = nul;
+	decoded->length = d - decoded->str + 1;
+
+	return decoded;
 }
 
 /*
 
-=item C<List *str_split(const String *str, const char *delim)>
+=item C<String *str_encode(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Splits C<str> into tokens separated by sequences of characters occurring in
-C<delim>. On success, returns a new I<List> of I<String> objects. It is the
-caller's responsibility to deallocate the list with I<list_release(3)> or
-I<list_destroy(3)>. On error, returns C<null> with C<errno> set
-appropriately.
+Returns a copy of C<str> with every occurrence in C<str> of characters in
+C<uncoded> replaced with C<quote_char> followed by the corresponding (by
+position) character in C<coded>. If C<printable> is non-zero, other
+non-printable characters are replaced with their I<ASCII> codes in
+hexadecimal. It is the caller's responsibility to deallocate the new string
+with I<str_release(3)> or I<str_destroy(3)>. It is strongly recommended to
+use I<str_destroy(3)>, because it also sets the pointer variable to C<null>.
+On error, returns C<null> with C<errno> set appropriately.
+
+Example:
+
+    // Encode a string into a C string literal
+    str_encode(str, "\a\b\t\n\v\f\r\\", "abtnvfr\\", '\\', 1);
+
+    // Decode a C string literal
+    str_decode(str, "\a\b\t\n\v\f\r\\", "abtnvfr\\", '\\', 1);
 
 =cut
 
 */
 
-List *str_split(const String *str, const char *delim)
+String *str_encode(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	return str_split_with_locker(NULL, str, delim);
+	return str_encode_with_locker(NULL, str, uncoded, coded, quote_char, printable);
 }
 
 /*
 
-=item C<List *str_split_unlocked(const String *str, const char *delim)>
+=item C<String *str_encode_unlocked(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Equivalent to I<str_split(3)> except that C<str> is not read-locked.
+Equivalent to I<str_encode(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-List *str_split_unlocked(const String *str, const char *delim)
+String *str_encode_unlocked(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	return str_split_with_locker_unlocked(NULL, str, delim);
+	return str_encode_with_locker_unlocked(NULL, str, uncoded, coded, quote_char, printable);
 }
 
 /*
 
-=item C<List *str_split_with_locker(Locker *locker, const String *str, const char *delim)>
+=item C<String *str_encode_with_locker(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Equivalent to I<str_split(3)> except that multiple threads accessing the new
-list will be synchronised by C<locker>.
+Equivalent to I<str_encode(3)> except that multiple threads accessing the new
+string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-List *str_split_with_locker(Locker *locker, const String *str, const char *delim)
+String *str_encode_with_locker(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	List *ret;
+	String *ret;
 	int err;
 
-	if (!str || !delim)
+	if (!str || !uncoded || !coded)
 		return set_errnull(EINVAL);
 
 	if ((err = str_rdlock(str)))
 		return set_errnull(err);
 
-	ret = str_split_with_locker_unlocked(locker, str, delim);
+	ret = str_encode_with_locker_unlocked(locker, str, uncoded, coded, quote_char, printable);
 
 	if ((err = str_unlock(str)))
 	{
-		list_release(ret);
+		str_release(ret);
 		return set_errnull(err);
 	}
 
@@ -4092,122 +9608,88 @@ List *str_split_with_locker(Locker *locker, const String *str, const char *delim
 
 /*
 
-=item C<List *str_split_with_locker_unlocked(Locker *locker, const String *str, const char *delim)>
+=item C<String *str_encode_with_locker_unlocked(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Equivalent to I<str_split_with_locker(3)> except that C<str> is not
+Equivalent to I<str_encode_with_locker(3)> except that C<str> is not
 read-locked.
 
 =cut
 
 */
 
-List *str_split_with_locker_unlocked(Locker *locker, const String *str, const char *delim)
-{
-	if (!str || !delim)
-		return set_errnull(EINVAL);
-
-	return do_split_with_locker(locker, str->str, str->length - 1, delim);
-}
-
-/*
-
-=item C<List *split(const char *str, const char *delim)>
-
-Equivalent to I<str_split(3)> but works on an ordinary I<C> string.
-
-=cut
-
-*/
-
-List *split(const char *str, const char *delim)
-{
-	return split_with_locker(NULL, str, delim);
-}
-
-/*
-
-=item C<List *split_with_locker(Locker *locker, const char *str, const char *delim)>
-
-Equivalent to I<split(3)> except that multiple threads accessing the new
-list will be synchronised by C<locker>.
-
-=cut
-
-*/
-
-List *split_with_locker(Locker *locker, const char *str, const char *delim)
+String *str_encode_with_locker_unlocked(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	if (!str || !delim)
+	if (!str || !uncoded || !coded)
 		return set_errnull(EINVAL);
 
-	return do_split_with_locker(locker, str, -1, delim);
+	return do_encode_with_locker(locker, str->str, str->length - 1, uncoded, coded, quote_char, printable);
 }
 
-#ifdef HAVE_REGEX_H
-
 /*
 
-=item C<List *str_regexpr_split(const String *str, const char *delim, int cflags, int eflags)>
+=item C<String *str_decode(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Splits C<str> into tokens separated by occurrences of the regular
-expression, C<delim>. C<str> is interpreted as a C<nul>-terminated I<C>
-string. C<cflags> is passed to I<regcomp(3)> along with C<REG_EXTENDED> and
-C<eflags> is passed to I<regexec(3)>. On success, returns a new I<List> of
-I<String> objects. It is the caller's responsibility to deallocate the list
-with I<list_release(3)> or I<list_destroy(3)>. On error, returns C<null>
-with C<errno> set appropriately.
+Returns a copy of C<str> with every occurrence in C<str> of C<quote_char>
+followed by a character in C<coded> replaced with the corresponding (by
+position) character in C<uncoded>. If C<printable> is non-zero, every
+occurrence in C<str> of an I<ASCII> code in octal or hexadecimal (i.e.
+"\ooo" or "\xhh") is replaced with the corresponding I<ASCII> character. It
+is the caller's responsibility to deallocate the new string with
+I<str_release(3)> or I<str_destroy(3)>. It is strongly recommended to use
+I<str_destroy(3)>, because it also sets the pointer variable to C<null>. On
+error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-List *str_regexpr_split(const String *str, const char *delim, int cflags, int eflags)
+String *str_decode(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	return str_regexpr_split_with_locker(NULL, str, delim, cflags, eflags);
+	return str_decode_with_locker(NULL, str, uncoded, coded, quote_char, printable);
 }
 
 /*
 
-=item C<List *str_regexpr_split_unlocked(const String *str, const char *delim, int cflags, int eflags)>
+=item C<String *str_decode_unlocked(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Equivalent to I<str_regexpr_split(3)> except that C<str> is not read-locked.
+Equivalent to I<str_decode(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-List *str_regexpr_split_unlocked(const String *str, const char *delim, int cflags, int eflags)
+String *str_decode_unlocked(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	return str_regexpr_split_with_locker_unlocked(NULL, str, delim, cflags, eflags);
+	return str_decode_with_locker_unlocked(NULL, str, uncoded, coded, quote_char, printable);
 }
 
 /*
 
-=item C<List *str_regexpr_split_with_locker(Locker *locker, const String *str, const char *delim, int cflags, int eflags)>
+=item C<String *str_decode_with_locker(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Equivalent to I<str_regexpr_split(3)> except that multiple threads accessing
-the new list will be synchronised by C<locker>.
+Equivalent to I<str_decode(3)> except that multiple threads accessing the
+new string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-List *str_regexpr_split_with_locker(Locker *locker, const String *str, const char *delim, int cflags, int eflags)
+String *str_decode_with_locker(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	List *ret;
+	String *ret;
 	int err;
 
-	if (!str || !delim)
+	if (!str || !uncoded || !coded)
 		return set_errnull(EINVAL);
 
 	if ((err = str_rdlock(str)))
 		return set_errnull(err);
 
-	ret = str_regexpr_split_with_locker_unlocked(locker, str, delim, cflags, eflags);
+	ret = str_decode_with_locker_unlocked(locker, str, uncoded, coded, quote_char, printable);
 
 	if ((err = str_unlock(str)))
 	{
-		list_release(ret);
+		str_release(ret);
 		return set_errnull(err);
 	}
 
@@ -4216,2300 +9698,2532 @@ List *str_regexpr_split_with_locker(Locker *locker, const String *str, const cha
 
 /*
 
-=item C<List *str_regexpr_split_with_locker_unlocked(Locker *locker, const String *str, const char *delim, int cflags, int eflags)>
+=item C<String *str_decode_with_locker_unlocked(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Equivalent to I<str_regexpr_split_with_locker(3)> except that C<str> is not
+Equivalent to I<str_decode_with_locker(3)> except that C<str> is not
 read-locked.
 
 =cut
 
 */
 
-List *str_regexpr_split_with_locker_unlocked(Locker *locker, const String *str, const char *delim, int cflags, int eflags)
+String *str_decode_with_locker_unlocked(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	if (!str || !delim)
+	if (!str || !uncoded || !coded)
 		return set_errnull(EINVAL);
 
-	return regexpr_split_with_locker(locker, str->str, delim, cflags, eflags);
+	return do_decode_with_locker(locker, str->str, str->length - 1, uncoded, coded, quote_char, printable);
 }
 
 /*
 
-=item C<List *regexpr_split(const char *str, const char *delim, int cflags, int eflags)>
+=item C<String *encode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Equivalent to I<str_regexpr_split(3)> but works on an ordinary I<C> string.
+Equivalent to I<str_encode(3)> but works on an ordinary I<C> string.
 
 =cut
 
 */
 
-List *regexpr_split(const char *str, const char *delim, int cflags, int eflags)
+String *encode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	return regexpr_split_with_locker(NULL, str, delim, cflags, eflags);
+	return encode_with_locker(NULL, str, uncoded, coded, quote_char, printable);
 }
 
 /*
 
-=item C<List *regexpr_split_with_locker(Locker *locker, const char *str, const char *delim, int cflags, int eflags)>
+=item C<String *encode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Equivalent to I<regexpr_split(3)> except that multiple threads accessing the
-new list will be synchronised by C<locker>.
+Equivalent to I<encode(3)> except that multiple threads accessing the new
+string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-List *regexpr_split_with_locker(Locker *locker, const char *str, const char *delim, int cflags, int eflags)
+String *encode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	List *ret;
-	String *token;
-	regex_t compiled[1];
-	regmatch_t match[1];
-	int start, matches;
-	int err;
-
-	if (!str || !delim)
+	if (!str || !uncoded || !coded)
 		return set_errnull(EINVAL);
 
-	if ((err = regexpr_compile(compiled, delim, cflags)))
-		return set_errnull(err);
-
-	if (!(ret = list_create_with_locker(locker, (list_release_t *)str_release)))
-		return NULL;
-
-	for (start = 0, matches = 0; str[start]; ++matches)
-	{
-		if (regexec(compiled, str + start, 1, match, eflags))
-			break;
-
-		/* Zero length match (at every position), make a token of each character */
-
-		if (match[0].rm_so == 0 && match[0].rm_eo == 0)
-		{
-			++match[0].rm_so;
-			++match[0].rm_eo;
-		}
-
-		/* Make a token of any text before the match */
-
-		if (match[0].rm_so)
-		{
-			if (!(token = substr(str, start, (ssize_t)match[0].rm_so)))
-			{
-				list_release(ret);
-				return NULL;
-			}
+	return do_encode_with_locker(locker, str, strlen(str), uncoded, coded, quote_char, printable);
+}
 
-			if (!list_append(ret, token))
-			{
-				str_release(token);
-				list_release(ret);
-				return NULL;
-			}
-		}
+/*
 
-		start += match[0].rm_eo;
-	}
+=item C<String *decode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-	/* Make a token of any text after the last match */
+Equivalent to I<str_decode(3)> but works on an ordinary I<C> string.
 
-	if (str[start])
-	{
-		if (!(token = str_create("%s", str + start)))
-		{
-			list_release(ret);
-			return NULL;
-		}
+=cut
 
-		if (!list_append(ret, token))
-		{
-			str_release(token);
-			list_release(ret);
-			return NULL;
-		}
-	}
+*/
 
-	return ret;
+String *decode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable)
+{
+	return decode_with_locker(NULL, str, uncoded, coded, quote_char, printable);
 }
 
-#endif
-
 /*
 
-=item C<String *str_join(const List *list, const char *delim)>
+=item C<String *decode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable)>
 
-Joins the I<String> objects in C<list> with C<delim> inserted between each
-one. On success, returns the resulting I<String>. It is the caller's
-responsibility to deallocate the string with I<str_release(3)> or
-I<str_destroy(3)>. On error, returns C<null> with C<errno> set
-appropriately.
+Equivalent to I<decode(3)> except that multiple threads accessing the new
+string will be synchronised by C<locker>.
 
 =cut
 
 */
 
-String *str_join(const List *list, const char *delim)
+String *decode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable)
 {
-	return str_join_with_locker(NULL, list, delim);
+	if (!str || !uncoded || !coded)
+		return set_errnull(EINVAL);
+
+	return do_decode_with_locker(locker, str, strlen(str), uncoded, coded, quote_char, printable);
 }
 
 /*
 
-=item C<String *str_join_unlocked(const List *list, const char *delim)>
-
-Equivalent to I<str_join(3)> except that C<list> is not read-locked.
+C<static String *codec_create(ssize_t length)>
 
-=cut
+Returns a new I<String> that can hold exactly C<length> bytes (plus the
+C<nul>), with its length already set to C<length>, for a codec to fill in.
+On error (including C<length> being C<-1>), returns C<null> with C<errno>
+set appropriately.
 
 */
 
-String *str_join_unlocked(const List *list, const char *delim)
+static String *codec_create(ssize_t length)
 {
-	return str_join_with_locker_unlocked(NULL, list, delim);
+	String *str;
+
+	if (length == -1)
+		return NULL;
+
+	if (!(str = str_create_sized((size_t)length + 1, "")))
+		return NULL;
+
+	str->str[length] = nul;
+	str->length = length + 1;
+
+	return str;
 }
 
 /*
 
-=item C<String *str_join_with_locker(Locker *locker, const List *list, const char *delim)>
+=item C<String *str_hex_encode(const String *str)>
 
-Equivalent to I<str_join(3)> except that multiple threads accessing the new
-string will be synchronised by C<locker>.
+Returns a new I<String> containing the bytes of C<str> encoded as pairs of
+lower case hexadecimal digits. It is the caller's responsibility to
+deallocate the new string with I<str_release(3)> or I<str_destroy(3)>. On
+error, returns C<null> with C<errno> set appropriately. See
+I<hex_encode(3)>.
 
 =cut
 
 */
 
-String *str_join_with_locker(Locker *locker, const List *list, const char *delim)
+String *str_hex_encode(const String *str)
 {
 	String *ret;
 	int err;
 
-	if (!list)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if ((err = list_rdlock(list)))
+	if ((err = str_rdlock(str)))
 		return set_errnull(err);
 
-	ret = str_join_with_locker_unlocked(locker, list, delim);
+	ret = str_hex_encode_unlocked(str);
 
-	if ((err = list_unlock(list)))
+	if ((err = str_unlock(str)))
+	{
+		str_release(ret);
 		return set_errnull(err);
+	}
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_join_with_locker_unlocked(Locker *locker, const List *list, const char *delim)>
+=item C<String *str_hex_encode_unlocked(const String *str)>
 
-Equivalent to I<str_join_with_locker(3)> except that C<list> is not
-read-locked.
+Equivalent to I<str_hex_encode(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_join_with_locker_unlocked(Locker *locker, const List *list, const char *delim)
+String *str_hex_encode_unlocked(const String *str)
 {
 	String *ret;
-	String *del;
-	Lister *lister;
-	int i;
 
-	if (!list)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if (!(ret = str_create_with_locker(locker, NULL)))
-		return NULL;
-
-	if (!(del = str_create(delim ? "%s" : NULL, delim)))
-	{
-		str_release(ret);
-		return NULL;
-	}
-
-	if (!(lister = lister_create_unlocked(list)))
-	{
-		str_release(ret);
-		str_release(del);
+	if (!(ret = codec_create(hex_encode(NULL, str->str, str->length - 1))))
 		return NULL;
-	}
-
-	for (i = 0; lister_has_next(lister) == 1; ++i)
-	{
-		String *s = (String *)lister_next(lister);
-
-		if (i && !str_append_str(ret, del))
-		{
-			str_release(ret);
-			str_release(del);
-			lister_release_unlocked(lister);
-			return NULL;
-		}
-
-		if (s && !str_append_str(ret, s))
-		{
-			str_release(ret);
-			str_release(del);
-			lister_release_unlocked(lister);
-			return NULL;
-		}
-	}
 
-	str_release(del);
-	lister_release_unlocked(lister);
+	hex_encode(ret->str, str->str, str->length - 1);
 
 	return ret;
 }
 
 /*
 
-=item C<String *join(const List *list, const char *delim)>
+=item C<String *str_hex_decode(const String *str)>
 
-Equivalent to I<str_join(3)> but works on a list of ordinary I<C> strings.
+Returns a new I<String> containing the bytes encoded as pairs of
+hexadecimal digits (in either case) in C<str>. It is the caller's
+responsibility to deallocate the new string with I<str_release(3)> or
+I<str_destroy(3)>. On error, returns C<null> with C<errno> set
+appropriately (C<EINVAL> if C<str> isn't an even number of hexadecimal
+digits).
 
 =cut
 
 */
 
-String *join(const List *list, const char *delim)
+String *str_hex_decode(const String *str)
 {
-	return join_with_locker(NULL, list, delim);
+	String *ret;
+	int err;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if ((err = str_rdlock(str)))
+		return set_errnull(err);
+
+	ret = str_hex_decode_unlocked(str);
+
+	if ((err = str_unlock(str)))
+	{
+		str_release(ret);
+		return set_errnull(err);
+	}
+
+	return ret;
 }
 
 /*
 
-=item C<String *join_with_locker(Locker *locker, const List *list, const char *delim)>
+=item C<String *str_hex_decode_unlocked(const String *str)>
 
-Equivalent to I<join(3)> except that multiple threads accessing the new
-string will be synchronised by C<locker>.
+Equivalent to I<str_hex_decode(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *join_with_locker(Locker *locker, const List *list, const char *delim)
+String *str_hex_decode_unlocked(const String *str)
 {
 	String *ret;
-	String *del;
-	Lister *lister;
-	int i;
 
-	if (!list)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if (!(ret = str_create_with_locker(locker, NULL)))
-		return NULL;
-
-	if (!(del = str_create(delim ? "%s" : NULL, delim)))
-	{
-		str_release(ret);
+	if (!(ret = codec_create(hex_decode(NULL, str->str, str->length - 1))))
 		return NULL;
-	}
 
-	if (!(lister = lister_create((List *)list)))
+	if (hex_decode(ret->str, str->str, str->length - 1) == -1)
 	{
 		str_release(ret);
-		str_release(del);
 		return NULL;
 	}
 
-	for (i = 0; lister_has_next(lister) == 1; ++i)
-	{
-		char *s = (char *)lister_next(lister);
-
-		if (i && !str_append_str(ret, del))
-		{
-			str_release(ret);
-			str_release(del);
-			lister_release(lister);
-			return NULL;
-		}
-
-		if (s && !str_append(ret, "%s", s))
-		{
-			str_release(ret);
-			str_release(del);
-			lister_release(lister);
-			return NULL;
-		}
-	}
-
-	str_release(del);
-	lister_release(lister);
-
 	return ret;
 }
 
 /*
 
-=item C<int str_soundex(const String *str)>
+=item C<String *str_base64_encode(const String *str, int url)>
 
-Returns the soundex code of C<str> as an integer. On error, returns C<-1>
-with C<errno> set appropriately.
+Returns a new I<String> containing the bytes of C<str> encoded in base64
+(RFC 4648). If C<url> is zero, the standard alphabet is used, and the
+result is padded with C<'='> to a multiple of 4 characters. If C<url> is
+non-zero, the URL and filename safe alphabet (with C<'-'> and C<'_'>
+instead of C<'+'> and C<'/'>) is used, without padding. It is the caller's
+responsibility to deallocate the new string with I<str_release(3)> or
+I<str_destroy(3)>. On error, returns C<null> with C<errno> set
+appropriately. See I<base64_encode(3)>.
 
 =cut
 
 */
 
-int str_soundex(const String *str)
+String *str_base64_encode(const String *str, int url)
 {
-	int ret;
+	String *ret;
 	int err;
 
 	if (!str)
-		return set_errno(EINVAL);
+		return set_errnull(EINVAL);
 
 	if ((err = str_rdlock(str)))
-		return set_errno(err);
+		return set_errnull(err);
 
-	ret = str_soundex_unlocked(str);
+	ret = str_base64_encode_unlocked(str, url);
 
 	if ((err = str_unlock(str)))
-		return set_errno(err);
+	{
+		str_release(ret);
+		return set_errnull(err);
+	}
 
 	return ret;
 }
 
 /*
 
-=item C<int str_soundex_unlocked(const String *str)>
+=item C<String *str_base64_encode_unlocked(const String *str, int url)>
 
-Equivalent to I<str_soundex(3)> except that C<str> is not read-locked.
+Equivalent to I<str_base64_encode(3)> except that C<str> is not
+read-locked.
 
 =cut
 
 */
 
-int str_soundex_unlocked(const String *str)
+String *str_base64_encode_unlocked(const String *str, int url)
 {
+	String *ret;
+
 	if (!str)
-		return set_errno(EINVAL);
+		return set_errnull(EINVAL);
 
-	return soundex(str->str);
+	if (!(ret = codec_create(base64_encode(NULL, str->str, str->length - 1, url))))
+		return NULL;
+
+	base64_encode(ret->str, str->str, str->length - 1, url);
+
+	return ret;
 }
 
 /*
 
-=item C<int soundex(const char *str)>
+=item C<String *str_base64_decode(const String *str, int url)>
 
-Equivalent to I<str_soundex(3)> but works on an ordinary I<C> string.
+Returns a new I<String> containing the bytes encoded in base64 in C<str>,
+using the standard alphabet if C<url> is zero, or the URL and filename
+safe alphabet if C<url> is non-zero. Padding is optional either way. It is
+the caller's responsibility to deallocate the new string with
+I<str_release(3)> or I<str_destroy(3)>. On error, returns C<null> with
+C<errno> set appropriately (C<EINVAL> if C<str> isn't valid base64).
 
 =cut
 
 */
 
-int soundex(const char *str)
+String *str_base64_decode(const String *str, int url)
 {
-	const char * const soundex_table = "\000123\00012\000\00022455\00012623\0001\0002\0002";
-	union { char c[4]; int i; } soundex;
-	int last, small;
+	String *ret;
+	int err;
 
 	if (!str)
-		return set_errno(EINVAL);
-
-	soundex.i = 0;
+		return set_errnull(EINVAL);
 
-	for (last = -1, small = 0; *str && small < 4; ++str)
-	{
-		if (is_alpha(*str))
-		{
-			int code = to_upper(*str);
+	if ((err = str_rdlock(str)))
+		return set_errnull(err);
 
-			if (small == 0)
-			{
-				soundex.c[small++] = code;
-				last = soundex_table[code - 'A'];
-			}
-			else
-			{
-				if ((code = soundex_table[code - 'A']) != last)
-				{
-					if (code != 0)
-						soundex.c[small++] = code;
+	ret = str_base64_decode_unlocked(str, url);
 
-					last = code;
-				}
-			}
-		}
+	if ((err = str_unlock(str)))
+	{
+		str_release(ret);
+		return set_errnull(err);
 	}
 
-	while (small < 4)
-		soundex.c[small++] = '0';
-
-	return ntohl(soundex.i);
+	return ret;
 }
 
 /*
 
-=item C<String *str_trim(String *str)>
+=item C<String *str_base64_decode_unlocked(const String *str, int url)>
 
-Trims leading and trailing whitespace from C<str>. On success, returns
-C<str>. On error, returns C<null> with C<errno> set appropriately.
+Equivalent to I<str_base64_decode(3)> except that C<str> is not
+read-locked.
 
 =cut
 
 */
 
-String *str_trim(String *str)
+String *str_base64_decode_unlocked(const String *str, int url)
 {
 	String *ret;
-	int err;
 
 	if (!str)
 		return set_errnull(EINVAL);
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
-
-	ret = str_trim_unlocked(str);
+	if (!(ret = codec_create(base64_decode(NULL, str->str, str->length - 1, url))))
+		return NULL;
 
-	if ((err = str_unlock(str)))
-		return set_errnull(err);
+	if (base64_decode(ret->str, str->str, str->length - 1, url) == -1)
+	{
+		str_release(ret);
+		return NULL;
+	}
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_trim_unlocked(String *str)>
+=item C<ssize_t hex_encode(char *dst, const void *src, size_t length)>
 
-Equivalent to I<str_trim(3)> except that C<str> is not write-locked.
+Encodes the C<length> bytes at C<src> as pairs of lower case hexadecimal
+digits, and stores them in C<dst>, which must have room for exactly
+C<2 * length> characters (no C<nul> is added). If C<dst> is C<null>,
+nothing is stored. On x86 CPUs with SSSE3, 16 bytes are encoded at a
+time. When the library is compiled with C<NO_SIMD> defined, or on other
+CPUs, only portable code is used. On success, returns the length of the
+encoding. On error, returns C<-1> with C<errno> set appropriately.
+
+    char *hex = malloc(hex_encode(NULL, buf, len));
+    hex_encode(hex, buf, len);
 
 =cut
 
 */
 
-String *str_trim_unlocked(String *str)
+ssize_t hex_encode(char *dst, const void *src, size_t length)
 {
-	char *s;
+	const unsigned char *s = (const unsigned char *)src;
+	size_t i = 0;
 
-	if (!str)
-		return set_errnull(EINVAL);
+	if (!src && length)
+		return set_errno(EINVAL);
 
-	for (s = str->str; is_space(*s); ++s)
-	{}
+	if (length > SSIZE_MAX / 2)
+		return set_errno(ERANGE);
 
-	if (s > str->str)
-	{
-		if (!str_remove_range_unlocked(str, 0, s - str->str))
-			return NULL;
-	}
+	if (!dst)
+		return 2 * length;
 
-	for (s = str->str + str->length - 1; s > str->str && is_space(s[-1]); --s)
-	{}
+	pthread_once(&codec_once, codec_init);
 
-	if (is_space(*s))
+#ifdef STR_SIMD
+	if (codec_level >= CODEC_SSSE3)
+		i = hex_encode_ssse3(dst, s, length);
+#endif
+
+	for (; i < length; ++i)
 	{
-		if (!str_remove_range_unlocked(str, s - str->str, str->length - 1 - (s - str->str)))
-			return NULL;
+		dst[2 * i] = hex_digits[s[i] >> 4];
+		dst[2 * i + 1] = hex_digits[s[i] & 0x0f];
 	}
 
-	return str;
+	return 2 * length;
 }
 
 /*
 
-=item C<char *trim(char *str)>
+=item C<ssize_t hex_decode(void *dst, const char *src, size_t length)>
 
-Equivalent to I<str_trim(3)> but works on an ordinary I<C> string.
+Decodes the C<length> hexadecimal digits (in either case) at C<src>, and
+stores the bytes in C<dst>, which must have room for exactly
+C<length / 2> bytes. If C<dst> is C<null>, nothing is stored (and the
+digits aren't checked). On success, returns the number of bytes decoded.
+On error, returns C<-1> with C<errno> set appropriately (C<EINVAL> if
+C<length> is odd or C<src> contains anything but hexadecimal digits, in
+which case C<dst> may have been partly written).
 
 =cut
 
 */
 
-char *trim(char *str)
+ssize_t hex_decode(void *dst, const char *src, size_t length)
 {
-	char *s;
-	size_t len;
+	unsigned char *d = (unsigned char *)dst;
+	size_t i = 0;
+	int hi, lo;
 
-	if (!str)
-		return set_errnull(EINVAL);
+	if ((!src && length) || length % 2)
+		return set_errno(EINVAL);
 
-	for (s = str; is_space(*s); ++s)
-	{}
+	if (!dst)
+		return length / 2;
 
-	len = strlen(s);
+	pthread_once(&codec_once, codec_init);
 
-	if (s > str)
-		memmove(str, s, len + 1);
+#ifdef STR_SIMD
+	if (codec_level >= CODEC_SSSE3)
+		i = hex_decode_ssse3(d, src, length);
+#endif
 
-	for (s = str + len; s > str && is_space(*--s); )
-		*s = '\0';
+	for (; i < length; i += 2)
+	{
+		if ((hi = hex_value[(unsigned char)src[i]]) == -1 || (lo = hex_value[(unsigned char)src[i + 1]]) == -1)
+			return set_errno(EINVAL);
 
-	return str;
+		d[i / 2] = (unsigned char)(hi << 4 | lo);
+	}
+
+	return length / 2;
 }
 
 /*
 
-=item C<String *str_trim_left(String *str)>
+=item C<ssize_t base64_encode(char *dst, const void *src, size_t length, int url)>
 
-Trims leading whitespace from C<str>. On success, returns C<str>. On error,
-returns C<null> with C<errno> set appropriately.
+Encodes the C<length> bytes at C<src> in base64 as for
+I<str_base64_encode(3)>, and stores the result in C<dst>, which must have
+room for exactly the number of characters returned when C<dst> is C<null>
+(no C<nul> is added). If C<dst> is C<null>, nothing is stored. On x86 CPUs
+with SSSE3, 12 bytes are encoded at a time. On success, returns the length
+of the encoding. On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_trim_left(String *str)
+ssize_t base64_encode(char *dst, const void *src, size_t length, int url)
 {
-	String *ret;
-	int err;
+	const unsigned char *s = (const unsigned char *)src;
+	const char *digits = base64_digits[url != 0];
+	size_t i = 0, o = 0, size;
+	unsigned long v;
 
-	if (!str)
-		return set_errnull(EINVAL);
+	if (!src && length)
+		return set_errno(EINVAL);
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
+	if (length / 3 > SSIZE_MAX / 4 - 1)
+		return set_errno(ERANGE);
 
-	ret = str_trim_left_unlocked(str);
+	size = (url) ? length / 3 * 4 + (length % 3 ? length % 3 + 1 : 0) : (length + 2) / 3 * 4;
 
-	if ((err = str_unlock(str)))
-		return set_errnull(err);
+	if (!dst)
+		return size;
 
-	return ret;
+	pthread_once(&codec_once, codec_init);
+
+#ifdef STR_SIMD
+	if (codec_level >= CODEC_SSSE3)
+		o = (i = base64_encode_ssse3(dst, s, length, url != 0)) / 3 * 4;
+#endif
+
+	for (; i + 3 <= length; i += 3, o += 4)
+	{
+		v = (unsigned long)s[i] << 16 | s[i + 1] << 8 | s[i + 2];
+		dst[o] = digits[v >> 18];
+		dst[o + 1] = digits[v >> 12 & 0x3f];
+		dst[o + 2] = digits[v >> 6 & 0x3f];
+		dst[o + 3] = digits[v & 0x3f];
+	}
+
+	if (i < length)
+	{
+		v = (unsigned long)s[i] << 16 | ((i + 1 < length) ? s[i + 1] << 8 : 0);
+		dst[o++] = digits[v >> 18];
+		dst[o++] = digits[v >> 12 & 0x3f];
+
+		if (i + 1 < length)
+			dst[o++] = digits[v >> 6 & 0x3f];
+
+		while (o < size)
+			dst[o++] = '=';
+	}
+
+	return size;
 }
 
 /*
 
-=item C<String *str_trim_left_unlocked(String *str)>
+=item C<ssize_t base64_decode(void *dst, const char *src, size_t length, int url)>
 
-Equivalent to I<str_trim_left(3)> except that C<str> is not write-locked.
+Decodes the C<length> base64 characters at C<src> as for
+I<str_base64_decode(3)>, and stores the bytes in C<dst>, which must have
+room for exactly the number of bytes returned when C<dst> is C<null>. If
+C<dst> is C<null>, nothing is stored (and the characters aren't checked).
+On x86 CPUs with SSSE3, 16 characters are decoded at a time. On success,
+returns the number of bytes decoded. On error, returns C<-1> with
+C<errno> set appropriately (C<EINVAL> if C<src> isn't valid base64, in
+which case C<dst> may have been partly written).
 
 =cut
 
 */
 
-String *str_trim_left_unlocked(String *str)
+ssize_t base64_decode(void *dst, const char *src, size_t length, int url)
 {
-	char *s;
+	unsigned char *d = (unsigned char *)dst;
+	const signed char *value;
+	size_t i = 0, o = 0, size;
+	int a, b, c, e;
 
-	if (!str)
-		return set_errnull(EINVAL);
+	if (!src && length)
+		return set_errno(EINVAL);
 
-	for (s = str->str; is_space(*s); ++s)
-	{}
+	/* Padding is optional but, when present, makes the length a multiple of 4 */
 
-	if (s > str->str)
-		if (!str_remove_range_unlocked(str, 0, s - str->str))
-			return NULL;
+	if (length && src[length - 1] == '=')
+	{
+		if (length % 4)
+			return set_errno(EINVAL);
 
-	return str;
+		length -= (src[length - 2] == '=') ? 2 : 1;
+	}
+
+	if (length % 4 == 1)
+		return set_errno(EINVAL);
+
+	size = length / 4 * 3 + (length % 4 ? length % 4 - 1 : 0);
+
+	if (!dst)
+		return size;
+
+	pthread_once(&codec_once, codec_init);
+	value = base64_value[url != 0];
+
+#ifdef STR_SIMD
+	if (codec_level >= CODEC_SSSE3)
+		o = (i = base64_decode_ssse3(d, src, length, url != 0)) / 4 * 3;
+#endif
+
+	for (; i + 4 <= length; i += 4, o += 3)
+	{
+		if ((a = value[(unsigned char)src[i]]) == -1 ||
+			(b = value[(unsigned char)src[i + 1]]) == -1 ||
+			(c = value[(unsigned char)src[i + 2]]) == -1 ||
+			(e = value[(unsigned char)src[i + 3]]) == -1)
+			return set_errno(EINVAL);
+
+		d[o] = (unsigned char)(a << 2 | b >> 4);
+		d[o + 1] = (unsigned char)(b << 4 | c >> 2);
+		d[o + 2] = (unsigned char)(c << 6 | e);
+	}
+
+	if (i < length)
+	{
+		if ((a = value[(unsigned char)src[i]]) == -1 ||
+			(b = value[(unsigned char)src[i + 1]]) == -1 ||
+			(i + 2 < length && (c = value[(unsigned char)src[i + 2]]) == -1))
+			return set_errno(EINVAL);
+
+		d[o++] = (unsigned char)(a << 2 | b >> 4);
+
+		if (i + 2 < length)
+			d[o] = (unsigned char)(b << 4 | c >> 2);
+	}
+
+	return size;
 }
 
 /*
 
-=item C<char *trim_left(char *str)>
-
-Equivalent to I<str_trim_left(3)> but works on an ordinary I<C> string.
+C<static size_t utf8_scalar(const unsigned char *s, size_t i, size_t length)>
 
-=cut
+Checks the UTF-8 in C<s> from offset C<i> (which must be the start of a
+character) to C<length> one byte at a time, skipping a word at a time
+through I<ASCII>. Returns the offset of the first invalid or incomplete
+character, or C<length> if there isn't one.
 
 */
 
-char *trim_left(char *str)
+static size_t utf8_scalar(const unsigned char *s, size_t i, size_t length)
 {
-	char *s;
-	size_t len;
+	unsigned char c, lo, hi;
+	size_t n, k;
 
-	if (!str)
-		return set_errnull(EINVAL);
+	while (i < length)
+	{
+		if ((c = s[i]) < 0x80)
+		{
+			unsigned long word;
 
-	for (s = str; is_space(*s); ++s)
-	{}
+			for (++i; i + sizeof word <= length; i += sizeof word)
+			{
+				memcpy(&word, s + i, sizeof word);
 
-	len = strlen(s);
+				if (word & ~0UL / 0xff * 0x80)
+					break;
+			}
 
-	if (s > str)
-		memmove(str, s, len + 1);
+			continue;
+		}
 
-	return str;
-}
+		lo = 0x80, hi = 0xbf;
+
+		if (c >= 0xc2 && c <= 0xdf)
+			n = 1;
+		else if (c >= 0xe0 && c <= 0xef)
+		{
+			n = 2;
 
-/*
+			if (c == 0xe0)
+				lo = 0xa0;
+			else if (c == 0xed)
+				hi = 0x9f;
+		}
+		else if (c >= 0xf0 && c <= 0xf4)
+		{
+			n = 3;
 
-=item C<String *str_trim_right(String *str)>
+			if (c == 0xf0)
+				lo = 0x90;
+			else if (c == 0xf4)
+				hi = 0x8f;
+		}
+		else
+			return i;
 
-Trims trailing whitespace from C<str>. On success, returns C<str>. On error,
-returns C<null> with C<errno> set appropriately.
+		if (length - i <= n || s[i + 1] < lo || s[i + 1] > hi)
+			return i;
 
-=cut
+		for (k = 2; k <= n; ++k)
+			if ((s[i + k] & 0xc0) != 0x80)
+				return i;
 
-*/
+		i += n + 1;
+	}
 
-String *str_trim_right(String *str)
-{
-	String *ret;
-	int err;
+	return length;
+}
 
-	if (!str)
-		return set_errnull(EINVAL);
+#ifdef STR_SIMD
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
+#define UTF8_TOO_SHORT (1 << 0)
+#define UTF8_TOO_LONG (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
 
-	ret = str_trim_right_unlocked(str);
+static const unsigned char utf8_byte_1_high[16] =
+{
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+	UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+	UTF8_TOO_SHORT,
+	UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+	UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+};
 
-	if ((err = str_unlock(str)))
-		return set_errnull(err);
+static const unsigned char utf8_byte_1_low[16] =
+{
+	UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+	UTF8_CARRY | UTF8_OVERLONG_2,
+	UTF8_CARRY,
+	UTF8_CARRY,
+	UTF8_CARRY | UTF8_TOO_LARGE,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+};
 
-	return ret;
-}
+static const unsigned char utf8_byte_2_high[16] =
+{
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+};
 
 /*
 
-=item C<String *str_trim_right_unlocked(String *str)>
-
-Equivalent to I<str_trim_right(3)> except that C<str> is not write-locked.
+C<static size_t utf8_valid_ssse3(const unsigned char *s, size_t length)>
 
-=cut
+Checks the UTF-8 in C<s> 16 bytes at a time with the lookup algorithm of
+Keiser and Lemire (as used by simdjson and simdutf): three I<pshufb> table
+lookups on the high and low nibbles of each byte and its predecessor
+classify every 2-byte error, and saturating subtractions check that 3 and
+4 byte characters have enough continuation bytes. All-I<ASCII> blocks only
+need checking for a character left incomplete by the previous block.
+Returns the offset of the first block containing an error, or the offset
+at which the whole blocks ran out. Either way, everything before the last
+character that starts before that offset is valid.
 
 */
 
-String *str_trim_right_unlocked(String *str)
+SIMD_TARGET("ssse3")
+static size_t utf8_valid_ssse3(const unsigned char *s, size_t length)
 {
-	char *s;
+	const __m128i byte_1_high = _mm_loadu_si128((const __m128i *)utf8_byte_1_high);
+	const __m128i byte_1_low = _mm_loadu_si128((const __m128i *)utf8_byte_1_low);
+	const __m128i byte_2_high = _mm_loadu_si128((const __m128i *)utf8_byte_2_high);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i third = _mm_set1_epi8(0xe0 - 0x80);
+	const __m128i fourth = _mm_set1_epi8(0xf0 - 0x80);
+	const __m128i high = _mm_set1_epi8(-0x80);
+	const __m128i last = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0xf0 - 1 - 0x100, 0xe0 - 1 - 0x100, 0xc0 - 1 - 0x100);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i in, prev = zero, incomplete = zero, prev1, sc, must23;
+	size_t i;
 
-	if (!str)
-		return set_errnull(EINVAL);
+	for (i = 0; i + 16 <= length; i += 16)
+	{
+		in = _mm_loadu_si128((const __m128i *)(s + i));
 
-	for (s = str->str + str->length - 1; s > str->str && is_space(s[-1]); --s)
-	{}
+		if (!_mm_movemask_epi8(in))
+		{
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(incomplete, zero)) != 0xffff)
+				return i;
 
-	if (is_space(*s))
-		if (!str_remove_range_unlocked(str, s - str->str, str->length - 1 - (s - str->str)))
-			return NULL;
+			prev = in;
+			continue;
+		}
 
-	return str;
+		prev1 = _mm_alignr_epi8(in, prev, 15);
+		sc = _mm_and_si128(_mm_and_si128(
+			_mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+			_mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+			_mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+		must23 = _mm_or_si128(
+			_mm_subs_epu8(_mm_alignr_epi8(in, prev, 14), third),
+			_mm_subs_epu8(_mm_alignr_epi8(in, prev, 13), fourth));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_xor_si128(_mm_and_si128(must23, high), sc), zero)) != 0xffff)
+			return i;
+
+		incomplete = _mm_subs_epu8(in, last);
+		prev = in;
+	}
+
+	return i;
 }
 
 /*
 
-=item C<char *trim_right(char *str)>
-
-Equivalent to I<str_trim_right(3)> but works on an ordinary I<C> string.
+C<static size_t utf8_length_sse2(const unsigned char *s, size_t length, size_t *count)>
 
-=cut
+Counts the bytes in C<s> that aren't UTF-8 continuation bytes (i.e. the
+characters), 16 bytes at a time, adding them to C<*count>. Returns the
+number of bytes examined.
 
 */
 
-char *trim_right(char *str)
+SIMD_TARGET("sse2")
+static size_t utf8_length_sse2(const unsigned char *s, size_t length, size_t *count)
 {
-	char *s;
-	size_t len;
-
-	if (!str)
-		return set_errnull(EINVAL);
+	const __m128i cont = _mm_set1_epi8(0xbf - 0x100);
+	size_t i, n = 0;
 
-	len = strlen(str);
+	for (i = 0; i + 16 <= length; i += 16)
+		n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_loadu_si128((const __m128i *)(s + i)), cont)));
 
-	for (s = str + len; s > str && is_space(*--s); )
-		*s = '\0';
+	*count += n;
 
-	return str;
+	return i;
 }
 
+#endif
+
 /*
 
-=item C<String *str_squeeze(String *str)>
+=item C<int str_utf8_valid(const String *str, size_t *error)>
 
-Trims leading and trailing whitespace from C<str> and replaces all other
-sequences of whitespace with a single space. On success, returns C<str>. On
-error, returns C<null> with C<errno> set appropriately.
+Returns whether or not C<str> is valid UTF-8 (see I<utf8_valid(3)>). If
+it isn't, and C<error> is not C<null>, the offset of the first invalid or
+incomplete character is stored in C<*error>. Returns C<1> if C<str> is
+valid, or C<0> if it isn't. On error, returns C<-1> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-String *str_squeeze(String *str)
+int str_utf8_valid(const String *str, size_t *error)
 {
-	String *ret;
+	int ret;
 	int err;
 
 	if (!str)
-		return set_errnull(EINVAL);
+		return set_errno(EINVAL);
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
+	if ((err = str_rdlock(str)))
+		return set_errno(err);
 
-	ret = str_squeeze_unlocked(str);
+	ret = str_utf8_valid_unlocked(str, error);
 
 	if ((err = str_unlock(str)))
-		return set_errnull(err);
+		return set_errno(err);
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_squeeze_unlocked(String *str)>
+=item C<int str_utf8_valid_unlocked(const String *str, size_t *error)>
 
-Equivalent to I<str_squeeze(3)> except that C<str> is not write-locked.
+Equivalent to I<str_utf8_valid(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_squeeze_unlocked(String *str)
+int str_utf8_valid_unlocked(const String *str, size_t *error)
 {
-	char *s, *r;
-	int started = 0;
-	int was_space = 0;
-
 	if (!str)
-		return set_errnull(EINVAL);
-
-	for (r = s = str->str; s - str->str < str->length - 1; ++s)
-	{
-		if (!is_space(*s))
-		{
-			if (was_space && started)
-				*r++ = ' ';
-			*r++ = *s;
-			started = 1;
-		}
-
-		was_space = is_space(*s);
-	}
-
-	if (r - str->str < str->length)
-		if (!str_remove_range_unlocked(str, r - str->str, str->length - 1 - (r - str->str)))
-			return NULL;
+		return set_errno(EINVAL);
 
-	return str;
+	return utf8_valid(str->str, str->length - 1, error);
 }
 
 /*
 
-=item C<char *squeeze(char *str)>
+=item C<ssize_t str_utf8_length(const String *str)>
 
-Equivalent to I<str_squeeze(3)> but works on an ordinary I<C> string.
+Returns the number of UTF-8 characters (code points) in C<str> (see
+I<utf8_length(3)>). On error, returns C<-1> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-char *squeeze(char *str)
+ssize_t str_utf8_length(const String *str)
 {
-	char *s, *r;
-	int started = 0;
-	int was_space = 0;
+	ssize_t ret;
+	int err;
 
 	if (!str)
-		return set_errnull(EINVAL);
+		return set_errno(EINVAL);
 
-	for (r = s = str; *s; ++s)
-	{
-		if (!is_space(*s))
-		{
-			if (was_space && started)
-				*r++ = ' ';
-			*r++ = *s;
-			started = 1;
-		}
+	if ((err = str_rdlock(str)))
+		return set_errno(err);
 
-		was_space = is_space(*s);
-	}
+	ret = str_utf8_length_unlocked(str);
 
-	*r = '\0';
+	if ((err = str_unlock(str)))
+		return set_errno(err);
 
-	return str;
+	return ret;
 }
 
 /*
 
-=item C<String *str_quote(const String *str, const char *quotable, char quote_char)>
+=item C<ssize_t str_utf8_length_unlocked(const String *str)>
 
-Creates a new I<String> containing C<str> with every occurrence of any
-character in C<quotable> preceded by C<quote_char>. On success, returns the
-new string. It is the caller's responsibility to deallocate the new string
-with I<str_release(3)> or I<str_destroy(3)>. On error, returns C<null> with
-C<errno> set appropriately.
+Equivalent to I<str_utf8_length(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_quote(const String *str, const char *quotable, char quote_char)
+ssize_t str_utf8_length_unlocked(const String *str)
 {
-	return str_quote_with_locker(NULL, str, quotable, quote_char);
+	if (!str)
+		return set_errno(EINVAL);
+
+	return utf8_length(str->str, str->length - 1);
 }
 
 /*
 
-=item C<String *str_quote_unlocked(const String *str, const char *quotable, char quote_char)>
+=item C<String *str_utf8_truncate(String *str, size_t length)>
 
-Equivalent to I<str_quote(3)> except that C<str> is not read-locked.
+Truncates C<str> to at most C<length> bytes without splitting a UTF-8
+character (see I<utf8_boundary(3)>). On success, returns C<str>. On error,
+returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_quote_unlocked(const String *str, const char *quotable, char quote_char)
+String *str_utf8_truncate(String *str, size_t length)
 {
-	return str_quote_with_locker_unlocked(NULL, str, quotable, quote_char);
+	String *ret;
+	int err;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
+
+	ret = str_utf8_truncate_unlocked(str, length);
+
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
+
+	return ret;
 }
 
 /*
 
-=item C<String *str_quote_with_locker(Locker *locker, const String *str, const char *quotable, char quote_char)>
+=item C<String *str_utf8_truncate_unlocked(String *str, size_t length)>
 
-Equivalent to I<str_quote(3)> except that multiple threads accessing the new
-string will be synchronised by C<locker>.
+Equivalent to I<str_utf8_truncate(3)> except that C<str> is not
+write-locked.
 
 =cut
 
 */
 
-String *str_quote_with_locker(Locker *locker, const String *str, const char *quotable, char quote_char)
+String *str_utf8_truncate_unlocked(String *str, size_t length)
 {
-	String *ret;
-	size_t i;
+	size_t keep;
 
-	if (!str || !quotable)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if (!(ret = str_copy_with_locker(locker, str)))
-		return NULL;
-
-	for (i = 0; i < ret->length - 1; ++i)
-	{
-		if (ret->str[i] && strchr(quotable, ret->str[i]))
-		{
-			if (!str_insert(ret, i++, "%c", quote_char))
-			{
-				str_release(ret);
-				return NULL;
-			}
-		}
-	}
+	keep = utf8_boundary(str->str, str->length - 1, length);
 
-	return ret;
+	return str_remove_range_unlocked(str, keep, str->length - 1 - keep);
 }
 
 /*
 
-=item C<String *str_quote_with_locker_unlocked(Locker *locker, const String *str, const char *quotable, char quote_char)>
+=item C<int utf8_valid(const char *str, size_t length, size_t *error)>
 
-Equivalent to I<str_quote_with_locker(3)> except that C<str> is not
-read-locked.
+Checks that the C<length> bytes at C<str> are valid UTF-8 as defined by
+RFC 3629: no overlong encodings, no surrogates (C<U+D800> to C<U+DFFF>),
+nothing above C<U+10FFFF>, and no character cut short by the end of the
+buffer. If not, and C<error> is not C<null>, the offset of the first
+invalid or incomplete character is stored in C<*error>. On x86 CPUs with
+SSSE3, 16 bytes are checked at a time (runs of I<ASCII> are just tested
+for their high bits). Returns C<1> if C<str> is valid, or C<0> if it
+isn't. On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_quote_with_locker_unlocked(Locker *locker, const String *str, const char *quotable, char quote_char)
+int utf8_valid(const char *str, size_t length, size_t *error)
 {
-	String *ret;
-	size_t i;
+	const unsigned char *s = (const unsigned char *)str;
+	size_t i = 0, k;
 
-	if (!str || !quotable)
-		return set_errnull(EINVAL);
-
-	if (!(ret = str_copy_with_locker_unlocked(locker, str)))
-		return NULL;
+	if (!str && length)
+		return set_errno(EINVAL);
 
-	for (i = 0; i < ret->length - 1; ++i)
-	{
-		if (ret->str[i] && strchr(quotable, ret->str[i]))
-		{
-			if (!str_insert(ret, i++, "%c", quote_char))
-			{
-				str_release(ret);
-				return NULL;
-			}
-		}
-	}
+	pthread_once(&codec_once, codec_init);
 
-	return ret;
-}
+#ifdef STR_SIMD
+	if (codec_level >= CODEC_SSSE3)
+		i = utf8_valid_ssse3(s, length);
+#endif
 
-/*
+	/*
+	** Back up to the start of the last character that began before i
+	** because it may end after i (or be the reason the kernel stopped).
+	*/
 
-=item C<String *quote(const char *str, const char *quotable, char quote_char)>
+	for (k = 0; k < 3 && i > 0 && (s[i - 1] & 0xc0) == 0x80; ++k)
+		--i;
 
-Equivalent to I<str_quote(3)> but works on an ordinary I<C> string.
+	if (i > 0 && s[i - 1] >= 0xc0)
+		--i;
 
-=cut
+	if ((i = utf8_scalar(s, i, length)) == length)
+		return 1;
 
-*/
+	if (error)
+		*error = i;
 
-String *quote(const char *str, const char *quotable, char quote_char)
-{
-	return quote_with_locker(NULL, str, quotable, quote_char);
+	return 0;
 }
 
 /*
 
-=item C<String *quote_with_locker(Locker *locker, const char *str, const char *quotable, char quote_char)>
+=item C<size_t utf8_length(const char *str, size_t length)>
 
-Equivalent to I<quote(3)> except that multiple threads accessing the new
-string will be synchronised by C<locker>.
+Returns the number of UTF-8 characters (code points) in the C<length>
+bytes at C<str>, i.e. the number of bytes that aren't continuation bytes.
+C<str> is not checked (see I<utf8_valid(3)>). On x86 CPUs with SSE2, 16
+bytes are counted at a time.
 
 =cut
 
 */
 
-String *quote_with_locker(Locker *locker, const char *str, const char *quotable, char quote_char)
+size_t utf8_length(const char *str, size_t length)
 {
-	String *ret;
-	size_t i;
+	const unsigned char *s = (const unsigned char *)str;
+	size_t i = 0, count = 0;
 
-	if (!str || !quotable)
-		return set_errnull(EINVAL);
+	if (!str)
+		return 0;
 
-	if (!(ret = str_create_with_locker(locker, "%s", str)))
-		return NULL;
+	pthread_once(&codec_once, codec_init);
 
-	for (i = 0; i < ret->length - 1; ++i)
-	{
-		if (strchr(quotable, ret->str[i]))
-		{
-			if (!str_insert(ret, i++, "%c", quote_char))
-			{
-				str_release(ret);
-				return NULL;
-			}
-		}
-	}
+#ifdef STR_SIMD
+	if (codec_level >= CODEC_SSE2)
+		i = utf8_length_sse2(s, length, &count);
+#endif
 
-	return ret;
+	for (; i < length; ++i)
+		if ((s[i] & 0xc0) != 0x80)
+			++count;
+
+	return count;
 }
 
 /*
 
-=item C<String *str_unquote(const String *str, const char *quotable, char quote_char)>
+=item C<size_t utf8_boundary(const char *str, size_t length, size_t max)>
 
-Creates a new string containing C<str> with every occurrence of
-C<quote_char> that is followed by any character in C<quotable> removed. On
-success, returns the new I<String>. It is the caller's responsibility to
-deallocate the new string with I<str_release(3)> or I<str_destroy(3)>. On
-error, returns C<null> with C<errno> set appropriately.
+Returns the largest number of bytes, no greater than C<max>, that the
+C<length> bytes of UTF-8 at C<str> can be truncated to without splitting a
+character. This is C<length> if C<max> is at least C<length>. Otherwise,
+at most 3 bytes are given back, so invalid input is still cut at or just
+before C<max>.
 
 =cut
 
 */
 
-String *str_unquote(const String *str, const char *quotable, char quote_char)
+size_t utf8_boundary(const char *str, size_t length, size_t max)
 {
-	return str_unquote_with_locker(NULL, str, quotable, quote_char);
+	size_t i, k;
+
+	if (!str || max >= length)
+		return (str) ? length : 0;
+
+	for (i = max, k = 0; k < 3 && i > 0 && (str[i] & 0xc0) == 0x80; ++k)
+		--i;
+
+	return i;
 }
 
 /*
 
-=item C<String *str_unquote_unlocked(const String *str, const char *quotable, char quote_char)>
+=item C<char *utf8_truncate(char *str, size_t length)>
 
-Equivalent to I<str_unquote(3)> except that C<str> is not read-locked.
+Equivalent to I<str_utf8_truncate(3)> but works on an ordinary I<C>
+string. On success, returns C<str>. On error, returns C<null> with
+C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_unquote_unlocked(const String *str, const char *quotable, char quote_char)
+char *utf8_truncate(char *str, size_t length)
 {
-	return str_unquote_with_locker_unlocked(NULL, str, quotable, quote_char);
+	if (!str)
+		return set_errnull(EINVAL);
+
+	str[utf8_boundary(str, strlen(str), length)] = '\0';
+
+	return str;
 }
 
 /*
 
-=item C<String *str_unquote_with_locker(Locker *locker, const String *str, const char *quotable, char quote_char)>
+=item C<String *str_lc(String *str)>
 
-Equivalent to I<str_unquote(3)> except that multiple threads accessing the
-new string will be synchronised by C<locker>.
+Converts C<str> into lower case. On success, returns C<str>. On error,
+returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_unquote_with_locker(Locker *locker, const String *str, const char *quotable, char quote_char)
+String *str_lc(String *str)
 {
 	String *ret;
-	int i;
+	int err;
 
-	if (!str || !quotable)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if (!(ret = str_copy_with_locker(locker, str)))
-		return NULL;
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
 
-	for (i = 0; i < (int)ret->length - 2; ++i)
-	{
-		if (ret->str[i] == quote_char && ret->str[i + 1] && strchr(quotable, ret->str[i + 1]))
-		{
-			if (!str_remove(ret, i))
-			{
-				str_release(ret);
-				return NULL;
-			}
-		}
-	}
+	ret = str_lc_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_unquote_with_locker_unlocked(Locker *locker, const String *str, const char *quotable, char quote_char)>
+=item C<String *str_lc_unlocked(String *str)>
 
-Equivalent to I<str_unquote_with_locker(3)> except that C<str> is not
-read-locked.
+Equivalent to I<str_lc(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_unquote_with_locker_unlocked(Locker *locker, const String *str, const char *quotable, char quote_char)
+String *str_lc_unlocked(String *str)
 {
-	String *ret;
-	int i;
+	size_t i;
 
-	if (!str || !quotable)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if (!(ret = str_copy_with_locker_unlocked(locker, str)))
+	if (unshare(str, str->size) == -1)
 		return NULL;
 
-	for (i = 0; i < (int)ret->length - 2; ++i)
-	{
-		if (ret->str[i] == quote_char && ret->str[i + 1] && strchr(quotable, ret->str[i + 1]))
-		{
-			if (!str_remove(ret, i))
-			{
-				str_release(ret);
-				return NULL;
-			}
-		}
-	}
+	for (i = 0; i < str->length - 1; ++i)
+		str->str[i] = to_lower(str->str[i]);
 
-	return ret;
+	return str;
 }
 
 /*
 
-=item C<String *unquote(const char *str, const char *quotable, char quote_char)>
+=item C<char *lc(char *str)>
 
-Equivalent to I<str_unquote(3)> but works on an ordinary I<C> string.
+Converts C<str> into lower case. On success, returns C<str>. On error,
+returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *unquote(const char *str, const char *quotable, char quote_char)
+char *lc(char *str)
 {
-	return unquote_with_locker(NULL, str, quotable, quote_char);
+	char *s;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	for (s = str; *s; ++s)
+		*s = to_lower(*s);
+
+	return str;
 }
 
 /*
 
-=item C<String *unquote_with_locker(Locker *locker, const char *str, const char *quotable, char quote_char)>
+=item C<String *str_lcfirst(String *str)>
 
-Equivalent to I<unquote(3)> except that multiple threads accessing the new
-string will be synchronised by C<locker>.
+Converts the first character in C<str> into lower case. On success, returns
+C<str>. On error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *unquote_with_locker(Locker *locker, const char *str, const char *quotable, char quote_char)
+String *str_lcfirst(String *str)
 {
 	String *ret;
-	int i;
+	int err;
 
-	if (!str || !quotable)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if (!(ret = str_create_with_locker(locker, "%s", str)))
-		return NULL;
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
 
-	for (i = 0; i < (int)ret->length - 2; ++i)
-	{
-		if (ret->str[i] == quote_char && strchr(quotable, ret->str[i + 1]))
-		{
-			if (!str_remove(ret, i))
-			{
-				str_release(ret);
-				return NULL;
-			}
-		}
-	}
+	ret = str_lcfirst_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
 
 	return ret;
 }
 
 /*
 
-C<static String *do_encode_with_locker(Locker *locker, const char *str, ssize_t length, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<String *str_lcfirst_unlocked(String *str)>
+
+Equivalent to I<str_lcfirst(3)> except that C<str> is not write-locked.
 
-Performs encoding as described in I<str_encode(3)>.
+=cut
 
 */
 
-static String *do_encode_with_locker(Locker *locker, const char *str, size_t length, const char *uncoded, const char *coded, char quote_char, int printable)
+String *str_lcfirst_unlocked(String *str)
 {
-	static const char hex[] = "0123456789abcdef";
-	String *encoded;
-	const char *target;
-	const char *s;
-
-	if (!str || !uncoded || !coded)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if (!(encoded = str_create_with_locker_sized(locker, length * 4 + 1, "")))
+	if (unshare(str, str->size) == -1)
 		return NULL;
 
-	for (s = str; s - str < length; ++s)
-	{
-		if (*s && (target = strchr(uncoded, (unsigned char)*s)))
-		{
-			if (!str_append(encoded, "%c%c", (unsigned char)quote_char, coded[target - uncoded]))
-			{
-				str_release(encoded);
-				return NULL;
-			}
-		}
-		else if (printable && !is_print(*s))
-		{
-			if (!str_append(encoded, "%cx%c%c", (unsigned char)quote_char, hex[(unsigned char)*s >> 4], hex[(unsigned char)*s & 0x0f]))
-			{
-				str_release(encoded);
-				return NULL;
-			}
-		}
-		else
-		{
-			if (!str_append(encoded, "%c", (unsigned char)*s))
-			{
-				str_release(encoded);
-				return NULL;
-			}
-		}
-	}
+	if (str->length > 1)
+		*str->str = to_lower(*str->str);
 
-	return encoded;
+	return str;
 }
 
 /*
 
-C<static String *do_decode_with_locker(Locker *locker, const char *str, ssize_t length, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<char *lcfirst(char *str)>
+
+Converts the first character in C<str> into lower case. On success, returns
+C<str>. On error, returns C<null> with C<errno> set appropriately.
 
-Performs decoding as described in I<str_decode(3)>.
+=cut
 
 */
 
-static String *do_decode_with_locker(Locker *locker, const char *str, size_t length, const char *uncoded, const char *coded, char quote_char, int printable)
+char *lcfirst(char *str)
 {
-	String *decoded;
-	const char *start;
-	const char *slosh;
-	char *target;
-
-	if (!str || !uncoded || !coded)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if (!(decoded = str_create_with_locker_sized(locker, length + 1, "")))
-		return NULL;
-
-	for (start = str; start - str < length; start = slosh + 1)
-	{
-		for (slosh = start; slosh - str < length; ++slosh)
-			if (*slosh == quote_char)
-				break;
-
-		if (slosh - str == length)
-			break;
-
-		if (printable)
-		{
-			int digits = 0;
-			const char *s = slosh + 1;
-			char c = '\0';
-
-			if (is_digit(*s) && *s <= '7')
-			{
-				--s;
-
-				do
-				{
-					++digits;
-					c <<= 3, c |= *++s - '0';
-				}
-				while (digits < 3 && is_digit(s[1]) && s[1] <= '7');
-			}
-			else if (*s == 'x' && is_xdigit(s[1]))
-			{
-				do
-				{
-					++digits;
-					c <<= 4;
-
-					switch (*++s)
-					{
-						case '0': case '1': case '2': case '3': case '4':
-						case '5': case '6': case '7': case '8': case '9':
-							c |= *s - '0';
-							break;
-						case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
-							c |= *s - 'a' + 10;
-							break;
-						case 'A': case 'B': case 'C': case 'D': case 'E': case 'F':
-							c |= *s - 'A' + 10;
-							break;
-					}
-				}
-				while (digits < 2 && is_xdigit(s[1]));
-			}
+	*str = to_lower(*str);
 
-			if (digits)
-			{
-				if (!str_append(decoded, "%*.*s%c", slosh - start, slosh - start, start, c))
-				{
-					str_release(decoded);
-					return NULL;
-				}
+	return str;
+}
 
-				slosh = s; /* Skip over ASCII code */
-				continue;
-			}
-		}
+/*
 
-		if (!slosh[1] || !(target = strchr(coded, slosh[1])))
-		{
-			if (!str_append(decoded, "%*.*s%c", slosh - start, slosh - start, start, quote_char))
-			{
-				str_release(decoded);
-				return NULL;
-			}
+=item C<String *str_uc(String *str)>
 
-			continue;
-		}
+Converts C<str> into upper case. On success, returns C<str>. On error,
+returns C<null> with C<errno> set appropriately.
 
-		if (!str_append(decoded, "%*.*s%c", slosh - start, slosh - start, start, uncoded[target - coded]))
-		{
-			str_release(decoded);
-			return NULL;
-		}
+=cut
 
-		++slosh; /* Skip over quoted char */
-	}
+*/
 
-	if (!str_append(decoded, "%s", start))
-	{
-		str_release(decoded);
-		return NULL;
-	}
+String *str_uc(String *str)
+{
+	String *ret;
+	int err;
 
-	return decoded;
-}
+	if (!str)
+		return set_errnull(EINVAL);
 
-/*
+	if ((err = str_wrlock(str)))
+		return set_errnull(err);
 
-=item C<String *str_encode(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+	ret = str_uc_unlocked(str);
 
-Returns a copy of C<str> with every occurrence in C<str> of characters in
-C<uncoded> replaced with C<quote_char> followed by the corresponding (by
-position) character in C<coded>. If C<printable> is non-zero, other
-non-printable characters are replaced with their I<ASCII> codes in
-hexadecimal. It is the caller's responsibility to deallocate the new string
-with I<str_release(3)> or I<str_destroy(3)>. It is strongly recommended to
-use I<str_destroy(3)>, because it also sets the pointer variable to C<null>.
-On error, returns C<null> with C<errno> set appropriately.
+	if ((err = str_unlock(str)))
+		return set_errnull(err);
 
-Example:
+	return ret;
+}
 
-    // Encode a string into a C string literal
-    str_encode(str, "\a\b\t\n\v\f\r\\", "abtnvfr\\", '\\', 1);
+/*
 
-    // Decode a C string literal
-    str_decode(str, "\a\b\t\n\v\f\r\\", "abtnvfr\\", '\\', 1);
+=item C<String *str_uc_unlocked(String *str)>
+
+Equivalent to I<str_uc(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_encode(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
+String *str_uc_unlocked(String *str)
 {
-	return str_encode_with_locker(NULL, str, uncoded, coded, quote_char, printable);
+	size_t i;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	if (unshare(str, str->size) == -1)
+		return NULL;
+
+	for (i = 0; i < str->length - 1; ++i)
+		str->str[i] = to_upper(str->str[i]);
+
+	return str;
 }
 
 /*
 
-=item C<String *str_encode_unlocked(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<char *uc(char *str)>
 
-Equivalent to I<str_encode(3)> except that C<str> is not read-locked.
+Converts C<str> into upper case. On success, returns C<str>. On error,
+returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_encode_unlocked(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
+char *uc(char *str)
 {
-	return str_encode_with_locker_unlocked(NULL, str, uncoded, coded, quote_char, printable);
+	char *s;
+
+	if (!str)
+		return set_errnull(EINVAL);
+
+	for (s = str; *s; ++s)
+		*s = to_upper(*s);
+
+	return str;
 }
 
 /*
 
-=item C<String *str_encode_with_locker(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<String *str_ucfirst(String *str)>
 
-Equivalent to I<str_encode(3)> except that multiple threads accessing the new
-string will be synchronised by C<locker>.
+Converts the first character in C<str> into upper case. On success, returns
+C<str>. On error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_encode_with_locker(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
+String *str_ucfirst(String *str)
 {
 	String *ret;
 	int err;
 
-	if (!str || !uncoded || !coded)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	if ((err = str_rdlock(str)))
+	if ((err = str_wrlock(str)))
 		return set_errnull(err);
 
-	ret = str_encode_with_locker_unlocked(locker, str, uncoded, coded, quote_char, printable);
+	ret = str_ucfirst_unlocked(str);
 
 	if ((err = str_unlock(str)))
-	{
-		str_release(ret);
 		return set_errnull(err);
-	}
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_encode_with_locker_unlocked(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<String *str_ucfirst_unlocked(String *str)>
 
-Equivalent to I<str_encode_with_locker(3)> except that C<str> is not
-read-locked.
+Equivalent to I<str_ucfirst(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_encode_with_locker_unlocked(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
+String *str_ucfirst_unlocked(String *str)
 {
-	if (!str || !uncoded || !coded)
+	if (!str)
 		return set_errnull(EINVAL);
 
-	return do_encode_with_locker(locker, str->str, str->length - 1, uncoded, coded, quote_char, printable);
+	if (unshare(str, str->size) == -1)
+		return NULL;
+
+	if (str->length > 1)
+		*str->str = to_upper(*str->str);
+
+	return str;
 }
 
 /*
 
-=item C<String *str_decode(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<char *ucfirst(char *str)>
 
-Returns a copy of C<str> with every occurrence in C<str> of C<quote_char>
-followed by a character in C<coded> replaced with the corresponding (by
-position) character in C<uncoded>. If C<printable> is non-zero, every
-occurrence in C<str> of an I<ASCII> code in octal or hexadecimal (i.e.
-"\ooo" or "\xhh") is replaced with the corresponding I<ASCII> character. It
-is the caller's responsibility to deallocate the new string with
-I<str_release(3)> or I<str_destroy(3)>. It is strongly recommended to use
-I<str_destroy(3)>, because it also sets the pointer variable to C<null>. On
-error, returns C<null> with C<errno> set appropriately.
+Converts the first character in C<str> into upper case. On success, returns
+C<str>. On error, returns C<null> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_decode(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
+char *ucfirst(char *str)
 {
-	return str_decode_with_locker(NULL, str, uncoded, coded, quote_char, printable);
+	if (!str)
+		return set_errnull(EINVAL);
+
+	*str = to_upper(*str);
+
+	return str;
 }
 
 /*
 
-=item C<String *str_decode_unlocked(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<int str_chop(String *str)>
 
-Equivalent to I<str_decode(3)> except that C<str> is not read-locked.
+Removes a character from the end of C<str>. On success, returns the
+character that was removed. On error, returns C<-1> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-String *str_decode_unlocked(const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
+int str_chop(String *str)
 {
-	return str_decode_with_locker_unlocked(NULL, str, uncoded, coded, quote_char, printable);
+	int ret;
+	int err;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if ((err = str_wrlock(str)))
+		return set_errno(err);
+
+	ret = str_chop_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errno(err);
+
+	return ret;
 }
 
 /*
 
-=item C<String *str_decode_with_locker(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<int str_chop_unlocked(String *str)>
 
-Equivalent to I<str_decode(3)> except that multiple threads accessing the
-new string will be synchronised by C<locker>.
+Equivalent to I<str_chop(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *str_decode_with_locker(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
+int str_chop_unlocked(String *str)
 {
-	String *ret;
-	int err;
+	int ret;
 
-	if (!str || !uncoded || !coded)
-		return set_errnull(EINVAL);
+	if (!str)
+		return set_errno(EINVAL);
 
-	if ((err = str_rdlock(str)))
-		return set_errnull(err);
+	if (str->length == 1)
+		return set_errno(EINVAL);
 
-	ret = str_decode_with_locker_unlocked(locker, str, uncoded, coded, quote_char, printable);
+	ret = str->str[str->length - 2];
 
-	if ((err = str_unlock(str)))
-	{
-		str_release(ret);
-		return set_errnull(err);
-	}
+	if (contract(str, str->length - 2, 1) == -1)
+		return -1;
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_decode_with_locker_unlocked(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<int chop(char *str)>
 
-Equivalent to I<str_decode_with_locker(3)> except that C<str> is not
-read-locked.
+Removes a character from the end of C<str>. On success, returns the
+character that was removed. On error, returns C<-1> with C<errno> set
+appropriately.
 
 =cut
 
 */
 
-String *str_decode_with_locker_unlocked(Locker *locker, const String *str, const char *uncoded, const char *coded, char quote_char, int printable)
+int chop(char *str)
 {
-	if (!str || !uncoded || !coded)
-		return set_errnull(EINVAL);
+	int ret;
 
-	return do_decode_with_locker(locker, str->str, str->length - 1, uncoded, coded, quote_char, printable);
+	if (!str || !*str)
+		return set_errno(EINVAL);
+
+	while (str[1])
+		++str;
+
+	ret = (int)*str;
+	*str = '\0';
+
+	return ret;
 }
 
 /*
 
-=item C<String *encode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<int str_chomp(String *str)>
 
-Equivalent to I<str_encode(3)> but works on an ordinary I<C> string.
+Removes line ending characters (i.e. C<'\n'> and C<'\r'>) from the end of
+C<str>. On success, returns the number of characters that were removed. On
+error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *encode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable)
+int str_chomp(String *str)
 {
-	return encode_with_locker(NULL, str, uncoded, coded, quote_char, printable);
+	int ret;
+	int err;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if ((err = str_wrlock(str)))
+		return set_errno(err);
+
+	ret = str_chomp_unlocked(str);
+
+	if ((err = str_unlock(str)))
+		return set_errno(err);
+
+	return ret;
 }
 
 /*
 
-=item C<String *encode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<int str_chomp_unlocked(String *str)>
 
-Equivalent to I<encode(3)> except that multiple threads accessing the new
-string will be synchronised by C<locker>.
+Equivalent to I<str_chomp(3)> except that C<str> is not write-locked.
 
 =cut
 
 */
 
-String *encode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable)
+int str_chomp_unlocked(String *str)
 {
-	if (!str || !uncoded || !coded)
-		return set_errnull(EINVAL);
+	char *s;
+	size_t length;
 
-	return do_encode_with_locker(locker, str, strlen(str), uncoded, coded, quote_char, printable);
+	if (!str)
+		return set_errno(EINVAL);
+
+	if (str->length == 1)
+		return 0;
+
+	length = str->length;
+
+	for (s = str->str + str->length - 2; *s == '\n' || *s == '\r'; --s)
+	{
+		if (contract(str, str->length - 2, 1) == -1)
+			return -1;
+	}
+
+	return length - str->length;
 }
 
 /*
 
-=item C<String *decode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+=item C<int chomp(char *str)>
 
-Equivalent to I<str_decode(3)> but works on an ordinary I<C> string.
+Removes line ending characters (i.e. C<'\n'> and C<'\r'>) from the end of
+C<str>. On success, returns the number of characters that were removed. On
+error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *decode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable)
+int chomp(char *str)
 {
-	return decode_with_locker(NULL, str, uncoded, coded, quote_char, printable);
+	char *s;
+
+	if (!str)
+		return set_errno(EINVAL);
+
+	if (str[0] == '\0')
+		return 0;
+
+	while (str[1])
+		++str;
+
+	for (s = str; *s == '\n' || *s == '\r'; --s)
+		*s = '\0';
+
+	return str - s;
 }
 
-/*
+/*
+
+C<static int parse_radix(const char *str, int base)>
+
+Returns the integer specified by C<str> for I<bin(3)>, I<hex(3)> and
+I<oct(3)>: C<str> must consist entirely of digits in C<base> (after an
+optional C<"0b"> or C<"0x"> prefix), and fit in 32 bits (larger values
+wrap to negative). An empty string, or a prefix with no digits, is C<0>.
+On error, returns C<-1> with C<errno> set appropriately.
+
+*/
+
+static int parse_radix(const char *str, int base)
+{
+	unsigned long val;
+	size_t length;
+	ssize_t n;
+
+	if (!str)
+		return set_errno(EINVAL);
 
-=item C<String *decode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable)>
+	if (base != 8 && str[0] == '0' && str[1] == ((base == 2) ? 'b' : 'x') && !str[2])
+		return 0;
 
-Equivalent to I<decode(3)> except that multiple threads accessing the new
-string will be synchronised by C<locker>.
+	if (!(length = strlen(str)))
+		return 0;
 
-=cut
+	if ((n = parse_ulong(str, length, base, &val)) == -1)
+		return -1;
 
-*/
+	if ((size_t)n != length)
+		return set_errno(EINVAL);
 
-String *decode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable)
-{
-	if (!str || !uncoded || !coded)
-		return set_errnull(EINVAL);
+	if (val > 0xffffffffUL)
+		return set_errno(ERANGE);
 
-	return do_decode_with_locker(locker, str, strlen(str), uncoded, coded, quote_char, printable);
+	return (int)(unsigned int)val;
 }
 
 /*
 
-=item C<String *str_lc(String *str)>
+=item C<int str_bin(const String *str)>
 
-Converts C<str> into lower case. On success, returns C<str>. On error,
-returns C<null> with C<errno> set appropriately.
+Returns the integer specified by the binary string, C<str>. C<str> can
+either be a string of C<[0-1]>, or C<"0b"> followed by a string of C<[0-1]>.
+On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_lc(String *str)
+int str_bin(const String *str)
 {
-	String *ret;
+	int ret;
 	int err;
 
 	if (!str)
-		return set_errnull(EINVAL);
+		return set_errno(EINVAL);
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
+	if ((err = str_rdlock(str)))
+		return set_errno(err);
 
-	ret = str_lc_unlocked(str);
+	ret = str_bin_unlocked(str);
 
 	if ((err = str_unlock(str)))
-		return set_errnull(err);
+		return set_errno(err);
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_lc_unlocked(String *str)>
+=item C<int str_bin_unlocked(const String *str)>
 
-Equivalent to I<str_lc(3)> except that C<str> is not write-locked.
+Equivalent to I<str_bin(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_lc_unlocked(String *str)
+int str_bin_unlocked(const String *str)
 {
-	size_t i;
-
 	if (!str)
-		return set_errnull(EINVAL);
-
-	for (i = 0; i < str->length - 1; ++i)
-		str->str[i] = to_lower(str->str[i]);
+		return set_errno(EINVAL);
 
-	return str;
+	return bin(str->str);
 }
 
 /*
 
-=item C<char *lc(char *str)>
+=item C<int bin(const char *str)>
 
-Converts C<str> into lower case. On success, returns C<str>. On error,
-returns C<null> with C<errno> set appropriately.
+Returns the integer specified by the binary string, C<str>. C<str> can
+either be a string of C<[0-1]>, or C<"0b"> followed by a string of C<[0-1]>.
+On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-char *lc(char *str)
+int bin(const char *str)
 {
-	char *s;
-
-	if (!str)
-		return set_errnull(EINVAL);
-
-	for (s = str; *s; ++s)
-		*s = to_lower(*s);
-
-	return str;
+	return parse_radix(str, 2);
 }
 
 /*
 
-=item C<String *str_lcfirst(String *str)>
+=item C<int str_hex(const String *str)>
 
-Converts the first character in C<str> into lower case. On success, returns
-C<str>. On error, returns C<null> with C<errno> set appropriately.
+Returns the integer specified by the hexadecimal string, C<str>. C<str> can
+either be a string of C<[0-9a-fA-F]>, or C<"0x"> followed by a string of
+C<[0-9a-fA-f]>. On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_lcfirst(String *str)
+int str_hex(const String *str)
 {
-	String *ret;
+	int ret;
 	int err;
 
 	if (!str)
-		return set_errnull(EINVAL);
+		return set_errno(EINVAL);
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
+	if ((err = str_rdlock(str)))
+		return set_errno(err);
 
-	ret = str_lcfirst_unlocked(str);
+	ret = str_hex_unlocked(str);
 
 	if ((err = str_unlock(str)))
-		return set_errnull(err);
+		return set_errno(err);
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_lcfirst_unlocked(String *str)>
+=item C<int str_hex_unlocked(const String *str)>
 
-Equivalent to I<str_lcfirst(3)> except that C<str> is not write-locked.
+Equivalent to I<str_hex(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_lcfirst_unlocked(String *str)
+int str_hex_unlocked(const String *str)
 {
 	if (!str)
-		return set_errnull(EINVAL);
-
-	if (str->length > 1)
-		*str->str = to_lower(*str->str);
+		return set_errno(EINVAL);
 
-	return str;
+	return hex(str->str);
 }
 
 /*
 
-=item C<char *lcfirst(char *str)>
+=item C<int hex(const char *str)>
 
-Converts the first character in C<str> into lower case. On success, returns
-C<str>. On error, returns C<null> with C<errno> set appropriately.
+Returns the integer specified by the hexadecimal string, C<str>. C<str> can
+either be a string of C<[0-9a-fA-F]>, or C<"0x"> followed by a string of
+C<[0-9a-fA-f]>. On error, returns C<-1> with C<errno> set appropriately.
 
 =cut
 
 */
 
-char *lcfirst(char *str)
+int hex(const char *str)
 {
-	if (!str)
-		return set_errnull(EINVAL);
-
-	*str = to_lower(*str);
-
-	return str;
+	return parse_radix(str, 16);
 }
 
 /*
 
-=item C<String *str_uc(String *str)>
+=item C<int str_oct(const String *str)>
 
-Converts C<str> into upper case. On success, returns C<str>. On error,
-returns C<null> with C<errno> set appropriately.
+Returns the integer specified by the binary, octal or hexadecimal string,
+C<str>. C<str> can either be C<"0x"> followed by a string of C<[0-9a-fA-F]>
+(hexadecimal), C<"0b"> followed by a string of C<[0-1]> (binary), or C<"0">
+followed by a string of C<[0-7]> (octal). On error, returns C<-1> with
+C<errno> set appropriately.
 
 =cut
 
 */
 
-String *str_uc(String *str)
+int str_oct(const String *str)
 {
-	String *ret;
+	int ret;
 	int err;
 
 	if (!str)
-		return set_errnull(EINVAL);
+		return set_errno(EINVAL);
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
+	if ((err = str_rdlock(str)))
+		return set_errno(err);
 
-	ret = str_uc_unlocked(str);
+	ret = str_oct_unlocked(str);
 
 	if ((err = str_unlock(str)))
-		return set_errnull(err);
+		return set_errno(err);
 
 	return ret;
 }
 
 /*
 
-=item C<String *str_uc_unlocked(String *str)>
+=item C<int str_oct_unlocked(const String *str)>
 
-Equivalent to I<str_uc(3)> except that C<str> is not write-locked.
+Equivalent to I<str_oct(3)> except that C<str> is not read-locked.
 
 =cut
 
 */
 
-String *str_uc_unlocked(String *str)
+int str_oct_unlocked(const String *str)
 {
-	size_t i;
-
 	if (!str)
-		return set_errnull(EINVAL);
-
-	for (i = 0; i < str->length - 1; ++i)
-		str->str[i] = to_upper(str->str[i]);
+		return set_errno(EINVAL);
 
-	return str;
+	return oct(str->str);
 }
 
 /*
 
-=item C<char *uc(char *str)>
+=item C<int oct(const char *str)>
 
-Converts C<str> into upper case. On success, returns C<str>. On error,
-returns C<null> with C<errno> set appropriately.
+Returns the integer specified by the binary, octal or hexadecimal string,
+C<str>. C<str> can either be C<"0x"> followed by a string of C<[0-9a-fA-F]>
+(hexadecimal), C<"0b"> followed by a string of C<[0-1]> (binary), or C<"0">
+followed by a string of C<[0-7]> (octal). On error, returns C<-1> with
+C<errno> set appropriately.
 
 =cut
 
 */
 
-char *uc(char *str)
+int oct(const char *str)
 {
-	char *s;
-
-	if (!str)
-		return set_errnull(EINVAL);
-
-	for (s = str; *s; ++s)
-		*s = to_upper(*s);
+	if (!str || str[0] != '0')
+		return set_errno(EINVAL);
 
-	return str;
+	return parse_radix(str, (str[1] == 'b') ? 2 : (str[1] == 'x') ? 16 : 8);
 }
 
 /*
 
-=item C<String *str_ucfirst(String *str)>
-
-Converts the first character in C<str> into upper case. On success, returns
-C<str>. On error, returns C<null> with C<errno> set appropriately.
+C<static int parse_digit(int c)>
 
-=cut
+Returns the value of the digit C<c> in bases up to 36 (C<[0-9a-zA-Z]>),
+or C<36> if it isn't one.
 
 */
 
-String *str_ucfirst(String *str)
+static int parse_digit(int c)
 {
-	String *ret;
-	int err;
-
-	if (!str)
-		return set_errnull(EINVAL);
+	if (c >= '0' && c <= '9')
+		return c - '0';
 
-	if ((err = str_wrlock(str)))
-		return set_errnull(err);
-
-	ret = str_ucfirst_unlocked(str);
+	if (c >= 'a' && c <= 'z')
+		return c - 'a' + 10;
 
-	if ((err = str_unlock(str)))
-		return set_errnull(err);
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 10;
 
-	return ret;
+	return 36;
 }
 
-/*
+#if defined(HAVE_LONG_LONG) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PARSE_SWAR 1
 
-=item C<String *str_ucfirst_unlocked(String *str)>
+/*
 
-Equivalent to I<str_ucfirst(3)> except that C<str> is not write-locked.
+C<static int parse_eight_digits(const char *s, unsigned long *value)>
 
-=cut
+If the 8 bytes at C<s> are all decimal digits, stores their value in
+C<*value> and returns C<1>. Otherwise, returns C<0>. The digits are
+checked and combined as one 64-bit word (three multiplications instead
+of eight).
 
 */
 
-String *str_ucfirst_unlocked(String *str)
+static int parse_eight_digits(const char *s, unsigned long *value)
 {
-	if (!str)
-		return set_errnull(EINVAL);
+	unsigned long long x;
 
-	if (str->length > 1)
-		*str->str = to_upper(*str->str);
+	memcpy(&x, s, 8);
 
-	return str;
+	if (((x + 0x4646464646464646ULL) | (x - 0x3030303030303030ULL)) & 0x8080808080808080ULL)
+		return 0;
+
+	x = (x & 0x0f0f0f0f0f0f0f0fULL) * 2561 >> 8;
+	x = (x & 0x00ff00ff00ff00ffULL) * 6553601 >> 16;
+	*value = (unsigned long)((x & 0x0000ffff0000ffffULL) * 42949672960001ULL >> 32 & 0xffffffff);
+
+	return 1;
 }
 
-/*
+#endif
 
-=item C<char *ucfirst(char *str)>
+/*
 
-Converts the first character in C<str> into upper case. On success, returns
-C<str>. On error, returns C<null> with C<errno> set appropriately.
+C<static ssize_t parse_digits(const char *str, size_t length, int base, unsigned long *value)>
 
-=cut
+Parses the unsigned integer described in I<parse_ulong(3)>. Returns the
+number of bytes used, or C<-1> with C<errno> set to C<EINVAL> (no digits)
+or C<ERANGE> (in which case C<*value> is C<ULONG_MAX>).
 
 */
 
-char *ucfirst(char *str)
+static ssize_t parse_digits(const char *str, size_t length, int base, unsigned long *value)
 {
-	if (!str)
-		return set_errnull(EINVAL);
+	unsigned long val = 0, cutoff, cutlim;
+	size_t i = 0, start;
+	int d, overflow = 0;
 
-	*str = to_upper(*str);
+	if (base < 0 || base == 1 || base > 36)
+		return set_errno(EINVAL);
 
-	return str;
-}
+	if (length >= 2 && str[0] == '0')
+	{
+		int prefix = str[1] | 0x20;
 
-/*
+		if (prefix == 'x' && (base == 0 || base == 16) && length > 2 && parse_digit(str[2]) < 16)
+			i = 2, base = 16;
+		else if (prefix == 'b' && (base == 0 || base == 2) && length > 2 && parse_digit(str[2]) < 2)
+			i = 2, base = 2;
+	}
 
-=item C<int str_chop(String *str)>
+	if (base == 0)
+		base = (length && str[0] == '0') ? 8 : 10;
 
-Removes a character from the end of C<str>. On success, returns the
-character that was removed. On error, returns C<-1> with C<errno> set
-appropriately.
+	cutoff = ULONG_MAX / base;
+	cutlim = ULONG_MAX % base;
 
-=cut
+	for (start = i;; ++i)
+	{
+#ifdef PARSE_SWAR
+		unsigned long eight;
 
-*/
+		if (base == 10)
+			while (i + 8 <= length && val <= (ULONG_MAX - 99999999) / 100000000 && parse_eight_digits(str + i, &eight))
+				val = val * 100000000 + eight, i += 8;
+#endif
 
-int str_chop(String *str)
-{
-	int ret;
-	int err;
+		if (i >= length || (d = parse_digit((unsigned char)str[i])) >= base)
+			break;
 
-	if (!str)
-		return set_errno(EINVAL);
+		if (val > cutoff || (val == cutoff && (unsigned long)d > cutlim))
+			overflow = 1;
+		else
+			val = val * base + d;
+	}
 
-	if ((err = str_wrlock(str)))
-		return set_errno(err);
+	if (i == start)
+		return set_errno(EINVAL);
 
-	ret = str_chop_unlocked(str);
+	if (overflow)
+	{
+		*value = ULONG_MAX;
+		return set_errno(ERANGE);
+	}
 
-	if ((err = str_unlock(str)))
-		return set_errno(err);
+	*value = val;
 
-	return ret;
+	return i;
 }
 
 /*
 
-=item C<int str_chop_unlocked(String *str)>
-
-Equivalent to I<str_chop(3)> except that C<str> is not write-locked.
+=item C<ssize_t parse_ulong(const char *str, size_t length, int base, unsigned long *value)>
+
+Parses the unsigned integer at the start of the C<length> bytes at C<str>
+in the given C<base> (C<2> to C<36>), and stores it in C<*value>. Unlike
+I<strtoul(3)>, C<str> needn't be C<nul>-terminated, and leading whitespace
+and signs aren't accepted. When C<base> is C<16> or C<2>, the digits may
+be preceded by C<"0x"> or C<"0b"> (either case). When C<base> is C<0>,
+those prefixes select hexadecimal or binary, a leading C<"0"> selects
+octal, and decimal is used otherwise. Decimal digits are read 8 at a time
+where possible. On success, returns the number of bytes parsed (parsing
+stops at the first byte that isn't a digit). On error, returns C<-1> with
+C<errno> set appropriately (C<EINVAL> if there are no digits, C<ERANGE>
+if the value doesn't fit, in which case C<*value> is set to
+C<ULONG_MAX>).
 
 =cut
 
 */
 
-int str_chop_unlocked(String *str)
+ssize_t parse_ulong(const char *str, size_t length, int base, unsigned long *value)
 {
-	int ret;
-
-	if (!str)
-		return set_errno(EINVAL);
-
-	if (str->length == 1)
+	if ((!str && length) || !value)
 		return set_errno(EINVAL);
 
-	ret = str->str[str->length - 2];
-
-	if (contract(str, str->length - 2, 1) == -1)
-		return -1;
-
-	return ret;
+	return parse_digits(str, length, base, value);
 }
 
 /*
 
-=item C<int chop(char *str)>
+=item C<ssize_t parse_long(const char *str, size_t length, int base, long *value)>
 
-Removes a character from the end of C<str>. On success, returns the
-character that was removed. On error, returns C<-1> with C<errno> set
-appropriately.
+Equivalent to I<parse_ulong(3)> except that the digits may be preceded by
+C<'+'> or C<'-'>, and the value must fit in a C<long>. On overflow,
+C<*value> is set to C<LONG_MAX> or C<LONG_MIN>.
 
 =cut
 
 */
 
-int chop(char *str)
+ssize_t parse_long(const char *str, size_t length, int base, long *value)
 {
-	int ret;
+	unsigned long val;
+	ssize_t len;
+	int neg = 0, sign = 0;
 
-	if (!str || !*str)
+	if ((!str && length) || !value)
 		return set_errno(EINVAL);
 
-	while (str[1])
-		++str;
+	if (length && (str[0] == '-' || str[0] == '+'))
+		neg = (str[0] == '-'), sign = 1;
 
-	ret = (int)*str;
-	*str = '\0';
+	if ((len = parse_digits(str + sign, length - sign, base, &val)) == -1 && errno != ERANGE)
+		return -1;
 
-	return ret;
+	if (len == -1 || val > (unsigned long)LONG_MAX + neg)
+	{
+		*value = (neg) ? LONG_MIN : LONG_MAX;
+		return set_errno(ERANGE);
+	}
+
+	*value = (neg) ? (val == (unsigned long)LONG_MAX + 1) ? LONG_MIN : -(long)val : (long)val;
+
+	return len + sign;
 }
 
-/*
+#if defined(HAVE_LONG_LONG) && DBL_MANT_DIG == 53 && FLT_RADIX == 2
+#define PARSE_EISEL_LEMIRE 1
+#define PARSE_POW10_MIN (-342)
+#define PARSE_POW10_MAX 308
+#define PARSE_BIG_LIMBS 58
 
-=item C<int str_chomp(String *str)>
+typedef unsigned long long u64_t;
 
-Removes line ending characters (i.e. C<'\n'> and C<'\r'>) from the end of
-C<str>. On success, returns the number of characters that were removed. On
-error, returns C<-1> with C<errno> set appropriately.
+static pthread_once_t parse_once = PTHREAD_ONCE_INIT;
+static u64_t parse_pow5[PARSE_POW10_MAX - PARSE_POW10_MIN + 1][2];
 
-=cut
+/*
+
+C<static int big_bitlen(const unsigned int *a)>
+
+Returns the number of significant bits in the I<PARSE_BIG_LIMBS> 32-bit
+limbs (least significant first) at C<a>.
 
 */
 
-int str_chomp(String *str)
+static int big_bitlen(const unsigned int *a)
 {
-	int ret;
-	int err;
-
-	if (!str)
-		return set_errno(EINVAL);
+	int i, bits;
 
-	if ((err = str_wrlock(str)))
-		return set_errno(err);
+	for (i = PARSE_BIG_LIMBS - 1; i >= 0 && !a[i]; --i)
+	{}
 
-	ret = str_chomp_unlocked(str);
+	if (i < 0)
+		return 0;
 
-	if ((err = str_unlock(str)))
-		return set_errno(err);
+	for (bits = 32; !(a[i] >> (bits - 1) & 1); --bits)
+	{}
 
-	return ret;
+	return i * 32 + bits;
 }
 
 /*
 
-=item C<int str_chomp_unlocked(String *str)>
-
-Equivalent to I<str_chomp(3)> except that C<str> is not write-locked.
+C<static void big_top128(const unsigned int *a, u64_t *hi, u64_t *lo)>
 
-=cut
+Stores the most significant 128 bits of C<a> (truncated, or shifted left
+if C<a> is shorter) in C<*hi> and C<*lo>.
 
 */
 
-int str_chomp_unlocked(String *str)
+static void big_top128(const unsigned int *a, u64_t *hi, u64_t *lo)
 {
-	char *s;
-	size_t length;
-
-	if (!str)
-		return set_errno(EINVAL);
+	int top = big_bitlen(a) - 1, i, b;
 
-	if (str->length == 1)
-		return 0;
-
-	length = str->length;
+	*hi = *lo = 0;
 
-	for (s = str->str + str->length - 2; *s == '\n' || *s == '\r'; --s)
+	for (i = 0; i < 128; ++i)
 	{
-		if (contract(str, str->length - 2, 1) == -1)
-			return -1;
-	}
+		b = top - i;
 
-	return length - str->length;
+		if (b >= 0 && a[b / 32] >> (b % 32) & 1)
+		{
+			if (i < 64)
+				*hi |= (u64_t)1 << (63 - i);
+			else
+				*lo |= (u64_t)1 << (127 - i);
+		}
+	}
 }
 
 /*
 
-=item C<int chomp(char *str)>
-
-Removes line ending characters (i.e. C<'\n'> and C<'\r'>) from the end of
-C<str>. On success, returns the number of characters that were removed. On
-error, returns C<-1> with C<errno> set appropriately.
+C<static void parse_init(void)>
 
-=cut
+Builds the table of 128-bit approximations of the powers of five used by
+I<parse_double(3)>, normalised so that the top bit is set: truncated
+for C<5^q>, and rounded up for C<1/5^q> (as in the I<fast_float>
+library). Called once via I<pthread_once(3)>. This takes a few hundred
+multiplications and divisions by 5 of a 1856-bit integer instead of
+shipping a 10KB table.
 
 */
 
-int chomp(char *str)
+static void parse_init(void)
 {
-	char *s;
-
-	if (!str)
-		return set_errno(EINVAL);
-
-	if (str[0] == '\0')
-		return 0;
-
-	while (str[1])
-		++str;
+	unsigned int pow5[PARSE_BIG_LIMBS], recip[PARSE_BIG_LIMBS], c[PARSE_BIG_LIMBS];
+	const int N = 32 * (PARSE_BIG_LIMBS - 1);
+	int q, i, z, shift, words, bits;
+	u64_t carry;
 
-	for (s = str; *s == '\n' || *s == '\r'; --s)
-		*s = '\0';
+	memset(pow5, 0, sizeof pow5);
+	memset(recip, 0, sizeof recip);
+	pow5[0] = 1;
+	recip[PARSE_BIG_LIMBS - 1] = 1; /* 2^N */
 
-	return str - s;
-}
+	for (q = 0; q <= -PARSE_POW10_MIN; ++q)
+	{
+		if (q)
+		{
+			/* pow5 *= 5, recip /= 5 (so recip = floor(2^N / 5^q)) */
 
-/*
+			for (carry = 0, i = 0; i < PARSE_BIG_LIMBS; ++i)
+			{
+				carry += (u64_t)pow5[i] * 5;
+				pow5[i] = (unsigned int)carry;
+				carry >>= 32;
+			}
 
-=item C<int str_bin(const String *str)>
+			for (carry = 0, i = PARSE_BIG_LIMBS - 1; i >= 0; --i)
+			{
+				carry = carry << 32 | recip[i];
+				recip[i] = (unsigned int)(carry / 5);
+				carry %= 5;
+			}
+		}
 
-Returns the integer specified by the binary string, C<str>. C<str> can
-either be a string of C<[0-1]>, or C<"0b"> followed by a string of C<[0-1]>.
-On error, returns C<-1> with C<errno> set appropriately.
+		if (q <= PARSE_POW10_MAX)
+			big_top128(pow5, &parse_pow5[q - PARSE_POW10_MIN][0], &parse_pow5[q - PARSE_POW10_MIN][1]);
 
-=cut
+		if (!q)
+			continue;
 
-*/
+		/* c = floor(2^b / 5^q) + 1 = (recip >> (N - b)) + 1 */
 
-int str_bin(const String *str)
-{
-	int ret;
-	int err;
+		z = big_bitlen(pow5);
+		shift = N - ((q <= 27) ? z + 127 : 2 * z + 128);
+		words = shift / 32, bits = shift % 32;
 
-	if (!str)
-		return set_errno(EINVAL);
+		for (i = 0; i < PARSE_BIG_LIMBS; ++i)
+		{
+			u64_t v = (i + words < PARSE_BIG_LIMBS) ? recip[i + words] : 0;
 
-	if ((err = str_rdlock(str)))
-		return set_errno(err);
+			if (bits && i + words + 1 < PARSE_BIG_LIMBS)
+				v |= (u64_t)recip[i + words + 1] << 32;
 
-	ret = str_bin_unlocked(str);
+			c[i] = (unsigned int)(v >> bits);
+		}
 
-	if ((err = str_unlock(str)))
-		return set_errno(err);
+		for (i = 0; i < PARSE_BIG_LIMBS && !++c[i]; ++i)
+		{}
 
-	return ret;
+		big_top128(c, &parse_pow5[-q - PARSE_POW10_MIN][0], &parse_pow5[-q - PARSE_POW10_MIN][1]);
+	}
 }
 
 /*
 
-=item C<int str_bin_unlocked(const String *str)>
-
-Equivalent to I<str_bin(3)> except that C<str> is not read-locked.
+C<static void parse_mul128(u64_t a, u64_t b, u64_t *hi, u64_t *lo)>
 
-=cut
+Stores the full 128-bit product of C<a> and C<b> in C<*hi> and C<*lo>.
 
 */
 
-int str_bin_unlocked(const String *str)
+static void parse_mul128(u64_t a, u64_t b, u64_t *hi, u64_t *lo)
 {
-	if (!str)
-		return set_errno(EINVAL);
+#ifdef __SIZEOF_INT128__
+	__extension__ unsigned __int128 p = (unsigned __int128)a * b;
 
-	return bin(str->str);
+	*hi = (u64_t)(p >> 64);
+	*lo = (u64_t)p;
+#else
+	u64_t a0 = a & 0xffffffff, a1 = a >> 32, b0 = b & 0xffffffff, b1 = b >> 32;
+	u64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+	u64_t mid = (p00 >> 32) + (p01 & 0xffffffff) + (p10 & 0xffffffff);
+
+	*lo = (mid << 32) | (p00 & 0xffffffff);
+	*hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+#endif
 }
 
 /*
 
-=item C<int bin(const char *str)>
-
-Returns the integer specified by the binary string, C<str>. C<str> can
-either be a string of C<[0-1]>, or C<"0b"> followed by a string of C<[0-1]>.
-On error, returns C<-1> with C<errno> set appropriately.
+C<static int parse_eisel_lemire(u64_t w, int q, int neg, double *value)>
 
-=cut
+Converts C<w * 10^q> (C<w> non-zero, C<q> within the table) to the
+nearest double using the algorithm of Eisel and Lemire: one (rarely two)
+64x128-bit multiplications by the normalised power of ten give enough
+bits to round correctly, except in rare cases which are detected.
+Returns C<1> on success, or C<0> if the result is ambiguous, subnormal or
+infinite (then the caller must fall back to a slower method).
 
 */
 
-int bin(const char *str)
+static int parse_eisel_lemire(u64_t w, int q, int neg, double *value)
 {
-	int ret = 0;
+	const u64_t *factor = parse_pow5[q - PARSE_POW10_MIN];
+	long exponent = (((152170L + 65536) * q) >> 16) + 1024 + 63;
+	u64_t hi, lo, hi2, lo2, mantissa, upperbit, bits;
+	int lz = 0;
 
-	if (!str)
-		return set_errno(EINVAL);
+	while (!(w >> 63))
+		w <<= 1, ++lz;
 
-	if (str[0] == '0' && str[1] == 'b')
-		str += 2;
+	parse_mul128(w, factor[0], &hi, &lo);
 
-	for (; *str; ++str)
+	if ((hi & 0x1ff) == 0x1ff && lo + w < lo)
 	{
-		ret <<= 1;
-
-		switch (*str)
-		{
-			case '0': break;
-			case '1': ret |= 1; break;
-			default:  return set_errno(EINVAL);
-		}
-	}
-
-	return ret;
-}
+		parse_mul128(w, factor[1], &hi2, &lo2);
 
-/*
+		if ((lo += hi2) < hi2)
+			++hi;
 
-=item C<int str_hex(const String *str)>
+		if (lo + 1 == 0 && (hi & 0x1ff) == 0x1ff && lo2 + w < lo2)
+			return 0;
+	}
 
-Returns the integer specified by the hexadecimal string, C<str>. C<str> can
-either be a string of C<[0-9a-fA-F]>, or C<"0x"> followed by a string of
-C<[0-9a-fA-f]>. On error, returns C<-1> with C<errno> set appropriately.
+	upperbit = hi >> 63;
+	mantissa = hi >> (upperbit + 9);
+	lz += (int)(1 ^ upperbit);
 
-=cut
+	/* Possibly exactly halfway between two doubles */
 
-*/
+	if (lo == 0 && (hi & 0x1ff) == 0 && (mantissa & 3) == 1)
+		return 0;
 
-int str_hex(const String *str)
-{
-	int ret;
-	int err;
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
 
-	if (!str)
-		return set_errno(EINVAL);
+	if (mantissa >= (u64_t)1 << 53)
+	{
+		mantissa = (u64_t)1 << 52;
+		--lz;
+	}
 
-	if ((err = str_rdlock(str)))
-		return set_errno(err);
+	mantissa &= ~((u64_t)1 << 52);
+	exponent -= lz;
 
-	ret = str_hex_unlocked(str);
+	if (exponent < 1 || exponent > 2046)
+		return 0;
 
-	if ((err = str_unlock(str)))
-		return set_errno(err);
+	bits = mantissa | (u64_t)exponent << 52 | (u64_t)neg << 63;
+	memcpy(value, &bits, sizeof *value);
 
-	return ret;
+	return 1;
 }
 
-/*
+#endif
 
-=item C<int str_hex_unlocked(const String *str)>
+/*
 
-Equivalent to I<str_hex(3)> except that C<str> is not read-locked.
+C<static ssize_t parse_double_slow(const char *str, size_t length, double *value)>
 
-=cut
+Parses the C<length> bytes at C<str>, already known to be a number, with
+I<strtod(3)> (via a C<nul>-terminated copy that uses the current locale's
+decimal point). Returns C<length>, or C<-1> with C<errno> set to
+C<ERANGE> if the value overflows.
 
 */
 
-int str_hex_unlocked(const String *str)
+static ssize_t parse_double_slow(const char *str, size_t length, double *value)
 {
-	if (!str)
-		return set_errno(EINVAL);
+	const char *point = localeconv()->decimal_point;
+	size_t plen = strlen(point), size = length * plen + 1, i, o;
+	char buf[128], *copy = buf;
+	double val;
 
-	return hex(str->str);
+	if (size > sizeof buf && !(copy = mem_create(size, char)))
+		return -1;
+
+	for (i = o = 0; i < length; ++i)
+	{
+		if (str[i] == '.')
+			memcpy(copy + o, point, plen), o += plen;
+		else
+			copy[o++] = str[i];
+	}
+
+	copy[o] = '\0';
+	errno = 0;
+	val = strtod(copy, NULL);
+
+	if (copy != buf)
+		mem_release(copy);
+
+	*value = val;
+
+	if (errno == ERANGE && (val == HUGE_VAL || val == -HUGE_VAL))
+		return -1;
+
+	return length;
 }
 
 /*
 
-=item C<int hex(const char *str)>
-
-Returns the integer specified by the hexadecimal string, C<str>. C<str> can
-either be a string of C<[0-9a-fA-F]>, or C<"0x"> followed by a string of
-C<[0-9a-fA-f]>. On error, returns C<-1> with C<errno> set appropriately.
+=item C<ssize_t parse_double(const char *str, size_t length, double *value)>
+
+Parses the floating point number at the start of the C<length> bytes at
+C<str>, and stores the nearest double (ties to even) in C<*value>. Accepts
+an optional sign, decimal digits with an optional C<'.'> (which doesn't
+depend on the locale) and exponent, C<"inf">, C<"infinity"> and C<"nan">
+(in any case), and hexadecimal floats (as for I<strtod(3)>). Unlike
+I<strtod(3)>, C<str> needn't be C<nul>-terminated, and leading whitespace
+isn't accepted. The digits are read 8 at a time where possible. Numbers
+with up to 19 significant digits are converted exactly with a
+multiplication or division of doubles when possible, or with the
+Eisel-Lemire algorithm. Longer or harder numbers (about 1 in 1000 random
+numbers, plus subnormals) are passed to I<strtod(3)>. On success, returns
+the number of bytes parsed. On error, returns C<-1> with C<errno> set
+appropriately (C<EINVAL> if there isn't a number, C<ERANGE> if it
+overflows, in which case C<*value> is set to C<HUGE_VAL> or
+C<-HUGE_VAL>). Underflow isn't an error.
 
 =cut
 
 */
 
-int hex(const char *str)
+ssize_t parse_double(const char *str, size_t length, double *value)
 {
-	int ret = 0;
+#ifdef PARSE_EISEL_LEMIRE
+	static const double pow10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	u64_t w = 0;
+#endif
+	size_t i = 0, start, digits, zeros, end;
+	long exp10 = 0, e;
+	int neg = 0, esign;
 
-	if (!str)
+	if ((!str && length) || !value)
 		return set_errno(EINVAL);
 
-	if (str[0] == '0' && str[1] == 'x')
-		str += 2;
+	if (length && (str[0] == '-' || str[0] == '+'))
+		neg = (str[i++] == '-');
 
-	for (; *str; ++str)
+	/* inf, infinity, nan */
+
+	if (length - i >= 3 && ((str[i] | 0x20) == 'i' || (str[i] | 0x20) == 'n'))
 	{
-		ret <<= 4;
+		if (!strncasecmp(str + i, "inf", 3))
+		{
+			i += (length - i >= 8 && !strncasecmp(str + i, "infinity", 8)) ? 8 : 3;
+			*value = (neg) ? -HUGE_VAL : HUGE_VAL;
+
+			return i;
+		}
 
-		switch (*str)
+		if (!strncasecmp(str + i, "nan", 3))
 		{
-			case '0': case '1': case '2': case '3': case '4':
-			case '5': case '6': case '7': case '8': case '9':
-				ret |= *str - '0';
-				break;
-			case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
-				ret |= *str - 'a' + 10;
-				break;
-			case 'A': case 'B': case 'C': case 'D': case 'E': case 'F':
-				ret |= *str - 'A' + 10;
-				break;
-			default:
-				return set_errno(EINVAL);
+			*value = (neg) ? -NAN : NAN;
+
+			return i + 3;
 		}
 	}
 
-	return ret;
-}
+	/* Hexadecimal floats are rare, so leave them to strtod() */
 
-/*
+	if (length - i > 2 && str[i] == '0' && (str[i + 1] | 0x20) == 'x' && (parse_digit((unsigned char)str[i + 2]) < 16 || (str[i + 2] == '.' && length - i > 3 && parse_digit((unsigned char)str[i + 3]) < 16)))
+	{
+		for (i += 2; i < length && parse_digit((unsigned char)str[i]) < 16; ++i)
+		{}
 
-=item C<int str_oct(const String *str)>
+		if (i < length && str[i] == '.')
+			for (++i; i < length && parse_digit((unsigned char)str[i]) < 16; ++i)
+			{}
 
-Returns the integer specified by the binary, octal or hexadecimal string,
-C<str>. C<str> can either be C<"0x"> followed by a string of C<[0-9a-fA-F]>
-(hexadecimal), C<"0b"> followed by a string of C<[0-1]> (binary), or C<"0">
-followed by a string of C<[0-7]> (octal). On error, returns C<-1> with
-C<errno> set appropriately.
+		if (i + 1 < length && (str[i] | 0x20) == 'p')
+		{
+			size_t j = i + 1 + (str[i + 1] == '-' || str[i + 1] == '+');
 
-=cut
+			if (j < length && is_digit(str[j]))
+				for (i = j; i < length && is_digit(str[i]); ++i)
+				{}
+		}
 
-*/
+		return parse_double_slow(str, i, value);
+	}
 
-int str_oct(const String *str)
-{
-	int ret;
-	int err;
+	/* Decimal digits, counting the leading zeros which aren't significant */
+
+	start = i;
+
+	for (zeros = 0; i < length && str[i] == '0'; ++i)
+		++zeros;
+
+	for (;; ++i)
+	{
+#if defined(PARSE_EISEL_LEMIRE) && defined(PARSE_SWAR)
+		unsigned long eight;
+
+		while (i + 8 <= length && parse_eight_digits(str + i, &eight))
+			w = w * 100000000 + eight, i += 8;
+#endif
 
-	if (!str)
-		return set_errno(EINVAL);
+		if (i >= length || !is_digit(str[i]))
+			break;
 
-	if ((err = str_rdlock(str)))
-		return set_errno(err);
+#ifdef PARSE_EISEL_LEMIRE
+		w = w * 10 + (str[i] - '0');
+#endif
+	}
 
-	ret = str_oct_unlocked(str);
+	digits = i - start;
 
-	if ((err = str_unlock(str)))
-		return set_errno(err);
+	if (i < length && str[i] == '.')
+	{
+		size_t point = ++i;
 
-	return ret;
-}
+		if (digits == zeros)
+			for (; i < length && str[i] == '0'; ++i)
+				++zeros;
 
-/*
+		for (;; ++i)
+		{
+#if defined(PARSE_EISEL_LEMIRE) && defined(PARSE_SWAR)
+			unsigned long eight;
 
-=item C<int str_oct_unlocked(const String *str)>
+			while (i + 8 <= length && parse_eight_digits(str + i, &eight))
+				w = w * 100000000 + eight, i += 8;
+#endif
 
-Equivalent to I<str_oct(3)> except that C<str> is not read-locked.
+			if (i >= length || !is_digit(str[i]))
+				break;
 
-=cut
+#ifdef PARSE_EISEL_LEMIRE
+			w = w * 10 + (str[i] - '0');
+#endif
+		}
 
-*/
+		digits += i - point;
+		exp10 = -(long)(i - point);
+	}
 
-int str_oct_unlocked(const String *str)
-{
-	if (!str)
+	if (!digits)
 		return set_errno(EINVAL);
 
-	return oct(str->str);
-}
+	if (i + 1 < length && (str[i] | 0x20) == 'e')
+	{
+		size_t j = i + 1;
 
-/*
+		esign = (str[j] == '-') ? -1 : 1;
 
-=item C<int oct(const char *str)>
+		if (str[j] == '-' || str[j] == '+')
+			++j;
 
-Returns the integer specified by the binary, octal or hexadecimal string,
-C<str>. C<str> can either be C<"0x"> followed by a string of C<[0-9a-fA-F]>
-(hexadecimal), C<"0b"> followed by a string of C<[0-1]> (binary), or C<"0">
-followed by a string of C<[0-7]> (octal). On error, returns C<-1> with
-C<errno> set appropriately.
+		if (j < length && is_digit(str[j]))
+		{
+			for (e = 0; j < length && is_digit(str[j]); ++j)
+				if (e < 100000)
+					e = e * 10 + (str[j] - '0');
 
-=cut
+			exp10 += esign * e;
+			i = j;
+		}
+	}
 
-*/
+	end = i;
 
-int oct(const char *str)
-{
-	int ret = 0;
+#ifdef PARSE_EISEL_LEMIRE
+	if (digits - zeros <= 19)
+	{
+		if (w == 0 || exp10 < PARSE_POW10_MIN)
+		{
+			*value = (neg) ? -0.0 : 0.0;
 
-	if (!str || str[0] != '0')
-		return set_errno(EINVAL);
+			return end;
+		}
 
-	if (str[1] == 'b')
-		return bin(str);
+		if (exp10 > PARSE_POW10_MAX)
+		{
+			*value = (neg) ? -HUGE_VAL : HUGE_VAL;
 
-	if (str[1] == 'x')
-		return hex(str);
+			return set_errno(ERANGE);
+		}
 
-	for (++str; *str; ++str)
-	{
-		ret <<= 3;
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+		/* Clinger's fast path: w and 10^|exp10| are both exact doubles */
 
-		switch (*str)
+		if (w <= (u64_t)1 << 53 && exp10 >= -22 && exp10 <= 22)
 		{
-			case '0': case '1': case '2': case '3':
-			case '4': case '5': case '6': case '7':
-				ret |= *str - '0';
-				break;
-			default:
-				return set_errno(EINVAL);
+			double d = (double)w;
+
+			d = (exp10 < 0) ? d / pow10[-exp10] : d * pow10[exp10];
+			*value = (neg) ? -d : d;
+
+			return end;
 		}
+#endif
+
+		pthread_once(&parse_once, parse_init);
+
+		if (parse_eisel_lemire(w, (int)exp10, neg, value))
+			return end;
 	}
+#endif
 
-	return ret;
+	return parse_double_slow(str, end, value);
 }
 
 #ifndef HAVE_STRCASECMP
@@ -6875,8 +12589,10 @@ int vasprintf(char **str, const char *format, va_list args)
 		return -1;
 	}
 
+	/* Move the bytes to the start of the buffer's allocation */
+
 	if (str)
-		*str = cstr(tmp);
+		*str = memmove(BUFFER(tmp->str), tmp->str, tmp->length);
 	len = str_length(tmp);
 	free(tmp);
 
@@ -6935,6 +12651,15 @@ appropriate for each application on a string by string basis.
 I<MT-Disciplined> means that the application developer has a mechanism for
 specifying the synchronisation requirements to be applied to library code.
 
+When client code is compiled with C<INLINE_ACCESSORS> defined, I<cstr(3)>
+and I<str_length_unlocked(3)> become macros that access the I<String>
+directly, and I<str_length(3)> becomes a macro that does the same when the
+I<String> has no I<Locker> (and calls the function otherwise). When client
+code is compiled with C<NO_LOCKERS> defined (i.e. none of its I<String>s
+have a I<Locker>), I<str_length(3)> doesn't even check for a I<Locker>. Note
+that the macros evaluate their arguments more than once, so the arguments
+mustn't have side effects.
+
 I<MT-Safe> - I<str_fgetline(3)>
 
 I<Mac OS X> doesn't have I<flockfile(3)>, I<funlockfile(3)> or
@@ -8078,6 +13803,86 @@ void mt_test(int test, Locker *locker)
 	}
 }
 
+#ifdef HAVE_REGEX_H
+static int regsub_double(String *dst, const char *text, const regmatch_t *match, void *data)
+{
+	++*(int *)data;
+
+	return str_append(dst, "%d", 2 * atoi(text + match[0].rm_so)) ? 0 : -1;
+}
+
+static int regsub_fail(String *dst, const char *text, const regmatch_t *match, void *data)
+{
+	return (++*(int *)data == 2) ? set_errno(ERANGE) : 0;
+}
+
+static int grep_semicolon(void *engine, const char *text, size_t start, size_t end, regmatch_t *match, int eflags)
+{
+	const char *p = memchr(text + start, ';', end - start);
+
+	++*(int *)engine;
+
+	if (!p)
+		return REG_NOMATCH;
+
+	match[0].rm_so = p - text;
+	match[0].rm_eo = p - text + 1;
+
+	return 0;
+}
+
+static int grep_same(List *a, List *b)
+{
+	size_t i;
+
+	if (!a || !b || list_length(a) != list_length(b))
+		return 0;
+
+	for (i = 0; i < list_length(a); ++i)
+	{
+		regmatch_t *ma = (regmatch_t *)list_item(a, i);
+		regmatch_t *mb = (regmatch_t *)list_item(b, i);
+
+		if (ma->rm_so != mb->rm_so || ma->rm_eo != mb->rm_eo)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int grep_item(List *list, size_t index, regoff_t so, regoff_t eo)
+{
+	regmatch_t *m = (list && index < list_length(list)) ? (regmatch_t *)list_item(list, index) : NULL;
+
+	return m && m->rm_so == so && m->rm_eo == eo;
+}
+#endif
+
+void *share(void *arg)
+{
+	String *str = arg;
+	long failed = 0;
+	int i;
+
+	for (i = 0; i < 10000; ++i)
+	{
+		String *copy;
+
+		if (!(copy = str_share(str)))
+		{
+			++failed;
+			continue;
+		}
+
+		if (i & 1 && !str_append(copy, "%d", i))
+			++failed;
+
+		str_release(copy);
+	}
+
+	return (void *)failed;
+}
+
 int main(int ac, char **av)
 {
 	const char * const testfile = "str_fgetline.test";
@@ -8086,9 +13891,17 @@ int main(int ac, char **av)
 	List *list;
 	StringTR *trtable;
 	int i, big, rc;
+	size_t pos;
 	FILE *stream;
 #ifdef HAVE_REGEX_H
 	regex_t re[1];
+	regmatch_t m[3];
+	Regex *rx;
+	regex_t res[3];
+	struct iovec iov[3];
+	List *list2;
+	int engines[4];
+	void *engine[4];
 #endif
 
 	if (ac == 2 && !strcmp(av[1], "help"))
@@ -8398,6 +14211,17 @@ int main(int ac, char **av)
 
 	str_destroy(&a);
 
+	/* Test str_create_iovecs */
+
+	iov[0].iov_base = "ab", iov[0].iov_len = 2;
+	iov[1].iov_base = "", iov[1].iov_len = 0;
+	iov[2].iov_base = "\0cd", iov[2].iov_len = 3;
+	TEST_STR(859, a = str_create_iovecs(iov, 3), a, 5, "ab\0cd")
+	str_destroy(&a);
+	TEST_STR(859, a = str_create_iovecs(NULL, 0), a, 0, "")
+	str_destroy(&a);
+	TEST_ACT(859, !str_create_iovecs(NULL, 1) && errno == EINVAL)
+
 	/* Test substr */
 
 	TEST_ACT(65, a = str_create("abcdefghijkl"))
@@ -8489,73 +14313,430 @@ int main(int ac, char **av)
 	str_destroy(&a);
 	str_destroy(&b);
 
-#define TEST_TR_DIRECT(i, action, str, bytes, length, value) \
-	TEST_EQ(i, action, bytes) \
-	CHECK_STR(i, action, str, length, value)
+#define TEST_TR_DIRECT(i, action, str, bytes, length, value) \
+	TEST_EQ(i, action, bytes) \
+	CHECK_STR(i, action, str, length, value)
+
+	big = 1024;
+	TEST_ACT(115, a = str_create("abcDEFghiJKLmnoPQRstuVWXyz"))
+	TEST_ACT(115, trtable = tr_compile("a-zA-Z", "A-Za-z", 0))
+	for (i = 0; i < big; ++i)
+	{
+		TEST_TR_DIRECT(115, tr_compiled(a->str, trtable), a, 26, 26, "ABCdefGHIjklMNOpqrSTUvwxYZ")
+		TEST_TR_DIRECT(115, tr_compiled(a->str, trtable), a, 26, 26, "abcDEFghiJKLmnoPQRstuVWXyz")
+	}
+	TEST_ACT(115, !tr_destroy(&trtable))
+	str_destroy(&a);
+
+	TEST_ACT(116, a = str_create("\170\171\172\173\174\175\176\177\200\201\202\203\204\205\206\207\210"))
+	TEST_ACT(116, b = str_create("\200-\377"))
+	TEST_ACT(116, c = str_create("%c-\177", '\000'))
+	TEST_TR_DIRECT(116, str_tr_str(a, b, c, 0), a, 9, 17, "\170\171\172\173\174\175\176\177\000\001\002\003\004\005\006\007\010")
+	str_destroy(&a);
+	str_destroy(&b);
+	str_destroy(&c);
+
+#ifdef HAVE_REGEX_H
+
+	/* Test str_regexpr */
+
+	TEST_ACT(117, a = str_create("abcabcabc"))
+	else
+	{
+		TEST_ACT(117, list = str_regexpr("a((.*)a(.*))a", a, 0, 0))
+		else
+		{
+			CHECK_LIST_LENGTH(117, str_regexpr(), list, 4)
+			CHECK_LIST_ITEM(117, str_regexpr("a((.*)a(.*))a", "abcabcabc"), 0, "abcabca")
+			CHECK_LIST_ITEM(117, str_regexpr("a((.*)a(.*))a", "abcabcabc"), 1, "bcabc")
+			CHECK_LIST_ITEM(117, str_regexpr("a((.*)a(.*))a", "abcabcabc"), 2, "bc")
+			CHECK_LIST_ITEM(117, str_regexpr("a((.*)a(.*))a", "abcabcabc"), 3, "bc")
+			list_destroy(&list);
+		}
+
+		str_destroy(&a);
+	}
+
+	/* Test str_regsub */
+
+#define TEST_REGSUB(i, str, pat, rep, cflags, eflags, all, len, res) \
+	TEST_ACT((i), a = str_create("%s", (str))) \
+	else \
+	{ \
+		TEST_STR((i), str_regsub((pat), (rep), a, (cflags), (eflags), (all)), a, (len), (res)) \
+		str_destroy(&a); \
+	}
+
+	TEST_REGSUB(118, "xabcabcabcx", "a((.*)a(.*))a", "$0", 0, 0, 0, 11, "xabcabcabcx")
+	TEST_REGSUB(119, "xabcabcabcx", "a((.*)a(.*))a", "$$$2${3}!", 0, 0, 0, 10, "x$bcbc!bcx")
+	TEST_REGSUB(120, "xabcabcabcx", "a((.*)a(.*))a", "$$$2$31!", 0, 0, 0, 11, "x$bcbc1!bcx")
+	TEST_REGSUB(121, "xabcabcabcx", "a", "z", 0, 0, 0, 11, "xzbcabcabcx")
+	TEST_REGSUB(122, "xabcabcabcx", "a", "z", 0, 0, 1, 11, "xzbczbczbcx")
+	TEST_REGSUB(123, "aba", "a", "z", 0, 0, 0, 3, "zba")
+	TEST_REGSUB(124, "aba", "a", "z", 0, 0, 1, 3, "zbz")
+	TEST_REGSUB(125, "xabcabcabcx", "((((((((((((((((((((((((((((((((a))))))))))))))))))))))))))))))))", "!${32}!", 0, 0, 0, 13, "x!a!bcabcabcx")
+	TEST_REGSUB(126, "xabcabcabcx", "((((((((((((((((((((((((((((((((a))))))))))))))))))))))))))))))))", "!${32}!", 0, 0, 1, 17, "x!a!bc!a!bc!a!bcx")
+	TEST_REGSUB(127, "\\a:b:c:d:e:f:G:H:I:", "(...)(..)(..)(..)(..)(..)(..)(..)(..)", "$1\\U$2\\Q$3\\l$4\\E$5\\E$6\\L$7\\Q\\u$8\\E\\E$9\\\\l", 0, 0, 0, 24, "\\a:B:C\\:d\\:E:f:g:H\\:I:\\l")
+	TEST_REGSUB(128, "abcdef", "()", "-", 0, 0, 0, 7, "-abcdef")
+	TEST_REGSUB(129, "abcdef", "()", "-", 0, 0, 1, 13, "-a-b-c-d-e-f-")
+	TEST_REGSUB(758, "a=b=cd=", "([a-z]+)=", "<$1>", 0, 0, 1, 10, "<a><b><cd>")
+	TEST_REGSUB(759, "ab ab", "(a)(b)", "\\u$1\\Q$2.\\E", 0, 0, 1, 9, "Ab\\. Ab\\.")
+
+	{
+		int calls = 0;
+
+		TEST_ACT(760, a = str_create("x1 y22 z333"))
+		else
+		{
+			TEST_STR(760, str_regsub_callback("[0-9]+", regsub_double, &calls, a, 0, 0, 1), a, 11, "x2 y44 z666")
+			TEST_ACT(760, calls == 3)
+			str_destroy(&a);
+		}
+
+		calls = 0;
+
+		TEST_ACT(761, a = str_create("x1 y22 z333"))
+		else
+		{
+			TEST_ACT(761, !str_regsub_callback("[0-9]+", regsub_fail, &calls, a, 0, 0, 1) && errno == ERANGE)
+			CHECK_STR(761, str_regsub_callback("[0-9]+", regsub_fail, &calls, a, 0, 0, 1), a, 11, "x1 y22 z333")
+			str_destroy(&a);
+		}
+
+		TEST_ACT(762, a = str_create("abc"))
+		else
+		{
+			TEST_ACT(762, !str_regsub("b", "\\E", a, 0, 0, 1) && errno == EINVAL)
+			CHECK_STR(762, str_regsub("b", "\\E", a, 0, 0, 1), a, 3, "abc")
+			str_destroy(&a);
+		}
+
+		/* Many matches in a long string (this used to take quadratic time) */
+
+		TEST_ACT(763, a = str_create_sized(300000, ""))
+		else
+		{
+			for (calls = 0; calls < 100000; ++calls)
+				str_append(a, "ab,");
+
+			TEST_ACT(763, str_regsub("b", "xy", a, 0, 0, 1))
+			TEST_ACT(763, str_length(a) == 400000 && !strncmp(cstr(a), "axy,axy,", 8) && !strcmp(cstr(a) + 399996, "axy,"))
+			str_destroy(&a);
+		}
+	}
+
+	/* The text after a match isn't the beginning of a line */
+
+#ifdef REG_STARTEND
+	TEST_REGSUB(764, "aaa", "^a", "x", 0, 0, 1, 3, "xaa")
+#endif
+
+	/* Test regex_create, regex_exec */
+
+#define TEST_REGEX(i, pat, cflags, text, len, eflags, ret, so, eo) \
+	TEST_ACT((i), rx = regex_create((pat), (cflags))) \
+	else \
+	{ \
+		TEST_EQ((i), regex_exec(rx, (text), (len), 1, m, (eflags)), (ret)) \
+		else if (rc == 0 && (m[0].rm_so != (so) || m[0].rm_eo != (eo))) \
+			++errors, printf("Test%d: regex_exec(\"%s\") failed (match is %d-%d, not %d-%d)\n", (i), (pat), (int)m[0].rm_so, (int)m[0].rm_eo, (so), (eo)); \
+		regex_destroy(&rx); \
+	}
+
+	TEST_REGEX(765, "X", 0, "abcXabc", 3, 0, REG_NOMATCH, 0, 0)
+	TEST_REGEX(766, "X", 0, "abcXabc", 7, 0, 0, 3, 4)
+	TEST_REGEX(767, "b", 0, "a\0b", 3, 0, 0, 2, 3)
+	TEST_REGEX(768, "abcd|bc", 0, "xabcd", 5, 0, 0, 1, 5)
+	TEST_REGEX(769, "^b", REG_NEWLINE, "a\nb", 3, 0, 0, 2, 3)
+	TEST_REGEX(770, "^b", 0, "a\nb", 3, 0, REG_NOMATCH, 0, 0)
+	TEST_REGEX(771, "hello", REG_ICASE, "say HeLLo", 9, 0, 0, 4, 9)
+	TEST_REGEX(772, "^a", 0, "aa", 2, REG_NOTBOL, REG_NOMATCH, 0, 0)
+	TEST_REGEX(773, "a$", 0, "aa", 2, REG_NOTEOL, REG_NOMATCH, 0, 0)
+	TEST_REGEX(774, "x{2,3}y?", 0, "axxxxy", 6, 0, 0, 1, 4)
+	TEST_REGEX(775, "[[:digit:]]+", 0, "ab123c", 6, 0, 0, 2, 5)
+
+	TEST_ACT(776, rx = regex_create("([a-z]+)=([0-9]+)", 0))
+	else
+	{
+		TEST_ACT(776, regex_is_dfa(rx))
+		TEST_EQ(776, regex_exec(rx, " key=42;", 8, 3, m, 0), 0)
+		TEST_ACT(776, m[0].rm_so == 1 && m[0].rm_eo == 7)
+		TEST_ACT(776, m[1].rm_so == 1 && m[1].rm_eo == 4)
+		TEST_ACT(776, m[2].rm_so == 5 && m[2].rm_eo == 7)
+		regex_destroy(&rx);
+	}
+
+	/* Back references aren't supported by the engine so regcomp() is used */
+
+	TEST_ACT(777, rx = regex_create("(a)\\1", 0))
+	else
+	{
+		TEST_ACT(777, !regex_is_dfa(rx))
+		TEST_EQ(777, regex_exec(rx, "baa", 3, 1, m, 0), 0)
+		TEST_ACT(777, m[0].rm_so == 1 && m[0].rm_eo == 3)
+		regex_destroy(&rx);
+	}
+
+	TEST_ACT(778, !regex_create("(", 0) && errno == REG_EPAREN)
+	TEST_EQ(778, regex_exec(NULL, "a", 1, 0, NULL, 0), REG_BADPAT)
+
+	/* Pathological patterns take linear time */
+
+	TEST_ACT(779, a = str_create("%s", ""))
+	else
+	{
+		for (i = 0; i < 5000; ++i)
+			str_append(a, "x");
+
+		TEST_ACT(779, rx = regex_create("(x+x+)+y", 0))
+		else
+		{
+			TEST_ACT(779, regex_is_dfa(rx))
+			TEST_EQ(779, regex_exec(rx, cstr(a), str_length(a), 1, m, 0), REG_NOMATCH)
+			regex_destroy(&rx);
+		}
+
+		str_destroy(&a);
+	}
+
+	/* REG_DFA with regexpr(), str_regsub() and regexpr_split() */
+
+	TEST_ACT(780, list = regexpr("a((.*)a(.*))a", "abcabcabc", REG_DFA, 0))
+	else
+	{
+		CHECK_LIST_LENGTH(780, regexpr(REG_DFA), list, 4)
+		CHECK_LIST_ITEM(780, regexpr(REG_DFA), 0, "abcabca")
+		CHECK_LIST_ITEM(780, regexpr(REG_DFA), 1, "bcabc")
+		list_destroy(&list);
+	}
+
+	TEST_REGSUB(781, "a1b22c333", "[0-9]+", "<$0>", REG_DFA, 0, 1, 15, "a<1>b<22>c<333>")
+	TEST_REGSUB(782, "aaa", "^a", "x", REG_DFA, 0, 1, 3, "xaa")
+	TEST_ACT(783, list = regexpr_split("a,b.c;d", "[ ,.;:]+", REG_DFA, 0))
+	else
+	{
+		CHECK_LIST_LENGTH(783, regexpr_split(REG_DFA), list, 4)
+		CHECK_LIST_ITEM(783, regexpr_split(REG_DFA), 0, "a")
+		CHECK_LIST_ITEM(783, regexpr_split(REG_DFA), 3, "d")
+		list_destroy(&list);
+	}
+
+	/* The engine agrees with regexec() */
+
+	{
+		static const char * const pats[] = { "a+b", "(ab|a)c", "[^x]*x", "b*", "^.", ".$", "(a|b)*c", "a.c", "[b-d]{2}" };
+		static const char * const texts[] = { "xaab", "abac", "ab\nxa", "", "c", "aaabbc", "xx\nac\n" };
+		regmatch_t n[1];
+		int j, k, r1, r2;
+
+		for (j = 0; j < sizeof pats / sizeof *pats; ++j)
+		{
+			if (!(rx = regex_create(pats[j], REG_NEWLINE)))
+			{
+				++errors, printf("Test784: regex_create(\"%s\") failed\n", pats[j]);
+				continue;
+			}
+
+			if (regcomp(re, pats[j], REG_EXTENDED | REG_NEWLINE))
+			{
+				++errors, printf("Test784: regcomp(\"%s\") failed\n", pats[j]);
+				regex_destroy(&rx);
+				continue;
+			}
+
+			for (k = 0; k < sizeof texts / sizeof *texts; ++k)
+			{
+				r1 = regex_exec(rx, texts[k], strlen(texts[k]), 1, m, 0);
+				r2 = regexec(re, texts[k], 1, n, 0);
+
+				if (r1 != r2 || (r1 == 0 && (m[0].rm_so != n[0].rm_so || m[0].rm_eo != n[0].rm_eo)))
+					++errors, printf("Test784: regex_exec(\"%s\", \"%s\") failed (returned %d, not %d)\n", pats[j], texts[k], r1, r2);
+			}
 
-	big = 1024;
-	TEST_ACT(115, a = str_create("abcDEFghiJKLmnoPQRstuVWXyz"))
-	TEST_ACT(115, trtable = tr_compile("a-zA-Z", "A-Za-z", 0))
-	for (i = 0; i < big; ++i)
+			regfree(re);
+			regex_destroy(&rx);
+		}
+	}
+
+	/* Test regexpr_grep */
+
+	TEST_ACT(785, a = str_create("%s", ""))
+	else
 	{
-		TEST_TR_DIRECT(115, tr_compiled(a->str, trtable), a, 26, 26, "ABCdefGHIjklMNOpqrSTUvwxYZ")
-		TEST_TR_DIRECT(115, tr_compiled(a->str, trtable), a, 26, 26, "abcDEFghiJKLmnoPQRstuVWXyz")
+		/* Enough lines for four threads */
+
+		for (i = 0; i < 20000; ++i)
+			str_append(a, (i % 7) ? "line %d is fine\n" : "line %d has an ERROR;\n", i);
+
+		TEST_ACT(785, list = regexpr_grep("ERROR", cstr(a), str_length(a), REG_NEWLINE, 0, 4, 1))
+		else
+		{
+			TEST_ACT(785, list_length(list) == 2858)
+			TEST_ACT(785, grep_item(list, 0, 0, 20))
+			TEST_ACT(785, grep_item(list, 1, 111, 131))
+
+			TEST_ACT(786, list2 = regexpr_grep("ERROR", cstr(a), str_length(a), REG_NEWLINE, 0, 1, 1))
+			TEST_ACT(786, grep_same(list, list2))
+			list_destroy(&list2);
+
+			TEST_ACT(787, list2 = regexpr_grep("ERROR", cstr(a), str_length(a), REG_NEWLINE | REG_DFA, 0, 4, 1))
+			TEST_ACT(787, grep_same(list, list2))
+			list_destroy(&list2);
+
+			TEST_ACT(788, list2 = str_regexpr_grep("^line [0-9]+ has", a, REG_NEWLINE, 0, 3, 1))
+			TEST_ACT(788, grep_same(list, list2))
+			list_destroy(&list2);
+
+			list_destroy(&list);
+		}
+
+		/* Matches rather than lines */
+
+		TEST_ACT(789, list = regexpr_grep("[0-9]+|$", cstr(a), str_length(a), REG_NEWLINE, 0, 1, 0))
+		else
+		{
+			TEST_ACT(789, list_length(list) == 40001)
+			TEST_ACT(789, grep_item(list, 0, 5, 6))
+			TEST_ACT(789, grep_item(list, 1, 20, 20))
+			TEST_ACT(789, grep_item(list, 2, 26, 27))
+
+			TEST_ACT(790, list2 = regexpr_grep("[0-9]+|$", cstr(a), str_length(a), REG_NEWLINE | REG_DFA, 0, 4, 0))
+			TEST_ACT(790, grep_same(list, list2))
+			list_destroy(&list2);
+
+			for (i = 0; i < 3; ++i)
+			{
+				TEST_EQ(791, regexpr_compile(res + i, "[0-9]+|$", REG_NEWLINE), 0)
+			}
+
+			TEST_ACT(791, list2 = regexpr_grep_compiled(res, 3, cstr(a), str_length(a), 0, 0))
+			TEST_ACT(791, grep_same(list, list2))
+			list_destroy(&list2);
+
+			for (i = 0; i < 3; ++i)
+				regfree(res + i);
+
+			list_destroy(&list);
+		}
+
+		/* Any search function */
+
+		for (i = 0; i < 4; ++i)
+			engines[i] = 0, engine[i] = &engines[i];
+
+		TEST_ACT(792, list = regexpr_grep_callback(grep_semicolon, engine, 4, cstr(a), str_length(a), 0, 0))
+		else
+		{
+			TEST_ACT(792, list_length(list) == 2858)
+			TEST_ACT(792, grep_item(list, 0, 19, 20))
+			TEST_ACT(792, engines[0] && engines[1] && engines[2] && engines[3])
+			list_destroy(&list);
+		}
+
+		str_destroy(&a);
 	}
-	TEST_ACT(115, !tr_destroy(&trtable))
-	str_destroy(&a);
 
-	TEST_ACT(116, a = str_create("\170\171\172\173\174\175\176\177\200\201\202\203\204\205\206\207\210"))
-	TEST_ACT(116, b = str_create("\200-\377"))
-	TEST_ACT(116, c = str_create("%c-\177", '\000'))
-	TEST_TR_DIRECT(116, str_tr_str(a, b, c, 0), a, 9, 17, "\170\171\172\173\174\175\176\177\000\001\002\003\004\005\006\007\010")
-	str_destroy(&a);
-	str_destroy(&b);
-	str_destroy(&c);
+	/* Lines at the ends of the text */
 
-#ifdef HAVE_REGEX_H
+	TEST_ACT(793, list = regexpr_grep("^$", "a\n\nb\n", 5, REG_NEWLINE, 0, 0, 1))
+	TEST_ACT(793, list && list_length(list) == 1 && grep_item(list, 0, 2, 2))
+	list_destroy(&list);
+	TEST_ACT(794, list = regexpr_grep("c$", "abc", 3, REG_NEWLINE | REG_DFA, 0, 0, 1))
+	TEST_ACT(794, list && list_length(list) == 1 && grep_item(list, 0, 0, 3))
+	list_destroy(&list);
+	TEST_ACT(795, list = regexpr_grep("x*", "ab", 2, 0, 0, 0, 0))
+	TEST_ACT(795, list && list_length(list) == 3 && grep_item(list, 2, 2, 2))
+	list_destroy(&list);
+	TEST_ACT(796, list = regexpr_grep("x*", "", 0, 0, 0, 0, 1))
+	TEST_ACT(796, list && list_length(list) == 0)
+	list_destroy(&list);
+	TEST_ACT(797, !regexpr_grep("(", "a", 1, 0, 0, 0, 0) && errno == REG_EPAREN)
+	TEST_ACT(797, !regexpr_grep("(", "a", 1, REG_DFA, 0, 0, 0) && errno == REG_EPAREN)
+	TEST_ACT(797, !regexpr_grep_callback(grep_semicolon, engine, 0, "a", 1, 0, 0) && errno == EINVAL)
 
-	/* Test str_regexpr */
+	/* Matches that cross chunk boundaries (and 64KiB) without REG_NEWLINE */
 
-	TEST_ACT(117, a = str_create("abcabcabc"))
+	TEST_ACT(854, a = str_create("%s", ""))
 	else
 	{
-		TEST_ACT(117, list = str_regexpr("a((.*)a(.*))a", a, 0, 0))
+		for (i = 0; i < 20000; ++i)
+			str_append(a, (i % 50 == 0) ? "line %d <opens\n" : (i % 50 == 30 && (i < 3000 || i > 17000)) ? "line %d closes>\n" : "line %d is fine\n", i);
+
+		TEST_ACT(854, list = regexpr_grep("<[^>]*>", cstr(a), str_length(a), 0, 0, 1, 0))
 		else
 		{
-			CHECK_LIST_LENGTH(117, str_regexpr(), list, 4)
-			CHECK_LIST_ITEM(117, str_regexpr("a((.*)a(.*))a", "abcabcabc"), 0, "abcabca")
-			CHECK_LIST_ITEM(117, str_regexpr("a((.*)a(.*))a", "abcabcabc"), 1, "bcabc")
-			CHECK_LIST_ITEM(117, str_regexpr("a((.*)a(.*))a", "abcabcabc"), 2, "bc")
-			CHECK_LIST_ITEM(117, str_regexpr("a((.*)a(.*))a", "abcabcabc"), 3, "bc")
+			for (i = 0; i < list_length(list); ++i)
+				if (((regmatch_t *)list_item(list, i))->rm_so < 65536 && ((regmatch_t *)list_item(list, i))->rm_eo > 65536)
+					break;
+
+			TEST_ACT(854, i < list_length(list))
+			TEST_ACT(854, list_length(list) == 120)
+
+			TEST_ACT(855, list2 = regexpr_grep("<[^>]*>", cstr(a), str_length(a), 0, 0, 4, 0))
+			TEST_ACT(855, grep_same(list, list2))
+			list_destroy(&list2);
+
+			TEST_ACT(856, list2 = regexpr_grep("<[^>]*>", cstr(a), str_length(a), REG_DFA, 0, 4, 0))
+			TEST_ACT(856, grep_same(list, list2))
+			list_destroy(&list2);
+
+			for (i = 0; i < 3; ++i)
+			{
+				TEST_EQ(857, regexpr_compile(res + i, "<[^>]*>", 0), 0)
+			}
+
+			TEST_ACT(857, list2 = regexpr_grep_compiled(res, 3, cstr(a), str_length(a), 0, 0))
+			TEST_ACT(857, grep_same(list, list2))
+			list_destroy(&list2);
+
+			for (i = 0; i < 3; ++i)
+				regfree(res + i);
+
 			list_destroy(&list);
 		}
 
+		/* Empty matches and matches that end exactly at chunk boundaries */
+
+		TEST_ACT(858, list = regexpr_grep("[0-9]+\n|x*", cstr(a), str_length(a), 0, 0, 1, 0))
+		TEST_ACT(858, list2 = regexpr_grep("[0-9]+\n|x*", cstr(a), str_length(a), 0, 0, 4, 0))
+		TEST_ACT(858, grep_same(list, list2))
+		list_destroy(&list);
+		list_destroy(&list2);
+
 		str_destroy(&a);
 	}
 
-	/* Test str_regsub */
+	/* A newline in the pattern matches one even with REG_NEWLINE */
 
-#define TEST_REGSUB(i, str, pat, rep, cflags, eflags, all, len, res) \
-	TEST_ACT((i), a = str_create("%s", (str))) \
-	else \
-	{ \
-		TEST_STR((i), str_regsub((pat), (rep), a, (cflags), (eflags), (all)), a, (len), (res)) \
-		str_destroy(&a); \
+	TEST_ACT(861, t = mem_create(200004, char))
+	else
+	{
+		memset(t, 'x', 200003);
+		t[200003] = '\0';
+		memcpy(t + 100000, "c\na", 3);
+
+		TEST_ACT(861, list = regexpr_grep("c\na", t, 200003, REG_NEWLINE, 0, 1, 0))
+		TEST_ACT(861, list && list_length(list) == 1 && grep_item(list, 0, 100000, 100003))
+		list_destroy(&list);
+		TEST_ACT(861, list = regexpr_grep("c\na", t, 200003, REG_NEWLINE, 0, 2, 0))
+		TEST_ACT(861, list && list_length(list) == 1 && grep_item(list, 0, 100000, 100003))
+		list_destroy(&list);
+		TEST_ACT(861, list = regexpr_grep("c\na", t, 200003, REG_NEWLINE | REG_DFA, 0, 2, 0))
+		TEST_ACT(861, list && list_length(list) == 1 && grep_item(list, 0, 100000, 100003))
+		list_destroy(&list);
+		TEST_ACT(861, list = regexpr_grep("c\na", t, 200003, REG_NEWLINE | REG_DFA, 0, 2, 1))
+		TEST_ACT(861, list && list_length(list) == 1 && grep_item(list, 0, 0, 100001))
+		list_destroy(&list);
+		TEST_ACT(862, list = regexpr_grep("c[[:space:]]a", t, 200003, REG_NEWLINE, 0, 2, 0))
+		TEST_ACT(862, list && list_length(list) == 1 && grep_item(list, 0, 100000, 100003))
+		list_destroy(&list);
+		TEST_ACT(862, list = regexpr_grep("c[^x]a", t, 200003, REG_NEWLINE | REG_DFA, 0, 2, 0))
+		TEST_ACT(862, list && list_length(list) == 0)
+		list_destroy(&list);
+
+		mem_release(t);
 	}
 
-	TEST_REGSUB(118, "xabcabcabcx", "a((.*)a(.*))a", "$0", 0, 0, 0, 11, "xabcabcabcx")
-	TEST_REGSUB(119, "xabcabcabcx", "a((.*)a(.*))a", "$$$2${3}!", 0, 0, 0, 10, "x$bcbc!bcx")
-	TEST_REGSUB(120, "xabcabcabcx", "a((.*)a(.*))a", "$$$2$31!", 0, 0, 0, 11, "x$bcbc1!bcx")
-	TEST_REGSUB(121, "xabcabcabcx", "a", "z", 0, 0, 0, 11, "xzbcabcabcx")
-	TEST_REGSUB(122, "xabcabcabcx", "a", "z", 0, 0, 1, 11, "xzbczbczbcx")
-	TEST_REGSUB(123, "aba", "a", "z", 0, 0, 0, 3, "zba")
-	TEST_REGSUB(124, "aba", "a", "z", 0, 0, 1, 3, "zbz")
-	TEST_REGSUB(125, "xabcabcabcx", "((((((((((((((((((((((((((((((((a))))))))))))))))))))))))))))))))", "!${32}!", 0, 0, 0, 13, "x!a!bcabcabcx")
-	TEST_REGSUB(126, "xabcabcabcx", "((((((((((((((((((((((((((((((((a))))))))))))))))))))))))))))))))", "!${32}!", 0, 0, 1, 17, "x!a!bc!a!bc!a!bcx")
-	TEST_REGSUB(127, "\\a:b:c:d:e:f:G:H:I:", "(...)(..)(..)(..)(..)(..)(..)(..)(..)", "$1\\U$2\\Q$3\\l$4\\E$5\\E$6\\L$7\\Q\\u$8\\E\\E$9\\\\l", 0, 0, 0, 24, "\\a:B:C\\:d\\:E:f:g:H\\:I:\\l")
-	TEST_REGSUB(128, "abcdef", "()", "-", 0, 0, 0, 7, "-abcdef")
-	TEST_REGSUB(129, "abcdef", "()", "-", 0, 0, 1, 13, "-a-b-c-d-e-f-")
-
 #endif
 
 	/* Test fmt */
@@ -9085,6 +15266,604 @@ int main(int ac, char **av)
 	TEST_ENCODE(378, "", "=", "=", '\\', 0, 0, "")
 	TEST_ENCODE(379, "a=b", "=", "=", '\\', 0, 4, "a\\=b")
 
+	/* Test hex_encode, hex_decode, base64_encode, base64_decode */
+
+	TEST_EQ(798, hex_encode(tst, "\000\001\253\377", 4), 8)
+	TEST_ACT(798, !memcmp(tst, "0001abff", 8))
+	TEST_EQ(798, hex_decode(tst, "0001ABff", 8), 4)
+	TEST_ACT(798, !memcmp(tst, "\000\001\253\377", 4))
+	TEST_EQ(799, hex_decode(NULL, "abc", 3), -1)
+	TEST_EQ(799, hex_decode(tst, "0g", 2), -1)
+
+	/* Long enough for the SIMD kernels, compared with short (scalar) ones */
+
+	TEST_ACT(800, a = str_create("%s", ""))
+	else
+	{
+		char hex[3];
+
+		for (i = 0; i < 1000; ++i)
+			str_append(a, "%c", (char)(i * 7 + i / 256));
+
+		TEST_ACT(800, b = str_hex_encode(a))
+		else
+		{
+			TEST_ACT(800, str_length(b) == 2000)
+
+			for (i = 0; i < 1000; ++i)
+			{
+				hex_encode(hex, cstr(a) + i, 1);
+
+				if (memcmp(cstr(b) + 2 * i, hex, 2))
+				{
+					++errors, printf("Test800: str_hex_encode() failed (byte %d)\n", i);
+					break;
+				}
+			}
+
+			TEST_ACT(800, c = str_hex_decode(b))
+			else
+			{
+				TEST_ACT(800, str_length(c) == 1000 && !memcmp(cstr(c), cstr(a), 1000))
+				str_destroy(&c);
+			}
+
+			/* A bad digit in a SIMD block */
+
+			str_uc(b);
+			TEST_ACT(801, c = str_hex_decode(b))
+			TEST_ACT(801, c && str_length(c) == 1000 && !memcmp(cstr(c), cstr(a), 1000))
+			str_destroy(&c);
+			cstr(b)[100] = 'g';
+			TEST_ACT(801, !str_hex_decode(b) && errno == EINVAL)
+			str_destroy(&b);
+		}
+
+		TEST_ACT(802, b = str_base64_encode(a, 0))
+		else
+		{
+			TEST_ACT(802, str_length(b) == 1336)
+
+			for (i = 0; i < 999; i += 3)
+			{
+				base64_encode(tst, cstr(a) + i, 3, 0);
+
+				if (memcmp(cstr(b) + i / 3 * 4, tst, 4))
+				{
+					++errors, printf("Test802: str_base64_encode() failed (byte %d)\n", i);
+					break;
+				}
+			}
+
+			TEST_ACT(802, c = str_base64_decode(b, 0))
+			else
+			{
+				TEST_ACT(802, str_length(c) == 1000 && !memcmp(cstr(c), cstr(a), 1000))
+				str_destroy(&c);
+			}
+
+			cstr(b)[100] = '-';
+			TEST_ACT(802, !str_base64_decode(b, 0) && errno == EINVAL)
+			str_destroy(&b);
+		}
+
+		TEST_ACT(803, b = str_base64_encode(a, 1))
+		else
+		{
+			TEST_ACT(803, str_length(b) == 1334 && !strchr(cstr(b), '+') && !strchr(cstr(b), '/') && !strchr(cstr(b), '='))
+			TEST_ACT(803, c = str_base64_decode(b, 1))
+			else
+			{
+				TEST_ACT(803, str_length(c) == 1000 && !memcmp(cstr(c), cstr(a), 1000))
+				str_destroy(&c);
+			}
+
+			str_destroy(&b);
+		}
+
+		str_destroy(&a);
+	}
+
+	/* RFC 4648 test vectors */
+
+#define TEST_BASE64(i, str, url, len, val) \
+	TEST_ACT((i), a = str_create("%s", (str))) \
+	else \
+	{ \
+		TEST_ACT((i), b = str_base64_encode(a, (url))) \
+		CHECK_STR((i), str_base64_encode(str, url), b, (len), (val)) \
+		TEST_ACT((i), c = str_base64_decode(b, (url))) \
+		CHECK_STR((i), str_base64_decode(val, url), c, strlen(str), (str)) \
+		str_destroy(&c); \
+		str_destroy(&b); \
+		str_destroy(&a); \
+	}
+
+	TEST_BASE64(804, "", 0, 0, "")
+	TEST_BASE64(805, "f", 0, 4, "Zg==")
+	TEST_BASE64(806, "fo", 0, 4, "Zm8=")
+	TEST_BASE64(807, "foo", 0, 4, "Zm9v")
+	TEST_BASE64(808, "foob", 0, 8, "Zm9vYg==")
+	TEST_BASE64(809, "fooba", 0, 8, "Zm9vYmE=")
+	TEST_BASE64(810, "foobar", 0, 8, "Zm9vYmFy")
+	TEST_BASE64(811, "f", 1, 2, "Zg")
+	TEST_BASE64(812, "fooba", 1, 7, "Zm9vYmE")
+	TEST_BASE64(813, "\373\377", 0, 4, "+/8=")
+	TEST_BASE64(814, "\373\377", 1, 3, "-_8")
+
+	TEST_EQ(815, base64_decode(tst, "Zm8", 3, 0), 2)
+	TEST_EQ(815, base64_decode(tst, "Zm8=", 4, 1), 2)
+	TEST_EQ(816, base64_decode(tst, "Zm9", 2, 0), 1)
+	TEST_EQ(816, base64_decode(tst, "Z", 1, 0), -1)
+	TEST_EQ(816, base64_decode(tst, "Zg=", 3, 0), -1)
+	TEST_EQ(816, base64_decode(tst, "Z===", 4, 0), -1)
+	TEST_EQ(816, base64_decode(tst, "Zg==Zg==", 8, 0), -1)
+	TEST_EQ(816, base64_decode(tst, "-_8", 3, 0), -1)
+	TEST_EQ(816, base64_decode(tst, "+/8", 3, 1), -1)
+
+	/* Long escapes (SIMD) compared with short ones (scalar) */
+
+	TEST_ACT(817, a = str_create("%s", ""))
+	else
+	{
+		String *expected = str_create("%s", "");
+
+		for (i = 0; i < 2000; ++i)
+		{
+			str_append(a, "%c", (i % 37 == 0) ? '\n' : (i % 41 == 0) ? '\\' : (i % 43 == 0) ? '\001' : 'a' + i % 26);
+			b = encode(cstr(a) + i, "\a\b\t\n\v\f\r\\", "abtnvfr\\", '\\', 1);
+			str_append_str(expected, b);
+			str_destroy(&b);
+		}
+
+		TEST_ACT(817, b = str_encode(a, "\a\b\t\n\v\f\r\\", "abtnvfr\\", '\\', 1))
+		TEST_ACT(817, b && str_length(b) == str_length(expected) && !memcmp(cstr(b), cstr(expected), str_length(b)))
+		TEST_ACT(817, c = str_decode(b, "\a\b\t\n\v\f\r\\", "abtnvfr\\", '\\', 1))
+		TEST_ACT(817, c && str_length(c) == 2000 && !memcmp(cstr(c), cstr(a), 2000))
+		str_destroy(&c);
+		str_destroy(&b);
+
+		/* Without printable, only the uncoded characters are encoded */
+
+		TEST_ACT(818, b = str_encode(a, "\n\\", "n\\", '\\', 0))
+		TEST_ACT(818, b && str_length(b) == 2102)
+		TEST_ACT(818, c = str_decode(b, "\n\\", "n\\", '\\', 0))
+		TEST_ACT(818, c && str_length(c) == 2000 && !memcmp(cstr(c), cstr(a), 2000))
+		str_destroy(&c);
+		str_destroy(&b);
+		str_destroy(&expected);
+		str_destroy(&a);
+	}
+
+
+	/* Test utf8_valid, utf8_length, utf8_boundary, utf8_truncate */
+
+#define TEST_UTF8(i, s, valid, offset) \
+	pos = 12345; \
+	TEST_EQ((i), utf8_valid((s), sizeof(s) - 1, &pos), (valid)) \
+	if (!(valid) && pos != (offset)) \
+		++errors, printf("Test%d: utf8_valid(\"%s\") failed: offset %d, not %d\n", (i), (s), (int)pos, (offset));
+
+	TEST_UTF8(819, "", 1, 0)
+	TEST_UTF8(819, "abc", 1, 0)
+	TEST_UTF8(819, "h\xc3\xa9llo", 1, 0)
+	TEST_UTF8(819, "\xe2\x82\xac", 1, 0)
+	TEST_UTF8(819, "\xf0\x9f\x98\x80", 1, 0)
+	TEST_UTF8(819, "\xed\x9f\xbf\xee\x80\x80\xef\xbf\xbf\xf4\x8f\xbf\xbf", 1, 0)
+	TEST_UTF8(820, "\xc0\xaf", 0, 0)
+	TEST_UTF8(820, "ab\xe0\x80\xaf", 0, 2)
+	TEST_UTF8(820, "abc\xed\xa0\x80", 0, 3)
+	TEST_UTF8(820, "\xf0\x8f\xbf\xbf", 0, 0)
+	TEST_UTF8(820, "\xf4\x90\x80\x80", 0, 0)
+	TEST_UTF8(820, "x\xf5\x80\x80\x80", 0, 1)
+	TEST_UTF8(820, "ab\x80", 0, 2)
+	TEST_UTF8(820, "ab\xe2\x82", 0, 2)
+	TEST_UTF8(820, "\xc3\xa9\xc3", 0, 2)
+	TEST_UTF8(820, "\xc3\xa9\xff", 0, 2)
+	TEST_EQ(820, utf8_valid(NULL, 1, NULL), -1)
+
+	for (i = 0; i < 100; ++i)
+		memcpy(tst + i * 8, "\xc3\xa9" "abc\xe2\x82\xac", 8);
+
+	TEST_EQ(821, utf8_valid(tst, 800, NULL), 1)
+	TEST_EQ(821, utf8_valid(tst, 799, &pos), 0)
+	TEST_ACT(821, pos == 797)
+	TEST_EQ(821, utf8_valid(tst + 1, 799, &pos), 0)
+	TEST_ACT(821, pos == 0)
+	tst[518] = 'x';
+	TEST_EQ(821, utf8_valid(tst, 800, &pos), 0)
+	TEST_ACT(821, pos == 517)
+	tst[518] = '\x82';
+	memset(tst + 800, 'a', 200);
+	TEST_EQ(821, utf8_valid(tst, 1000, NULL), 1)
+	tst[799] = 'a';
+	TEST_EQ(821, utf8_valid(tst, 1000, &pos), 0)
+	TEST_ACT(821, pos == 797)
+	tst[799] = '\xac';
+
+	TEST_ACT(822, utf8_length("", 0) == 0)
+	TEST_ACT(822, utf8_length("h\xc3\xa9llo", 6) == 5)
+	TEST_ACT(822, utf8_length("\xf0\x9f\x98\x80\xe2\x82\xac", 7) == 2)
+	TEST_ACT(822, utf8_length(tst, 800) == 500)
+	TEST_ACT(822, utf8_length(tst, 1000) == 700)
+
+	TEST_ACT(823, utf8_boundary("h\xc3\xa9llo", 6, 0) == 0)
+	TEST_ACT(823, utf8_boundary("h\xc3\xa9llo", 6, 1) == 1)
+	TEST_ACT(823, utf8_boundary("h\xc3\xa9llo", 6, 2) == 1)
+	TEST_ACT(823, utf8_boundary("h\xc3\xa9llo", 6, 3) == 3)
+	TEST_ACT(823, utf8_boundary("h\xc3\xa9llo", 6, 6) == 6)
+	TEST_ACT(823, utf8_boundary("h\xc3\xa9llo", 6, 100) == 6)
+	TEST_ACT(823, utf8_boundary("\xf0\x9f\x98\x80", 4, 3) == 0)
+	TEST_ACT(823, utf8_boundary("\x80\x80\x80\x80\x80", 5, 4) == 1)
+	strcpy(tst, "caf\xc3\xa9");
+	TEST_ACT(823, utf8_truncate(tst, 4) && !strcmp(tst, "caf"))
+	strcpy(tst, "caf\xc3\xa9");
+	TEST_ACT(823, utf8_truncate(tst, 5) && !strcmp(tst, "caf\xc3\xa9"))
+
+	TEST_ACT(824, a = str_create("na\xc3\xafve \xe2\x82\xac"))
+	TEST_EQ(824, str_utf8_valid(a, NULL), 1)
+	TEST_ACT(824, str_utf8_length(a) == 7)
+	TEST_STR(824, str_utf8_truncate(a, 9), a, 7, "na\xc3\xafve ")
+	TEST_STR(824, str_utf8_truncate(a, 2), a, 2, "na")
+	TEST_ACT(824, str_append(a, "\xc3"))
+	TEST_EQ(824, str_utf8_valid(a, &pos), 0)
+	TEST_ACT(824, pos == 2)
+	str_destroy(&a);
+
+	/* Test fmt_utf8, trim_utf8 */
+
+	TEST_ACT(825, list = fmt_utf8("\xc3\xa9t\xc3\xa9 caf\xc3\xa9 na\xc3\xafve", 9, ALIGN_LEFT))
+	CHECK_LIST_LENGTH(825, fmt_utf8(ALIGN_LEFT), list, 2)
+	CHECK_LIST_ITEM(825, fmt_utf8(ALIGN_LEFT), 0, "\xc3\xa9t\xc3\xa9 caf\xc3\xa9")
+	CHECK_LIST_ITEM(825, fmt_utf8(ALIGN_LEFT), 1, "na\xc3\xafve")
+	list_destroy(&list);
+
+	TEST_ACT(825, list = fmt("\xc3\xa9t\xc3\xa9 caf\xc3\xa9 na\xc3\xafve", 9, ALIGN_LEFT))
+	CHECK_LIST_LENGTH(825, fmt(ALIGN_LEFT), list, 3)
+	list_destroy(&list);
+
+	TEST_ACT(825, list = fmt_utf8("\xc3\xa9t\xc3\xa9 caf\xc3\xa9 na\xc3\xafve", 9, ALIGN_RIGHT))
+	CHECK_LIST_LENGTH(825, fmt_utf8(ALIGN_RIGHT), list, 2)
+	CHECK_LIST_ITEM(825, fmt_utf8(ALIGN_RIGHT), 0, " \xc3\xa9t\xc3\xa9 caf\xc3\xa9")
+	CHECK_LIST_ITEM(825, fmt_utf8(ALIGN_RIGHT), 1, "    na\xc3\xafve")
+	list_destroy(&list);
+
+	TEST_ACT(825, list = fmt_utf8("\xc3\xa9t\xc3\xa9 caf\xc3\xa9 na\xc3\xafve x", 9, ALIGN_FULL))
+	CHECK_LIST_LENGTH(825, fmt_utf8(ALIGN_FULL), list, 2)
+	CHECK_LIST_ITEM(825, fmt_utf8(ALIGN_FULL), 0, "\xc3\xa9t\xc3\xa9  caf\xc3\xa9")
+	CHECK_LIST_ITEM(825, fmt_utf8(ALIGN_FULL), 1, "na\xc3\xafve x")
+	list_destroy(&list);
+
+	TEST_ACT(825, list = fmt_utf8("\xc3\xa9t\xc3\xa9\n caf\xc3\xa9 ", 9, ALIGN_CENTRE))
+	CHECK_LIST_LENGTH(825, fmt_utf8(ALIGN_CENTRE), list, 2)
+	CHECK_LIST_ITEM(825, fmt_utf8(ALIGN_CENTRE), 0, "   \xc3\xa9t\xc3\xa9")
+	CHECK_LIST_ITEM(825, fmt_utf8(ALIGN_CENTRE), 1, "  caf\xc3\xa9")
+	list_destroy(&list);
+
+	TEST_ACT(826, list = fmt_utf8("a\xe3\x80\x80" "b\xe2\x80\x83" "c\xc2\xa0" "d  ", 1, ALIGN_LEFT))
+	CHECK_LIST_LENGTH(826, fmt_utf8(U+3000, U+2003, U+00A0), list, 3)
+	CHECK_LIST_ITEM(826, fmt_utf8(U+3000, U+2003, U+00A0), 0, "a")
+	CHECK_LIST_ITEM(826, fmt_utf8(U+3000, U+2003, U+00A0), 1, "b")
+	CHECK_LIST_ITEM(826, fmt_utf8(U+3000, U+2003, U+00A0), 2, "c\xc2\xa0" "d")
+	list_destroy(&list);
+
+	TEST_ACT(826, list = fmt("abc  ", 10, ALIGN_LEFT))
+	CHECK_LIST_LENGTH(826, fmt(trailing spaces), list, 1)
+	CHECK_LIST_ITEM(826, fmt(trailing spaces), 0, "abc")
+	list_destroy(&list);
+
+	TEST_ACT(827, a = str_create("\xe3\x80\x80 \xc2\xa0" "a \xc2\xa0" "b\xe2\x80\xa8\t\xe2\x80\xaf"))
+	TEST_STR(827, str_trim_utf8(a), a, 5, "a \xc2\xa0" "b")
+	TEST_STR(827, str_trim_utf8(a), a, 5, "a \xc2\xa0" "b")
+	str_destroy(&a);
+	TEST_ACT(827, a = str_create("\xc2\x85\xe1\x9a\x80 \xe2\x81\x9f"))
+	TEST_STR(827, str_trim_utf8(a), a, 0, "")
+	str_destroy(&a);
+	strcpy(tst, "\xe2\x80\x80\xe2\x80\x8a" "caf\xc3\xa9\xe3\x80\x80");
+	TEST_ACT(827, !strcmp(trim_utf8(tst), "caf\xc3\xa9"))
+	strcpy(tst, " \xc2\xa0 ");
+	TEST_ACT(827, !strcmp(trim_utf8(tst), ""))
+	strcpy(tst, "\xc2\xa0x");
+	TEST_ACT(827, !strcmp(trim(tst), "\xc2\xa0x"))
+
+	/* Test parse_ulong, parse_long, parse_double */
+
+	{
+		unsigned long ul;
+		long l;
+		double d;
+
+#define TEST_PARSE(i, func, str, length, base, ret, val) \
+		TEST_EQ((i), func((str), (length), (base), &l), (ret)) \
+		if ((ret) != -1 && l != (val)) \
+			++errors, printf("Test%d: %s(\"%s\") failed: value %ld, not %ld\n", (i), #func, (str), (long)l, (long)(val));
+
+		TEST_EQ(828, parse_ulong("12345", 5, 10, &ul), 5)
+		TEST_ACT(828, ul == 12345)
+		TEST_PARSE(828, parse_long, "123abc", 6, 10, 3, 123)
+		TEST_PARSE(828, parse_long, "12345", 3, 10, 3, 123)
+		TEST_PARSE(828, parse_long, "ff", 2, 16, 2, 255)
+		TEST_PARSE(828, parse_long, "0xff", 4, 16, 4, 255)
+		TEST_PARSE(828, parse_long, "0XfF", 4, 0, 4, 255)
+		TEST_PARSE(828, parse_long, "0b101", 5, 0, 5, 5)
+		TEST_PARSE(828, parse_long, "0b101", 5, 2, 5, 5)
+		TEST_PARSE(828, parse_long, "017", 3, 0, 3, 15)
+		TEST_PARSE(828, parse_long, "019", 3, 0, 2, 1)
+		TEST_PARSE(828, parse_long, "0x", 2, 0, 1, 0)
+		TEST_PARSE(828, parse_long, "zz", 2, 36, 2, 1295)
+		TEST_PARSE(828, parse_long, "-42", 3, 10, 3, -42)
+		TEST_PARSE(828, parse_long, "+7", 2, 10, 2, 7)
+		TEST_PARSE(828, parse_long, "-0x10", 5, 16, 5, -16)
+		TEST_PARSE(829, parse_long, "", 0, 10, -1, 0)
+		TEST_PARSE(829, parse_long, "-", 1, 10, -1, 0)
+		TEST_PARSE(829, parse_long, "x1", 2, 10, -1, 0)
+		TEST_PARSE(829, parse_long, "1", 1, 1, -1, 0)
+		TEST_PARSE(829, parse_long, "1", 1, 37, -1, 0)
+		TEST_EQ(829, parse_ulong("-1", 2, 10, &ul), -1)
+		TEST_EQ(829, parse_ulong("1", 1, 10, NULL), -1)
+
+		snprintf(tst, sizeof tst, "%lu", ULONG_MAX);
+		TEST_EQ(830, parse_ulong(tst, strlen(tst), 10, &ul), (int)strlen(tst))
+		TEST_ACT(830, ul == ULONG_MAX)
+		strcat(tst, "0");
+		ul = 0;
+		TEST_EQ(830, parse_ulong(tst, strlen(tst), 10, &ul), -1)
+		TEST_ACT(830, errno == ERANGE && ul == ULONG_MAX)
+		snprintf(tst, sizeof tst, "%ld", LONG_MIN);
+		TEST_PARSE(830, parse_long, tst, strlen(tst), 10, (int)strlen(tst), LONG_MIN)
+		snprintf(tst, sizeof tst, "%lu", (unsigned long)LONG_MAX + 1);
+		TEST_EQ(830, parse_long(tst, strlen(tst), 10, &l), -1)
+		TEST_ACT(830, errno == ERANGE && l == LONG_MAX)
+
+#define TEST_PARSE_DOUBLE(i, str, length, ret, val) \
+		d = -1.0; \
+		TEST_EQ((i), parse_double((str), (length), &d), (ret)) \
+		if ((ret) != -1 && d != (val)) \
+			++errors, printf("Test%d: parse_double(\"%s\") failed: value %.17g, not %.17g\n", (i), (str), d, (double)(val));
+
+		TEST_PARSE_DOUBLE(831, "3.14159", 7, 7, 3.14159)
+		TEST_PARSE_DOUBLE(831, "0.1", 3, 3, 0.1)
+		TEST_PARSE_DOUBLE(831, "-0.5e2", 6, 6, -50.0)
+		TEST_PARSE_DOUBLE(831, "+12E-1", 6, 6, 1.2)
+		TEST_PARSE_DOUBLE(831, ".5", 2, 2, 0.5)
+		TEST_PARSE_DOUBLE(831, "5.", 2, 2, 5.0)
+		TEST_PARSE_DOUBLE(831, "1.5x", 4, 3, 1.5)
+		TEST_PARSE_DOUBLE(831, "1e", 2, 1, 1.0)
+		TEST_PARSE_DOUBLE(831, "2e+", 3, 1, 2.0)
+		TEST_PARSE_DOUBLE(831, "12345", 2, 2, 12.0)
+		TEST_PARSE_DOUBLE(831, "000000000000000000000000001.5", 29, 29, 1.5)
+		TEST_PARSE_DOUBLE(831, "0.000000000000000000000000001", 29, 29, 1e-27)
+		TEST_PARSE_DOUBLE(832, "1e23", 4, 4, 1e23)
+		TEST_PARSE_DOUBLE(832, "9007199254740993", 16, 16, 9007199254740993.0)
+		TEST_PARSE_DOUBLE(832, "1234567890123456789012345", 25, 25, 1234567890123456789012345.0)
+		TEST_PARSE_DOUBLE(832, "2.2250738585072014e-308", 23, 23, 2.2250738585072014e-308)
+		TEST_PARSE_DOUBLE(832, "4.9e-324", 8, 8, 4.9e-324)
+		TEST_PARSE_DOUBLE(832, "1e-400", 6, 6, 0.0)
+		TEST_PARSE_DOUBLE(832, "1.7976931348623157e308", 22, 22, DBL_MAX)
+		TEST_PARSE_DOUBLE(832, "0x1.8p1", 7, 7, 3.0)
+		TEST_PARSE_DOUBLE(833, "inf", 3, 3, HUGE_VAL)
+		TEST_PARSE_DOUBLE(833, "-Infinity", 9, 9, -HUGE_VAL)
+		TEST_PARSE_DOUBLE(833, "infinite", 8, 3, HUGE_VAL)
+		TEST_EQ(833, parse_double("NaN", 3, &d), 3)
+		TEST_ACT(833, d != d)
+		TEST_EQ(833, parse_double("1e309", 5, &d), -1)
+		TEST_ACT(833, errno == ERANGE && d == HUGE_VAL)
+		TEST_EQ(833, parse_double("-1e309", 6, &d), -1)
+		TEST_ACT(833, errno == ERANGE && d == -HUGE_VAL)
+		TEST_PARSE_DOUBLE(833, "", 0, -1, 0.0)
+		TEST_PARSE_DOUBLE(833, ".", 1, -1, 0.0)
+		TEST_PARSE_DOUBLE(833, "-e5", 3, -1, 0.0)
+		TEST_PARSE_DOUBLE(833, "in", 2, -1, 0.0)
+
+		TEST_EQ(834, hex("100000000"), -1)
+		TEST_ACT(834, errno == ERANGE)
+		TEST_EQ(834, bin("102"), -1)
+		TEST_ACT(834, errno == EINVAL)
+		TEST_EQ(834, bin(""), 0)
+		TEST_EQ(834, hex("0x"), 0)
+		TEST_EQ(834, oct("0"), 0)
+	}
+
+	/* Test copy-on-write buffers */
+
+	TEST_ACT(835, a = str_create("hello world"))
+	TEST_ACT(835, b = str_share(a))
+	TEST_ACT(835, cstr(a) == cstr(b))
+	CHECK_STR(835, str_share(a), b, 11, "hello world")
+	TEST_ACT(836, str_append(b, "!"))
+	TEST_ACT(836, cstr(a) != cstr(b))
+	CHECK_STR(836, str_append(b, "!"), a, 11, "hello world")
+	CHECK_STR(836, str_append(b, "!"), b, 12, "hello world!")
+	str_destroy(&b);
+
+	TEST_ACT(837, b = str_share(a))
+	TEST_ACT(837, str_uc(b))
+	CHECK_STR(837, str_uc(b), a, 11, "hello world")
+	CHECK_STR(837, str_uc(b), b, 11, "HELLO WORLD")
+	str_destroy(&b);
+
+	TEST_ACT(838, b = str_share(a))
+	TEST_EQ(838, str_set_length(b, 5), 5)
+	CHECK_STR(838, str_set_length(b, 5), a, 11, "hello world")
+	CHECK_STR(838, str_set_length(b, 5), b, 5, "hello")
+	str_destroy(&b);
+
+	TEST_ACT(839, b = str_share(a))
+	TEST_ACT(839, str_replace(b, 0, 5, "HOWDY"))
+	CHECK_STR(839, str_replace(b, 0, 5, "HOWDY"), a, 11, "hello world")
+	CHECK_STR(839, str_replace(b, 0, 5, "HOWDY"), b, 11, "HOWDY world")
+	str_destroy(&b);
+
+	TEST_ACT(840, b = str_share(a))
+	TEST_ACT(840, str_remove_range(b, 0, 6))
+	CHECK_STR(840, str_remove_range(b, 0, 6), a, 11, "hello world")
+	CHECK_STR(840, str_remove_range(b, 0, 6), b, 5, "world")
+	str_destroy(&b);
+
+	TEST_ACT(841, b = str_share(a))
+	TEST_EQ(841, str_tr(b, "lo", "01", 0), 5)
+	CHECK_STR(841, str_tr(b, "lo", "01", 0), a, 11, "hello world")
+	CHECK_STR(841, str_tr(b, "lo", "01", 0), b, 11, "he001 w1r0d")
+	str_destroy(&b);
+
+#ifdef HAVE_REGEX_H
+	TEST_ACT(842, b = str_share(a))
+	TEST_ACT(842, str_regsub("o", "0", b, 0, 0, 1))
+	CHECK_STR(842, str_regsub("o", "0", b, 0, 0, 1), a, 11, "hello world")
+	CHECK_STR(842, str_regsub("o", "0", b, 0, 0, 1), b, 11, "hell0 w0rld")
+	str_destroy(&b);
+#endif
+
+	TEST_ACT(843, b = str_share(a))
+	TEST_ACT(843, c = str_share_unlocked(a))
+	TEST_ACT(843, cstr(c) == cstr(a))
+	str_destroy(&a);
+	CHECK_STR(843, str_destroy(&a), b, 11, "hello world")
+	CHECK_STR(843, str_destroy(&a), c, 11, "hello world")
+	t = cstr(b);
+	TEST_EQ(844, str_unshare(b), 0)
+	TEST_ACT(844, cstr(b) != t && cstr(c) == t)
+	TEST_EQ(844, str_unshare(c), 0)
+	TEST_ACT(844, cstr(c) == t)
+	CHECK_STR(844, str_unshare(b), b, 11, "hello world")
+	TEST_EQ(844, str_unshare(NULL), -1)
+	TEST_ACT(844, !str_share(NULL))
+	str_destroy(&b);
+	str_destroy(&c);
+
+	/* Test that plain copies can be shortened via cstr() */
+
+	TEST_ACT(860, a = str_create("hello world"))
+	TEST_ACT(860, b = str_copy(a))
+	TEST_ACT(860, c = str_substr(a, 0, -1))
+	TEST_ACT(860, cstr(b) != cstr(a) && cstr(c) != cstr(a))
+	cstr(b)[5] = '\0';
+	TEST_EQ(860, str_set_length(b, 5), 5)
+	CHECK_STR(860, str_set_length(b, 5), a, 11, "hello world")
+	CHECK_STR(860, str_set_length(b, 5), b, 5, "hello")
+	CHECK_STR(860, str_set_length(b, 5), c, 11, "hello world")
+	str_destroy(&a);
+	str_destroy(&b);
+	str_destroy(&c);
+
+	/* Test that copies can be made and released by multiple threads at once */
+
+	TEST_ACT(845, a = str_create("%*s", 4096, "shared"))
+	else
+	{
+		pthread_t tid[4];
+		void *failed;
+
+		for (i = 0; i < 4; ++i)
+			pthread_create(&tid[i], NULL, share, a);
+
+		for (i = 0; i < 4; ++i)
+		{
+			pthread_join(tid[i], &failed);
+			TEST_ACT(845, !failed)
+		}
+
+		TEST_ACT(845, b = str_share(a))
+		TEST_EQ(845, str_unshare(a), 0)
+		TEST_ACT(845, cstr(a) != cstr(b))
+		str_destroy(&a);
+		str_destroy(&b);
+	}
+
+	/* Test adopting buffers */
+
+	TEST_ACT(846, t = mem_create(16, char))
+	else
+	{
+		strcpy(t, "adopted");
+
+		TEST_ACT(846, a = str_adopt(t, 7, 16))
+		TEST_ACT(846, cstr(a) == t)
+		CHECK_STR(846, str_adopt(t, 7, 16), a, 7, "adopted")
+		TEST_ACT(846, str_append(a, "%*s", 100, "!"))
+		CHECK_STR(846, str_append(a, "%*s", 100, "!"), a, 107, "adopted                                                                                                   !")
+		TEST_ACT(846, b = str_share(a))
+		TEST_ACT(846, cstr(a) != cstr(b))
+		TEST_ACT(846, str_remove_range(a, 7, 100))
+		CHECK_STR(846, str_remove_range(a, 7, 100), a, 7, "adopted")
+#ifdef HAVE_REGEX_H
+		TEST_ACT(846, str_regsub("d", "D", a, 0, 0, 1))
+		CHECK_STR(846, str_regsub("d", "D", a, 0, 0, 1), a, 7, "aDopteD")
+		TEST_ACT(846, !a->adopted)
+#endif
+		str_destroy(&a);
+		str_destroy(&b);
+	}
+
+	TEST_ACT(847, !str_adopt(NULL, 0, 1))
+	TEST_ACT(847, errno == EINVAL)
+	TEST_ACT(847, !str_adopt("abc", 3, 3))
+	TEST_ACT(847, errno == EINVAL)
+
+	/* Test reserving and releasing memory */
+
+	TEST_ACT(848, a = str_create(""))
+	TEST_EQ(848, str_reserve(a, 10000), 0)
+	TEST_ACT(848, a->size >= 10000)
+	t = cstr(a);
+
+	for (i = 0; i < 9999; ++i)
+		if (!str_append(a, "x"))
+			break;
+
+	TEST_ACT(848, i == 9999 && cstr(a) == t)
+	TEST_ACT(848, str_clear(a))
+	TEST_ACT(848, a->size >= 10000)
+	TEST_EQ(848, str_shrink_to_fit(a), 0)
+	TEST_ACT(848, a->size == 1 && a->length == 1)
+	TEST_ACT(848, str_append(a, "abc"))
+	CHECK_STR(848, str_append(a, "abc"), a, 3, "abc")
+	TEST_EQ(848, str_reserve(NULL, 1), -1)
+	TEST_EQ(848, str_shrink_to_fit(NULL), -1)
+	str_destroy(&a);
+
+	/* Test shrinking hysteresis: a string only shrinks below a quarter full */
+
+	TEST_ACT(849, a = str_create("%*s", 4000, ""))
+	TEST_ACT(849, a->size == 4096)
+	TEST_ACT(849, str_remove_range(a, 0, 2000))
+	TEST_ACT(849, a->size == 4096)
+
+	for (i = 0; i < 100; ++i)
+		if (!str_append(a, "%*s", 100, "") || !str_remove_range(a, 0, 100) || a->size != 4096)
+			break;
+
+	TEST_ACT(849, i == 100)
+	TEST_ACT(849, str_remove_range(a, 0, 1100))
+	TEST_ACT(849, a->size == 2048 && str_length(a) == 900)
+	str_destroy(&a);
+
+	/* Test growth factor */
+
+	TEST_ACT(850, a = str_create(""))
+	TEST_ACT(850, a->size == 32)
+	TEST_EQ(850, str_set_growth(a, 50), 0)
+	TEST_ACT(850, str_append(a, "%*s", 32, ""))
+	TEST_ACT(850, a->size == 48)
+	TEST_ACT(850, str_append(a, "%*s", 16, ""))
+	TEST_ACT(850, a->size == 72)
+	TEST_EQ(850, str_set_growth(a, 0), -1)
+	TEST_EQ(850, str_set_growth(NULL, 100), -1)
+	str_destroy(&a);
+
+	/* Test reserving and releasing memory with a shared buffer */
+
+	TEST_ACT(851, a = str_create("shared"))
+	TEST_ACT(851, b = str_share(a))
+	TEST_EQ(851, str_shrink_to_fit(b), 0)
+	TEST_ACT(851, cstr(a) == cstr(b))
+	TEST_EQ(851, str_reserve(b, 4096), 0)
+	TEST_ACT(851, cstr(a) != cstr(b) && b->size == 4096)
+	CHECK_STR(851, str_reserve(b, 4096), a, 6, "shared")
+	CHECK_STR(851, str_reserve(b, 4096), b, 6, "shared")
+	str_destroy(&a);
+	str_destroy(&b);
+
 	/* Test lc, lcfirst */
 
 	TEST_SFUNC(380, str_lc, "", 0, "")
@@ -9542,6 +16321,8 @@ int main(int ac, char **av)
 	TEST_ACT(654, !regexpr("", NULL, 0, 0))
 	TEST_EQ (655, regexpr_compile(re, NULL, 0), REG_BADPAT)
 	TEST_EQ (656, regexpr_compile(NULL, "", 0), REG_BADPAT)
+	TEST_EQ (852, regexpr_compile(re, "a", REG_DFA), REG_BADPAT)
+	TEST_ACT(853, errno == EINVAL)
 	TEST_ACT(657, !regexpr_compiled(re, NULL, 0))
 	TEST_ACT(658, !regexpr_compiled(NULL, "", 0))
 	str_destroy(&a);
@@ -9703,7 +16484,7 @@ int main(int ac, char **av)
 	}
 
 	if (errors)
-		printf("%d/757 tests failed\n", errors);
+		printf("%d/862 tests failed\n", errors);
 	else
 		printf("All tests passed\n");
 
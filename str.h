@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+#include <sys/uio.h>
 #include <regex.h>
 
 #include <slack/hdr.h>
@@ -33,6 +34,7 @@
 
 typedef struct String String;
 typedef struct StringTR StringTR;
+typedef struct Regex Regex;
 
 enum StringAlignment
 {
@@ -52,6 +54,10 @@ enum StringTROption
 
 typedef enum StringAlignment StringAlignment;
 typedef enum StringTROption StringTROption;
+typedef int str_regsub_t(String *dst, const char *text, const regmatch_t *match, void *data);
+typedef int regexpr_search_t(void *engine, const char *text, size_t start, size_t end, regmatch_t *match, int eflags);
+
+#define REG_DFA 0x100000 /* use regex_create() instead of regcomp() */
 
 _begin_decls
 String *str_create(const char *format, ...);
@@ -62,10 +68,26 @@ String *str_create_sized(size_t size, const char *format, ...);
 String *str_create_with_locker_sized(Locker *locker, size_t size, const char *format, ...);
 String *str_vcreate_sized(size_t size, const char *format, va_list args);
 String *str_vcreate_with_locker_sized(Locker *locker, size_t size, const char *format, va_list args);
+String *str_create_iovecs(const struct iovec *iov, size_t iovcnt);
+String *str_create_with_locker_iovecs(Locker *locker, const struct iovec *iov, size_t iovcnt);
 String *str_copy(const String *str);
 String *str_copy_unlocked(const String *str);
 String *str_copy_with_locker(Locker *locker, const String *str);
 String *str_copy_with_locker_unlocked(Locker *locker, const String *str);
+String *str_share(const String *str);
+String *str_share_unlocked(const String *str);
+String *str_share_with_locker(Locker *locker, const String *str);
+String *str_share_with_locker_unlocked(Locker *locker, const String *str);
+int str_unshare(String *str);
+int str_unshare_unlocked(String *str);
+String *str_adopt(char *buf, size_t length, size_t size);
+String *str_adopt_with_locker(Locker *locker, char *buf, size_t length, size_t size);
+int str_reserve(String *str, size_t size);
+int str_reserve_unlocked(String *str, size_t size);
+int str_shrink_to_fit(String *str);
+int str_shrink_to_fit_unlocked(String *str);
+int str_set_growth(String *str, int percent);
+int str_set_growth_unlocked(String *str, int percent);
 String *str_fgetline(FILE *stream);
 String *str_fgetline_with_locker(Locker *locker, FILE *stream);
 void str_release(String *str);
@@ -142,6 +164,12 @@ void *tr_destroy(StringTR **table);
 int str_tr_compiled(String *str, StringTR *table);
 int str_tr_compiled_unlocked(String *str, StringTR *table);
 int tr_compiled(char *str, StringTR *table);
+Regex *regex_create(const char *pattern, int cflags);
+Regex *regex_create_with_locker(Locker *locker, const char *pattern, int cflags);
+void regex_release(Regex *regex);
+void *regex_destroy(Regex **regex);
+int regex_exec(Regex *regex, const char *text, size_t length, size_t nmatch, regmatch_t *match, int eflags);
+int regex_is_dfa(const Regex *regex);
 List *str_regexpr(const char *pattern, const String *text, int cflags, int eflags);
 List *str_regexpr_unlocked(const char *pattern, const String *text, int cflags, int eflags);
 List *str_regexpr_with_locker(Locker *locker, const char *pattern, const String *text, int cflags, int eflags);
@@ -160,12 +188,24 @@ String *str_regsub(const char *pattern, const char *replacement, String *text, i
 String *str_regsub_unlocked(const char *pattern, const char *replacement, String *text, int cflags, int eflags, int all);
 String *str_regsub_compiled(const regex_t *compiled, const char *replacement, String *text, int eflags, int all);
 String *str_regsub_compiled_unlocked(const regex_t *compiled, const char *replacement, String *text, int eflags, int all);
+String *str_regsub_callback(const char *pattern, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all);
+String *str_regsub_callback_unlocked(const char *pattern, str_regsub_t *callback, void *data, String *text, int cflags, int eflags, int all);
+String *str_regsub_callback_compiled(const regex_t *compiled, str_regsub_t *callback, void *data, String *text, int eflags, int all);
+String *str_regsub_callback_compiled_unlocked(const regex_t *compiled, str_regsub_t *callback, void *data, String *text, int eflags, int all);
+List *str_regexpr_grep(const char *pattern, const String *text, int cflags, int eflags, int threads, int lines);
+List *str_regexpr_grep_unlocked(const char *pattern, const String *text, int cflags, int eflags, int threads, int lines);
+List *regexpr_grep(const char *pattern, const char *text, size_t length, int cflags, int eflags, int threads, int lines);
+List *regexpr_grep_compiled(const regex_t *compiled, int ncompiled, const char *text, size_t length, int eflags, int lines);
+List *regexpr_grep_callback(regexpr_search_t *search, void **engines, int threads, const char *text, size_t length, int eflags, int lines);
 List *str_fmt(const String *str, size_t line_width, StringAlignment alignment);
 List *str_fmt_unlocked(const String *str, size_t line_width, StringAlignment alignment);
 List *str_fmt_with_locker(Locker *locker, const String *str, size_t line_width, StringAlignment alignment);
 List *str_fmt_with_locker_unlocked(Locker *locker, const String *str, size_t line_width, StringAlignment alignment);
 List *fmt(const char *str, size_t line_width, StringAlignment alignment);
 List *fmt_with_locker(Locker *locker, const char *str, size_t line_width, StringAlignment alignment);
+List *str_fmt_utf8(const String *str, size_t line_width, StringAlignment alignment);
+List *str_fmt_utf8_unlocked(const String *str, size_t line_width, StringAlignment alignment);
+List *fmt_utf8(const char *str, size_t line_width, StringAlignment alignment);
 List *str_split(const String *str, const char *delim);
 List *str_split_unlocked(const String *str, const char *delim);
 List *str_split_with_locker(Locker *locker, const String *str, const char *delim);
@@ -196,6 +236,9 @@ char *trim_left(char *str);
 String *str_trim_right(String *str);
 String *str_trim_right_unlocked(String *str);
 char *trim_right(char *str);
+String *str_trim_utf8(String *str);
+String *str_trim_utf8_unlocked(String *str);
+char *trim_utf8(char *str);
 String *str_squeeze(String *str);
 String *str_squeeze_unlocked(String *str);
 char *squeeze(char *str);
@@ -223,6 +266,28 @@ String *encode(const char *str, const char *uncoded, const char *coded, char quo
 String *encode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable);
 String *decode(const char *str, const char *uncoded, const char *coded, char quote_char, int printable);
 String *decode_with_locker(Locker *locker, const char *str, const char *uncoded, const char *coded, char quote_char, int printable);
+String *str_hex_encode(const String *str);
+String *str_hex_encode_unlocked(const String *str);
+String *str_hex_decode(const String *str);
+String *str_hex_decode_unlocked(const String *str);
+String *str_base64_encode(const String *str, int url);
+String *str_base64_encode_unlocked(const String *str, int url);
+String *str_base64_decode(const String *str, int url);
+String *str_base64_decode_unlocked(const String *str, int url);
+ssize_t hex_encode(char *dst, const void *src, size_t length);
+ssize_t hex_decode(void *dst, const char *src, size_t length);
+ssize_t base64_encode(char *dst, const void *src, size_t length, int url);
+ssize_t base64_decode(void *dst, const char *src, size_t length, int url);
+int str_utf8_valid(const String *str, size_t *error);
+int str_utf8_valid_unlocked(const String *str, size_t *error);
+ssize_t str_utf8_length(const String *str);
+ssize_t str_utf8_length_unlocked(const String *str);
+String *str_utf8_truncate(String *str, size_t length);
+String *str_utf8_truncate_unlocked(String *str, size_t length);
+int utf8_valid(const char *str, size_t length, size_t *error);
+size_t utf8_length(const char *str, size_t length);
+size_t utf8_boundary(const char *str, size_t length, size_t max);
+char *utf8_truncate(char *str, size_t length);
 String *str_lc(String *str);
 String *str_lc_unlocked(String *str);
 char *lc(char *str);
@@ -250,6 +315,9 @@ int hex(const char *str);
 int str_oct(const String *str);
 int str_oct_unlocked(const String *str);
 int oct(const char *str);
+ssize_t parse_ulong(const char *str, size_t length, int base, unsigned long *value);
+ssize_t parse_long(const char *str, size_t length, int base, long *value);
+ssize_t parse_double(const char *str, size_t length, double *value);
 int strcasecmp(const char *s1, const char *s2);
 int strncasecmp(const char *s1, const char *s2, size_t n);
 #ifndef strlcpy /* This is now a macro on OSX/macOS */
@@ -268,6 +336,29 @@ int asprintf(char **str, const char *format, ...);
 int vasprintf(char **str, const char *format, va_list args);
 _end_decls
 
+/* Don't look below here - optimisations only */
+
+struct String
+{
+	size_t size;    /* number of bytes allocated */
+	size_t length;  /* number of bytes used (including nul) */
+	char *str;      /* vector of characters */
+	Locker *locker; /* locking strategy for this string */
+	size_t reserve; /* minimum number of bytes to keep allocated */
+	int growth;     /* percentage to grow by when full */
+	int adopted;    /* whether str was adopted (and is never shared) */
+};
+
+#if defined(INLINE_ACCESSORS) || defined(NO_LOCKERS)
+#define str_length_unlocked(s) ((s) ? (ssize_t)(s)->length - 1 : (str_length_unlocked)(s))
+#define cstr(s) ((s) ? (s)->str : (cstr)(s))
+#ifdef NO_LOCKERS
+#define str_length(s) str_length_unlocked(s)
+#else
+#define str_length(s) (((s) && !(s)->locker) ? (ssize_t)(s)->length - 1 : (str_length)(s))
+#endif
+#endif
+
 #endif
 
 /* vi:set ts=4 sw=4: */
@@ -0,0 +1,1199 @@
+/*
+* libslack - https://libslack.org
+*
+* Copyright (C) 1999-2004, 2010, 2020-2023 raf <raf@raf.org>
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see <https://www.gnu.org/licenses/>.
+*
+* 20230824 raf <raf@raf.org>
+*/
+
+/*
+
+=head1 NAME
+
+I<bench-slack> - libslack benchmarks
+
+=head1 SYNOPSIS
+
+    bench-slack [-r rounds] [-n max] [-f filter] [-b baseline] [-t percent]
+
+=head1 DESCRIPTION
+
+I<bench-slack> runs micro and macro benchmarks of the I<list(3)>, I<map(3)>,
+I<shm(3)>, I<hash(3)>, I<filter(3)>, I<str(3)>, I<mem(3)> (pools), I<net(3)>
+(I<pack(3)> and I<unpack(3)>), I<msg(3)> and I<agent(3)> modules. It is
+built and run with C<make bench> (or C<make bench-slack>) in the libslack
+source directory. Extra arguments can be passed with C<BENCH_ARGS>, e.g.
+C<make bench BENCH_ARGS="-n 100000000">.
+
+Each benchmark is run several times (rounds), and only the operations
+themselves are timed (not any setup or cleanup). The output has one line
+per benchmark, with the benchmark name (including the number of items
+involved), the number of operations per round, the operations per second
+and nanoseconds per operation of the median round, and the 50th, 90th and
+99th percentiles (over the rounds) of the nanoseconds per operation. Lines
+starting with C<#> are comments. Save the output to use it as a baseline
+later.
+
+=head1 OPTIONS
+
+=over 4
+
+=item C<-r> I<rounds>
+
+The number of times to run each benchmark (default C<7>).
+
+=item C<-n> I<max>
+
+The number of items in the largest containers (default C<1000000>). I<Map>
+benchmarks run at every power of 10 from C<1000> up to I<max> (e.g.
+C<100000000>, if there's enough memory).
+
+=item C<-f> I<filter>
+
+Only run the benchmarks whose names contain I<filter>.
+
+=item C<-b> I<baseline>
+
+Compare the results with the output of a previous run in the file
+I<baseline>. Each line then includes the baseline's median nanoseconds per
+operation and the change as a percentage. Benchmarks that have become
+slower by more than the threshold are marked with C<REGRESSION>, and the
+exit status is C<1>.
+
+=item C<-t> I<percent>
+
+The threshold for regressions (default C<10>).
+
+=back
+
+=cut
+
+*/
+
+#include <slack/std.h>
+#include <slack/agent.h>
+#include <slack/err.h>
+#include <slack/filter.h>
+#include <slack/hash.h>
+#include <slack/list.h>
+#include <slack/map.h>
+#include <slack/mem.h>
+#include <slack/msg.h>
+#include <slack/net.h>
+#include <slack/rope.h>
+#include <slack/shm.h>
+#include <slack/str.h>
+
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+
+typedef unsigned long long nsec_t;
+typedef nsec_t bench_t(size_t n);
+
+#define BENCH_MAX_ROUNDS 101
+#define BENCH_MAX_BASELINE 1024
+#define BENCH_NAME 64
+
+static struct
+{
+	int rounds;                /* times to run each benchmark */
+	size_t max;                /* largest number of items */
+	const char *filter;        /* only run benchmarks whose names contain this */
+	double threshold;          /* regression threshold (percent) */
+	int baselines;             /* number of baseline results */
+	char baseline_name[BENCH_MAX_BASELINE][BENCH_NAME]; /* baseline benchmark names */
+	double baseline_nsec[BENCH_MAX_BASELINE];            /* baseline ns/op */
+	int regressions;           /* number of regressions found */
+	nsec_t start;              /* when the timed part of a benchmark started */
+}
+g =
+{
+	7, 1000000, NULL, 10.0, 0, { "" }, { 0.0 }, 0, 0
+};
+
+/*
+
+C<static nsec_t now(void)>
+
+Returns the current (monotonic, if possible) time in nanoseconds.
+
+*/
+
+static nsec_t now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts[1];
+
+	if (clock_gettime(CLOCK_MONOTONIC, ts) == 0)
+		return (nsec_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+#endif
+	{
+		struct timeval tv[1];
+
+		gettimeofday(tv, NULL);
+
+		return (nsec_t)tv->tv_sec * 1000000000 + tv->tv_usec * 1000;
+	}
+}
+
+#define START() (g.start = now())
+#define STOP() (now() - g.start)
+
+/*
+
+C<static char **make_keys(size_t n)>
+
+Returns C<n> distinct strings to use as keys, or exits on error.
+
+*/
+
+static char **make_keys(size_t n)
+{
+	char **keys;
+	char *buf;
+	size_t i;
+
+	if (!(keys = mem_create(n, char *)) || !(buf = mem_create(n * 12, char)))
+		fatalsys("bench-slack: out of memory");
+
+	for (i = 0; i < n; ++i)
+	{
+		keys[i] = buf + i * 12;
+		snprintf(keys[i], 12, "k%lu", (unsigned long)i);
+	}
+
+	return keys;
+}
+
+static void free_keys(char **keys)
+{
+	mem_release(keys[0]);
+	mem_release(keys);
+}
+
+/* List benchmarks */
+
+static nsec_t bench_list_append(size_t n)
+{
+	List *list = list_create(NULL);
+	nsec_t nsec;
+	size_t i;
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		list_append(list, list);
+
+	nsec = STOP();
+	list_release(list);
+
+	return nsec;
+}
+
+static nsec_t bench_list_shift(size_t n)
+{
+	List *list = list_create(NULL);
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		list_append(list, list);
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		list_shift(list);
+
+	nsec = STOP();
+	list_release(list);
+
+	return nsec;
+}
+
+static nsec_t bench_list_push_pop(size_t n)
+{
+	List *list = list_create(NULL);
+	nsec_t nsec;
+	size_t i;
+
+	/* Oscillate around a power of two boundary */
+
+	for (i = 0; i < 1023; ++i)
+		list_append(list, list);
+
+	START();
+
+	for (i = 0; i < n; ++i)
+	{
+		list_push(list, list);
+		list_push(list, list);
+		list_pop(list);
+		list_pop(list);
+	}
+
+	nsec = STOP();
+	list_release(list);
+
+	return nsec;
+}
+
+static int is_even(void *item, size_t *index, void *data)
+{
+	return !(*index & 1);
+}
+
+static nsec_t bench_list_retain(size_t n)
+{
+	List *list = list_create(NULL);
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		list_append(list, list);
+
+	START();
+	list_retain(list, is_even, NULL);
+	nsec = STOP();
+	list_release(list);
+
+	return nsec;
+}
+
+static int cmp_longs(void * const *a, void * const *b)
+{
+	return (*a > *b) - (*a < *b);
+}
+
+static nsec_t bench_list_bsearch(size_t n)
+{
+	List *list = list_create(NULL);
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		list_append(list, (void *)(long)(i << 1));
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		list_bsearch(list, (void *)(long)((i * 7919 % n) << 1), (list_cmp_t *)cmp_longs);
+
+	nsec = STOP();
+	list_release(list);
+
+	return nsec;
+}
+
+static int cmp_keys(const char **a, const char **b)
+{
+	return strcmp(*a, *b);
+}
+
+static nsec_t bench_list_sort(size_t n)
+{
+	List *list = list_create(NULL);
+	char **keys = make_keys(n);
+	nsec_t nsec;
+	size_t i;
+
+	srand(1);
+
+	for (i = 0; i < n; ++i)
+		list_append(list, keys[rand() % n]);
+
+	START();
+	list_sort(list, (list_cmp_t *)cmp_keys);
+	nsec = STOP();
+
+	list_release(list);
+	free_keys(keys);
+
+	return nsec;
+}
+
+/* Map benchmarks */
+
+static nsec_t bench_map_add(size_t n)
+{
+	Map *map = map_create(NULL);
+	char **keys = make_keys(n);
+	nsec_t nsec;
+	size_t i;
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		map_add(map, keys[i], keys[i]);
+
+	nsec = STOP();
+
+	map_release(map);
+	free_keys(keys);
+
+	return nsec;
+}
+
+static nsec_t bench_map_get(size_t n)
+{
+	Map *map = map_create(NULL);
+	char **keys = make_keys(n);
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		map_add(map, keys[i], keys[i]);
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		map_get(map, keys[(i * 7919) % n]);
+
+	nsec = STOP();
+
+	map_release(map);
+	free_keys(keys);
+
+	return nsec;
+}
+
+static void count_mapping(void *key, void *value, void *data)
+{
+	__atomic_add_fetch((size_t *)data, strlen(key), __ATOMIC_RELAXED);
+}
+
+static nsec_t bench_map_apply(size_t n, int threads)
+{
+	Map *map = map_create(NULL);
+	char **keys = make_keys(n);
+	size_t i, count = 0;
+	nsec_t nsec;
+
+	for (i = 0; i < n; ++i)
+		map_add(map, keys[i], keys[i]);
+
+	START();
+
+	if (threads)
+		map_apply_parallel(map, count_mapping, &count, threads);
+	else
+		map_apply_rdlocked(map, count_mapping, &count);
+
+	nsec = STOP();
+
+	map_release(map);
+	free_keys(keys);
+
+	return nsec;
+}
+
+static nsec_t bench_map_apply_rdlocked(size_t n)
+{
+	return bench_map_apply(n, 0);
+}
+
+static nsec_t bench_map_apply_parallel(size_t n)
+{
+	return bench_map_apply(n, 4);
+}
+
+static nsec_t bench_map_snapshot(size_t n)
+{
+	Map *map = map_create(NULL);
+	char **keys = make_keys(n);
+	MapSnapshot *snapshot;
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		map_add(map, keys[i], keys[i]);
+
+	START();
+	snapshot = map_snapshot(map);
+	nsec = STOP();
+
+	map_snapshot_release(snapshot);
+	map_release(map);
+	free_keys(keys);
+
+	return nsec;
+}
+
+static nsec_t bench_map_get_hash_map_str(size_t n)
+{
+	Map *map = map_create_with_hash(hash_map_str, NULL);
+	char **keys = make_keys(n);
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		map_add(map, keys[i], keys[i]);
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		map_get(map, keys[(i * 7919) % n]);
+
+	nsec = STOP();
+
+	map_release(map);
+	free_keys(keys);
+
+	return nsec;
+}
+
+static nsec_t bench_shm_map_get(size_t n)
+{
+	Shm *shm = shm_create(NULL, 1024 * 1024 + n * 128, 0);
+	ShmMap *map = shm_map_create(shm, n);
+	char **keys = make_keys(n);
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		shm_map_put(shm, map, keys[i], &i, sizeof i);
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		shm_map_get(shm, map, keys[(i * 7919) % n], NULL);
+
+	nsec = STOP();
+
+	shm_destroy(&shm);
+	free_keys(keys);
+
+	return nsec;
+}
+
+/* Hash benchmarks (n bytes) */
+
+static nsec_t bench_bloom_test(size_t n)
+{
+	Bloom *bloom = bloom_create(n, 0.01);
+	char **keys = make_keys(2 * n);
+	volatile int hits = 0;
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		bloom_add_unlocked(bloom, keys[i], strlen(keys[i]));
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		hits += bloom_test(bloom, keys[n + (i * 7919) % n], strlen(keys[n + (i * 7919) % n]));
+
+	nsec = STOP();
+
+	bloom_release(bloom);
+	free_keys(keys);
+
+	return nsec;
+}
+
+static nsec_t bench_cuckoo_test(size_t n)
+{
+	Cuckoo *cuckoo = cuckoo_create(n, 0.01);
+	char **keys = make_keys(2 * n);
+	volatile int hits = 0;
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		cuckoo_add_unlocked(cuckoo, keys[i], strlen(keys[i]));
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		hits += cuckoo_test_unlocked(cuckoo, keys[n + (i * 7919) % n], strlen(keys[n + (i * 7919) % n]));
+
+	nsec = STOP();
+
+	cuckoo_release(cuckoo);
+	free_keys(keys);
+
+	return nsec;
+}
+
+static nsec_t bench_hash_bytes(size_t n)
+{
+	char *buf;
+	volatile unsigned long long h;
+	nsec_t nsec;
+
+	if (!(buf = mem_create(n, char)))
+		fatalsys("bench-slack: out of memory");
+
+	memset(buf, 'x', n);
+
+	START();
+	h = hash_bytes(buf, n, 0);
+	nsec = STOP();
+
+	(void)h;
+	mem_release(buf);
+
+	return nsec;
+}
+
+static nsec_t bench_hash_crc32c(size_t n)
+{
+	char *buf;
+	volatile unsigned int crc;
+	nsec_t nsec;
+
+	if (!(buf = mem_create(n, char)))
+		fatalsys("bench-slack: out of memory");
+
+	memset(buf, 'x', n);
+
+	START();
+	crc = hash_crc32c(0, buf, n);
+	nsec = STOP();
+
+	(void)crc;
+	mem_release(buf);
+
+	return nsec;
+}
+
+/* String benchmarks */
+
+static nsec_t bench_str_append(size_t n)
+{
+	String *str = str_create("");
+	nsec_t nsec;
+	size_t i;
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		str_append(str, "x");
+
+	nsec = STOP();
+	str_release(str);
+
+	return nsec;
+}
+
+static nsec_t bench_str_copy(size_t n)
+{
+	String *str = str_create("%*s", 65536, "payload");
+	nsec_t nsec;
+	size_t i;
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		str_release(str_copy(str));
+
+	nsec = STOP();
+	str_release(str);
+
+	return nsec;
+}
+
+static nsec_t bench_str_share(size_t n)
+{
+	String *str = str_create("%*s", 65536, "payload");
+	nsec_t nsec;
+	size_t i;
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		str_release(str_share(str));
+
+	nsec = STOP();
+	str_release(str);
+
+	return nsec;
+}
+
+/*
+
+C<static String *make_text(size_t n)>
+
+Returns a string of C<n> comma separated words.
+
+*/
+
+static String *make_text(size_t n)
+{
+	String *str = str_create("");
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		str_append(str, i ? ",word%lu" : "word%lu", (unsigned long)i % 100);
+
+	return str;
+}
+
+static nsec_t bench_str_split(size_t n)
+{
+	String *text = make_text(n);
+	List *list;
+	nsec_t nsec;
+
+	START();
+	list = str_split(text, ",");
+	nsec = STOP();
+
+	list_release(list);
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_str_regsub(size_t n)
+{
+	String *text = make_text(n);
+	regex_t compiled[1];
+	nsec_t nsec;
+
+	regexpr_compile(compiled, "word([0-9])", REG_EXTENDED);
+
+	START();
+	str_regsub_compiled(compiled, "W$1", text, 0, 1);
+	nsec = STOP();
+
+	regfree(compiled);
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_str_regsub_dfa(size_t n)
+{
+	String *text = make_text(n);
+	nsec_t nsec;
+
+	START();
+	str_regsub("word([0-9])", "W$1", text, REG_DFA, 0, 1);
+	nsec = STOP();
+
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_regexpr_grep(size_t n)
+{
+	String *text = make_text(n);
+	List *list;
+	nsec_t nsec;
+
+	str_tr(text, ",", "\n", 0);
+
+	START();
+	list = regexpr_grep("word(1|2)7", cstr(text), str_length(text), REG_NEWLINE | REG_DFA, 0, 0, 1);
+	nsec = STOP();
+
+	list_release(list);
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_str_encode(size_t n)
+{
+	String *text = make_text(n);
+	String *encoded;
+	nsec_t nsec;
+
+	START();
+	encoded = str_encode(text, "\a\b\t\n\v\f\r\\", "abtnvfr\\", '\\', 1);
+	nsec = STOP();
+
+	str_release(encoded);
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_str_base64(size_t n)
+{
+	String *text = make_text(n);
+	String *encoded, *decoded;
+	nsec_t nsec;
+
+	START();
+	encoded = str_base64_encode(text, 0);
+	decoded = str_base64_decode(encoded, 0);
+	nsec = STOP();
+
+	str_release(decoded);
+	str_release(encoded);
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_utf8_valid(size_t n)
+{
+	String *text = str_create("");
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		str_append(text, (i % 4) ? "word%lu," : "w\xc3\xb6rd \xe2\x82\xac%lu,", (unsigned long)i % 100);
+
+	START();
+	utf8_valid(cstr(text), str_length(text), NULL);
+	str_utf8_length(text);
+	nsec = STOP();
+
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_rope_insert(size_t n)
+{
+	String *text = make_text(n);
+	Rope *rope = rope_create(cstr(text), str_length(text));
+	size_t length = str_length(text);
+	nsec_t nsec;
+	size_t i;
+
+	START();
+
+	for (i = 0; i < n; ++i)
+	{
+		rope_insert(rope, (i * 7919) % length, "x", 1);
+		rope_remove_range(rope, (i * 104729) % length, 1);
+	}
+
+	nsec = STOP();
+
+	rope_release(rope);
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_parse_double(size_t n)
+{
+	String *text = str_create("");
+	const char *s, *end;
+	nsec_t nsec;
+	double d;
+	ssize_t len;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		str_append(text, "%.17g,%lu,", (double)i / 7.0, (unsigned long)i * 2654435761UL);
+
+	START();
+
+	for (s = cstr(text), end = s + str_length(text); s < end; s += len + 1)
+	{
+		if ((len = parse_double(s, end - s, &d)) == -1)
+			break;
+	}
+
+	nsec = STOP();
+
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_str_regexpr(size_t n)
+{
+	String *text = make_text(100);
+	regex_t compiled[1];
+	List *list;
+	nsec_t nsec;
+	size_t i;
+
+	regexpr_compile(compiled, "word9[0-9]x", REG_EXTENDED);
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		if ((list = str_regexpr_compiled(compiled, text, 0)))
+			list_release(list);
+
+	nsec = STOP();
+
+	regfree(compiled);
+	str_release(text);
+
+	return nsec;
+}
+
+static nsec_t bench_str_tr(size_t n)
+{
+	String *text = str_create("%*s", (int)n, "");
+	char *s = cstr(text);
+	nsec_t nsec;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		s[i] = 'a' + i % 26;
+
+	START();
+	str_tr(text, "a-z", "A-Z", 0);
+	nsec = STOP();
+
+	str_release(text);
+
+	return nsec;
+}
+
+/* Pool benchmarks */
+
+static nsec_t bench_pool_alloc(size_t n)
+{
+	Pool *pool = pool_create(n * 32);
+	nsec_t nsec;
+	size_t i;
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		pool_alloc(pool, 32);
+
+	nsec = STOP();
+	pool_release(pool);
+
+	return nsec;
+}
+
+/* Pack/unpack benchmarks */
+
+static nsec_t bench_pack(size_t n)
+{
+	char buf[64];
+	nsec_t nsec;
+	size_t i;
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		pack(buf, sizeof buf, "csiz8", 'c', 12345, (int)i, "slack");
+
+	nsec = STOP();
+
+	return nsec;
+}
+
+static nsec_t bench_unpack(size_t n)
+{
+	char buf[64], z[8];
+	short s;
+	int num;
+	char c;
+	nsec_t nsec;
+	size_t i;
+
+	pack(buf, sizeof buf, "csiz8", 'c', 12345, 1, "slack");
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		unpack(buf, sizeof buf, "csiz8", &c, &s, &num, z);
+
+	nsec = STOP();
+
+	return nsec;
+}
+
+/* Message benchmarks */
+
+static nsec_t bench_msg_out(size_t n)
+{
+	Msg *msg;
+	nsec_t nsec;
+	size_t i;
+	int fd;
+
+	if ((fd = open("/dev/null", O_WRONLY)) == -1 || !(msg = msg_create_fd(fd)))
+		fatalsys("bench-slack: failed to open /dev/null");
+
+	START();
+
+	for (i = 0; i < n; ++i)
+		msg_out(msg, "message %lu\n", (unsigned long)i);
+
+	nsec = STOP();
+	msg_release(msg);
+
+	return nsec;
+}
+
+/* Agent benchmarks */
+
+static size_t agent_todo;
+
+static int agent_bench_action(Agent *agent, void *arg)
+{
+	if (--agent_todo == 0)
+		return agent_stop(agent);
+
+	return agent_schedule(agent, 0, 0, agent_bench_action, arg) ? 0 : -1;
+}
+
+static nsec_t bench_agent_schedule(size_t n)
+{
+	Agent *agent = agent_create();
+	nsec_t nsec;
+
+	agent_todo = n;
+	agent_schedule(agent, 0, 0, agent_bench_action, NULL);
+
+	START();
+	agent_start(agent);
+	nsec = STOP();
+
+	agent_release(agent);
+
+	return nsec;
+}
+
+static int agent_bench_reaction(Agent *agent, int fd, int revents, void *arg)
+{
+	int *pipefd = (int *)arg;
+	char c;
+
+	if (read(fd, &c, 1) != 1)
+		return -1;
+
+	if (--agent_todo == 0)
+		return agent_stop(agent);
+
+	return (write(pipefd[1], &c, 1) == 1) ? 0 : -1;
+}
+
+static nsec_t bench_agent_react(size_t n)
+{
+	Agent *agent = agent_create();
+	int pipefd[2];
+	nsec_t nsec;
+
+	if (pipe(pipefd) == -1)
+		fatalsys("bench-slack: pipe() failed");
+
+	agent_todo = n;
+	agent_connect(agent, pipefd[0], R_OK, agent_bench_reaction, pipefd);
+
+	if (write(pipefd[1], "x", 1) != 1)
+		fatalsys("bench-slack: write() failed");
+
+	START();
+	agent_start(agent);
+	nsec = STOP();
+
+	agent_release(agent);
+	close(pipefd[0]);
+	close(pipefd[1]);
+
+	return nsec;
+}
+
+/*
+
+C<static int cmp_double(const double *a, const double *b)>
+
+Compares two doubles for I<qsort(3)>.
+
+*/
+
+static int cmp_double(const double *a, const double *b)
+{
+	return (*a < *b) ? -1 : (*a > *b) ? 1 : 0;
+}
+
+/*
+
+C<static double percentile(const double *sorted, int count, int percent)>
+
+Returns the C<percent>th percentile (nearest rank) of the C<count> values in
+C<sorted>.
+
+*/
+
+static double percentile(const double *sorted, int count, int percent)
+{
+	int rank = (percent * count + 99) / 100;
+
+	return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+/*
+
+C<static void run(const char *label, bench_t *bench, size_t n, size_t ops)>
+
+Runs the benchmark, C<bench>, over C<n> items (performing C<ops> operations
+each round) for the configured number of rounds, and prints the results
+(compared with the baseline, if there is one).
+
+*/
+
+static void run(const char *label, bench_t *bench, size_t n, size_t ops)
+{
+	double nsec[BENCH_MAX_ROUNDS];
+	char name[BENCH_NAME];
+	double median;
+	int round, i;
+
+	snprintf(name, BENCH_NAME, "%s/%lu", label, (unsigned long)n);
+
+	if (g.filter && !strstr(name, g.filter))
+		return;
+
+	for (round = 0; round < g.rounds; ++round)
+		nsec[round] = (double)bench(n) / ops;
+
+	qsort(nsec, g.rounds, sizeof *nsec, (int (*)(const void *, const void *))cmp_double);
+	median = percentile(nsec, g.rounds, 50);
+
+	printf("%-28s %10lu %14.1f %10.2f %10.2f %10.2f %10.2f", name, (unsigned long)ops, 1e9 / median, median, median, percentile(nsec, g.rounds, 90), percentile(nsec, g.rounds, 99));
+
+	for (i = 0; i < g.baselines; ++i)
+	{
+		if (!strcmp(g.baseline_name[i], name))
+		{
+			double change = (median / g.baseline_nsec[i] - 1.0) * 100.0;
+
+			printf(" %10.2f %+7.1f%%", g.baseline_nsec[i], change);
+
+			if (change > g.threshold)
+				printf(" REGRESSION"), ++g.regressions;
+
+			break;
+		}
+	}
+
+	printf("\n");
+	fflush(stdout);
+}
+
+/*
+
+C<static void load_baseline(const char *path)>
+
+Loads the results of a previous run from C<path>, or exits on error.
+
+*/
+
+static void load_baseline(const char *path)
+{
+	char line[BUFSIZ];
+	FILE *baseline;
+
+	if (!(baseline = fopen(path, "r")))
+		fatalsys("bench-slack: failed to open %s", path);
+
+	while (g.baselines < BENCH_MAX_BASELINE && fgets(line, BUFSIZ, baseline))
+	{
+		if (*line == '#')
+			continue;
+
+		if (sscanf(line, "%63s %*s %*s %lf", g.baseline_name[g.baselines], &g.baseline_nsec[g.baselines]) == 2 && g.baseline_nsec[g.baselines] > 0.0)
+			++g.baselines;
+	}
+
+	fclose(baseline);
+}
+
+int main(int ac, char **av)
+{
+	size_t n, small;
+	int c;
+
+	while ((c = getopt(ac, av, "r:n:f:b:t:")) != -1)
+	{
+		switch (c)
+		{
+			case 'r': g.rounds = atoi(optarg); break;
+			case 'n': g.max = (size_t)atof(optarg); break;
+			case 'f': g.filter = optarg; break;
+			case 'b': load_baseline(optarg); break;
+			case 't': g.threshold = atof(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-r rounds] [-n max] [-f filter] [-b baseline] [-t percent]\n", *av);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (g.rounds < 1 || g.rounds > BENCH_MAX_ROUNDS || g.max < 1000)
+	{
+		fprintf(stderr, "%s: rounds must be 1 to %d, max must be at least 1000\n", *av, BENCH_MAX_ROUNDS);
+		return EXIT_FAILURE;
+	}
+
+	/* The quadratic, or slow per item, benchmarks use fewer items */
+
+	small = (g.max < 10000) ? g.max : 10000;
+
+	printf("# bench-slack rounds=%d max=%lu\n", g.rounds, (unsigned long)g.max);
+	printf("# %-26s %10s %14s %10s %10s %10s %10s%s\n", "benchmark", "ops", "ops/s", "ns/op", "p50", "p90", "p99", g.baselines ? "   baseline  change" : "");
+
+	run("list_append", bench_list_append, g.max, g.max);
+	run("list_shift", bench_list_shift, small, small);
+	run("list_push_pop", bench_list_push_pop, g.max, g.max);
+	run("list_retain", bench_list_retain, g.max, g.max);
+	run("list_bsearch", bench_list_bsearch, g.max, g.max);
+	run("list_sort", bench_list_sort, g.max, g.max);
+
+	for (n = 1000; n <= g.max; n *= 10)
+	{
+		run("map_add", bench_map_add, n, n);
+		run("map_get", bench_map_get, n, n);
+	}
+
+	run("map_get_hash_map_str", bench_map_get_hash_map_str, g.max, g.max);
+	run("map_apply_rdlocked", bench_map_apply_rdlocked, g.max, g.max);
+	run("map_apply_parallel", bench_map_apply_parallel, g.max, g.max);
+	run("map_snapshot", bench_map_snapshot, g.max, g.max);
+	run("shm_map_get", bench_shm_map_get, g.max, g.max);
+
+	run("hash_bytes", bench_hash_bytes, g.max, g.max);
+	run("hash_crc32c", bench_hash_crc32c, g.max, g.max);
+	run("bloom_test", bench_bloom_test, g.max, g.max);
+	run("cuckoo_test", bench_cuckoo_test, g.max, g.max);
+
+	run("str_append", bench_str_append, g.max, g.max);
+	run("str_copy", bench_str_copy, g.max, g.max);
+	run("str_share", bench_str_share, g.max, g.max);
+	run("str_split", bench_str_split, g.max, g.max);
+	run("str_regsub", bench_str_regsub, g.max, g.max);
+	run("str_regsub_dfa", bench_str_regsub_dfa, g.max, g.max);
+	run("regexpr_grep", bench_regexpr_grep, g.max, g.max);
+	run("str_regexpr", bench_str_regexpr, small, small);
+	run("str_tr", bench_str_tr, g.max, g.max);
+	run("str_encode", bench_str_encode, g.max, g.max);
+	run("str_base64", bench_str_base64, g.max, g.max);
+	run("utf8_valid", bench_utf8_valid, g.max, g.max);
+	run("parse_double", bench_parse_double, g.max, g.max);
+	run("rope_insert", bench_rope_insert, g.max, g.max);
+	run("pool_alloc", bench_pool_alloc, g.max, g.max);
+	run("pack", bench_pack, g.max, g.max);
+	run("unpack", bench_unpack, g.max, g.max);
+	run("msg_out", bench_msg_out, g.max, g.max);
+	run("agent_schedule", bench_agent_schedule, g.max, g.max);
+	run("agent_react", bench_agent_react, small, small);
+
+	if (g.regressions)
+		printf("# %d regression%s (threshold %g%%)\n", g.regressions, (g.regressions == 1) ? "" : "s", g.threshold);
+
+	return g.regressions ? 1 : EXIT_SUCCESS;
+}
+
+/* vi:set ts=4 sw=4: */